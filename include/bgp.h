@@ -0,0 +1,86 @@
+/* bgp.h: BGP-4 wire format definitions (RFC 4271) shared by the BGP speaker and its
+ * helper modules. Wire structs are packed so their layout matches the bytes on the
+ * wire exactly and can be overlaid on receive buffers without padding surprises. Like
+ * the standard form every library uses for its book-sharing paperwork. */
+
+#ifndef BGP_H
+#define BGP_H
+
+#include <stdint.h> /* For uint8_t, uint16_t, uint32_t */
+
+/* BGP message types (per RFC 4271) */
+#define BGP_OPEN 1
+#define BGP_UPDATE 2
+#define BGP_NOTIFICATION 3
+#define BGP_KEEPALIVE 4
+
+/* NOTIFICATION error codes (RFC 4271 section 4.5) */
+#define BGP_ERR_HEADER 1        /* Message Header Error */
+#define BGP_ERR_OPEN 2          /* OPEN Message Error */
+#define BGP_ERR_UPDATE 3        /* UPDATE Message Error */
+#define BGP_ERR_HOLD_TIMER 4    /* Hold Timer Expired */
+#define BGP_ERR_FSM 5           /* Finite State Machine Error */
+#define BGP_ERR_CEASE 6         /* Cease */
+
+/* Message Header Error subcodes */
+#define BGP_ERR_HDR_SYNC 1      /* Connection Not Synchronized */
+#define BGP_ERR_HDR_LENGTH 2    /* Bad Message Length */
+#define BGP_ERR_HDR_TYPE 3      /* Bad Message Type */
+
+/* OPEN optional parameters and capabilities (RFC 5492, RFC 4760, RFC 6793) */
+#define BGP_OPT_CAPABILITIES 2  /* Optional parameter carrying capabilities */
+#define BGP_CAP_MP 1            /* Multiprotocol extensions (AFI/SAFI) */
+#define BGP_CAP_AS4 65          /* Support for 4-octet AS numbers */
+#define BGP_AS_TRANS 23456      /* 2-octet stand-in for a 4-octet AS */
+
+/* Message size limits */
+#define BGP_HEADER_LEN 19       /* Fixed header on the wire */
+#define BGP_OPEN_LEN 29         /* OPEN without optional parameters */
+#define BGP_MAX_MESSAGE 4096    /* Maximum message length */
+
+/* BGP message header (19 bytes) */
+struct bgp_header {
+    uint8_t marker[16]; /* All 1s (0xFF) for synchronization */
+    uint16_t length;    /* Message length (including header) */
+    uint8_t type;       /* Message type (OPEN, UPDATE, etc.) */
+} __attribute__((packed));
+
+/* BGP OPEN message (variable length, minimum 29 bytes) */
+struct bgp_open {
+    struct bgp_header header; /* Common header */
+    uint8_t version;          /* BGP version (4) */
+    uint16_t my_as;           /* My Autonomous System number */
+    uint16_t hold_time;       /* Hold time in seconds (e.g., 180) */
+    uint32_t bgp_id;          /* BGP Identifier (IP address as integer) */
+    uint8_t opt_param_len;    /* Length of optional parameters */
+    /* Optional parameters follow */
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct bgp_header) == BGP_HEADER_LEN, "bgp_header must match the wire");
+_Static_assert(sizeof(struct bgp_open) == BGP_OPEN_LEN, "bgp_open must match the wire");
+
+/* Read a big-endian 16-bit value from an unaligned position */
+static inline uint16_t bgp_get16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/* Read a big-endian 32-bit value from an unaligned position */
+static inline uint32_t bgp_get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Write a big-endian 16-bit value to an unaligned position */
+static inline void bgp_put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+/* Write a big-endian 32-bit value to an unaligned position */
+static inline void bgp_put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+#endif /* BGP_H */
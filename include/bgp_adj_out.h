@@ -0,0 +1,119 @@
+/* bgp_adj_out.h: Adj-RIB-Out and update groups for the BGP speaker. Peers whose
+ * outbound policy is the same (eBGP or iBGP, 4-octet AS support, next hop) share
+ * one update group. The group keeps one Adj-RIB-Out, collects Loc-RIB changes,
+ * and at flush time sorts them by interned attribute set, so each set is encoded
+ * once, for the members' AS width, and followed by as many NLRI as fit in a
+ * 4096-byte UPDATE. The UPDATEs go into reference-counted chunks that are queued,
+ * unchanged, on every member's output queue. Peers that join are sent the whole
+ * table in one shared pass.
+ * Like a librarian photocopying one newsletter for every branch on the list
+ * instead of writing each branch its own letter. */
+
+#ifndef BGP_ADJ_OUT_H
+#define BGP_ADJ_OUT_H
+
+#include <stddef.h>       /* For size_t */
+#include <stdint.h>       /* For uint32_t, uint8_t */
+#include "bgp_attr.h"     /* For struct bgp_attrs, struct bgp_attr_table */
+#include "bgp_rib.h"      /* For struct bgp_dest */
+#include "prefix_trie.h"  /* For struct ptrie */
+
+/* Bytes of UPDATEs carried per output chunk */
+#define BGP_OUT_CHUNK_SIZE (64 * 1024)
+
+/* A run of encoded messages shared by every queue it is on */
+struct bgp_out_chunk {
+    unsigned refcnt; /* Queues (and builders) holding the chunk */
+    size_t len;      /* Bytes used in data[] */
+    uint8_t data[];  /* Complete BGP messages back to back */
+};
+
+/* Per-peer output queue of chunks awaiting the socket */
+struct bgp_outq {
+    struct bgp_out_chunk **chunks; /* Ring of queued chunks */
+    size_t head;                   /* Index of the oldest chunk */
+    size_t count;                  /* Chunks queued */
+    size_t cap;                    /* Ring capacity (power of two) */
+    size_t off;                    /* Bytes of the oldest chunk already written */
+    size_t bytes;                  /* Bytes queued in total */
+};
+
+/* A change waiting to be advertised by a group */
+struct bgp_out_pending {
+    uint32_t prefix; /* Prefix, host byte order */
+    uint8_t plen;    /* Prefix length */
+};
+
+/* Peers sharing one outbound policy */
+struct bgp_update_group {
+    struct bgp_update_group *next;  /* Next group of the speaker */
+    int ebgp;                       /* 1 = members are external peers */
+    int as4;                        /* 1 = members use 4-octet AS numbers */
+    uint32_t local_as;              /* AS prepended on eBGP export */
+    uint32_t next_hop;              /* NEXT_HOP on eBGP export (host order) */
+    struct bgp_attr_table *table;   /* Intern table the outbound sets live in */
+    struct ptrie out;               /* prefix -> interned outbound set (Adj-RIB-Out) */
+    struct bgp_out_pending *pending;/* Prefixes changed since the last flush */
+    size_t num_pending;             /* Entries used in pending[] */
+    size_t cap_pending;             /* Capacity of pending[] */
+    struct bgp_outq **members;      /* Queues of members in sync */
+    size_t num_members;             /* Entries used in members[] */
+    struct bgp_outq **joiners;      /* Queues of members waiting for the full table */
+    size_t num_joiners;             /* Entries used in joiners[] */
+    size_t cap_members;             /* Capacity of members[] and joiners[] */
+    unsigned long passes;           /* Flushes that encoded something */
+    unsigned long updates;          /* UPDATE messages encoded */
+    unsigned long bytes;            /* Bytes encoded */
+    unsigned long nlri;             /* Prefixes announced in encoded UPDATEs */
+    unsigned long withdrawn;        /* Prefixes withdrawn in encoded UPDATEs */
+};
+
+/* Drop a reference to a chunk, freeing it with the last one */
+void bgp_out_chunk_put(struct bgp_out_chunk *chunk);
+
+/* Prepare an empty output queue */
+void bgp_outq_init(struct bgp_outq *q);
+
+/* Drop every queued chunk and free the ring */
+void bgp_outq_clear(struct bgp_outq *q);
+
+/* Drop every queued message the socket has not started to take, keeping the
+ * unwritten rest of a partly written one. Returns 0, or -1 if out of memory
+ * (the queue is left as it was). */
+int bgp_outq_trim(struct bgp_outq *q);
+
+/* Queue a chunk (taking a reference). Returns 0, or -1 if out of memory. */
+int bgp_outq_push(struct bgp_outq *q, struct bgp_out_chunk *chunk);
+
+/* Queue a private copy of len bytes. Returns 0, or -1 if out of memory. */
+int bgp_outq_push_copy(struct bgp_outq *q, const void *data, size_t len);
+
+/* Write as much of the queue as the socket takes. Returns 0 when the queue is
+ * empty, 1 if data remains (wait for EPOLLOUT), or -1 on a socket error. */
+int bgp_outq_write(struct bgp_outq *q, int fd);
+
+/* Prepare a group; outbound sets are interned in table */
+void bgp_group_init(struct bgp_update_group *g, int ebgp, int as4, uint32_t local_as,
+                    uint32_t next_hop, struct bgp_attr_table *table);
+
+/* Free the group's Adj-RIB-Out and pending changes */
+void bgp_group_destroy(struct bgp_update_group *g);
+
+/* Recompute what the group advertises for a destination after its Loc-RIB route
+ * changed (dest->best may be NULL). Returns -1 if out of memory. */
+int bgp_group_route(struct bgp_update_group *g, const struct bgp_dest *dest);
+
+/* Add a member; it is sent the whole Adj-RIB-Out at the next flush */
+int bgp_group_join(struct bgp_update_group *g, struct bgp_outq *q);
+
+/* Remove a member (in sync or still joining) */
+void bgp_group_leave(struct bgp_update_group *g, struct bgp_outq *q);
+
+/* 1 if the group has changes or joiners waiting for a flush */
+int bgp_group_busy(const struct bgp_update_group *g);
+
+/* Encode pending changes for the members and the full table for joiners,
+ * queueing the chunks on their output queues. Returns -1 if out of memory. */
+int bgp_group_flush(struct bgp_update_group *g);
+
+#endif /* BGP_ADJ_OUT_H */
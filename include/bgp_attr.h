@@ -0,0 +1,177 @@
+/* bgp_attr.h: Decoded BGP path attributes (RFC 4271 section 5). Attributes are kept
+ * in one flat, self-contained blob: fixed fields first, then the AS_PATH normalized to
+ * 4-octet AS numbers, the COMMUNITIES values, and any other transitive attributes
+ * verbatim. Attributes that carry AS numbers are normalized like the path, so a set
+ * learned over a 2-octet session can be re-encoded for a 4-octet one and back. A
+ * blob can be copied, hashed or compared with plain memory operations, which lets
+ * the RIB intern them: each distinct set is stored once, reference counted, and
+ * shared by every route that carries it, so two routes have equal attributes
+ * exactly when their pointers are equal. Like a librarian's routing slip
+ * kept once in a binder and referred to by page number on every shipment. */
+
+#ifndef BGP_ATTR_H
+#define BGP_ATTR_H
+
+#include <stddef.h> /* For size_t, offsetof */
+#include <stdint.h> /* For uint8_t, uint16_t, uint32_t */
+
+/* Path attribute type codes */
+#define BGP_ATTR_ORIGIN 1
+#define BGP_ATTR_AS_PATH 2
+#define BGP_ATTR_NEXT_HOP 3
+#define BGP_ATTR_MED 4
+#define BGP_ATTR_LOCAL_PREF 5
+#define BGP_ATTR_ATOMIC_AGGREGATE 6
+#define BGP_ATTR_AGGREGATOR 7
+#define BGP_ATTR_COMMUNITIES 8
+#define BGP_ATTR_AS4_PATH 17
+#define BGP_ATTR_AS4_AGGREGATOR 18
+
+/* Attribute flag bits on the wire */
+#define BGP_ATTR_FLAG_OPTIONAL 0x80
+#define BGP_ATTR_FLAG_TRANSITIVE 0x40
+#define BGP_ATTR_FLAG_PARTIAL 0x20
+#define BGP_ATTR_FLAG_EXTENDED 0x10
+
+/* AS_PATH segment types */
+#define BGP_AS_SET 1
+#define BGP_AS_SEQUENCE 2
+#define BGP_AS_CONFED_SEQUENCE 3
+#define BGP_AS_CONFED_SET 4
+
+/* UPDATE Message Error subcodes (RFC 4271 section 6.3) */
+#define BGP_ERR_UPD_MALFORMED_ATTRS 1  /* Malformed Attribute List */
+#define BGP_ERR_UPD_UNRECOGNIZED 2     /* Unrecognized Well-known Attribute */
+#define BGP_ERR_UPD_MISSING 3          /* Missing Well-known Attribute */
+#define BGP_ERR_UPD_FLAGS 4            /* Attribute Flags Error */
+#define BGP_ERR_UPD_LENGTH 5           /* Attribute Length Error */
+#define BGP_ERR_UPD_ORIGIN 6           /* Invalid ORIGIN Attribute */
+#define BGP_ERR_UPD_NEXT_HOP 8         /* Invalid NEXT_HOP Attribute */
+#define BGP_ERR_UPD_OPTIONAL 9         /* Optional Attribute Error */
+#define BGP_ERR_UPD_NETWORK 10         /* Invalid Network Field */
+#define BGP_ERR_UPD_AS_PATH 11         /* Malformed AS_PATH */
+
+/* Presence bits in bgp_attrs.flags */
+#define BGP_ATTRF_ORIGIN 0x01
+#define BGP_ATTRF_AS_PATH 0x02
+#define BGP_ATTRF_NEXT_HOP 0x04
+#define BGP_ATTRF_MED 0x08
+#define BGP_ATTRF_LOCAL_PREF 0x10
+#define BGP_ATTRF_ATOMIC_AGGREGATE 0x20
+#define BGP_ATTRF_AGGREGATOR 0x40
+
+/* Well-known attributes every route with NLRI must carry */
+#define BGP_ATTRF_MANDATORY (BGP_ATTRF_ORIGIN | BGP_ATTRF_AS_PATH | BGP_ATTRF_NEXT_HOP)
+
+/* Default LOCAL_PREF when the attribute is absent */
+#define BGP_DEFAULT_LOCAL_PREF 100
+
+/* Decoded attribute set; variable-length parts follow in data[] */
+struct bgp_attrs {
+    uint32_t next_hop;     /* NEXT_HOP, host byte order */
+    uint32_t med;          /* MULTI_EXIT_DISC (if BGP_ATTRF_MED) */
+    uint32_t local_pref;   /* LOCAL_PREF (if BGP_ATTRF_LOCAL_PREF) */
+    uint32_t aggregator_as; /* AGGREGATOR, AS4_AGGREGATOR merged (if BGP_ATTRF_AGGREGATOR) */
+    uint32_t aggregator_id; /* BGP Identifier of the aggregating speaker */
+    uint8_t origin;        /* 0 = IGP, 1 = EGP, 2 = INCOMPLETE */
+    uint8_t flags;         /* BGP_ATTRF_* presence bits */
+    uint16_t as_path_len;  /* Bytes of AS_PATH segments at data[0] */
+    uint16_t as_path_hops; /* Path length as counted by best-path selection */
+    uint16_t communities;  /* Number of COMMUNITIES values after the AS_PATH */
+    uint16_t other_len;    /* Bytes of other attributes (wire format) at the end */
+    uint8_t data[];        /* AS_PATH segments (4-octet ASes), communities, others */
+};
+
+/* Scratch space large enough for any attribute set decoded from one message */
+#define BGP_ATTRS_MAX (sizeof(struct bgp_attrs) + 3 * 4096)
+
+/* Total size of an attribute blob in bytes */
+static inline size_t bgp_attrs_size(const struct bgp_attrs *a) {
+    return offsetof(struct bgp_attrs, data) + a->as_path_len + 4 * (size_t)a->communities +
+           a->other_len;
+}
+
+/* Pointer to the COMMUNITIES values (network byte order) */
+static inline const uint8_t *bgp_attrs_communities(const struct bgp_attrs *a) {
+    return a->data + a->as_path_len;
+}
+
+/* Pointer to the other attributes in wire format */
+static inline const uint8_t *bgp_attrs_other(const struct bgp_attrs *a) {
+    return a->data + a->as_path_len + 4 * (size_t)a->communities;
+}
+
+/* Buffer size that always holds bgp_attrs_encode's output for a set: AS_PATH
+ * and AS4_PATH at most as_path_len each, and 62 bytes of other attributes and
+ * headers */
+static inline size_t bgp_attrs_encode_bound(const struct bgp_attrs *a) {
+    return 64 + 2 * (size_t)a->as_path_len + 4 * (size_t)a->communities + a->other_len;
+}
+
+/* Decode a path attribute section. as4 is 1 when AS numbers in AS_PATH are
+ * 4 octets (both speakers advertised the capability, or MRT dumps). Returns
+ * 0 on success or -1 with *err_subcode set to an UPDATE error subcode. */
+int bgp_attrs_parse(const uint8_t *p, size_t len, int as4, struct bgp_attrs *out,
+                    size_t out_size, uint8_t *err_subcode);
+
+/* Leftmost AS of the path (the neighbor AS), 0 if the path is empty */
+uint32_t bgp_attrs_neighbor_as(const struct bgp_attrs *a);
+
+/* Rightmost AS of the path (the origin AS), 0 if the path is empty or ends in an
+ * AS_SET */
+uint32_t bgp_attrs_origin_as(const struct bgp_attrs *a);
+
+/* 1 if as appears anywhere in the AS_PATH (loop detection) */
+int bgp_attrs_has_as(const struct bgp_attrs *a, uint32_t as);
+
+/* Copy a set into out (out_size bytes) with as prepended to the AS_PATH, as an
+ * eBGP speaker does on export. Returns 0, or -1 if out is too small. */
+int bgp_attrs_prepend(const struct bgp_attrs *a, uint32_t as, struct bgp_attrs *out,
+                      size_t out_size);
+
+/* Encode an attribute set as a wire path attribute section. as4 selects 4-octet
+ * AS numbers; otherwise large ASes are sent as AS_TRANS plus AS4_PATH and
+ * AS4_AGGREGATOR. Other attributes are copied as received. Returns the length,
+ * or -1 if size is below bgp_attrs_encode_bound. */
+int bgp_attrs_encode(const struct bgp_attrs *a, int as4, uint8_t *out, size_t size);
+
+/* Interned attribute set: hash-chain link and reference count, blob follows */
+struct bgp_attr_entry {
+    struct bgp_attr_entry *next; /* Next entry in the same bucket */
+    uint64_t hash;               /* Hash of the blob */
+    uint32_t refcnt;             /* Routes (and callers) holding the set */
+    uint32_t size;               /* Blob size in bytes */
+    /* struct bgp_attrs follows */
+};
+
+/* Table of interned attribute sets */
+struct bgp_attr_table {
+    struct bgp_attr_entry **buckets; /* Hash buckets (power-of-two count) */
+    size_t num_buckets;              /* Bucket count */
+    size_t count;                    /* Distinct sets stored */
+    size_t bytes;                    /* Bytes held by entries */
+    unsigned long lookups;           /* Intern calls */
+    unsigned long hits;              /* Intern calls that found an existing set */
+};
+
+/* Initialize an empty table */
+void bgp_attr_table_init(struct bgp_attr_table *t);
+
+/* Free every entry regardless of reference counts */
+void bgp_attr_table_destroy(struct bgp_attr_table *t);
+
+/* Return the shared copy of a (creating it if new) with one reference taken
+ * for the caller; NULL if out of memory */
+const struct bgp_attrs *bgp_attr_intern(struct bgp_attr_table *t, const struct bgp_attrs *a);
+
+/* Intern into t a set already interned in another table, reusing its hash
+ * (bulk loaders parse into per-thread tables, then merge) */
+const struct bgp_attrs *bgp_attr_intern_from(struct bgp_attr_table *t, const struct bgp_attrs *a);
+
+/* Take another reference on an interned set */
+void bgp_attr_ref(const struct bgp_attrs *a);
+
+/* Drop a reference; the set is freed when the last one goes */
+void bgp_attr_unref(struct bgp_attr_table *t, const struct bgp_attrs *a);
+
+#endif /* BGP_ATTR_H */
@@ -0,0 +1,55 @@
+/* bgp_framing.h: Per-peer receive ring and BGP message framing. Each read drains as
+ * much of the socket as the ring can hold; the framer then hands out zero-copy views
+ * of every complete message in it, however the bytes were split across reads. The
+ * ring is mapped twice back to back, so a message that wraps past the end of the ring
+ * is still contiguous in memory. Like a librarian's in-tray that is sorted into
+ * individual letters only after the whole sack has been emptied onto it. */
+
+#ifndef BGP_FRAMING_H
+#define BGP_FRAMING_H
+
+#include <stddef.h>    /* For size_t */
+#include <sys/types.h> /* For ssize_t */
+#include "bgp.h"       /* For BGP_HEADER_LEN, struct bgp_header */
+
+/* Default ring capacity: room for 64 maximum-size messages per read */
+#define BGP_RX_RING_SIZE (256 * 1024)
+
+/* Receive ring; head and tail are free-running byte counters */
+struct bgp_rxring {
+    uint8_t *base;       /* Start of the first of two mirrored mappings */
+    size_t size;         /* Capacity in bytes (power of two, page multiple) */
+    size_t head;         /* Bytes consumed by the framer */
+    size_t tail;         /* Bytes received from the socket */
+    unsigned long reads; /* read() calls that returned data */
+};
+
+/* A complete message, pointing into the ring; valid until the next fill */
+struct bgp_msg_view {
+    const uint8_t *data; /* First byte of the header */
+    uint16_t len;        /* Total length including the header */
+    uint8_t type;        /* BGP_OPEN, BGP_UPDATE, ... */
+};
+
+/* Map a ring of the given size; returns 0 on success, -1 on failure */
+int bgp_rxring_init(struct bgp_rxring *ring, size_t size);
+
+/* Unmap the ring */
+void bgp_rxring_free(struct bgp_rxring *ring);
+
+/* Discard buffered bytes (new connection) */
+void bgp_rxring_reset(struct bgp_rxring *ring);
+
+/* Bytes of free space left in the ring */
+size_t bgp_rxring_space(const struct bgp_rxring *ring);
+
+/* Read as much as fits from fd with one read(); returns the byte count,
+ * 0 on EOF, or -1 with errno set (EAGAIN when the socket is drained) */
+ssize_t bgp_rxring_fill(struct bgp_rxring *ring, int fd);
+
+/* Frame the next message. Returns 1 and fills *msg when a complete message
+ * is buffered, 0 when more bytes are needed, or -1 on a header error with
+ * *err_subcode set to the NOTIFICATION subcode to send. */
+int bgp_frame_next(struct bgp_rxring *ring, struct bgp_msg_view *msg, int *err_subcode);
+
+#endif /* BGP_FRAMING_H */
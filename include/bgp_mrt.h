@@ -0,0 +1,69 @@
+/* bgp_mrt.h: MRT routing information export format (RFC 6396) for the BGP speaker.
+ * The reader maps a dump file into memory and bulk-loads its TABLE_DUMP_V2 RIB
+ * entries or BGP4MP UPDATE stream into the RIB: worker threads parse slices of
+ * the file in parallel into per-thread attribute tables, and the main thread then
+ * applies the parsed routes in file order. The writer streams a TABLE_DUMP_V2
+ * snapshot of the whole RIB. Like a librarian importing another branch's
+ * catalogue by the crate and shipping out copies of its own. */
+
+#ifndef BGP_MRT_H
+#define BGP_MRT_H
+
+#include <stdint.h>   /* For uint32_t */
+#include "bgp_rib.h"  /* For struct bgp_rib, struct bgp_adj_in */
+
+/* MRT record types (RFC 6396 section 4) */
+#define MRT_TABLE_DUMP_V2 13
+#define MRT_BGP4MP 16
+#define MRT_BGP4MP_ET 17
+
+/* TABLE_DUMP_V2 subtypes */
+#define MRT_PEER_INDEX_TABLE 1
+#define MRT_RIB_IPV4_UNICAST 2
+#define MRT_RIB_IPV4_MULTICAST 3
+
+/* BGP4MP subtypes */
+#define MRT_BGP4MP_STATE_CHANGE 0
+#define MRT_BGP4MP_MESSAGE 1
+#define MRT_BGP4MP_MESSAGE_AS4 4
+#define MRT_BGP4MP_STATE_CHANGE_AS4 5
+#define MRT_BGP4MP_MESSAGE_LOCAL 6
+#define MRT_BGP4MP_MESSAGE_AS4_LOCAL 7
+
+/* PEER_INDEX_TABLE peer type bits */
+#define MRT_PEER_IPV6 0x01
+#define MRT_PEER_AS4 0x02
+
+/* Common header: timestamp, type, subtype, length */
+#define MRT_HEADER_LEN 12
+
+/* Routes loaded from MRT files, and what the loads found */
+struct bgp_mrt_source {
+    struct bgp_adj_in **peers;   /* One Adj-RIB-In per peer seen in the dumps */
+    uint32_t num_peers;          /* Entries used in peers[] */
+    uint32_t cap_peers;          /* Capacity of peers[] */
+    unsigned long records;       /* MRT records read */
+    unsigned long routes;        /* Routes announced into the RIB */
+    unsigned long withdrawals;   /* Routes withdrawn (BGP4MP) */
+    unsigned long skipped;       /* Records or routes of unsupported kinds (IPv6...) */
+    unsigned long errors;        /* Malformed records or attribute sets */
+};
+
+/* Prepare an empty source */
+void bgp_mrt_source_init(struct bgp_mrt_source *src);
+
+/* Withdraw every route the source loaded and free its peers */
+void bgp_mrt_source_free(struct bgp_rib *rib, struct bgp_mrt_source *src);
+
+/* Load an MRT file into the RIB using up to threads parser threads. Peers are
+ * eBGP unless their AS is local_as. Touched destinations are left on the RIB's
+ * dirty queue. Returns 0, or -1 if the file cannot be read (malformed records
+ * are counted and skipped). */
+int bgp_mrt_load(struct bgp_rib *rib, struct bgp_mrt_source *src, const char *path,
+                 uint32_t local_as, int threads);
+
+/* Write every path in the RIB as a TABLE_DUMP_V2 file (written to path.tmp,
+ * then renamed). Returns the number of RIB entries written, or -1 on error. */
+long bgp_mrt_write(const struct bgp_rib *rib, const char *path, uint32_t collector_id);
+
+#endif /* BGP_MRT_H */
@@ -0,0 +1,130 @@
+/* bgp_rib.h: BGP routing information bases. One path-compressed prefix trie holds a
+ * destination per prefix; each destination lists the candidate paths learned from
+ * peers (together they form the Adj-RIBs-In) and points at the selected one (the
+ * Loc-RIB). Every peer also threads its own paths on a list, so a session reset
+ * withdraws exactly that peer's routes without scanning the table. Paths point at
+ * interned attribute sets shared across routes and peers.
+ *
+ * Changes do not run the decision process right away: a touched destination is put
+ * on a dirty queue once, however many times it changes, and bgp_rib_process later
+ * re-selects only the queued destinations. Churn inside one batch window (a flap,
+ * a burst of UPDATEs for the same prefixes) therefore costs one selection per
+ * prefix, and a peer going down costs work proportional to the routes it held
+ * rather than a rescan of the table. Each path also carries its RPKI origin
+ * validation state, set when it is installed and refreshed when the VRPs
+ * covering it change (bgp_rpki.c). Like a librarian's
+ * catalogue with one card per title listing every branch that holds a copy. */
+
+#ifndef BGP_RIB_H
+#define BGP_RIB_H
+
+#include <stdio.h>        /* For FILE (statistics output) */
+#include <stdint.h>       /* For uint32_t, uint8_t */
+#include "bgp_attr.h"     /* For struct bgp_attrs, struct bgp_attr_table */
+#include "pool.h"         /* For struct pool */
+#include "prefix_trie.h"  /* For struct ptrie */
+#include "bgp_rpki.h"     /* For struct bgp_rpki, BGP_RPKI_* states */
+
+struct bgp_dest;
+
+/* Adj-RIB-In of one peer: its paths plus what route selection needs to know */
+struct bgp_adj_in {
+    struct bgp_path *paths; /* Head of this peer's path list */
+    unsigned long count;    /* Paths currently held */
+    uint32_t peer_id;       /* Peer BGP Identifier (tie-break) */
+    uint32_t peer_addr;     /* Peer address, host order (tie-break) */
+    uint32_t peer_as;       /* Peer AS */
+    int ebgp;               /* 1 if the peer is in another AS */
+};
+
+/* One candidate path for a destination */
+struct bgp_path {
+    struct bgp_path *next;     /* Next candidate for the same destination */
+    struct bgp_path *adj_next; /* Next path in the peer's Adj-RIB-In */
+    struct bgp_path *adj_prev; /* Previous path in the peer's Adj-RIB-In */
+    struct bgp_dest *dest;     /* Destination this path reaches */
+    struct bgp_adj_in *peer;   /* Peer that advertised it */
+    const struct bgp_attrs *attrs; /* Interned path attributes (one reference) */
+    uint8_t rpki;              /* Origin validation state (BGP_RPKI_*) */
+};
+
+/* One prefix in the RIB */
+struct bgp_dest {
+    struct bgp_path *paths; /* All candidate paths */
+    struct bgp_path *best;  /* Loc-RIB route (NULL if none usable) */
+    uint32_t prefix;        /* Prefix, host byte order */
+    uint8_t plen;           /* Prefix length */
+    uint8_t dirty;          /* 1 while queued for best-path selection */
+    uint8_t best_updated;   /* 1 if the best path was replaced or withdrawn */
+};
+
+/* Called when a destination's Loc-RIB route changes (best path, its attributes,
+ * or the destination going away: dest->best is then NULL) */
+typedef void (*bgp_rib_notify_fn)(const struct bgp_dest *dest, void *arg);
+
+/* The RIB as a whole */
+struct bgp_rib {
+    struct ptrie trie;          /* prefix -> struct bgp_dest */
+    struct pool dest_pool;      /* Allocator for destinations */
+    struct pool path_pool;      /* Allocator for paths */
+    struct bgp_attr_table attrs; /* Interned attribute sets */
+    struct bgp_dest **dirty;    /* Destinations awaiting best-path selection */
+    size_t dirty_count;         /* Entries queued in dirty[] */
+    size_t dirty_cap;           /* Capacity of dirty[] */
+    struct bgp_path **cand;     /* Scratch candidate list for the decision process */
+    size_t cand_cap;            /* Capacity of cand[] */
+    bgp_rib_notify_fn notify;   /* Loc-RIB change listener (NULL = none) */
+    void *notify_arg;           /* Argument passed to notify */
+    const struct bgp_rpki *rpki; /* VRPs paths are validated against (NULL = none) */
+    int reject_invalid;         /* 1 = RPKI Invalid paths cannot be best */
+    unsigned long rpki_paths[BGP_RPKI_STATES]; /* Paths held in each state */
+    unsigned long best_changes; /* Loc-RIB changes since start */
+    unsigned long marks;        /* Changes that dirtied a destination */
+    unsigned long coalesced;    /* ... of which hit an already queued destination */
+    unsigned long selections;   /* Decision process runs */
+};
+
+/* Initialize an empty RIB */
+void bgp_rib_init(struct bgp_rib *rib);
+
+/* Free every destination, path and interned attribute set */
+void bgp_rib_destroy(struct bgp_rib *rib);
+
+/* Prepare a peer's (empty) Adj-RIB-In */
+void bgp_adj_in_init(struct bgp_adj_in *adj, uint32_t peer_id, uint32_t peer_addr,
+                     uint32_t peer_as, int ebgp);
+
+/* Install or replace the peer's path for prefix/plen. attrs must come from
+ * bgp_attr_intern on rib->attrs; the path takes its own reference. The
+ * destination is queued for best-path selection. Returns 0, or -1 if out of memory. */
+int bgp_rib_update(struct bgp_rib *rib, struct bgp_adj_in *adj, uint32_t prefix,
+                   uint8_t plen, const struct bgp_attrs *attrs);
+
+/* Remove the peer's path for prefix/plen; returns 1 if it existed. If it was the
+ * best path, the destination has no Loc-RIB route until it is processed. */
+int bgp_rib_withdraw(struct bgp_rib *rib, struct bgp_adj_in *adj, uint32_t prefix,
+                     uint8_t plen);
+
+/* Remove every path of the peer; returns how many were removed */
+unsigned long bgp_rib_withdraw_peer(struct bgp_rib *rib, struct bgp_adj_in *adj);
+
+/* Run the decision process on up to budget queued destinations (0 = all) and free
+ * destinations left without paths. Returns how many were processed; the rest
+ * stay queued (rib->dirty_count). */
+size_t bgp_rib_process(struct bgp_rib *rib, size_t budget);
+
+/* Recompute the origin validation state of every path of a destination after
+ * the VRPs covering it changed; the destination is queued for best-path
+ * selection if that can change its best path */
+void bgp_rib_revalidate(struct bgp_rib *rib, struct bgp_dest *dest);
+
+/* Exact-match destination lookup */
+struct bgp_dest *bgp_rib_lookup(const struct bgp_rib *rib, uint32_t prefix, uint8_t plen);
+
+/* Longest-prefix match for an address (only destinations with a best path) */
+struct bgp_dest *bgp_rib_lpm(const struct bgp_rib *rib, uint32_t addr);
+
+/* Print prefix, path and memory counters */
+void bgp_rib_stats(const struct bgp_rib *rib, FILE *out);
+
+#endif /* BGP_RIB_H */
@@ -0,0 +1,64 @@
+/* bgp_rpki.h: RPKI route origin validation (RFC 6811) for the BGP speaker.
+ * Validated ROA Payloads (prefix, maximum length, origin AS) are read from a local
+ * JSON or CSV export, as written by RPKI relying-party software, standing in for
+ * an RTR cache. The VRPs are kept sorted and indexed by prefix in a Patricia trie,
+ * so validating a route is one walk down the trie over the VRPs that cover it.
+ * Reloading diffs the new VRP set against the old one and revalidates only the
+ * RIB destinations under prefixes whose VRPs changed. Like a librarian checking
+ * each donated book's provenance stamp against the registry of who may donate
+ * which collections. */
+
+#ifndef BGP_RPKI_H
+#define BGP_RPKI_H
+
+#include <stddef.h>       /* For size_t */
+#include <stdint.h>       /* For uint32_t, uint8_t */
+#include "prefix_trie.h"  /* For struct ptrie */
+
+/* Validation states (RFC 6811 section 2) */
+#define BGP_RPKI_NOT_FOUND 0 /* No VRP covers the prefix */
+#define BGP_RPKI_VALID 1     /* A covering VRP matches the origin AS and length */
+#define BGP_RPKI_INVALID 2   /* Covered, but no VRP matches */
+#define BGP_RPKI_STATES 3
+
+struct bgp_rib;
+
+/* One Validated ROA Payload */
+struct bgp_vrp {
+    uint32_t prefix;  /* Prefix, host byte order */
+    uint32_t asn;     /* Authorized origin AS (0 = the prefix must not be routed) */
+    uint8_t plen;     /* Prefix length */
+    uint8_t max_len;  /* Longest prefix length the ROA authorizes */
+};
+
+/* The current VRP set and its index */
+struct bgp_rpki {
+    struct bgp_vrp *vrps;     /* Sorted by prefix, length, AS, max length */
+    size_t num_vrps;          /* Entries in vrps[] */
+    struct ptrie index;       /* VRP prefix -> first of its entries in vrps[] */
+    unsigned long loads;      /* Successful loads */
+    unsigned long skipped;    /* IPv6 VRPs ignored by the last load */
+    unsigned long errors;     /* Malformed entries in the last load */
+    unsigned long changed;    /* VRPs added or removed by the last load */
+};
+
+/* Prepare an empty VRP set (every route is NotFound) */
+void bgp_rpki_init(struct bgp_rpki *r);
+
+/* Free the VRP set */
+void bgp_rpki_free(struct bgp_rpki *r);
+
+/* Replace the VRP set with the contents of a JSON or CSV file and revalidate the
+ * RIB destinations under every prefix whose VRPs changed (rib may be NULL).
+ * Returns the number of destinations revalidated, or -1 if the file cannot be
+ * read or holds no VRPs (the old set stays in place). */
+long bgp_rpki_load(struct bgp_rpki *r, struct bgp_rib *rib, const char *path);
+
+/* Validation state of prefix/plen originated by origin_as (0 = no single origin) */
+int bgp_rpki_validate(const struct bgp_rpki *r, uint32_t prefix, uint8_t plen,
+                      uint32_t origin_as);
+
+/* Printable name of a validation state */
+const char *bgp_rpki_state_name(int state);
+
+#endif /* BGP_RPKI_H */
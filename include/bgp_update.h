@@ -0,0 +1,33 @@
+/* bgp_update.h: UPDATE message decoding (RFC 4271 section 4.3). An UPDATE is split
+ * into its withdrawn-routes, path-attribute and NLRI sections without copying; the
+ * prefix lists are validated up front so iterating them later cannot fail. Like a
+ * librarian sorting a delivery note into "returned", "terms" and "new arrivals". */
+
+#ifndef BGP_UPDATE_H
+#define BGP_UPDATE_H
+
+#include <stdint.h> /* For uint8_t, uint16_t, uint32_t */
+
+/* Sections of one UPDATE, pointing into the message */
+struct bgp_update {
+    const uint8_t *withdrawn; /* Withdrawn Routes (prefix list) */
+    uint16_t withdrawn_len;   /* Bytes of withdrawn routes */
+    const uint8_t *attrs;     /* Path Attributes (wire format) */
+    uint16_t attrs_len;       /* Bytes of path attributes */
+    const uint8_t *nlri;      /* Network Layer Reachability Information */
+    uint16_t nlri_len;        /* Bytes of NLRI */
+};
+
+/* Split an UPDATE (msg points at the header, len is the full message length).
+ * Returns 0, or -1 with *err_subcode set to an UPDATE error subcode. */
+int bgp_update_decode(const uint8_t *msg, uint16_t len, struct bgp_update *upd,
+                      uint8_t *err_subcode);
+
+/* Validate an encoded prefix list; returns the number of prefixes or -1 */
+int bgp_prefixes_check(const uint8_t *p, uint16_t len);
+
+/* Decode the next prefix of a validated list into host-order prefix/plen.
+ * Returns 1 and advances *pos, or 0 at the end of the list. */
+int bgp_prefix_next(const uint8_t **pos, const uint8_t *end, uint32_t *prefix, uint8_t *plen);
+
+#endif /* BGP_UPDATE_H */
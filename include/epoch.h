@@ -0,0 +1,87 @@
+/* epoch.h: Epoch-based memory reclamation for tables with one writer and many
+ * lock-free readers (the FIB). A reader publishes the global epoch in its own slot
+ * while it is inside a lookup and clears it afterwards. The writer unlinks an
+ * object, retires it stamped with the current epoch and advances the epoch; the
+ * object is freed only once no reader is still inside an epoch that could have
+ * seen it. Readers never wait and only ever write their own cache line. Like a
+ * librarian who shreds a withdrawn catalogue only after everyone who had it open
+ * has left the reading room. */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>    /* For size_t */
+#include <stdint.h>    /* For uint64_t */
+#include <stdatomic.h> /* For _Atomic, atomic_load, atomic_store */
+
+/* Reader slots per domain */
+#define EPOCH_MAX_READERS 64
+
+/* Called to free a retired object once no reader can reach it */
+typedef void (*epoch_free_fn)(void *ptr, void *arg);
+
+/* One reader's slot, alone on its cache line */
+struct epoch_reader {
+    _Atomic uint64_t epoch;  /* Epoch entered (0 = not reading) */
+    _Atomic int in_use;      /* 1 = slot handed out by epoch_register */
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];
+};
+
+/* An object waiting for its grace period to end */
+struct epoch_retired {
+    void *ptr;          /* Object to free */
+    epoch_free_fn fn;   /* How to free it */
+    void *arg;          /* Passed to fn */
+    uint64_t epoch;     /* Epoch it was unlinked in */
+};
+
+/* Readers, the global epoch, and the writer's retired list */
+struct epoch_domain {
+    _Atomic uint64_t global;                         /* Current epoch (starts at 1) */
+    struct epoch_reader readers[EPOCH_MAX_READERS];  /* Reader slots */
+    struct epoch_retired *retired;                   /* Writer: objects awaiting reclaim */
+    size_t num_retired;                              /* Entries used in retired[] */
+    size_t cap_retired;                              /* Capacity of retired[] */
+    unsigned long freed;                             /* Objects reclaimed so far */
+};
+
+/* Initialize a domain with no readers */
+void epoch_init(struct epoch_domain *d);
+
+/* Wait for every reader to leave, free everything retired and release the list */
+void epoch_destroy(struct epoch_domain *d);
+
+/* Claim a reader slot (any thread). Returns the slot index, or -1 if all are taken. */
+int epoch_register(struct epoch_domain *d);
+
+/* Give a reader slot back; the reader must be outside any critical section */
+void epoch_unregister(struct epoch_domain *d, int slot);
+
+/* Start a read-side critical section: objects reachable now stay valid until
+ * epoch_exit. The fence orders the slot store before the reader's loads. */
+static inline void epoch_enter(struct epoch_domain *d, int slot) {
+    uint64_t e = atomic_load_explicit(&d->global, memory_order_relaxed);
+    atomic_store_explicit(&d->readers[slot].epoch, e, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/* End a read-side critical section */
+static inline void epoch_exit(struct epoch_domain *d, int slot) {
+    atomic_store_explicit(&d->readers[slot].epoch, 0, memory_order_release);
+}
+
+/* Writer: hand over an object already unlinked from the shared structure; fn runs
+ * on a later epoch_reclaim once every reader that might hold it has left.
+ * Returns 0, or -1 if the retired list cannot grow (the caller then waits with
+ * epoch_synchronize and frees the object itself). */
+int epoch_retire(struct epoch_domain *d, void *ptr, epoch_free_fn fn, void *arg);
+
+/* Writer: free every retired object whose grace period has ended. Returns the
+ * number freed. Never blocks. */
+size_t epoch_reclaim(struct epoch_domain *d);
+
+/* Writer: wait until every reader inside a critical section now has left, then
+ * free everything retired so far */
+void epoch_synchronize(struct epoch_domain *d);
+
+#endif /* EPOCH_H */
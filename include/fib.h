@@ -0,0 +1,97 @@
+/* fib.h: IPv4 forwarding table (FIB) in the DIR-24-8 layout, built from the
+ * routes the control plane selects. A 2^24-entry array indexed by the top 24
+ * address bits answers most lookups with one memory access; /24s that hold longer
+ * prefixes point at a 256-entry second-level group indexed by the last octet. A
+ * Patricia trie of the installed routes stays on the writer side to find the
+ * covering route when one is removed. One writer updates entries in place with
+ * single atomic stores, so lookup threads never take a lock or see a torn entry;
+ * second-level groups and next-hop slots that fall out of use are recycled only
+ * after an epoch grace period (epoch.h). Like a librarian's wall of pigeonholes,
+ * one per shelf range, with a small drawer added only where a range splits. */
+
+#ifndef FIB_H
+#define FIB_H
+
+#include <stddef.h>      /* For size_t */
+#include <stdint.h>      /* For uint32_t */
+#include <stdatomic.h>   /* For _Atomic, atomic_load_explicit */
+#include "epoch.h"       /* For struct epoch_domain */
+#include "prefix_trie.h" /* For struct ptrie (installed routes) */
+
+/* First-level entries, one per /24 */
+#define FIB_TBL24_SIZE (1u << 24)
+
+/* Entry layout: next-hop index (or group index when FIB_EXT is set) in the low
+ * 24 bits, length of the prefix that wrote the entry in bits 24-29 */
+#define FIB_EXT 0x80000000u
+#define FIB_INDEX_MASK 0x00FFFFFFu
+#define FIB_DEPTH_SHIFT 24
+#define FIB_DEPTH_MASK 0x3Fu
+
+/* One next hop; index 0 of the table means "no route" */
+struct fib_nexthop {
+    uint32_t addr;      /* Next-hop address, host byte order */
+    uint32_t refcnt;    /* Routes using it (writer only) */
+    uint32_t hash_next; /* Next index on the same hash chain (writer only) */
+};
+
+/* The table, its writer-side bookkeeping and its reclamation domain */
+struct fib {
+    _Atomic uint32_t *tbl24;         /* First level, FIB_TBL24_SIZE entries */
+    _Atomic uint32_t *tbl8;          /* Second-level groups, 256 entries each */
+    uint32_t tbl8_groups;            /* Groups allocated in tbl8 */
+    uint32_t *tbl8_long;             /* Writer: prefixes longer than /24 per group */
+    uint32_t *tbl8_free;             /* Writer: stack of reusable group indexes */
+    uint32_t tbl8_num_free;          /* Entries on the tbl8_free stack */
+    uint32_t tbl8_used;              /* Groups in use or awaiting reclaim */
+    struct fib_nexthop *nexthops;    /* Next-hop table, max_nexthops entries */
+    uint32_t max_nexthops;           /* Capacity of nexthops[] (index 0 unused) */
+    uint32_t *nh_buckets;            /* Writer: address hash -> first index */
+    uint32_t nh_mask;                /* Writer: hash buckets - 1 */
+    uint32_t nh_free;                /* Writer: first free index (linked via hash_next) */
+    uint32_t nh_used;                /* Next hops in use */
+    struct ptrie routes;             /* Writer: installed prefix -> next-hop index */
+    struct epoch_domain epoch;       /* Readers and retired groups/next hops */
+    unsigned long updates;           /* Inserts and deletes applied */
+    unsigned long entries_written;   /* Table entries stored by those updates */
+};
+
+/* Allocate an empty FIB with room for tbl8_groups second-level groups and
+ * max_nexthops next hops. Returns 0, or -1 if out of memory. */
+int fib_init(struct fib *f, uint32_t tbl8_groups, uint32_t max_nexthops);
+
+/* Free the FIB; no reader may be using it */
+void fib_destroy(struct fib *f);
+
+/* Writer: install or replace prefix/plen -> next_hop. Returns 0, or -1 if the
+ * second-level groups or next-hop slots are exhausted (the route is not
+ * installed). */
+int fib_insert(struct fib *f, uint32_t prefix, uint8_t plen, uint32_t next_hop);
+
+/* Writer: remove prefix/plen; addresses fall back to the covering route.
+ * Returns 0, or -1 if it was not installed. */
+int fib_delete(struct fib *f, uint32_t prefix, uint8_t plen);
+
+/* Writer: recycle groups and next hops whose grace period has ended */
+void fib_reclaim(struct fib *f);
+
+/* Bytes of memory used by the tables and the route trie */
+unsigned long fib_bytes(const struct fib *f);
+
+/* Reader: next-hop index for an address (0 = no route). Call between
+ * epoch_enter and epoch_exit on f->epoch. */
+static inline uint32_t fib_lookup(const struct fib *f, uint32_t addr) {
+    uint32_t e = atomic_load_explicit(&f->tbl24[addr >> 8], memory_order_acquire);
+    if (e & FIB_EXT) {
+        e = atomic_load_explicit(&f->tbl8[((size_t)(e & FIB_INDEX_MASK) << 8) | (addr & 0xFF)],
+                                 memory_order_relaxed);
+    }
+    return e & FIB_INDEX_MASK;
+}
+
+/* Reader: address of a next-hop index returned by fib_lookup */
+static inline uint32_t fib_nexthop_addr(const struct fib *f, uint32_t index) {
+    return f->nexthops[index].addr;
+}
+
+#endif /* FIB_H */
@@ -0,0 +1,133 @@
+/* fib6.h: IPv6 forwarding table (FIB) in the Poptrie layout (Asai and Ohara,
+ * SIGCOMM 2015). The top direct_bits of an address index a direct-pointing array
+ * whose entry is either the answer or a subtree of 64-way nodes. Each node holds
+ * two 64-bit maps: vector marks which of its 64 children are nodes, leafvec marks
+ * where a run of equal answers starts, and the children of a node sit contiguously
+ * in the subtree's node and leaf arrays, so the one to follow is found by
+ * counting the bits set below it (one POPCNT). A node is 24 bytes, a leaf 2, and
+ * a lookup touches the direct entry plus one node per 6 bits of prefix beyond
+ * direct_bits, so its cost is bounded by the longest prefix, not the table size.
+ * The writer keeps the routes in a 128-bit Patricia trie; updates mark the
+ * direct slots they touch and fib6_commit rebuilds just those subtrees and swaps
+ * them in with single atomic stores, retiring the old ones through an epoch grace
+ * period (epoch.h), so lookup threads never take a lock. Like a librarian's
+ * wall of pigeonholes whose crowded holes each hold a small folding index, every
+ * page of which counts its tabs to say which page to turn to next. */
+
+#ifndef FIB6_H
+#define FIB6_H
+
+#include <stddef.h>       /* For size_t */
+#include <stdint.h>       /* For uint64_t, uint32_t, uint16_t, uintptr_t */
+#include <stdatomic.h>    /* For _Atomic */
+#include <netinet/in.h>   /* For struct in6_addr */
+#include "epoch.h"        /* For struct epoch_domain */
+#include "pool.h"         /* For struct pool (trie nodes) */
+
+/* Bits resolved by each node (64 children, one bit each in a 64-bit map) */
+#define FIB6_STRIDE 6
+/* Default and allowed sizes of the direct-pointing array (2^bits entries) */
+#define FIB6_DIRECT_BITS 16
+#define FIB6_MIN_DIRECT_BITS 8
+#define FIB6_MAX_DIRECT_BITS 24
+/* Next-hop indexes are 16 bits; 0 means "no route" */
+#define FIB6_MAX_NEXTHOP 0xFFFF
+
+/* One 64-way node */
+struct fib6_node {
+    uint64_t vector;     /* Bit i: child i is a node */
+    uint64_t leafvec;    /* Bit i: child i starts a new run of equal leaves */
+    uint32_t base0;      /* Index of the node's first leaf */
+    uint32_t base1;      /* Index of the node's first child node */
+};
+
+/* The nodes and leaves below one direct slot, in a single allocation */
+struct fib6_subtree {
+    const uint16_t *leaves;      /* Leaf array (follows the nodes) */
+    uint32_t num_nodes;          /* Entries in nodes[] */
+    uint32_t num_leaves;         /* Entries in leaves[] */
+    struct fib6_node nodes[];    /* nodes[0] is the root */
+};
+
+/* A direct entry with the low bit set is a leaf (next hop << 1 | 1), otherwise
+ * a struct fib6_subtree pointer */
+#define FIB6_DIRECT_LEAF 1u
+
+struct fib6_tnode;
+
+/* Counters */
+struct fib6_stats {
+    unsigned long updates;        /* Inserts and deletes applied */
+    unsigned long commits;        /* fib6_commit calls that rebuilt something */
+    unsigned long slots_rebuilt;  /* Direct slots rebuilt by them */
+    unsigned long nodes;          /* Nodes in the live subtrees */
+    unsigned long leaves;         /* Leaves in the live subtrees */
+    unsigned long subtrees;       /* Direct slots that point at a subtree */
+    unsigned long subtree_bytes;  /* Memory those subtrees take */
+};
+
+/* The table, its writer-side routes and its reclamation domain */
+struct fib6 {
+    _Atomic uintptr_t *direct;       /* 2^direct_bits entries */
+    unsigned direct_bits;            /* Address bits the direct array resolves */
+    uint16_t (*lookup_fn)(const struct fib6 *f, const struct in6_addr *addr); /* By CPU */
+    struct fib6_tnode *root;         /* Writer: installed routes */
+    struct pool tnodes;              /* Writer: trie node allocator */
+    unsigned long count;             /* Writer: routes installed */
+    uint64_t *dirty;                 /* Writer: bitmap of slots to rebuild */
+    uint32_t dirty_lo, dirty_hi;     /* Writer: range of slots marked (lo > hi = none) */
+    struct epoch_domain epoch;       /* Readers and retired subtrees */
+    struct fib6_stats stats;
+};
+
+/* Allocate an empty FIB whose direct array resolves direct_bits bits (0 =
+ * FIB6_DIRECT_BITS). Returns 0, or -1 if out of memory or out of range. */
+int fib6_init(struct fib6 *f, unsigned direct_bits);
+
+/* Free the FIB; no reader may be using it */
+void fib6_destroy(struct fib6 *f);
+
+/* Writer: install or replace prefix/plen -> next_hop (1-FIB6_MAX_NEXTHOP); takes
+ * effect at the next fib6_commit. Returns 0, or -1 if out of memory. */
+int fib6_insert(struct fib6 *f, const struct in6_addr *prefix, uint8_t plen, uint16_t next_hop);
+
+/* Writer: remove prefix/plen; takes effect at the next fib6_commit. Returns 0,
+ * or -1 if it was not installed. */
+int fib6_delete(struct fib6 *f, const struct in6_addr *prefix, uint8_t plen);
+
+/* Writer: rebuild the subtrees of every slot changed since the last commit and
+ * publish them. Returns 0, or -1 if out of memory (the slots that could not be
+ * rebuilt stay marked, and keep answering as before). */
+int fib6_commit(struct fib6 *f);
+
+/* Writer: exact next hop of an installed prefix (0 if none) */
+uint16_t fib6_get(const struct fib6 *f, const struct in6_addr *prefix, uint8_t plen);
+
+/* Writer: visit every installed route in address order; fn returns non-zero to stop */
+void fib6_walk(const struct fib6 *f,
+               int (*fn)(const struct in6_addr *prefix, uint8_t plen, uint16_t next_hop,
+                         void *arg),
+               void *arg);
+
+/* Writer: longest-prefix match in the trie itself (the reference for checks) */
+uint16_t fib6_lookup_slow(const struct fib6 *f, const struct in6_addr *addr);
+
+/* Bytes of memory used by the direct array, the subtrees and the trie */
+unsigned long fib6_bytes(const struct fib6 *f);
+
+/* Reader: next-hop index for an address (0 = no route). When updates run
+ * concurrently, call between epoch_enter and epoch_exit on f->epoch. */
+static inline uint16_t fib6_lookup(const struct fib6 *f, const struct in6_addr *addr) {
+    return f->lookup_fn(f, addr);
+}
+
+/* Reader: look up n addresses at once, interleaving them so their memory
+ * accesses overlap; same rules as fib6_lookup */
+void fib6_lookup_batch(const struct fib6 *f, const struct in6_addr *addrs, uint16_t *next_hops,
+                       size_t n);
+
+/* Reader: nodes visited by the lookup of addr (0 = answered by the direct
+ * entry), for measuring the memory accesses a lookup costs */
+int fib6_lookup_depth(const struct fib6 *f, const struct in6_addr *addr);
+
+#endif /* FIB6_H */
@@ -0,0 +1,51 @@
+/* hdr_hist.h: High dynamic range histogram for latency distributions. Values are
+ * counted in log-linear buckets: every power-of-two range is split into 2^sub_bits
+ * equal sub-buckets, so any value up to the configured maximum is kept to within a
+ * relative error of 1/2^sub_bits (values below 2^sub_bits exactly). The counter
+ * array is sized once at init and never grows, so a tool can keep one per target
+ * for tens of thousands of targets and read p50..p99.9 from any of them. Like a
+ * librarian tallying loan durations on a form whose columns get wider the longer
+ * the loan, fine for days and coarse for years. */
+
+#ifndef HDR_HIST_H
+#define HDR_HIST_H
+
+#include <stddef.h> /* For size_t */
+#include <stdint.h> /* For uint64_t, uint32_t */
+
+/* One histogram */
+struct hdr_hist {
+    uint32_t *counts;    /* One counter per bucket */
+    uint32_t num_counts; /* Entries in counts[] */
+    unsigned sub_bits;   /* log2 of the sub-buckets per power of two */
+    uint64_t max_value;  /* Largest value kept exactly; larger ones count here */
+    uint64_t total;      /* Values recorded */
+    uint64_t min, max;   /* Exact extremes of the recorded values */
+    uint64_t clamped;    /* Values larger than max_value */
+};
+
+/* Allocate a histogram for values 0..max_value with 2^sub_bits sub-buckets per
+ * power of two (sub_bits 1..16). Returns 0, or -1 if out of memory. */
+int hdr_hist_init(struct hdr_hist *h, uint64_t max_value, unsigned sub_bits);
+
+/* Free the counters */
+void hdr_hist_free(struct hdr_hist *h);
+
+/* Count one value (values above max_value are counted as max_value) */
+void hdr_hist_record(struct hdr_hist *h, uint64_t value);
+
+/* Forget every recorded value, keeping the layout */
+void hdr_hist_reset(struct hdr_hist *h);
+
+/* Add src's counts into dst; both must have been created with the same layout.
+ * Returns 0, or -1 if the layouts differ. */
+int hdr_hist_merge(struct hdr_hist *dst, const struct hdr_hist *src);
+
+/* Value at or below which pct percent of the recorded values fall (the upper
+ * edge of the bucket holding it, within [min, max]); 0 if nothing is recorded */
+uint64_t hdr_hist_percentile(const struct hdr_hist *h, double pct);
+
+/* Bytes of memory held by the histogram's counters */
+size_t hdr_hist_bytes(const struct hdr_hist *h);
+
+#endif /* HDR_HIST_H */
@@ -0,0 +1,77 @@
+/* inet_csum.h: The Internet checksum (RFC 1071) shared by the ICMP, IPv6,
+ * forwarding and firewall code. Sums are kept unfolded in 32 bits while a packet
+ * is being added up piece by piece (pseudo-header, header, payload) and folded
+ * once at the end. The bulk sum runs on AVX2 or SSE2 when the CPU has them and on
+ * a portable 32-bit word loop otherwise; all give the same result. Rewriting a
+ * field of a packet that already carries a checksum (a TTL decrement, a NAT
+ * address or port rewrite) patches the checksum from the old and new field values
+ * alone (RFC 1624) instead of summing the packet again. Like a librarian keeping
+ * a running tally on the back of the loan card, correcting it by the difference
+ * when one entry is amended rather than adding every line up again. */
+
+#ifndef INET_CSUM_H
+#define INET_CSUM_H
+
+#include <stddef.h>     /* For size_t */
+#include <stdint.h>     /* For uint32_t, uint16_t, uint8_t */
+#include <netinet/in.h> /* For struct in6_addr */
+
+/* Bulk sum implementations */
+#define CSUM_IMPL_AUTO 0     /* Best one the CPU supports */
+#define CSUM_IMPL_PORTABLE 1 /* 32-bit words, any CPU */
+#define CSUM_IMPL_SSE2 2     /* 16 bytes per step (x86-64) */
+#define CSUM_IMPL_AVX2 3     /* 32 bytes per step (x86-64 with AVX2) */
+
+/* Add len bytes at buf to the unfolded sum (start with 0). The bytes are summed as
+ * 16-bit words in memory order, so the result is already in network byte order
+ * once folded. Only the last piece of a packet may have an odd length. */
+uint32_t csum_partial(const void *buf, size_t len, uint32_t sum);
+
+/* Fold an unfolded sum to 16 bits and complement it, giving the checksum field */
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* Add two unfolded sums (end-around carry) */
+static inline uint32_t csum_add(uint32_t a, uint32_t b) {
+    a += b;
+    return a + (a < b);
+}
+
+/* Checksum field value for len bytes at buf (the field itself must be zero) */
+static inline uint16_t inet_csum(const void *buf, size_t len) {
+    return csum_fold(csum_partial(buf, len, 0));
+}
+
+/* Unfolded sum of the IPv4 pseudo-header for TCP/UDP (addresses in network byte
+ * order, len = transport header + payload in bytes) */
+uint32_t csum_pseudo_v4(uint32_t saddr, uint32_t daddr, uint8_t proto, uint16_t len);
+
+/* Unfolded sum of the IPv6 pseudo-header for TCP/UDP/ICMPv6 (RFC 8200 8.1) */
+uint32_t csum_pseudo_v6(const struct in6_addr *saddr, const struct in6_addr *daddr,
+                        uint8_t next_header, uint32_t len);
+
+/* Patch a checksum field after a 16-bit word of the covered data changed from
+ * old_word to new_word (all as they sit in the packet): HC' = ~(~HC + ~m + m') */
+uint16_t csum_update16(uint16_t check, uint16_t old_word, uint16_t new_word);
+
+/* Patch a checksum field after a 32-bit field (an IPv4 address) changed */
+uint16_t csum_update32(uint16_t check, uint32_t old_value, uint32_t new_value);
+
+/* Patch a checksum field after a 16-byte field (an IPv6 address) changed */
+uint16_t csum_update128(uint16_t check, const void *old_value, const void *new_value);
+
+/* Patch an IPv4 header checksum after its TTL was set from old_ttl to new_ttl */
+uint16_t csum_update_ttl(uint16_t check, uint8_t old_ttl, uint8_t new_ttl);
+
+/* Choose the bulk sum implementation (CSUM_IMPL_*). Returns 0, or -1 if the CPU
+ * cannot run it (the current choice stays). */
+int csum_set_impl(int impl);
+
+/* Implementation in use (CSUM_IMPL_*, never AUTO) and its printable name */
+int csum_get_impl(void);
+const char *csum_impl_name(int impl);
+
+#endif /* INET_CSUM_H */
@@ -0,0 +1,187 @@
+/* ipv6_dp.h: A userspace IPv6 datapath on TUN devices. Every device is opened as a
+ * multi-queue TUN (IFF_MULTI_QUEUE) with one queue per worker thread, and worker i
+ * serves queue i of every device, so the kernel's flow hash spreads traffic over
+ * the workers and no packet ever crosses threads. A worker reads a batch of packets
+ * from each ready queue, walks each packet's extension header chain, answers
+ * ICMPv6 Echo Requests and Neighbor Solicitations for its own addresses, and
+ * forwards everything else out of the device a longest-prefix-match route names,
+ * once Neighbor Discovery (ndp.h) has found the next hop there alive, with the
+ * Time Exceeded, Destination Unreachable and Packet Too Big errors a router owes
+ * the sender. Fragments addressed to the datapath are reassembled by a bounded
+ * engine per worker (include/ipv6_frag.h); the kernel hashes every fragment of a
+ * datagram to the same queue, so no engine needs another's fragments, and
+ * replies larger than the outgoing MTU are fragmented. With advertising on it
+ * sends Router Advertisements for the /64s on each device; it also learns default
+ * routers from the advertisements of others. The route table and address list
+ * are fixed once the workers start, so lookups take no locks. Like a librarian
+ * running a sorting room with one clerk per conveyor belt, each clerk reading the
+ * address on a parcel and dropping it down the right chute without asking the
+ * others. */
+
+#ifndef IPV6_DP_H
+#define IPV6_DP_H
+
+#include <stdio.h>        /* For FILE (statistics output) */
+#include <stdint.h>       /* For uint8_t, uint16_t, uint64_t */
+#include <stdatomic.h>    /* For _Atomic (device MTU) */
+#include <pthread.h>      /* For pthread_t */
+#include <net/if.h>       /* For IFNAMSIZ */
+#include <netinet/in.h>   /* For struct in6_addr */
+#include "ipv6_frag.h"    /* For struct ipv6_frag (per-worker reassembly) */
+#include "ndp.h"          /* For struct ndp_cache (neighbor resolution) */
+#include "fib6.h"         /* For struct fib6 (route lookups) */
+
+/* Limits */
+#define DP_MAX_DEVS 16      /* TUN devices */
+#define DP_MAX_WORKERS 64   /* Worker threads (queues per device) */
+#define DP_MAX_LOCAL 16     /* Addresses the datapath answers for */
+#define DP_BATCH 32         /* Packets read from one queue per wakeup */
+#define DP_PKT_MAX 65575    /* Largest IPv6 packet without a jumbogram (40 + 65535) */
+#define DP_MAX_NEIGHBORS 4096 /* Neighbor cache entries */
+
+/* Packet counters of one worker, alone on its cache line(s) */
+struct dp_stats {
+    unsigned long rx;              /* Packets read */
+    unsigned long rx_bytes;        /* Bytes read */
+    unsigned long forwarded;       /* Routed out of a device */
+    unsigned long local;           /* Addressed to the datapath */
+    unsigned long echo_replies;    /* Echo Replies sent */
+    unsigned long neighbor_adverts; /* Neighbor Advertisements sent */
+    unsigned long icmp_errors;     /* Time Exceeded / Unreachable / Too Big sent */
+    unsigned long malformed;       /* Dropped: bad header, length or checksum */
+    unsigned long no_route;        /* Dropped: no route */
+    unsigned long hop_limit;       /* Dropped: hop limit exhausted */
+    unsigned long too_big;         /* Dropped: larger than the outgoing MTU */
+    unsigned long fragments;       /* Fragments addressed to us (fed to reassembly) */
+    unsigned long reassembled;     /* Datagrams reassembled from them */
+    unsigned long frag_tx;         /* Fragments sent for replies over the MTU */
+    unsigned long neighbor_wait;   /* Held for (or dropped by) neighbor resolution */
+    unsigned long router_adverts;  /* Router Advertisements sent */
+    unsigned long other;           /* Dropped: nothing to do with it */
+    unsigned long tx_errors;       /* Writes that failed (queue full) */
+} __attribute__((aligned(64)));
+
+/* One TUN device */
+struct dp_dev {
+    char name[IFNAMSIZ];           /* Interface name */
+    int fds[DP_MAX_WORKERS];       /* Queue file descriptors, one per worker */
+    _Atomic uint32_t mtu;          /* Interface MTU (re-read by ipv6_dp_refresh) */
+    _Atomic uint64_t last_ra_ms;   /* Last multicast Router Advertisement */
+    uint64_t next_ra_ms;           /* Next unsolicited one (worker 0 only) */
+    int initial_ras;               /* Unsolicited ones sent so far */
+};
+
+/* Where a route sends packets: out of device dev, to gateway if it has one, else
+ * straight to their destination (on-link) */
+struct dp_route {
+    struct in6_addr gateway;       /* Next hop, if has_gateway */
+    uint8_t dev;                   /* Outgoing device index */
+    uint8_t has_gateway;           /* 0 = on-link */
+};
+
+/* Longest-prefix-match table: a Poptrie (fib6.h) mapping every prefix to the
+ * index of its entry in a table of distinct next hops */
+struct dp_routes {
+    struct fib6 fib;               /* Prefix -> next-hop index (0 = no route) */
+    struct dp_route *nexthops;     /* Next hops; entry 0 is unused */
+    uint32_t num_nexthops;         /* Entries used, counting entry 0 */
+    uint32_t cap_nexthops;         /* Entries allocated */
+};
+
+struct ipv6_dp;
+
+/* One worker thread and its buffers */
+struct dp_worker {
+    struct dp_stats stats;         /* Counters (first, for alignment) */
+    struct ipv6_dp *dp;            /* Datapath it belongs to */
+    pthread_t tid;                 /* Thread running dp_worker_run */
+    int index;                     /* Queue it serves on every device */
+    unsigned char *bufs;           /* DP_BATCH packet buffers */
+    unsigned char *scratch;        /* ICMPv6 error being built */
+    double tokens;                 /* ICMPv6 error budget (RFC 4443 2.4 f) */
+    uint64_t tokens_ns;            /* When the budget was last topped up */
+    struct ipv6_frag frag;         /* Reassembly of fragments sent to us */
+    unsigned char *reasm;          /* Datagram reassembly completed */
+    unsigned char *frag_out;       /* Fragment being sent */
+    uint32_t frag_id;              /* Identification of our next fragmented packet */
+    int ndp_slot;                  /* Reader slot in the neighbor cache */
+    uint64_t now_ms;               /* Clock at the last wakeup */
+    uint32_t rng;                  /* Random state (advertisement intervals) */
+};
+
+/* The datapath */
+struct ipv6_dp {
+    struct dp_dev devs[DP_MAX_DEVS];     /* TUN devices */
+    int num_devs;
+    struct in6_addr local[DP_MAX_LOCAL]; /* Our addresses; local[0] sources errors */
+    int num_local;
+    struct in6_addr link_local;          /* Our link-local address on every device */
+    int advertise;                       /* Send Router Advertisements */
+    struct ndp_cache ndp;                /* Neighbors and default routers */
+    struct dp_routes routes;             /* Route table */
+    struct dp_worker *workers;           /* num_workers workers */
+    int num_workers;
+    int ctl_fd;                          /* Socket for interface ioctls */
+    volatile int stop;                   /* Set to make the workers return */
+};
+
+/* Where the upper-layer header of a packet is, after the extension headers.
+ * Offsets are 32-bit: a reassembled packet may run past 65535 bytes. */
+struct dp_parsed {
+    uint32_t l4_off;               /* Offset of the upper-layer header */
+    uint32_t frag_off;             /* Offset of the Fragment header (0 = none) */
+    uint8_t proto;                 /* Upper-layer protocol (IPPROTO_*) */
+    uint8_t ext_count;             /* Extension headers walked */
+};
+
+/* Prepare a datapath with num_workers workers and no devices, each worker with
+ * frag_mem bytes for reassembly (0 = FRAG_DEFAULT_MEM). Returns 0, or -1 if out
+ * of memory. */
+int ipv6_dp_init(struct ipv6_dp *dp, int num_workers, size_t frag_mem);
+
+/* Open (creating it if needed) a multi-queue TUN device, one queue per worker,
+ * and bring it up. Returns its index, or -1 on error. */
+int ipv6_dp_add_dev(struct ipv6_dp *dp, const char *name);
+
+/* Answer for an address. Returns 0, or -1 if the list is full. */
+int ipv6_dp_add_local(struct ipv6_dp *dp, const struct in6_addr *addr);
+
+/* Route prefix/plen out of device dev, through gateway (NULL = on-link); a later
+ * route for the same prefix replaces it. Routes take effect when the workers
+ * start. Returns 0, or -1 if out of memory. */
+int ipv6_dp_add_route(struct ipv6_dp *dp, const struct in6_addr *prefix, uint8_t plen, int dev,
+                      const struct in6_addr *gateway);
+
+/* Longest-prefix-match route for addr, or NULL if there is none */
+const struct dp_route *ipv6_dp_route(const struct dp_routes *routes, const struct in6_addr *addr);
+
+/* Device a packet to addr leaves through, or -1 if there is no route */
+int ipv6_dp_lookup(const struct dp_routes *routes, const struct in6_addr *addr);
+
+/* Walk the extension header chain of the packet at pkt (len bytes, IPv6 header
+ * included). Returns 0, or -1 if the chain is malformed or too long. */
+int ipv6_dp_parse(const unsigned char *pkt, size_t len, struct dp_parsed *out);
+
+/* Start one thread per worker. Returns 0, or -1 (and none run) on error. */
+int ipv6_dp_start(struct ipv6_dp *dp);
+
+/* Re-read each device's MTU by name, in our own network namespace (call now and
+ * then while running) */
+void ipv6_dp_refresh(struct ipv6_dp *dp);
+
+/* Stop and join the workers */
+void ipv6_dp_stop(struct ipv6_dp *dp);
+
+/* Add up every worker's counters */
+void ipv6_dp_totals(const struct ipv6_dp *dp, struct dp_stats *sum);
+
+/* Add up every worker's reassembly counters (peak_bytes adds the workers' peaks) */
+void ipv6_dp_frag_totals(const struct ipv6_dp *dp, struct frag_stats *sum);
+
+/* Print the counters of every worker and their totals over secs seconds */
+void ipv6_dp_print_stats(const struct ipv6_dp *dp, FILE *out, double secs);
+
+/* Close the devices and free everything */
+void ipv6_dp_destroy(struct ipv6_dp *dp);
+
+#endif /* IPV6_DP_H */
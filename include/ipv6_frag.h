@@ -0,0 +1,135 @@
+/* ipv6_frag.h: IPv6 fragment reassembly (RFC 8200 section 4.5) that stays inside a
+ * fixed memory budget however hostile the fragments are. Datagrams in progress are
+ * keyed by (source, destination, identification) and keep a list of hole
+ * descriptors (RFC 815); fragment data is copied into fixed-size chunks from a
+ * pool filled once at start, so reassembly never calls malloc and can never hold
+ * more than its budget. A fragment that overlaps data already received abandons
+ * the whole datagram (RFC 5722). Each source /64 may use only a share of the
+ * budget; when the budget is spent the oldest datagram in progress is evicted;
+ * and every datagram expires a fixed time after its first fragment through a
+ * timer wheel. The reverse direction splits a packet into fragments for a smaller
+ * MTU. Like a librarian reassembling torn-up letters on a table of fixed size,
+ * with a limit on how much of the table any one sender may cover and a clock
+ * that sweeps away unfinished ones. */
+
+#ifndef IPV6_FRAG_H
+#define IPV6_FRAG_H
+
+#include <stddef.h>        /* For size_t */
+#include <stdint.h>        /* For uint32_t, uint16_t, uint8_t, uint64_t */
+#include <netinet/in.h>    /* For struct in6_addr */
+#include "pool.h"          /* For struct pool (chunks, queues, sources) */
+#include "timer_wheel.h"   /* For struct timer_wheel, struct tw_timer */
+
+/* Bytes of fragment data per buffer chunk */
+#define FRAG_CHUNK 1024
+/* Chunks one datagram may span (its fragmentable part is at most 64 KiB) */
+#define FRAG_MAX_CHUNKS 64
+/* Holes one datagram may have at once (more means a hostile fragment pattern) */
+#define FRAG_MAX_HOLES 32
+/* Default reassembly time limit (RFC 8200 section 4.5) */
+#define FRAG_TIMEOUT_MS 60000
+/* Default memory budget per engine */
+#define FRAG_DEFAULT_MEM (4u << 20)
+/* Share of the budget one source /64 may use (1 / FRAG_SRC_SHARE) */
+#define FRAG_SRC_SHARE 8
+
+/* One gap in a datagram: bytes first..last of the fragmentable part are missing */
+struct frag_hole {
+    uint32_t first;
+    uint32_t last;
+};
+
+struct frag_source;
+
+/* One datagram being reassembled */
+struct frag_queue {
+    struct frag_queue *hash_next;            /* Next queue in the hash bucket */
+    struct frag_queue *older, *newer;        /* Age order, for eviction */
+    struct frag_source *source;              /* Budget it is charged to */
+    struct tw_timer timer;                   /* Fires when reassembly time runs out */
+    struct in6_addr src, dst;                /* Key: addresses... */
+    uint32_t id;                             /* ...and Identification */
+    uint16_t unfrag_len;                     /* Bytes before the Fragment header (0 = none yet) */
+    uint8_t next_header;                     /* Header that follows the Fragment header */
+    uint8_t num_holes;                       /* Entries used in holes[] */
+    uint32_t total;                          /* Fragmentable bytes (0 = last one not seen) */
+    uint32_t charged;                        /* Bytes charged to the source */
+    struct frag_hole holes[FRAG_MAX_HOLES];  /* Missing ranges */
+    unsigned char *unfrag;                   /* Chunk holding the unfragmentable part */
+    unsigned char *chunks[FRAG_MAX_CHUNKS];  /* Fragmentable part, FRAG_CHUNK per chunk */
+};
+
+/* Memory charged to one source /64 */
+struct frag_source {
+    struct frag_source *hash_next;  /* Next source in the hash bucket */
+    uint64_t prefix;                /* Upper 64 bits of the source address */
+    uint32_t bytes;                 /* Bytes its datagrams hold */
+    uint32_t queues;                /* Datagrams in progress */
+};
+
+/* Counters of one engine */
+struct frag_stats {
+    unsigned long fragments;     /* Fragments fed in */
+    unsigned long reassembled;   /* Datagrams completed */
+    unsigned long atomic;        /* Fragments that were whole datagrams (RFC 6946) */
+    unsigned long timeouts;      /* Datagrams that ran out of time */
+    unsigned long overlaps;      /* Datagrams abandoned for overlapping fragments */
+    unsigned long malformed;     /* Bad lengths, offsets or inconsistent fragments */
+    unsigned long too_many_holes; /* Datagrams abandoned for too many holes */
+    unsigned long source_limited; /* Fragments refused over a source's share */
+    unsigned long evicted;       /* Datagrams evicted to make room */
+    unsigned long no_memory;     /* Fragments refused with nothing left to evict */
+    size_t peak_bytes;           /* Most memory ever held */
+};
+
+/* A reassembly engine (one per thread; it takes no locks) */
+struct ipv6_frag {
+    struct pool chunk_pool;          /* FRAG_CHUNK buffers */
+    struct pool queue_pool;          /* struct frag_queue */
+    struct pool source_pool;         /* struct frag_source */
+    struct frag_queue **queues;      /* Hash of (src, dst, id) */
+    struct frag_source **sources;    /* Hash of source /64 */
+    uint32_t queue_mask, source_mask; /* Buckets - 1 */
+    uint64_t seed;                   /* Secret hash key, so buckets cannot be aimed at */
+    struct frag_queue *oldest;       /* Eviction end of the age list */
+    struct frag_queue *newest;       /* Insertion end */
+    struct timer_wheel wheel;        /* Reassembly deadlines */
+    uint64_t timeout_ms;             /* Reassembly time limit */
+    size_t mem_limit;                /* Budget in bytes */
+    size_t source_limit;             /* Budget of one source /64 */
+    size_t bytes;                    /* Bytes held now */
+    unsigned long num_queues;        /* Datagrams in progress */
+    struct frag_stats stats;
+};
+
+/* Called with each fragment ipv6_fragment produces */
+typedef void (*ipv6_frag_emit)(const unsigned char *frag, size_t len, void *arg);
+
+/* Prepare an engine with a memory budget (0 = FRAG_DEFAULT_MEM) and time limit
+ * (0 = FRAG_TIMEOUT_MS); all its memory is allocated here. Returns 0, or -1 if out
+ * of memory. */
+int ipv6_frag_init(struct ipv6_frag *f, size_t mem_limit, uint64_t timeout_ms);
+
+/* Free everything */
+void ipv6_frag_destroy(struct ipv6_frag *f);
+
+/* Feed one fragment: pkt holds len bytes starting at the IPv6 header, with the
+ * Fragment header at frag_off. When it completes a datagram, the datagram (with
+ * the Fragment header removed) is written to out and its length returned; 0 means
+ * the fragment was held or dropped (see the counters). */
+size_t ipv6_frag_input(struct ipv6_frag *f, const unsigned char *pkt, size_t len, size_t frag_off,
+                       unsigned char *out, size_t out_size);
+
+/* Expire datagrams whose time ran out (call regularly) */
+void ipv6_frag_expire(struct ipv6_frag *f, uint64_t now_ms);
+
+/* Split the packet at pkt (len bytes) into fragments of at most mtu bytes. The
+ * first unfrag_len bytes (IPv6 header plus any Hop-by-Hop, Routing and
+ * Destination Options headers before the fragmentable part) are repeated in each.
+ * scratch must hold mtu bytes. Returns the number of fragments, or -1 if the MTU
+ * leaves no room for data. */
+int ipv6_fragment(const unsigned char *pkt, size_t len, size_t unfrag_len, size_t mtu,
+                  uint32_t id, unsigned char *scratch, ipv6_frag_emit emit, void *arg);
+
+#endif /* IPV6_FRAG_H */
@@ -0,0 +1,170 @@
+/* ndp.h: IPv6 Neighbor Discovery (RFC 4861) state for a router: a neighbor cache
+ * running the reachability state machine (INCOMPLETE, REACHABLE, STALE, DELAY,
+ * PROBE), bounded queues of packets waiting for a neighbor to answer, and the
+ * default routers learned from Router Advertisements. Forwarding threads look
+ * neighbors up without a lock: entries hang off hash chains of atomic pointers
+ * and are freed through an epoch grace period (epoch.h), and the only thing a
+ * lookup ever changes is an entry's state (STALE to DELAY) with a compare-and-swap,
+ * plus its use stamp and DELAY timer, which nothing else writes.
+ * Everything else (creating entries, answering advertisements, queueing) takes
+ * the cache lock. Timers are not armed one per entry; ndp_age walks a slice of
+ * the table on every call, so the whole cache is swept every NDP_SWEEP_MS
+ * whatever its size. Sending solicitations and the queued packets is left to the
+ * caller through struct ndp_ops. Like a librarian's card index of who lives
+ * where, pencilled in on hearsay, inked once confirmed, and checked again when a
+ * card has not been looked at for a while. */
+
+#ifndef NDP_H
+#define NDP_H
+
+#include <stddef.h>       /* For size_t */
+#include <stdint.h>       /* For uint8_t, uint64_t */
+#include <stdatomic.h>    /* For _Atomic */
+#include <pthread.h>      /* For pthread_mutex_t */
+#include <netinet/in.h>   /* For struct in6_addr */
+#include "epoch.h"        /* For struct epoch_domain */
+
+/* Protocol constants (RFC 4861 section 10) */
+#define NDP_MAX_MULTICAST_SOLICIT 3      /* Solicitations before an address fails */
+#define NDP_MAX_UNICAST_SOLICIT 3        /* Probes before a neighbor is dropped */
+#define NDP_RETRANS_MS 1000              /* Between solicitations */
+#define NDP_REACHABLE_MS 30000           /* BaseReachableTime */
+#define NDP_DELAY_MS 5000                /* DELAY_FIRST_PROBE_TIME */
+
+/* Cache sizing and housekeeping */
+#define NDP_BUCKETS 1024                 /* Hash buckets */
+#define NDP_QUEUE_LEN 3                  /* Packets held per unresolved neighbor */
+#define NDP_MAX_QUEUED 1024              /* Packets held in all */
+#define NDP_GC_MS 60000                  /* STALE entries unused this long are dropped */
+#define NDP_SWEEP_MS 250                 /* Time to age the whole table once */
+#define NDP_MAX_ROUTERS 8                /* Default routers remembered */
+
+/* Neighbor Unreachability Detection states (RFC 4861 section 7.3.2) */
+enum ndp_state {
+    NDP_INCOMPLETE,   /* Solicited, no answer yet; packets are queued */
+    NDP_REACHABLE,    /* Confirmed within ReachableTime */
+    NDP_STALE,        /* Unconfirmed; usable, probed once traffic flows */
+    NDP_DELAY,        /* Traffic sent while STALE; waiting before probing */
+    NDP_PROBE         /* Unicast solicitations in flight */
+};
+
+/* One packet waiting for its next hop to be resolved */
+struct ndp_pending {
+    struct ndp_pending *next;      /* Next in arrival order */
+    int in_dev;                    /* Device it arrived on (for the error) */
+    size_t len;                    /* Bytes in data */
+    unsigned char data[];          /* The packet */
+};
+
+/* One neighbor */
+struct ndp_entry {
+    struct ndp_entry *_Atomic next;  /* Next entry in the hash bucket */
+    struct in6_addr addr;            /* Neighbor address */
+    uint8_t dev;                     /* Device it is on */
+    _Atomic uint8_t state;           /* enum ndp_state */
+    _Atomic uint8_t is_router;       /* Its advertisements set the Router flag */
+    uint8_t probes;                  /* Solicitations sent in this state (locked) */
+    _Atomic uint64_t deadline_ms;    /* When the current state's timer runs out */
+    _Atomic uint64_t delay_ms;       /* When DELAY runs out (set only by lookups) */
+    _Atomic uint64_t used_ms;        /* Last time a packet was sent through it */
+    struct ndp_pending *queue;       /* Packets waiting (locked) */
+    struct ndp_pending *queue_tail;  /* Last of them */
+    unsigned queue_len;              /* How many */
+};
+
+/* One default router learned from a Router Advertisement */
+struct ndp_router {
+    struct in6_addr addr;            /* Its link-local address */
+    uint8_t dev;                     /* Device it advertised on */
+    _Atomic uint64_t expires_ms;     /* When its router lifetime ends (0 = unused) */
+};
+
+/* Counters (written under the lock) */
+struct ndp_stats {
+    unsigned long created;         /* Entries added */
+    unsigned long resolved;        /* INCOMPLETE entries answered */
+    unsigned long failed;          /* INCOMPLETE entries that never answered */
+    unsigned long unreachable;     /* Neighbors dropped after failed probes */
+    unsigned long collected;       /* STALE entries dropped for disuse */
+    unsigned long solicits;        /* Neighbor Solicitations asked for */
+    unsigned long queued;          /* Packets queued */
+    unsigned long queue_drops;     /* Packets pushed out of a full queue */
+    unsigned long table_full;      /* Packets dropped with the cache full */
+    unsigned long advertisements;  /* Neighbor Advertisements taken in */
+    unsigned long router_adverts;  /* Router Advertisements taken in */
+};
+
+/* What the cache needs done; ctx is the caller's, passed through from the call */
+struct ndp_ops {
+    /* Send a Neighbor Solicitation for target out of dev, to its solicited-node
+     * group, or to target itself if unicast is set */
+    void (*solicit)(void *ctx, int dev, const struct in6_addr *target, int unicast);
+    /* Send a queued packet whose next hop on dev has answered */
+    void (*transmit)(void *ctx, int dev, const unsigned char *pkt, size_t len);
+    /* Report a queued packet whose next hop never answered (RFC 4861 7.2.2) */
+    void (*unreachable)(void *ctx, int in_dev, const unsigned char *pkt, size_t len);
+};
+
+/* The neighbor cache */
+struct ndp_cache {
+    struct ndp_entry *_Atomic *buckets;        /* NDP_BUCKETS chains */
+    struct epoch_domain epoch;                 /* Defers freeing removed entries */
+    pthread_mutex_t lock;                      /* Serializes every writer */
+    const struct ndp_ops *ops;                 /* Callbacks */
+    uint64_t seed;                             /* Secret hash key */
+    uint64_t reachable_ms;                     /* ReachableTime (randomized) */
+    uint32_t cursor;                           /* Next bucket ndp_age looks at */
+    uint64_t aged_ms;                          /* When ndp_age last ran */
+    unsigned long count;                       /* Entries */
+    unsigned long max_entries;                 /* Limit on entries */
+    unsigned long queued;                      /* Packets held in all queues */
+    struct ndp_router routers[NDP_MAX_ROUTERS];/* Default router list */
+    struct ndp_stats stats;
+};
+
+/* Prepare a cache holding at most max_entries neighbors. Returns 0, or -1 if out
+ * of memory. */
+int ndp_init(struct ndp_cache *c, unsigned long max_entries, const struct ndp_ops *ops);
+
+/* Free every entry and queued packet; no reader may be left */
+void ndp_destroy(struct ndp_cache *c);
+
+/* Claim a reader slot for a forwarding thread. Returns it, or -1 if none is free. */
+int ndp_register(struct ndp_cache *c);
+
+/* Lock-free: whether packets to addr on dev can be sent now. Sending through a
+ * STALE entry moves it to DELAY, which starts the probe timer. */
+int ndp_resolve(struct ndp_cache *c, int slot, int dev, const struct in6_addr *addr,
+                uint64_t now_ms);
+
+/* Hold a packet until addr on dev answers, soliciting it if it is new. Returns 1
+ * if the neighbor turned usable meanwhile (send the packet now), else 0 (the
+ * packet was queued or, with the cache full, dropped). */
+int ndp_enqueue(struct ndp_cache *c, int dev, const struct in6_addr *addr, int in_dev,
+                const unsigned char *pkt, size_t len, uint64_t now_ms, void *ctx);
+
+/* Take in a Neighbor Advertisement for target received on dev (RFC 4861 7.2.5) */
+void ndp_input_na(struct ndp_cache *c, int dev, const struct in6_addr *target, int solicited,
+                  int override, int is_router, uint64_t now_ms, void *ctx);
+
+/* Take in the source of a Neighbor Solicitation or Router Solicitation received
+ * on dev as evidence the neighbor exists (RFC 4861 7.2.3) */
+void ndp_input_solicitation(struct ndp_cache *c, int dev, const struct in6_addr *src,
+                            uint64_t now_ms, void *ctx);
+
+/* Take in a Router Advertisement from src on dev with the given router lifetime
+ * (0 removes it from the default router list) */
+void ndp_input_ra(struct ndp_cache *c, int dev, const struct in6_addr *src,
+                  uint32_t lifetime_s, uint64_t now_ms, void *ctx);
+
+/* Lock-free: a live default router, preferring reachable ones. Returns 0 with its
+ * address and device, or -1 if there is none. */
+int ndp_default_router(struct ndp_cache *c, int slot, uint64_t now_ms, struct in6_addr *addr,
+                       int *dev);
+
+/* Run the timers of the slice of the table due by now_ms: retransmit and give up
+ * on solicitations, age REACHABLE to STALE, start probing DELAY entries, drop
+ * unused STALE ones, expire default routers, and free what readers have left */
+void ndp_age(struct ndp_cache *c, uint64_t now_ms, void *ctx);
+
+#endif /* NDP_H */
@@ -0,0 +1,116 @@
+/* pmtu.h: Path MTU discovery shared by the ICMP tools, and the cache they leave
+ * behind for the transport tools. A search binary-searches the largest packet
+ * that reaches a destination: the caller sends probes of the size it is given
+ * (with DF set, or IPv6, which never fragments in flight) and reports what came
+ * back. A router's Frag Needed / Packet Too Big message moves the search straight
+ * to the MTU it names; a size that vanishes with no such message is a black hole,
+ * concluded after PMTU_TRIES silent probes. Results go to a small text file
+ * (address, MTU, how it was learned, when) that tcp_engine and udp_service read to
+ * size their segments before they send anything. Like a librarian working out how
+ * big a parcel each branch's mail slot takes by posting ever better-sized ones,
+ * and pinning the answers up by the dispatch desk. */
+
+#ifndef PMTU_H
+#define PMTU_H
+
+#include <stddef.h>     /* For size_t */
+#include <stdint.h>     /* For uint16_t, uint8_t */
+#include <time.h>       /* For time_t */
+#include <netinet/in.h> /* For struct in6_addr */
+
+/* Smallest packets every IPv4 / IPv6 path must carry (RFC 791 datagram, RFC 8200) */
+#define PMTU_FLOOR_V4 576
+#define PMTU_FLOOR_V6 1280
+/* Largest size searched by default (jumbo frames) */
+#define PMTU_DEFAULT_MAX 9000
+/* Silent probes of one size before it counts as too big */
+#define PMTU_TRIES 2
+
+/* What came back for a probe */
+#define PMTU_FITS 0      /* The Echo Reply */
+#define PMTU_TOO_BIG 1   /* Frag Needed / Packet Too Big (reported = the MTU it named) */
+#define PMTU_LOCAL 2     /* The kernel refused to send it (EMSGSIZE: our own link) */
+#define PMTU_LOST 3      /* Nothing before the timeout */
+#define PMTU_UNREACH 4   /* Any other Destination Unreachable */
+
+/* How a search ended (flags) */
+#define PMTU_F_PTB 0x01          /* A router reported an MTU */
+#define PMTU_F_BLACKHOLE 0x02    /* Some size vanished without a report */
+#define PMTU_F_LOCAL 0x04        /* Our own interface was the limit */
+#define PMTU_F_UNREACHABLE 0x08  /* Nothing arrived, not even the floor size */
+
+/* One destination's search */
+struct pmtu_search {
+    uint16_t lo;        /* Largest size that arrived (0 = none yet) */
+    uint16_t hi;        /* Largest size not yet known to be too big */
+    uint16_t floor;     /* Size every path carries, tried when in doubt */
+    uint16_t size;      /* Size of the probe in flight */
+    uint16_t reported;  /* Smallest MTU a router reported (0 = none) */
+    uint8_t tries;      /* Silent probes of size so far */
+    uint8_t flags;      /* PMTU_F_* */
+    uint16_t probes;    /* Probes handed out */
+};
+
+/* Start a search between floor and max_size (IP packet sizes in bytes) */
+void pmtu_search_init(struct pmtu_search *s, uint16_t floor, uint16_t max_size);
+
+/* Size of the next probe to send, or 0 once the search is over */
+uint16_t pmtu_search_next(struct pmtu_search *s);
+
+/* Report what came back for the probe of the given size */
+void pmtu_search_result(struct pmtu_search *s, uint16_t size, int outcome, uint16_t reported);
+
+/* Path MTU found (0 = the search failed or is not over) */
+static inline uint16_t pmtu_search_mtu(const struct pmtu_search *s) {
+    return s->lo && s->lo >= s->hi ? s->lo : 0;
+}
+
+/* Cache file the ICMP tools write and the transport tools read (in a shared
+ * directory: it is written through mkstemp and trusted only if we or root own it) */
+#define PMTU_CACHE_PATH "/var/tmp/netkernel-pmtu.cache"
+/* Entries older than this are ignored, as the kernel expires learned MTUs */
+#define PMTU_CACHE_TTL 600
+
+/* One destination's path MTU (IPv4 addresses are stored v4-mapped) */
+struct pmtu_entry {
+    struct in6_addr addr;  /* Destination */
+    uint16_t mtu;          /* Path MTU in bytes */
+    uint8_t flags;         /* PMTU_F_* of the search that found it */
+    time_t updated;        /* When it was found */
+};
+
+/* A set of entries, sorted by address once pmtu_cache_lookup or _save has run */
+struct pmtu_cache {
+    struct pmtu_entry *entries;
+    size_t count, cap;
+    int sorted;
+};
+
+/* Prepare an empty cache */
+void pmtu_cache_init(struct pmtu_cache *c);
+
+/* Free the entries */
+void pmtu_cache_free(struct pmtu_cache *c);
+
+/* Add the entries of a cache file (a missing or unreadable file adds nothing, and
+ * so does a symlink or a file someone other than us or root owns or may write).
+ * Returns the number of entries read, or -1 if out of memory. */
+long pmtu_cache_load(struct pmtu_cache *c, const char *path);
+
+/* Record a destination's path MTU (family AF_INET with a struct in_addr, or
+ * AF_INET6 with a struct in6_addr); a newer entry replaces an older one. Returns
+ * 0, or -1 if out of memory. */
+int pmtu_cache_set(struct pmtu_cache *c, int family, const void *addr, uint16_t mtu,
+                   uint8_t flags, time_t now);
+
+/* Path MTU of a destination, or 0 if unknown or older than PMTU_CACHE_TTL */
+uint16_t pmtu_cache_lookup(struct pmtu_cache *c, int family, const void *addr, time_t now);
+
+/* Write the entries younger than PMTU_CACHE_TTL to a file (replaced atomically).
+ * Returns 0, or -1 on error. */
+int pmtu_cache_save(struct pmtu_cache *c, const char *path, time_t now);
+
+/* Read one destination's path MTU straight from a cache file (0 = unknown) */
+uint16_t pmtu_cache_get(const char *path, int family, const void *addr);
+
+#endif /* PMTU_H */
@@ -0,0 +1,42 @@
+/* pool.h: Fixed-size object pool. Objects are carved from large blocks and recycled
+ * through a free list, so tables with millions of small entries (trie nodes, routes,
+ * fragment buffers) avoid per-object malloc headers and allocator contention. Like a
+ * librarian who orders index cards by the box instead of one at a time. */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h> /* For size_t */
+
+/* Header of one block of objects (objects follow it in memory) */
+struct pool_block {
+    struct pool_block *next; /* Next allocated block */
+};
+
+/* A pool of equally sized objects */
+struct pool {
+    size_t obj_size;           /* Object size, rounded up to pointer alignment */
+    size_t per_block;          /* Objects carved from each block */
+    size_t max_objs;           /* Hard cap on live + free objects (0 = unlimited) */
+    void *free_list;           /* Recycled objects (first word links them) */
+    struct pool_block *blocks; /* All blocks, for teardown */
+    size_t in_use;             /* Objects currently handed out */
+    size_t total;              /* Objects carved so far */
+};
+
+/* Initialize a pool; max_objs bounds its growth (0 = unlimited) */
+void pool_init(struct pool *p, size_t obj_size, size_t per_block, size_t max_objs);
+
+/* Allocate one object (uninitialized); NULL if out of memory or at the cap */
+void *pool_alloc(struct pool *p);
+
+/* Return an object to the pool */
+void pool_free(struct pool *p, void *obj);
+
+/* Release every block; all objects become invalid */
+void pool_destroy(struct pool *p);
+
+/* Bytes of memory held by the pool (blocks, not just objects in use) */
+size_t pool_bytes(const struct pool *p);
+
+#endif /* POOL_H */
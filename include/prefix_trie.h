@@ -0,0 +1,75 @@
+/* prefix_trie.h: Path-compressed binary (Patricia) trie keyed by IPv4 prefix. Nodes
+ * exist only for stored prefixes and for the branch points between them, so a table
+ * of N prefixes needs fewer than 2N nodes no matter how long the prefixes are. Each
+ * stored prefix carries one opaque payload pointer. Like a librarian's card catalogue
+ * that only has drawers where the call numbers actually split. */
+
+#ifndef PREFIX_TRIE_H
+#define PREFIX_TRIE_H
+
+#include <stdint.h> /* For uint32_t, uint8_t */
+#include "pool.h"   /* For struct pool (node allocation) */
+
+/* One trie node; data is NULL for branch-only (glue) nodes */
+struct ptrie_node {
+    struct ptrie_node *child[2]; /* Next bit 0 / 1 below this prefix */
+    uint32_t prefix;             /* Masked prefix, host byte order */
+    uint8_t plen;                /* Prefix length (0-32) */
+    void *data;                  /* Payload of a stored prefix */
+};
+
+/* A trie and the pool its nodes come from */
+struct ptrie {
+    struct ptrie_node *root; /* Top node (NULL when empty) */
+    unsigned long count;     /* Stored prefixes */
+    struct pool nodes;       /* Node allocator */
+};
+
+/* Callback for walks: return non-zero to stop the walk early */
+typedef int (*ptrie_walk_fn)(uint32_t prefix, uint8_t plen, void *data, void *arg);
+
+/* Netmask for a prefix length, host byte order */
+static inline uint32_t ptrie_mask(uint8_t plen) {
+    return plen ? ~0u << (32 - plen) : 0;
+}
+
+/* Initialize an empty trie */
+void ptrie_init(struct ptrie *t);
+
+/* Free every node; free_data (may be NULL) is called on each payload */
+void ptrie_destroy(struct ptrie *t, void (*free_data)(void *data));
+
+/* Find or create the node for prefix/plen and return its payload slot.
+ * *slot is NULL for a new prefix; the caller must store a non-NULL
+ * payload (or call ptrie_abort_insert) before the next trie operation.
+ * Returns NULL if out of memory. */
+void **ptrie_insert(struct ptrie *t, uint32_t prefix, uint8_t plen);
+
+/* Drop a prefix just created by ptrie_insert while its slot is still NULL
+ * (does nothing to a prefix that holds a payload) */
+void ptrie_abort_insert(struct ptrie *t, uint32_t prefix, uint8_t plen);
+
+/* Exact-match lookup; NULL if the prefix is not stored */
+void *ptrie_lookup(const struct ptrie *t, uint32_t prefix, uint8_t plen);
+
+/* Longest-prefix match for an address; *plen receives the matched length */
+void *ptrie_lpm(const struct ptrie *t, uint32_t addr, uint8_t *plen);
+
+/* Remove a prefix and return its payload (NULL if not stored) */
+void *ptrie_remove(struct ptrie *t, uint32_t prefix, uint8_t plen);
+
+/* Visit every stored prefix in address order */
+void ptrie_walk(const struct ptrie *t, ptrie_walk_fn fn, void *arg);
+
+/* Visit every stored prefix that covers prefix/plen (shortest first) */
+void ptrie_walk_covering(const struct ptrie *t, uint32_t prefix, uint8_t plen,
+                         ptrie_walk_fn fn, void *arg);
+
+/* Visit every stored prefix inside prefix/plen, including itself */
+void ptrie_walk_subtree(const struct ptrie *t, uint32_t prefix, uint8_t plen,
+                        ptrie_walk_fn fn, void *arg);
+
+/* Bytes used by trie nodes */
+unsigned long ptrie_bytes(const struct ptrie *t);
+
+#endif /* PREFIX_TRIE_H */
@@ -0,0 +1,136 @@
+/* rudp.h: Reliable message transport over UDP. A connection carries messages
+ * of up to RUDP_MAX_MESSAGE bytes on up to RUDP_MAX_STREAMS independent streams;
+ * each message is cut into fragments that travel in numbered packets, and a
+ * packet number is never reused, so a lost fragment goes out again in a new
+ * packet and every acknowledgment gives an unambiguous RTT sample (as in QUIC).
+ * The receiver acknowledges with SACK ranges of packet numbers, the sender
+ * declares a packet lost once three later ones are acknowledged or it is 9/8
+ * of an RTT older than one that was, and a probe timeout covers the tail.
+ * Messages are delivered per stream, in order unless sent RUDP_UNORDERED, so a
+ * loss on one stream never holds back another. Sending is limited by a
+ * congestion window and paced over the RTT; the controller is CUBIC (RFC 9438)
+ * or BBR (v1). Everything runs in the caller's thread from rudp_poll, which
+ * waits for datagrams, timers (timer_wheel.h) and pacing, and hands complete
+ * messages to a callback. Like a librarian posting a long manuscript as
+ * numbered parcels, a series per reader, re-posting whichever the reader's
+ * receipts show missing and pacing the parcels to what the post office
+ * delivers. */
+
+#ifndef RUDP_H
+#define RUDP_H
+
+#include <stddef.h>       /* For size_t */
+#include <stdint.h>       /* For uint64_t, uint32_t, uint16_t */
+#include <netinet/in.h>   /* For struct sockaddr_in */
+
+/* Payload bytes per packet: with the 32 bytes of headers and 48 of IPv6 and
+ * UDP, a packet fits the 1280-byte minimum IPv6 MTU */
+#define RUDP_FRAGMENT 1200
+/* Largest message (at most 64 fragments, one bit each) */
+#define RUDP_MAX_MESSAGE 65536
+/* Streams per connection, and messages a stream may have unacknowledged */
+#define RUDP_MAX_STREAMS 256
+#define RUDP_STREAM_WINDOW 256
+
+/* A connection that hears nothing from its peer for this long is closed (ms) */
+#define RUDP_IDLE_MS 10000
+
+/* rudp_send flag: deliver the message as soon as it is complete, without
+ * waiting for earlier messages on its stream */
+#define RUDP_UNORDERED 1
+
+/* Congestion controllers */
+enum rudp_cc {
+    RUDP_CC_CUBIC,      /* Loss-based: cut by 30% on loss, regrow along a cubic */
+    RUDP_CC_BBR         /* Model-based: pace at the measured bottleneck rate */
+};
+
+/* Connection events */
+enum rudp_event {
+    RUDP_EV_ACCEPTED,       /* Server: a peer connected */
+    RUDP_EV_ESTABLISHED,    /* Client: the server answered */
+    RUDP_EV_CLOSED          /* Closed by either side, timed out or failed to connect */
+};
+
+struct rudp_endpoint;
+struct rudp_conn;
+
+/* Endpoint settings and callbacks */
+struct rudp_config {
+    enum rudp_cc cc;            /* Congestion controller for new connections */
+    int accept;                 /* Accept connections from peers (server) */
+    size_t send_buffer;         /* Bytes a connection may hold unacknowledged */
+    /* A complete message, in order on its stream unless it was sent unordered */
+    void (*on_message)(struct rudp_conn *c, uint16_t stream, const void *data, size_t len,
+                       void *arg);
+    /* After RUDP_EV_CLOSED the connection is freed when rudp_poll returns */
+    void (*on_event)(struct rudp_conn *c, enum rudp_event ev, void *arg);
+    void *arg;                  /* Passed to both callbacks */
+};
+
+/* Connection counters and the sender's current estimates */
+struct rudp_stats {
+    unsigned long packets_sent;         /* Data packets, retransmissions included */
+    unsigned long packets_received;     /* Packets of every type */
+    unsigned long bytes_sent;           /* Datagram bytes, acknowledgments included */
+    unsigned long retransmits;          /* Fragments sent again */
+    unsigned long lost;                 /* Data packets declared lost */
+    unsigned long spurious;             /* Of those, acknowledged after all */
+    unsigned long ptos;                 /* Probe timeouts */
+    unsigned long acks_sent;            /* Acknowledgment packets */
+    unsigned long msgs_sent;            /* Messages accepted by rudp_send */
+    unsigned long msgs_acked;           /* Messages the peer has all of */
+    unsigned long msgs_delivered;       /* Messages handed to on_message */
+    unsigned long duplicates;           /* Fragments received more than once */
+    uint64_t srtt_ns, rttvar_ns, min_rtt_ns;
+    uint64_t cwnd;                      /* Congestion window (bytes) */
+    uint64_t bytes_in_flight;
+    double pacing_rate;                 /* Bytes per second (0 = not paced yet) */
+    double delivery_rate;               /* Latest delivery rate sample (bytes/s) */
+    const char *cc_state;               /* Controller phase, e.g. "slow start" */
+};
+
+/* Fill in the defaults: CUBIC, no accepting, a 4 MB send buffer, no callbacks */
+void rudp_config_init(struct rudp_config *cfg);
+
+/* Open an endpoint on a UDP port (0 = any). Returns it, or NULL on error. */
+struct rudp_endpoint *rudp_open(int port, const struct rudp_config *cfg);
+
+/* Close every connection without notice and free the endpoint */
+void rudp_endpoint_close(struct rudp_endpoint *ep);
+
+/* Start a connection to peer; RUDP_EV_ESTABLISHED or RUDP_EV_CLOSED follows
+ * from rudp_poll. Messages may be sent at once and go out when it is up.
+ * Returns the connection, or NULL if out of memory. */
+struct rudp_conn *rudp_connect(struct rudp_endpoint *ep, const struct sockaddr_in *peer);
+
+/* Queue a message on a stream. Returns 0, or -1 with errno EAGAIN (the
+ * stream's window or the send buffer is full: poll and retry), EMSGSIZE,
+ * EINVAL (no such stream), ENOTCONN (closing) or ENOMEM. */
+int rudp_send(struct rudp_conn *c, uint16_t stream, const void *data, size_t len, int flags);
+
+/* Close once everything queued has been acknowledged; RUDP_EV_CLOSED follows */
+void rudp_close(struct rudp_conn *c);
+
+/* Receive, time out, retransmit and send for up to timeout_ms (-1 = until
+ * something happens, 0 = do what is due and return). Returns 0, or -1 on a
+ * socket error. */
+int rudp_poll(struct rudp_endpoint *ep, int timeout_ms);
+
+/* 1 once nothing is queued or unacknowledged on the connection */
+int rudp_idle(const struct rudp_conn *c);
+
+/* Counters and estimates of a connection */
+void rudp_conn_stats(const struct rudp_conn *c, struct rudp_stats *st);
+
+/* The peer's address */
+const struct sockaddr_in *rudp_peer(const struct rudp_conn *c);
+
+/* Attach and fetch the caller's own data for a connection */
+void rudp_set_context(struct rudp_conn *c, void *ctx);
+void *rudp_context(const struct rudp_conn *c);
+
+/* Name of a congestion controller */
+const char *rudp_cc_name(enum rudp_cc cc);
+
+#endif /* RUDP_H */
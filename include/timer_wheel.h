@@ -0,0 +1,63 @@
+/* timer_wheel.h: A hashed timer wheel shared by the netkernel tools that need many
+ * concurrent timeouts (BGP hold/keepalive timers, probe timeouts, reassembly expiry).
+ * Timers hash into a fixed ring of slots by expiry tick; each tick only the current
+ * slot is scanned, so arming, cancelling and firing are O(1) regardless of how many
+ * timers are pending. Like a librarian's ring of daily trays for due-date reminders. */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h> /* For uint64_t (ticks and milliseconds) */
+
+/* Number of slots in the wheel (power of two so the slot index is a mask) */
+#define TW_SLOTS 1024
+
+struct tw_timer;
+
+/* Callback invoked when a timer fires (the timer is already unlinked) */
+typedef void (*tw_callback)(struct tw_timer *timer, void *arg);
+
+/* One timer; embed it in the owning object (peer, probe, fragment queue) */
+struct tw_timer {
+    struct tw_timer *next; /* Next timer in the same slot */
+    struct tw_timer *prev; /* Previous timer in the same slot */
+    uint64_t expires;      /* Absolute expiry tick */
+    tw_callback cb;        /* Function to call on expiry */
+    void *arg;             /* Argument passed to cb */
+};
+
+/* The wheel: slot heads are sentinels so unlinking never needs the wheel */
+struct timer_wheel {
+    struct tw_timer slots[TW_SLOTS]; /* Circular list head per slot */
+    uint64_t tick_ms;                /* Milliseconds per tick (resolution) */
+    uint64_t current;                /* Last tick processed */
+    uint64_t base_ms;                /* Monotonic time of tick 0 */
+    unsigned long pending;           /* Number of armed timers */
+};
+
+/* Current CLOCK_MONOTONIC time in milliseconds */
+uint64_t tw_now_ms(void);
+
+/* Initialize a wheel with the given resolution in milliseconds */
+void tw_init(struct timer_wheel *tw, unsigned tick_ms);
+
+/* Initialize a timer with its callback (does not arm it) */
+void tw_timer_init(struct tw_timer *timer, tw_callback cb, void *arg);
+
+/* Arm (or re-arm) a timer to fire delay_ms from now */
+void tw_add(struct timer_wheel *tw, struct tw_timer *timer, uint64_t delay_ms);
+
+/* Disarm a timer; safe to call on a timer that is not armed */
+void tw_cancel(struct timer_wheel *tw, struct tw_timer *timer);
+
+/* Return 1 if the timer is currently armed */
+int tw_pending(const struct tw_timer *timer);
+
+/* Fire every timer that expired up to now_ms */
+void tw_advance(struct timer_wheel *tw, uint64_t now_ms);
+
+/* Milliseconds until the next tick boundary, or -1 if nothing is armed
+ * (suitable as an epoll_wait/poll timeout) */
+int tw_timeout_ms(const struct timer_wheel *tw, uint64_t now_ms);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,108 @@
+/* epoch.c: Epoch-based memory reclamation implementation (see include/epoch.h). */
+
+/* Include standard libraries for memory management and yielding */
+#include <stdlib.h> /* For realloc, free */
+#include <string.h> /* For memmove */
+#include <sched.h>  /* For sched_yield (epoch_synchronize) */
+#include "epoch.h"  /* For struct epoch_domain */
+
+/* Function to initialize a domain */
+void epoch_init(struct epoch_domain *d) {
+    atomic_init(&d->global, 1);
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        atomic_init(&d->readers[i].epoch, 0);
+        atomic_init(&d->readers[i].in_use, 0);
+    }
+    d->retired = NULL;
+    d->num_retired = d->cap_retired = 0;
+    d->freed = 0;
+}
+
+/* Function to tear a domain down */
+void epoch_destroy(struct epoch_domain *d) {
+    epoch_synchronize(d);
+    free(d->retired);
+    d->retired = NULL;
+    d->cap_retired = 0;
+}
+
+/* Function to claim a free reader slot */
+int epoch_register(struct epoch_domain *d) {
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&d->readers[i].in_use, &expected, 1)) {
+            atomic_store(&d->readers[i].epoch, 0);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Function to release a reader slot */
+void epoch_unregister(struct epoch_domain *d, int slot) {
+    atomic_store(&d->readers[slot].epoch, 0);
+    atomic_store(&d->readers[slot].in_use, 0);
+}
+
+/* Function to queue an unlinked object for freeing */
+int epoch_retire(struct epoch_domain *d, void *ptr, epoch_free_fn fn, void *arg) {
+    if (d->num_retired == d->cap_retired) {
+        size_t cap = d->cap_retired ? d->cap_retired * 2 : 64;
+        struct epoch_retired *list = realloc(d->retired, cap * sizeof(*list));
+        if (!list) {
+            return -1;
+        }
+        d->retired = list;
+        d->cap_retired = cap;
+    }
+    /* Readers that entered before this point hold an epoch <= the stamp; the
+     * increment makes every later reader's epoch larger */
+    struct epoch_retired *r = &d->retired[d->num_retired++];
+    r->ptr = ptr;
+    r->fn = fn;
+    r->arg = arg;
+    r->epoch = atomic_fetch_add(&d->global, 1);
+    return 0;
+}
+
+/* Function to find the oldest epoch any reader is still inside */
+static uint64_t epoch_oldest(struct epoch_domain *d) {
+    uint64_t oldest = UINT64_MAX;
+    atomic_thread_fence(memory_order_seq_cst); /* Unlinks before the slot scan */
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        uint64_t e = atomic_load_explicit(&d->readers[i].epoch, memory_order_acquire);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+    return oldest;
+}
+
+/* Function to free retired objects no reader can reach */
+size_t epoch_reclaim(struct epoch_domain *d) {
+    if (d->num_retired == 0) {
+        return 0;
+    }
+    uint64_t oldest = epoch_oldest(d);
+    /* Stamps only grow along the list, so the reclaimable ones are a prefix */
+    size_t n = 0;
+    while (n < d->num_retired && d->retired[n].epoch < oldest) {
+        struct epoch_retired *r = &d->retired[n++];
+        r->fn(r->ptr, r->arg);
+    }
+    if (n > 0) {
+        memmove(d->retired, d->retired + n, (d->num_retired - n) * sizeof(*d->retired));
+        d->num_retired -= n;
+        d->freed += n;
+    }
+    return n;
+}
+
+/* Function to wait out every pending grace period */
+void epoch_synchronize(struct epoch_domain *d) {
+    uint64_t target = atomic_fetch_add(&d->global, 1);
+    while (epoch_oldest(d) <= target) {
+        sched_yield(); /* Let the readers finish their lookups */
+    }
+    epoch_reclaim(d);
+}
@@ -0,0 +1,289 @@
+/* fib.c: DIR-24-8 IPv4 forwarding table implementation (see include/fib.h). */
+
+/* Include standard libraries for memory management */
+#include <stdlib.h>      /* For calloc, malloc, free */
+#include <string.h>      /* For memset */
+#include "fib.h"         /* For struct fib */
+
+/* Marks "no group available" from fib_tbl8_alloc */
+#define FIB_NO_GROUP 0xFFFFFFFFu
+
+/* Function to build an entry from an index and the prefix length that wrote it */
+static inline uint32_t fib_entry(uint32_t index, uint8_t depth) {
+    return index | (uint32_t)depth << FIB_DEPTH_SHIFT;
+}
+
+/* Function to read back the prefix length stored in an entry */
+static inline uint8_t fib_depth(uint32_t e) {
+    return (e >> FIB_DEPTH_SHIFT) & FIB_DEPTH_MASK;
+}
+
+/* Function to allocate an empty FIB */
+int fib_init(struct fib *f, uint32_t tbl8_groups, uint32_t max_nexthops) {
+    memset(f, 0, sizeof(*f));
+    if (tbl8_groups == 0 || tbl8_groups > FIB_INDEX_MASK + 1 ||
+        max_nexthops < 2 || max_nexthops > FIB_INDEX_MASK + 1) {
+        return -1;
+    }
+    ptrie_init(&f->routes);
+    epoch_init(&f->epoch);
+    uint32_t buckets = 1;
+    while (buckets < max_nexthops) {
+        buckets <<= 1;
+    }
+    /* calloc maps the big arrays lazily; untouched pages cost nothing */
+    f->tbl24 = calloc(FIB_TBL24_SIZE, sizeof(*f->tbl24));
+    f->tbl8 = calloc((size_t)tbl8_groups * 256, sizeof(*f->tbl8));
+    f->tbl8_long = calloc(tbl8_groups, sizeof(*f->tbl8_long));
+    f->tbl8_free = malloc(tbl8_groups * sizeof(*f->tbl8_free));
+    f->nexthops = calloc(max_nexthops, sizeof(*f->nexthops));
+    f->nh_buckets = calloc(buckets, sizeof(*f->nh_buckets));
+    if (!f->tbl24 || !f->tbl8 || !f->tbl8_long || !f->tbl8_free || !f->nexthops ||
+        !f->nh_buckets) {
+        fib_destroy(f);
+        return -1;
+    }
+    f->tbl8_groups = tbl8_groups;
+    for (uint32_t g = 0; g < tbl8_groups; g++) {
+        f->tbl8_free[g] = tbl8_groups - 1 - g; /* Hand out low indexes first */
+    }
+    f->tbl8_num_free = tbl8_groups;
+    f->max_nexthops = max_nexthops;
+    f->nh_mask = buckets - 1;
+    for (uint32_t i = max_nexthops - 1; i > 0; i--) {
+        f->nexthops[i].hash_next = f->nh_free;
+        f->nh_free = i;
+    }
+    return 0;
+}
+
+/* Function to free the FIB */
+void fib_destroy(struct fib *f) {
+    epoch_destroy(&f->epoch);
+    ptrie_destroy(&f->routes, NULL);
+    free(f->tbl24);
+    free(f->tbl8);
+    free(f->tbl8_long);
+    free(f->tbl8_free);
+    free(f->nexthops);
+    free(f->nh_buckets);
+    memset(f, 0, sizeof(*f));
+}
+
+/* Function to recycle what readers can no longer reach */
+void fib_reclaim(struct fib *f) {
+    epoch_reclaim(&f->epoch);
+}
+
+/* Function to hash a next-hop address to its bucket */
+static inline uint32_t fib_nh_bucket(const struct fib *f, uint32_t addr) {
+    return (addr * 0x9E3779B1u >> 7) & f->nh_mask;
+}
+
+/* Function to find or add a next hop, taking a reference. Returns its index,
+ * or 0 if the table is full. */
+static uint32_t fib_nh_get(struct fib *f, uint32_t addr) {
+    uint32_t *bucket = &f->nh_buckets[fib_nh_bucket(f, addr)];
+    for (uint32_t i = *bucket; i; i = f->nexthops[i].hash_next) {
+        if (f->nexthops[i].addr == addr) {
+            f->nexthops[i].refcnt++;
+            return i;
+        }
+    }
+    if (!f->nh_free) {
+        fib_reclaim(f);
+        if (!f->nh_free) {
+            return 0;
+        }
+    }
+    uint32_t i = f->nh_free;
+    struct fib_nexthop *nh = &f->nexthops[i];
+    f->nh_free = nh->hash_next;
+    nh->addr = addr; /* Published to readers by the release store of an entry */
+    nh->refcnt = 1;
+    nh->hash_next = *bucket;
+    *bucket = i;
+    f->nh_used++;
+    return i;
+}
+
+/* Epoch callback: put a next-hop slot back on the free list */
+static void fib_nh_release(void *ptr, void *arg) {
+    struct fib *f = arg;
+    uint32_t i = (uint32_t)(uintptr_t)ptr;
+    f->nexthops[i].hash_next = f->nh_free;
+    f->nh_free = i;
+    f->nh_used--;
+}
+
+/* Function to drop a reference to a next hop; the slot is reused only after
+ * every lookup that might have read its index has finished */
+static void fib_nh_put(struct fib *f, uint32_t i) {
+    if (--f->nexthops[i].refcnt > 0) {
+        return;
+    }
+    uint32_t *link = &f->nh_buckets[fib_nh_bucket(f, f->nexthops[i].addr)];
+    while (*link != i) {
+        link = &f->nexthops[*link].hash_next;
+    }
+    *link = f->nexthops[i].hash_next;
+    if (epoch_retire(&f->epoch, (void *)(uintptr_t)i, fib_nh_release, f) < 0) {
+        epoch_synchronize(&f->epoch);
+        fib_nh_release((void *)(uintptr_t)i, f);
+    }
+}
+
+/* Function to take a second-level group off the free stack */
+static uint32_t fib_tbl8_alloc(struct fib *f) {
+    if (f->tbl8_num_free == 0) {
+        fib_reclaim(f);
+        if (f->tbl8_num_free == 0) {
+            return FIB_NO_GROUP;
+        }
+    }
+    f->tbl8_used++;
+    return f->tbl8_free[--f->tbl8_num_free];
+}
+
+/* Epoch callback: put a group back on the free stack */
+static void fib_tbl8_release(void *ptr, void *arg) {
+    struct fib *f = arg;
+    f->tbl8_free[f->tbl8_num_free++] = (uint32_t)(uintptr_t)ptr;
+    f->tbl8_used--;
+}
+
+/* Function to store ent into the entries of a group range written by a prefix
+ * no longer than plen (insert), or exactly plen long (delete) */
+static void fib_fill8(struct fib *f, uint32_t g, uint32_t first, uint32_t count,
+                      uint32_t ent, uint8_t plen, int exact) {
+    _Atomic uint32_t *slot = f->tbl8 + ((size_t)g << 8) + first;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t d = fib_depth(atomic_load_explicit(&slot[i], memory_order_relaxed));
+        if (exact ? d == plen : d <= plen) {
+            atomic_store_explicit(&slot[i], ent, memory_order_release);
+            f->entries_written++;
+        }
+    }
+}
+
+/* Function to do the same over a range of first-level entries, descending into
+ * the groups of /24s that hold longer prefixes */
+static void fib_fill24(struct fib *f, uint32_t first, uint32_t count, uint32_t ent,
+                       uint8_t plen, int exact) {
+    _Atomic uint32_t *slot = f->tbl24 + first;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t e = atomic_load_explicit(&slot[i], memory_order_relaxed);
+        if (e & FIB_EXT) {
+            fib_fill8(f, e & FIB_INDEX_MASK, 0, 256, ent, plen, exact);
+        } else if (exact ? fib_depth(e) == plen : fib_depth(e) <= plen) {
+            atomic_store_explicit(&slot[i], ent, memory_order_release);
+            f->entries_written++;
+        }
+    }
+}
+
+/* Function to install or replace a route */
+int fib_insert(struct fib *f, uint32_t prefix, uint8_t plen, uint32_t next_hop) {
+    prefix &= ptrie_mask(plen);
+    uint32_t nh = fib_nh_get(f, next_hop);
+    if (!nh) {
+        return -1;
+    }
+    void **data = ptrie_insert(&f->routes, prefix, plen);
+    if (!data) {
+        fib_nh_put(f, nh);
+        return -1;
+    }
+    uint32_t old = (uint32_t)(uintptr_t)*data;
+    if (old == nh) {
+        fib_nh_put(f, nh); /* Same next hop: nothing to rewrite */
+        return 0;
+    }
+    uint32_t ent = fib_entry(nh, plen);
+
+    if (plen <= 24) {
+        *data = (void *)(uintptr_t)nh;
+        fib_fill24(f, prefix >> 8, 1u << (24 - plen), ent, plen, 0);
+    } else {
+        _Atomic uint32_t *slot = &f->tbl24[prefix >> 8];
+        uint32_t e = atomic_load_explicit(slot, memory_order_relaxed);
+        uint32_t g = e & FIB_INDEX_MASK;
+        if (!(e & FIB_EXT)) {
+            /* First long prefix in this /24: copy the /24's entry into a new
+             * group, then publish the group with one store */
+            g = fib_tbl8_alloc(f);
+            if (g == FIB_NO_GROUP) {
+                ptrie_abort_insert(&f->routes, prefix, plen); /* No route stored yet */
+                fib_nh_put(f, nh);
+                return -1;
+            }
+            _Atomic uint32_t *group = f->tbl8 + ((size_t)g << 8);
+            for (int i = 0; i < 256; i++) {
+                atomic_store_explicit(&group[i], e, memory_order_relaxed);
+            }
+            atomic_store_explicit(slot, FIB_EXT | g, memory_order_release);
+            f->entries_written += 257;
+        }
+        if (!old) {
+            f->tbl8_long[g]++;
+        }
+        *data = (void *)(uintptr_t)nh;
+        fib_fill8(f, g, prefix & 0xFF, 1u << (32 - plen), ent, plen, 0);
+    }
+    if (old) {
+        fib_nh_put(f, old);
+    }
+    f->updates++;
+    fib_reclaim(f);
+    return 0;
+}
+
+/* Walk callback: remember the longest covering route seen so far */
+static int fib_cover(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    *(uint32_t *)arg = fib_entry((uint32_t)(uintptr_t)data, plen);
+    return 0;
+}
+
+/* Function to remove a route */
+int fib_delete(struct fib *f, uint32_t prefix, uint8_t plen) {
+    prefix &= ptrie_mask(plen);
+    uint32_t nh = (uint32_t)(uintptr_t)ptrie_remove(&f->routes, prefix, plen);
+    if (!nh) {
+        return -1;
+    }
+    /* Entries this route wrote now take the next shorter covering route */
+    uint32_t ent = 0;
+    ptrie_walk_covering(&f->routes, prefix, plen, fib_cover, &ent);
+
+    if (plen <= 24) {
+        fib_fill24(f, prefix >> 8, 1u << (24 - plen), ent, plen, 1);
+    } else {
+        _Atomic uint32_t *slot = &f->tbl24[prefix >> 8];
+        uint32_t g = atomic_load_explicit(slot, memory_order_relaxed) & FIB_INDEX_MASK;
+        fib_fill8(f, g, prefix & 0xFF, 1u << (32 - plen), ent, plen, 1);
+        if (--f->tbl8_long[g] == 0) {
+            /* Only /24-or-shorter routes left: every entry in the group is the
+             * same, so fold it back into the first level */
+            uint32_t e = atomic_load_explicit(&f->tbl8[(size_t)g << 8], memory_order_relaxed);
+            atomic_store_explicit(slot, e, memory_order_release);
+            f->entries_written++;
+            if (epoch_retire(&f->epoch, (void *)(uintptr_t)g, fib_tbl8_release, f) < 0) {
+                epoch_synchronize(&f->epoch);
+                fib_tbl8_release((void *)(uintptr_t)g, f);
+            }
+        }
+    }
+    fib_nh_put(f, nh);
+    f->updates++;
+    fib_reclaim(f);
+    return 0;
+}
+
+/* Function to report memory held by the FIB */
+unsigned long fib_bytes(const struct fib *f) {
+    return FIB_TBL24_SIZE * sizeof(*f->tbl24) +
+           (unsigned long)f->tbl8_groups * (256 * sizeof(*f->tbl8) + 2 * sizeof(uint32_t)) +
+           f->max_nexthops * sizeof(*f->nexthops) + (f->nh_mask + 1UL) * sizeof(uint32_t) +
+           ptrie_bytes(&f->routes);
+}
@@ -0,0 +1,696 @@
+/* fib6.c: Poptrie IPv6 forwarding table implementation (see include/fib6.h).
+ * The writer-side trie is path-compressed like prefix_trie.c, on 128-bit keys.
+ * A subtree is built breadth first, so the children of every node are appended
+ * to the node and leaf arrays together and end up contiguous. */
+
+/* Include standard libraries for memory management */
+#include <stdlib.h>      /* For malloc, aligned_alloc, realloc, free */
+#include <string.h>      /* For memset, memcpy */
+#include <endian.h>      /* For be64toh, htobe64 */
+#include "fib6.h"        /* For struct fib6, struct fib6_subtree */
+
+/* Trie nodes carved per pool block */
+#define FIB6_TNODES_PER_BLOCK 8192
+/* Lookups fib6_lookup_batch walks in step */
+#define FIB6_BATCH 8
+
+/* A host-order address; keys stored in pool objects are only 8-byte aligned */
+typedef unsigned __int128 fib6_key;
+typedef unsigned __int128 fib6_key8 __attribute__((aligned(8)));
+
+/* Writer-side trie node; has_route is 0 for branch-only (glue) nodes */
+struct fib6_tnode {
+    struct fib6_tnode *child[2];  /* Next bit 0 / 1 below this prefix */
+    fib6_key8 prefix;             /* Masked prefix */
+    uint8_t plen;                 /* Prefix length (0-128) */
+    uint8_t has_route;            /* A route is installed here */
+    uint16_t next_hop;            /* Its next-hop index */
+};
+
+/* A node waiting to be filled in while a subtree is built */
+struct fib6_pending {
+    fib6_key base;                   /* First address the node covers */
+    const struct fib6_tnode *sub;    /* Trie node holding the routes inside it */
+    uint16_t def;                    /* Next hop of the longest route covering it */
+    uint8_t len;                     /* Bits its position fixes */
+};
+
+/* Scratch arrays for building subtrees, reused across one commit */
+struct fib6_build {
+    struct fib6_node *nodes;
+    struct fib6_pending *pending;    /* Parallel to nodes */
+    uint32_t num_nodes, cap_nodes;
+    uint16_t *leaves;
+    uint32_t num_leaves, cap_leaves;
+};
+
+/* Function to turn an address into a host-order key */
+static inline fib6_key fib6_key_of(const struct in6_addr *a) {
+    uint64_t hi, lo;
+    memcpy(&hi, a->s6_addr, 8);
+    memcpy(&lo, a->s6_addr + 8, 8);
+    return (fib6_key)be64toh(hi) << 64 | be64toh(lo);
+}
+
+/* Function to turn a key back into an address */
+static inline void fib6_addr_of(fib6_key k, struct in6_addr *a) {
+    uint64_t hi = htobe64((uint64_t)(k >> 64));
+    uint64_t lo = htobe64((uint64_t)k);
+    memcpy(a->s6_addr, &hi, 8);
+    memcpy(a->s6_addr + 8, &lo, 8);
+}
+
+/* Netmask of a prefix length */
+static inline fib6_key fib6_mask(uint8_t plen) {
+    return plen ? ~(fib6_key)0 << (128 - plen) : 0;
+}
+
+/* Bit i (0 = most significant) of a key */
+static inline int fib6_bit(fib6_key k, uint8_t i) {
+    return (int)(k >> (127 - i)) & 1;
+}
+
+/* Number of leading bits two keys share */
+static inline uint8_t fib6_common(fib6_key a, fib6_key b) {
+    fib6_key diff = a ^ b;
+    uint64_t hi = (uint64_t)(diff >> 64);
+    if (hi) {
+        return (uint8_t)__builtin_clzll(hi);
+    }
+    return (uint64_t)diff ? (uint8_t)(64 + __builtin_clzll((uint64_t)diff)) : 128;
+}
+
+/* The FIB6_STRIDE bits of a key starting at bit pos (bits past 127 read as 0) */
+static inline unsigned fib6_chunk(fib6_key k, unsigned pos) {
+    return (unsigned)(uint64_t)((k << pos) >> (128 - FIB6_STRIDE));
+}
+
+/* Function to take one step down a subtree: moves *n to the child node and
+ * returns -1, or returns the next hop if the child is a leaf */
+static inline __attribute__((always_inline))
+int fib6_step(const struct fib6_subtree *t, const struct fib6_node **n, fib6_key k, unsigned pos) {
+    const struct fib6_node *nd = *n;
+    uint64_t bit = 1ULL << fib6_chunk(k, pos);
+    uint64_t below = bit | (bit - 1);
+    if (nd->vector & bit) {
+        *n = &t->nodes[nd->base1 + __builtin_popcountll(nd->vector & below) - 1];
+        return -1;
+    }
+    return t->leaves[nd->base0 + __builtin_popcountll(nd->leafvec & below) - 1];
+}
+
+/* Function to look one address up (inlined into each CPU variant) */
+static inline __attribute__((always_inline))
+uint16_t fib6_lookup_body(const struct fib6 *f, const struct in6_addr *addr) {
+    fib6_key k = fib6_key_of(addr);
+    uintptr_t e = atomic_load_explicit(&f->direct[(uint32_t)(k >> (128 - f->direct_bits))],
+                                       memory_order_acquire);
+    if (e & FIB6_DIRECT_LEAF) {
+        return (uint16_t)(e >> 1);
+    }
+    const struct fib6_subtree *t = (const struct fib6_subtree *)e;
+    const struct fib6_node *n = t->nodes;
+    for (unsigned pos = f->direct_bits;; pos += FIB6_STRIDE) {
+        int nh = fib6_step(t, &n, k, pos);
+        if (nh >= 0) {
+            return (uint16_t)nh;
+        }
+    }
+}
+
+/* Function to look a batch up, walking FIB6_BATCH lookups one level at a time
+ * so the cache misses of each level overlap instead of queueing */
+static inline __attribute__((always_inline))
+void fib6_batch_body(const struct fib6 *f, const struct in6_addr *addrs, uint16_t *next_hops,
+                     size_t n) {
+    unsigned shift = 128 - f->direct_bits;
+    size_t i = 0;
+    for (; i + FIB6_BATCH <= n; i += FIB6_BATCH) {
+        fib6_key k[FIB6_BATCH];
+        const struct fib6_subtree *t[FIB6_BATCH];
+        const struct fib6_node *nd[FIB6_BATCH];
+        unsigned active = 0;
+        for (int j = 0; j < FIB6_BATCH; j++) {
+            k[j] = fib6_key_of(&addrs[i + j]);
+            __builtin_prefetch(&f->direct[(uint32_t)(k[j] >> shift)]);
+        }
+        for (int j = 0; j < FIB6_BATCH; j++) {
+            uintptr_t e = atomic_load_explicit(&f->direct[(uint32_t)(k[j] >> shift)],
+                                               memory_order_acquire);
+            if (e & FIB6_DIRECT_LEAF) {
+                next_hops[i + j] = (uint16_t)(e >> 1);
+            } else {
+                t[j] = (const struct fib6_subtree *)e;
+                nd[j] = t[j]->nodes;
+                __builtin_prefetch(nd[j]);
+                active |= 1u << j;
+            }
+        }
+        for (unsigned pos = f->direct_bits; active; pos += FIB6_STRIDE) {
+            for (int j = 0; j < FIB6_BATCH; j++) {
+                if (!(active & 1u << j)) {
+                    continue;
+                }
+                int nh = fib6_step(t[j], &nd[j], k[j], pos);
+                if (nh >= 0) {
+                    next_hops[i + j] = (uint16_t)nh;
+                    active &= ~(1u << j);
+                } else {
+                    __builtin_prefetch(nd[j]);
+                }
+            }
+        }
+    }
+    for (; i < n; i++) {
+        next_hops[i] = fib6_lookup_body(f, &addrs[i]);
+    }
+}
+
+/* Portable variants: POPCNT is not in the x86-64 baseline, so these count bits
+ * with a table or shifts */
+static uint16_t fib6_lookup_generic(const struct fib6 *f, const struct in6_addr *addr) {
+    return fib6_lookup_body(f, addr);
+}
+
+static void fib6_batch_generic(const struct fib6 *f, const struct in6_addr *addrs,
+                               uint16_t *next_hops, size_t n) {
+    fib6_batch_body(f, addrs, next_hops, n);
+}
+
+#if defined(__x86_64__)
+/* Variants using the POPCNT instruction, chosen at run time when the CPU has it */
+__attribute__((target("popcnt")))
+static uint16_t fib6_lookup_popcnt(const struct fib6 *f, const struct in6_addr *addr) {
+    return fib6_lookup_body(f, addr);
+}
+
+__attribute__((target("popcnt")))
+static void fib6_batch_popcnt(const struct fib6 *f, const struct in6_addr *addrs,
+                              uint16_t *next_hops, size_t n) {
+    fib6_batch_body(f, addrs, next_hops, n);
+}
+#endif
+
+/* Function to look up n addresses with the variant fib6_init chose */
+void fib6_lookup_batch(const struct fib6 *f, const struct in6_addr *addrs, uint16_t *next_hops,
+                       size_t n) {
+#if defined(__x86_64__)
+    if (f->lookup_fn == fib6_lookup_popcnt) {
+        fib6_batch_popcnt(f, addrs, next_hops, n);
+        return;
+    }
+#endif
+    fib6_batch_generic(f, addrs, next_hops, n);
+}
+
+/* Function to count the nodes a lookup visits */
+int fib6_lookup_depth(const struct fib6 *f, const struct in6_addr *addr) {
+    fib6_key k = fib6_key_of(addr);
+    uintptr_t e = atomic_load_explicit(&f->direct[(uint32_t)(k >> (128 - f->direct_bits))],
+                                       memory_order_acquire);
+    if (e & FIB6_DIRECT_LEAF) {
+        return 0;
+    }
+    const struct fib6_subtree *t = (const struct fib6_subtree *)e;
+    const struct fib6_node *n = t->nodes;
+    int depth = 1;
+    for (unsigned pos = f->direct_bits; fib6_step(t, &n, k, pos) < 0; pos += FIB6_STRIDE) {
+        depth++;
+    }
+    return depth;
+}
+
+/* Function to allocate an empty FIB */
+int fib6_init(struct fib6 *f, unsigned direct_bits) {
+    memset(f, 0, sizeof(*f));
+    if (direct_bits == 0) {
+        direct_bits = FIB6_DIRECT_BITS;
+    }
+    if (direct_bits < FIB6_MIN_DIRECT_BITS || direct_bits > FIB6_MAX_DIRECT_BITS) {
+        return -1;
+    }
+    epoch_init(&f->epoch);
+    pool_init(&f->tnodes, sizeof(struct fib6_tnode), FIB6_TNODES_PER_BLOCK, 0);
+    size_t slots = (size_t)1 << direct_bits;
+    f->direct = malloc(slots * sizeof(*f->direct));
+    f->dirty = calloc(slots / 64, sizeof(*f->dirty));
+    if (!f->direct || !f->dirty) {
+        fib6_destroy(f);
+        return -1;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&f->direct[i], FIB6_DIRECT_LEAF); /* Next hop 0: no route */
+    }
+    f->direct_bits = direct_bits;
+    f->dirty_lo = UINT32_MAX;
+    f->dirty_hi = 0;
+    f->lookup_fn = fib6_lookup_generic;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt")) {
+        f->lookup_fn = fib6_lookup_popcnt;
+    }
+#endif
+    return 0;
+}
+
+/* Function to free the FIB */
+void fib6_destroy(struct fib6 *f) {
+    epoch_destroy(&f->epoch);
+    if (f->direct) {
+        for (size_t i = 0; i < (size_t)1 << f->direct_bits; i++) {
+            uintptr_t e = atomic_load_explicit(&f->direct[i], memory_order_relaxed);
+            if (!(e & FIB6_DIRECT_LEAF)) {
+                free((void *)e);
+            }
+        }
+    }
+    pool_destroy(&f->tnodes);
+    free(f->direct);
+    free(f->dirty);
+    memset(f, 0, sizeof(*f));
+}
+
+/* Function to mark the direct slots a prefix spans for rebuilding */
+static void fib6_mark(struct fib6 *f, fib6_key prefix, uint8_t plen) {
+    uint32_t first = (uint32_t)(prefix >> (128 - f->direct_bits));
+    uint32_t end = first + (plen >= f->direct_bits ? 1 : 1u << (f->direct_bits - plen));
+    for (uint32_t i = first; i < end;) {
+        if ((i & 63) == 0 && end - i >= 64) {
+            f->dirty[i >> 6] = ~0ULL;
+            i += 64;
+        } else {
+            f->dirty[i >> 6] |= 1ULL << (i & 63);
+            i++;
+        }
+    }
+    if (first < f->dirty_lo) {
+        f->dirty_lo = first;
+    }
+    if (end - 1 > f->dirty_hi) {
+        f->dirty_hi = end - 1;
+    }
+}
+
+/* Function to allocate a trie node */
+static struct fib6_tnode *fib6_tnode_new(struct fib6 *f, fib6_key prefix, uint8_t plen) {
+    struct fib6_tnode *n = pool_alloc(&f->tnodes);
+    if (n) {
+        n->child[0] = n->child[1] = NULL;
+        n->prefix = prefix;
+        n->plen = plen;
+        n->has_route = 0;
+        n->next_hop = 0;
+    }
+    return n;
+}
+
+/* Function to find or create the trie node of a prefix */
+static struct fib6_tnode *fib6_tnode_get(struct fib6 *f, fib6_key prefix, uint8_t plen) {
+    struct fib6_tnode **link = &f->root;
+    struct fib6_tnode *n;
+
+    while ((n = *link) != NULL) {
+        uint8_t common = fib6_common(prefix, n->prefix);
+        if (common > plen) {
+            common = plen;
+        }
+        if (common > n->plen) {
+            common = n->plen;
+        }
+
+        if (common < n->plen) {
+            /* The new prefix diverges inside (or ends above) this node */
+            struct fib6_tnode *leaf = fib6_tnode_new(f, prefix, plen);
+            if (!leaf) {
+                return NULL;
+            }
+            if (common == plen) {
+                /* New prefix is an ancestor of n */
+                leaf->child[fib6_bit(n->prefix, plen)] = n;
+                *link = leaf;
+            } else {
+                /* Branch point where the two prefixes differ */
+                struct fib6_tnode *glue = fib6_tnode_new(f, prefix & fib6_mask(common), common);
+                if (!glue) {
+                    pool_free(&f->tnodes, leaf);
+                    return NULL;
+                }
+                glue->child[fib6_bit(prefix, common)] = leaf;
+                glue->child[fib6_bit(n->prefix, common)] = n;
+                *link = glue;
+            }
+            return leaf;
+        }
+
+        /* n covers the prefix */
+        if (n->plen == plen) {
+            return n;
+        }
+        link = &n->child[fib6_bit(prefix, n->plen)];
+    }
+
+    n = fib6_tnode_new(f, prefix, plen);
+    if (n) {
+        *link = n;
+    }
+    return n;
+}
+
+/* Function to install or replace a route */
+int fib6_insert(struct fib6 *f, const struct in6_addr *prefix, uint8_t plen, uint16_t next_hop) {
+    if (plen > 128 || next_hop == 0) {
+        return -1;
+    }
+    fib6_key k = fib6_key_of(prefix) & fib6_mask(plen);
+    struct fib6_tnode *n = fib6_tnode_get(f, k, plen);
+    if (!n) {
+        return -1;
+    }
+    if (n->has_route && n->next_hop == next_hop) {
+        return 0; /* Nothing changes */
+    }
+    if (!n->has_route) {
+        n->has_route = 1;
+        f->count++;
+    }
+    n->next_hop = next_hop;
+    fib6_mark(f, k, plen);
+    f->stats.updates++;
+    return 0;
+}
+
+/* Function to remove a route, collapsing glue nodes left behind */
+int fib6_delete(struct fib6 *f, const struct in6_addr *prefix, uint8_t plen) {
+    if (plen > 128) {
+        return -1;
+    }
+    fib6_key k = fib6_key_of(prefix) & fib6_mask(plen);
+    struct fib6_tnode **parent_link = NULL;
+    struct fib6_tnode **link = &f->root;
+    struct fib6_tnode *n = f->root;
+
+    while (n && n->plen < plen) {
+        if ((k & fib6_mask(n->plen)) != n->prefix) {
+            return -1;
+        }
+        parent_link = link;
+        link = &n->child[fib6_bit(k, n->plen)];
+        n = *link;
+    }
+    if (!n || n->plen != plen || n->prefix != k || !n->has_route) {
+        return -1;
+    }
+    n->has_route = 0;
+    n->next_hop = 0;
+    f->count--;
+    fib6_mark(f, k, plen);
+    f->stats.updates++;
+
+    if (n->child[0] && n->child[1]) {
+        return 0; /* Still needed as a branch point */
+    }
+
+    /* Splice n out, replacing it with its only child (if any) */
+    *link = n->child[0] ? n->child[0] : n->child[1];
+    pool_free(&f->tnodes, n);
+
+    /* A glue parent left with one child is no longer a branch point */
+    if (parent_link) {
+        struct fib6_tnode *p = *parent_link;
+        if (!p->has_route && (!p->child[0] || !p->child[1])) {
+            *parent_link = p->child[0] ? p->child[0] : p->child[1];
+            pool_free(&f->tnodes, p);
+        }
+    }
+    return 0;
+}
+
+/* Function to find an exact prefix */
+uint16_t fib6_get(const struct fib6 *f, const struct in6_addr *prefix, uint8_t plen) {
+    fib6_key k = fib6_key_of(prefix) & fib6_mask(plen);
+    const struct fib6_tnode *n = f->root;
+    while (n && n->plen <= plen) {
+        if ((k & fib6_mask(n->plen)) != n->prefix) {
+            return 0;
+        }
+        if (n->plen == plen) {
+            return n->has_route ? n->next_hop : 0;
+        }
+        n = n->child[fib6_bit(k, n->plen)];
+    }
+    return 0;
+}
+
+/* Function to find the longest route covering an address in the trie */
+uint16_t fib6_lookup_slow(const struct fib6 *f, const struct in6_addr *addr) {
+    fib6_key k = fib6_key_of(addr);
+    const struct fib6_tnode *n = f->root;
+    uint16_t best = 0;
+    while (n) {
+        if ((k & fib6_mask(n->plen)) != n->prefix) {
+            break;
+        }
+        if (n->has_route) {
+            best = n->next_hop;
+        }
+        if (n->plen == 128) {
+            break;
+        }
+        n = n->child[fib6_bit(k, n->plen)];
+    }
+    return best;
+}
+
+/* Function to walk a subtree in order; returns non-zero if stopped */
+static int fib6_walk_node(const struct fib6_tnode *n,
+                          int (*fn)(const struct in6_addr *prefix, uint8_t plen,
+                                    uint16_t next_hop, void *arg),
+                          void *arg) {
+    if (!n) {
+        return 0;
+    }
+    if (n->has_route) {
+        struct in6_addr a;
+        fib6_addr_of(n->prefix, &a);
+        if (fn(&a, n->plen, n->next_hop, arg)) {
+            return 1;
+        }
+    }
+    return fib6_walk_node(n->child[0], fn, arg) || fib6_walk_node(n->child[1], fn, arg);
+}
+
+/* Function to walk every route */
+void fib6_walk(const struct fib6 *f,
+               int (*fn)(const struct in6_addr *prefix, uint8_t plen, uint16_t next_hop,
+                         void *arg),
+               void *arg) {
+    fib6_walk_node(f->root, fn, arg);
+}
+
+/* Function to find what the trie says about the len-bit block starting at base:
+ * *def picks up the next hop of each route covering the block, and the node
+ * returned holds every route strictly inside it (NULL if there is none) */
+static const struct fib6_tnode *fib6_descend(const struct fib6_tnode *n, fib6_key base,
+                                             uint8_t len, uint16_t *def) {
+    while (n) {
+        uint8_t common = fib6_common(n->prefix, base);
+        if (n->plen > len) {
+            return common >= len ? n : NULL;
+        }
+        if (common < n->plen) {
+            return NULL;
+        }
+        if (n->has_route) {
+            *def = n->next_hop;
+        }
+        if (n->plen == len) {
+            return n->child[0] || n->child[1] ? n : NULL;
+        }
+        n = n->child[fib6_bit(base, n->plen)];
+    }
+    return NULL;
+}
+
+/* Function to append a node to the build arrays */
+static int fib6_build_node(struct fib6_build *b, fib6_key base, uint8_t len, uint16_t def,
+                           const struct fib6_tnode *sub) {
+    if (b->num_nodes == b->cap_nodes) {
+        uint32_t cap = b->cap_nodes ? b->cap_nodes * 2 : 64;
+        struct fib6_node *nodes = realloc(b->nodes, cap * sizeof(*nodes));
+        if (!nodes) {
+            return -1;
+        }
+        b->nodes = nodes;
+        struct fib6_pending *pending = realloc(b->pending, cap * sizeof(*pending));
+        if (!pending) {
+            return -1;
+        }
+        b->pending = pending;
+        b->cap_nodes = cap;
+    }
+    b->pending[b->num_nodes] = (struct fib6_pending){ base, sub, def, len };
+    b->num_nodes++;
+    return 0;
+}
+
+/* Function to append a leaf to the build arrays */
+static int fib6_build_leaf(struct fib6_build *b, uint16_t next_hop) {
+    if (b->num_leaves == b->cap_leaves) {
+        uint32_t cap = b->cap_leaves ? b->cap_leaves * 2 : 256;
+        uint16_t *leaves = realloc(b->leaves, cap * sizeof(*leaves));
+        if (!leaves) {
+            return -1;
+        }
+        b->leaves = leaves;
+        b->cap_leaves = cap;
+    }
+    b->leaves[b->num_leaves++] = next_hop;
+    return 0;
+}
+
+/* Bytes of a subtree allocation */
+static size_t fib6_subtree_size(uint32_t num_nodes, uint32_t num_leaves) {
+    size_t size = sizeof(struct fib6_subtree) + num_nodes * sizeof(struct fib6_node) +
+                  num_leaves * sizeof(uint16_t);
+    return (size + 63) & ~(size_t)63;
+}
+
+/* Function to build the subtree under one direct slot whose routes hang off sub */
+static struct fib6_subtree *fib6_build_subtree(struct fib6 *f, struct fib6_build *b,
+                                               fib6_key base, uint16_t def,
+                                               const struct fib6_tnode *sub) {
+    b->num_nodes = b->num_leaves = 0;
+    if (fib6_build_node(b, base, (uint8_t)f->direct_bits, def, sub) < 0) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < b->num_nodes; i++) {
+        struct fib6_pending p = b->pending[i];
+        unsigned child_len = p.len + FIB6_STRIDE;
+        struct fib6_node node = { 0, 0, b->num_leaves, b->num_nodes };
+        int have_leaf = 0;
+        uint16_t last = 0;
+        for (unsigned c = 0; c < 64; c++) {
+            /* Past bit 127 the low bits of c are padding: those children repeat
+             * their neighbor and are never reached */
+            fib6_key child_base;
+            uint8_t len;
+            if (child_len <= 128) {
+                child_base = p.base | (fib6_key)c << (128 - child_len);
+                len = (uint8_t)child_len;
+            } else {
+                child_base = p.base | (fib6_key)(c >> (child_len - 128));
+                len = 128;
+            }
+            uint16_t nh = p.def;
+            const struct fib6_tnode *inside = fib6_descend(p.sub, child_base, len, &nh);
+            if (inside && len < 128) {
+                node.vector |= 1ULL << c;
+                if (fib6_build_node(b, child_base, len, nh, inside) < 0) {
+                    return NULL;
+                }
+            } else if (!have_leaf || nh != last) {
+                /* Leaf compression: only the start of each run is stored */
+                node.leafvec |= 1ULL << c;
+                if (fib6_build_leaf(b, nh) < 0) {
+                    return NULL;
+                }
+                have_leaf = 1;
+                last = nh;
+            }
+        }
+        b->nodes[i] = node;
+    }
+
+    size_t size = fib6_subtree_size(b->num_nodes, b->num_leaves);
+    struct fib6_subtree *t = aligned_alloc(64, size);
+    if (!t) {
+        return NULL;
+    }
+    t->num_nodes = b->num_nodes;
+    t->num_leaves = b->num_leaves;
+    memcpy(t->nodes, b->nodes, b->num_nodes * sizeof(struct fib6_node));
+    uint16_t *leaves = (uint16_t *)(t->nodes + b->num_nodes);
+    memcpy(leaves, b->leaves, b->num_leaves * sizeof(uint16_t));
+    t->leaves = leaves;
+    return t;
+}
+
+/* Function to free a subtree once readers have left it */
+static void fib6_subtree_release(void *ptr, void *arg) {
+    (void)arg;
+    free(ptr);
+}
+
+/* Function to rebuild one direct slot and swap the result in */
+static int fib6_rebuild(struct fib6 *f, struct fib6_build *b, uint32_t slot) {
+    fib6_key base = (fib6_key)slot << (128 - f->direct_bits);
+    uint16_t def = 0;
+    const struct fib6_tnode *sub = fib6_descend(f->root, base, (uint8_t)f->direct_bits, &def);
+    uintptr_t e = (uintptr_t)def << 1 | FIB6_DIRECT_LEAF;
+    struct fib6_subtree *t = NULL;
+    if (sub) {
+        t = fib6_build_subtree(f, b, base, def, sub);
+        if (!t) {
+            return -1;
+        }
+        e = (uintptr_t)t;
+        f->stats.nodes += t->num_nodes;
+        f->stats.leaves += t->num_leaves;
+        f->stats.subtrees++;
+        f->stats.subtree_bytes += fib6_subtree_size(t->num_nodes, t->num_leaves);
+    }
+
+    uintptr_t old = atomic_load_explicit(&f->direct[slot], memory_order_relaxed);
+    atomic_store_explicit(&f->direct[slot], e, memory_order_release);
+    if (!(old & FIB6_DIRECT_LEAF)) {
+        struct fib6_subtree *o = (struct fib6_subtree *)old;
+        f->stats.nodes -= o->num_nodes;
+        f->stats.leaves -= o->num_leaves;
+        f->stats.subtrees--;
+        f->stats.subtree_bytes -= fib6_subtree_size(o->num_nodes, o->num_leaves);
+        if (epoch_retire(&f->epoch, o, fib6_subtree_release, NULL) < 0) {
+            epoch_synchronize(&f->epoch);
+            free(o);
+        }
+    }
+    return 0;
+}
+
+/* Function to publish every change since the last commit */
+int fib6_commit(struct fib6 *f) {
+    if (f->dirty_lo > f->dirty_hi) {
+        return 0;
+    }
+    struct fib6_build b = { 0 };
+    int rc = 0;
+    for (uint32_t w = f->dirty_lo >> 6; w <= f->dirty_hi >> 6 && rc == 0; w++) {
+        while (f->dirty[w]) {
+            uint32_t slot = w * 64 + (uint32_t)__builtin_ctzll(f->dirty[w]);
+            if (fib6_rebuild(f, &b, slot) < 0) {
+                f->dirty_lo = slot; /* The rest stays marked for the next try */
+                rc = -1;
+                break;
+            }
+            f->dirty[w] &= f->dirty[w] - 1;
+            f->stats.slots_rebuilt++;
+        }
+    }
+    if (rc == 0) {
+        f->dirty_lo = UINT32_MAX;
+        f->dirty_hi = 0;
+    }
+    f->stats.commits++;
+    free(b.nodes);
+    free(b.pending);
+    free(b.leaves);
+    epoch_reclaim(&f->epoch);
+    return rc;
+}
+
+/* Function to report memory use */
+unsigned long fib6_bytes(const struct fib6 *f) {
+    size_t slots = (size_t)1 << f->direct_bits;
+    return slots * sizeof(*f->direct) + slots / 8 + f->stats.subtree_bytes +
+           pool_bytes(&f->tnodes);
+}
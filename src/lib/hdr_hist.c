@@ -0,0 +1,119 @@
+/* hdr_hist.c: High dynamic range histogram implementation (see include/hdr_hist.h). */
+
+/* Include standard libraries for memory management */
+#include <stdlib.h>     /* For calloc, free */
+#include <string.h>     /* For memset */
+#include "hdr_hist.h"   /* For struct hdr_hist */
+
+/* Function to map a value to its bucket. Values below 2^sub_bits have a bucket
+ * each; above that, the top sub_bits + 1 bits pick the bucket. */
+static inline uint32_t hdr_index(const struct hdr_hist *h, uint64_t value) {
+    uint64_t sub_count = 1ULL << h->sub_bits;
+    if (value < sub_count) {
+        return (uint32_t)value;
+    }
+    unsigned shift = 63 - __builtin_clzll(value) - h->sub_bits;
+    return (uint32_t)((shift + 1) * sub_count + ((value >> shift) - sub_count));
+}
+
+/* Function to return the largest value that maps to a bucket */
+static inline uint64_t hdr_upper(const struct hdr_hist *h, uint32_t index) {
+    uint64_t sub_count = 1ULL << h->sub_bits;
+    if (index < sub_count) {
+        return index;
+    }
+    unsigned shift = index / sub_count - 1;
+    uint64_t base = sub_count + index % sub_count;
+    return ((base + 1) << shift) - 1;
+}
+
+/* Function to allocate an empty histogram */
+int hdr_hist_init(struct hdr_hist *h, uint64_t max_value, unsigned sub_bits) {
+    memset(h, 0, sizeof(*h));
+    if (sub_bits < 1 || sub_bits > 16 || max_value == 0 || max_value >> 62) {
+        return -1;
+    }
+    h->sub_bits = sub_bits;
+    h->max_value = max_value;
+    h->num_counts = hdr_index(h, max_value) + 1;
+    h->counts = calloc(h->num_counts, sizeof(*h->counts));
+    return h->counts ? 0 : -1;
+}
+
+/* Function to free the counters */
+void hdr_hist_free(struct hdr_hist *h) {
+    free(h->counts);
+    memset(h, 0, sizeof(*h));
+}
+
+/* Function to count one value */
+void hdr_hist_record(struct hdr_hist *h, uint64_t value) {
+    if (value > h->max_value) {
+        value = h->max_value;
+        h->clamped++;
+    }
+    h->counts[hdr_index(h, value)]++;
+    if (h->total == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+    h->total++;
+}
+
+/* Function to forget every recorded value */
+void hdr_hist_reset(struct hdr_hist *h) {
+    memset(h->counts, 0, h->num_counts * sizeof(*h->counts));
+    h->total = h->min = h->max = h->clamped = 0;
+}
+
+/* Function to add one histogram's counts into another */
+int hdr_hist_merge(struct hdr_hist *dst, const struct hdr_hist *src) {
+    if (dst->sub_bits != src->sub_bits || dst->num_counts != src->num_counts) {
+        return -1;
+    }
+    if (src->total == 0) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < src->num_counts; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    if (dst->total == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->total += src->total;
+    dst->clamped += src->clamped;
+    return 0;
+}
+
+/* Function to find the value below which pct percent of the values fall */
+uint64_t hdr_hist_percentile(const struct hdr_hist *h, double pct) {
+    if (h->total == 0) {
+        return 0;
+    }
+    if (pct >= 100.0) {
+        return h->max;
+    }
+    uint64_t rank = (uint64_t)(pct / 100.0 * h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < h->num_counts; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = hdr_upper(h, i);
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+/* Function to report memory held by the counters */
+size_t hdr_hist_bytes(const struct hdr_hist *h) {
+    return h->num_counts * sizeof(*h->counts);
+}
@@ -0,0 +1,251 @@
+/* inet_csum.c: Internet checksum implementation (see include/inet_csum.h). */
+
+/* Include standard libraries for memory operations and SIMD intrinsics */
+#include <string.h>        /* For memcpy */
+#include "inet_csum.h"     /* For csum_partial, CSUM_IMPL_* */
+#if defined(__x86_64__)
+#include <immintrin.h>     /* For _mm_*, _mm256_* (SSE2, AVX2) */
+#endif
+
+/* A bulk sum implementation: adds len bytes to a 64-bit accumulator */
+typedef uint64_t (*csum_fn)(const unsigned char *p, size_t len, uint64_t acc);
+
+/* Function to add the trailing 0..3 bytes. A lone last byte is the high-order
+ * byte of its 16-bit word in memory order. */
+static inline uint64_t csum_tail(const unsigned char *p, size_t len, uint64_t acc) {
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        acc += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        acc += (uint16_t)(*p << 8);
+#else
+        acc += *p;
+#endif
+    }
+    return acc;
+}
+
+/* Function to sum 32-bit words into a 64-bit accumulator. Ones' complement
+ * addition is associative, so summing 32-bit words and folding the carries back
+ * at the end gives the same checksum as summing 16-bit words. */
+static uint64_t csum_portable(const unsigned char *p, size_t len, uint64_t acc) {
+    uint64_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+    while (len >= 16) {
+        uint32_t w[4];
+        memcpy(w, p, 16);
+        a0 += w[0];
+        a1 += w[1];
+        a2 += w[2];
+        a3 += w[3];
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        a0 += w;
+        p += 4;
+        len -= 4;
+    }
+    return csum_tail(p, len, acc + a0 + a1 + a2 + a3);
+}
+
+#if defined(__x86_64__)
+/* Function to sum 16-byte blocks: each block's four 32-bit words are widened into
+ * two 64-bit lanes so no carry is ever lost */
+__attribute__((target("sse2")))
+static uint64_t csum_sse2(const unsigned char *p, size_t len, uint64_t acc) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s0 = zero, s1 = zero;
+    while (len >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+        s0 = _mm_add_epi64(s0, _mm_unpacklo_epi32(a, zero));
+        s1 = _mm_add_epi64(s1, _mm_unpackhi_epi32(a, zero));
+        s0 = _mm_add_epi64(s0, _mm_unpacklo_epi32(b, zero));
+        s1 = _mm_add_epi64(s1, _mm_unpackhi_epi32(b, zero));
+        p += 32;
+        len -= 32;
+    }
+    if (len >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        s0 = _mm_add_epi64(s0, _mm_unpacklo_epi32(a, zero));
+        s1 = _mm_add_epi64(s1, _mm_unpackhi_epi32(a, zero));
+        p += 16;
+        len -= 16;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(s0, s1));
+    return csum_portable(p, len, acc + lanes[0] + lanes[1]);
+}
+
+/* Function to sum 32-byte blocks, two per step with independent accumulators */
+__attribute__((target("avx2")))
+static uint64_t csum_avx2(const unsigned char *p, size_t len, uint64_t acc) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+    while (len >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+        s0 = _mm256_add_epi64(s0, _mm256_unpacklo_epi32(a, zero));
+        s1 = _mm256_add_epi64(s1, _mm256_unpackhi_epi32(a, zero));
+        s2 = _mm256_add_epi64(s2, _mm256_unpacklo_epi32(b, zero));
+        s3 = _mm256_add_epi64(s3, _mm256_unpackhi_epi32(b, zero));
+        p += 64;
+        len -= 64;
+    }
+    if (len >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        s0 = _mm256_add_epi64(s0, _mm256_unpacklo_epi32(a, zero));
+        s1 = _mm256_add_epi64(s1, _mm256_unpackhi_epi32(a, zero));
+        p += 32;
+        len -= 32;
+    }
+    __m256i s = _mm256_add_epi64(_mm256_add_epi64(s0, s1), _mm256_add_epi64(s2, s3));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, s);
+    return csum_portable(p, len, acc + lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif
+
+/* Implementation in use (chosen on first use unless csum_set_impl was called) */
+static csum_fn csum_impl_fn;
+static int csum_impl_id;
+
+/* Function to tell whether this CPU can run an implementation */
+static int csum_impl_supported(int impl) {
+    switch (impl) {
+    case CSUM_IMPL_PORTABLE:
+        return 1;
+#if defined(__x86_64__)
+    case CSUM_IMPL_SSE2:
+        return 1; /* Part of the x86-64 baseline */
+    case CSUM_IMPL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Function to choose the bulk sum implementation */
+int csum_set_impl(int impl) {
+    if (impl == CSUM_IMPL_AUTO) {
+        impl = csum_impl_supported(CSUM_IMPL_AVX2) ? CSUM_IMPL_AVX2
+             : csum_impl_supported(CSUM_IMPL_SSE2) ? CSUM_IMPL_SSE2
+             : CSUM_IMPL_PORTABLE;
+    }
+    if (!csum_impl_supported(impl)) {
+        return -1;
+    }
+    switch (impl) {
+#if defined(__x86_64__)
+    case CSUM_IMPL_SSE2:
+        csum_impl_fn = csum_sse2;
+        break;
+    case CSUM_IMPL_AVX2:
+        csum_impl_fn = csum_avx2;
+        break;
+#endif
+    default:
+        csum_impl_fn = csum_portable;
+        break;
+    }
+    csum_impl_id = impl;
+    return 0;
+}
+
+/* Function to report the implementation in use */
+int csum_get_impl(void) {
+    if (!csum_impl_fn) {
+        csum_set_impl(CSUM_IMPL_AUTO);
+    }
+    return csum_impl_id;
+}
+
+/* Function to name an implementation */
+const char *csum_impl_name(int impl) {
+    switch (impl) {
+    case CSUM_IMPL_AUTO: return "auto";
+    case CSUM_IMPL_PORTABLE: return "portable";
+    case CSUM_IMPL_SSE2: return "sse2";
+    case CSUM_IMPL_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+/* Function to fold a 64-bit accumulator into an unfolded 32-bit sum */
+static inline uint32_t csum_fold64(uint64_t acc) {
+    acc = (acc & 0xFFFFFFFFULL) + (acc >> 32);
+    acc = (acc & 0xFFFFFFFFULL) + (acc >> 32);
+    return (uint32_t)acc;
+}
+
+/* Function to add a buffer to an unfolded sum. Short buffers (headers) skip the
+ * SIMD setup. */
+uint32_t csum_partial(const void *buf, size_t len, uint32_t sum) {
+    if (!csum_impl_fn) {
+        csum_set_impl(CSUM_IMPL_AUTO);
+    }
+    uint64_t acc = len < 64 ? csum_portable(buf, len, sum) : csum_impl_fn(buf, len, sum);
+    return csum_fold64(acc);
+}
+
+/* Function to sum the IPv4 pseudo-header: addresses, zero, protocol, length */
+uint32_t csum_pseudo_v4(uint32_t saddr, uint32_t daddr, uint8_t proto, uint16_t len) {
+    uint64_t acc = (uint64_t)saddr + daddr + htons(proto) + htons(len);
+    return csum_fold64(acc);
+}
+
+/* Function to sum the IPv6 pseudo-header: addresses, 32-bit length, zero, next header */
+uint32_t csum_pseudo_v6(const struct in6_addr *saddr, const struct in6_addr *daddr,
+                        uint8_t next_header, uint32_t len) {
+    uint64_t acc = csum_portable((const unsigned char *)saddr, 16, 0);
+    acc = csum_portable((const unsigned char *)daddr, 16, acc);
+    acc += htonl(len);
+    acc += htonl(next_header);
+    return csum_fold64(acc);
+}
+
+/* Function to patch a checksum for one changed 16-bit word (RFC 1624 eqn. 3) */
+uint16_t csum_update16(uint16_t check, uint16_t old_word, uint16_t new_word) {
+    uint32_t sum = (uint16_t)~check + (uint32_t)(uint16_t)~old_word + new_word;
+    return csum_fold(sum);
+}
+
+/* Function to patch a checksum for a changed 32-bit field, one word at a time */
+uint16_t csum_update32(uint16_t check, uint32_t old_value, uint32_t new_value) {
+    uint32_t sum = (uint16_t)~check;
+    sum += (uint16_t)~(old_value & 0xFFFF) + (uint32_t)(uint16_t)~(old_value >> 16);
+    sum += (new_value & 0xFFFF) + (new_value >> 16);
+    return csum_fold(sum);
+}
+
+/* Function to patch a checksum for a changed 16-byte field */
+uint16_t csum_update128(uint16_t check, const void *old_value, const void *new_value) {
+    uint16_t o[8], n[8];
+    memcpy(o, old_value, sizeof(o));
+    memcpy(n, new_value, sizeof(n));
+    uint32_t sum = (uint16_t)~check;
+    for (int i = 0; i < 8; i++) {
+        sum += (uint16_t)~o[i] + (uint32_t)n[i];
+    }
+    return csum_fold(sum);
+}
+
+/* Function to patch an IPv4 header checksum for a TTL change. The TTL shares its
+ * 16-bit word with the protocol, which cancels out. */
+uint16_t csum_update_ttl(uint16_t check, uint8_t old_ttl, uint8_t new_ttl) {
+    unsigned char o[2] = { old_ttl, 0 };
+    unsigned char n[2] = { new_ttl, 0 };
+    uint16_t ow, nw;
+    memcpy(&ow, o, 2);
+    memcpy(&nw, n, 2);
+    return csum_update16(check, ow, nw);
+}
@@ -0,0 +1,346 @@
+/* pmtu.c: Path MTU search and cache implementation (see include/pmtu.h). */
+
+/* Include standard libraries for files, memory and address conversion */
+#include <stdio.h>      /* For fdopen, fprintf, fgets, sscanf, rename */
+#include <stdlib.h>     /* For realloc, free, qsort, mkstemp */
+#include <string.h>     /* For memcmp, memset, strcmp, strcat, strtok_r */
+#include <unistd.h>     /* For getuid, geteuid, unlink, close */
+#include <fcntl.h>      /* For open, O_NOFOLLOW */
+#include <sys/stat.h>   /* For fstat, fchmod */
+#include <arpa/inet.h>  /* For inet_pton, inet_ntop */
+#include "pmtu.h"       /* For struct pmtu_search, struct pmtu_cache */
+
+/* Smallest MTU a router may report (RFC 791) */
+#define PMTU_MIN_REPORTED 68
+
+/* Flag names as written to the cache file */
+static const struct {
+    uint8_t flag;
+    const char *name;
+} pmtu_flag_names[] = {
+    { PMTU_F_PTB, "ptb" },
+    { PMTU_F_BLACKHOLE, "blackhole" },
+    { PMTU_F_LOCAL, "local" },
+};
+#define NUM_FLAG_NAMES (int)(sizeof(pmtu_flag_names) / sizeof(pmtu_flag_names[0]))
+
+/* Function to start a search */
+void pmtu_search_init(struct pmtu_search *s, uint16_t floor, uint16_t max_size) {
+    memset(s, 0, sizeof(*s));
+    s->floor = floor < max_size ? floor : max_size;
+    s->hi = max_size;
+}
+
+/* Function to pick the next probe size. The first probe tries the largest size,
+ * which settles the common case in one round trip; after that a reported MTU is
+ * tried as is, and otherwise the range left is halved. A silence with nothing
+ * confirmed yet falls back to the floor, to tell a black hole from a dead host. */
+uint16_t pmtu_search_next(struct pmtu_search *s) {
+    if ((s->flags & PMTU_F_UNREACHABLE) || (s->lo && s->lo >= s->hi) ||
+        (!s->lo && s->hi < s->floor)) {
+        return 0;
+    }
+    uint16_t size;
+    if (s->tries > 0) {
+        size = s->size; /* Send the same size again */
+    } else if (s->probes == 0) {
+        size = s->hi;
+    } else if (s->reported > s->lo && s->reported <= s->hi) {
+        size = s->reported;
+    } else if (!s->lo && (s->flags & PMTU_F_BLACKHOLE)) {
+        size = s->floor;
+    } else {
+        uint16_t base = s->lo ? s->lo : s->floor;
+        size = base + (s->hi - base + 1) / 2;
+    }
+    s->size = size;
+    s->probes++;
+    return size;
+}
+
+/* Function to lower the upper bound, forgetting a confirmed size above it (the
+ * path changed under the search) */
+static void pmtu_lower(struct pmtu_search *s, uint16_t hi) {
+    if (hi < s->hi) {
+        s->hi = hi;
+    }
+    if (s->lo > s->hi) {
+        s->lo = 0;
+    }
+}
+
+/* Function to narrow the search by what came back for one probe */
+void pmtu_search_result(struct pmtu_search *s, uint16_t size, int outcome, uint16_t reported) {
+    if (size == s->size && outcome != PMTU_LOST) {
+        s->tries = 0;
+    }
+    switch (outcome) {
+    case PMTU_FITS:
+        if (size > s->lo) {
+            s->lo = size;
+        }
+        if (s->lo > s->hi) {
+            s->hi = s->lo;
+        }
+        break;
+    case PMTU_TOO_BIG:
+        s->flags |= PMTU_F_PTB;
+        if (reported >= PMTU_MIN_REPORTED && reported < size) {
+            if (!s->reported || reported < s->reported) {
+                s->reported = reported;
+            }
+            pmtu_lower(s, reported);
+        } else {
+            pmtu_lower(s, size - 1); /* No usable MTU in the message (RFC 1191 section 5) */
+        }
+        break;
+    case PMTU_LOCAL:
+        s->flags |= PMTU_F_LOCAL;
+        pmtu_lower(s, size - 1);
+        break;
+    case PMTU_LOST:
+        if (size != s->size || ++s->tries < PMTU_TRIES) {
+            break;
+        }
+        s->tries = 0;
+        if (!s->lo && size <= s->floor) {
+            s->flags = (s->flags & ~PMTU_F_BLACKHOLE) | PMTU_F_UNREACHABLE;
+        } else {
+            s->flags |= PMTU_F_BLACKHOLE;
+            pmtu_lower(s, size - 1);
+        }
+        break;
+    default:
+        s->flags = (s->flags & ~PMTU_F_BLACKHOLE) | PMTU_F_UNREACHABLE;
+        break;
+    }
+}
+
+/* Function to prepare an empty cache */
+void pmtu_cache_init(struct pmtu_cache *c) {
+    memset(c, 0, sizeof(*c));
+    c->sorted = 1;
+}
+
+/* Function to free the entries */
+void pmtu_cache_free(struct pmtu_cache *c) {
+    free(c->entries);
+    pmtu_cache_init(c);
+}
+
+/* Function to turn an address of either family into the stored form */
+static int pmtu_key(int family, const void *addr, struct in6_addr *key) {
+    if (family == AF_INET6) {
+        memcpy(key, addr, sizeof(*key));
+        return 0;
+    }
+    if (family != AF_INET) {
+        return -1;
+    }
+    memset(key, 0, sizeof(*key));
+    key->s6_addr[10] = key->s6_addr[11] = 0xFF;
+    memcpy(&key->s6_addr[12], addr, 4);
+    return 0;
+}
+
+/* Function to order entries by address, newest first within one address */
+static int pmtu_entry_cmp(const void *a, const void *b) {
+    const struct pmtu_entry *x = a, *y = b;
+    int d = memcmp(&x->addr, &y->addr, sizeof(x->addr));
+    if (d) {
+        return d;
+    }
+    return (x->updated < y->updated) - (x->updated > y->updated);
+}
+
+/* Function to sort the entries and keep only the newest for each address */
+static void pmtu_cache_sort(struct pmtu_cache *c) {
+    if (c->sorted) {
+        return;
+    }
+    qsort(c->entries, c->count, sizeof(*c->entries), pmtu_entry_cmp);
+    size_t kept = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        if (kept == 0 || memcmp(&c->entries[kept - 1].addr, &c->entries[i].addr,
+                                sizeof(struct in6_addr)) != 0) {
+            c->entries[kept++] = c->entries[i];
+        }
+    }
+    c->count = kept;
+    c->sorted = 1;
+}
+
+/* Function to record a destination's path MTU */
+int pmtu_cache_set(struct pmtu_cache *c, int family, const void *addr, uint16_t mtu,
+                   uint8_t flags, time_t now) {
+    struct in6_addr key;
+    if (pmtu_key(family, addr, &key) < 0) {
+        return -1;
+    }
+    if (c->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 64;
+        struct pmtu_entry *entries = realloc(c->entries, cap * sizeof(*entries));
+        if (!entries) {
+            return -1;
+        }
+        c->entries = entries;
+        c->cap = cap;
+    }
+    struct pmtu_entry *e = &c->entries[c->count++];
+    e->addr = key;
+    e->mtu = mtu;
+    e->flags = flags & (PMTU_F_PTB | PMTU_F_BLACKHOLE | PMTU_F_LOCAL);
+    e->updated = now;
+    c->sorted = c->count == 1;
+    return 0;
+}
+
+/* Function to find a destination's path MTU */
+uint16_t pmtu_cache_lookup(struct pmtu_cache *c, int family, const void *addr, time_t now) {
+    struct pmtu_entry key;
+    if (pmtu_key(family, addr, &key.addr) < 0) {
+        return 0;
+    }
+    pmtu_cache_sort(c);
+    const struct pmtu_entry *e = NULL;
+    size_t lo = 0, hi = c->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int d = memcmp(&c->entries[mid].addr, &key.addr, sizeof(key.addr));
+        if (d == 0) {
+            e = &c->entries[mid];
+            break;
+        }
+        if (d < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return e && now - e->updated <= PMTU_CACHE_TTL ? e->mtu : 0;
+}
+
+/* Function to open a cache file for reading, if it can be trusted: a regular
+ * file (not a symlink) owned by us or root that nobody else may write. The
+ * cache sits in a shared directory, so anyone could have planted one there. */
+static FILE *pmtu_cache_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        (st.st_uid != 0 && st.st_uid != getuid() && st.st_uid != geteuid()) ||
+        (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        fprintf(stderr, "Ignoring path MTU cache %s: not a file only its owner (us or "
+                "root) can write\n", path);
+        close(fd);
+        return NULL;
+    }
+    FILE *f = fdopen(fd, "r");
+    if (!f) {
+        close(fd);
+    }
+    return f;
+}
+
+/* Function to read a cache file: "address mtu how updated" per line */
+long pmtu_cache_load(struct pmtu_cache *c, const char *path) {
+    FILE *f = pmtu_cache_open(path);
+    if (!f) {
+        return 0; /* Nothing cached yet, or nothing to trust */
+    }
+    char line[256];
+    long n = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char addr_text[INET6_ADDRSTRLEN], how[64];
+        unsigned mtu;
+        long long updated;
+        if (line[0] == '#' ||
+            sscanf(line, "%45s %u %63s %lld", addr_text, &mtu, how, &updated) != 4 ||
+            mtu < PMTU_MIN_REPORTED || mtu > 65535) {
+            continue;
+        }
+        unsigned char addr[sizeof(struct in6_addr)];
+        int family = inet_pton(AF_INET, addr_text, addr) == 1 ? AF_INET :
+                     inet_pton(AF_INET6, addr_text, addr) == 1 ? AF_INET6 : 0;
+        if (!family) {
+            continue;
+        }
+        uint8_t flags = 0;
+        char *save = NULL;
+        for (char *w = strtok_r(how, ",", &save); w; w = strtok_r(NULL, ",", &save)) {
+            for (int i = 0; i < NUM_FLAG_NAMES; i++) {
+                if (strcmp(w, pmtu_flag_names[i].name) == 0) {
+                    flags |= pmtu_flag_names[i].flag;
+                }
+            }
+        }
+        if (pmtu_cache_set(c, family, addr, mtu, flags, (time_t)updated) < 0) {
+            fclose(f);
+            return -1;
+        }
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/* Function to write the live entries to path through a temporary file, so
+ * readers never see half a cache. mkstemp creates the file with a name nobody
+ * can guess and refuses to follow a link planted in its place. */
+int pmtu_cache_save(struct pmtu_cache *c, const char *path, time_t now) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE *f = NULL;
+    if (fchmod(fd, 0644) < 0 || !(f = fdopen(fd, "w"))) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    pmtu_cache_sort(c);
+    fprintf(f, "# netkernel path MTU cache: address mtu how updated\n");
+    for (size_t i = 0; i < c->count; i++) {
+        const struct pmtu_entry *e = &c->entries[i];
+        if (now - e->updated > PMTU_CACHE_TTL) {
+            continue;
+        }
+        char addr[INET6_ADDRSTRLEN];
+        if (IN6_IS_ADDR_V4MAPPED(&e->addr)) {
+            inet_ntop(AF_INET, &e->addr.s6_addr[12], addr, sizeof(addr));
+        } else {
+            inet_ntop(AF_INET6, &e->addr, addr, sizeof(addr));
+        }
+        char how[64] = "";
+        for (int k = 0; k < NUM_FLAG_NAMES; k++) {
+            if (e->flags & pmtu_flag_names[k].flag) {
+                strcat(how, how[0] ? "," : "");
+                strcat(how, pmtu_flag_names[k].name);
+            }
+        }
+        fprintf(f, "%s %u %s %lld\n", addr, e->mtu, how[0] ? how : "echo", (long long)e->updated);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to look one destination up in a cache file */
+uint16_t pmtu_cache_get(const char *path, int family, const void *addr) {
+    struct pmtu_cache c;
+    pmtu_cache_init(&c);
+    uint16_t mtu = 0;
+    if (pmtu_cache_load(&c, path) > 0) {
+        mtu = pmtu_cache_lookup(&c, family, addr, time(NULL));
+    }
+    pmtu_cache_free(&c);
+    return mtu;
+}
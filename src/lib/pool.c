@@ -0,0 +1,84 @@
+/* pool.c: Fixed-size object pool implementation (see include/pool.h). */
+
+/* Include standard libraries for memory management */
+#include <stdlib.h> /* For malloc, free */
+#include "pool.h"   /* For struct pool */
+
+/* Function to initialize an empty pool */
+void pool_init(struct pool *p, size_t obj_size, size_t per_block, size_t max_objs) {
+    size_t align = sizeof(void *);
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *); /* Free objects store the list link */
+    }
+    p->obj_size = (obj_size + align - 1) & ~(align - 1);
+    p->per_block = per_block ? per_block : 1024;
+    p->max_objs = max_objs;
+    p->free_list = NULL;
+    p->blocks = NULL;
+    p->in_use = 0;
+    p->total = 0;
+}
+
+/* Function to carve a new block onto the free list */
+static int pool_grow(struct pool *p) {
+    size_t n = p->per_block;
+    if (p->max_objs) {
+        if (p->total >= p->max_objs) {
+            return -1;
+        }
+        if (n > p->max_objs - p->total) {
+            n = p->max_objs - p->total;
+        }
+    }
+    struct pool_block *block = malloc(sizeof(*block) + n * p->obj_size);
+    if (!block) {
+        return -1;
+    }
+    block->next = p->blocks;
+    p->blocks = block;
+
+    /* Thread the new objects onto the free list in address order */
+    char *obj = (char *)(block + 1);
+    for (size_t i = n; i-- > 0;) {
+        void **slot = (void **)(obj + i * p->obj_size);
+        *slot = p->free_list;
+        p->free_list = slot;
+    }
+    p->total += n;
+    return 0;
+}
+
+/* Function to allocate one object */
+void *pool_alloc(struct pool *p) {
+    if (!p->free_list && pool_grow(p) < 0) {
+        return NULL;
+    }
+    void **obj = p->free_list;
+    p->free_list = *obj;
+    p->in_use++;
+    return obj;
+}
+
+/* Function to recycle one object */
+void pool_free(struct pool *p, void *obj) {
+    *(void **)obj = p->free_list;
+    p->free_list = obj;
+    p->in_use--;
+}
+
+/* Function to release all blocks */
+void pool_destroy(struct pool *p) {
+    while (p->blocks) {
+        struct pool_block *next = p->blocks->next;
+        free(p->blocks);
+        p->blocks = next;
+    }
+    p->free_list = NULL;
+    p->in_use = 0;
+    p->total = 0;
+}
+
+/* Function to report memory held by the pool */
+size_t pool_bytes(const struct pool *p) {
+    return p->total * p->obj_size;
+}
@@ -0,0 +1,277 @@
+/* prefix_trie.c: Path-compressed binary trie implementation (see include/prefix_trie.h).
+ * Every node's prefix is a strict extension of its parent's, and a node's children
+ * differ in the bit right after the node's prefix length. */
+
+/* Include the trie interface */
+#include <stddef.h>        /* For NULL */
+#include "prefix_trie.h"   /* For struct ptrie, struct ptrie_node */
+
+/* Nodes carved per pool block */
+#define PTRIE_NODES_PER_BLOCK 8192
+
+/* Bit i (0 = most significant) of a host-order address */
+static inline int ptrie_bit(uint32_t addr, uint8_t i) {
+    return (addr >> (31 - i)) & 1;
+}
+
+/* Number of leading bits two addresses share */
+static inline uint8_t ptrie_common(uint32_t a, uint32_t b) {
+    uint32_t diff = a ^ b;
+    return diff ? (uint8_t)__builtin_clz(diff) : 32;
+}
+
+/* Function to initialize an empty trie */
+void ptrie_init(struct ptrie *t) {
+    t->root = NULL;
+    t->count = 0;
+    pool_init(&t->nodes, sizeof(struct ptrie_node), PTRIE_NODES_PER_BLOCK, 0);
+}
+
+/* Function to free payloads below a node */
+static void ptrie_free_data(struct ptrie_node *n, void (*free_data)(void *data)) {
+    if (!n) {
+        return;
+    }
+    ptrie_free_data(n->child[0], free_data);
+    ptrie_free_data(n->child[1], free_data);
+    if (n->data) {
+        free_data(n->data);
+    }
+}
+
+/* Function to tear down the trie */
+void ptrie_destroy(struct ptrie *t, void (*free_data)(void *data)) {
+    if (free_data) {
+        ptrie_free_data(t->root, free_data);
+    }
+    pool_destroy(&t->nodes);
+    t->root = NULL;
+    t->count = 0;
+}
+
+/* Function to allocate a node */
+static struct ptrie_node *ptrie_node_new(struct ptrie *t, uint32_t prefix, uint8_t plen) {
+    struct ptrie_node *n = pool_alloc(&t->nodes);
+    if (n) {
+        n->child[0] = n->child[1] = NULL;
+        n->prefix = prefix;
+        n->plen = plen;
+        n->data = NULL;
+    }
+    return n;
+}
+
+/* Function to find or create a prefix node */
+void **ptrie_insert(struct ptrie *t, uint32_t prefix, uint8_t plen) {
+    prefix &= ptrie_mask(plen);
+    struct ptrie_node **link = &t->root;
+    struct ptrie_node *n;
+
+    while ((n = *link) != NULL) {
+        uint8_t common = ptrie_common(prefix, n->prefix);
+        if (common > plen) {
+            common = plen;
+        }
+        if (common > n->plen) {
+            common = n->plen;
+        }
+
+        if (common < n->plen) {
+            /* The new prefix diverges inside (or ends above) this node */
+            struct ptrie_node *leaf = ptrie_node_new(t, prefix, plen);
+            if (!leaf) {
+                return NULL;
+            }
+            if (common == plen) {
+                /* New prefix is an ancestor of n */
+                leaf->child[ptrie_bit(n->prefix, plen)] = n;
+                *link = leaf;
+            } else {
+                /* Branch point where the two prefixes differ */
+                struct ptrie_node *glue = ptrie_node_new(t, prefix & ptrie_mask(common), common);
+                if (!glue) {
+                    pool_free(&t->nodes, leaf);
+                    return NULL;
+                }
+                glue->child[ptrie_bit(prefix, common)] = leaf;
+                glue->child[ptrie_bit(n->prefix, common)] = n;
+                *link = glue;
+            }
+            t->count++;
+            return &leaf->data;
+        }
+
+        /* n covers the prefix */
+        if (n->plen == plen) {
+            if (!n->data) {
+                t->count++; /* Glue node becomes a stored prefix */
+            }
+            return &n->data;
+        }
+        link = &n->child[ptrie_bit(prefix, n->plen)];
+    }
+
+    n = ptrie_node_new(t, prefix, plen);
+    if (!n) {
+        return NULL;
+    }
+    *link = n;
+    t->count++;
+    return &n->data;
+}
+
+/* Function to find an exact prefix */
+void *ptrie_lookup(const struct ptrie *t, uint32_t prefix, uint8_t plen) {
+    prefix &= ptrie_mask(plen);
+    const struct ptrie_node *n = t->root;
+    while (n && n->plen <= plen) {
+        if ((prefix & ptrie_mask(n->plen)) != n->prefix) {
+            return NULL;
+        }
+        if (n->plen == plen) {
+            return n->data;
+        }
+        n = n->child[ptrie_bit(prefix, n->plen)];
+    }
+    return NULL;
+}
+
+/* Function to find the longest stored prefix covering an address */
+void *ptrie_lpm(const struct ptrie *t, uint32_t addr, uint8_t *plen) {
+    const struct ptrie_node *n = t->root;
+    void *best = NULL;
+    while (n) {
+        if ((addr & ptrie_mask(n->plen)) != n->prefix) {
+            break;
+        }
+        if (n->data) {
+            best = n->data;
+            if (plen) {
+                *plen = n->plen;
+            }
+        }
+        if (n->plen == 32) {
+            break;
+        }
+        n = n->child[ptrie_bit(addr, n->plen)];
+    }
+    return best;
+}
+
+/* Function to unlink a stored prefix, collapsing glue nodes left behind. With
+ * empty set it only takes a slot ptrie_insert has just handed out (still NULL),
+ * otherwise only one holding a payload. Returns 1 if a prefix was unlinked. */
+static int ptrie_unlink(struct ptrie *t, uint32_t prefix, uint8_t plen, int empty,
+                        void **data) {
+    prefix &= ptrie_mask(plen);
+    struct ptrie_node **parent_link = NULL;
+    struct ptrie_node **link = &t->root;
+    struct ptrie_node *n = t->root;
+
+    while (n && n->plen < plen) {
+        if ((prefix & ptrie_mask(n->plen)) != n->prefix) {
+            return 0;
+        }
+        parent_link = link;
+        link = &n->child[ptrie_bit(prefix, n->plen)];
+        n = *link;
+    }
+    if (!n || n->plen != plen || n->prefix != prefix || !n->data != !!empty) {
+        return 0;
+    }
+
+    *data = n->data;
+    n->data = NULL;
+    t->count--;
+
+    if (n->child[0] && n->child[1]) {
+        return 1; /* Still needed as a branch point */
+    }
+
+    /* Splice n out, replacing it with its only child (if any) */
+    *link = n->child[0] ? n->child[0] : n->child[1];
+    pool_free(&t->nodes, n);
+
+    /* A glue parent left with one child is no longer a branch point */
+    if (parent_link) {
+        struct ptrie_node *p = *parent_link;
+        if (!p->data && (!p->child[0] || !p->child[1])) {
+            *parent_link = p->child[0] ? p->child[0] : p->child[1];
+            pool_free(&t->nodes, p);
+        }
+    }
+    return 1;
+}
+
+/* Function to remove a prefix and hand back its payload */
+void *ptrie_remove(struct ptrie *t, uint32_t prefix, uint8_t plen) {
+    void *data = NULL;
+    ptrie_unlink(t, prefix, plen, 0, &data);
+    return data;
+}
+
+/* Function to drop a prefix ptrie_insert created whose slot is still empty */
+void ptrie_abort_insert(struct ptrie *t, uint32_t prefix, uint8_t plen) {
+    void *data;
+    ptrie_unlink(t, prefix, plen, 1, &data);
+}
+
+/* Function to walk a subtree in order; returns non-zero if stopped */
+static int ptrie_walk_node(const struct ptrie_node *n, ptrie_walk_fn fn, void *arg) {
+    if (!n) {
+        return 0;
+    }
+    if (n->data && fn(n->prefix, n->plen, n->data, arg)) {
+        return 1;
+    }
+    return ptrie_walk_node(n->child[0], fn, arg) || ptrie_walk_node(n->child[1], fn, arg);
+}
+
+/* Function to walk every prefix */
+void ptrie_walk(const struct ptrie *t, ptrie_walk_fn fn, void *arg) {
+    ptrie_walk_node(t->root, fn, arg);
+}
+
+/* Function to walk the prefixes that cover prefix/plen */
+void ptrie_walk_covering(const struct ptrie *t, uint32_t prefix, uint8_t plen,
+                         ptrie_walk_fn fn, void *arg) {
+    prefix &= ptrie_mask(plen);
+    const struct ptrie_node *n = t->root;
+    while (n && n->plen <= plen) {
+        if ((prefix & ptrie_mask(n->plen)) != n->prefix) {
+            return;
+        }
+        if (n->data && fn(n->prefix, n->plen, n->data, arg)) {
+            return;
+        }
+        if (n->plen == 32) {
+            return;
+        }
+        n = n->child[ptrie_bit(prefix, n->plen)];
+    }
+}
+
+/* Function to walk the prefixes inside prefix/plen */
+void ptrie_walk_subtree(const struct ptrie *t, uint32_t prefix, uint8_t plen,
+                        ptrie_walk_fn fn, void *arg) {
+    prefix &= ptrie_mask(plen);
+    const struct ptrie_node *n = t->root;
+    while (n) {
+        if (n->plen >= plen) {
+            /* First node at or below plen: all of it is inside, or none is */
+            if ((n->prefix & ptrie_mask(plen)) == prefix) {
+                ptrie_walk_node(n, fn, arg);
+            }
+            return;
+        }
+        if ((prefix & ptrie_mask(n->plen)) != n->prefix) {
+            return;
+        }
+        n = n->child[ptrie_bit(prefix, n->plen)];
+    }
+}
+
+/* Function to report node memory */
+unsigned long ptrie_bytes(const struct ptrie *t) {
+    return pool_bytes(&t->nodes);
+}
@@ -0,0 +1,1793 @@
+/* rudp.c: Reliable message transport over UDP (see include/rudp.h). Loss
+ * detection and RTT estimation follow RFC 9002: packets carry ever-increasing
+ * numbers, acknowledgments list received ranges, and a fragment found missing is
+ * queued to go out again in a new packet. The sender remembers its packets in a
+ * ring indexed by packet number, from the oldest still in flight to the newest,
+ * and samples the delivery rate from them (draft-cheng-iccrg-delivery-rate-
+ * estimation) for BBR. The receiver reassembles each stream's messages in a
+ * window of RUDP_STREAM_WINDOW slots indexed by message number, which is also
+ * how far ahead of the oldest unacknowledged message a sender may run. */
+
+#define _GNU_SOURCE /* For recvmmsg, sendmmsg, ppoll */
+
+/* Include standard libraries for sockets, timing and the transport interface */
+#include <stdio.h>        /* For perror */
+#include <stdlib.h>       /* For malloc, calloc, free */
+#include <string.h>       /* For memcpy, memset */
+#include <unistd.h>       /* For close, getpid */
+#include <errno.h>        /* For errno, EAGAIN, EINTR */
+#include <math.h>         /* For cbrt */
+#include <poll.h>         /* For ppoll */
+#include <time.h>         /* For clock_gettime, struct timespec */
+#include <endian.h>       /* For htobe64, be64toh */
+#include <sys/random.h>   /* For getrandom (connection ids) */
+#include <sys/socket.h>   /* For socket, bind, recvmmsg, sendmmsg */
+#include <arpa/inet.h>    /* For htonl, ntohl, htons, ntohs */
+#include "timer_wheel.h"  /* For struct timer_wheel, struct tw_timer */
+#include "rudp.h"         /* For struct rudp_config, struct rudp_stats */
+
+/* Packet types */
+#define RUDP_SYN 1
+#define RUDP_SYNACK 2
+#define RUDP_DATA 3
+#define RUDP_ACK 4
+#define RUDP_CLOSE 5
+
+/* Packet header: type, flags, reserved, connection id, packet number */
+#define RUDP_HEADER 16
+/* Data header: stream, flags, reserved, message number, length, offset */
+#define RUDP_DATA_HEADER 16
+/* Acknowledgment header: largest, delay (us), ranges, reserved */
+#define RUDP_ACK_HEADER 16
+#define RUDP_MAX_DATAGRAM (RUDP_HEADER + RUDP_DATA_HEADER + RUDP_FRAGMENT)
+
+/* Datagrams per recvmmsg / sendmmsg, and receive batches per poll */
+#define RUDP_BATCH 64
+#define RUDP_RX_BATCHES 16
+/* Connection hash table size (power of two) */
+#define RUDP_CONN_BUCKETS 1024
+/* Socket buffers asked for (the kernel caps them at net.core.[rw]mem_max) */
+#define RUDP_SOCKET_BUFFER (4 << 20)
+
+/* RFC 9002 constants */
+#define RUDP_INITIAL_RTT_NS 100000000ULL    /* Before the first sample */
+#define RUDP_GRANULARITY_NS 1000000ULL      /* Timer granularity */
+#define RUDP_PACKET_THRESHOLD 3             /* Later packets acked before one is lost */
+#define RUDP_MAX_PACKET_THRESHOLD 256       /* Raised this far by reordering */
+#define RUDP_MAX_ACK_DELAY_NS 2000000ULL    /* Receiver's promise, counted into PTO */
+#define RUDP_ACK_DELAY_MS 1                 /* How long a lone packet waits for company */
+#define RUDP_ACK_EVERY 2                    /* Packets per acknowledgment otherwise */
+#define RUDP_MAX_RANGES 32                  /* SACK ranges per acknowledgment */
+#define RUDP_PERSISTENT_PTOS 3              /* Probe timeouts in a row that collapse cwnd */
+#define RUDP_PROBES 2                       /* Packets a probe timeout may send */
+/* Handshake: attempts and first timeout */
+#define RUDP_SYN_TRIES 8
+#define RUDP_SYN_TIMEOUT_MS 200
+/* Copies of CLOSE sent (it is not acknowledged) */
+#define RUDP_CLOSE_COPIES 3
+/* Most packets the sender tracks at once */
+#define RUDP_MAX_TRACKED (1u << 20)
+
+/* Congestion window bounds (packets) */
+#define RUDP_INITIAL_CWND 10
+#define RUDP_MIN_CWND 2
+/* Pacing may catch up on this much lost time in one burst */
+#define RUDP_PACE_BURST_NS 500000ULL
+
+/* CUBIC (RFC 9438) */
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+/* BBR v1 */
+#define BBR_HIGH_GAIN 2.885                 /* 2/ln 2: doubles the rate each round */
+#define BBR_BW_ROUNDS 10                    /* Bandwidth max filter window (rounds) */
+#define BBR_FULL_BW_GROWTH 1.25             /* Startup ends when 3 rounds grow less */
+#define BBR_FULL_BW_ROUNDS 3
+#define BBR_MIN_RTT_WINDOW_NS 10000000000ULL
+#define BBR_PROBE_RTT_NS 200000000ULL
+#define BBR_MIN_CWND 4                      /* Packets */
+static const double bbr_cycle_gains[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/* Connection states */
+enum conn_state {
+    CONN_SYN_SENT,      /* Client waiting for SYNACK */
+    CONN_OPEN,
+    CONN_CLOSING,       /* Sends what is queued, then CLOSE */
+    CONN_CLOSED         /* Freed at the end of rudp_poll */
+};
+
+/* Sent packet states */
+enum { SENT_NONE, SENT_IN_FLIGHT, SENT_ACKED, SENT_LOST };
+
+/* BBR modes */
+enum { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW, BBR_PROBE_RTT };
+
+/* A message being sent; freed when nothing refers to it any more */
+struct rudp_msg {
+    struct rudp_msg *next;      /* Send queue */
+    uint64_t acked;             /* Fragments the peer has */
+    uint32_t refs;              /* Send queue, packets in flight, retransmit queue */
+    uint32_t seq;               /* Message number on its stream */
+    uint32_t len;
+    uint16_t stream;
+    uint8_t flags;
+    uint8_t nfrags;             /* 1..64 */
+    uint8_t next_frag;          /* First fragment never sent */
+    char data[];
+};
+
+/* A fragment waiting to be sent again */
+struct rudp_frag {
+    struct rudp_msg *msg;
+    uint8_t frag;
+};
+
+/* A data packet the sender has not forgotten yet */
+struct rudp_sent {
+    struct rudp_msg *msg;       /* Message of the fragment (NULL once acked or lost) */
+    uint64_t sent_ns;
+    uint64_t delivered;         /* Connection's delivered bytes when it was sent */
+    uint64_t delivered_ns;      /* ...and when they last grew */
+    uint64_t first_sent_ns;     /* Send time of the packet that began the interval */
+    uint32_t size;              /* Bytes on the wire */
+    uint8_t frag;
+    uint8_t state;
+    uint8_t app_limited;        /* Sent with nothing else waiting */
+};
+
+/* A message being reassembled */
+struct rudp_rmsg {
+    char *buf;
+    uint64_t frags;             /* Fragments received */
+    uint32_t seq;
+    uint32_t len;
+    uint8_t state;              /* SLOT_FREE, SLOT_PARTIAL, SLOT_COMPLETE, SLOT_DELIVERED */
+    uint8_t flags;
+    uint8_t nfrags;
+};
+
+enum { SLOT_FREE, SLOT_PARTIAL, SLOT_COMPLETE, SLOT_DELIVERED };
+
+/* Both directions of one stream */
+struct rudp_stream {
+    uint32_t next_seq;                          /* Send: next message number */
+    uint32_t acked_base;                        /* Send: oldest not fully acked */
+    uint64_t acked[RUDP_STREAM_WINDOW / 64];    /* Send: acked from acked_base on */
+    uint32_t base;                              /* Receive: oldest not delivered */
+    struct rudp_rmsg slots[RUDP_STREAM_WINDOW]; /* Receive: by message number */
+};
+
+/* One delivery rate sample */
+struct rudp_rate_sample {
+    double rate;                /* Bytes per second */
+    uint64_t prior_delivered;   /* Delivered bytes when the sampled packet was sent */
+    uint64_t rtt_ns;            /* RTT of the sampled packet */
+    int app_limited;
+    int valid;
+    int in_recovery;            /* Acked packets were sent before the last loss event */
+};
+
+/* CUBIC state */
+struct rudp_cubic {
+    uint64_t ssthresh;
+    double w_max;               /* Window before the last reduction (bytes) */
+    double k;                   /* Seconds from the epoch to regain w_max */
+    double w_est;               /* Reno-friendly window (bytes) */
+    uint64_t epoch_ns;          /* Start of the current growth (0 = none) */
+};
+
+/* BBR state */
+struct rudp_bbr {
+    int mode;
+    double bw[BBR_BW_ROUNDS];   /* Max delivery rate per round, by round number */
+    uint64_t round;
+    uint64_t next_round_delivered;
+    double full_bw;
+    int full_bw_rounds;
+    int filled_pipe;
+    uint64_t min_rtt_ns, min_rtt_stamp_ns;
+    uint64_t probe_rtt_done_ns;
+    uint64_t prior_cwnd;
+    int cycle;
+    uint64_t cycle_stamp_ns;
+    double pacing_gain, cwnd_gain;
+};
+
+struct rudp_conn;
+
+/* A congestion controller: it sets c->cwnd and c->pacing_rate */
+struct rudp_cc_ops {
+    void (*init)(struct rudp_conn *c, uint64_t now);
+    void (*on_ack)(struct rudp_conn *c, uint64_t acked, uint64_t now);   /* Sample in c->rs */
+    void (*on_loss)(struct rudp_conn *c, uint64_t now);                  /* New loss event */
+    void (*on_collapse)(struct rudp_conn *c);                            /* Persistent loss */
+    const char *(*state)(const struct rudp_conn *c);
+};
+
+/* One received packet number range */
+struct rudp_range {
+    uint64_t lo, hi;
+};
+
+/* One connection */
+struct rudp_conn {
+    struct rudp_endpoint *ep;
+    struct rudp_conn *next, *prev;      /* Endpoint's list */
+    struct rudp_conn *hnext;            /* Hash chain */
+    struct sockaddr_in peer;
+    uint32_t id;
+    enum conn_state state;
+    int client;
+    void *ctx;
+    struct rudp_stream *streams[RUDP_MAX_STREAMS];
+
+    /* Sending */
+    struct rudp_msg *sendq, *sendq_tail;    /* Messages with fragments never sent */
+    size_t queued_bytes;                    /* Of messages not fully acked */
+    unsigned long unacked_msgs;
+    struct rudp_frag *rtx;                  /* Ring of fragments to send again */
+    uint32_t rtx_head, rtx_tail, rtx_cap;
+    struct rudp_sent *sent;                 /* Ring of packets sent_lo..next_pn-1 */
+    uint32_t sent_cap;
+    uint64_t sent_lo, next_pn;
+    uint64_t largest_acked;                 /* 0 = none yet */
+    uint64_t bytes_in_flight;
+    uint64_t last_sent_ns;
+    uint64_t loss_time_ns;                  /* Earliest time-threshold loss (0 = none) */
+    uint64_t pkt_threshold;                 /* Reordering that counts as loss */
+    int pto_count;
+    int probes;                             /* Packets allowed past cwnd */
+    uint64_t srtt, rttvar, min_rtt, latest_rtt;
+    int have_rtt;
+    uint64_t recovery_start_ns;
+    uint64_t delivered, delivered_ns, first_sent_ns;
+    struct rudp_rate_sample rs;
+    int cwnd_limited;                       /* cwnd or pacing held sending back since
+                                             * the last ack */
+
+    /* Congestion control */
+    const struct rudp_cc_ops *cc;
+    enum rudp_cc cc_kind;
+    uint64_t cwnd;
+    double pacing_rate;
+    uint64_t pace_next_ns;
+    struct rudp_cubic cubic;
+    struct rudp_bbr bbr;
+
+    /* Receiving */
+    struct rudp_range ranges[RUDP_MAX_RANGES];  /* Descending, disjoint */
+    int num_ranges;
+    uint64_t largest_recv_ns;
+    int ack_pending;                        /* Data packets not yet acknowledged */
+    int ack_now;
+
+    /* Timers */
+    struct tw_timer loss_timer;             /* Loss, probe and handshake timeouts */
+    struct tw_timer ack_timer;
+    struct tw_timer idle_timer;
+    uint64_t last_recv_ns;
+    int syn_tries;
+    uint64_t syn_sent_ns;
+
+    struct rudp_stats stats;
+};
+
+/* The socket, its connections and its datagram batches */
+struct rudp_endpoint {
+    int fd;
+    struct rudp_config cfg;
+    struct timer_wheel tw;
+    struct rudp_conn *conns;
+    struct rudp_conn *buckets[RUDP_CONN_BUCKETS];
+    int reap;                               /* Some connection is CLOSED */
+    struct mmsghdr rx_msgs[RUDP_BATCH];
+    struct iovec rx_iovs[RUDP_BATCH];
+    struct sockaddr_in rx_addrs[RUDP_BATCH];
+    uint8_t rx_bufs[RUDP_BATCH][RUDP_MAX_DATAGRAM];
+    struct mmsghdr tx_msgs[RUDP_BATCH];
+    struct iovec tx_iovs[RUDP_BATCH];
+    struct sockaddr_in tx_addrs[RUDP_BATCH];
+    uint8_t tx_bufs[RUDP_BATCH][RUDP_MAX_DATAGRAM];
+    int tx_count;
+};
+
+static void conn_flush(struct rudp_conn *c, uint64_t now);
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Functions to write and read big-endian fields */
+static void put16(uint8_t *p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    v = htobe64(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t get16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return be64toh(v);
+}
+
+/* Function to compute the bitmap of a message's nfrags fragments */
+static uint64_t frag_mask(unsigned nfrags) {
+    return nfrags >= 64 ? ~0ULL : (1ULL << nfrags) - 1;
+}
+
+/* Function to compute the fragments of a message of len bytes (at least one) */
+static unsigned frag_count(uint32_t len) {
+    return len ? (len + RUDP_FRAGMENT - 1) / RUDP_FRAGMENT : 1;
+}
+
+/* Function to compute the length of fragment frag of a len-byte message */
+static uint32_t frag_len(uint32_t len, unsigned frag) {
+    uint32_t off = frag * RUDP_FRAGMENT;
+    return len - off < RUDP_FRAGMENT ? len - off : RUDP_FRAGMENT;
+}
+
+/* ---- Datagram batches ---- */
+
+/* Function to send every queued datagram */
+static void ep_flush(struct rudp_endpoint *ep) {
+    int sent = 0;
+    while (sent < ep->tx_count) {
+        int k = sendmmsg(ep->fd, ep->tx_msgs + sent, ep->tx_count - sent, 0);
+        if (k < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            k = 1; /* Drop the datagram the kernel refused (ENOBUFS, ...) */
+        }
+        sent += k;
+    }
+    ep->tx_count = 0;
+}
+
+/* Function to get the buffer for the next datagram to peer */
+static uint8_t *tx_slot(struct rudp_endpoint *ep, const struct sockaddr_in *peer) {
+    if (ep->tx_count == RUDP_BATCH) {
+        ep_flush(ep);
+    }
+    ep->tx_addrs[ep->tx_count] = *peer;
+    return ep->tx_bufs[ep->tx_count];
+}
+
+/* Function to queue the datagram built in the buffer tx_slot returned */
+static void tx_commit(struct rudp_endpoint *ep, size_t len) {
+    ep->tx_iovs[ep->tx_count].iov_len = len;
+    ep->tx_count++;
+}
+
+/* Function to write a packet header */
+static size_t put_header(uint8_t *p, uint8_t type, uint32_t id, uint64_t pn) {
+    p[0] = type;
+    p[1] = 0;
+    put16(p + 2, 0);
+    put32(p + 4, id);
+    put64(p + 8, pn);
+    return RUDP_HEADER;
+}
+
+/* Function to send a packet that is only a header */
+static void send_control(struct rudp_conn *c, uint8_t type) {
+    uint8_t *p = tx_slot(c->ep, &c->peer);
+    tx_commit(c->ep, put_header(p, type, c->id, 0));
+    c->stats.bytes_sent += RUDP_HEADER;
+}
+
+/* ---- Messages ---- */
+
+/* Function to drop a reference to a message, freeing it with the last one */
+static void msg_unref(struct rudp_msg *m) {
+    if (--m->refs == 0) {
+        free(m);
+    }
+}
+
+/* Function to get a stream, allocating it on first use. Returns NULL if out of
+ * memory. */
+static struct rudp_stream *get_stream(struct rudp_conn *c, uint16_t id) {
+    if (!c->streams[id]) {
+        c->streams[id] = calloc(1, sizeof(struct rudp_stream));
+    }
+    return c->streams[id];
+}
+
+/* Function to record that the peer has every fragment of a message */
+static void msg_acked(struct rudp_conn *c, struct rudp_msg *m) {
+    struct rudp_stream *st = c->streams[m->stream];
+    uint32_t i = m->seq & (RUDP_STREAM_WINDOW - 1);
+    st->acked[i / 64] |= 1ULL << (i % 64);
+    for (;;) {
+        i = st->acked_base & (RUDP_STREAM_WINDOW - 1);
+        if (!(st->acked[i / 64] & (1ULL << (i % 64)))) {
+            break;
+        }
+        st->acked[i / 64] &= ~(1ULL << (i % 64));
+        st->acked_base++;
+    }
+    c->queued_bytes -= m->len;
+    c->unacked_msgs--;
+    c->stats.msgs_acked++;
+}
+
+/* Function to record that the peer has one fragment (once) */
+static void frag_acked(struct rudp_conn *c, struct rudp_msg *m, unsigned frag) {
+    uint64_t bit = 1ULL << frag;
+    if (m->acked & bit) {
+        return;
+    }
+    m->acked |= bit;
+    if (m->acked == frag_mask(m->nfrags)) {
+        msg_acked(c, m);
+    }
+}
+
+/* Function to queue a fragment to be sent again; the queue takes over a
+ * reference the caller holds. Returns 0, or -1 if out of memory. */
+static int rtx_push(struct rudp_conn *c, struct rudp_msg *m, unsigned frag) {
+    if (c->rtx_tail - c->rtx_head == c->rtx_cap) {
+        uint32_t cap = c->rtx_cap ? c->rtx_cap * 2 : 64;
+        struct rudp_frag *r = malloc(cap * sizeof(*r));
+        if (!r) {
+            return -1;
+        }
+        for (uint32_t i = c->rtx_head; i != c->rtx_tail; i++) {
+            r[i & (cap - 1)] = c->rtx[i & (c->rtx_cap - 1)];
+        }
+        free(c->rtx);
+        c->rtx = r;
+        c->rtx_cap = cap;
+    }
+    c->rtx[c->rtx_tail++ & (c->rtx_cap - 1)] = (struct rudp_frag){ m, (uint8_t)frag };
+    return 0;
+}
+
+/* ---- Sending ---- */
+
+/* Function to find a tracked packet */
+static struct rudp_sent *sent_at(const struct rudp_conn *c, uint64_t pn) {
+    return &c->sent[pn & (c->sent_cap - 1)];
+}
+
+/* Function to make room to track one more packet. Returns 0, or -1 if the ring
+ * cannot grow. */
+static int sent_reserve(struct rudp_conn *c) {
+    if (c->next_pn - c->sent_lo < c->sent_cap) {
+        return 0;
+    }
+    uint32_t cap = c->sent_cap ? c->sent_cap * 2 : 256;
+    if (cap > RUDP_MAX_TRACKED) {
+        return -1;
+    }
+    struct rudp_sent *s = calloc(cap, sizeof(*s));
+    if (!s) {
+        return -1;
+    }
+    for (uint64_t pn = c->sent_lo; pn < c->next_pn; pn++) {
+        s[pn & (cap - 1)] = *sent_at(c, pn);
+    }
+    free(c->sent);
+    c->sent = s;
+    c->sent_cap = cap;
+    return 0;
+}
+
+/* Function to forget the packets at the front that are no longer in flight.
+ * One declared lost is kept for two RTTs, so that a late acknowledgment still
+ * shows the loss was spurious. */
+static void sent_advance(struct rudp_conn *c, uint64_t now) {
+    uint64_t keep = 2 * (c->srtt > c->latest_rtt ? c->srtt : c->latest_rtt);
+    while (c->sent_lo < c->next_pn) {
+        struct rudp_sent *s = sent_at(c, c->sent_lo);
+        if (s->state == SENT_IN_FLIGHT || (s->state == SENT_LOST && s->sent_ns + keep > now)) {
+            break;
+        }
+        s->state = SENT_NONE;
+        c->sent_lo++;
+    }
+}
+
+/* Function to send one fragment in a new packet. Returns 0, or -1 if the
+ * packet cannot be tracked. */
+static int send_fragment(struct rudp_conn *c, struct rudp_msg *m, unsigned frag, uint64_t now,
+                         int app_limited) {
+    if (sent_reserve(c) < 0) {
+        return -1;
+    }
+    uint32_t off = frag * RUDP_FRAGMENT;
+    uint32_t len = frag_len(m->len, frag);
+    uint64_t pn = c->next_pn++;
+    uint8_t *p = tx_slot(c->ep, &c->peer);
+    size_t n = put_header(p, RUDP_DATA, c->id, pn);
+    put16(p + n, m->stream);
+    p[n + 2] = m->flags;
+    p[n + 3] = 0;
+    put32(p + n + 4, m->seq);
+    put32(p + n + 8, m->len);
+    put32(p + n + 12, off);
+    n += RUDP_DATA_HEADER;
+    memcpy(p + n, m->data + off, len);
+    n += len;
+    tx_commit(c->ep, n);
+
+    /* Rate sampling restarts its interval when nothing was in flight */
+    if (c->bytes_in_flight == 0) {
+        c->first_sent_ns = now;
+        c->delivered_ns = now;
+    }
+    struct rudp_sent *s = sent_at(c, pn);
+    s->msg = m;
+    m->refs++;
+    s->sent_ns = now;
+    s->delivered = c->delivered;
+    s->delivered_ns = c->delivered_ns;
+    s->first_sent_ns = c->first_sent_ns;
+    s->size = n;
+    s->frag = frag;
+    s->state = SENT_IN_FLIGHT;
+    s->app_limited = app_limited;
+    c->bytes_in_flight += n;
+    c->last_sent_ns = now;
+    c->stats.packets_sent++;
+    c->stats.bytes_sent += n;
+
+    /* Next departure under pacing, allowing a short burst to catch up */
+    if (c->pacing_rate > 0) {
+        uint64_t floor = now > RUDP_PACE_BURST_NS ? now - RUDP_PACE_BURST_NS : 0;
+        if (c->pace_next_ns < floor) {
+            c->pace_next_ns = floor;
+        }
+        c->pace_next_ns += (uint64_t)(n * 1e9 / c->pacing_rate);
+    }
+    return 0;
+}
+
+/* Function to send an acknowledgment of everything received */
+static void send_ack(struct rudp_conn *c, uint64_t now) {
+    if (c->num_ranges == 0) {
+        return;
+    }
+    uint8_t *p = tx_slot(c->ep, &c->peer);
+    size_t n = put_header(p, RUDP_ACK, c->id, 0);
+    uint64_t delay_us = (now - c->largest_recv_ns) / 1000;
+    put64(p + n, c->ranges[0].hi);
+    put32(p + n + 8, delay_us > UINT32_MAX ? UINT32_MAX : (uint32_t)delay_us);
+    put16(p + n + 14, 0);
+    n += RUDP_ACK_HEADER;
+
+    /* Each range: gap below the previous one (0 for the first), then length - 1;
+     * a range too long to encode is cut short and ends the list */
+    int num = 0;
+    for (int i = 0; i < c->num_ranges; i++) {
+        uint64_t gap = i ? c->ranges[i - 1].lo - c->ranges[i].hi - 2 : 0;
+        uint64_t span = c->ranges[i].hi - c->ranges[i].lo;
+        if (gap > UINT32_MAX) {
+            break;
+        }
+        put32(p + n, (uint32_t)gap);
+        put32(p + n + 4, span > UINT32_MAX ? UINT32_MAX : (uint32_t)span);
+        n += 8;
+        num++;
+        if (span > UINT32_MAX) {
+            break;
+        }
+    }
+    put16(p + RUDP_HEADER + 12, (uint16_t)num);
+    tx_commit(c->ep, n);
+    c->ack_pending = 0;
+    c->ack_now = 0;
+    tw_cancel(&c->ep->tw, &c->ack_timer);
+    c->stats.acks_sent++;
+    c->stats.bytes_sent += n;
+}
+
+/* Function to compute the probe timeout, backed off by the probes so far */
+static uint64_t pto_ns(const struct rudp_conn *c) {
+    uint64_t pto;
+    if (c->have_rtt) {
+        uint64_t var = 4 * c->rttvar;
+        pto = c->srtt + (var > RUDP_GRANULARITY_NS ? var : RUDP_GRANULARITY_NS);
+    } else {
+        pto = 2 * RUDP_INITIAL_RTT_NS;
+    }
+    return (pto + RUDP_MAX_ACK_DELAY_NS) << (c->pto_count < 16 ? c->pto_count : 16);
+}
+
+/* Function to arm the loss timer for the earliest loss deadline, or the probe
+ * timeout, or disarm it when nothing is in flight */
+static void set_loss_timer(struct rudp_conn *c, uint64_t now) {
+    if (c->state == CONN_SYN_SENT || c->state == CONN_CLOSED) {
+        return;
+    }
+    if (c->bytes_in_flight == 0) {
+        tw_cancel(&c->ep->tw, &c->loss_timer);
+        return;
+    }
+    uint64_t deadline = c->loss_time_ns ? c->loss_time_ns : c->last_sent_ns + pto_ns(c);
+    uint64_t delay = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+    tw_add(&c->ep->tw, &c->loss_timer, delay);
+}
+
+/* Function to send the SYN that opens a connection */
+static void send_syn(struct rudp_conn *c, uint64_t now) {
+    send_control(c, RUDP_SYN);
+    c->syn_sent_ns = now;
+    tw_add(&c->ep->tw, &c->loss_timer, (uint64_t)RUDP_SYN_TIMEOUT_MS << c->syn_tries);
+}
+
+/* Function to mark a connection closed; it is freed at the end of rudp_poll */
+static void conn_dead(struct rudp_conn *c) {
+    if (c->state == CONN_CLOSED) {
+        return;
+    }
+    c->state = CONN_CLOSED;
+    c->ep->reap = 1;
+    if (c->ep->cfg.on_event) {
+        c->ep->cfg.on_event(c, RUDP_EV_CLOSED, c->ep->cfg.arg);
+    }
+}
+
+/* Function to send what the connection may: an acknowledgment if one is due,
+ * then fragments to resend and new ones, as long as the congestion window,
+ * pacing and any probe allowance let it */
+static void conn_flush(struct rudp_conn *c, uint64_t now) {
+    if (c->ack_now || c->ack_pending >= RUDP_ACK_EVERY) {
+        send_ack(c, now);
+    }
+    if (c->state != CONN_OPEN && c->state != CONN_CLOSING) {
+        return;
+    }
+    int sent = 0;
+    while (c->rtx_head != c->rtx_tail || c->sendq) {
+        if (c->probes == 0) {
+            if (c->bytes_in_flight + RUDP_MAX_DATAGRAM > c->cwnd) {
+                c->cwnd_limited = 1;
+                break;
+            }
+            if (c->pacing_rate > 0 && c->pace_next_ns > now) {
+                c->cwnd_limited = 1; /* The pacer spreads the window; data is waiting */
+                break;
+            }
+        }
+        struct rudp_msg *m;
+        unsigned frag;
+        int rtx = c->rtx_head != c->rtx_tail;
+        if (rtx) {
+            struct rudp_frag *f = &c->rtx[c->rtx_head & (c->rtx_cap - 1)];
+            m = f->msg;
+            frag = f->frag;
+            if (m->acked & (1ULL << frag)) {
+                c->rtx_head++;
+                msg_unref(m); /* Acked after all */
+                continue;
+            }
+        } else {
+            m = c->sendq;
+            frag = m->next_frag;
+        }
+        int last = rtx ? c->rtx_tail - c->rtx_head == 1 && !c->sendq
+                       : !m->next && m->next_frag + 1 == m->nfrags;
+        if (send_fragment(c, m, frag, now, last) < 0) {
+            break;
+        }
+        if (rtx) {
+            c->rtx_head++;
+            c->stats.retransmits++;
+            msg_unref(m);
+        } else if (++m->next_frag == m->nfrags) {
+            c->sendq = m->next;
+            if (!c->sendq) {
+                c->sendq_tail = NULL;
+            }
+            msg_unref(m);
+        }
+        if (c->probes > 0) {
+            c->probes--;
+        }
+        sent = 1;
+    }
+    if (sent) {
+        set_loss_timer(c, now);
+    }
+    if (c->state == CONN_CLOSING && rudp_idle(c)) {
+        for (int i = 0; i < RUDP_CLOSE_COPIES; i++) {
+            send_control(c, RUDP_CLOSE);
+        }
+        conn_dead(c);
+    }
+}
+
+/* ---- Acknowledgments and loss ---- */
+
+/* Function to fold an RTT sample into the estimates (RFC 9002 section 5) */
+static void update_rtt(struct rudp_conn *c, uint64_t latest, uint64_t ack_delay) {
+    c->latest_rtt = latest;
+    if (!c->have_rtt) {
+        c->min_rtt = c->srtt = latest;
+        c->rttvar = latest / 2;
+        c->have_rtt = 1;
+        return;
+    }
+    if (latest < c->min_rtt) {
+        c->min_rtt = latest;
+    }
+    if (ack_delay > RUDP_MAX_ACK_DELAY_NS) {
+        ack_delay = RUDP_MAX_ACK_DELAY_NS;
+    }
+    uint64_t adjusted = latest >= c->min_rtt + ack_delay ? latest - ack_delay : latest;
+    uint64_t diff = c->srtt > adjusted ? c->srtt - adjusted : adjusted - c->srtt;
+    c->rttvar = (3 * c->rttvar + diff) / 4;
+    c->srtt = (7 * c->srtt + adjusted) / 8;
+}
+
+/* Function to declare lost every packet in flight below the largest acked by
+ * the packet threshold or more, or sent 9/8 RTT before now, and note when the
+ * next one will be */
+static void detect_lost(struct rudp_conn *c, uint64_t now) {
+    c->loss_time_ns = 0;
+    if (c->largest_acked == 0) {
+        return;
+    }
+    uint64_t rtt = c->latest_rtt > c->srtt ? c->latest_rtt : c->srtt;
+    uint64_t delay = rtt * 9 / 8;
+    if (delay < RUDP_GRANULARITY_NS) {
+        delay = RUDP_GRANULARITY_NS;
+    }
+    uint64_t newest_lost = 0;
+    for (uint64_t pn = c->sent_lo; pn < c->largest_acked && pn < c->next_pn; pn++) {
+        struct rudp_sent *s = sent_at(c, pn);
+        if (s->state != SENT_IN_FLIGHT) {
+            continue;
+        }
+        if (c->largest_acked - pn < c->pkt_threshold && s->sent_ns + delay > now) {
+            uint64_t t = s->sent_ns + delay;
+            if (c->loss_time_ns == 0 || t < c->loss_time_ns) {
+                c->loss_time_ns = t;
+            }
+            continue;
+        }
+        s->state = SENT_LOST;
+        c->bytes_in_flight -= s->size;
+        c->stats.lost++;
+        if (s->sent_ns > newest_lost) {
+            newest_lost = s->sent_ns;
+        }
+        if (s->msg) {
+            if ((s->msg->acked & (1ULL << s->frag)) || rtx_push(c, s->msg, s->frag) < 0) {
+                msg_unref(s->msg);
+            }
+            s->msg = NULL;
+        }
+    }
+    sent_advance(c, now);
+
+    /* One window reduction per round trip: losses of packets sent before the
+     * last reduction belong to the same event */
+    if (newest_lost > c->recovery_start_ns) {
+        c->recovery_start_ns = now;
+        c->cc->on_loss(c, now);
+    }
+}
+
+/* Function to handle one acknowledgment */
+static void on_ack_frame(struct rudp_conn *c, const uint8_t *p, size_t len, uint64_t now) {
+    if (len < RUDP_ACK_HEADER) {
+        return;
+    }
+    uint64_t largest = get64(p);
+    uint64_t ack_delay = (uint64_t)get32(p + 8) * 1000;
+    unsigned num = get16(p + 12);
+    if (largest == 0 || largest >= c->next_pn || num == 0 || num > RUDP_MAX_RANGES ||
+        len < RUDP_ACK_HEADER + num * 8u) {
+        return;
+    }
+
+    uint64_t acked = 0;
+    struct rudp_sent newest;    /* Most recently sent packet newly acked */
+    memset(&newest, 0, sizeof(newest));
+    int have_newest = 0, largest_new = 0;
+    uint64_t hi = largest;
+    const uint8_t *r = p + RUDP_ACK_HEADER;
+    for (unsigned i = 0; i < num; i++, r += 8) {
+        uint64_t gap = get32(r), span = get32(r + 4);
+        if (i > 0) {
+            if (hi < gap + 2) {
+                break;
+            }
+            hi -= gap + 2;
+        }
+        if (span > hi) {
+            break;
+        }
+        uint64_t lo = hi - span;
+        for (uint64_t pn = lo > c->sent_lo ? lo : c->sent_lo; pn <= hi && pn < c->next_pn; pn++) {
+            struct rudp_sent *s = sent_at(c, pn);
+            if (s->state == SENT_LOST) {
+                /* Only reordered: wait for that much reordering from now on */
+                s->state = SENT_ACKED;
+                c->stats.spurious++;
+                if (largest - pn >= c->pkt_threshold) {
+                    c->pkt_threshold = largest - pn + 1 < RUDP_MAX_PACKET_THRESHOLD
+                                           ? largest - pn + 1 : RUDP_MAX_PACKET_THRESHOLD;
+                }
+                continue;
+            }
+            if (s->state != SENT_IN_FLIGHT) {
+                continue;
+            }
+            s->state = SENT_ACKED;
+            c->bytes_in_flight -= s->size;
+            c->delivered += s->size;
+            acked += s->size;
+            if (s->msg) {
+                frag_acked(c, s->msg, s->frag);
+                msg_unref(s->msg);
+                s->msg = NULL;
+            }
+            if (!have_newest || s->sent_ns >= newest.sent_ns) {
+                newest = *s;
+                have_newest = 1;
+            }
+            if (pn == largest) {
+                largest_new = 1;
+            }
+        }
+        hi = lo;
+    }
+    if (largest > c->largest_acked) {
+        c->largest_acked = largest;
+    }
+    if (!have_newest) {
+        return;
+    }
+
+    /* RTT from the largest packet, when this is the first ack of it */
+    if (largest_new) {
+        update_rtt(c, now - newest.sent_ns, ack_delay);
+    }
+    c->pto_count = 0;
+
+    /* Delivery rate over the longer of the send and the ack intervals */
+    memset(&c->rs, 0, sizeof(c->rs));
+    uint64_t send_elapsed = newest.sent_ns - newest.first_sent_ns;
+    uint64_t ack_elapsed = now - newest.delivered_ns;
+    uint64_t interval = send_elapsed > ack_elapsed ? send_elapsed : ack_elapsed;
+    c->rs.prior_delivered = newest.delivered;
+    c->rs.app_limited = newest.app_limited;
+    c->rs.rtt_ns = now - newest.sent_ns;
+    c->rs.in_recovery = newest.sent_ns <= c->recovery_start_ns;
+    if (interval > 0 && (!c->have_rtt || interval >= c->min_rtt)) {
+        c->rs.rate = (c->delivered - newest.delivered) * 1e9 / interval;
+        c->rs.valid = 1;
+        c->stats.delivery_rate = c->rs.rate;
+    }
+    c->first_sent_ns = newest.sent_ns;
+    c->delivered_ns = now;
+
+    detect_lost(c, now);
+    c->cc->on_ack(c, acked, now);
+    c->cwnd_limited = 0;
+    sent_advance(c, now);
+    set_loss_timer(c, now);
+}
+
+/* Function run when the loss timer fires: retry the handshake, declare the
+ * packets whose time is up lost, or send probes after a probe timeout */
+static void on_loss_timer(struct tw_timer *t, void *arg) {
+    (void)t;
+    struct rudp_conn *c = arg;
+    uint64_t now = now_ns();
+    if (c->state == CONN_CLOSED) {
+        return;
+    }
+    if (c->state == CONN_SYN_SENT) {
+        if (++c->syn_tries >= RUDP_SYN_TRIES) {
+            conn_dead(c);
+        } else {
+            send_syn(c, now);
+        }
+        return;
+    }
+    if (c->loss_time_ns) {
+        detect_lost(c, now > c->loss_time_ns ? now : c->loss_time_ns);
+    } else if (c->bytes_in_flight > 0) {
+        c->stats.ptos++;
+        if (++c->pto_count >= RUDP_PERSISTENT_PTOS) {
+            c->cc->on_collapse(c);
+        }
+
+        /* Probe with the oldest fragments still in flight */
+        int queued = 0;
+        for (uint64_t pn = c->sent_lo; pn < c->next_pn && queued < RUDP_PROBES; pn++) {
+            struct rudp_sent *s = sent_at(c, pn);
+            if (s->state == SENT_IN_FLIGHT && s->msg && rtx_push(c, s->msg, s->frag) == 0) {
+                s->msg->refs++;
+                queued++;
+            }
+        }
+        c->probes = RUDP_PROBES;
+    }
+    conn_flush(c, now);
+    set_loss_timer(c, now);
+}
+
+/* ---- Receiving ---- */
+
+/* Function to add a packet number to the received ranges. Returns 1 if it is
+ * new (or too old to tell), 0 if it was received before. */
+static int record_pn(struct rudp_conn *c, uint64_t pn, uint64_t now) {
+    struct rudp_range *r = c->ranges;
+    uint64_t top = c->num_ranges ? r[0].hi : 0;
+    int i;
+    for (i = 0; i < c->num_ranges; i++) {
+        if (pn > r[i].hi + 1) {
+            break;
+        }
+        if (pn == r[i].hi + 1) {
+            r[i].hi = pn;
+            if (i > 0 && r[i - 1].lo == pn + 1) {
+                r[i - 1].lo = r[i].lo;
+                memmove(&r[i], &r[i + 1], (c->num_ranges - i - 1) * sizeof(*r));
+                c->num_ranges--;
+            }
+            goto added;
+        }
+        if (pn >= r[i].lo) {
+            return 0;
+        }
+        if (pn + 1 == r[i].lo) {
+            r[i].lo = pn;
+            if (i + 1 < c->num_ranges && r[i + 1].hi + 1 == pn) {
+                r[i].lo = r[i + 1].lo;
+                memmove(&r[i + 1], &r[i + 2], (c->num_ranges - i - 2) * sizeof(*r));
+                c->num_ranges--;
+            }
+            goto added;
+        }
+    }
+
+    /* A new range at i; the oldest range is forgotten to make room */
+    if (i == RUDP_MAX_RANGES) {
+        return 1;
+    }
+    if (c->num_ranges == RUDP_MAX_RANGES) {
+        c->num_ranges--;
+    }
+    memmove(&r[i + 1], &r[i], (c->num_ranges - i) * sizeof(*r));
+    r[i].lo = r[i].hi = pn;
+    c->num_ranges++;
+
+added:
+    if (pn > top) {
+        c->largest_recv_ns = now;
+    }
+    /* Acknowledge out-of-order arrivals at once, so the sender learns of the
+     * hole (or of its filling) within the RTT */
+    if (pn != top + 1) {
+        c->ack_now = 1;
+    }
+    return 1;
+}
+
+/* Function to hand a complete message to the application */
+static void deliver(struct rudp_conn *c, uint16_t stream, struct rudp_rmsg *s) {
+    if (c->ep->cfg.on_message) {
+        c->ep->cfg.on_message(c, stream, s->buf, s->len, c->ep->cfg.arg);
+    }
+    c->stats.msgs_delivered++;
+    free(s->buf);
+    s->buf = NULL;
+    s->state = SLOT_DELIVERED;
+}
+
+/* Function to store a received fragment and deliver what it completes */
+static void on_data(struct rudp_conn *c, const uint8_t *p, size_t len) {
+    if (len < RUDP_DATA_HEADER) {
+        return;
+    }
+    uint16_t sid = get16(p);
+    uint8_t flags = p[2];
+    uint32_t seq = get32(p + 4), msg_len = get32(p + 8), off = get32(p + 12);
+    size_t plen = len - RUDP_DATA_HEADER;
+    unsigned frag = off / RUDP_FRAGMENT, nfrags = frag_count(msg_len);
+    if (sid >= RUDP_MAX_STREAMS || msg_len > RUDP_MAX_MESSAGE || off % RUDP_FRAGMENT ||
+        frag >= nfrags || plen != frag_len(msg_len, frag)) {
+        return;
+    }
+    struct rudp_stream *st = get_stream(c, sid);
+    if (!st) {
+        return;
+    }
+    int32_t ahead = (int32_t)(seq - st->base);
+    if (ahead < 0) {
+        c->stats.duplicates++; /* Delivered already */
+        return;
+    }
+    if (ahead >= RUDP_STREAM_WINDOW) {
+        return;
+    }
+
+    struct rudp_rmsg *s = &st->slots[seq & (RUDP_STREAM_WINDOW - 1)];
+    if (s->state == SLOT_FREE) {
+        s->buf = malloc(msg_len ? msg_len : 1);
+        if (!s->buf) {
+            return;
+        }
+        s->seq = seq;
+        s->len = msg_len;
+        s->flags = flags;
+        s->nfrags = nfrags;
+        s->frags = 0;
+        s->state = SLOT_PARTIAL;
+    } else if (s->seq != seq || s->len != msg_len) {
+        return;
+    }
+    if (s->state != SLOT_PARTIAL || (s->frags & (1ULL << frag))) {
+        c->stats.duplicates++;
+        return;
+    }
+    memcpy(s->buf + off, p + RUDP_DATA_HEADER, plen);
+    s->frags |= 1ULL << frag;
+    if (s->frags != frag_mask(nfrags)) {
+        return;
+    }
+    s->state = SLOT_COMPLETE;
+    if (s->flags & RUDP_UNORDERED) {
+        deliver(c, sid, s);
+    }
+
+    /* Deliver in order from the base, and free the slots behind it */
+    for (;;) {
+        s = &st->slots[st->base & (RUDP_STREAM_WINDOW - 1)];
+        if (s->state == SLOT_COMPLETE) {
+            deliver(c, sid, s);
+        }
+        if (s->state != SLOT_DELIVERED) {
+            break;
+        }
+        s->state = SLOT_FREE;
+        st->base++;
+    }
+}
+
+/* Function run when a lone data packet has waited long enough for its ack */
+static void on_ack_timer(struct tw_timer *t, void *arg) {
+    (void)t;
+    struct rudp_conn *c = arg;
+    if (c->ack_pending > 0) {
+        c->ack_now = 1;
+    }
+}
+
+/* Function run when the idle timer fires: close if nothing came for too long */
+static void on_idle_timer(struct tw_timer *t, void *arg) {
+    (void)t;
+    struct rudp_conn *c = arg;
+    uint64_t idle_ms = (now_ns() - c->last_recv_ns) / 1000000;
+    if (c->state == CONN_CLOSED) {
+        return;
+    }
+    if (idle_ms >= RUDP_IDLE_MS) {
+        conn_dead(c);
+    } else {
+        tw_add(&c->ep->tw, &c->idle_timer, RUDP_IDLE_MS - idle_ms);
+    }
+}
+
+/* ---- Congestion control: CUBIC ---- */
+
+/* Function to set the pacing rate from cwnd over the smoothed RTT */
+static void pace_by_cwnd(struct rudp_conn *c, double gain) {
+    c->pacing_rate = c->have_rtt && c->srtt ? gain * c->cwnd * 1e9 / c->srtt : 0;
+}
+
+static void cubic_init(struct rudp_conn *c, uint64_t now) {
+    (void)now;
+    memset(&c->cubic, 0, sizeof(c->cubic));
+    c->cubic.ssthresh = UINT64_MAX;
+    c->cwnd = RUDP_INITIAL_CWND * RUDP_MAX_DATAGRAM;
+}
+
+static void cubic_on_ack(struct rudp_conn *c, uint64_t acked, uint64_t now) {
+    struct rudp_cubic *cu = &c->cubic;
+    const double mss = RUDP_MAX_DATAGRAM;
+    if (c->cwnd_limited && !c->rs.in_recovery) {
+        if (c->cwnd < cu->ssthresh) {
+            c->cwnd += acked;
+        } else {
+            if (cu->epoch_ns == 0) {
+                cu->epoch_ns = now;
+                cu->w_est = c->cwnd;
+                if (c->cwnd < cu->w_max) {
+                    cu->k = cbrt((cu->w_max - c->cwnd) / mss / CUBIC_C);
+                } else {
+                    cu->k = 0;
+                    cu->w_max = c->cwnd;
+                }
+            }
+            double t = (now - cu->epoch_ns + c->min_rtt) / 1e9;
+            double target = cu->w_max + CUBIC_C * (t - cu->k) * (t - cu->k) * (t - cu->k) * mss;
+            if (target > 1.5 * c->cwnd) {
+                target = 1.5 * c->cwnd;
+            }
+            /* Never slower than Reno would grow with the same average window */
+            cu->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked * mss / c->cwnd;
+            if (cu->w_est > target) {
+                target = cu->w_est;
+            }
+            if (target > c->cwnd) {
+                c->cwnd += (uint64_t)((target - c->cwnd) * acked / c->cwnd);
+            }
+        }
+    }
+    pace_by_cwnd(c, c->cwnd < cu->ssthresh ? 2.0 : 1.2);
+}
+
+static void cubic_on_loss(struct rudp_conn *c, uint64_t now) {
+    (void)now;
+    struct rudp_cubic *cu = &c->cubic;
+    /* Fast convergence: give up more room when the window is still shrinking */
+    cu->w_max = c->cwnd < cu->w_max ? c->cwnd * (1 + CUBIC_BETA) / 2 : c->cwnd;
+    cu->epoch_ns = 0;
+    c->cwnd = (uint64_t)(c->cwnd * CUBIC_BETA);
+    if (c->cwnd < RUDP_MIN_CWND * RUDP_MAX_DATAGRAM) {
+        c->cwnd = RUDP_MIN_CWND * RUDP_MAX_DATAGRAM;
+    }
+    cu->ssthresh = c->cwnd;
+    pace_by_cwnd(c, 1.2);
+}
+
+static void cubic_on_collapse(struct rudp_conn *c) {
+    struct rudp_cubic *cu = &c->cubic;
+    uint64_t floor = RUDP_MIN_CWND * RUDP_MAX_DATAGRAM;
+    cu->ssthresh = c->cwnd / 2 > floor ? c->cwnd / 2 : floor;
+    cu->epoch_ns = 0;
+    c->cwnd = floor;
+}
+
+static const char *cubic_state(const struct rudp_conn *c) {
+    if (c->cwnd < c->cubic.ssthresh) {
+        return "slow start";
+    }
+    return c->rs.in_recovery ? "recovery" : "congestion avoidance";
+}
+
+static const struct rudp_cc_ops cubic_ops = {
+    cubic_init, cubic_on_ack, cubic_on_loss, cubic_on_collapse, cubic_state
+};
+
+/* ---- Congestion control: BBR ---- */
+
+/* Function to read the bandwidth max filter */
+static double bbr_max_bw(const struct rudp_bbr *b) {
+    double bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++) {
+        if (b->bw[i] > bw) {
+            bw = b->bw[i];
+        }
+    }
+    return bw;
+}
+
+/* Function to compute gain times the estimated bandwidth-delay product */
+static uint64_t bbr_bdp(const struct rudp_conn *c, double gain) {
+    const struct rudp_bbr *b = &c->bbr;
+    if (b->min_rtt_ns == UINT64_MAX) {
+        return RUDP_INITIAL_CWND * RUDP_MAX_DATAGRAM;
+    }
+    return (uint64_t)(gain * bbr_max_bw(b) * b->min_rtt_ns / 1e9);
+}
+
+static void bbr_enter(struct rudp_bbr *b, int mode, uint64_t now) {
+    b->mode = mode;
+    switch (mode) {
+    case BBR_STARTUP:
+        b->pacing_gain = b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        b->pacing_gain = 1 / BBR_HIGH_GAIN;
+        b->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_PROBE_BW:
+        b->cycle = 2; /* Start cruising, not probing */
+        b->cycle_stamp_ns = now;
+        b->pacing_gain = bbr_cycle_gains[b->cycle];
+        b->cwnd_gain = 2;
+        break;
+    case BBR_PROBE_RTT:
+        b->pacing_gain = b->cwnd_gain = 1;
+        b->probe_rtt_done_ns = 0;
+        break;
+    }
+}
+
+static void bbr_init(struct rudp_conn *c, uint64_t now) {
+    struct rudp_bbr *b = &c->bbr;
+    memset(b, 0, sizeof(*b));
+    b->min_rtt_ns = UINT64_MAX;
+    b->min_rtt_stamp_ns = now;
+    bbr_enter(b, BBR_STARTUP, now);
+    c->cwnd = RUDP_INITIAL_CWND * RUDP_MAX_DATAGRAM;
+}
+
+static void bbr_on_ack(struct rudp_conn *c, uint64_t acked, uint64_t now) {
+    struct rudp_bbr *b = &c->bbr;
+    const struct rudp_rate_sample *rs = &c->rs;
+    const uint64_t mss = RUDP_MAX_DATAGRAM;
+
+    /* A round trip ends when a packet sent after its start is acked */
+    int round_start = 0;
+    if (rs->prior_delivered >= b->next_round_delivered) {
+        b->next_round_delivered = c->delivered;
+        b->round++;
+        b->bw[b->round % BBR_BW_ROUNDS] = 0;
+        round_start = 1;
+    }
+    /* App-limited samples only count if they raise the estimate */
+    if (rs->valid && (!rs->app_limited || rs->rate >= bbr_max_bw(b))) {
+        double *slot = &b->bw[b->round % BBR_BW_ROUNDS];
+        if (rs->rate > *slot) {
+            *slot = rs->rate;
+        }
+    }
+    int expired = now > b->min_rtt_stamp_ns + BBR_MIN_RTT_WINDOW_NS;
+    if (rs->rtt_ns && (rs->rtt_ns <= b->min_rtt_ns || expired)) {
+        b->min_rtt_ns = rs->rtt_ns;
+        b->min_rtt_stamp_ns = now;
+    }
+
+    switch (b->mode) {
+    case BBR_STARTUP:
+        if (round_start && !rs->app_limited) {
+            double bw = bbr_max_bw(b);
+            if (bw >= b->full_bw * BBR_FULL_BW_GROWTH) {
+                b->full_bw = bw;
+                b->full_bw_rounds = 0;
+            } else if (++b->full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+                b->filled_pipe = 1;
+                bbr_enter(b, BBR_DRAIN, now);
+            }
+        }
+        break;
+    case BBR_DRAIN:
+        if (c->bytes_in_flight <= bbr_bdp(c, 1)) {
+            bbr_enter(b, BBR_PROBE_BW, now);
+        }
+        break;
+    case BBR_PROBE_BW: {
+        /* Each phase lasts a min RTT; the drain phase ends early once the queue
+         * the probe built is gone */
+        int next = now - b->cycle_stamp_ns > b->min_rtt_ns;
+        if (b->pacing_gain < 1 && c->bytes_in_flight <= bbr_bdp(c, 1)) {
+            next = 1;
+        }
+        if (next) {
+            b->cycle = (b->cycle + 1) % 8;
+            b->cycle_stamp_ns = now;
+            b->pacing_gain = bbr_cycle_gains[b->cycle];
+        }
+        break;
+    }
+    case BBR_PROBE_RTT:
+        break;
+    }
+
+    /* Every 10 s without a lower RTT, drain the queue to measure it afresh */
+    if (b->mode != BBR_PROBE_RTT && expired) {
+        b->prior_cwnd = c->cwnd;
+        bbr_enter(b, BBR_PROBE_RTT, now);
+    }
+    if (b->mode == BBR_PROBE_RTT) {
+        if (b->probe_rtt_done_ns == 0 && c->bytes_in_flight <= BBR_MIN_CWND * mss) {
+            b->probe_rtt_done_ns = now + BBR_PROBE_RTT_NS;
+        } else if (b->probe_rtt_done_ns && now >= b->probe_rtt_done_ns) {
+            b->min_rtt_stamp_ns = now;
+            c->cwnd = b->prior_cwnd > c->cwnd ? b->prior_cwnd : c->cwnd;
+            bbr_enter(b, b->filled_pipe ? BBR_PROBE_BW : BBR_STARTUP, now);
+        }
+    }
+
+    /* Outputs: pace at gain x bandwidth, cap in flight at gain x BDP */
+    double bw = bbr_max_bw(b);
+    if (bw > 0) {
+        c->pacing_rate = b->pacing_gain * bw;
+    } else {
+        pace_by_cwnd(c, BBR_HIGH_GAIN);
+    }
+    uint64_t target = bbr_bdp(c, b->cwnd_gain) + 3 * mss;
+    if (b->filled_pipe) {
+        c->cwnd = c->cwnd + acked < target ? c->cwnd + acked : target;
+    } else if (c->cwnd < target || c->delivered < RUDP_INITIAL_CWND * mss) {
+        c->cwnd += acked;
+    }
+    if (c->cwnd < BBR_MIN_CWND * mss) {
+        c->cwnd = BBR_MIN_CWND * mss;
+    }
+    if (b->mode == BBR_PROBE_RTT && c->cwnd > BBR_MIN_CWND * mss) {
+        c->cwnd = BBR_MIN_CWND * mss;
+    }
+}
+
+/* BBR does not take loss as a sign of congestion */
+static void bbr_on_loss(struct rudp_conn *c, uint64_t now) {
+    (void)c;
+    (void)now;
+}
+
+static void bbr_on_collapse(struct rudp_conn *c) {
+    c->bbr.prior_cwnd = c->cwnd;
+    c->cwnd = BBR_MIN_CWND * RUDP_MAX_DATAGRAM;
+}
+
+static const char *bbr_state(const struct rudp_conn *c) {
+    static const char *names[] = { "startup", "drain", "probe bandwidth", "probe RTT" };
+    return names[c->bbr.mode];
+}
+
+static const struct rudp_cc_ops bbr_ops = {
+    bbr_init, bbr_on_ack, bbr_on_loss, bbr_on_collapse, bbr_state
+};
+
+/* ---- Connections ---- */
+
+/* Function to hash a connection id to its bucket */
+static unsigned conn_bucket(uint32_t id) {
+    return (id * 2654435761u) >> 22; /* Top 10 bits: RUDP_CONN_BUCKETS */
+}
+
+/* Function to find a connection by id */
+static struct rudp_conn *conn_find(const struct rudp_endpoint *ep, uint32_t id) {
+    struct rudp_conn *c = ep->buckets[conn_bucket(id)];
+    while (c && c->id != id) {
+        c = c->hnext;
+    }
+    return c;
+}
+
+/* Function to create a connection and link it into the endpoint. Returns it,
+ * or NULL if out of memory. */
+static struct rudp_conn *conn_new(struct rudp_endpoint *ep, uint32_t id,
+                                  const struct sockaddr_in *peer, uint64_t now) {
+    struct rudp_conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return NULL;
+    }
+    c->ep = ep;
+    c->id = id;
+    c->peer = *peer;
+    c->next_pn = c->sent_lo = 1; /* 0 marks packets that are not tracked */
+    c->pkt_threshold = RUDP_PACKET_THRESHOLD;
+    c->cc_kind = ep->cfg.cc;
+    c->cc = ep->cfg.cc == RUDP_CC_BBR ? &bbr_ops : &cubic_ops;
+    c->cc->init(c, now);
+    c->last_recv_ns = now;
+    tw_timer_init(&c->loss_timer, on_loss_timer, c);
+    tw_timer_init(&c->ack_timer, on_ack_timer, c);
+    tw_timer_init(&c->idle_timer, on_idle_timer, c);
+    tw_add(&ep->tw, &c->idle_timer, RUDP_IDLE_MS);
+
+    unsigned b = conn_bucket(id);
+    c->hnext = ep->buckets[b];
+    ep->buckets[b] = c;
+    c->next = ep->conns;
+    if (ep->conns) {
+        ep->conns->prev = c;
+    }
+    ep->conns = c;
+    return c;
+}
+
+/* Function to unlink and free a connection and everything it holds */
+static void conn_free(struct rudp_conn *c) {
+    struct rudp_endpoint *ep = c->ep;
+    tw_cancel(&ep->tw, &c->loss_timer);
+    tw_cancel(&ep->tw, &c->ack_timer);
+    tw_cancel(&ep->tw, &c->idle_timer);
+    struct rudp_conn **pp = &ep->buckets[conn_bucket(c->id)];
+    while (*pp != c) {
+        pp = &(*pp)->hnext;
+    }
+    *pp = c->hnext;
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        ep->conns = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+
+    for (uint64_t pn = c->sent_lo; pn < c->next_pn; pn++) {
+        struct rudp_sent *s = sent_at(c, pn);
+        if (s->msg) {
+            msg_unref(s->msg);
+        }
+    }
+    for (uint32_t i = c->rtx_head; i != c->rtx_tail; i++) {
+        msg_unref(c->rtx[i & (c->rtx_cap - 1)].msg);
+    }
+    while (c->sendq) {
+        struct rudp_msg *m = c->sendq;
+        c->sendq = m->next;
+        msg_unref(m);
+    }
+    for (int i = 0; i < RUDP_MAX_STREAMS; i++) {
+        if (c->streams[i]) {
+            for (int j = 0; j < RUDP_STREAM_WINDOW; j++) {
+                free(c->streams[i]->slots[j].buf);
+            }
+            free(c->streams[i]);
+        }
+    }
+    free(c->sent);
+    free(c->rtx);
+    free(c);
+}
+
+/* Function to mark a client connection open */
+static void conn_established(struct rudp_conn *c, uint64_t now) {
+    c->state = CONN_OPEN;
+    tw_cancel(&c->ep->tw, &c->loss_timer);
+    if (c->syn_tries == 0) {
+        update_rtt(c, now - c->syn_sent_ns, 0); /* The SYN was not retried */
+    }
+    if (c->ep->cfg.on_event) {
+        c->ep->cfg.on_event(c, RUDP_EV_ESTABLISHED, c->ep->cfg.arg);
+    }
+}
+
+/* Function to handle one received datagram */
+static void on_datagram(struct rudp_endpoint *ep, const uint8_t *p, size_t len,
+                        const struct sockaddr_in *from, uint64_t now) {
+    if (len < RUDP_HEADER) {
+        return;
+    }
+    uint8_t type = p[0];
+    uint32_t id = get32(p + 4);
+    uint64_t pn = get64(p + 8);
+    struct rudp_conn *c = conn_find(ep, id);
+
+    if (type == RUDP_SYN) {
+        if (!c) {
+            if (!ep->cfg.accept || id == 0 || !(c = conn_new(ep, id, from, now))) {
+                return;
+            }
+            c->state = CONN_OPEN;
+            if (ep->cfg.on_event) {
+                ep->cfg.on_event(c, RUDP_EV_ACCEPTED, ep->cfg.arg);
+            }
+        }
+        if (c->client || c->state == CONN_CLOSED) {
+            return;
+        }
+        c->peer = *from;
+        c->last_recv_ns = now;
+        c->stats.packets_received++;
+        send_control(c, RUDP_SYNACK);
+        return;
+    }
+    if (!c || c->state == CONN_CLOSED || c->peer.sin_addr.s_addr != from->sin_addr.s_addr ||
+        c->peer.sin_port != from->sin_port) {
+        return;
+    }
+    c->last_recv_ns = now;
+    c->stats.packets_received++;
+    if (c->state == CONN_SYN_SENT) {
+        conn_established(c, now);
+    }
+
+    switch (type) {
+    case RUDP_DATA:
+        if (pn == 0) {
+            return;
+        }
+        if (!record_pn(c, pn, now)) {
+            c->stats.duplicates++;
+            c->ack_now = 1;
+            return;
+        }
+        c->ack_pending++;
+        on_data(c, p + RUDP_HEADER, len - RUDP_HEADER);
+        if (!c->ack_now && c->ack_pending < RUDP_ACK_EVERY && !tw_pending(&c->ack_timer)) {
+            tw_add(&ep->tw, &c->ack_timer, RUDP_ACK_DELAY_MS);
+        }
+        break;
+    case RUDP_ACK:
+        on_ack_frame(c, p + RUDP_HEADER, len - RUDP_HEADER, now);
+        break;
+    case RUDP_CLOSE:
+        conn_dead(c);
+        break;
+    }
+}
+
+/* ---- Interface ---- */
+
+/* Function to fill in the default settings */
+void rudp_config_init(struct rudp_config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->cc = RUDP_CC_CUBIC;
+    cfg->send_buffer = 4 << 20;
+}
+
+/* Function to open an endpoint on a UDP port */
+struct rudp_endpoint *rudp_open(int port, const struct rudp_config *cfg) {
+    struct rudp_endpoint *ep = calloc(1, sizeof(*ep));
+    if (!ep) {
+        return NULL;
+    }
+    ep->cfg = *cfg;
+    tw_init(&ep->tw, 1);
+    ep->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ep->fd < 0) {
+        perror("Socket creation failed");
+        free(ep);
+        return NULL;
+    }
+    int bufsize = RUDP_SOCKET_BUFFER;
+    setsockopt(ep->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(ep->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(ep->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Bind failed");
+        close(ep->fd);
+        free(ep);
+        return NULL;
+    }
+    for (int i = 0; i < RUDP_BATCH; i++) {
+        ep->rx_iovs[i].iov_base = ep->rx_bufs[i];
+        ep->rx_msgs[i].msg_hdr.msg_iov = &ep->rx_iovs[i];
+        ep->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        ep->rx_msgs[i].msg_hdr.msg_name = &ep->rx_addrs[i];
+        ep->tx_iovs[i].iov_base = ep->tx_bufs[i];
+        ep->tx_msgs[i].msg_hdr.msg_iov = &ep->tx_iovs[i];
+        ep->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        ep->tx_msgs[i].msg_hdr.msg_name = &ep->tx_addrs[i];
+        ep->tx_msgs[i].msg_hdr.msg_namelen = sizeof(ep->tx_addrs[i]);
+    }
+    return ep;
+}
+
+/* Function to free an endpoint and all its connections */
+void rudp_endpoint_close(struct rudp_endpoint *ep) {
+    ep_flush(ep);
+    while (ep->conns) {
+        conn_free(ep->conns);
+    }
+    close(ep->fd);
+    free(ep);
+}
+
+/* Function to start a connection */
+struct rudp_conn *rudp_connect(struct rudp_endpoint *ep, const struct sockaddr_in *peer) {
+    uint32_t id = 0;
+    while (id == 0 || conn_find(ep, id)) {
+        if (getrandom(&id, sizeof(id), 0) != sizeof(id)) {
+            id = (uint32_t)now_ns() ^ (uint32_t)getpid() << 16;
+        }
+    }
+    uint64_t now = now_ns();
+    struct rudp_conn *c = conn_new(ep, id, peer, now);
+    if (!c) {
+        return NULL;
+    }
+    c->client = 1;
+    c->state = CONN_SYN_SENT;
+    send_syn(c, now);
+    return c;
+}
+
+/* Function to queue a message */
+int rudp_send(struct rudp_conn *c, uint16_t stream, const void *data, size_t len, int flags) {
+    if (c->state == CONN_CLOSING || c->state == CONN_CLOSED) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if (len > RUDP_MAX_MESSAGE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (stream >= RUDP_MAX_STREAMS) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct rudp_stream *st = get_stream(c, stream);
+    if (!st) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (st->next_seq - st->acked_base >= RUDP_STREAM_WINDOW ||
+        (c->queued_bytes > 0 && c->queued_bytes + len > c->ep->cfg.send_buffer)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    struct rudp_msg *m = malloc(sizeof(*m) + len);
+    if (!m) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(m, 0, sizeof(*m));
+    memcpy(m->data, data, len);
+    m->refs = 1; /* The send queue's */
+    m->seq = st->next_seq++;
+    m->len = len;
+    m->stream = stream;
+    m->flags = flags & RUDP_UNORDERED;
+    m->nfrags = frag_count(len);
+    if (c->sendq_tail) {
+        c->sendq_tail->next = m;
+    } else {
+        c->sendq = m;
+    }
+    c->sendq_tail = m;
+    c->queued_bytes += len;
+    c->unacked_msgs++;
+    c->stats.msgs_sent++;
+    return 0;
+}
+
+/* Function to close a connection once its messages are acknowledged */
+void rudp_close(struct rudp_conn *c) {
+    if (c->state == CONN_SYN_SENT) {
+        conn_dead(c);
+    } else if (c->state == CONN_OPEN) {
+        c->state = CONN_CLOSING;
+    }
+}
+
+/* Function to compute how long rudp_poll may sleep before pacing lets some
+ * connection send again (UINT64_MAX if none is waiting for it) */
+static uint64_t pacing_wait(const struct rudp_endpoint *ep, uint64_t now) {
+    uint64_t wait = UINT64_MAX;
+    for (const struct rudp_conn *c = ep->conns; c; c = c->next) {
+        if ((c->state == CONN_OPEN || c->state == CONN_CLOSING) &&
+            (c->sendq || c->rtx_head != c->rtx_tail) && c->pacing_rate > 0 &&
+            c->bytes_in_flight + RUDP_MAX_DATAGRAM <= c->cwnd) {
+            uint64_t w = c->pace_next_ns > now ? c->pace_next_ns - now : 0;
+            if (w < wait) {
+                wait = w;
+            }
+        }
+    }
+    return wait;
+}
+
+/* Function to run the endpoint for up to timeout_ms */
+int rudp_poll(struct rudp_endpoint *ep, int timeout_ms) {
+    uint64_t now = now_ns();
+    for (struct rudp_conn *c = ep->conns; c; c = c->next) {
+        conn_flush(c, now);
+    }
+    ep_flush(ep);
+
+    /* Sleep until a datagram, a timer tick or a pacing departure */
+    uint64_t wait = timeout_ms < 0 ? UINT64_MAX : (uint64_t)timeout_ms * 1000000;
+    int tick = tw_timeout_ms(&ep->tw, now / 1000000);
+    if (tick >= 0 && (uint64_t)tick * 1000000 < wait) {
+        wait = (uint64_t)tick * 1000000;
+    }
+    uint64_t pace = pacing_wait(ep, now);
+    if (pace < wait) {
+        wait = pace;
+    }
+    struct pollfd pfd = { ep->fd, POLLIN, 0 };
+    struct timespec ts = { (time_t)(wait / 1000000000), (long)(wait % 1000000000) };
+    int ready = ppoll(&pfd, 1, wait == UINT64_MAX ? NULL : &ts, NULL);
+    if (ready < 0 && errno != EINTR) {
+        perror("ppoll failed");
+        return -1;
+    }
+
+    /* Receive everything queued, a batch at a time */
+    for (int i = 0; ready > 0 && i < RUDP_RX_BATCHES; i++) {
+        for (int j = 0; j < RUDP_BATCH; j++) {
+            ep->rx_iovs[j].iov_len = RUDP_MAX_DATAGRAM;
+            ep->rx_msgs[j].msg_hdr.msg_namelen = sizeof(ep->rx_addrs[j]);
+            ep->rx_msgs[j].msg_hdr.msg_flags = 0;
+        }
+        int n = recvmmsg(ep->fd, ep->rx_msgs, RUDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            perror("Receive failed");
+            return -1;
+        }
+        now = now_ns();
+        for (int j = 0; j < n; j++) {
+            if (!(ep->rx_msgs[j].msg_hdr.msg_flags & MSG_TRUNC)) {
+                on_datagram(ep, ep->rx_bufs[j], ep->rx_msgs[j].msg_len, &ep->rx_addrs[j], now);
+            }
+        }
+        if (n < RUDP_BATCH) {
+            break;
+        }
+    }
+
+    /* Timers, then whatever the connections may send now */
+    now = now_ns();
+    tw_advance(&ep->tw, now / 1000000);
+    for (struct rudp_conn *c = ep->conns; c; c = c->next) {
+        conn_flush(c, now);
+    }
+    ep_flush(ep);
+
+    if (ep->reap) {
+        struct rudp_conn *c = ep->conns;
+        while (c) {
+            struct rudp_conn *next = c->next;
+            if (c->state == CONN_CLOSED) {
+                conn_free(c);
+            }
+            c = next;
+        }
+        ep->reap = 0;
+    }
+    return 0;
+}
+
+/* Function to check whether a connection has nothing left to deliver */
+int rudp_idle(const struct rudp_conn *c) {
+    return c->unacked_msgs == 0 && !c->sendq;
+}
+
+/* Function to copy out a connection's counters and estimates */
+void rudp_conn_stats(const struct rudp_conn *c, struct rudp_stats *st) {
+    *st = c->stats;
+    st->srtt_ns = c->srtt;
+    st->rttvar_ns = c->rttvar;
+    st->min_rtt_ns = c->min_rtt;
+    st->cwnd = c->cwnd;
+    st->bytes_in_flight = c->bytes_in_flight;
+    st->pacing_rate = c->pacing_rate;
+    st->cc_state = c->cc->state(c);
+}
+
+/* Function to get a connection's peer */
+const struct sockaddr_in *rudp_peer(const struct rudp_conn *c) {
+    return &c->peer;
+}
+
+/* Functions to attach and fetch the caller's data */
+void rudp_set_context(struct rudp_conn *c, void *ctx) {
+    c->ctx = ctx;
+}
+
+void *rudp_context(const struct rudp_conn *c) {
+    return c->ctx;
+}
+
+/* Function to name a congestion controller */
+const char *rudp_cc_name(enum rudp_cc cc) {
+    return cc == RUDP_CC_BBR ? "BBR" : "CUBIC";
+}
@@ -0,0 +1,133 @@
+/* timer_wheel.c: Hashed timer wheel implementation (see include/timer_wheel.h).
+ * Timers further out than one revolution stay in their slot and are skipped until
+ * the wheel comes round to their expiry tick. */
+
+/* Include standard libraries for time and the wheel interface */
+#include <string.h>      /* For memset */
+#include <time.h>        /* For clock_gettime, CLOCK_MONOTONIC */
+#include "timer_wheel.h" /* For struct timer_wheel, struct tw_timer */
+
+/* Function to read the monotonic clock in milliseconds */
+uint64_t tw_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function to initialize an empty wheel */
+void tw_init(struct timer_wheel *tw, unsigned tick_ms) {
+    memset(tw, 0, sizeof(*tw));
+    for (int i = 0; i < TW_SLOTS; i++) {
+        tw->slots[i].next = &tw->slots[i]; /* Empty circular list */
+        tw->slots[i].prev = &tw->slots[i];
+    }
+    tw->tick_ms = tick_ms ? tick_ms : 1;
+    tw->base_ms = tw_now_ms();
+    tw->current = 0;
+}
+
+/* Function to initialize a timer (unarmed) */
+void tw_timer_init(struct tw_timer *timer, tw_callback cb, void *arg) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+/* Function to check whether a timer is armed */
+int tw_pending(const struct tw_timer *timer) {
+    return timer->next != NULL;
+}
+
+/* Function to unlink a timer from its slot */
+static void tw_unlink(struct timer_wheel *tw, struct tw_timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+    tw->pending--;
+}
+
+/* Function to disarm a timer */
+void tw_cancel(struct timer_wheel *tw, struct tw_timer *timer) {
+    if (tw_pending(timer)) {
+        tw_unlink(tw, timer);
+    }
+}
+
+/* Function to arm a timer delay_ms from now */
+void tw_add(struct timer_wheel *tw, struct tw_timer *timer, uint64_t delay_ms) {
+    tw_cancel(tw, timer);
+
+    /* Round up so a timer never fires early; always at least one tick out */
+    uint64_t now_tick = (tw_now_ms() - tw->base_ms) / tw->tick_ms;
+    uint64_t ticks = (delay_ms + tw->tick_ms - 1) / tw->tick_ms;
+    if (now_tick < tw->current) {
+        now_tick = tw->current;
+    }
+    timer->expires = now_tick + (ticks ? ticks : 1);
+
+    /* Insert at the tail of the expiry slot */
+    struct tw_timer *head = &tw->slots[timer->expires & (TW_SLOTS - 1)];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    tw->pending++;
+}
+
+/* Function to fire all timers whose expiry tick has passed */
+void tw_advance(struct timer_wheel *tw, uint64_t now_ms) {
+    uint64_t target = (now_ms - tw->base_ms) / tw->tick_ms;
+
+    /* Skip straight through idle periods longer than a full revolution */
+    if (tw->pending == 0) {
+        tw->current = target;
+        return;
+    }
+
+    while (tw->current < target) {
+        tw->current++;
+        struct tw_timer *head = &tw->slots[tw->current & (TW_SLOTS - 1)];
+
+        /* Detach due timers first so callbacks may re-arm or cancel freely */
+        struct tw_timer due;
+        due.next = due.prev = &due;
+        struct tw_timer *t = head->next;
+        while (t != head) {
+            struct tw_timer *next = t->next;
+            if (t->expires <= tw->current) {
+                t->prev->next = t->next;
+                t->next->prev = t->prev;
+                t->next = &due;
+                t->prev = due.prev;
+                due.prev->next = t;
+                due.prev = t;
+            }
+            t = next;
+        }
+
+        while (due.next != &due) {
+            t = due.next;
+            due.next = t->next;
+            t->next->prev = &due;
+            t->next = t->prev = NULL;
+            tw->pending--;
+            t->cb(t, t->arg);
+        }
+
+        if (tw->pending == 0) {
+            tw->current = target;
+            return;
+        }
+    }
+}
+
+/* Function to compute a poll timeout that wakes at the next tick */
+int tw_timeout_ms(const struct timer_wheel *tw, uint64_t now_ms) {
+    if (tw->pending == 0) {
+        return -1;
+    }
+    uint64_t elapsed = now_ms - tw->base_ms;
+    uint64_t next = (tw->current + 1) * tw->tick_ms;
+    return next > elapsed ? (int)(next - elapsed) : 0;
+}
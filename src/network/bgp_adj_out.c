@@ -0,0 +1,516 @@
+/* bgp_adj_out.c: Adj-RIB-Out, update groups and output queues for the BGP speaker
+ * (see include/bgp_adj_out.h). Encoding cost depends on the number of groups,
+ * not on the number of peers: members only add a pointer to their queue. */
+
+/* Include standard libraries and BGP definitions */
+#include <stddef.h>     /* For offsetof */
+#include <stdlib.h>     /* For malloc, realloc, free, qsort */
+#include <string.h>     /* For memcpy, memset */
+#include <errno.h>      /* For errno, EAGAIN, EINTR */
+#include <sys/uio.h>    /* For writev, struct iovec */
+#include "bgp.h"        /* For BGP_HEADER_LEN, BGP_MAX_MESSAGE, bgp_put16, bgp_get16 */
+#include "bgp_adj_out.h" /* For struct bgp_update_group, struct bgp_outq */
+
+#define OUTQ_MAX_IOV 64 /* Chunks handed to one writev */
+
+/* Function to allocate an empty chunk holding one reference */
+static struct bgp_out_chunk *bgp_out_chunk_new(size_t size) {
+    struct bgp_out_chunk *chunk = malloc(sizeof(*chunk) + size);
+    if (chunk) {
+        chunk->refcnt = 1;
+        chunk->len = 0;
+    }
+    return chunk;
+}
+
+/* Function to drop a chunk reference */
+void bgp_out_chunk_put(struct bgp_out_chunk *chunk) {
+    if (--chunk->refcnt == 0) {
+        free(chunk);
+    }
+}
+
+/* Function to prepare an empty queue */
+void bgp_outq_init(struct bgp_outq *q) {
+    q->chunks = NULL;
+    q->head = q->count = q->cap = 0;
+    q->off = 0;
+    q->bytes = 0;
+}
+
+/* Function to drop every queued chunk */
+void bgp_outq_clear(struct bgp_outq *q) {
+    for (size_t i = 0; i < q->count; i++) {
+        bgp_out_chunk_put(q->chunks[(q->head + i) & (q->cap - 1)]);
+    }
+    free(q->chunks);
+    bgp_outq_init(q);
+}
+
+/* Function to drop the messages the peer has not started to receive. The rest
+ * of a message already partly written is kept (copied out of a possibly shared
+ * chunk) so the byte stream stays framed. */
+int bgp_outq_trim(struct bgp_outq *q) {
+    struct bgp_out_chunk *tail = NULL;
+    if (q->count > 0 && q->off > 0) {
+        const struct bgp_out_chunk *head = q->chunks[q->head];
+        size_t end = 0;
+        while (end < q->off) {
+            end += bgp_get16(head->data + end + offsetof(struct bgp_header, length));
+        }
+        if (end > q->off) {
+            tail = bgp_out_chunk_new(end - q->off);
+            if (!tail) {
+                return -1;
+            }
+            memcpy(tail->data, head->data + q->off, end - q->off);
+            tail->len = end - q->off;
+        }
+    }
+    bgp_outq_clear(q);
+    if (tail) {
+        int rc = bgp_outq_push(q, tail);
+        bgp_out_chunk_put(tail);
+        return rc;
+    }
+    return 0;
+}
+
+/* Function to append a chunk to the queue */
+int bgp_outq_push(struct bgp_outq *q, struct bgp_out_chunk *chunk) {
+    if (q->count == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 16;
+        struct bgp_out_chunk **ring = malloc(cap * sizeof(*ring));
+        if (!ring) {
+            return -1;
+        }
+        for (size_t i = 0; i < q->count; i++) {
+            ring[i] = q->chunks[(q->head + i) & (q->cap - 1)];
+        }
+        free(q->chunks);
+        q->chunks = ring;
+        q->cap = cap;
+        q->head = 0;
+    }
+    chunk->refcnt++;
+    q->chunks[(q->head + q->count++) & (q->cap - 1)] = chunk;
+    q->bytes += chunk->len;
+    return 0;
+}
+
+/* Function to queue a private copy of a message */
+int bgp_outq_push_copy(struct bgp_outq *q, const void *data, size_t len) {
+    struct bgp_out_chunk *chunk = bgp_out_chunk_new(len);
+    if (!chunk) {
+        return -1;
+    }
+    memcpy(chunk->data, data, len);
+    chunk->len = len;
+    int rc = bgp_outq_push(q, chunk);
+    bgp_out_chunk_put(chunk);
+    return rc;
+}
+
+/* Function to write queued chunks until the socket would block */
+int bgp_outq_write(struct bgp_outq *q, int fd) {
+    while (q->count > 0) {
+        struct iovec iov[OUTQ_MAX_IOV];
+        int n = 0;
+        for (size_t i = 0; i < q->count && n < OUTQ_MAX_IOV; i++, n++) {
+            struct bgp_out_chunk *chunk = q->chunks[(q->head + i) & (q->cap - 1)];
+            size_t skip = i == 0 ? q->off : 0;
+            iov[n].iov_base = chunk->data + skip;
+            iov[n].iov_len = chunk->len - skip;
+        }
+        ssize_t sent = writev(fd, iov, n);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+        q->bytes -= sent;
+        /* Retire fully written chunks, remember how far into the next we got */
+        size_t left = sent + q->off;
+        while (q->count > 0) {
+            struct bgp_out_chunk *chunk = q->chunks[q->head];
+            if (left < chunk->len) {
+                break;
+            }
+            left -= chunk->len;
+            bgp_out_chunk_put(chunk);
+            q->head = (q->head + 1) & (q->cap - 1);
+            q->count--;
+        }
+        q->off = left;
+    }
+    return 0;
+}
+
+/* Function to prepare a group */
+void bgp_group_init(struct bgp_update_group *g, int ebgp, int as4, uint32_t local_as,
+                    uint32_t next_hop, struct bgp_attr_table *table) {
+    memset(g, 0, sizeof(*g));
+    g->ebgp = ebgp;
+    g->as4 = as4;
+    g->local_as = local_as;
+    g->next_hop = next_hop;
+    g->table = table;
+    ptrie_init(&g->out);
+}
+
+/* Walk callback: release the outbound set held for one prefix */
+static int bgp_group_release(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    bgp_attr_unref(arg, data);
+    return 0;
+}
+
+/* Function to free a group's state */
+void bgp_group_destroy(struct bgp_update_group *g) {
+    ptrie_walk(&g->out, bgp_group_release, g->table);
+    ptrie_destroy(&g->out, NULL);
+    free(g->pending);
+    free(g->members);
+    free(g->joiners);
+    g->pending = NULL;
+    g->members = g->joiners = NULL;
+    g->num_pending = g->num_members = g->num_joiners = 0;
+}
+
+/* Function to apply outbound policy to a path: eBGP gets our AS prepended, our
+ * next hop, and no MED or LOCAL_PREF; iBGP gets the path as is with LOCAL_PREF
+ * filled in. Returns the interned result with a reference, or NULL. */
+static const struct bgp_attrs *bgp_group_export(struct bgp_update_group *g,
+                                                const struct bgp_attrs *a) {
+    union {
+        struct bgp_attrs attrs;
+        uint8_t raw[BGP_ATTRS_MAX + 8];
+    } scratch;
+
+    if (!g->ebgp) {
+        if (a->flags & BGP_ATTRF_LOCAL_PREF) {
+            bgp_attr_ref(a);
+            return a;
+        }
+        memcpy(&scratch, a, bgp_attrs_size(a));
+        scratch.attrs.local_pref = BGP_DEFAULT_LOCAL_PREF;
+        scratch.attrs.flags |= BGP_ATTRF_LOCAL_PREF;
+        return bgp_attr_intern(g->table, &scratch.attrs);
+    }
+    if (bgp_attrs_prepend(a, g->local_as, &scratch.attrs, sizeof(scratch)) < 0) {
+        return NULL;
+    }
+    scratch.attrs.next_hop = g->next_hop;
+    scratch.attrs.med = 0;
+    scratch.attrs.local_pref = 0;
+    scratch.attrs.flags &= ~(BGP_ATTRF_MED | BGP_ATTRF_LOCAL_PREF);
+    return bgp_attr_intern(g->table, &scratch.attrs);
+}
+
+/* Function to update the Adj-RIB-Out entry of one destination */
+int bgp_group_route(struct bgp_update_group *g, const struct bgp_dest *dest) {
+    const struct bgp_path *best = dest->best;
+    const struct bgp_attrs *want = NULL;
+
+    /* Routes learned over iBGP are not passed on to iBGP peers (full mesh) */
+    if (best && (g->ebgp || best->peer->ebgp)) {
+        want = bgp_group_export(g, best->attrs);
+        if (!want) {
+            return -1;
+        }
+    }
+
+    const struct bgp_attrs *have = ptrie_lookup(&g->out, dest->prefix, dest->plen);
+    if (have == want) {
+        if (want) {
+            bgp_attr_unref(g->table, want);
+        }
+        return 0; /* Nothing the members can see changed */
+    }
+    if (want) {
+        void **slot = ptrie_insert(&g->out, dest->prefix, dest->plen);
+        if (!slot) {
+            bgp_attr_unref(g->table, want);
+            return -1;
+        }
+        *slot = (void *)want;
+    } else {
+        ptrie_remove(&g->out, dest->prefix, dest->plen);
+    }
+    if (have) {
+        bgp_attr_unref(g->table, have);
+    }
+
+    /* Members only need to hear about it if there are any; joiners get the
+     * table as it stands at flush time */
+    if (g->num_members == 0) {
+        return 0;
+    }
+    if (g->num_pending == g->cap_pending) {
+        size_t cap = g->cap_pending ? g->cap_pending * 2 : 1024;
+        struct bgp_out_pending *grown = realloc(g->pending, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        g->pending = grown;
+        g->cap_pending = cap;
+    }
+    g->pending[g->num_pending].prefix = dest->prefix;
+    g->pending[g->num_pending].plen = dest->plen;
+    g->num_pending++;
+    return 0;
+}
+
+/* Function to add a queue to one of the member lists */
+static int bgp_group_add(struct bgp_update_group *g, struct bgp_outq ***list, size_t *count,
+                         struct bgp_outq *q) {
+    if (g->num_members + g->num_joiners == g->cap_members) {
+        size_t cap = g->cap_members ? g->cap_members * 2 : 16;
+        struct bgp_outq **members = realloc(g->members, cap * sizeof(*members));
+        if (!members) {
+            return -1;
+        }
+        g->members = members;
+        struct bgp_outq **joiners = realloc(g->joiners, cap * sizeof(*joiners));
+        if (!joiners) {
+            return -1;
+        }
+        g->joiners = joiners;
+        g->cap_members = cap;
+    }
+    (*list)[(*count)++] = q;
+    return 0;
+}
+
+/* Function to add a member that still needs the full table */
+int bgp_group_join(struct bgp_update_group *g, struct bgp_outq *q) {
+    return bgp_group_add(g, &g->joiners, &g->num_joiners, q);
+}
+
+/* Function to remove a queue from a member list, if present */
+static void bgp_group_remove(struct bgp_outq **list, size_t *count, struct bgp_outq *q) {
+    for (size_t i = 0; i < *count; i++) {
+        if (list[i] == q) {
+            list[i] = list[--*count];
+            return;
+        }
+    }
+}
+
+/* Function to remove a member */
+void bgp_group_leave(struct bgp_update_group *g, struct bgp_outq *q) {
+    bgp_group_remove(g->members, &g->num_members, q);
+    bgp_group_remove(g->joiners, &g->num_joiners, q);
+    if (g->num_members == 0) {
+        g->num_pending = 0;
+    }
+}
+
+/* Function to check for flush work */
+int bgp_group_busy(const struct bgp_update_group *g) {
+    return (g->num_pending > 0 && g->num_members > 0) || g->num_joiners > 0;
+}
+
+/* One route to encode: its outbound set (NULL = withdraw) and prefix */
+struct bgp_out_entry {
+    const struct bgp_attrs *attrs;
+    uint32_t prefix;
+    uint8_t plen;
+};
+
+/* qsort comparator: withdrawals first, then grouped by set, then by prefix */
+static int bgp_out_entry_cmp(const void *x, const void *y) {
+    const struct bgp_out_entry *a = x, *b = y;
+    if (a->attrs != b->attrs) {
+        return (uintptr_t)a->attrs < (uintptr_t)b->attrs ? -1 : 1;
+    }
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    return (int)a->plen - (int)b->plen;
+}
+
+/* State of one encoding pass */
+struct bgp_encoder {
+    struct bgp_update_group *g;  /* Group being flushed */
+    struct bgp_outq **targets;   /* Queues that receive the chunks */
+    size_t num_targets;          /* Entries in targets[] */
+    struct bgp_out_chunk *chunk; /* Chunk being filled */
+    int failed;                  /* Set if a queue or chunk allocation failed */
+};
+
+/* Function to hand the current chunk to every target */
+static void bgp_encoder_ship(struct bgp_encoder *enc) {
+    if (!enc->chunk) {
+        return;
+    }
+    if (enc->chunk->len > 0) {
+        for (size_t i = 0; i < enc->num_targets; i++) {
+            if (bgp_outq_push(enc->targets[i], enc->chunk) < 0) {
+                enc->failed = 1;
+            }
+        }
+    }
+    bgp_out_chunk_put(enc->chunk);
+    enc->chunk = NULL;
+}
+
+/* Function to get room for one more message; returns where it goes or NULL */
+static uint8_t *bgp_encoder_room(struct bgp_encoder *enc) {
+    if (enc->chunk && enc->chunk->len + BGP_MAX_MESSAGE > BGP_OUT_CHUNK_SIZE) {
+        bgp_encoder_ship(enc);
+    }
+    if (!enc->chunk) {
+        enc->chunk = bgp_out_chunk_new(BGP_OUT_CHUNK_SIZE);
+        if (!enc->chunk) {
+            enc->failed = 1;
+            return NULL;
+        }
+    }
+    return enc->chunk->data + enc->chunk->len;
+}
+
+/* Function to close a message started by bgp_encoder_room */
+static void bgp_encoder_commit(struct bgp_encoder *enc, uint8_t *msg, size_t len) {
+    memset(msg, 0xFF, 16);
+    bgp_put16(msg + 16, len);
+    msg[18] = BGP_UPDATE;
+    enc->chunk->len += len;
+    enc->g->updates++;
+    enc->g->bytes += len;
+}
+
+/* Function to append one prefix in NLRI encoding; returns bytes written */
+static size_t bgp_put_prefix(uint8_t *p, uint32_t prefix, uint8_t plen) {
+    int bytes = (plen + 7) / 8;
+    p[0] = plen;
+    for (int i = 0; i < bytes; i++) {
+        p[1 + i] = prefix >> (24 - 8 * i);
+    }
+    return 1 + bytes;
+}
+
+/* Function to encode sorted entries into packed UPDATEs */
+static void bgp_encode_entries(struct bgp_encoder *enc, const struct bgp_out_entry *e, size_t n) {
+    struct bgp_update_group *g = enc->g;
+    uint8_t attrs[BGP_MAX_MESSAGE];
+    size_t i = 0;
+
+    /* Withdrawals: Withdrawn Routes only, as many as fit */
+    while (i < n && !e[i].attrs) {
+        uint8_t *msg = bgp_encoder_room(enc);
+        if (!msg) {
+            return;
+        }
+        size_t len = BGP_HEADER_LEN + 2;
+        while (i < n && !e[i].attrs && len + 5 + 2 <= BGP_MAX_MESSAGE) {
+            len += bgp_put_prefix(msg + len, e[i].prefix, e[i].plen);
+            g->withdrawn++;
+            i++;
+        }
+        bgp_put16(msg + BGP_HEADER_LEN, len - BGP_HEADER_LEN - 2);
+        bgp_put16(msg + len, 0); /* No path attributes */
+        bgp_encoder_commit(enc, msg, len + 2);
+    }
+
+    /* Announcements: encode each set once, then fill UPDATEs with its prefixes. The
+     * interned sets are width-neutral (AS_PATH and AGGREGATOR hold 4-octet ASes);
+     * bgp_attrs_encode writes them for the group's AS width, AS_TRANS plus AS4_PATH
+     * and AS4_AGGREGATOR for 2-octet members, so chunks never cross widths. */
+    while (i < n) {
+        const struct bgp_attrs *set = e[i].attrs;
+        int alen = bgp_attrs_encode(set, g->as4, attrs, sizeof(attrs));
+        if (alen < 0 || BGP_HEADER_LEN + 4 + alen + 5 > BGP_MAX_MESSAGE) {
+            while (i < n && e[i].attrs == set) {
+                i++; /* Cannot be sent in a single message; skip the set */
+            }
+            continue;
+        }
+        while (i < n && e[i].attrs == set) {
+            uint8_t *msg = bgp_encoder_room(enc);
+            if (!msg) {
+                return;
+            }
+            size_t len = BGP_HEADER_LEN;
+            bgp_put16(msg + len, 0); /* No withdrawn routes */
+            bgp_put16(msg + len + 2, alen);
+            memcpy(msg + len + 4, attrs, alen);
+            len += 4 + alen;
+            while (i < n && e[i].attrs == set && len + 5 <= BGP_MAX_MESSAGE) {
+                len += bgp_put_prefix(msg + len, e[i].prefix, e[i].plen);
+                g->nlri++;
+                i++;
+            }
+            bgp_encoder_commit(enc, msg, len);
+        }
+    }
+}
+
+/* Function to sort, de-duplicate and encode entries for a set of queues */
+static int bgp_group_send(struct bgp_update_group *g, struct bgp_out_entry *e, size_t n,
+                          struct bgp_outq **targets, size_t num_targets) {
+    qsort(e, n, sizeof(*e), bgp_out_entry_cmp);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m == 0 || e[i].prefix != e[m - 1].prefix || e[i].plen != e[m - 1].plen) {
+            e[m++] = e[i];
+        }
+    }
+    struct bgp_encoder enc = { .g = g, .targets = targets, .num_targets = num_targets };
+    bgp_encode_entries(&enc, e, m);
+    bgp_encoder_ship(&enc);
+    g->passes++;
+    return enc.failed ? -1 : 0;
+}
+
+/* Walk state used to snapshot the Adj-RIB-Out for joiners */
+struct bgp_out_snapshot {
+    struct bgp_out_entry *entries;
+    size_t count;
+};
+
+/* Walk callback: record one advertised prefix */
+static int bgp_group_collect(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    struct bgp_out_snapshot *snap = arg;
+    struct bgp_out_entry *e = &snap->entries[snap->count++];
+    e->attrs = data;
+    e->prefix = prefix;
+    e->plen = plen;
+    return 0;
+}
+
+/* Function to flush pending changes and bring joiners up to date */
+int bgp_group_flush(struct bgp_update_group *g) {
+    int rc = 0;
+
+    if (g->num_pending > 0 && g->num_members > 0) {
+        struct bgp_out_entry *e = malloc(g->num_pending * sizeof(*e));
+        if (!e) {
+            return -1;
+        }
+        for (size_t i = 0; i < g->num_pending; i++) {
+            e[i].prefix = g->pending[i].prefix;
+            e[i].plen = g->pending[i].plen;
+            e[i].attrs = ptrie_lookup(&g->out, e[i].prefix, e[i].plen);
+        }
+        rc |= bgp_group_send(g, e, g->num_pending, g->members, g->num_members);
+        free(e);
+    }
+    g->num_pending = 0;
+
+    if (g->num_joiners > 0) {
+        struct bgp_out_snapshot snap = { malloc((g->out.count + 1) * sizeof(*snap.entries)), 0 };
+        if (!snap.entries) {
+            return -1;
+        }
+        ptrie_walk(&g->out, bgp_group_collect, &snap);
+        rc |= bgp_group_send(g, snap.entries, snap.count, g->joiners, g->num_joiners);
+        free(snap.entries);
+        memcpy(g->members + g->num_members, g->joiners, g->num_joiners * sizeof(*g->joiners));
+        g->num_members += g->num_joiners;
+        g->num_joiners = 0;
+    }
+    return rc;
+}
@@ -0,0 +1,624 @@
+/* bgp_attr.c: Path attribute decoding for the BGP speaker (see include/bgp_attr.h).
+ * One pass over the attribute section validates every attribute and records where
+ * the variable-length ones are; the blob is then assembled in canonical order so
+ * identical attribute sets always produce identical bytes. */
+
+/* Include standard libraries and BGP definitions */
+#include <stdlib.h>     /* For malloc, free */
+#include <string.h>     /* For memcpy, memcmp */
+#include "bgp.h"        /* For bgp_get16, bgp_get32, bgp_put32 */
+#include "bgp_attr.h"   /* For struct bgp_attrs, struct bgp_attr_table */
+
+/* Function to normalize an AS_PATH (2- or 4-octet ASes) into 4-octet segments.
+ * Returns the number of bytes written, or -1 if the path is malformed or
+ * does not fit. *hops receives the path length for route selection. */
+static int bgp_normalize_as_path(const uint8_t *p, size_t len, int as_size,
+                                 uint8_t *out, size_t out_size, uint16_t *hops) {
+    size_t in = 0, w = 0;
+    *hops = 0;
+    while (in < len) {
+        if (len - in < 2) {
+            return -1;
+        }
+        uint8_t type = p[in];
+        uint8_t count = p[in + 1];
+        if (type < BGP_AS_SET || type > BGP_AS_CONFED_SET || count == 0 ||
+            len - in - 2 < (size_t)count * as_size) {
+            return -1;
+        }
+        if (w + 2 + (size_t)count * 4 > out_size) {
+            return -1;
+        }
+        out[w++] = type;
+        out[w++] = count;
+        for (int i = 0; i < count; i++) {
+            const uint8_t *as = p + in + 2 + i * as_size;
+            bgp_put32(out + w, as_size == 4 ? bgp_get32(as) : bgp_get16(as));
+            w += 4;
+        }
+        if (type == BGP_AS_SEQUENCE) {
+            *hops += count;
+        } else if (type == BGP_AS_SET) {
+            *hops += 1; /* An AS_SET counts as one hop */
+        }
+        in += 2 + (size_t)count * as_size;
+    }
+    return (int)w;
+}
+
+/* Function to rebuild a path from AS_PATH and AS4_PATH (RFC 6793 section 4.2.3):
+ * keep the leading hops of AS_PATH that AS4_PATH does not cover, then append
+ * AS4_PATH. Both inputs are normalized. Returns bytes written or -1. */
+static int bgp_merge_as4_path(const uint8_t *as_path, size_t as_len, uint16_t as_hops,
+                              const uint8_t *as4_path, size_t as4_len, uint16_t as4_hops,
+                              uint8_t *out, size_t out_size, uint16_t *hops) {
+    size_t in = 0, w = 0;
+    int keep = as_hops - as4_hops;
+    while (in < as_len && keep > 0) {
+        uint8_t type = as_path[in];
+        uint8_t count = as_path[in + 1];
+        uint8_t take = count;
+        if (type == BGP_AS_SEQUENCE) {
+            take = count < keep ? count : keep;
+            keep -= take;
+        } else if (type == BGP_AS_SET) {
+            keep -= 1;
+        }
+        if (w + 2 + (size_t)take * 4 > out_size) {
+            return -1;
+        }
+        out[w++] = type;
+        out[w++] = take;
+        memcpy(out + w, as_path + in + 2, (size_t)take * 4);
+        w += (size_t)take * 4;
+        in += 2 + (size_t)count * 4;
+    }
+    if (w + as4_len > out_size) {
+        return -1;
+    }
+    memcpy(out + w, as4_path, as4_len);
+    *hops = as_hops;
+    return (int)(w + as4_len);
+}
+
+/* Function to decode a path attribute section */
+int bgp_attrs_parse(const uint8_t *p, size_t len, int as4, struct bgp_attrs *out,
+                    size_t out_size, uint8_t *err_subcode) {
+    const uint8_t *as_path = NULL, *as4_path = NULL, *communities = NULL;
+    const uint8_t *as4_aggregator = NULL;
+    size_t as_path_len = 0, as4_path_len = 0, communities_len = 0;
+    uint8_t other[4096];
+    size_t other_len = 0;
+    uint32_t seen[8] = { 0 }; /* Bitmap of attribute types already decoded */
+
+    memset(out, 0, sizeof(*out));
+
+    size_t off = 0;
+    while (off < len) {
+        /* Attribute header: flags, type, 1- or 2-octet length */
+        if (len - off < 3) {
+            *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+            return -1;
+        }
+        uint8_t flags = p[off];
+        uint8_t type = p[off + 1];
+        size_t hdr_len = (flags & BGP_ATTR_FLAG_EXTENDED) ? 4 : 3;
+        if (len - off < hdr_len) {
+            *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+            return -1;
+        }
+        size_t alen = hdr_len == 4 ? bgp_get16(p + off + 2) : p[off + 2];
+        if (len - off - hdr_len < alen) {
+            *err_subcode = BGP_ERR_UPD_LENGTH;
+            return -1;
+        }
+        const uint8_t *val = p + off + hdr_len;
+
+        /* Each attribute may appear at most once */
+        if (seen[type / 32] & (1u << (type % 32))) {
+            *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+            return -1;
+        }
+        seen[type / 32] |= 1u << (type % 32);
+
+        /* Well-known attributes must be marked well-known transitive */
+        int well_known = type >= BGP_ATTR_ORIGIN && type <= BGP_ATTR_ATOMIC_AGGREGATE &&
+                         type != BGP_ATTR_MED;
+        if (well_known && (flags & (BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE)) !=
+                          BGP_ATTR_FLAG_TRANSITIVE) {
+            *err_subcode = BGP_ERR_UPD_FLAGS;
+            return -1;
+        }
+
+        switch (type) {
+        case BGP_ATTR_ORIGIN:
+            if (alen != 1) {
+                *err_subcode = BGP_ERR_UPD_LENGTH;
+                return -1;
+            }
+            if (val[0] > 2) {
+                *err_subcode = BGP_ERR_UPD_ORIGIN;
+                return -1;
+            }
+            out->origin = val[0];
+            out->flags |= BGP_ATTRF_ORIGIN;
+            break;
+        case BGP_ATTR_AS_PATH:
+            as_path = val;
+            as_path_len = alen;
+            out->flags |= BGP_ATTRF_AS_PATH;
+            break;
+        case BGP_ATTR_NEXT_HOP:
+            if (alen != 4) {
+                *err_subcode = BGP_ERR_UPD_LENGTH;
+                return -1;
+            }
+            out->next_hop = bgp_get32(val);
+            /* Reject unspecified, broadcast and multicast next hops */
+            if (out->next_hop == 0 || out->next_hop == 0xFFFFFFFF ||
+                (out->next_hop >> 28) == 0xE) {
+                *err_subcode = BGP_ERR_UPD_NEXT_HOP;
+                return -1;
+            }
+            out->flags |= BGP_ATTRF_NEXT_HOP;
+            break;
+        case BGP_ATTR_MED:
+            if (alen != 4) {
+                *err_subcode = BGP_ERR_UPD_LENGTH;
+                return -1;
+            }
+            out->med = bgp_get32(val);
+            out->flags |= BGP_ATTRF_MED;
+            break;
+        case BGP_ATTR_LOCAL_PREF:
+            if (alen != 4) {
+                *err_subcode = BGP_ERR_UPD_LENGTH;
+                return -1;
+            }
+            out->local_pref = bgp_get32(val);
+            out->flags |= BGP_ATTRF_LOCAL_PREF;
+            break;
+        case BGP_ATTR_ATOMIC_AGGREGATE:
+            if (alen != 0) {
+                *err_subcode = BGP_ERR_UPD_LENGTH;
+                return -1;
+            }
+            out->flags |= BGP_ATTRF_ATOMIC_AGGREGATE;
+            break;
+        case BGP_ATTR_COMMUNITIES:
+            if (alen % 4 != 0) {
+                *err_subcode = BGP_ERR_UPD_OPTIONAL;
+                return -1;
+            }
+            communities = val;
+            communities_len = alen;
+            break;
+        case BGP_ATTR_AS4_PATH:
+            as4_path = val;
+            as4_path_len = alen;
+            break;
+        case BGP_ATTR_AGGREGATOR:
+            if (!(flags & BGP_ATTR_FLAG_OPTIONAL)) {
+                *err_subcode = BGP_ERR_UPD_FLAGS;
+                return -1;
+            }
+            /* AS and BGP Identifier; one of the wrong length is discarded (RFC 7606) */
+            if (alen == (as4 ? 8u : 6u)) {
+                out->aggregator_as = as4 ? bgp_get32(val) : bgp_get16(val);
+                out->aggregator_id = bgp_get32(val + (as4 ? 4 : 2));
+                out->flags |= BGP_ATTRF_AGGREGATOR;
+            }
+            break;
+        case BGP_ATTR_AS4_AGGREGATOR:
+            if (!(flags & BGP_ATTR_FLAG_OPTIONAL)) {
+                *err_subcode = BGP_ERR_UPD_FLAGS;
+                return -1;
+            }
+            if (alen == 8) {
+                as4_aggregator = val;
+            }
+            break;
+        default:
+            if (!(flags & BGP_ATTR_FLAG_OPTIONAL)) {
+                *err_subcode = BGP_ERR_UPD_UNRECOGNIZED;
+                return -1;
+            }
+            /* Optional non-transitive attributes we do not use are dropped */
+            if (!(flags & BGP_ATTR_FLAG_TRANSITIVE)) {
+                break;
+            }
+            if (other_len + hdr_len + alen > sizeof(other)) {
+                *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+                return -1;
+            }
+            memcpy(other + other_len, p + off, hdr_len + alen);
+            /* Unrecognized transitive attributes are passed on marked Partial */
+            other[other_len] |= BGP_ATTR_FLAG_PARTIAL;
+            other_len += hdr_len + alen;
+            break;
+        }
+        off += hdr_len + alen;
+    }
+
+    /* A 2-octet session carries a large aggregating AS as AS_TRANS in AGGREGATOR
+     * and the real one in AS4_AGGREGATOR (RFC 6793 section 4.2.3); a 4-octet
+     * session never needs it */
+    if (as4_aggregator && !as4 && (out->flags & BGP_ATTRF_AGGREGATOR) &&
+        out->aggregator_as == BGP_AS_TRANS) {
+        out->aggregator_as = bgp_get32(as4_aggregator);
+        out->aggregator_id = bgp_get32(as4_aggregator + 4);
+    }
+
+    /* Assemble the variable-length tail: AS_PATH, communities, others */
+    size_t room = out_size - sizeof(*out);
+    if (as_path) {
+        int w = bgp_normalize_as_path(as_path, as_path_len, as4 ? 4 : 2,
+                                      out->data, room, &out->as_path_hops);
+        if (w < 0) {
+            *err_subcode = BGP_ERR_UPD_AS_PATH;
+            return -1;
+        }
+        out->as_path_len = w;
+
+        /* Only a 2-octet session needs AS4_PATH to recover the real ASes */
+        if (as4_path && !as4) {
+            uint8_t norm_as4[4096], merged[8192];
+            uint16_t as4_hops;
+            int n4 = bgp_normalize_as_path(as4_path, as4_path_len, 4, norm_as4,
+                                           sizeof(norm_as4), &as4_hops);
+            if (n4 >= 0 && as4_hops <= out->as_path_hops) {
+                int m = bgp_merge_as4_path(out->data, out->as_path_len, out->as_path_hops,
+                                           norm_as4, n4, as4_hops, merged, sizeof(merged),
+                                           &out->as_path_hops);
+                if (m >= 0 && (size_t)m <= room) {
+                    memcpy(out->data, merged, m);
+                    out->as_path_len = m;
+                }
+            }
+        }
+    }
+    if (out->as_path_len + communities_len + other_len > room) {
+        *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+        return -1;
+    }
+    if (communities_len > 0) {
+        memcpy(out->data + out->as_path_len, communities, communities_len);
+    }
+    out->communities = communities_len / 4;
+    if (other_len > 0) {
+        memcpy(out->data + out->as_path_len + communities_len, other, other_len);
+    }
+    out->other_len = other_len;
+    return 0;
+}
+
+/* Function to find the neighbor AS (first AS of a leading AS_SEQUENCE) */
+uint32_t bgp_attrs_neighbor_as(const struct bgp_attrs *a) {
+    if (a->as_path_len < 6 || a->data[0] != BGP_AS_SEQUENCE) {
+        return 0;
+    }
+    return bgp_get32(a->data + 2);
+}
+
+/* Function to find the origin AS (last AS of a trailing AS_SEQUENCE) */
+uint32_t bgp_attrs_origin_as(const struct bgp_attrs *a) {
+    size_t in = 0;
+    size_t last = a->as_path_len;
+    while (in < a->as_path_len) {
+        last = in;
+        in += 2 + (size_t)a->data[in + 1] * 4;
+    }
+    if (last == a->as_path_len || a->data[last] != BGP_AS_SEQUENCE || a->data[last + 1] == 0) {
+        return 0; /* Empty path or an aggregate ending in an AS_SET */
+    }
+    return bgp_get32(a->data + last + 2 + (a->data[last + 1] - 1) * 4);
+}
+
+/* Function to look for an AS anywhere in the path */
+int bgp_attrs_has_as(const struct bgp_attrs *a, uint32_t as) {
+    size_t in = 0;
+    while (in < a->as_path_len) {
+        uint8_t count = a->data[in + 1];
+        for (int i = 0; i < count; i++) {
+            if (bgp_get32(a->data + in + 2 + i * 4) == as) {
+                return 1;
+            }
+        }
+        in += 2 + (size_t)count * 4;
+    }
+    return 0;
+}
+
+/* Function to copy a set with one more AS at the front of the path */
+int bgp_attrs_prepend(const struct bgp_attrs *a, uint32_t as, struct bgp_attrs *out,
+                      size_t out_size) {
+    size_t tail = bgp_attrs_size(a) - offsetof(struct bgp_attrs, data);
+    if (offsetof(struct bgp_attrs, data) + tail + 6 > out_size) {
+        return -1;
+    }
+    memcpy(out, a, offsetof(struct bgp_attrs, data));
+    size_t w = 0, in = 0;
+    if (a->as_path_len > 0 && a->data[0] == BGP_AS_SEQUENCE && a->data[1] < 255) {
+        /* Room in the leading sequence: grow it by one */
+        out->data[0] = BGP_AS_SEQUENCE;
+        out->data[1] = a->data[1] + 1;
+        in = 2;
+    } else {
+        out->data[0] = BGP_AS_SEQUENCE;
+        out->data[1] = 1;
+    }
+    w = 2;
+    bgp_put32(out->data + w, as);
+    w += 4;
+    memcpy(out->data + w, a->data + in, tail - in);
+    out->as_path_len = a->as_path_len + w - in;
+    out->as_path_hops = a->as_path_hops + 1;
+    out->flags |= BGP_ATTRF_AS_PATH;
+    return 0;
+}
+
+/* Function to write one attribute header; returns its length */
+static size_t bgp_attr_header(uint8_t *p, uint8_t flags, uint8_t type, size_t len) {
+    if (len > 255) {
+        p[0] = flags | BGP_ATTR_FLAG_EXTENDED;
+        p[1] = type;
+        bgp_put16(p + 2, len);
+        return 4;
+    }
+    p[0] = flags;
+    p[1] = type;
+    p[2] = len;
+    return 3;
+}
+
+/* Function to write AS_PATH segments with 2- or 4-octet AS numbers. With 2-octet
+ * numbers, ASes above 65535 become AS_TRANS and *wide is set. */
+static size_t bgp_put_as_path(uint8_t *out, const struct bgp_attrs *a, int as_size, int *wide) {
+    size_t in = 0, w = 0;
+    while (in < a->as_path_len) {
+        uint8_t count = a->data[in + 1];
+        out[w++] = a->data[in];
+        out[w++] = count;
+        for (int i = 0; i < count; i++) {
+            uint32_t as = bgp_get32(a->data + in + 2 + i * 4);
+            if (as_size == 4) {
+                bgp_put32(out + w, as);
+            } else {
+                if (as > 0xFFFF) {
+                    as = BGP_AS_TRANS;
+                    *wide = 1;
+                }
+                bgp_put16(out + w, as);
+            }
+            w += as_size;
+        }
+        in += 2 + (size_t)count * 4;
+    }
+    return w;
+}
+
+/* Function to compute the wire length of the AS_PATH with as_size-octet ASes */
+static size_t bgp_as_path_wire_len(const struct bgp_attrs *a, int as_size) {
+    size_t in = 0, segments = 0;
+    while (in < a->as_path_len) {
+        segments++;
+        in += 2 + (size_t)a->data[in + 1] * 4;
+    }
+    return segments * 2 + (a->as_path_len - segments * 2) / 4 * as_size;
+}
+
+/* Function to encode an attribute set back to wire format */
+int bgp_attrs_encode(const struct bgp_attrs *a, int as4, uint8_t *out, size_t size) {
+    const uint8_t *other = bgp_attrs_other(a);
+    int wide = 0;
+    size_t w = 0;
+
+    if (size < bgp_attrs_encode_bound(a)) {
+        return -1;
+    }
+    if (a->flags & BGP_ATTRF_ORIGIN) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_ORIGIN, 1);
+        out[w++] = a->origin;
+    }
+    w += bgp_attr_header(out + w, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_AS_PATH,
+                         bgp_as_path_wire_len(a, as4 ? 4 : 2));
+    w += bgp_put_as_path(out + w, a, as4 ? 4 : 2, &wide);
+    if (a->flags & BGP_ATTRF_NEXT_HOP) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_NEXT_HOP, 4);
+        bgp_put32(out + w, a->next_hop);
+        w += 4;
+    }
+    if (a->flags & BGP_ATTRF_MED) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_OPTIONAL, BGP_ATTR_MED, 4);
+        bgp_put32(out + w, a->med);
+        w += 4;
+    }
+    if (a->flags & BGP_ATTRF_LOCAL_PREF) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_LOCAL_PREF, 4);
+        bgp_put32(out + w, a->local_pref);
+        w += 4;
+    }
+    if (a->flags & BGP_ATTRF_ATOMIC_AGGREGATE) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_TRANSITIVE, BGP_ATTR_ATOMIC_AGGREGATE, 0);
+    }
+    if (a->flags & BGP_ATTRF_AGGREGATOR) {
+        /* 8 bytes to a 4-octet peer; 6 to a 2-octet one, with AS_TRANS if too large */
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE,
+                             BGP_ATTR_AGGREGATOR, as4 ? 8 : 6);
+        if (as4) {
+            bgp_put32(out + w, a->aggregator_as);
+            w += 4;
+        } else {
+            bgp_put16(out + w, a->aggregator_as > 0xFFFF ? BGP_AS_TRANS : a->aggregator_as);
+            w += 2;
+        }
+        bgp_put32(out + w, a->aggregator_id);
+        w += 4;
+    }
+    if (a->communities) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE,
+                             BGP_ATTR_COMMUNITIES, 4 * (size_t)a->communities);
+        memcpy(out + w, bgp_attrs_communities(a), 4 * (size_t)a->communities);
+        w += 4 * (size_t)a->communities;
+    }
+    if (wide) {
+        /* A 2-octet peer needs AS4_PATH to see the real path */
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE,
+                             BGP_ATTR_AS4_PATH, a->as_path_len);
+        w += bgp_put_as_path(out + w, a, 4, &wide);
+    }
+    if (!as4 && (a->flags & BGP_ATTRF_AGGREGATOR) && a->aggregator_as > 0xFFFF) {
+        w += bgp_attr_header(out + w, BGP_ATTR_FLAG_OPTIONAL | BGP_ATTR_FLAG_TRANSITIVE,
+                             BGP_ATTR_AS4_AGGREGATOR, 8);
+        bgp_put32(out + w, a->aggregator_as);
+        bgp_put32(out + w + 4, a->aggregator_id);
+        w += 8;
+    }
+    memcpy(out + w, other, a->other_len);
+    w += a->other_len;
+    return (int)w;
+}
+
+/* Initial bucket count of the intern table */
+#define ATTR_TABLE_MIN_BUCKETS 1024
+
+/* Blob of an interned entry */
+static inline struct bgp_attrs *entry_attrs(struct bgp_attr_entry *e) {
+    return (struct bgp_attrs *)(e + 1);
+}
+
+/* Entry of an interned blob */
+static inline struct bgp_attr_entry *attrs_entry(const struct bgp_attrs *a) {
+    return (struct bgp_attr_entry *)a - 1;
+}
+
+/* Function to hash a blob, eight bytes per step (multiply-xorshift mixing) */
+static uint64_t bgp_attrs_hash(const struct bgp_attrs *a, size_t size) {
+    const uint8_t *p = (const uint8_t *)a;
+    uint64_t h = 0xcbf29ce484222325ULL ^ size;
+    uint64_t w;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    w = 0;
+    memcpy(&w, p + i, size - i);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+/* Function to initialize an empty intern table */
+void bgp_attr_table_init(struct bgp_attr_table *t) {
+    t->num_buckets = ATTR_TABLE_MIN_BUCKETS;
+    t->buckets = calloc(t->num_buckets, sizeof(*t->buckets));
+    t->count = 0;
+    t->bytes = 0;
+    t->lookups = 0;
+    t->hits = 0;
+}
+
+/* Function to free every interned set */
+void bgp_attr_table_destroy(struct bgp_attr_table *t) {
+    for (size_t i = 0; i < t->num_buckets; i++) {
+        struct bgp_attr_entry *e = t->buckets[i];
+        while (e) {
+            struct bgp_attr_entry *next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(t->buckets);
+    t->buckets = NULL;
+    t->num_buckets = t->count = t->bytes = 0;
+}
+
+/* Function to double the bucket array once the load factor reaches 1 */
+static void bgp_attr_table_grow(struct bgp_attr_table *t) {
+    size_t n = t->num_buckets * 2;
+    struct bgp_attr_entry **buckets = calloc(n, sizeof(*buckets));
+    if (!buckets) {
+        return; /* Keep working with longer chains */
+    }
+    for (size_t i = 0; i < t->num_buckets; i++) {
+        struct bgp_attr_entry *e = t->buckets[i];
+        while (e) {
+            struct bgp_attr_entry *next = e->next;
+            size_t b = e->hash & (n - 1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(t->buckets);
+    t->buckets = buckets;
+    t->num_buckets = n;
+}
+
+/* Function to find or insert the shared copy of a blob whose hash is known */
+static const struct bgp_attrs *bgp_attr_intern_hashed(struct bgp_attr_table *t,
+                                                      const struct bgp_attrs *a,
+                                                      size_t size, uint64_t hash) {
+    t->lookups++;
+
+    for (struct bgp_attr_entry *e = t->buckets[hash & (t->num_buckets - 1)]; e; e = e->next) {
+        if (e->hash == hash && e->size == size && memcmp(entry_attrs(e), a, size) == 0) {
+            e->refcnt++;
+            t->hits++;
+            return entry_attrs(e);
+        }
+    }
+
+    struct bgp_attr_entry *e = malloc(sizeof(*e) + size);
+    if (!e) {
+        return NULL;
+    }
+    e->hash = hash;
+    e->refcnt = 1;
+    e->size = size;
+    memcpy(entry_attrs(e), a, size);
+
+    if (t->count >= t->num_buckets) {
+        bgp_attr_table_grow(t);
+    }
+    size_t b = hash & (t->num_buckets - 1);
+    e->next = t->buckets[b];
+    t->buckets[b] = e;
+    t->count++;
+    t->bytes += sizeof(*e) + size;
+    return entry_attrs(e);
+}
+
+/* Function to find or insert the shared copy of a blob */
+const struct bgp_attrs *bgp_attr_intern(struct bgp_attr_table *t, const struct bgp_attrs *a) {
+    size_t size = bgp_attrs_size(a);
+    return bgp_attr_intern_hashed(t, a, size, bgp_attrs_hash(a, size));
+}
+
+/* Function to copy a set interned elsewhere, reusing its stored hash */
+const struct bgp_attrs *bgp_attr_intern_from(struct bgp_attr_table *t, const struct bgp_attrs *a) {
+    const struct bgp_attr_entry *e = attrs_entry(a);
+    return bgp_attr_intern_hashed(t, a, e->size, e->hash);
+}
+
+/* Function to take a reference */
+void bgp_attr_ref(const struct bgp_attrs *a) {
+    attrs_entry(a)->refcnt++;
+}
+
+/* Function to drop a reference, unlinking the set when unused */
+void bgp_attr_unref(struct bgp_attr_table *t, const struct bgp_attrs *a) {
+    struct bgp_attr_entry *e = attrs_entry(a);
+    if (--e->refcnt > 0) {
+        return;
+    }
+    struct bgp_attr_entry **link = &t->buckets[e->hash & (t->num_buckets - 1)];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    t->count--;
+    t->bytes -= sizeof(*e) + e->size;
+    free(e);
+}
@@ -0,0 +1,125 @@
+/* bgp_framing.c: Receive ring and message framer for the BGP speaker (see
+ * include/bgp_framing.h). The mirrored mapping comes from one memfd mapped twice
+ * into adjacent virtual addresses, so views never need to be copied out. */
+
+#define _GNU_SOURCE /* For memfd_create */
+
+/* Include standard libraries for memory mapping and I/O */
+#include <stdio.h>       /* For perror */
+#include <string.h>      /* For memcmp */
+#include <unistd.h>      /* For read, close, ftruncate, sysconf */
+#include <sys/mman.h>    /* For mmap, munmap, memfd_create */
+#include "bgp_framing.h" /* For struct bgp_rxring, struct bgp_msg_view */
+
+/* The 16-byte all-ones marker every message starts with */
+static const uint8_t bgp_marker[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* Function to map the ring twice back to back over the same pages */
+int bgp_rxring_init(struct bgp_rxring *ring, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size < BGP_MAX_MESSAGE || size % page != 0 || (size & (size - 1)) != 0) {
+        return -1;
+    }
+
+    int fd = memfd_create("bgp_rxring", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create failed");
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        perror("ftruncate failed");
+        close(fd);
+        return -1;
+    }
+
+    /* Reserve 2 * size of address space, then overlay both halves */
+    uint8_t *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap failed");
+        close(fd);
+        return -1;
+    }
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        perror("mmap failed");
+        munmap(base, 2 * size);
+        close(fd);
+        return -1;
+    }
+    close(fd); /* The mappings keep the pages alive */
+
+    ring->base = base;
+    ring->size = size;
+    ring->head = ring->tail = 0;
+    ring->reads = 0;
+    return 0;
+}
+
+/* Function to release the ring mappings */
+void bgp_rxring_free(struct bgp_rxring *ring) {
+    if (ring->base) {
+        munmap(ring->base, 2 * ring->size);
+        ring->base = NULL;
+    }
+}
+
+/* Function to drop any buffered bytes */
+void bgp_rxring_reset(struct bgp_rxring *ring) {
+    ring->head = ring->tail = 0;
+}
+
+/* Function to report free space */
+size_t bgp_rxring_space(const struct bgp_rxring *ring) {
+    return ring->size - (ring->tail - ring->head);
+}
+
+/* Function to append socket data with a single large read */
+ssize_t bgp_rxring_fill(struct bgp_rxring *ring, int fd) {
+    size_t space = bgp_rxring_space(ring);
+    if (space == 0) {
+        return -1; /* Cannot happen while the framer keeps up */
+    }
+    /* The mirror makes the free region contiguous even when it wraps */
+    ssize_t n = read(fd, ring->base + (ring->tail & (ring->size - 1)), space);
+    if (n > 0) {
+        ring->tail += n;
+        ring->reads++;
+    }
+    return n;
+}
+
+/* Function to frame the next complete message */
+int bgp_frame_next(struct bgp_rxring *ring, struct bgp_msg_view *msg, int *err_subcode) {
+    size_t avail = ring->tail - ring->head;
+    if (avail < BGP_HEADER_LEN) {
+        return 0;
+    }
+
+    const uint8_t *p = ring->base + (ring->head & (ring->size - 1));
+    const struct bgp_header *hdr = (const struct bgp_header *)p;
+    if (memcmp(hdr->marker, bgp_marker, sizeof(bgp_marker)) != 0) {
+        *err_subcode = BGP_ERR_HDR_SYNC;
+        return -1;
+    }
+    uint16_t len = bgp_get16(p + 16);
+    if (len < BGP_HEADER_LEN || len > BGP_MAX_MESSAGE) {
+        *err_subcode = BGP_ERR_HDR_LENGTH;
+        return -1;
+    }
+    if (hdr->type < BGP_OPEN || hdr->type > BGP_KEEPALIVE) {
+        *err_subcode = BGP_ERR_HDR_TYPE;
+        return -1;
+    }
+    if (avail < len) {
+        return 0; /* Rest of the message is still in flight */
+    }
+
+    msg->data = p;
+    msg->len = len;
+    msg->type = hdr->type;
+    ring->head += len;
+    return 1;
+}
@@ -0,0 +1,697 @@
+/* bgp_mrt.c: MRT dump reader and RIB snapshot writer for the BGP speaker (see
+ * include/bgp_mrt.h). The reader never copies the file: records are parsed in
+ * place from the mapping, a round of slices at a time, so memory stays bounded
+ * by the slice size times the thread count however large the dump is. */
+
+/* Include standard libraries and BGP definitions */
+#include <stdio.h>      /* For FILE, fopen, fwrite, perror */
+#include <stdlib.h>     /* For malloc, realloc, calloc, free */
+#include <string.h>     /* For memset */
+#include <time.h>       /* For time (record timestamps) */
+#include <unistd.h>     /* For close, unlink */
+#include <fcntl.h>      /* For open, O_RDONLY */
+#include <pthread.h>    /* For pthread_create, pthread_join (parallel parsing) */
+#include <sys/mman.h>   /* For mmap, munmap, madvise */
+#include <sys/stat.h>   /* For fstat */
+#include "bgp.h"        /* For bgp_get16, bgp_get32, bgp_put16, bgp_put32 */
+#include "bgp_attr.h"   /* For bgp_attrs_parse, bgp_attrs_encode, struct bgp_attr_table */
+#include "bgp_update.h" /* For bgp_update_decode, bgp_prefix_next */
+#include "bgp_mrt.h"    /* For struct bgp_mrt_source */
+
+#define MRT_SLICE_BYTES (4 << 20) /* Record bytes each parser takes per round */
+#define MRT_MAX_THREADS 64        /* Upper bound on parser threads */
+#define MRT_STATE_ESTABLISHED 6   /* BGP4MP_STATE_CHANGE code for Established */
+
+/* What a parsed route does to the RIB */
+enum mrt_op {
+    MRT_ANNOUNCE,  /* Install or replace the peer's path */
+    MRT_WITHDRAW,  /* Remove the peer's path */
+    MRT_PEER_DOWN  /* Session left Established: remove all of the peer's paths */
+};
+
+/* One route parsed by a worker, applied later by the main thread */
+struct mrt_route {
+    const struct bgp_attrs *attrs; /* Interned in the slice's table (announcements) */
+    uint32_t prefix;               /* Prefix, host byte order */
+    uint32_t peer;                 /* PEER_INDEX_TABLE index, or BGP4MP peer address */
+    uint32_t peer_as;              /* BGP4MP peer AS (0 for indexed peers) */
+    uint8_t plen;                  /* Prefix length */
+    uint8_t op;                    /* enum mrt_op */
+    uint8_t indexed;               /* 1 if peer is a PEER_INDEX_TABLE index */
+};
+
+/* A run of whole records handed to one parser */
+struct mrt_slice {
+    const uint8_t *start;         /* First record */
+    const uint8_t *end;           /* One past the last record */
+    struct bgp_attr_table attrs;  /* Attribute sets seen in this slice */
+    struct mrt_route *routes;     /* Parsed routes in file order */
+    size_t count;                 /* Entries used in routes[] */
+    size_t cap;                   /* Capacity of routes[] */
+    unsigned long records;        /* Records parsed */
+    unsigned long skipped;        /* Unsupported records or routes */
+    unsigned long errors;         /* Malformed records or attributes */
+};
+
+/* Function to append a parsed route to a slice; returns -1 if out of memory */
+static int mrt_push(struct mrt_slice *s, const struct mrt_route *r) {
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 4096;
+        struct mrt_route *grown = realloc(s->routes, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        s->routes = grown;
+        s->cap = cap;
+    }
+    s->routes[s->count++] = *r;
+    return 0;
+}
+
+/* Function to decode and intern an attribute section; NULL if malformed */
+static const struct bgp_attrs *mrt_attrs(struct mrt_slice *s, const uint8_t *p, size_t len,
+                                         int as4, struct bgp_attrs *scratch, size_t size) {
+    uint8_t subcode;
+    if (bgp_attrs_parse(p, len, as4, scratch, size, &subcode) < 0 ||
+        (scratch->flags & BGP_ATTRF_MANDATORY) != BGP_ATTRF_MANDATORY) {
+        s->errors++;
+        return NULL;
+    }
+    return bgp_attr_intern(&s->attrs, scratch);
+}
+
+/* Function to parse a RIB_IPV4_UNICAST record: one prefix, one entry per peer */
+static void mrt_parse_rib(struct mrt_slice *s, const uint8_t *p, size_t len,
+                          struct bgp_attrs *scratch, size_t size) {
+    if (len < 7 || p[4] > 32 || 7 + (size_t)(p[4] + 7) / 8 > len) {
+        s->errors++;
+        return;
+    }
+    struct mrt_route r = { .plen = p[4], .op = MRT_ANNOUNCE, .indexed = 1 };
+    const uint8_t *end = p + len;
+    const uint8_t *pos = p + 4;
+    bgp_prefix_next(&pos, end, &r.prefix, &r.plen);
+    uint16_t count = bgp_get16(pos);
+    pos += 2;
+
+    for (int i = 0; i < count; i++) {
+        /* Peer index (2), originated time (4), attribute length (2), attributes */
+        if (end - pos < 8 || end - pos - 8 < bgp_get16(pos + 6)) {
+            s->errors++;
+            return;
+        }
+        uint16_t attr_len = bgp_get16(pos + 6);
+        r.peer = bgp_get16(pos);
+        r.attrs = mrt_attrs(s, pos + 8, attr_len, 1, scratch, size);
+        if (r.attrs && mrt_push(s, &r) < 0) {
+            s->errors++;
+        }
+        pos += 8 + attr_len;
+    }
+}
+
+/* Function to parse a BGP4MP STATE_CHANGE or MESSAGE record */
+static void mrt_parse_bgp4mp(struct mrt_slice *s, uint16_t subtype, const uint8_t *p,
+                             size_t len, struct bgp_attrs *scratch, size_t size) {
+    int as_size = (subtype == MRT_BGP4MP_MESSAGE_AS4 ||
+                   subtype == MRT_BGP4MP_STATE_CHANGE_AS4) ? 4 : 2;
+    if (subtype != MRT_BGP4MP_STATE_CHANGE && subtype != MRT_BGP4MP_STATE_CHANGE_AS4 &&
+        subtype != MRT_BGP4MP_MESSAGE && subtype != MRT_BGP4MP_MESSAGE_AS4) {
+        s->skipped++; /* *_LOCAL records are messages the collector sent */
+        return;
+    }
+    /* Peer AS, local AS, interface index (2), AFI (2), then the two addresses */
+    size_t hdr = 2 * as_size + 4;
+    if (len < hdr) {
+        s->errors++;
+        return;
+    }
+    if (bgp_get16(p + hdr - 2) != 1) {
+        s->skipped++; /* IPv6 sessions */
+        return;
+    }
+    hdr += 8;
+    if (len < hdr) {
+        s->errors++;
+        return;
+    }
+    struct mrt_route r = { .indexed = 0 };
+    r.peer_as = as_size == 4 ? bgp_get32(p) : bgp_get16(p);
+    r.peer = bgp_get32(p + hdr - 8);
+    const uint8_t *msg = p + hdr;
+    size_t msg_len = len - hdr;
+
+    if (subtype == MRT_BGP4MP_STATE_CHANGE || subtype == MRT_BGP4MP_STATE_CHANGE_AS4) {
+        if (msg_len < 4) {
+            s->errors++;
+        } else if (bgp_get16(msg) == MRT_STATE_ESTABLISHED &&
+                   bgp_get16(msg + 2) != MRT_STATE_ESTABLISHED) {
+            r.op = MRT_PEER_DOWN;
+            if (mrt_push(s, &r) < 0) {
+                s->errors++;
+            }
+        }
+        return;
+    }
+
+    if (msg_len < BGP_HEADER_LEN || msg_len > 0xFFFF || bgp_get16(msg + 16) != msg_len) {
+        s->errors++;
+        return;
+    }
+    if (msg[18] != BGP_UPDATE) {
+        return; /* OPEN, KEEPALIVE and NOTIFICATION carry no routes */
+    }
+    struct bgp_update upd;
+    uint8_t subcode;
+    if (bgp_update_decode(msg, msg_len, &upd, &subcode) < 0) {
+        s->errors++;
+        return;
+    }
+    const uint8_t *pos = upd.withdrawn;
+    r.op = MRT_WITHDRAW;
+    while (bgp_prefix_next(&pos, upd.withdrawn + upd.withdrawn_len, &r.prefix, &r.plen)) {
+        if (mrt_push(s, &r) < 0) {
+            s->errors++;
+            return;
+        }
+    }
+    if (upd.nlri_len == 0) {
+        return;
+    }
+    r.attrs = mrt_attrs(s, upd.attrs, upd.attrs_len, as_size == 4, scratch, size);
+    if (!r.attrs) {
+        return;
+    }
+    r.op = MRT_ANNOUNCE;
+    pos = upd.nlri;
+    while (bgp_prefix_next(&pos, upd.nlri + upd.nlri_len, &r.prefix, &r.plen)) {
+        if (mrt_push(s, &r) < 0) {
+            s->errors++;
+            return;
+        }
+    }
+}
+
+/* Thread body: parse every record of one slice */
+static void *mrt_parse_slice(void *arg) {
+    struct mrt_slice *s = arg;
+    union {
+        struct bgp_attrs attrs;
+        uint8_t raw[BGP_ATTRS_MAX];
+    } scratch;
+
+    for (const uint8_t *p = s->start; p < s->end; ) {
+        uint16_t type = bgp_get16(p + 4);
+        uint16_t subtype = bgp_get16(p + 6);
+        uint32_t len = bgp_get32(p + 8);
+        const uint8_t *body = p + MRT_HEADER_LEN;
+        p = body + len; /* The slicer checked every record fits */
+        s->records++;
+
+        if (type == MRT_TABLE_DUMP_V2) {
+            if (subtype == MRT_RIB_IPV4_UNICAST) {
+                mrt_parse_rib(s, body, len, &scratch.attrs, sizeof(scratch));
+            } else if (subtype != MRT_PEER_INDEX_TABLE) {
+                s->skipped++; /* Multicast and IPv6 RIBs */
+            }
+        } else if (type == MRT_BGP4MP || type == MRT_BGP4MP_ET) {
+            if (type == MRT_BGP4MP_ET) {
+                if (len < 4) {
+                    s->errors++;
+                    continue;
+                }
+                body += 4; /* Microsecond timestamp */
+                len -= 4;
+            }
+            mrt_parse_bgp4mp(s, subtype, body, len, &scratch.attrs, sizeof(scratch));
+        } else {
+            s->skipped++;
+        }
+    }
+    return NULL;
+}
+
+/* Function to find (or create) the source's Adj-RIB-In for a peer */
+static struct bgp_adj_in *mrt_find_peer(struct bgp_mrt_source *src, uint32_t addr,
+                                        uint32_t as, uint32_t id, uint32_t local_as) {
+    for (uint32_t i = 0; i < src->num_peers; i++) {
+        if (src->peers[i]->peer_addr == addr && src->peers[i]->peer_as == as) {
+            return src->peers[i];
+        }
+    }
+    if (src->num_peers == src->cap_peers) {
+        uint32_t cap = src->cap_peers ? src->cap_peers * 2 : 64;
+        struct bgp_adj_in **grown = realloc(src->peers, cap * sizeof(*grown));
+        if (!grown) {
+            return NULL;
+        }
+        src->peers = grown;
+        src->cap_peers = cap;
+    }
+    struct bgp_adj_in *adj = malloc(sizeof(*adj));
+    if (!adj) {
+        return NULL;
+    }
+    bgp_adj_in_init(adj, id, addr, as, as != local_as);
+    src->peers[src->num_peers++] = adj;
+    return adj;
+}
+
+/* Function to parse a PEER_INDEX_TABLE into an index -> Adj-RIB-In map */
+static int mrt_peer_index(struct bgp_mrt_source *src, const uint8_t *p, size_t len,
+                          uint32_t local_as, struct bgp_adj_in ***index, uint32_t *index_len) {
+    /* Collector BGP ID (4), view name length (2), view name, peer count (2) */
+    if (len < 8 || len - 8 < bgp_get16(p + 4)) {
+        return -1;
+    }
+    size_t off = 6 + bgp_get16(p + 4);
+    uint16_t count = bgp_get16(p + off);
+    off += 2;
+
+    struct bgp_adj_in **map = realloc(*index, (count ? count : 1) * sizeof(*map));
+    if (!map) {
+        return -1;
+    }
+    *index = map;
+    *index_len = 0;
+    for (int i = 0; i < count; i++) {
+        /* Peer type, BGP ID (4), address (4 or 16), AS (2 or 4) */
+        if (off + 5 > len) {
+            return -1;
+        }
+        uint8_t type = p[off];
+        uint32_t id = bgp_get32(p + off + 1);
+        size_t addr_len = (type & MRT_PEER_IPV6) ? 16 : 4;
+        size_t as_len = (type & MRT_PEER_AS4) ? 4 : 2;
+        if (off + 5 + addr_len + as_len > len) {
+            return -1;
+        }
+        /* An IPv6 peer is keyed by the low 32 bits of its address (tie-break only) */
+        uint32_t addr = bgp_get32(p + off + 5 + addr_len - 4);
+        const uint8_t *asp = p + off + 5 + addr_len;
+        uint32_t as = as_len == 4 ? bgp_get32(asp) : bgp_get16(asp);
+        map[i] = mrt_find_peer(src, addr, as, id, local_as);
+        if (!map[i]) {
+            return -1;
+        }
+        *index_len = i + 1;
+        off += 5 + addr_len + as_len;
+    }
+    return 0;
+}
+
+/* Function to apply one parsed slice to the RIB, in order */
+static void mrt_apply(struct bgp_rib *rib, struct bgp_mrt_source *src, struct mrt_slice *s,
+                      struct bgp_adj_in **index, uint32_t index_len, uint32_t local_as) {
+    const struct bgp_attrs *local = NULL, *global = NULL;
+    struct bgp_adj_in *adj = NULL;
+    uint32_t last_addr = 0, last_as = 0;
+
+    for (size_t i = 0; i < s->count; i++) {
+        const struct mrt_route *r = &s->routes[i];
+        if (r->indexed) {
+            adj = r->peer < index_len ? index[r->peer] : NULL;
+        } else if (!adj || r->peer != last_addr || r->peer_as != last_as) {
+            adj = mrt_find_peer(src, r->peer, r->peer_as, r->peer, local_as);
+            last_addr = r->peer;
+            last_as = r->peer_as;
+        }
+        if (!adj) {
+            src->errors++;
+            continue;
+        }
+
+        if (r->op == MRT_WITHDRAW) {
+            src->withdrawals += bgp_rib_withdraw(rib, adj, r->prefix, r->plen);
+            continue;
+        }
+        if (r->op == MRT_PEER_DOWN) {
+            src->withdrawals += bgp_rib_withdraw_peer(rib, adj);
+            continue;
+        }
+
+        /* Consecutive routes usually share a set; move it to the RIB table once */
+        if (r->attrs != local) {
+            if (global) {
+                bgp_attr_unref(&rib->attrs, global);
+            }
+            local = r->attrs;
+            global = bgp_attr_intern_from(&rib->attrs, local);
+            if (!global) {
+                local = NULL;
+                src->errors++;
+                continue;
+            }
+        }
+        if (bgp_rib_update(rib, adj, r->prefix, r->plen, global) < 0) {
+            src->errors++;
+            continue;
+        }
+        src->routes++;
+    }
+    if (global) {
+        bgp_attr_unref(&rib->attrs, global);
+    }
+}
+
+/* Function to prepare an empty source */
+void bgp_mrt_source_init(struct bgp_mrt_source *src) {
+    memset(src, 0, sizeof(*src));
+}
+
+/* Function to withdraw a source's routes and free its peers */
+void bgp_mrt_source_free(struct bgp_rib *rib, struct bgp_mrt_source *src) {
+    for (uint32_t i = 0; i < src->num_peers; i++) {
+        bgp_rib_withdraw_peer(rib, src->peers[i]);
+        free(src->peers[i]);
+    }
+    free(src->peers);
+    bgp_mrt_source_init(src);
+}
+
+/* Function to bulk-load an MRT file */
+int bgp_mrt_load(struct bgp_rib *rib, struct bgp_mrt_source *src, const char *path,
+                 uint32_t local_as, int threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open MRT file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to stat MRT file");
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map MRT file");
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+    madvise((void *)map, size, MADV_WILLNEED);
+
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > MRT_MAX_THREADS) {
+        threads = MRT_MAX_THREADS;
+    }
+    struct mrt_slice *slices = calloc(threads, sizeof(*slices));
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    if (!slices || !tids) {
+        perror("Failed to allocate MRT parsers");
+        free(slices);
+        free(tids);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    struct bgp_adj_in **index = NULL;
+    uint32_t index_len = 0;
+    size_t off = 0;
+    size_t valid = size;    /* Cut short at a truncated record */
+    while (off < valid) {
+        /* Cut the next round into slices of whole records. A PEER_INDEX_TABLE is
+         * read here, before any RIB entry after it, and closes the round so the
+         * entries before it still resolve against the previous table. */
+        int n = 0;
+        int barrier = 0;
+        while (n < threads && off < valid && !barrier) {
+            struct mrt_slice *s = &slices[n];
+            s->start = map + off;
+            size_t limit = off + MRT_SLICE_BYTES;
+            while (off < valid && off < limit) {
+                if (size - off < MRT_HEADER_LEN ||
+                    size - off - MRT_HEADER_LEN < bgp_get32(map + off + 8)) {
+                    /* The slice ends before it, so no parser sees a partial record */
+                    fprintf(stderr, "%s: truncated record at offset %zu\n", path, off);
+                    src->errors++;
+                    valid = off;
+                    break;
+                }
+                const uint8_t *rec = map + off;
+                if (bgp_get16(rec + 4) == MRT_TABLE_DUMP_V2 &&
+                    bgp_get16(rec + 6) == MRT_PEER_INDEX_TABLE) {
+                    if (n > 0 || rec > s->start) {
+                        barrier = 1;
+                        break;
+                    }
+                    if (mrt_peer_index(src, rec + MRT_HEADER_LEN, bgp_get32(rec + 8), local_as,
+                                       &index, &index_len) < 0) {
+                        src->errors++;
+                    }
+                }
+                off += MRT_HEADER_LEN + bgp_get32(rec + 8);
+            }
+            s->end = map + off;
+            bgp_attr_table_init(&s->attrs);
+            n++;
+        }
+
+        /* Parse the slices in parallel; the main thread takes the first one */
+        for (int i = 1; i < n; i++) {
+            if (pthread_create(&tids[i], NULL, mrt_parse_slice, &slices[i]) != 0) {
+                mrt_parse_slice(&slices[i]);
+                tids[i] = 0;
+            }
+        }
+        mrt_parse_slice(&slices[0]);
+        for (int i = 1; i < n; i++) {
+            if (tids[i]) {
+                pthread_join(tids[i], NULL);
+            }
+        }
+
+        /* Apply in file order, then recycle the slices */
+        for (int i = 0; i < n; i++) {
+            struct mrt_slice *s = &slices[i];
+            mrt_apply(rib, src, s, index, index_len, local_as);
+            src->records += s->records;
+            src->skipped += s->skipped;
+            src->errors += s->errors;
+            bgp_attr_table_destroy(&s->attrs);
+            s->count = 0;
+            s->records = s->skipped = s->errors = 0;
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        free(slices[i].routes);
+    }
+    free(slices);
+    free(tids);
+    free(index);
+    munmap((void *)map, size);
+    return 0;
+}
+
+/* State of one snapshot being written */
+struct mrt_writer {
+    FILE *out;                         /* Destination stream */
+    const struct bgp_adj_in **peers;   /* Peers in PEER_INDEX_TABLE order */
+    size_t num_peers;                  /* Entries used in peers[] */
+    const struct bgp_adj_in **keys;    /* Open-addressed map: peer -> ... */
+    uint16_t *vals;                    /* ... its index in peers[] */
+    size_t map_size;                   /* Slots in keys[]/vals[] (power of two) */
+    uint8_t *buf;                      /* Record being built */
+    size_t buf_cap;                    /* Capacity of buf */
+    uint32_t now;                      /* Timestamp for every record */
+    uint32_t seq;                      /* RIB record sequence number */
+    long entries;                      /* RIB entries written */
+    int failed;                        /* Set on allocation or write failure */
+};
+
+/* Function to find a peer's slot in the writer's map */
+static size_t mrt_peer_slot(const struct mrt_writer *w, const struct bgp_adj_in *adj) {
+    size_t i = ((uintptr_t)adj >> 4) * 0x9E3779B97F4A7C15ULL & (w->map_size - 1);
+    while (w->keys[i] && w->keys[i] != adj) {
+        i = (i + 1) & (w->map_size - 1);
+    }
+    return i;
+}
+
+/* Function to register a peer, keeping the map at most half full */
+static void mrt_add_peer(struct mrt_writer *w, const struct bgp_adj_in *adj) {
+    if (w->keys[mrt_peer_slot(w, adj)]) {
+        return;
+    }
+    if (w->num_peers == 0xFFFF) {
+        w->failed = 1; /* PEER_INDEX_TABLE holds at most 65535 peers */
+        return;
+    }
+    if (2 * (w->num_peers + 1) > w->map_size) {
+        size_t size = w->map_size * 2;
+        const struct bgp_adj_in **keys = calloc(size, sizeof(*keys));
+        uint16_t *vals = calloc(size, sizeof(*vals));
+        const struct bgp_adj_in **peers = realloc(w->peers, size / 2 * sizeof(*peers));
+        if (!keys || !vals || !peers) {
+            free(keys);
+            free(vals);
+            if (peers) {
+                w->peers = peers;
+            }
+            w->failed = 1;
+            return;
+        }
+        free(w->keys);
+        free(w->vals);
+        w->keys = keys;
+        w->vals = vals;
+        w->peers = peers;
+        w->map_size = size;
+        for (size_t i = 0; i < w->num_peers; i++) {
+            size_t slot = mrt_peer_slot(w, w->peers[i]);
+            w->keys[slot] = w->peers[i];
+            w->vals[slot] = i;
+        }
+    }
+    size_t slot = mrt_peer_slot(w, adj);
+    w->keys[slot] = adj;
+    w->vals[slot] = w->num_peers;
+    w->peers[w->num_peers++] = adj;
+}
+
+/* Walk callback: collect the peers that hold paths */
+static int mrt_collect_peers(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    struct mrt_writer *w = arg;
+    for (const struct bgp_path *path = ((struct bgp_dest *)data)->paths; path; path = path->next) {
+        mrt_add_peer(w, path->peer);
+    }
+    return w->failed;
+}
+
+/* Function to make room for need more bytes after used in the record buffer */
+static int mrt_reserve(struct mrt_writer *w, size_t used, size_t need) {
+    if (used + need <= w->buf_cap) {
+        return 0;
+    }
+    size_t cap = w->buf_cap ? w->buf_cap : 65536;
+    while (cap < used + need) {
+        cap *= 2;
+    }
+    uint8_t *grown = realloc(w->buf, cap);
+    if (!grown) {
+        w->failed = 1;
+        return -1;
+    }
+    w->buf = grown;
+    w->buf_cap = cap;
+    return 0;
+}
+
+/* Function to fill in a record's common header and write it out */
+static void mrt_emit(struct mrt_writer *w, uint16_t type, uint16_t subtype, size_t len) {
+    bgp_put32(w->buf, w->now);
+    bgp_put16(w->buf + 4, type);
+    bgp_put16(w->buf + 6, subtype);
+    bgp_put32(w->buf + 8, len - MRT_HEADER_LEN);
+    if (fwrite(w->buf, 1, len, w->out) != len) {
+        w->failed = 1;
+    }
+}
+
+/* Walk callback: write one RIB_IPV4_UNICAST record per destination */
+static int mrt_write_dest(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    struct mrt_writer *w = arg;
+    const struct bgp_dest *dest = data;
+    size_t len = MRT_HEADER_LEN;
+    if (!dest->paths || mrt_reserve(w, 0, MRT_HEADER_LEN + 11) < 0) {
+        return w->failed;
+    }
+    bgp_put32(w->buf + len, w->seq++);
+    w->buf[len + 4] = plen;
+    len += 5;
+    for (int i = 0; i < (plen + 7) / 8; i++) {
+        w->buf[len++] = prefix >> (24 - 8 * i);
+    }
+    size_t count_at = len;
+    len += 2;
+
+    uint16_t count = 0;
+    for (const struct bgp_path *path = dest->paths; path && count < 0xFFFF; path = path->next) {
+        const struct bgp_attrs *a = path->attrs;
+        size_t bound = bgp_attrs_encode_bound(a);
+        if (mrt_reserve(w, len, 8 + bound) < 0) {
+            return 1;
+        }
+        int attr_len = bgp_attrs_encode(a, 1, w->buf + len + 8, bound);
+        if (attr_len < 0 || attr_len > 0xFFFF) {
+            continue;
+        }
+        bgp_put16(w->buf + len, w->vals[mrt_peer_slot(w, path->peer)]);
+        bgp_put32(w->buf + len + 2, w->now);
+        bgp_put16(w->buf + len + 6, attr_len);
+        len += 8 + attr_len;
+        count++;
+    }
+    bgp_put16(w->buf + count_at, count);
+    mrt_emit(w, MRT_TABLE_DUMP_V2, MRT_RIB_IPV4_UNICAST, len);
+    w->entries += count;
+    return w->failed;
+}
+
+/* Function to write a TABLE_DUMP_V2 snapshot of the RIB */
+long bgp_mrt_write(const struct bgp_rib *rib, const char *path, uint32_t collector_id) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    struct mrt_writer w;
+    memset(&w, 0, sizeof(w));
+    w.out = fopen(tmp, "wb");
+    if (!w.out) {
+        perror("Failed to create MRT snapshot");
+        return -1;
+    }
+    setvbuf(w.out, NULL, _IOFBF, 1 << 20);
+    w.now = time(NULL);
+    w.map_size = 64;
+    w.keys = calloc(w.map_size, sizeof(*w.keys));
+    w.vals = calloc(w.map_size, sizeof(*w.vals));
+    w.peers = malloc(w.map_size / 2 * sizeof(*w.peers));
+    w.failed = !w.keys || !w.vals || !w.peers;
+
+    /* First pass: which peers appear. Then the PEER_INDEX_TABLE: collector BGP ID,
+     * empty view name, peer count, and per peer type, BGP ID, address and AS. */
+    if (!w.failed) {
+        ptrie_walk(&rib->trie, mrt_collect_peers, &w);
+    }
+    if (!w.failed && mrt_reserve(&w, 0, MRT_HEADER_LEN + 8 + 13 * w.num_peers) == 0) {
+        size_t len = MRT_HEADER_LEN;
+        bgp_put32(w.buf + len, collector_id);
+        bgp_put16(w.buf + len + 4, 0);
+        bgp_put16(w.buf + len + 6, w.num_peers);
+        len += 8;
+        for (size_t i = 0; i < w.num_peers; i++) {
+            w.buf[len] = MRT_PEER_AS4;
+            bgp_put32(w.buf + len + 1, w.peers[i]->peer_id);
+            bgp_put32(w.buf + len + 5, w.peers[i]->peer_addr);
+            bgp_put32(w.buf + len + 9, w.peers[i]->peer_as);
+            len += 13;
+        }
+        mrt_emit(&w, MRT_TABLE_DUMP_V2, MRT_PEER_INDEX_TABLE, len);
+    }
+    if (!w.failed) {
+        ptrie_walk(&rib->trie, mrt_write_dest, &w);
+    }
+
+    if (fclose(w.out) != 0) {
+        w.failed = 1;
+    }
+    free(w.keys);
+    free(w.vals);
+    free(w.peers);
+    free(w.buf);
+    if (w.failed || rename(tmp, path) < 0) {
+        perror("Failed to write MRT snapshot");
+        unlink(tmp);
+        return -1;
+    }
+    return w.entries;
+}
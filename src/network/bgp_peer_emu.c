@@ -0,0 +1,1306 @@
+/* bgp_peer_emu.c: BGP peer emulator and route-churn load generator for bgp_sim.
+ * Opens hundreds of eBGP sessions to one speaker over loopback, each from its own
+ * 127.1.x.y source address and 4-octet private AS, and drives them all from a
+ * single epoll loop. Every emulated peer runs the OPEN/KEEPALIVE exchange, then
+ * injects a full table: the routes one peer of an MRT dump held (bgp_mrt.c), or a
+ * synthetic table generated from a seed. After the table it can replay random
+ * churn (withdrawals, re-announcements and path changes) at a fixed rate.
+ *
+ * One extra session injects nothing and only listens: it sees every Loc-RIB
+ * change the speaker advertises. Each peer also ends a phase by announcing (after
+ * its table) or withdrawing (after churn) a sentinel /32 of its own from the
+ * 198.18.0.0/15 benchmarking range; the speaker handles a session's messages in
+ * order, so once the observer has seen every sentinel change the speaker has at
+ * least read all the input before it. A phase has converged once the observer also
+ * holds exactly the prefixes still announced and nothing has arrived for a quiet
+ * period; the convergence time runs to the last UPDATE it received. Each point of
+ * a peer-count list (-n 10,50,100) repeats the whole cycle on fresh sessions:
+ * session setup, table load, churn and teardown, printing one result line per run
+ * and optionally one CSV row, so scaling curves can be plotted and, with the same
+ * seed, reproduced. Like a librarian staging a rush of book deliveries from a
+ * hundred branches and timing how long the catalogue takes to catch up. */
+
+/* Include standard libraries for sockets, networking, and I/O */
+#include <stdio.h>        /* For printf, perror, fprintf (printing) */
+#include <stdlib.h>       /* For exit, malloc, calloc, free, qsort */
+#include <string.h>       /* For memcpy, memset (memory operations) */
+#include <unistd.h>       /* For close, sysconf */
+#include <errno.h>        /* For errno, EAGAIN, EINPROGRESS */
+#include <signal.h>       /* For signal, SIGINT (stop between runs) */
+#include <time.h>         /* For clock_gettime (phase timing) */
+#include <sys/socket.h>   /* For socket, bind, connect, getsockopt */
+#include <sys/epoll.h>    /* For epoll_create1, epoll_ctl, epoll_wait */
+#include <sys/resource.h> /* For setrlimit (one descriptor per session) */
+#include <netinet/in.h>   /* For sockaddr_in, in_addr (IP addresses) */
+#include <arpa/inet.h>    /* For inet_pton, htons (network conversions) */
+#include "bgp.h"          /* For BGP wire structs and constants */
+#include "bgp_framing.h"  /* For struct bgp_rxring, bgp_frame_next */
+#include "bgp_attr.h"     /* For struct bgp_attrs, bgp_attrs_encode */
+#include "bgp_update.h"   /* For bgp_update_decode, bgp_prefix_next */
+#include "bgp_rib.h"      /* For struct bgp_rib, struct bgp_adj_in */
+#include "bgp_mrt.h"      /* For bgp_mrt_load */
+#include "bgp_adj_out.h"  /* For struct bgp_outq */
+
+/* Emulated sessions */
+#define EMU_MAX_PEERS 1000           /* Injecting peers (bgp_sim allows 1024 sessions) */
+#define EMU_HOLD_TIME 90             /* Proposed hold time, seconds */
+#define EMU_BASE_AS 4200000000u      /* Observer AS; peer i uses EMU_BASE_AS + i */
+#define EMU_BASE_ADDR 0x7F010001u    /* 127.1.0.1: observer; peer i uses + i */
+#define EMU_SENTINEL 0xC6120000u     /* 198.18.0.0: peer i's sentinel /32 is + i */
+
+/* Load generation */
+#define EMU_DEFAULT_PREFIXES 100000  /* Synthetic table size without -m or -g */
+#define EMU_MAX_PREFIXES (8 << 20)   /* Largest synthetic table */
+#define EMU_GROUP_ROUTES 16          /* Synthetic prefixes sharing one attribute set */
+#define EMU_OUT_HIGH (1024 * 1024)   /* Queued bytes per peer before it stops generating */
+#define EMU_STAGE_SIZE (64 * 1024)   /* Table messages batched per queued chunk */
+#define EMU_PICK_TRIES 8             /* Attempts to find an unblocked peer per churn event */
+
+/* Measurement */
+#define EMU_QUIET_MS 1000            /* Silence that ends a phase */
+#define EMU_TIMEOUT_S 300            /* Give up on a phase after this long */
+#define EMU_MAX_POINTS 32            /* Entries in the -n list */
+#define EMU_MAX_MRT 16               /* -m dumps */
+#define EMU_MAX_EVENTS 256           /* epoll events handled per wakeup */
+#define EMU_MAX_FILLS 8              /* Ring fills per peer per wakeup (fairness bound) */
+
+/* Session states (the subset of RFC 4271 section 8.2.2 an active peer passes) */
+enum emu_state {
+    EMU_IDLE,
+    EMU_CONNECT,
+    EMU_OPENSENT,
+    EMU_OPENCONFIRM,
+    EMU_ESTABLISHED
+};
+
+/* One route of a table: which prefix, carried with which attribute set */
+struct emu_route {
+    uint32_t pid;  /* Index into the global prefix list */
+    uint32_t set;  /* Attribute set: index into sets[], or synthetic group */
+};
+
+/* A full table one or more emulated peers inject; routes are ordered by set so
+ * consecutive routes pack into one UPDATE */
+struct emu_table {
+    struct emu_route *routes;       /* Routes in set order */
+    size_t count;                   /* Entries in routes[] */
+    const struct bgp_attrs **sets;  /* MRT attribute sets (NULL = synthetic) */
+    size_t num_sets;                /* Entries in sets[] */
+};
+
+struct emu;
+
+/* One emulated BGP peer */
+struct emu_peer {
+    struct emu *emu;                /* Owning emulator */
+    int index;                      /* 0 = observer, 1... = injecting peers */
+    int fd;                         /* Socket (-1 when down) */
+    enum emu_state state;           /* Session state */
+    uint32_t addr;                  /* Source address, BGP ID and NEXT_HOP (host order) */
+    uint32_t as;                    /* Our AS on this session */
+    struct bgp_rxring rx;           /* Receive ring */
+    struct bgp_outq outq;           /* Messages waiting for the socket */
+    int want_out;                   /* 1 while EPOLLOUT is registered */
+    const struct emu_table *table;  /* Table this peer injects (NULL for the observer) */
+    size_t cursor;                  /* Next table route to send (initial load) */
+    int loading;                    /* 1 while the initial table is being queued */
+    uint8_t *announced;             /* Bit per table route: currently announced */
+    int sentinel;                   /* 1 while our sentinel is announced */
+    int sentinel_seen;              /* Observer only tracks these: 1 if it holds ours */
+    int hold_time;                  /* Negotiated hold time (0 = no keepalives) */
+    uint64_t next_keepalive;        /* When the next KEEPALIVE is due (ns) */
+    unsigned long updates_out;      /* UPDATEs sent */
+    unsigned long updates_in;       /* UPDATEs received */
+};
+
+/* Results of one run */
+struct emu_result {
+    int peers;                      /* Injecting peers */
+    int run;                        /* Repetition number */
+    unsigned long routes;           /* Routes injected by the table load */
+    size_t prefixes;                /* Distinct prefixes among them */
+    double setup_ms;                /* Until every session was Established */
+    double sent_ms;                 /* Until every table was written to the socket */
+    double load_ms;                 /* Until the observer's last UPDATE of the load */
+    unsigned long load_updates;     /* UPDATEs sent by the table load */
+    unsigned long churn_events;     /* Churn events sent */
+    double churn_ms;                /* Length of the churn phase */
+    unsigned long churn_observed;   /* UPDATEs the observer received during churn */
+    double churn_settle_ms;         /* Last observer UPDATE after churn stopped */
+    double teardown_ms;             /* Until the observer's table emptied */
+    int converged;                  /* 1 if every phase converged */
+};
+
+/* The emulator */
+struct emu {
+    struct sockaddr_in speaker;     /* Speaker address and port */
+    int epfd;                       /* epoll instance */
+    int hold_time;                  /* Proposed hold time */
+    uint64_t seed;                  /* Seed for synthetic tables and churn */
+    uint64_t rng;                   /* Churn random state */
+    struct emu_peer *peers;         /* Observer, then injecting peers */
+    int num_peers;                  /* Sessions in use this run (observer included) */
+    int established;                /* Sessions currently Established */
+    int failures;                   /* Sessions lost this run */
+    uint64_t *prefixes;             /* Sorted prefix << 8 | plen of every table route */
+    size_t num_prefixes;            /* Entries in prefixes[] */
+    struct emu_table *tables;       /* Tables handed out round-robin to peers */
+    int num_tables;                 /* Entries in tables[] */
+    uint32_t *announcers;           /* Per prefix: peers announcing it */
+    size_t expected;                /* Prefixes with at least one announcer */
+    uint8_t *seen;                  /* Per prefix: observer holds a route */
+    size_t seen_count;              /* Prefixes the observer holds */
+    int sentinels;                  /* Sentinels announced */
+    int sentinels_seen;             /* Sentinels the observer holds */
+    unsigned long foreign;          /* Observed prefixes not in any table */
+    unsigned long observed;         /* UPDATEs the observer received */
+    uint64_t last_change;           /* When the observer last received an UPDATE (ns) */
+    struct bgp_rib rib;             /* Holds the MRT routes and their attributes */
+    struct bgp_mrt_source mrt;      /* MRT peers the tables come from */
+    uint8_t stage[EMU_STAGE_SIZE];  /* Table messages being batched */
+};
+
+/* Set by SIGINT: finish the current phase early and stop */
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Signal handler: request a stop */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t emu_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to mix a 64-bit value (splitmix64 finalizer) */
+static uint64_t emu_hash(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Function to draw the next churn random number */
+static uint64_t emu_random(struct emu *emu) {
+    emu->rng = emu_hash(emu->rng);
+    return emu->rng;
+}
+
+/* Function to fill in a BGP header (all-ones marker) */
+static void emu_header(uint8_t *msg, uint16_t len, uint8_t type) {
+    memset(msg, 0xFF, 16);
+    bgp_put16(msg + 16, len);
+    msg[18] = type;
+}
+
+/* Function to append one prefix in NLRI encoding; returns bytes written */
+static size_t emu_put_prefix(uint8_t *p, uint64_t key) {
+    uint32_t prefix = key >> 8;
+    uint8_t plen = key & 0xFF;
+    int bytes = (plen + 7) / 8;
+    p[0] = plen;
+    for (int i = 0; i < bytes; i++) {
+        p[1 + i] = prefix >> (24 - 8 * i);
+    }
+    return 1 + bytes;
+}
+
+/* Function to find a prefix in the global list; returns its index or -1 */
+static long emu_find_prefix(const struct emu *emu, uint32_t prefix, uint8_t plen) {
+    uint64_t key = (uint64_t)prefix << 8 | plen;
+    size_t lo = 0, hi = emu->num_prefixes;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (emu->prefixes[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < emu->num_prefixes && emu->prefixes[lo] == key ? (long)lo : -1;
+}
+
+/* Function to compare prefix keys for qsort */
+static int emu_key_cmp(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+    return a < b ? -1 : a > b;
+}
+
+/* Function to generate a synthetic table of count prefixes: consecutive /24s
+ * from 1.0.0.0, every eighth widened to a /21-/24 so some routes cover others */
+static int emu_synth_table(struct emu *emu, size_t count) {
+    emu->prefixes = malloc(count * sizeof(*emu->prefixes));
+    emu->tables = calloc(1, sizeof(*emu->tables));
+    if (!emu->prefixes || !emu->tables) {
+        return -1;
+    }
+    struct emu_table *t = &emu->tables[0];
+    t->routes = malloc(count * sizeof(*t->routes));
+    if (!t->routes) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t prefix = 0x01000000u + (uint32_t)i * 256;
+        uint8_t plen = i % 8 ? 24 : 21 + emu_hash(emu->seed ^ i) % 4;
+        emu->prefixes[i] = (uint64_t)prefix << 8 | plen;
+        t->routes[i].pid = i;
+        t->routes[i].set = i / EMU_GROUP_ROUTES;
+    }
+    t->count = count;
+    t->num_sets = (count + EMU_GROUP_ROUTES - 1) / EMU_GROUP_ROUTES;
+    emu->num_prefixes = count;
+    emu->num_tables = 1;
+    return 0;
+}
+
+/* A route collected from an MRT peer before it is given a set index */
+struct emu_mrt_route {
+    const struct bgp_attrs *attrs; /* Interned attribute set */
+    uint64_t key;                  /* prefix << 8 | plen */
+};
+
+/* Function to order collected routes by attribute set, then prefix */
+static int emu_mrt_route_cmp(const void *x, const void *y) {
+    const struct emu_mrt_route *a = x, *b = y;
+    if (a->attrs != b->attrs) {
+        return (uintptr_t)a->attrs < (uintptr_t)b->attrs ? -1 : 1;
+    }
+    return a->key < b->key ? -1 : a->key > b->key;
+}
+
+/* Function to turn every MRT peer's Adj-RIB-In into a table */
+static int emu_mrt_tables(struct emu *emu) {
+    struct bgp_mrt_source *src = &emu->mrt;
+    size_t total = 0;
+    for (uint32_t p = 0; p < src->num_peers; p++) {
+        total += src->peers[p]->count;
+    }
+    emu->tables = calloc(src->num_peers, sizeof(*emu->tables));
+    emu->prefixes = malloc((total + 1) * sizeof(*emu->prefixes));
+    if (!emu->tables || !emu->prefixes) {
+        return -1;
+    }
+
+    /* Every prefix any peer holds, once */
+    size_t n = 0;
+    for (uint32_t p = 0; p < src->num_peers; p++) {
+        for (struct bgp_path *path = src->peers[p]->paths; path; path = path->adj_next) {
+            emu->prefixes[n++] = (uint64_t)path->dest->prefix << 8 | path->dest->plen;
+        }
+    }
+    qsort(emu->prefixes, n, sizeof(*emu->prefixes), emu_key_cmp);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique == 0 || emu->prefixes[unique - 1] != emu->prefixes[i]) {
+            emu->prefixes[unique++] = emu->prefixes[i];
+        }
+    }
+    emu->num_prefixes = unique;
+
+    /* One table per peer with routes, grouped by attribute set */
+    for (uint32_t p = 0; p < src->num_peers; p++) {
+        const struct bgp_adj_in *adj = src->peers[p];
+        if (adj->count == 0) {
+            continue;
+        }
+        struct emu_mrt_route *tmp = malloc(adj->count * sizeof(*tmp));
+        struct emu_table *t = &emu->tables[emu->num_tables];
+        t->routes = malloc(adj->count * sizeof(*t->routes));
+        t->sets = malloc(adj->count * sizeof(*t->sets));
+        if (!tmp || !t->routes || !t->sets) {
+            free(tmp);
+            return -1;
+        }
+        size_t c = 0;
+        for (struct bgp_path *path = adj->paths; path; path = path->adj_next) {
+            tmp[c].attrs = path->attrs;
+            tmp[c].key = (uint64_t)path->dest->prefix << 8 | path->dest->plen;
+            c++;
+        }
+        qsort(tmp, c, sizeof(*tmp), emu_mrt_route_cmp);
+        for (size_t i = 0; i < c; i++) {
+            if (i == 0 || tmp[i].attrs != tmp[i - 1].attrs) {
+                t->sets[t->num_sets++] = tmp[i].attrs;
+            }
+            t->routes[i].set = t->num_sets - 1;
+            t->routes[i].pid = emu_find_prefix(emu, tmp[i].key >> 8, tmp[i].key & 0xFF);
+        }
+        t->count = c;
+        free(tmp);
+        emu->num_tables++;
+    }
+    return emu->num_tables > 0 ? 0 : -1;
+}
+
+/* Function to build the attribute set a synthetic group carries from one peer:
+ * the origin AS depends only on the group, so every peer agrees on who
+ * originates a prefix, while the transit hops differ per peer */
+static void emu_synth_attrs(const struct emu *emu, int peer, uint32_t group,
+                            struct bgp_attrs *a) {
+    memset(a, 0, sizeof(*a));
+    uint64_t h = emu_hash(emu->seed ^ ((uint64_t)group << 20 | (uint64_t)peer));
+    int hops = 1 + h % 5;
+    a->origin = 0; /* IGP */
+    a->flags = BGP_ATTRF_ORIGIN | BGP_ATTRF_AS_PATH;
+    a->data[0] = BGP_AS_SEQUENCE;
+    a->data[1] = hops + 1;
+    for (int i = 0; i < hops; i++) {
+        h = emu_hash(h);
+        bgp_put32(a->data + 2 + 4 * i, 1 + h % 64000);
+    }
+    uint32_t origin = 1 + emu_hash(emu->seed ^ group) % 64000;
+    bgp_put32(a->data + 2 + 4 * hops, origin == BGP_AS_TRANS ? origin + 1 : origin);
+    a->as_path_len = 2 + 4 * (hops + 1);
+    a->as_path_hops = hops + 1;
+}
+
+/* Function to encode the path attributes a peer sends for a table set: the
+ * table's path with the peer's AS prepended (extra times for a path change)
+ * and the peer's address as NEXT_HOP. Returns the length, or -1. */
+static int emu_encode_attrs(const struct emu_peer *peer, uint32_t set, int prepends,
+                            uint8_t *out, size_t size) {
+    static union {
+        struct bgp_attrs attrs;
+        uint8_t raw[BGP_ATTRS_MAX];
+    } a, b;
+    const struct bgp_attrs *base = peer->table->sets ? peer->table->sets[set] : NULL;
+    if (!base) {
+        emu_synth_attrs(peer->emu, peer->index, set, &a.attrs);
+        base = &a.attrs;
+    }
+    struct bgp_attrs *cur = base == &a.attrs ? &b.attrs : &a.attrs;
+    if (bgp_attrs_prepend(base, peer->as, cur, sizeof(a)) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < prepends; i++) {
+        struct bgp_attrs *next = cur == &a.attrs ? &b.attrs : &a.attrs;
+        if (bgp_attrs_prepend(cur, peer->as, next, sizeof(a)) < 0) {
+            return -1;
+        }
+        cur = next;
+    }
+    cur->next_hop = peer->addr;
+    cur->flags |= BGP_ATTRF_NEXT_HOP;
+    cur->flags &= ~BGP_ATTRF_LOCAL_PREF; /* Not sent to an external peer */
+    return bgp_attrs_encode(cur, 1, out, size);
+}
+
+/* Function to record that a peer now announces (on) or withdrew (off) a route */
+static void emu_mark(struct emu_peer *peer, size_t route, int on) {
+    struct emu *emu = peer->emu;
+    uint8_t bit = 1u << (route & 7);
+    if (!(peer->announced[route >> 3] & bit) == !on) {
+        return;
+    }
+    peer->announced[route >> 3] ^= bit;
+    uint32_t pid = peer->table->routes[route].pid;
+    if (on) {
+        if (emu->announcers[pid]++ == 0) {
+            emu->expected++;
+        }
+    } else if (--emu->announcers[pid] == 0) {
+        emu->expected--;
+    }
+}
+
+/* Function to encode one UPDATE announcing table routes from *route on that share
+ * its attribute set, as many as fit (at most max). Advances *route and returns
+ * the message length (0 if the set cannot be encoded; the route is skipped). */
+static size_t emu_encode_announce(struct emu_peer *peer, size_t *route, size_t max,
+                                  int prepends, uint8_t *msg) {
+    const struct emu_table *t = peer->table;
+    uint32_t set = t->routes[*route].set;
+    int alen = emu_encode_attrs(peer, set, prepends, msg + BGP_HEADER_LEN + 4,
+                                BGP_MAX_MESSAGE - BGP_HEADER_LEN - 4);
+    if (alen < 0 || BGP_HEADER_LEN + 4 + alen + 5 > BGP_MAX_MESSAGE) {
+        (*route)++;
+        return 0;
+    }
+    size_t len = BGP_HEADER_LEN;
+    bgp_put16(msg + len, 0); /* No withdrawn routes */
+    bgp_put16(msg + len + 2, alen);
+    len += 4 + alen;
+    size_t end = *route + max < t->count ? *route + max : t->count;
+    while (*route < end && t->routes[*route].set == set && len + 5 <= BGP_MAX_MESSAGE) {
+        len += emu_put_prefix(msg + len, peer->emu->prefixes[t->routes[*route].pid]);
+        emu_mark(peer, *route, 1);
+        (*route)++;
+    }
+    emu_header(msg, len, BGP_UPDATE);
+    peer->updates_out++;
+    return len;
+}
+
+/* Function to encode an UPDATE withdrawing one table route; returns its length */
+static size_t emu_encode_withdraw(struct emu_peer *peer, size_t route, uint8_t *msg) {
+    size_t len = BGP_HEADER_LEN + 2;
+    len += emu_put_prefix(msg + len, peer->emu->prefixes[peer->table->routes[route].pid]);
+    bgp_put16(msg + BGP_HEADER_LEN, len - BGP_HEADER_LEN - 2);
+    bgp_put16(msg + len, 0); /* No path attributes */
+    emu_mark(peer, route, 0);
+    emu_header(msg, len + 2, BGP_UPDATE);
+    peer->updates_out++;
+    return len + 2;
+}
+
+/* Function to encode an UPDATE announcing (on) or withdrawing the peer's
+ * sentinel; returns its length (0 if the attributes cannot be encoded) */
+static size_t emu_encode_sentinel(struct emu_peer *peer, int on, uint8_t *msg) {
+    size_t len = BGP_HEADER_LEN;
+    uint64_t key = (uint64_t)(EMU_SENTINEL + peer->index) << 8 | 32;
+    if (on) {
+        int alen = emu_encode_attrs(peer, peer->table->routes[0].set, 0, msg + len + 4,
+                                    BGP_MAX_MESSAGE - len - 4 - 5);
+        if (alen < 0) {
+            return 0;
+        }
+        bgp_put16(msg + len, 0); /* No withdrawn routes */
+        bgp_put16(msg + len + 2, alen);
+        len += 4 + alen;
+        len += emu_put_prefix(msg + len, key);
+    } else {
+        len += 2;
+        len += emu_put_prefix(msg + len, key);
+        bgp_put16(msg + BGP_HEADER_LEN, len - BGP_HEADER_LEN - 2);
+        bgp_put16(msg + len, 0); /* No path attributes */
+        len += 2;
+    }
+    emu_header(msg, len, BGP_UPDATE);
+    peer->emu->sentinels += on ? 1 : -1;
+    peer->sentinel = on;
+    return len;
+}
+
+/* Function to register or update a peer's socket with epoll */
+static void emu_watch(struct emu_peer *peer, uint32_t events, int op) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = peer;
+    if (epoll_ctl(peer->emu->epfd, op, peer->fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+    }
+}
+
+/* Function to close a session */
+static void emu_close(struct emu_peer *peer) {
+    struct emu *emu = peer->emu;
+    if (peer->fd >= 0) {
+        close(peer->fd);
+        peer->fd = -1;
+    }
+    if (peer->state == EMU_ESTABLISHED) {
+        emu->established--;
+    }
+    if (peer->sentinel) {
+        emu->sentinels--; /* The speaker withdraws it with the session */
+        peer->sentinel = 0;
+    }
+    peer->state = EMU_IDLE;
+    peer->want_out = 0;
+    peer->loading = 0;
+    bgp_outq_clear(&peer->outq);
+    bgp_rxring_reset(&peer->rx);
+}
+
+/* Function to drop a session that failed, counting the failure */
+static void emu_fail(struct emu_peer *peer, const char *why) {
+    fprintf(stderr, "[peer %d] %s\n", peer->index, why);
+    peer->emu->failures++;
+    emu_close(peer);
+}
+
+/* Function to write what the socket takes and track EPOLLOUT interest */
+static void emu_flush(struct emu_peer *peer) {
+    if (peer->fd < 0 || peer->state < EMU_OPENSENT) {
+        return;
+    }
+    int rc = bgp_outq_write(&peer->outq, peer->fd);
+    if (rc < 0) {
+        emu_fail(peer, "Write failed");
+        return;
+    }
+    if (rc == 1 && !peer->want_out) {
+        emu_watch(peer, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+        peer->want_out = 1;
+    } else if (rc == 0 && peer->want_out) {
+        emu_watch(peer, EPOLLIN, EPOLL_CTL_MOD);
+        peer->want_out = 0;
+    }
+}
+
+/* Function to queue a message */
+static int emu_send(struct emu_peer *peer, const void *msg, size_t len) {
+    if (bgp_outq_push_copy(&peer->outq, msg, len) < 0) {
+        emu_fail(peer, "Out of memory queueing a message");
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to queue a KEEPALIVE */
+static int emu_send_keepalive(struct emu_peer *peer) {
+    uint8_t msg[BGP_HEADER_LEN];
+    emu_header(msg, BGP_HEADER_LEN, BGP_KEEPALIVE);
+    int interval = peer->hold_time / 3;
+    peer->next_keepalive = interval > 0 ? emu_now_ns() + interval * 1000000000ULL : UINT64_MAX;
+    return emu_send(peer, msg, sizeof(msg));
+}
+
+/* Function to queue our OPEN: IPv4 unicast and 4-octet AS capabilities */
+static int emu_send_open(struct emu_peer *peer) {
+    uint8_t msg[BGP_OPEN_LEN + 16];
+    struct bgp_open *open_msg = (struct bgp_open *)msg;
+    uint8_t *caps = msg + BGP_OPEN_LEN;
+    caps[0] = BGP_OPT_CAPABILITIES;
+    caps[1] = 14;
+    caps[2] = BGP_CAP_MP;
+    caps[3] = 4;
+    bgp_put16(caps + 4, 1);
+    caps[6] = 0;
+    caps[7] = 1;
+    caps[8] = BGP_CAP_AS4;
+    caps[9] = 4;
+    bgp_put32(caps + 10, peer->as);
+    emu_header(msg, sizeof(msg), BGP_OPEN);
+    open_msg->version = 4;
+    open_msg->my_as = htons(BGP_AS_TRANS);
+    open_msg->hold_time = htons(peer->emu->hold_time);
+    open_msg->bgp_id = htonl(peer->addr);
+    open_msg->opt_param_len = 16;
+    return emu_send(peer, msg, sizeof(msg));
+}
+
+/* Function to start a session: connect from the peer's own loopback address */
+static int emu_connect(struct emu_peer *peer) {
+    struct emu *emu = peer->emu;
+    peer->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (peer->fd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(peer->addr);
+    if (bind(peer->fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("Bind to the peer address failed");
+        close(peer->fd);
+        peer->fd = -1;
+        return -1;
+    }
+    if (connect(peer->fd, (struct sockaddr *)&emu->speaker, sizeof(emu->speaker)) < 0 &&
+        errno != EINPROGRESS) {
+        perror("Connect failed");
+        close(peer->fd);
+        peer->fd = -1;
+        return -1;
+    }
+    peer->state = EMU_CONNECT;
+    peer->updates_in = 0;
+    peer->updates_out = 0;
+    emu_watch(peer, EPOLLOUT, EPOLL_CTL_ADD);
+    return 0;
+}
+
+/* Function to finish a non-blocking connect and send our OPEN */
+static void emu_connected(struct emu_peer *peer) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        emu_fail(peer, err ? strerror(err) : "Connect failed");
+        return;
+    }
+    peer->state = EMU_OPENSENT;
+    emu_watch(peer, EPOLLIN, EPOLL_CTL_MOD);
+    if (emu_send_open(peer) == 0) {
+        emu_flush(peer);
+    }
+}
+
+/* Function to record a sentinel change; returns 1 if prefix/plen is a sentinel */
+static int emu_observe_sentinel(struct emu *emu, uint32_t prefix, uint8_t plen, int on) {
+    uint32_t index = prefix - EMU_SENTINEL;
+    if (plen != 32 || index >= (uint32_t)emu->num_peers || index == 0) {
+        return 0;
+    }
+    struct emu_peer *peer = &emu->peers[index];
+    if (peer->sentinel_seen != on) {
+        peer->sentinel_seen = on;
+        emu->sentinels_seen += on ? 1 : -1;
+    }
+    return 1;
+}
+
+/* Function to apply an UPDATE the speaker sent the observer */
+static void emu_observe(struct emu *emu, const struct bgp_msg_view *msg) {
+    struct bgp_update upd;
+    uint8_t subcode;
+    uint32_t prefix;
+    uint8_t plen;
+    if (bgp_update_decode(msg->data, msg->len, &upd, &subcode) < 0) {
+        return;
+    }
+    emu->observed++;
+    emu->last_change = emu_now_ns();
+    const uint8_t *pos = upd.withdrawn;
+    while (bgp_prefix_next(&pos, upd.withdrawn + upd.withdrawn_len, &prefix, &plen)) {
+        long pid = emu_find_prefix(emu, prefix, plen);
+        if (pid < 0) {
+            emu_observe_sentinel(emu, prefix, plen, 0);
+        } else if (emu->seen[pid]) {
+            emu->seen[pid] = 0;
+            emu->seen_count--;
+        }
+    }
+    pos = upd.nlri;
+    while (bgp_prefix_next(&pos, upd.nlri + upd.nlri_len, &prefix, &plen)) {
+        long pid = emu_find_prefix(emu, prefix, plen);
+        if (pid < 0) {
+            if (!emu_observe_sentinel(emu, prefix, plen, 1)) {
+                emu->foreign++;
+            }
+        } else if (!emu->seen[pid]) {
+            emu->seen[pid] = 1;
+            emu->seen_count++;
+        }
+    }
+}
+
+/* Function to validate the speaker's OPEN. Returns its hold time, or -1 after
+ * dropping the session. */
+static int emu_check_open(struct emu_peer *peer, const struct bgp_msg_view *msg) {
+    const struct bgp_open *open_msg = (const struct bgp_open *)msg->data;
+    if (msg->len < BGP_OPEN_LEN || msg->len != BGP_OPEN_LEN + open_msg->opt_param_len) {
+        emu_fail(peer, "Malformed OPEN");
+        return -1;
+    }
+    uint16_t hold = ntohs(open_msg->hold_time);
+    if (open_msg->version != 4) {
+        emu_fail(peer, "OPEN with an unsupported version");
+        return -1;
+    }
+    if (open_msg->bgp_id == 0 || ntohl(open_msg->bgp_id) == peer->addr) {
+        emu_fail(peer, "OPEN with a bad BGP Identifier");
+        return -1;
+    }
+    if (hold == 1 || hold == 2) {
+        emu_fail(peer, "OPEN with an unacceptable hold time");
+        return -1;
+    }
+    return hold;
+}
+
+/* Function to handle one message from the speaker. Returns -1 if the session
+ * was dropped. */
+static int emu_handle(struct emu_peer *peer, const struct bgp_msg_view *msg) {
+    char why[64];
+    int hold;
+    switch (msg->type) {
+    case BGP_OPEN:
+        if (peer->state != EMU_OPENSENT) {
+            emu_fail(peer, "Unexpected OPEN");
+            return -1;
+        }
+        hold = emu_check_open(peer, msg);
+        if (hold < 0) {
+            return -1;
+        }
+        /* The smaller proposal is the session's hold time (RFC 4271 section 4.2) */
+        peer->hold_time = hold < peer->emu->hold_time ? hold : peer->emu->hold_time;
+        peer->state = EMU_OPENCONFIRM;
+        return emu_send_keepalive(peer);
+    case BGP_KEEPALIVE:
+        if (peer->state == EMU_OPENCONFIRM) {
+            peer->state = EMU_ESTABLISHED;
+            peer->emu->established++;
+        }
+        return 0;
+    case BGP_UPDATE:
+        peer->updates_in++;
+        if (peer->index == 0 && peer->state == EMU_ESTABLISHED) {
+            emu_observe(peer->emu, msg);
+        }
+        return 0;
+    case BGP_NOTIFICATION:
+        snprintf(why, sizeof(why), "Received NOTIFICATION %d/%d",
+                 msg->len > BGP_HEADER_LEN ? msg->data[BGP_HEADER_LEN] : 0,
+                 msg->len > BGP_HEADER_LEN + 1 ? msg->data[BGP_HEADER_LEN + 1] : 0);
+        emu_fail(peer, why);
+        return -1;
+    default:
+        emu_fail(peer, "Unknown message type");
+        return -1;
+    }
+}
+
+/* Function to drain the socket and handle every complete message */
+static void emu_read(struct emu_peer *peer) {
+    for (int fills = 0; fills < EMU_MAX_FILLS; fills++) {
+        ssize_t n = bgp_rxring_fill(&peer->rx, peer->fd);
+        if (n == 0) {
+            emu_fail(peer, "Connection closed by the speaker");
+            return;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                emu_fail(peer, "Read failed");
+            }
+            return;
+        }
+        struct bgp_msg_view msg;
+        int subcode, rc;
+        while ((rc = bgp_frame_next(&peer->rx, &msg, &subcode)) == 1) {
+            if (emu_handle(peer, &msg) < 0) {
+                return;
+            }
+        }
+        if (rc < 0) {
+            emu_fail(peer, "Malformed message header");
+            return;
+        }
+    }
+}
+
+/* Function to queue the next stretch of a peer's initial table, leaving at most
+ * EMU_OUT_HIGH bytes waiting so every peer keeps making progress */
+static void emu_send_table(struct emu *emu, struct emu_peer *peer) {
+    const struct emu_table *t = peer->table;
+    while (peer->loading && peer->outq.bytes < EMU_OUT_HIGH) {
+        size_t len = 0;
+        while (peer->cursor < t->count && len + BGP_MAX_MESSAGE <= sizeof(emu->stage)) {
+            len += emu_encode_announce(peer, &peer->cursor, t->count, 0, emu->stage + len);
+        }
+        if (len > 0 && emu_send(peer, emu->stage, len) < 0) {
+            return;
+        }
+        if (peer->cursor == t->count) {
+            len = emu_encode_sentinel(peer, 1, emu->stage);
+            if (len > 0 && emu_send(peer, emu->stage, len) < 0) {
+                return;
+            }
+            peer->loading = 0;
+        }
+    }
+}
+
+/* Function to wait for socket events once and then service every peer:
+ * keepalives, table loading and output */
+static void emu_poll(struct emu *emu, int timeout_ms) {
+    struct epoll_event events[EMU_MAX_EVENTS];
+    int n = epoll_wait(emu->epfd, events, EMU_MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        struct emu_peer *peer = events[i].data.ptr;
+        if (peer->fd < 0) {
+            continue;
+        }
+        if (peer->state == EMU_CONNECT) {
+            emu_connected(peer);
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            emu_read(peer);
+        }
+        if (peer->fd >= 0 && (events[i].events & EPOLLOUT)) {
+            emu_flush(peer);
+        }
+    }
+    uint64_t now = emu_now_ns();
+    for (int i = 0; i < emu->num_peers; i++) {
+        struct emu_peer *peer = &emu->peers[i];
+        if (peer->state != EMU_ESTABLISHED) {
+            continue;
+        }
+        if (now >= peer->next_keepalive && emu_send_keepalive(peer) < 0) {
+            continue;
+        }
+        if (peer->loading) {
+            emu_send_table(emu, peer);
+        }
+        emu_flush(peer);
+    }
+}
+
+/* Function to check whether every queued message has been written */
+static int emu_drained(const struct emu *emu) {
+    for (int i = 0; i < emu->num_peers; i++) {
+        const struct emu_peer *peer = &emu->peers[i];
+        if (peer->fd >= 0 && (peer->loading || peer->outq.count > 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Function to check whether the observer agrees with what is announced, has
+ * seen every sentinel change and has heard nothing for quiet_ms */
+static int emu_settled(const struct emu *emu, int quiet_ms) {
+    return emu->peers[0].state == EMU_ESTABLISHED && emu->seen_count == emu->expected &&
+           emu->sentinels_seen == emu->sentinels &&
+           emu_now_ns() - emu->last_change >= quiet_ms * 1000000ULL && emu_drained(emu);
+}
+
+/* Function to poll until every queue has drained and the observer has settled.
+ * *sent_ns is set when the queues first drain. Returns 0, or -1 on timeout,
+ * stop request or a lost observer. */
+static int emu_converge(struct emu *emu, int quiet_ms, uint64_t *sent_ns) {
+    uint64_t deadline = emu_now_ns() + EMU_TIMEOUT_S * 1000000000ULL;
+    while (!emu_settled(emu, quiet_ms)) {
+        if (stop_requested || emu_now_ns() > deadline || emu->peers[0].fd < 0) {
+            return -1;
+        }
+        emu_poll(emu, 10);
+        if (sent_ns && !*sent_ns && emu_drained(emu)) {
+            *sent_ns = emu_now_ns();
+        }
+    }
+    if (sent_ns && !*sent_ns) {
+        *sent_ns = emu_now_ns();
+    }
+    return 0;
+}
+
+/* Function to send one churn event from a random injecting peer: withdraw an
+ * announced route (or change its path), or announce a withdrawn one. Returns
+ * 1 if an event was queued, 0 if every peer tried was backed up. */
+static int emu_churn_event(struct emu *emu, int path_change_pct) {
+    uint8_t msg[BGP_MAX_MESSAGE];
+    for (int tries = 0; tries < EMU_PICK_TRIES; tries++) {
+        uint64_t r = emu_random(emu);
+        struct emu_peer *peer = &emu->peers[1 + r % (emu->num_peers - 1)];
+        if (peer->state != EMU_ESTABLISHED || peer->outq.bytes >= EMU_OUT_HIGH) {
+            continue;
+        }
+        size_t route = (r >> 20) % peer->table->count;
+        size_t len;
+        if (!(peer->announced[route >> 3] & (1u << (route & 7)))) {
+            len = emu_encode_announce(peer, &route, 1, 0, msg);
+        } else if ((int)(emu_random(emu) % 100) < path_change_pct) {
+            len = emu_encode_announce(peer, &route, 1, 1 + (r >> 60) % 2, msg);
+        } else {
+            len = emu_encode_withdraw(peer, route, msg);
+        }
+        if (len > 0 && emu_send(peer, msg, len) < 0) {
+            return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Function to bring up the observer and peers injecting peers for one run */
+static int emu_start_sessions(struct emu *emu, int peers) {
+    emu->num_peers = peers + 1;
+    emu->established = 0;
+    emu->failures = 0;
+    for (int i = 0; i <= peers; i++) {
+        struct emu_peer *peer = &emu->peers[i];
+        peer->cursor = 0;
+        peer->loading = 0;
+        if (peer->announced) {
+            memset(peer->announced, 0, (peer->table->count + 7) / 8);
+        }
+        if (emu_connect(peer) < 0) {
+            return -1;
+        }
+    }
+    uint64_t deadline = emu_now_ns() + EMU_TIMEOUT_S * 1000000000ULL;
+    while (emu->established < emu->num_peers) {
+        if (stop_requested || emu->failures > 0 || emu_now_ns() > deadline) {
+            return -1;
+        }
+        emu_poll(emu, 10);
+    }
+    return 0;
+}
+
+/* Function to close every session and forget what was announced */
+static void emu_stop_sessions(struct emu *emu) {
+    for (int i = 0; i < emu->num_peers; i++) {
+        emu_close(&emu->peers[i]);
+    }
+    memset(emu->announcers, 0, emu->num_prefixes * sizeof(*emu->announcers));
+    memset(emu->seen, 0, emu->num_prefixes);
+    for (int i = 0; i < emu->num_peers; i++) {
+        emu->peers[i].sentinel_seen = 0;
+    }
+    emu->expected = 0;
+    emu->seen_count = 0;
+    emu->sentinels_seen = 0;
+}
+
+/* Function to convert a nanosecond interval to milliseconds */
+static double emu_ms(uint64_t from, uint64_t to) {
+    return to > from ? (to - from) / 1e6 : 0;
+}
+
+/* Function to run one full cycle with the given number of injecting peers */
+static int emu_run(struct emu *emu, int peers, int run, double churn_rate, int churn_s,
+                   int path_change_pct, int quiet_ms, struct emu_result *res) {
+    memset(res, 0, sizeof(*res));
+    res->peers = peers;
+    res->run = run;
+    emu->rng = emu->seed;
+    emu->foreign = 0;
+
+    /* Sessions */
+    uint64_t start = emu_now_ns();
+    if (emu_start_sessions(emu, peers) < 0) {
+        fprintf(stderr, "Sessions did not come up (%d of %d Established)\n",
+                emu->established, emu->num_peers);
+        emu_stop_sessions(emu);
+        return -1;
+    }
+    res->setup_ms = emu_ms(start, emu_now_ns());
+
+    /* Table load: every peer queues its table at once */
+    start = emu_now_ns();
+    emu->observed = 0;
+    emu->last_change = start;
+    for (int i = 1; i <= peers; i++) {
+        emu->peers[i].loading = 1;
+        res->routes += emu->peers[i].table->count;
+    }
+    uint64_t sent = 0;
+    int rc = emu_converge(emu, quiet_ms, &sent);
+    res->sent_ms = emu_ms(start, sent);
+    res->load_ms = emu_ms(start, emu->last_change);
+    res->prefixes = emu->expected;
+    for (int i = 1; i <= peers; i++) {
+        res->load_updates += emu->peers[i].updates_out;
+    }
+    if (rc < 0) {
+        fprintf(stderr, "Table load did not converge: observer holds %zu of %zu prefixes, "
+                "%d of %d sentinels\n", emu->seen_count, emu->expected, emu->sentinels_seen,
+                emu->sentinels);
+        emu_stop_sessions(emu);
+        return -1;
+    }
+
+    /* Churn at a fixed rate, then wait for the speaker to settle */
+    if (churn_rate > 0 && churn_s > 0) {
+        start = emu_now_ns();
+        uint64_t end = start + churn_s * 1000000000ULL;
+        unsigned long observed = emu->observed;
+        uint64_t now;
+        while ((now = emu_now_ns()) < end && !stop_requested) {
+            double due = churn_rate * (now - start) / 1e9;
+            while (res->churn_events < due && emu_churn_event(emu, path_change_pct)) {
+                res->churn_events++;
+            }
+            emu_poll(emu, 1);
+        }
+        res->churn_ms = emu_ms(start, now);
+        for (int i = 1; i <= peers; i++) {
+            struct emu_peer *peer = &emu->peers[i];
+            uint8_t msg[BGP_MAX_MESSAGE];
+            size_t len = peer->sentinel ? emu_encode_sentinel(peer, 0, msg) : 0;
+            if (len > 0) {
+                emu_send(peer, msg, len);
+            }
+        }
+        if (emu_converge(emu, quiet_ms, NULL) < 0) {
+            fprintf(stderr, "Churn did not converge: observer holds %zu of %zu prefixes, "
+                    "%d sentinels\n", emu->seen_count, emu->expected, emu->sentinels_seen);
+            emu_stop_sessions(emu);
+            return -1;
+        }
+        res->churn_observed = emu->observed - observed;
+        res->churn_settle_ms = emu_ms(now, emu->last_change);
+    }
+
+    /* Teardown: drop the injecting sessions, wait for the withdrawals */
+    start = emu_now_ns();
+    emu->last_change = start;
+    for (int i = 1; i <= peers; i++) {
+        emu_close(&emu->peers[i]);
+        memset(emu->peers[i].announced, 0, (emu->peers[i].table->count + 7) / 8);
+    }
+    memset(emu->announcers, 0, emu->num_prefixes * sizeof(*emu->announcers));
+    emu->expected = 0;
+    rc = emu_converge(emu, quiet_ms, NULL);
+    res->teardown_ms = emu_ms(start, emu->last_change);
+    if (rc < 0) {
+        fprintf(stderr, "Teardown did not converge: observer still holds %zu prefixes\n",
+                emu->seen_count);
+    }
+    res->converged = rc == 0 && emu->failures == 0;
+    emu_stop_sessions(emu);
+    return rc;
+}
+
+/* Function to print one run's results */
+static void emu_print_result(const struct emu *emu, const struct emu_result *r) {
+    printf("%d peers (run %d): sessions up in %.0f ms\n", r->peers, r->run, r->setup_ms);
+    printf("  load: %lu routes, %zu prefixes in %lu UPDATEs; sent in %.0f ms, "
+           "converged in %.0f ms (%.0f routes/s, %.0f UPDATEs/s)\n",
+           r->routes, r->prefixes, r->load_updates, r->sent_ms, r->load_ms,
+           r->load_ms > 0 ? r->routes / (r->load_ms / 1000) : 0,
+           r->load_ms > 0 ? r->load_updates / (r->load_ms / 1000) : 0);
+    if (r->churn_ms > 0) {
+        printf("  churn: %lu events in %.0f ms (%.0f/s), %lu UPDATEs observed, "
+               "settled %.0f ms after the last event\n",
+               r->churn_events, r->churn_ms, r->churn_events / (r->churn_ms / 1000),
+               r->churn_observed, r->churn_settle_ms);
+    }
+    printf("  teardown: withdrawn in %.0f ms%s\n", r->teardown_ms,
+           r->converged ? "" : " (did not converge)");
+    if (emu->foreign > 0) {
+        printf("  note: the speaker advertised %lu prefixes no peer injected\n", emu->foreign);
+    }
+}
+
+/* Function to append one run's results to the CSV file */
+static void emu_write_csv(FILE *csv, const struct emu_result *r) {
+    fprintf(csv, "%d,%d,%lu,%zu,%lu,%.1f,%.1f,%.1f,%.0f,%.0f,%lu,%.1f,%lu,%.1f,%.1f,%d\n",
+            r->peers, r->run, r->routes, r->prefixes, r->load_updates, r->setup_ms,
+            r->sent_ms, r->load_ms, r->load_ms > 0 ? r->routes / (r->load_ms / 1000) : 0,
+            r->load_ms > 0 ? r->load_updates / (r->load_ms / 1000) : 0, r->churn_events,
+            r->churn_ms, r->churn_observed, r->churn_settle_ms, r->teardown_ms, r->converged);
+    fflush(csv);
+}
+
+/* Function to parse the -n list; returns the number of points or -1 */
+static int emu_parse_points(const char *arg, int *points) {
+    int n = 0;
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 1 || v > EMU_MAX_PEERS || n == EMU_MAX_POINTS ||
+            (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        points[n++] = v;
+        p = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+/* Main function: Entry point of the peer emulator */
+int main(int argc, char *argv[]) {
+    static struct emu emu;
+    emu.hold_time = EMU_HOLD_TIME;
+    emu.seed = 1;
+    int points[EMU_MAX_POINTS] = { 10 };
+    int num_points = 1;
+    char *mrt_files[EMU_MAX_MRT];
+    int num_mrt = 0;
+    long synth = 0;
+    double churn_rate = 0;
+    int churn_s = 10;
+    int path_change_pct = 20;
+    int quiet_ms = EMU_QUIET_MS;
+    int repeats = 1;
+    const char *csv_path = NULL;
+
+    /* Parse options */
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:g:c:d:x:s:q:r:o:t:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_points = emu_parse_points(optarg, points);
+            if (num_points < 0) {
+                fprintf(stderr, "Invalid peer counts: %s (1-%d each, at most %d)\n", optarg,
+                        EMU_MAX_PEERS, EMU_MAX_POINTS);
+                exit(1);
+            }
+            break;
+        case 'm':
+            if (num_mrt == EMU_MAX_MRT) {
+                fprintf(stderr, "Too many MRT files (max %d)\n", EMU_MAX_MRT);
+                exit(1);
+            }
+            mrt_files[num_mrt++] = optarg;
+            break;
+        case 'g':
+            synth = atol(optarg);
+            break;
+        case 'c':
+            churn_rate = atof(optarg);
+            break;
+        case 'd':
+            churn_s = atoi(optarg);
+            break;
+        case 'x':
+            path_change_pct = atoi(optarg);
+            break;
+        case 's':
+            emu.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'q':
+            quiet_ms = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+        case 't':
+            emu.hold_time = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    /* Remaining arguments: the speaker's address and port */
+    if (argc - optind != 2 || synth < 0 || synth > EMU_MAX_PREFIXES || repeats < 1 ||
+        quiet_ms < 1 || (emu.hold_time != 0 && emu.hold_time < 3) ||
+        path_change_pct < 0 || path_change_pct > 100) {
+usage:
+        fprintf(stderr, "Usage: %s [-n peers[,peers...]] [-m dump.mrt]... [-g prefixes]\n"
+                        "          [-c events/s [-d seconds] [-x path_change_pct]] [-s seed]\n"
+                        "          [-q quiet_ms] [-r repeats] [-o results.csv] [-t hold_time]\n"
+                        "          <speaker_ip> <speaker_port>\n", argv[0]);
+        fprintf(stderr, "  -n  injecting peers per run; a list gives a scaling curve (default 10)\n"
+                        "  -m  inject the routes of each MRT dump peer, round-robin over the peers\n"
+                        "  -g  synthetic table size when no -m is given (default %d)\n"
+                        "  -c  churn events per second after the table load (default 0: none)\n"
+                        "  -d  churn duration in seconds (default 10)\n"
+                        "  -x  share of churn events on announced routes that change the path\n"
+                        "      instead of withdrawing (default 20)\n"
+                        "  -s  seed for synthetic paths and churn (default 1)\n"
+                        "  -q  silence that marks convergence (default %d ms)\n"
+                        "  -r  runs per peer count (default 1)\n"
+                        "  -o  append one CSV row per run\n",
+                EMU_DEFAULT_PREFIXES, EMU_QUIET_MS);
+        fprintf(stderr, "The speaker must accept unconfigured peers, e.g. bgp_sim -l 1179 -a 65001\n");
+        fprintf(stderr, "Example: %s -n 10,50,100 -g 500000 -c 5000 -o scale.csv 127.0.0.1 1179\n",
+                argv[0]);
+        exit(1);
+    }
+    emu.speaker.sin_family = AF_INET;
+    emu.speaker.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &emu.speaker.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid speaker address: %s\n", argv[optind]);
+        exit(1);
+    }
+    int max_peers = 0;
+    for (int i = 0; i < num_points; i++) {
+        max_peers = points[i] > max_peers ? points[i] : max_peers;
+    }
+
+    /* One descriptor per session, plus MRT files and the epoll instance */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)max_peers + 64) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)max_peers + 64 ? rl.rlim_max : (rlim_t)max_peers + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    /* Build the tables */
+    bgp_rib_init(&emu.rib);
+    bgp_mrt_source_init(&emu.mrt);
+    if (num_mrt > 0) {
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 0; i < num_mrt; i++) {
+            if (bgp_mrt_load(&emu.rib, &emu.mrt, mrt_files[i], 0, threads) < 0) {
+                exit(1);
+            }
+        }
+        if (emu_mrt_tables(&emu) < 0) {
+            fprintf(stderr, "No routes to inject from the MRT dumps\n");
+            exit(1);
+        }
+        printf("Loaded %d peer tables, %zu prefixes from %d MRT files\n", emu.num_tables,
+               emu.num_prefixes, num_mrt);
+    } else if (emu_synth_table(&emu, synth > 0 ? synth : EMU_DEFAULT_PREFIXES) < 0) {
+        fprintf(stderr, "Out of memory generating the synthetic table\n");
+        exit(1);
+    }
+    emu.announcers = calloc(emu.num_prefixes, sizeof(*emu.announcers));
+    emu.seen = calloc(emu.num_prefixes, 1);
+    emu.peers = calloc(max_peers + 1, sizeof(*emu.peers));
+    if (!emu.announcers || !emu.seen || !emu.peers) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    /* Peers: the observer, then injecting peers with their tables */
+    emu.epfd = epoll_create1(0);
+    if (emu.epfd < 0) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+    for (int i = 0; i <= max_peers; i++) {
+        struct emu_peer *peer = &emu.peers[i];
+        peer->emu = &emu;
+        peer->index = i;
+        peer->fd = -1;
+        peer->addr = EMU_BASE_ADDR + i;
+        peer->as = EMU_BASE_AS + i;
+        bgp_outq_init(&peer->outq);
+        if (bgp_rxring_init(&peer->rx, BGP_RX_RING_SIZE) < 0) {
+            exit(1);
+        }
+        if (i > 0) {
+            peer->table = &emu.tables[(i - 1) % emu.num_tables];
+            peer->announced = calloc((peer->table->count + 7) / 8, 1);
+            if (!peer->announced) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+        }
+    }
+
+    FILE *csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "a");
+        if (!csv) {
+            perror("Failed to open the CSV file");
+            exit(1);
+        }
+        fseek(csv, 0, SEEK_END);
+        if (ftell(csv) == 0) {
+            fprintf(csv, "peers,run,routes,prefixes,load_updates,setup_ms,sent_ms,load_ms,"
+                         "routes_per_s,updates_per_s,churn_events,churn_ms,churn_observed,"
+                         "churn_settle_ms,teardown_ms,converged\n");
+        }
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Run every point of the curve */
+    int failed = 0;
+    for (int p = 0; p < num_points && !stop_requested; p++) {
+        for (int run = 1; run <= repeats && !stop_requested; run++) {
+            struct emu_result res;
+            if (emu_run(&emu, points[p], run, churn_rate, churn_s, path_change_pct,
+                        quiet_ms, &res) < 0) {
+                failed = 1;
+                continue;
+            }
+            emu_print_result(&emu, &res);
+            if (csv) {
+                emu_write_csv(csv, &res);
+            }
+        }
+    }
+
+    /* Cleanup */
+    if (csv) {
+        fclose(csv);
+    }
+    for (int i = 0; i <= max_peers; i++) {
+        emu_close(&emu.peers[i]);
+        bgp_rxring_free(&emu.peers[i].rx);
+        free(emu.peers[i].announced);
+    }
+    for (int t = 0; t < emu.num_tables; t++) {
+        free(emu.tables[t].routes);
+        free(emu.tables[t].sets);
+    }
+    free(emu.tables);
+    free(emu.prefixes);
+    free(emu.announcers);
+    free(emu.seen);
+    free(emu.peers);
+    bgp_mrt_source_free(&emu.rib, &emu.mrt);
+    bgp_rib_destroy(&emu.rib);
+    close(emu.epfd);
+    return failed;
+}
@@ -0,0 +1,452 @@
+/* bgp_rib.c: Adj-RIB-In and Loc-RIB storage for the BGP speaker (see include/bgp_rib.h).
+ * Destinations and paths come from object pools so a full table costs a few
+ * hundred bytes per route instead of several malloc headers each. Best-path
+ * selection follows the RFC 4271 section 9.1.2.2 tie-breaking rules and runs
+ * from the dirty-destination queue, not from the UPDATE path. */
+
+/* Include standard libraries and RIB definitions */
+#include <stdio.h>      /* For fprintf */
+#include <stdlib.h>     /* For realloc, free */
+#include "bgp_rib.h"    /* For struct bgp_rib, struct bgp_dest, struct bgp_path */
+
+/* Objects carved per pool block */
+#define RIB_POOL_BLOCK 8192
+
+/* Function to initialize an empty RIB */
+void bgp_rib_init(struct bgp_rib *rib) {
+    ptrie_init(&rib->trie);
+    pool_init(&rib->dest_pool, sizeof(struct bgp_dest), RIB_POOL_BLOCK, 0);
+    pool_init(&rib->path_pool, sizeof(struct bgp_path), RIB_POOL_BLOCK, 0);
+    bgp_attr_table_init(&rib->attrs);
+    rib->dirty = NULL;
+    rib->dirty_count = rib->dirty_cap = 0;
+    rib->cand = NULL;
+    rib->cand_cap = 0;
+    rib->notify = NULL;
+    rib->notify_arg = NULL;
+    rib->rpki = NULL;
+    rib->reject_invalid = 0;
+    for (int i = 0; i < BGP_RPKI_STATES; i++) {
+        rib->rpki_paths[i] = 0;
+    }
+    rib->best_changes = 0;
+    rib->marks = rib->coalesced = rib->selections = 0;
+}
+
+/* Function to tear down the RIB */
+void bgp_rib_destroy(struct bgp_rib *rib) {
+    ptrie_destroy(&rib->trie, NULL);
+    pool_destroy(&rib->dest_pool);
+    pool_destroy(&rib->path_pool);
+    bgp_attr_table_destroy(&rib->attrs);
+    free(rib->dirty);
+    free(rib->cand);
+    rib->dirty = NULL;
+    rib->cand = NULL;
+    rib->dirty_count = rib->dirty_cap = rib->cand_cap = 0;
+}
+
+/* Function to prepare an empty Adj-RIB-In */
+void bgp_adj_in_init(struct bgp_adj_in *adj, uint32_t peer_id, uint32_t peer_addr,
+                     uint32_t peer_as, int ebgp) {
+    adj->paths = NULL;
+    adj->count = 0;
+    adj->peer_id = peer_id;
+    adj->peer_addr = peer_addr;
+    adj->peer_as = peer_as;
+    adj->ebgp = ebgp;
+}
+
+/* Degree of preference of a path: LOCAL_PREF from internal peers, the default
+ * for external ones (their LOCAL_PREF is not meaningful to us) */
+static uint32_t bgp_path_pref(const struct bgp_path *path) {
+    if (!path->peer->ebgp && (path->attrs->flags & BGP_ATTRF_LOCAL_PREF)) {
+        return path->attrs->local_pref;
+    }
+    return BGP_DEFAULT_LOCAL_PREF;
+}
+
+/* MULTI_EXIT_DISC of a path; a missing MED counts as the lowest value */
+static uint32_t bgp_path_med(const struct bgp_path *path) {
+    return (path->attrs->flags & BGP_ATTRF_MED) ? path->attrs->med : 0;
+}
+
+/* Function to run the decision process over a destination's paths (RFC 4271
+ * section 9.1.2.2). Each rule drops the candidates that lose it; whatever
+ * survives the last rule is the best path. */
+static struct bgp_path *bgp_decide(struct bgp_rib *rib, struct bgp_dest *dest) {
+    struct bgp_path **c = rib->cand;
+    size_t n = 0, m, i, j;
+
+    for (struct bgp_path *path = dest->paths; path; path = path->next) {
+        if (rib->reject_invalid && path->rpki == BGP_RPKI_INVALID) {
+            continue; /* Local policy: RPKI Invalid routes are not eligible */
+        }
+        if (n == rib->cand_cap) {
+            size_t cap = rib->cand_cap ? rib->cand_cap * 2 : 16;
+            struct bgp_path **grown = realloc(rib->cand, cap * sizeof(*grown));
+            if (!grown) {
+                break; /* Decide among the candidates collected so far */
+            }
+            rib->cand = c = grown;
+            rib->cand_cap = cap;
+        }
+        c[n++] = path;
+    }
+    if (n <= 1) {
+        return n ? c[0] : NULL;
+    }
+
+    /* Rules a) to d) only look at attributes; interned sets that are the same
+     * pointer compare equal without reading them */
+    for (i = 1; i < n && c[i]->attrs == c[0]->attrs && c[i]->peer->ebgp == c[0]->peer->ebgp; i++) {
+    }
+    if (i < n) {
+        /* a) Highest degree of preference */
+        uint32_t pref = 0;
+        for (i = 0; i < n; i++) {
+            if (bgp_path_pref(c[i]) > pref) {
+                pref = bgp_path_pref(c[i]);
+            }
+        }
+        for (i = m = 0; i < n; i++) {
+            if (bgp_path_pref(c[i]) == pref) {
+                c[m++] = c[i];
+            }
+        }
+        n = m;
+
+        /* b) Fewest AS numbers in the AS_PATH */
+        uint16_t hops = UINT16_MAX;
+        for (i = 0; i < n; i++) {
+            if (c[i]->attrs->as_path_hops < hops) {
+                hops = c[i]->attrs->as_path_hops;
+            }
+        }
+        for (i = m = 0; i < n; i++) {
+            if (c[i]->attrs->as_path_hops == hops) {
+                c[m++] = c[i];
+            }
+        }
+        n = m;
+
+        /* c) Lowest ORIGIN */
+        uint8_t origin = UINT8_MAX;
+        for (i = 0; i < n; i++) {
+            if (c[i]->attrs->origin < origin) {
+                origin = c[i]->attrs->origin;
+            }
+        }
+        for (i = m = 0; i < n; i++) {
+            if (c[i]->attrs->origin == origin) {
+                c[m++] = c[i];
+            }
+        }
+        n = m;
+
+        /* d) MED, compared only between routes from the same neighbor AS: drop a
+         * route if another one from that AS has a lower MED */
+        for (i = m = 0; i < n; i++) {
+            uint32_t as = bgp_attrs_neighbor_as(c[i]->attrs);
+            for (j = 0; j < n; j++) {
+                if (c[j]->attrs != c[i]->attrs && bgp_path_med(c[j]) < bgp_path_med(c[i]) &&
+                    bgp_attrs_neighbor_as(c[j]->attrs) == as) {
+                    break;
+                }
+            }
+            if (j == n) {
+                c[m++] = c[i];
+            }
+        }
+        n = m;
+    }
+
+    /* e) Routes from external peers over routes from internal peers */
+    for (i = 0; i < n && !c[i]->peer->ebgp; i++) {
+    }
+    if (i < n) {
+        for (i = m = 0; i < n; i++) {
+            if (c[i]->peer->ebgp) {
+                c[m++] = c[i];
+            }
+        }
+        n = m;
+    }
+
+    /* f) Interior cost to the NEXT_HOP is the same for every route here: the
+     * speaker runs no IGP. g) Lowest BGP Identifier, then h) lowest peer address */
+    struct bgp_path *best = c[0];
+    for (i = 1; i < n; i++) {
+        const struct bgp_adj_in *a = c[i]->peer, *b = best->peer;
+        if (a->peer_id < b->peer_id || (a->peer_id == b->peer_id && a->peer_addr < b->peer_addr)) {
+            best = c[i];
+        }
+    }
+    return best;
+}
+
+/* Function to re-select the Loc-RIB route of one destination */
+static void bgp_select_best(struct bgp_rib *rib, struct bgp_dest *dest) {
+    struct bgp_path *best = bgp_decide(rib, dest);
+    rib->selections++;
+    if (best != dest->best || dest->best_updated) {
+        dest->best = best;
+        dest->best_updated = 0;
+        rib->best_changes++;
+        if (rib->notify) {
+            rib->notify(dest, rib->notify_arg);
+        }
+    }
+}
+
+/* Function to queue a destination for best-path selection */
+static void bgp_mark_dirty(struct bgp_rib *rib, struct bgp_dest *dest) {
+    rib->marks++;
+    if (dest->dirty) {
+        rib->coalesced++;
+        return;
+    }
+    if (rib->dirty_count == rib->dirty_cap) {
+        size_t cap = rib->dirty_cap ? rib->dirty_cap * 2 : 1024;
+        struct bgp_dest **grown = realloc(rib->dirty, cap * sizeof(*grown));
+        if (!grown) {
+            /* No room to defer: decide now (an empty destination stays in the
+             * trie with no best path until it is touched again) */
+            bgp_select_best(rib, dest);
+            return;
+        }
+        rib->dirty = grown;
+        rib->dirty_cap = cap;
+    }
+    dest->dirty = 1;
+    rib->dirty[rib->dirty_count++] = dest;
+}
+
+/* Function to validate the origin of a path's route */
+static uint8_t bgp_path_validate(const struct bgp_rib *rib, const struct bgp_dest *dest,
+                                 const struct bgp_attrs *attrs) {
+    if (!rib->rpki) {
+        return BGP_RPKI_NOT_FOUND;
+    }
+    return bgp_rpki_validate(rib->rpki, dest->prefix, dest->plen, bgp_attrs_origin_as(attrs));
+}
+
+/* Function to find the path a peer holds for a destination */
+static struct bgp_path **bgp_find_path(struct bgp_dest *dest, const struct bgp_adj_in *adj) {
+    struct bgp_path **link = &dest->paths;
+    while (*link && (*link)->peer != adj) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/* Function to install or replace a peer's path */
+int bgp_rib_update(struct bgp_rib *rib, struct bgp_adj_in *adj, uint32_t prefix,
+                   uint8_t plen, const struct bgp_attrs *attrs) {
+    void **slot = ptrie_insert(&rib->trie, prefix, plen);
+    if (!slot) {
+        return -1;
+    }
+    struct bgp_dest *dest = *slot;
+    int created = 0;
+    if (!dest) {
+        dest = pool_alloc(&rib->dest_pool);
+        if (!dest) {
+            ptrie_abort_insert(&rib->trie, prefix, plen);
+            return -1;
+        }
+        dest->paths = NULL;
+        dest->best = NULL;
+        dest->prefix = prefix & ptrie_mask(plen);
+        dest->plen = plen;
+        dest->dirty = 0;
+        dest->best_updated = 0;
+        *slot = dest;
+        created = 1;
+    }
+
+    struct bgp_path *path = *bgp_find_path(dest, adj);
+    if (path) {
+        /* Re-announcement with identical attributes changes nothing */
+        if (path->attrs == attrs) {
+            return 0;
+        }
+        /* Implicit withdraw: the new attributes replace the old ones */
+        bgp_attr_unref(&rib->attrs, path->attrs);
+        rib->rpki_paths[path->rpki]--;
+        if (path == dest->best) {
+            dest->best_updated = 1;
+        }
+    } else {
+        path = pool_alloc(&rib->path_pool);
+        if (!path) {
+            if (created) {
+                ptrie_remove(&rib->trie, prefix, plen);
+                pool_free(&rib->dest_pool, dest);
+            }
+            return -1;
+        }
+        path->dest = dest;
+        path->peer = adj;
+        path->next = dest->paths;
+        dest->paths = path;
+        path->adj_prev = NULL;
+        path->adj_next = adj->paths;
+        if (adj->paths) {
+            adj->paths->adj_prev = path;
+        }
+        adj->paths = path;
+        adj->count++;
+    }
+    bgp_attr_ref(attrs);
+    path->attrs = attrs;
+    path->rpki = bgp_path_validate(rib, dest, attrs);
+    rib->rpki_paths[path->rpki]++;
+
+    bgp_mark_dirty(rib, dest);
+    return 0;
+}
+
+/* Function to unlink and free one path and queue its destination */
+static void bgp_path_remove(struct bgp_rib *rib, struct bgp_path *path) {
+    struct bgp_dest *dest = path->dest;
+    struct bgp_adj_in *adj = path->peer;
+
+    *bgp_find_path(dest, adj) = path->next;
+    if (path->adj_prev) {
+        path->adj_prev->adj_next = path->adj_next;
+    } else {
+        adj->paths = path->adj_next;
+    }
+    if (path->adj_next) {
+        path->adj_next->adj_prev = path->adj_prev;
+    }
+    adj->count--;
+
+    bgp_attr_unref(&rib->attrs, path->attrs);
+    rib->rpki_paths[path->rpki]--;
+    pool_free(&rib->path_pool, path);
+
+    if (dest->best == path) {
+        /* Never leave the Loc-RIB pointing at freed memory. The change is reported
+         * when the destination is decided, even if no remaining path is usable
+         * (best stays NULL) */
+        dest->best = NULL;
+        dest->best_updated = 1;
+        if (!dest->paths) {
+            rib->best_changes++;
+        }
+    }
+    bgp_mark_dirty(rib, dest);
+}
+
+/* Function to drain the dirty queue */
+size_t bgp_rib_process(struct bgp_rib *rib, size_t budget) {
+    size_t done = 0;
+    while (rib->dirty_count > 0 && (budget == 0 || done < budget)) {
+        struct bgp_dest *dest = rib->dirty[--rib->dirty_count];
+        dest->dirty = 0;
+        done++;
+        if (!dest->paths) {
+            if (rib->notify) {
+                rib->notify(dest, rib->notify_arg);
+            }
+            ptrie_remove(&rib->trie, dest->prefix, dest->plen);
+            pool_free(&rib->dest_pool, dest);
+            continue;
+        }
+        bgp_select_best(rib, dest);
+    }
+    return done;
+}
+
+/* Function to withdraw one prefix from a peer */
+int bgp_rib_withdraw(struct bgp_rib *rib, struct bgp_adj_in *adj, uint32_t prefix,
+                     uint8_t plen) {
+    struct bgp_dest *dest = ptrie_lookup(&rib->trie, prefix, plen);
+    if (!dest) {
+        return 0;
+    }
+    struct bgp_path *path = *bgp_find_path(dest, adj);
+    if (!path) {
+        return 0;
+    }
+    bgp_path_remove(rib, path);
+    return 1;
+}
+
+/* Function to flush a peer's Adj-RIB-In (session went down) */
+unsigned long bgp_rib_withdraw_peer(struct bgp_rib *rib, struct bgp_adj_in *adj) {
+    unsigned long removed = 0;
+    while (adj->paths) {
+        bgp_path_remove(rib, adj->paths);
+        removed++;
+    }
+    return removed;
+}
+
+/* Function to refresh the validation state of a destination's paths */
+void bgp_rib_revalidate(struct bgp_rib *rib, struct bgp_dest *dest) {
+    int eligibility_changed = 0;
+    for (struct bgp_path *path = dest->paths; path; path = path->next) {
+        uint8_t state = bgp_path_validate(rib, dest, path->attrs);
+        if (state != path->rpki) {
+            eligibility_changed |= state == BGP_RPKI_INVALID || path->rpki == BGP_RPKI_INVALID;
+            rib->rpki_paths[path->rpki]--;
+            rib->rpki_paths[state]++;
+            path->rpki = state;
+        }
+    }
+    if (rib->reject_invalid && eligibility_changed) {
+        bgp_mark_dirty(rib, dest);
+    }
+}
+
+/* Function to find a destination by exact prefix */
+struct bgp_dest *bgp_rib_lookup(const struct bgp_rib *rib, uint32_t prefix, uint8_t plen) {
+    return ptrie_lookup(&rib->trie, prefix, plen);
+}
+
+/* Walk callback: remember the longest covering destination with a best path */
+static int bgp_lpm_visit(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    struct bgp_dest *dest = data;
+    if (dest->best) {
+        *(struct bgp_dest **)arg = dest;
+    }
+    return 0;
+}
+
+/* Function to find the most specific usable destination for an address */
+struct bgp_dest *bgp_rib_lpm(const struct bgp_rib *rib, uint32_t addr) {
+    struct bgp_dest *found = NULL;
+    ptrie_walk_covering(&rib->trie, addr, 32, bgp_lpm_visit, &found);
+    return found;
+}
+
+/* Function to print RIB counters and memory use */
+void bgp_rib_stats(const struct bgp_rib *rib, FILE *out) {
+    unsigned long trie = ptrie_bytes(&rib->trie);
+    unsigned long dests = pool_bytes(&rib->dest_pool);
+    unsigned long paths = pool_bytes(&rib->path_pool);
+    unsigned long attrs = rib->attrs.bytes + rib->attrs.num_buckets * sizeof(void *);
+    fprintf(out, "RIB: %lu prefixes, %zu paths, %lu best-path changes\n",
+            rib->trie.count, rib->path_pool.in_use, rib->best_changes);
+    fprintf(out, "RIB decisions: %lu changes, %lu coalesced, %lu selections, %zu queued\n",
+            rib->marks, rib->coalesced, rib->selections, rib->dirty_count);
+    fprintf(out, "RIB attributes: %zu unique sets, %.1f paths per set, %.1f%% intern hits\n",
+            rib->attrs.count,
+            rib->attrs.count ? (double)rib->path_pool.in_use / rib->attrs.count : 0.0,
+            rib->attrs.lookups ? 100.0 * rib->attrs.hits / rib->attrs.lookups : 0.0);
+    fprintf(out, "RIB memory: trie %.1f MB, destinations %.1f MB, paths %.1f MB, "
+            "attributes %.1f MB, total %.1f MB\n",
+            trie / 1048576.0, dests / 1048576.0, paths / 1048576.0, attrs / 1048576.0,
+            (trie + dests + paths + attrs) / 1048576.0);
+    if (rib->rpki) {
+        fprintf(out, "RIB origin validation: %lu valid, %lu invalid, %lu not found "
+                "(%zu VRPs%s)\n", rib->rpki_paths[BGP_RPKI_VALID],
+                rib->rpki_paths[BGP_RPKI_INVALID], rib->rpki_paths[BGP_RPKI_NOT_FOUND],
+                rib->rpki->num_vrps, rib->reject_invalid ? ", invalid rejected" : "");
+    }
+}
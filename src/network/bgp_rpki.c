@@ -0,0 +1,457 @@
+/* bgp_rpki.c: RPKI route origin validation for the BGP speaker (see
+ * include/bgp_rpki.h). Accepts the JSON export of common relying-party software
+ * ({"roas": [{"asn": "AS13335", "prefix": "1.0.0.0/24", "maxLength": 24}, ...]})
+ * and the matching CSV export (ASN,IP Prefix,Max Length[,Trust Anchor]). */
+
+/* Include standard libraries and BGP definitions */
+#include <stdio.h>      /* For FILE, fopen, fread, perror */
+#include <stdlib.h>     /* For malloc, realloc, free, qsort, strtoul */
+#include <string.h>     /* For memcmp, memchr */
+#include <arpa/inet.h>  /* For inet_pton (prefix parsing) */
+#include "bgp_rib.h"    /* For struct bgp_rib, bgp_rib_revalidate */
+#include "bgp_rpki.h"   /* For struct bgp_rpki, struct bgp_vrp */
+
+/* A VRP set being built from a file */
+struct rpki_set {
+    struct bgp_vrp *vrps; /* Parsed entries */
+    size_t count;         /* Entries used */
+    size_t cap;           /* Capacity of vrps[] */
+    unsigned long skipped; /* IPv6 entries */
+    unsigned long errors;  /* Malformed entries */
+    int failed;            /* 1 = out of memory */
+};
+
+/* Function to prepare an empty VRP set */
+void bgp_rpki_init(struct bgp_rpki *r) {
+    memset(r, 0, sizeof(*r));
+    ptrie_init(&r->index);
+}
+
+/* Function to free the VRP set */
+void bgp_rpki_free(struct bgp_rpki *r) {
+    ptrie_destroy(&r->index, NULL);
+    free(r->vrps);
+    r->vrps = NULL;
+    r->num_vrps = 0;
+}
+
+/* Function to name a validation state */
+const char *bgp_rpki_state_name(int state) {
+    static const char *names[] = { "NotFound", "Valid", "Invalid" };
+    return state >= 0 && state < BGP_RPKI_STATES ? names[state] : "?";
+}
+
+/* Function to parse "a.b.c.d/len". Returns 0, 1 for an IPv6 prefix, or -1. */
+static int rpki_parse_prefix(const char *s, size_t len, uint32_t *prefix, uint8_t *plen) {
+    char buf[64];
+    if (len == 0 || len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    if (memchr(buf, ':', len)) {
+        return 1;
+    }
+    char *slash = strchr(buf, '/');
+    if (!slash) {
+        return -1;
+    }
+    *slash = '\0';
+    char *end;
+    unsigned long l = strtoul(slash + 1, &end, 10);
+    struct in_addr a;
+    if (end == slash + 1 || *end != '\0' || l > 32 || inet_pton(AF_INET, buf, &a) != 1) {
+        return -1;
+    }
+    *prefix = ntohl(a.s_addr) & ptrie_mask(l);
+    *plen = l;
+    return 0;
+}
+
+/* Function to parse "AS64496" or "64496". Returns 0, or -1. */
+static int rpki_parse_asn(const char *s, size_t len, uint32_t *asn) {
+    char buf[16];
+    if (len >= 2 && (s[0] == 'A' || s[0] == 'a') && (s[1] == 'S' || s[1] == 's')) {
+        s += 2;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    char *end;
+    unsigned long long v = strtoull(buf, &end, 10);
+    if (*end != '\0' || v > UINT32_MAX) {
+        return -1;
+    }
+    *asn = v;
+    return 0;
+}
+
+/* Function to add one entry from the file, given as its three text fields
+ * (max_len may be empty: it then equals the prefix length) */
+static void rpki_add(struct rpki_set *set, const char *asn, size_t asn_len, const char *prefix,
+                     size_t prefix_len, const char *max_len, size_t max_len_len) {
+    struct bgp_vrp v;
+    int rc = rpki_parse_prefix(prefix, prefix_len, &v.prefix, &v.plen);
+    if (rc > 0) {
+        set->skipped++;
+        return;
+    }
+    unsigned long ml = v.plen;
+    if (max_len_len > 0) {
+        char buf[8];
+        char *end;
+        if (max_len_len >= sizeof(buf)) {
+            rc = -1;
+        } else {
+            memcpy(buf, max_len, max_len_len);
+            buf[max_len_len] = '\0';
+            ml = strtoul(buf, &end, 10);
+            if (*end != '\0') {
+                rc = -1;
+            }
+        }
+    }
+    if (rc < 0 || rpki_parse_asn(asn, asn_len, &v.asn) < 0 || ml < v.plen || ml > 32) {
+        set->errors++;
+        return;
+    }
+    v.max_len = ml;
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 4096;
+        struct bgp_vrp *grown = realloc(set->vrps, cap * sizeof(*grown));
+        if (!grown) {
+            set->failed = 1;
+            return;
+        }
+        set->vrps = grown;
+        set->cap = cap;
+    }
+    set->vrps[set->count++] = v;
+}
+
+/* Function to read the VRP objects of a JSON export. Every object that has
+ * "prefix" and "asn" members is a VRP; nesting and other members are ignored. */
+static void rpki_parse_json(struct rpki_set *set, const char *p, const char *end) {
+    const char *key = NULL, *asn = NULL, *prefix = NULL, *max_len = NULL;
+    size_t key_len = 0, asn_len = 0, prefix_len = 0, max_len_len = 0;
+    while (p < end && !set->failed) {
+        char c = *p;
+        if (c == '{' || c == '}') {
+            if (c == '}' && asn && prefix) {
+                rpki_add(set, asn, asn_len, prefix, prefix_len, max_len,
+                         max_len ? max_len_len : 0);
+            }
+            asn = prefix = max_len = key = NULL;
+            p++;
+            continue;
+        }
+        if (c != '"' && c != '-' && (c < '0' || c > '9')) {
+            p++;
+            continue;
+        }
+        /* A string or number token */
+        const char *tok = p;
+        if (c == '"') {
+            tok = ++p;
+            while (p < end && *p != '"') {
+                p += *p == '\\' ? 2 : 1;
+            }
+        } else {
+            while (p < end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '.')) {
+                p++;
+            }
+        }
+        size_t tok_len = (p < end ? p : end) - tok;
+        if (c == '"') {
+            p++;
+        }
+        const char *q = p;
+        while (q < end && (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\n')) {
+            q++;
+        }
+        if (q < end && *q == ':') {
+            key = tok; /* The token names the value that follows */
+            key_len = tok_len;
+            p = q + 1;
+            continue;
+        }
+        if (key) {
+            if (key_len == 3 && memcmp(key, "asn", 3) == 0) {
+                asn = tok;
+                asn_len = tok_len;
+            } else if (key_len == 6 && memcmp(key, "prefix", 6) == 0) {
+                prefix = tok;
+                prefix_len = tok_len;
+            } else if ((key_len == 9 && memcmp(key, "maxLength", 9) == 0) ||
+                       (key_len == 10 && memcmp(key, "max_length", 10) == 0)) {
+                max_len = tok;
+                max_len_len = tok_len;
+            }
+            key = NULL;
+        }
+    }
+}
+
+/* Function to read a CSV export: ASN,prefix,max length[,anything else]. A first
+ * line whose first field is not an AS number is the header; blank lines and
+ * '#' comments are skipped. */
+static void rpki_parse_csv(struct rpki_set *set, const char *p, const char *end) {
+    for (int line = 0; p < end && !set->failed; line++) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        const char *f[3];
+        size_t len[3];
+        int n = 0;
+        const char *s = p;
+        while (n < 3) {
+            const char *comma = memchr(s, ',', eol - s);
+            const char *fe = comma ? comma : eol;
+            while (s < fe && (*s == ' ' || *s == '"')) {
+                s++;
+            }
+            const char *te = fe;
+            while (te > s && (te[-1] == ' ' || te[-1] == '"' || te[-1] == '\r')) {
+                te--;
+            }
+            f[n] = s;
+            len[n++] = te - s;
+            if (!comma) {
+                break;
+            }
+            s = comma + 1;
+        }
+        uint32_t asn;
+        if (len[0] == 0 || f[0][0] == '#' ||
+            (line == 0 && rpki_parse_asn(f[0], len[0], &asn) < 0)) {
+            /* Blank, comment or header */
+        } else if (n < 2) {
+            set->errors++;
+        } else {
+            rpki_add(set, f[0], len[0], f[1], len[1], n > 2 ? f[2] : "", n > 2 ? len[2] : 0);
+        }
+        p = eol + 1;
+    }
+}
+
+/* Function to order VRPs by prefix, length, AS and maximum length */
+static int rpki_vrp_cmp(const void *x, const void *y) {
+    const struct bgp_vrp *a = x, *b = y;
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    if (a->plen != b->plen) {
+        return a->plen < b->plen ? -1 : 1;
+    }
+    if (a->asn != b->asn) {
+        return a->asn < b->asn ? -1 : 1;
+    }
+    return (int)a->max_len - (int)b->max_len;
+}
+
+/* Function to read a whole file into a buffer */
+static char *rpki_read_file(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror("Failed to open VRP file");
+        return NULL;
+    }
+    size_t cap = 1 << 20, used = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        used += fread(buf + used, 1, cap - used, fp);
+        if (used < cap) {
+            break;
+        }
+        char *grown = realloc(buf, cap * 2);
+        if (!grown) {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        buf = grown;
+        cap *= 2;
+    }
+    if (!buf || ferror(fp)) {
+        perror("Failed to read VRP file");
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *len = used;
+    return buf;
+}
+
+/* Changed VRP prefixes collected while diffing two sets */
+struct rpki_changes {
+    struct bgp_vrp *v;  /* Prefix and length of each change (other fields unused) */
+    size_t count;       /* Entries used */
+};
+
+/* Function to order changes so that a covering prefix precedes what it covers */
+static int rpki_change_cmp(const void *x, const void *y) {
+    const struct bgp_vrp *a = x, *b = y;
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    return (int)a->plen - (int)b->plen;
+}
+
+/* RIB destinations revalidated after a load */
+struct rpki_reval {
+    struct bgp_rib *rib; /* RIB holding the routes */
+    long count;          /* Destinations visited */
+};
+
+/* Walk callback: revalidate one RIB destination */
+static int rpki_revalidate_dest(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    struct rpki_reval *rv = arg;
+    bgp_rib_revalidate(rv->rib, data);
+    rv->count++;
+    return 0;
+}
+
+/* Function to replace the VRP set from a file and revalidate what changed */
+long bgp_rpki_load(struct bgp_rpki *r, struct bgp_rib *rib, const char *path) {
+    size_t len;
+    char *buf = rpki_read_file(path, &len);
+    if (!buf) {
+        return -1;
+    }
+    struct rpki_set set;
+    memset(&set, 0, sizeof(set));
+    const char *p = buf;
+    while (p < buf + len && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    if (p < buf + len && (*p == '{' || *p == '[')) {
+        rpki_parse_json(&set, p, buf + len);
+    } else {
+        rpki_parse_csv(&set, p, buf + len);
+    }
+    free(buf);
+    if (set.failed) {
+        fprintf(stderr, "Out of memory loading VRPs from %s\n", path);
+        free(set.vrps);
+        return -1;
+    }
+    if (set.count == 0 && set.skipped == 0) {
+        /* Likely a truncated or foreign file; dropping every VRP would turn all
+         * Invalid routes back into NotFound */
+        fprintf(stderr, "No VRPs found in %s (%lu malformed entries)\n", path, set.errors);
+        free(set.vrps);
+        return -1;
+    }
+
+    /* Sort and drop duplicates (the same ROA from several trust anchors) */
+    qsort(set.vrps, set.count, sizeof(*set.vrps), rpki_vrp_cmp);
+    size_t n = 0;
+    for (size_t i = 0; i < set.count; i++) {
+        if (n == 0 || rpki_vrp_cmp(&set.vrps[n - 1], &set.vrps[i]) != 0) {
+            set.vrps[n++] = set.vrps[i];
+        }
+    }
+
+    /* Index the runs of VRPs sharing a prefix */
+    struct ptrie index;
+    ptrie_init(&index);
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && set.vrps[i].prefix == set.vrps[i - 1].prefix &&
+            set.vrps[i].plen == set.vrps[i - 1].plen) {
+            continue;
+        }
+        void **slot = ptrie_insert(&index, set.vrps[i].prefix, set.vrps[i].plen);
+        if (!slot) {
+            fprintf(stderr, "Out of memory indexing VRPs from %s\n", path);
+            ptrie_destroy(&index, NULL);
+            free(set.vrps);
+            return -1;
+        }
+        *slot = &set.vrps[i];
+    }
+
+    /* Merge the old and new sorted sets; every VRP in only one of them changes
+     * the validity of routes under its prefix */
+    struct rpki_changes changes = { malloc((r->num_vrps + n + 1) * sizeof(struct bgp_vrp)), 0 };
+    size_t i = 0, j = 0;
+    while (changes.v && (i < r->num_vrps || j < n)) {
+        int cmp = i == r->num_vrps ? 1 : j == n ? -1 : rpki_vrp_cmp(&r->vrps[i], &set.vrps[j]);
+        if (cmp == 0) {
+            i++;
+            j++;
+        } else {
+            changes.v[changes.count++] = cmp < 0 ? r->vrps[i++] : set.vrps[j++];
+        }
+    }
+
+    /* Swap in the new set before revalidating against it */
+    ptrie_destroy(&r->index, NULL);
+    free(r->vrps);
+    r->index = index;
+    r->vrps = set.vrps;
+    r->num_vrps = n;
+    r->loads++;
+    r->skipped = set.skipped;
+    r->errors = set.errors;
+    r->changed = changes.v ? changes.count : n;
+
+    struct rpki_reval rv = { rib, 0 };
+    if (rib && !changes.v) {
+        /* No memory for the diff: fall back to revalidating everything */
+        ptrie_walk(&rib->trie, rpki_revalidate_dest, &rv);
+    } else if (rib) {
+        qsort(changes.v, changes.count, sizeof(*changes.v), rpki_change_cmp);
+        const struct bgp_vrp *last = NULL;
+        for (size_t k = 0; k < changes.count; k++) {
+            const struct bgp_vrp *c = &changes.v[k];
+            if (last && last->plen <= c->plen &&
+                (c->prefix & ptrie_mask(last->plen)) == last->prefix) {
+                continue; /* Already covered by an earlier change */
+            }
+            last = c;
+            ptrie_walk_subtree(&rib->trie, c->prefix, c->plen, rpki_revalidate_dest, &rv);
+        }
+    }
+    free(changes.v);
+    return rv.count;
+}
+
+/* Validation walk state */
+struct rpki_match {
+    const struct bgp_rpki *r; /* VRP set */
+    uint32_t origin_as;       /* Route origin (0 = none) */
+    uint8_t plen;             /* Route prefix length */
+    int state;                /* Result so far */
+};
+
+/* Walk callback: check the VRPs of one covering prefix */
+static int rpki_match_visit(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    struct rpki_match *m = arg;
+    const struct bgp_vrp *end = m->r->vrps + m->r->num_vrps;
+    m->state = BGP_RPKI_INVALID;
+    for (const struct bgp_vrp *v = data; v < end && v->prefix == prefix && v->plen == plen; v++) {
+        if (v->asn == m->origin_as && m->origin_as != 0 && m->plen <= v->max_len) {
+            m->state = BGP_RPKI_VALID;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Function to validate one route */
+int bgp_rpki_validate(const struct bgp_rpki *r, uint32_t prefix, uint8_t plen,
+                      uint32_t origin_as) {
+    if (r->num_vrps == 0) {
+        return BGP_RPKI_NOT_FOUND;
+    }
+    struct rpki_match m = { r, origin_as, plen, BGP_RPKI_NOT_FOUND };
+    ptrie_walk_covering(&r->index, prefix, plen, rpki_match_visit, &m);
+    return m.state;
+}
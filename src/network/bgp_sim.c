@@ -1,44 +1,167 @@
-/* bgp_sim.c: A simple BGP simulator that establishes a BGP session with a peer over TCP,
- * sends an OPEN message to negotiate parameters, receives the peer’s OPEN, and sends a
- * KEEPALIVE to maintain the session. Like a librarian negotiating a book-sharing agreement
- * with another library, exchanging contracts and check-ins. Uses TCP port 179 by default. */
+/* bgp_sim.c: A BGP speaker that keeps long-lived sessions with many peers over TCP.
+ * Each peer runs the RFC 4271 finite state machine (Idle, Connect, Active, OpenSent,
+ * OpenConfirm, Established); hold, keepalive and connect-retry timers live on a timer
+ * wheel, and every socket is driven from a single epoll loop. Received UPDATEs are
+ * decoded into the Adj-RIBs-In; best-path selection for the prefixes they touched
+ * runs in batches once a short window has passed, so bursts and flaps coalesce
+ * into one decision per prefix (bgp_rib.c). Best-path changes are advertised through
+ * update groups that encode each UPDATE once for every peer sharing an outbound
+ * policy (bgp_adj_out.c) and installed in a DIR-24-8 forwarding table that lookup
+ * threads read without locks (fib.c). Routes are checked against RPKI VRPs loaded
+ * from a file and reloaded on SIGHUP (bgp_rpki.c). Tables can also be bulk-loaded
+ * from MRT dumps and snapshotted back to MRT (bgp_mrt.c). Like a librarian keeping
+ * standing book-sharing agreements with many libraries, checking in on schedule and
+ * tearing up a contract when a partner goes quiet. Uses TCP port 179 by default. */
 
 /* Include standard libraries for sockets, networking, and I/O */
 #include <stdio.h>      /* For printf, perror, fprintf (printing) */
 #include <stdlib.h>     /* For exit, malloc, free (memory and control) */
 #include <string.h>     /* For memcpy, memset (memory operations) */
 #include <unistd.h>     /* For close, read, write (socket operations) */
+#include <errno.h>      /* For errno, EINTR, EINPROGRESS */
+#include <fcntl.h>      /* For fcntl, O_NONBLOCK (non-blocking connect) */
+#include <signal.h>     /* For signal, SIGINT, SIGTERM (graceful Cease) */
+#include <pthread.h>    /* For pthread_create, pthread_join (FIB benchmark) */
+#include <time.h>       /* For clock_gettime (FIB benchmark) */
 #include <sys/socket.h> /* For socket, connect, bind, listen, accept */
+#include <sys/epoll.h>  /* For epoll_create1, epoll_ctl, epoll_wait */
+#include <poll.h>       /* For poll (flushing a NOTIFICATION before close) */
 #include <netinet/in.h> /* For sockaddr_in, in_addr (IP addresses) */
 #include <arpa/inet.h>  /* For inet_pton, htons (network conversions) */
+#include "timer_wheel.h" /* For struct timer_wheel (hold/keepalive timers) */
+#include "bgp.h"         /* For BGP wire structs and constants */
+#include "bgp_framing.h" /* For struct bgp_rxring, bgp_frame_next */
+#include "bgp_attr.h"    /* For struct bgp_attrs, bgp_attrs_parse */
+#include "bgp_update.h"  /* For struct bgp_update, bgp_update_decode */
+#include "bgp_rib.h"     /* For struct bgp_rib, struct bgp_adj_in */
+#include "bgp_mrt.h"     /* For bgp_mrt_load, bgp_mrt_write */
+#include "bgp_adj_out.h" /* For struct bgp_update_group, struct bgp_outq */
+#include "fib.h"         /* For struct fib, fib_insert, fib_lookup */
+#include "bgp_rpki.h"    /* For struct bgp_rpki, bgp_rpki_load */
 
-/* BGP message types (per RFC 4271) */
-#define BGP_OPEN 1
-#define BGP_UPDATE 2
-#define BGP_NOTIFICATION 3
-#define BGP_KEEPALIVE 4
+/* Session timers, in seconds (RFC 4271 section 10 suggested values) */
+#define BGP_HOLD_TIME 180          /* Proposed hold time */
+#define BGP_OPEN_HOLD_TIME 240     /* "Large" hold time while waiting for OPEN */
+#define BGP_CONNECT_RETRY_TIME 30  /* Delay between connection attempts */
+#define BGP_NOTIFICATION_WAIT_MS 1000 /* Longest wait for the socket to take a NOTIFICATION */
 
-/* Buffer size for BGP messages */
-#define BUFFER_SIZE 4096
+/* Event loop limits */
+#define MAX_PEERS 1024    /* Maximum configured plus dynamic peers */
+#define MAX_EVENTS 64     /* epoll events handled per wakeup */
+#define TIMER_TICK_MS 100 /* Timer wheel resolution */
+#define MAX_FILLS 8       /* Ring fills per peer per wakeup (fairness bound) */
+#define RIB_BATCH_MS 50   /* Window that collects changes before best-path runs */
+#define RIB_BUDGET 65536  /* Destinations decided per loop pass (keeps I/O flowing) */
+#define MAX_MRT_FILES 16  /* -m dumps loaded at startup */
 
-/* BGP message header (19 bytes) */
-struct bgp_header {
-    uint8_t marker[16]; /* All 1s (0xFF) for synchronization */
-    uint16_t length;    /* Message length (including header) */
-    uint8_t type;       /* Message type (OPEN, UPDATE, etc.) */
+/* Forwarding table sizing and lookup benchmark (-b) */
+#define FIB_TBL8_GROUPS 16384     /* /24s that may hold longer prefixes */
+#define FIB_MAX_NEXTHOPS 65536    /* Distinct next-hop addresses */
+#define FIB_BENCH_ADDRS (1 << 22) /* Addresses per benchmark run */
+#define FIB_BENCH_BATCH 64        /* Lookups per epoch critical section */
+#define FIB_BENCH_MS 1000         /* Length of each benchmark run */
+
+/* FSM states (RFC 4271 section 8.2.2) */
+enum bgp_state {
+    BGP_IDLE,
+    BGP_CONNECT,
+    BGP_ACTIVE,
+    BGP_OPENSENT,
+    BGP_OPENCONFIRM,
+    BGP_ESTABLISHED
+};
+
+/* Printable state names, indexed by enum bgp_state */
+static const char *bgp_state_names[] = {
+    "Idle", "Connect", "Active", "OpenSent", "OpenConfirm", "Established"
 };
 
-/* BGP OPEN message (variable length, minimum 29 bytes) */
-struct bgp_open {
-    struct bgp_header header; /* Common header */
-    uint8_t version;         /* BGP version (4) */
-    uint16_t my_as;          /* My Autonomous System number */
-    uint16_t hold_time;      /* Hold time in seconds (e.g., 180) */
-    uint32_t bgp_id;         /* BGP Identifier (IP address as integer) */
-    uint8_t opt_param_len;   /* Length of optional parameters */
-    /* Optional parameters follow (none for simplicity) */
+/* FSM events (the subset of RFC 4271 section 8.1 this speaker generates) */
+enum bgp_event {
+    BGP_EV_START,                 /* ManualStart / AutomaticStart */
+    BGP_EV_STOP,                  /* ManualStop (shutdown) */
+    BGP_EV_CONNECT_RETRY_EXPIRES, /* ConnectRetryTimer_Expires */
+    BGP_EV_HOLD_EXPIRES,          /* HoldTimer_Expires */
+    BGP_EV_KEEPALIVE_EXPIRES,     /* KeepaliveTimer_Expires */
+    BGP_EV_TCP_ESTABLISHED,       /* Outgoing connection completed */
+    BGP_EV_TCP_CONFIRMED,         /* Incoming connection accepted */
+    BGP_EV_TCP_FAILS,             /* Connection failed or closed */
+    BGP_EV_OPEN,                  /* Valid OPEN received */
+    BGP_EV_KEEPALIVE,             /* KEEPALIVE received */
+    BGP_EV_UPDATE,                /* UPDATE received */
+    BGP_EV_NOTIFICATION           /* NOTIFICATION received */
 };
 
+struct bgp_speaker;
+
+/* Per-peer session state */
+struct bgp_peer {
+    struct bgp_speaker *spk;       /* Owning speaker */
+    int fd;                        /* Session socket (-1 when none) */
+    struct bgp_rxring rx;          /* Receive ring for message framing */
+    enum bgp_state state;          /* Current FSM state */
+    struct sockaddr_in addr;       /* Peer address and port */
+    char name[32];                 /* "a.b.c.d" for log messages */
+    uint32_t remote_as;            /* Configured peer AS (0 = accept any) */
+    uint32_t peer_as;              /* AS from the peer's OPEN */
+    int as4;                       /* 1 = both sides use 4-octet AS numbers */
+    uint32_t peer_id;              /* BGP Identifier from the peer's OPEN */
+    uint16_t hold_time;            /* Negotiated hold time (0 = no keepalives) */
+    uint16_t keepalive_time;       /* Negotiated keepalive interval */
+    int passive;                   /* 1 = never initiate connections */
+    int dynamic;                   /* 1 = created by accept, freed on close */
+    int dead;                      /* 1 = pending free at end of loop pass */
+    struct tw_timer connect_retry; /* ConnectRetryTimer */
+    struct tw_timer hold;          /* HoldTimer */
+    struct tw_timer keepalive;     /* KeepaliveTimer */
+    unsigned long msgs_in;         /* Messages received this session */
+    unsigned long updates_in;      /* UPDATEs received this session */
+    unsigned long prefixes_in;     /* NLRI announced this session */
+    unsigned long withdrawals_in;  /* Prefixes withdrawn this session */
+    struct bgp_adj_in adj_in;      /* Routes learned from this peer */
+    struct bgp_outq outq;          /* Messages waiting for the socket */
+    struct bgp_update_group *group; /* Update group while Established */
+    int out_blocked;               /* 1 = waiting for EPOLLOUT to drain outq */
+    unsigned long flaps;           /* Times the session left Established */
+};
+
+/* Speaker-wide state shared by all peers */
+struct bgp_speaker {
+    uint32_t local_as;               /* Our AS number */
+    uint32_t router_id;              /* Our BGP Identifier (host order) */
+    uint16_t hold_time;              /* Hold time we propose */
+    int epfd;                        /* epoll instance */
+    int listen_fd;                   /* Passive socket (-1 if not listening) */
+    int accept_any;                  /* 1 = accept unconfigured peers */
+    struct timer_wheel timers;       /* Hold/keepalive/connect-retry timers */
+    struct bgp_rib rib;              /* Adj-RIBs-In and Loc-RIB */
+    struct bgp_mrt_source mrt;       /* Routes loaded from MRT dumps */
+    const char *snapshot_path;       /* MRT file written on SIGUSR2 (-w) */
+    struct bgp_rpki rpki;            /* Validated ROA Payloads */
+    const char *vrp_path;            /* VRP file, reloaded on SIGHUP (-r) */
+    uint64_t rib_due_ms;             /* When queued changes get decided (0 = none queued) */
+    uint64_t rib_batch_start_ms;     /* When the current batch started deciding */
+    unsigned long rib_batch_size;    /* Destinations decided in the current batch */
+    struct bgp_update_group *groups; /* Update groups of Established peers */
+    struct fib fib;                  /* Forwarding table built from the Loc-RIB */
+    unsigned long fib_failures;      /* Loc-RIB routes the FIB had no room for */
+    struct bgp_peer *peers[MAX_PEERS]; /* All peers (configured first) */
+    int num_peers;                   /* Entries used in peers[] */
+};
+
+/* Set from the signal handler to request a graceful shutdown */
+static volatile sig_atomic_t stop_requested = 0;
+/* Set from the signal handler to request a RIB summary (SIGUSR1) */
+static volatile sig_atomic_t stats_requested = 0;
+/* Set from the signal handler to request an MRT snapshot (SIGUSR2) */
+static volatile sig_atomic_t snapshot_requested = 0;
+/* Set from the signal handler to request a VRP reload (SIGHUP) */
+static volatile sig_atomic_t vrp_reload_requested = 0;
+/* Print every message sent/received when set (-v) */
+static int verbose = 0;
+
+static void bgp_fsm(struct bgp_peer *peer, enum bgp_event ev);
+
 /* Function to initialize BGP header */
 void init_bgp_header(struct bgp_header *hdr, uint16_t length, uint8_t type) {
     memset(hdr->marker, 0xFF, 16); /* Set marker to all 1s */
@@ -52,110 +175,1480 @@ int send_bgp_message(int sockfd, void *msg, size_t len) {
         perror("Failed to send BGP message");
         return -1;
     }
-    printf("Sent BGP message (type %u, length %zu)\n", ((struct bgp_header*)msg)->type, len);
+    if (verbose) {
+        printf("Sent BGP message (type %u, length %zu)\n", ((struct bgp_header*)msg)->type, len);
+    }
     return 0;
 }
 
-/* Function to receive and validate a BGP message */
-int receive_bgp_message(int sockfd, unsigned char *buffer, size_t buf_size) {
-    ssize_t len = read(sockfd, buffer, buf_size);
-    if (len <= 0) {
-        perror("Failed to receive BGP message");
+/* Function to send a message to a peer behind anything already queued; what the
+ * socket does not take now is queued (whole, with the written part counted as
+ * sent, so queued chunks always start on a message) and written on EPOLLOUT */
+static int bgp_peer_send(struct bgp_peer *peer, void *msg, size_t len) {
+    if (peer->outq.count > 0) {
+        if (bgp_outq_push_copy(&peer->outq, msg, len) < 0) {
+            fprintf(stderr, "[%s] Out of memory queueing message\n", peer->name);
+            return -1;
+        }
+        return 0;
+    }
+    ssize_t n = write(peer->fd, msg, len);
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        perror("Failed to send BGP message");
         return -1;
     }
-    struct bgp_header *hdr = (struct bgp_header*)buffer;
-    if (len < sizeof(struct bgp_header) || ntohs(hdr->length) != len) {
-        fprintf(stderr, "Invalid BGP message length\n");
+    if (n < 0) {
+        n = 0;
+    }
+    if (verbose) {
+        printf("Sent BGP message (type %u, length %zu)\n", ((struct bgp_header*)msg)->type, len);
+    }
+    if ((size_t)n < len) {
+        if (bgp_outq_push_copy(&peer->outq, msg, len) < 0) {
+            fprintf(stderr, "[%s] Out of memory queueing message\n", peer->name);
+            return -1;
+        }
+        peer->outq.off = n;
+        peer->outq.bytes -= n;
+    }
+    return 0;
+}
+
+/* Function to send a NOTIFICATION with optional data */
+static void bgp_send_notification(struct bgp_peer *peer, uint8_t code, uint8_t subcode,
+                                  const void *data, size_t data_len) {
+    unsigned char msg[BGP_MAX_MESSAGE];
+    size_t len = BGP_HEADER_LEN + 2 + data_len;
+    if (peer->fd < 0 || len > sizeof(msg)) {
+        return;
+    }
+    init_bgp_header((struct bgp_header*)msg, len, BGP_NOTIFICATION);
+    msg[BGP_HEADER_LEN] = code;
+    msg[BGP_HEADER_LEN + 1] = subcode;
+    if (data_len > 0) {
+        memcpy(msg + BGP_HEADER_LEN + 2, data, data_len);
+    }
+    printf("[%s] Sending NOTIFICATION %u/%u\n", peer->name, code, subcode);
+
+    /* The connection is closed right after this, dropping the queue: skip the
+     * UPDATEs the peer has not started to receive, finish the one it has, and
+     * wait a bounded time for the socket to take the NOTIFICATION */
+    if (bgp_outq_trim(&peer->outq) < 0 || bgp_outq_push_copy(&peer->outq, msg, len) < 0) {
+        fprintf(stderr, "[%s] Out of memory queueing NOTIFICATION\n", peer->name);
+        return;
+    }
+    uint64_t deadline = tw_now_ms() + BGP_NOTIFICATION_WAIT_MS;
+    int rc;
+    while ((rc = bgp_outq_write(&peer->outq, peer->fd)) > 0) {
+        uint64_t now = tw_now_ms();
+        struct pollfd pfd = { .fd = peer->fd, .events = POLLOUT };
+        if (now >= deadline || (poll(&pfd, 1, (int)(deadline - now)) < 0 && errno != EINTR)) {
+            break;
+        }
+    }
+    if (rc != 0) {
+        printf("[%s] NOTIFICATION not delivered: %s\n", peer->name,
+               rc < 0 ? strerror(errno) : "socket stayed full");
+    } else if (verbose) {
+        printf("Sent BGP message (type %u, length %zu)\n", BGP_NOTIFICATION, len);
+    }
+}
+
+/* Function to send our OPEN, advertising IPv4 unicast and 4-octet AS support */
+static int bgp_send_open(struct bgp_peer *peer) {
+    struct bgp_speaker *spk = peer->spk;
+    unsigned char msg[BGP_OPEN_LEN + 16];
+    struct bgp_open *open_msg = (struct bgp_open*)msg;
+    uint8_t *caps = msg + BGP_OPEN_LEN;
+
+    /* One Capabilities parameter holding two capabilities */
+    caps[0] = BGP_OPT_CAPABILITIES;
+    caps[1] = 14;
+    caps[2] = BGP_CAP_MP;          /* IPv4 unicast: AFI 1, reserved, SAFI 1 */
+    caps[3] = 4;
+    bgp_put16(caps + 4, 1);
+    caps[6] = 0;
+    caps[7] = 1;
+    caps[8] = BGP_CAP_AS4;         /* Our real (possibly 4-octet) AS */
+    caps[9] = 4;
+    bgp_put32(caps + 10, spk->local_as);
+
+    init_bgp_header(&open_msg->header, BGP_OPEN_LEN + 16, BGP_OPEN);
+    open_msg->version = 4;                        /* BGP-4 */
+    open_msg->my_as = htons(spk->local_as > 0xFFFF ? BGP_AS_TRANS : spk->local_as);
+    open_msg->hold_time = htons(spk->hold_time);  /* Proposed hold time */
+    open_msg->bgp_id = htonl(spk->router_id);     /* Our BGP Identifier */
+    open_msg->opt_param_len = 16;
+    return bgp_peer_send(peer, msg, sizeof(msg));
+}
+
+/* Function to send a KEEPALIVE */
+static int bgp_send_keepalive(struct bgp_peer *peer) {
+    struct bgp_header keepalive;
+    init_bgp_header(&keepalive, BGP_HEADER_LEN, BGP_KEEPALIVE);
+    return bgp_peer_send(peer, &keepalive, BGP_HEADER_LEN);
+}
+
+/* Function to tell the FIB and every update group about a Loc-RIB change */
+static void bgp_rib_changed(const struct bgp_dest *dest, void *arg) {
+    struct bgp_speaker *spk = arg;
+    if (dest->best) {
+        if (fib_insert(&spk->fib, dest->prefix, dest->plen, dest->best->attrs->next_hop) < 0) {
+            spk->fib_failures++;
+        }
+    } else {
+        fib_delete(&spk->fib, dest->prefix, dest->plen);
+    }
+    for (struct bgp_update_group *g = spk->groups; g; g = g->next) {
+        if (bgp_group_route(g, dest) < 0) {
+            fprintf(stderr, "Out of memory updating Adj-RIB-Out\n");
+        }
+    }
+}
+
+/* Function to seed a new group's Adj-RIB-Out from one Loc-RIB destination */
+static int bgp_group_seed(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    return bgp_group_route(arg, data);
+}
+
+/* Function to put a newly Established peer in the update group matching its
+ * outbound policy, creating the group if none matches; the peer gets the full
+ * table at the next flush */
+static void bgp_export_start(struct bgp_peer *peer) {
+    struct bgp_speaker *spk = peer->spk;
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    int ebgp = peer->peer_as != spk->local_as;
+    uint32_t next_hop = 0;
+    if (ebgp && getsockname(peer->fd, (struct sockaddr*)&local, &local_len) == 0) {
+        next_hop = ntohl(local.sin_addr.s_addr); /* Next hop self on eBGP */
+    }
+
+    struct bgp_update_group *g = spk->groups;
+    while (g && (g->ebgp != ebgp || g->as4 != peer->as4 || g->next_hop != next_hop)) {
+        g = g->next;
+    }
+    if (!g) {
+        g = malloc(sizeof(*g));
+        if (!g) {
+            perror("Failed to allocate update group");
+            return;
+        }
+        bgp_group_init(g, ebgp, peer->as4, spk->local_as, next_hop, &spk->rib.attrs);
+        ptrie_walk(&spk->rib.trie, bgp_group_seed, g);
+        g->next = spk->groups;
+        spk->groups = g;
+    }
+    if (bgp_group_join(g, &peer->outq) < 0) {
+        fprintf(stderr, "[%s] Out of memory joining update group\n", peer->name);
+        return;
+    }
+    peer->group = g;
+    if (spk->rib_due_ms == 0) {
+        spk->rib_due_ms = tw_now_ms() + RIB_BATCH_MS;
+    }
+}
+
+/* Function to take a peer out of its update group, freeing the group with its
+ * last member, and drop whatever it had queued */
+static void bgp_export_stop(struct bgp_peer *peer) {
+    struct bgp_speaker *spk = peer->spk;
+    struct bgp_update_group *g = peer->group;
+    if (g) {
+        bgp_group_leave(g, &peer->outq);
+        if (g->num_members == 0 && g->num_joiners == 0) {
+            struct bgp_update_group **link = &spk->groups;
+            while (*link != g) {
+                link = &(*link)->next;
+            }
+            *link = g->next;
+            bgp_group_destroy(g);
+            free(g);
+        }
+        peer->group = NULL;
+    }
+    bgp_outq_clear(&peer->outq);
+    peer->out_blocked = 0;
+}
+
+/* Function to log and apply a state change */
+static void bgp_set_state(struct bgp_peer *peer, enum bgp_state state) {
+    if (peer->state == state) {
+        return;
+    }
+    if (peer->state == BGP_ESTABLISHED) {
+        /* Leaving Established withdraws everything the peer told us */
+        peer->flaps++;
+        bgp_export_stop(peer);
+        unsigned long removed = bgp_rib_withdraw_peer(&peer->spk->rib, &peer->adj_in);
+        printf("[%s] Withdrew %lu routes\n", peer->name, removed);
+    }
+    printf("[%s] %s -> %s\n", peer->name, bgp_state_names[peer->state], bgp_state_names[state]);
+    peer->state = state;
+    if (state == BGP_ESTABLISHED) {
+        bgp_export_start(peer);
+    }
+}
+
+/* Function to close the session socket and stop the session timers */
+static void bgp_close_connection(struct bgp_peer *peer) {
+    struct bgp_speaker *spk = peer->spk;
+    if (peer->fd >= 0) {
+        epoll_ctl(spk->epfd, EPOLL_CTL_DEL, peer->fd, NULL);
+        close(peer->fd);
+        peer->fd = -1;
+    }
+    bgp_outq_clear(&peer->outq);
+    peer->out_blocked = 0;
+    tw_cancel(&spk->timers, &peer->hold);
+    tw_cancel(&spk->timers, &peer->keepalive);
+}
+
+/* Function to drop back to Idle; configured peers restart after the
+ * connect-retry interval, dynamic peers are released */
+static void bgp_go_idle(struct bgp_peer *peer) {
+    struct bgp_speaker *spk = peer->spk;
+    bgp_close_connection(peer);
+    bgp_set_state(peer, BGP_IDLE);
+    peer->msgs_in = peer->updates_in = peer->prefixes_in = peer->withdrawals_in = 0;
+    if (peer->dynamic) {
+        tw_cancel(&spk->timers, &peer->connect_retry);
+        peer->dead = 1;
+    } else if (!stop_requested) {
+        tw_add(&spk->timers, &peer->connect_retry, BGP_CONNECT_RETRY_TIME * 1000);
+    }
+}
+
+/* Function to report an error to the peer and drop the session */
+static void bgp_peer_error(struct bgp_peer *peer, uint8_t code, uint8_t subcode,
+                           const void *data, size_t data_len) {
+    bgp_send_notification(peer, code, subcode, data, data_len);
+    bgp_go_idle(peer);
+}
+
+/* Function to register a socket with epoll for the given events */
+static void bgp_watch(struct bgp_peer *peer, uint32_t events, int op) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = peer;
+    if (epoll_ctl(peer->spk->epfd, op, peer->fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+    }
+}
+
+/* Function to write a peer's queued messages, watching for EPOLLOUT while the
+ * socket cannot take them all */
+static void bgp_peer_flush(struct bgp_peer *peer) {
+    int rc = bgp_outq_write(&peer->outq, peer->fd);
+    if (rc < 0) {
+        printf("[%s] Send failed: %s\n", peer->name, strerror(errno));
+        bgp_fsm(peer, BGP_EV_TCP_FAILS);
+        return;
+    }
+    if (rc != peer->out_blocked) {
+        bgp_watch(peer, rc ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+        peer->out_blocked = rc;
+    }
+}
+
+/* Function to start a non-blocking connection attempt; completion is
+ * reported by epoll as EPOLLOUT */
+static int bgp_start_connect(struct bgp_peer *peer) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
         return -1;
     }
-    printf("Received BGP message (type %u, length %zd)\n", hdr->type, len);
-    return len;
+    if (connect(fd, (struct sockaddr*)&peer->addr, sizeof(peer->addr)) < 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    peer->fd = fd;
+    bgp_watch(peer, EPOLLOUT, EPOLL_CTL_ADD);
+    return 0;
 }
 
-/* Main function: Entry point of the BGP simulator */
-int main(int argc, char *argv[]) {
-    /* Check for correct number of command-line arguments */
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <local_as> <peer_ip> <peer_as> <peer_port>\n", argv[0]);
-        fprintf(stderr, "Example: %s 65001 127.0.0.1 65002 179\n", argv[0]);
-        exit(1);
+/* Function to start reading messages on a connected socket */
+static void bgp_session_up(struct bgp_peer *peer) {
+    bgp_rxring_reset(&peer->rx);
+    bgp_watch(peer, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+/* Function to restart the hold timer after traffic from the peer */
+static void bgp_restart_hold(struct bgp_peer *peer) {
+    if (peer->hold_time > 0) {
+        tw_add(&peer->spk->timers, &peer->hold, peer->hold_time * 1000ULL);
+    }
+}
+
+/* The RFC 4271 finite state machine: one transition per (state, event) */
+static void bgp_fsm(struct bgp_peer *peer, enum bgp_event ev) {
+    struct bgp_speaker *spk = peer->spk;
+
+    /* ManualStop is handled the same way in every state */
+    if (ev == BGP_EV_STOP) {
+        if (peer->state >= BGP_OPENSENT) {
+            bgp_send_notification(peer, BGP_ERR_CEASE, 0, NULL, 0);
+        }
+        tw_cancel(&spk->timers, &peer->connect_retry);
+        bgp_close_connection(peer);
+        bgp_set_state(peer, BGP_IDLE);
+        return;
     }
 
-    /* Pointers to command-line arguments */
-    char *local_as_str = argv[1]; /* Local AS number (e.g., 65001) */
-    char *peer_ip = argv[2];     /* Peer IP address (e.g., 127.0.0.1) */
-    char *peer_as_str = argv[3]; /* Peer AS number (e.g., 65002) */
-    char *peer_port_str = argv[4]; /* Peer port (e.g., 179) */
+    switch (peer->state) {
+    case BGP_IDLE:
+        /* Automatic restart reuses the connect-retry timer as IdleHoldTimer */
+        if (ev == BGP_EV_START || ev == BGP_EV_CONNECT_RETRY_EXPIRES) {
+            tw_add(&spk->timers, &peer->connect_retry, BGP_CONNECT_RETRY_TIME * 1000);
+            if (peer->passive) {
+                bgp_set_state(peer, BGP_ACTIVE);
+            } else if (bgp_start_connect(peer) == 0) {
+                bgp_set_state(peer, BGP_CONNECT);
+            } else {
+                bgp_set_state(peer, BGP_ACTIVE);
+            }
+        }
+        break;
 
-    /* Parse arguments */
-    uint16_t local_as = atoi(local_as_str);
-    uint16_t peer_as = atoi(peer_as_str);
-    int peer_port = atoi(peer_port_str);
+    case BGP_CONNECT:
+    case BGP_ACTIVE:
+        switch (ev) {
+        case BGP_EV_CONNECT_RETRY_EXPIRES:
+            /* Abandon the pending attempt and try again */
+            bgp_close_connection(peer);
+            tw_add(&spk->timers, &peer->connect_retry, BGP_CONNECT_RETRY_TIME * 1000);
+            if (!peer->passive && bgp_start_connect(peer) == 0) {
+                bgp_set_state(peer, BGP_CONNECT);
+            } else {
+                bgp_set_state(peer, BGP_ACTIVE);
+            }
+            break;
+        case BGP_EV_TCP_ESTABLISHED:
+        case BGP_EV_TCP_CONFIRMED:
+            tw_cancel(&spk->timers, &peer->connect_retry);
+            bgp_session_up(peer);
+            if (bgp_send_open(peer) < 0) {
+                bgp_go_idle(peer);
+                break;
+            }
+            tw_add(&spk->timers, &peer->hold, BGP_OPEN_HOLD_TIME * 1000);
+            bgp_set_state(peer, BGP_OPENSENT);
+            break;
+        case BGP_EV_TCP_FAILS:
+            /* Wait for the connect-retry timer (or an inbound connection) */
+            bgp_close_connection(peer);
+            bgp_set_state(peer, BGP_ACTIVE);
+            break;
+        default:
+            bgp_peer_error(peer, BGP_ERR_FSM, 0, NULL, 0);
+            break;
+        }
+        break;
+
+    case BGP_OPENSENT:
+        switch (ev) {
+        case BGP_EV_OPEN:
+            /* hold_time/keepalive_time were negotiated while validating the OPEN */
+            if (bgp_send_keepalive(peer) < 0) {
+                bgp_go_idle(peer);
+                break;
+            }
+            tw_cancel(&spk->timers, &peer->hold);
+            bgp_restart_hold(peer);
+            if (peer->keepalive_time > 0) {
+                tw_add(&spk->timers, &peer->keepalive, peer->keepalive_time * 1000ULL);
+            }
+            bgp_set_state(peer, BGP_OPENCONFIRM);
+            break;
+        case BGP_EV_HOLD_EXPIRES:
+            bgp_peer_error(peer, BGP_ERR_HOLD_TIMER, 0, NULL, 0);
+            break;
+        case BGP_EV_TCP_FAILS:
+        case BGP_EV_NOTIFICATION:
+            bgp_go_idle(peer);
+            break;
+        default:
+            bgp_peer_error(peer, BGP_ERR_FSM, 1, NULL, 0); /* Unexpected in OpenSent */
+            break;
+        }
+        break;
+
+    case BGP_OPENCONFIRM:
+    case BGP_ESTABLISHED:
+        switch (ev) {
+        case BGP_EV_KEEPALIVE:
+            bgp_restart_hold(peer);
+            if (peer->state == BGP_OPENCONFIRM) {
+                bgp_adj_in_init(&peer->adj_in, peer->peer_id, ntohl(peer->addr.sin_addr.s_addr),
+                                peer->peer_as, peer->peer_as != spk->local_as);
+                bgp_set_state(peer, BGP_ESTABLISHED);
+                printf("[%s] Session established: AS %u, BGP ID %x, hold %us\n",
+                       peer->name, peer->peer_as, peer->peer_id, peer->hold_time);
+            }
+            break;
+        case BGP_EV_UPDATE:
+            if (peer->state != BGP_ESTABLISHED) {
+                bgp_peer_error(peer, BGP_ERR_FSM, 2, NULL, 0); /* Unexpected in OpenConfirm */
+                break;
+            }
+            peer->updates_in++;
+            bgp_restart_hold(peer);
+            break;
+        case BGP_EV_KEEPALIVE_EXPIRES:
+            if (bgp_send_keepalive(peer) < 0) {
+                bgp_go_idle(peer);
+                break;
+            }
+            tw_add(&spk->timers, &peer->keepalive, peer->keepalive_time * 1000ULL);
+            break;
+        case BGP_EV_HOLD_EXPIRES:
+            printf("[%s] Hold timer expired\n", peer->name);
+            bgp_peer_error(peer, BGP_ERR_HOLD_TIMER, 0, NULL, 0);
+            break;
+        case BGP_EV_TCP_FAILS:
+        case BGP_EV_NOTIFICATION:
+            bgp_go_idle(peer);
+            break;
+        default:
+            bgp_peer_error(peer, BGP_ERR_FSM, peer->state == BGP_OPENCONFIRM ? 2 : 3, NULL, 0);
+            break;
+        }
+        break;
+    }
+}
+
+/* Function to validate a received OPEN and negotiate timers. Returns 0 if
+ * acceptable; otherwise sends the matching NOTIFICATION and returns -1. */
+static int bgp_process_open(struct bgp_peer *peer, const struct bgp_msg_view *msg) {
+    struct bgp_speaker *spk = peer->spk;
+    const struct bgp_open *peer_open = (const struct bgp_open*)msg->data;
+    if (msg->len < BGP_OPEN_LEN || msg->len != BGP_OPEN_LEN + peer_open->opt_param_len) {
+        uint16_t bad_len = htons(msg->len);
+        bgp_peer_error(peer, BGP_ERR_HEADER, BGP_ERR_HDR_LENGTH, &bad_len, sizeof(bad_len));
+        return -1;
+    }
+    uint32_t as = ntohs(peer_open->my_as);
+    uint16_t hold = ntohs(peer_open->hold_time);
+    uint32_t id = ntohl(peer_open->bgp_id);
+
+    /* Walk the optional parameters for the 4-octet AS capability */
+    int as4 = 0;
+    const uint8_t *opt = msg->data + BGP_OPEN_LEN;
+    const uint8_t *opt_end = opt + peer_open->opt_param_len;
+    while (opt + 2 <= opt_end && opt + 2 + opt[1] <= opt_end) {
+        if (opt[0] == BGP_OPT_CAPABILITIES) {
+            const uint8_t *cap = opt + 2;
+            const uint8_t *cap_end = cap + opt[1];
+            while (cap + 2 <= cap_end && cap + 2 + cap[1] <= cap_end) {
+                if (cap[0] == BGP_CAP_AS4 && cap[1] == 4) {
+                    as4 = 1;
+                    as = bgp_get32(cap + 2);
+                }
+                cap += 2 + cap[1];
+            }
+        }
+        opt += 2 + opt[1];
+    }
+
+    if (peer_open->version != 4) {
+        uint16_t supported = htons(4);
+        bgp_peer_error(peer, BGP_ERR_OPEN, 1, &supported, sizeof(supported)); /* Unsupported Version */
+        return -1;
+    }
+    if (peer->remote_as != 0 && as != peer->remote_as) {
+        bgp_peer_error(peer, BGP_ERR_OPEN, 2, NULL, 0); /* Bad Peer AS */
+        return -1;
+    }
+    if (id == 0 || id == spk->router_id) {
+        bgp_peer_error(peer, BGP_ERR_OPEN, 3, NULL, 0); /* Bad BGP Identifier */
+        return -1;
+    }
+    if (hold == 1 || hold == 2) {
+        bgp_peer_error(peer, BGP_ERR_OPEN, 6, NULL, 0); /* Unacceptable Hold Time */
+        return -1;
+    }
+
+    peer->peer_as = as;
+    peer->peer_id = id;
+    peer->as4 = as4;
+    peer->hold_time = hold < spk->hold_time ? hold : spk->hold_time;
+    peer->keepalive_time = peer->hold_time / 3;
+    printf("[%s] Received OPEN: AS %u, Hold Time %u, BGP ID %x%s\n", peer->name, as, hold, id,
+           as4 ? ", 4-octet AS" : "");
+    return 0;
+}
+
+/* Function to apply one UPDATE to the peer's Adj-RIB-In. Returns 0, or -1
+ * after resetting the session with an UPDATE Message Error. */
+static int bgp_process_update(struct bgp_peer *peer, const struct bgp_msg_view *msg) {
+    static union {
+        struct bgp_attrs attrs;
+        uint8_t raw[BGP_ATTRS_MAX];
+    } scratch;
+    struct bgp_rib *rib = &peer->spk->rib;
+    struct bgp_update upd;
+    uint8_t subcode;
+    uint32_t prefix;
+    uint8_t plen;
+
+    if (bgp_update_decode(msg->data, msg->len, &upd, &subcode) < 0) {
+        bgp_peer_error(peer, BGP_ERR_UPDATE, subcode, NULL, 0);
+        return -1;
+    }
+
+    /* Withdrawn routes first, then the announced prefixes */
+    const uint8_t *pos = upd.withdrawn;
+    while (bgp_prefix_next(&pos, upd.withdrawn + upd.withdrawn_len, &prefix, &plen)) {
+        peer->withdrawals_in += bgp_rib_withdraw(rib, &peer->adj_in, prefix, plen);
+    }
+    if (upd.nlri_len == 0) {
+        return 0;
+    }
+
+    if (bgp_attrs_parse(upd.attrs, upd.attrs_len, peer->as4, &scratch.attrs,
+                        sizeof(scratch), &subcode) < 0) {
+        bgp_peer_error(peer, BGP_ERR_UPDATE, subcode, NULL, 0);
+        return -1;
+    }
+    if ((scratch.attrs.flags & BGP_ATTRF_MANDATORY) != BGP_ATTRF_MANDATORY) {
+        uint8_t missing = !(scratch.attrs.flags & BGP_ATTRF_ORIGIN) ? BGP_ATTR_ORIGIN :
+                          !(scratch.attrs.flags & BGP_ATTRF_AS_PATH) ? BGP_ATTR_AS_PATH :
+                          BGP_ATTR_NEXT_HOP;
+        bgp_peer_error(peer, BGP_ERR_UPDATE, BGP_ERR_UPD_MISSING, &missing, 1);
+        return -1;
+    }
+
+    /* A path that already went through our AS is a loop (RFC 4271 section
+     * 9.1.2); drop any earlier route the peer sent for these prefixes */
+    if (bgp_attrs_has_as(&scratch.attrs, peer->spk->local_as)) {
+        pos = upd.nlri;
+        while (bgp_prefix_next(&pos, upd.nlri + upd.nlri_len, &prefix, &plen)) {
+            peer->withdrawals_in += bgp_rib_withdraw(rib, &peer->adj_in, prefix, plen);
+        }
+        return 0;
+    }
+
+    /* Intern once per UPDATE; every NLRI in it shares the same set */
+    const struct bgp_attrs *attrs = bgp_attr_intern(&rib->attrs, &scratch.attrs);
+    if (!attrs) {
+        fprintf(stderr, "[%s] Out of memory storing attributes\n", peer->name);
+        bgp_peer_error(peer, BGP_ERR_CEASE, 0, NULL, 0);
+        return -1;
+    }
+    pos = upd.nlri;
+    int rc = 0;
+    while (bgp_prefix_next(&pos, upd.nlri + upd.nlri_len, &prefix, &plen)) {
+        if (bgp_rib_update(rib, &peer->adj_in, prefix, plen, attrs) < 0) {
+            rc = -1;
+            break;
+        }
+        peer->prefixes_in++;
+    }
+    bgp_attr_unref(&rib->attrs, attrs);
+    if (rc < 0) {
+        fprintf(stderr, "[%s] Out of memory storing routes\n", peer->name);
+        bgp_peer_error(peer, BGP_ERR_CEASE, 0, NULL, 0);
+    }
+    return rc;
+}
+
+/* Function to log a received NOTIFICATION */
+static void bgp_process_notification(struct bgp_peer *peer, const struct bgp_msg_view *msg) {
+    static const char *codes[] = {
+        "?", "Message Header Error", "OPEN Message Error", "UPDATE Message Error",
+        "Hold Timer Expired", "Finite State Machine Error", "Cease"
+    };
+    uint8_t code = msg->len > BGP_HEADER_LEN ? msg->data[BGP_HEADER_LEN] : 0;
+    uint8_t subcode = msg->len > BGP_HEADER_LEN + 1 ? msg->data[BGP_HEADER_LEN + 1] : 0;
+    printf("[%s] Received NOTIFICATION %u/%u (%s)\n", peer->name, code, subcode,
+           code <= BGP_ERR_CEASE ? codes[code] : "Unknown");
+}
+
+/* Function to feed one framed message to the FSM */
+static void bgp_handle_message(struct bgp_peer *peer, const struct bgp_msg_view *msg) {
+    if (verbose) {
+        printf("[%s] Received BGP message (type %u, length %u)\n", peer->name, msg->type, msg->len);
+    }
+    peer->msgs_in++;
+
+    switch (msg->type) {
+    case BGP_OPEN:
+        if (peer->state != BGP_OPENSENT) {
+            bgp_fsm(peer, BGP_EV_OPEN); /* FSM reports the error */
+        } else if (bgp_process_open(peer, msg) == 0) {
+            bgp_fsm(peer, BGP_EV_OPEN);
+        }
+        break;
+    case BGP_UPDATE:
+        if (peer->state == BGP_ESTABLISHED && bgp_process_update(peer, msg) < 0) {
+            break;
+        }
+        bgp_fsm(peer, BGP_EV_UPDATE);
+        break;
+    case BGP_NOTIFICATION:
+        bgp_process_notification(peer, msg);
+        bgp_fsm(peer, BGP_EV_NOTIFICATION);
+        break;
+    case BGP_KEEPALIVE:
+        if (msg->len != BGP_HEADER_LEN) {
+            uint16_t bad_len = htons(msg->len);
+            bgp_peer_error(peer, BGP_ERR_HEADER, BGP_ERR_HDR_LENGTH, &bad_len, sizeof(bad_len));
+            break;
+        }
+        bgp_fsm(peer, BGP_EV_KEEPALIVE);
+        break;
+    }
+}
+
+/* Function to drain a readable peer: each fill is one large read, after which
+ * every complete message in the ring is handled in place */
+static void bgp_peer_readable(struct bgp_peer *peer) {
+    for (int fills = 0; fills < MAX_FILLS; fills++) {
+        size_t space = bgp_rxring_space(&peer->rx);
+        ssize_t n = bgp_rxring_fill(&peer->rx, peer->fd);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            printf("[%s] Connection closed\n", peer->name);
+            bgp_fsm(peer, BGP_EV_TCP_FAILS);
+            return;
+        }
+        if (n < 0) {
+            return; /* Socket drained */
+        }
+
+        struct bgp_msg_view msg;
+        int err_subcode = 0;
+        int rc;
+        while ((rc = bgp_frame_next(&peer->rx, &msg, &err_subcode)) == 1) {
+            bgp_handle_message(peer, &msg);
+            if (peer->fd < 0) {
+                return; /* Message tore the session down */
+            }
+        }
+        if (rc < 0) {
+            fprintf(stderr, "[%s] Bad message header (subcode %d)\n", peer->name, err_subcode);
+            bgp_peer_error(peer, BGP_ERR_HEADER, err_subcode, NULL, 0);
+            return;
+        }
+        if ((size_t)n < space) {
+            return; /* Short read: nothing more queued right now */
+        }
+    }
+}
+
+/* Function to finish a non-blocking connect once the socket is writable */
+static void bgp_peer_connected(struct bgp_peer *peer) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    if (err != 0) {
+        if (verbose) {
+            fprintf(stderr, "[%s] Connection failed: %s\n", peer->name, strerror(err));
+        }
+        bgp_fsm(peer, BGP_EV_TCP_FAILS);
+        return;
+    }
+    printf("[%s] Connected to peer port %d\n", peer->name, ntohs(peer->addr.sin_port));
+    bgp_fsm(peer, BGP_EV_TCP_ESTABLISHED);
+}
 
-    /* Create TCP socket */
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
+/* Timer callbacks: translate expiries into FSM events */
+static void connect_retry_expired(struct tw_timer *t, void *arg) {
+    (void)t;
+    bgp_fsm(arg, BGP_EV_CONNECT_RETRY_EXPIRES);
+}
+
+static void hold_expired(struct tw_timer *t, void *arg) {
+    (void)t;
+    bgp_fsm(arg, BGP_EV_HOLD_EXPIRES);
+}
+
+static void keepalive_expired(struct tw_timer *t, void *arg) {
+    (void)t;
+    bgp_fsm(arg, BGP_EV_KEEPALIVE_EXPIRES);
+}
+
+/* Function to create a peer and register it with the speaker */
+static struct bgp_peer *bgp_add_peer(struct bgp_speaker *spk, struct sockaddr_in *addr,
+                                     uint32_t remote_as) {
+    if (spk->num_peers >= MAX_PEERS) {
+        fprintf(stderr, "Too many peers (max %d)\n", MAX_PEERS);
+        return NULL;
+    }
+    struct bgp_peer *peer = calloc(1, sizeof(*peer));
+    if (!peer) {
+        perror("Failed to allocate peer");
+        return NULL;
+    }
+    peer->spk = spk;
+    peer->fd = -1;
+    peer->state = BGP_IDLE;
+    peer->addr = *addr;
+    peer->remote_as = remote_as;
+    if (bgp_rxring_init(&peer->rx, BGP_RX_RING_SIZE) < 0) {
+        fprintf(stderr, "Failed to allocate receive ring\n");
+        free(peer);
+        return NULL;
+    }
+    bgp_outq_init(&peer->outq);
+    inet_ntop(AF_INET, &addr->sin_addr, peer->name, sizeof(peer->name));
+    tw_timer_init(&peer->connect_retry, connect_retry_expired, peer);
+    tw_timer_init(&peer->hold, hold_expired, peer);
+    tw_timer_init(&peer->keepalive, keepalive_expired, peer);
+    spk->peers[spk->num_peers++] = peer;
+    return peer;
+}
+
+/* Function to free dynamic peers whose sessions ended during this loop pass */
+static void bgp_reap_peers(struct bgp_speaker *spk) {
+    int j = 0;
+    for (int i = 0; i < spk->num_peers; i++) {
+        struct bgp_peer *peer = spk->peers[i];
+        if (peer->dead) {
+            bgp_rxring_free(&peer->rx);
+            free(peer);
+        } else {
+            spk->peers[j++] = peer;
+        }
+    }
+    spk->num_peers = j;
+}
+
+/* Function to accept an inbound session and bind it to a peer */
+static void bgp_accept(struct bgp_speaker *spk) {
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int fd = accept(spk->listen_fd, (struct sockaddr*)&from, &from_len);
+    if (fd < 0) {
+        perror("Accept failed");
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    /* Find a configured peer with this address that is not yet connected */
+    struct bgp_peer *peer = NULL;
+    for (int i = 0; i < spk->num_peers; i++) {
+        struct bgp_peer *p = spk->peers[i];
+        if (!p->dead && !p->dynamic &&
+            p->addr.sin_addr.s_addr == from.sin_addr.s_addr) {
+            peer = p;
+            break;
+        }
+    }
+
+    /* Simplified collision handling: keep an existing OPEN exchange */
+    if (peer && peer->state >= BGP_OPENSENT) {
+        close(fd);
+        return;
+    }
+    if (!peer) {
+        if (!spk->accept_any) {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+            fprintf(stderr, "Rejected connection from unconfigured peer %s\n", ip);
+            close(fd);
+            return;
+        }
+        peer = bgp_add_peer(spk, &from, 0);
+        if (!peer) {
+            close(fd);
+            return;
+        }
+        peer->dynamic = 1;
+        peer->passive = 1;
+        peer->state = BGP_ACTIVE;
+        snprintf(peer->name + strlen(peer->name), sizeof(peer->name) - strlen(peer->name),
+                 ":%d", ntohs(from.sin_port));
+    }
+
+    /* Drop any outgoing attempt in favour of the accepted connection */
+    bgp_close_connection(peer);
+    if (peer->state == BGP_IDLE) {
+        bgp_set_state(peer, BGP_ACTIVE);
+    }
+    peer->fd = fd;
+    bgp_watch(peer, EPOLLIN, EPOLL_CTL_ADD);
+    bgp_fsm(peer, BGP_EV_TCP_CONFIRMED);
+}
+
+/* Function to open the passive listening socket */
+static int bgp_listen(struct bgp_speaker *spk, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
         perror("Socket creation failed");
-        exit(1);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror("Listen failed");
+        close(fd);
+        return -1;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL marks the listening socket */
+    epoll_ctl(spk->epfd, EPOLL_CTL_ADD, fd, &ev);
+    spk->listen_fd = fd;
+    printf("Listening for BGP sessions on port %d\n", port);
+    return 0;
+}
+
+/* Function to print the forwarding table summary */
+static void bgp_fib_stats(struct bgp_speaker *spk) {
+    struct fib *f = &spk->fib;
+    printf("FIB: %lu routes, %u of %u second-level groups, %u next hops, %lu updates "
+           "(%.1f entries written each), %lu not installed, %.1f MB\n",
+           f->routes.count, f->tbl8_used, f->tbl8_groups, f->nh_used, f->updates,
+           f->updates ? (double)f->entries_written / f->updates : 0.0, spk->fib_failures,
+           fib_bytes(f) / 1048576.0);
+}
+
+/* Function to print per-peer counters and the RIB summary */
+static void bgp_print_stats(struct bgp_speaker *spk) {
+    for (int i = 0; i < spk->num_peers; i++) {
+        struct bgp_peer *peer = spk->peers[i];
+        printf("[%s] %s, %lu UPDATEs, %lu prefixes announced, %lu withdrawn, %lu routes held\n",
+               peer->name, bgp_state_names[peer->state], peer->updates_in,
+               peer->prefixes_in, peer->withdrawals_in,
+               peer->state == BGP_ESTABLISHED ? peer->adj_in.count : 0);
+    }
+    bgp_rib_stats(&spk->rib, stdout);
+    bgp_fib_stats(spk);
+    for (struct bgp_update_group *g = spk->groups; g; g = g->next) {
+        printf("Update group (%s%s): %zu members, %lu routes out, %lu passes, "
+               "%lu UPDATEs, %lu bytes, %.1f prefixes/UPDATE, %lu withdrawn\n",
+               g->ebgp ? "eBGP" : "iBGP", g->as4 ? ", 4-octet AS" : "",
+               g->num_members + g->num_joiners, g->out.count, g->passes, g->updates,
+               g->bytes, g->updates ? (double)g->nlri / g->updates : 0.0, g->withdrawn);
+    }
+    fflush(stdout);
+}
+
+/* Function to check whether any update group has output to encode */
+static int bgp_export_busy(const struct bgp_speaker *spk) {
+    for (const struct bgp_update_group *g = spk->groups; g; g = g->next) {
+        if (bgp_group_busy(g)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Function to start writing queued output to peers not already waiting for
+ * EPOLLOUT */
+static void bgp_flush_peers(struct bgp_speaker *spk) {
+    for (int i = 0; i < spk->num_peers; i++) {
+        struct bgp_peer *peer = spk->peers[i];
+        if (peer->outq.count > 0 && !peer->out_blocked && peer->fd >= 0) {
+            bgp_peer_flush(peer);
+        }
+    }
+}
+
+/* Function to encode every group's pending output once best-path selection has
+ * caught up */
+static void bgp_export_flush(struct bgp_speaker *spk) {
+    for (struct bgp_update_group *g = spk->groups; g; g = g->next) {
+        if (bgp_group_busy(g) && bgp_group_flush(g) < 0) {
+            fprintf(stderr, "Out of memory encoding UPDATEs\n");
+        }
+    }
+}
+
+/* Function to run best-path selection for queued destinations once their window
+ * has passed, a budget at a time, then advertise the results */
+static void bgp_rib_batch(struct bgp_speaker *spk) {
+    uint64_t now = tw_now_ms();
+    if (spk->rib.dirty_count == 0 && !bgp_export_busy(spk)) {
+        return;
+    }
+    if (spk->rib_due_ms == 0) {
+        spk->rib_due_ms = now + RIB_BATCH_MS; /* First change opens the window */
+        return;
+    }
+    if (now < spk->rib_due_ms) {
+        return;
+    }
+    if (spk->rib_batch_size == 0) {
+        spk->rib_batch_start_ms = now;
+    }
+    spk->rib_batch_size += bgp_rib_process(&spk->rib, RIB_BUDGET);
+    if (spk->rib.dirty_count == 0) {
+        if (verbose) {
+            printf("Best-path batch: %lu prefixes in %llu ms\n", spk->rib_batch_size,
+                   (unsigned long long)(tw_now_ms() - spk->rib_batch_start_ms));
+        }
+        spk->rib_due_ms = 0;
+        spk->rib_batch_size = 0;
+        bgp_export_flush(spk);
+    }
+}
+
+/* Function to write the RIB to the -w file as an MRT TABLE_DUMP_V2 snapshot */
+static void bgp_write_snapshot(struct bgp_speaker *spk) {
+    if (!spk->snapshot_path) {
+        fprintf(stderr, "No snapshot file configured (-w)\n");
+        return;
+    }
+    uint64_t start = tw_now_ms();
+    long entries = bgp_mrt_write(&spk->rib, spk->snapshot_path, spk->router_id);
+    if (entries >= 0) {
+        printf("Wrote %ld RIB entries to %s in %llu ms\n", entries, spk->snapshot_path,
+               (unsigned long long)(tw_now_ms() - start));
+    }
+}
+
+/* Function to (re)load the -r VRP file; only destinations under changed VRPs
+ * are revalidated */
+static int bgp_load_vrps(struct bgp_speaker *spk) {
+    uint64_t start = tw_now_ms();
+    long revalidated = bgp_rpki_load(&spk->rpki, &spk->rib, spk->vrp_path);
+    if (revalidated < 0) {
+        return -1;
+    }
+    printf("Loaded %zu VRPs from %s in %llu ms: %lu changed, %lu IPv6 skipped, %lu errors, "
+           "%ld prefixes revalidated\n", spk->rpki.num_vrps, spk->vrp_path,
+           (unsigned long long)(tw_now_ms() - start), spk->rpki.changed, spk->rpki.skipped,
+           spk->rpki.errors, revalidated);
+    return 0;
+}
+
+/* Function to bulk-load MRT dumps into the RIB and decide every prefix */
+static int bgp_load_mrt(struct bgp_speaker *spk, char **files, int num_files, int threads) {
+    for (int i = 0; i < num_files; i++) {
+        uint64_t start = tw_now_ms();
+        unsigned long routes = spk->mrt.routes;
+        if (bgp_mrt_load(&spk->rib, &spk->mrt, files[i], spk->local_as, threads) < 0) {
+            return -1;
+        }
+        uint64_t loaded = tw_now_ms();
+        size_t decided = bgp_rib_process(&spk->rib, 0);
+        uint64_t done = tw_now_ms();
+        unsigned long n = spk->mrt.routes - routes;
+        printf("Loaded %s: %lu routes in %llu ms (%.0f routes/s, %d threads), "
+               "best path for %zu prefixes in %llu ms\n",
+               files[i], n, (unsigned long long)(loaded - start),
+               n * 1000.0 / (loaded - start + 1), threads, decided,
+               (unsigned long long)(done - loaded));
+    }
+    printf("MRT: %u peers, %lu records, %lu routes, %lu withdrawals, %lu skipped, %lu errors\n",
+           spk->mrt.num_peers, spk->mrt.records, spk->mrt.routes, spk->mrt.withdrawals,
+           spk->mrt.skipped, spk->mrt.errors);
+    return 0;
+}
+
+/* One lookup thread of the FIB benchmark */
+struct fib_bench_thread {
+    pthread_t tid;               /* Thread running fib_bench_worker */
+    struct fib *fib;             /* Table under test */
+    const uint32_t *addrs;       /* Destination addresses to look up */
+    size_t num_addrs;            /* Entries in addrs[] */
+    volatile int *stop;          /* Set by the main thread to end the run */
+    unsigned long lookups;       /* Lookups done */
+    unsigned long misses;        /* Lookups that found no route */
+    uint64_t ns;                 /* Time spent looking up */
+};
+
+/* Function to read CLOCK_MONOTONIC in nanoseconds */
+static uint64_t bgp_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to look addresses up until told to stop; each batch of lookups is one
+ * epoch critical section, so a concurrent writer never waits for the reader */
+static void *fib_bench_worker(void *arg) {
+    struct fib_bench_thread *t = arg;
+    struct fib *f = t->fib;
+    int slot = epoch_register(&f->epoch);
+    if (slot < 0) {
+        return NULL;
+    }
+    uint64_t start = bgp_now_ns();
+    while (!*t->stop) {
+        for (size_t i = 0; i < t->num_addrs && !*t->stop; i += FIB_BENCH_BATCH) {
+            size_t end = i + FIB_BENCH_BATCH < t->num_addrs ? i + FIB_BENCH_BATCH : t->num_addrs;
+            epoch_enter(&f->epoch, slot);
+            for (size_t j = i; j < end; j++) {
+                uint32_t nh = fib_lookup(f, t->addrs[j]);
+                t->misses += fib_nexthop_addr(f, nh) == 0;
+            }
+            epoch_exit(&f->epoch, slot);
+            t->lookups += end - i;
+        }
+    }
+    t->ns = bgp_now_ns() - start;
+    epoch_unregister(&f->epoch, slot);
+    return NULL;
+}
+
+/* Function to run one benchmark pass: threads look addresses up for FIB_BENCH_MS
+ * while, if routes is non-NULL, this thread withdraws and reinstalls them */
+static void fib_bench_run(struct bgp_speaker *spk, const char *label, const uint32_t *addrs,
+                          size_t num_addrs, int threads, const struct bgp_dest **routes,
+                          size_t num_routes) {
+    struct fib_bench_thread *t = calloc(threads, sizeof(*t));
+    volatile int stop = 0;
+    if (!t) {
+        perror("Failed to allocate benchmark threads");
+        return;
+    }
+    int started = 0;
+    for (; started < threads; started++) {
+        t[started].fib = &spk->fib;
+        t[started].addrs = addrs + (num_addrs / threads) * started; /* Spread start points */
+        t[started].num_addrs = num_addrs - (num_addrs / threads) * started;
+        t[started].stop = &stop;
+        if (pthread_create(&t[started].tid, NULL, fib_bench_worker, &t[started]) != 0) {
+            perror("pthread_create failed");
+            break;
+        }
+    }
+
+    /* Idle runs just wait; churn runs flap routes until the time is up */
+    uint64_t start = bgp_now_ns();
+    uint64_t end = start + FIB_BENCH_MS * 1000000ULL;
+    unsigned long flaps = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    while (bgp_now_ns() < end) {
+        if (!routes || num_routes == 0) {
+            usleep(10000);
+            continue;
+        }
+        for (int k = 0; k < 256; k++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            const struct bgp_dest *d = routes[seed % num_routes];
+            fib_delete(&spk->fib, d->prefix, d->plen);
+            fib_insert(&spk->fib, d->prefix, d->plen, d->best->attrs->next_hop);
+            flaps++;
+        }
+    }
+    uint64_t elapsed = bgp_now_ns() - start;
+    stop = 1;
+
+    unsigned long lookups = 0;
+    unsigned long misses = 0;
+    double rate = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(t[i].tid, NULL);
+        lookups += t[i].lookups;
+        misses += t[i].misses;
+        if (t[i].ns > 0) {
+            rate += t[i].lookups * 1e9 / t[i].ns;
+        }
     }
+    if (started > 0 && lookups > 0) {
+        printf("FIB %-9s %d threads: %.1f ns/lookup, %.1f M lookups/s per thread, "
+               "%.1f M lookups/s total, %.1f%% no route",
+               label, started, started * 1e9 / rate, rate / started / 1e6, rate / 1e6,
+               100.0 * misses / lookups);
+        if (routes) {
+            printf(", %.0f route flaps/s", flaps * 1e9 / elapsed);
+        }
+        printf("\n");
+    }
+    fib_reclaim(&spk->fib);
+    free(t);
+}
+
+/* Walk callback: collect destinations that have a Loc-RIB route */
+static int fib_bench_collect(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    (void)prefix;
+    (void)plen;
+    const struct bgp_dest *d = data;
+    struct { const struct bgp_dest **v; size_t n; } *c = arg;
+    if (d->best) {
+        c->v[c->n++] = d;
+    }
+    return 0;
+}
 
-    /* Set up peer address */
-    struct sockaddr_in peer_addr;
-    memset(&peer_addr, 0, sizeof(peer_addr));
-    peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(peer_port);
-    if (inet_pton(AF_INET, peer_ip, &peer_addr.sin_addr) <= 0) {
-        perror("Invalid peer IP address");
-        close(sockfd);
+/* Function to read a trace of destination addresses, one dotted quad per line */
+static size_t fib_bench_read_trace(const char *path, uint32_t *addrs, size_t max) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Failed to open trace");
+        return 0;
+    }
+    char line[64];
+    size_t n = 0;
+    while (n < max && fgets(line, sizeof(line), fp)) {
+        struct in_addr a;
+        line[strcspn(line, " \t\r\n")] = '\0';
+        if (inet_pton(AF_INET, line, &a) == 1) {
+            addrs[n++] = ntohl(a.s_addr);
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+/* Function to benchmark FIB lookups with uniformly random addresses and with a
+ * traffic trace (read from trace_path, or drawn from the installed prefixes with
+ * a skewed popularity), first on a quiet table and then under route churn */
+static void bgp_fib_bench(struct bgp_speaker *spk, int threads, const char *trace_path) {
+    size_t num_dests = spk->rib.trie.count;
+    uint32_t *random_addrs = malloc(FIB_BENCH_ADDRS * sizeof(uint32_t));
+    uint32_t *trace = malloc(FIB_BENCH_ADDRS * sizeof(uint32_t));
+    const struct bgp_dest **routes = malloc((num_dests + 1) * sizeof(*routes));
+    if (!random_addrs || !trace || !routes) {
+        perror("Failed to allocate benchmark addresses");
+        free(random_addrs);
+        free(trace);
+        free(routes);
+        return;
+    }
+    struct { const struct bgp_dest **v; size_t n; } collected = { routes, 0 };
+    ptrie_walk(&spk->rib.trie, fib_bench_collect, &collected);
+    size_t num_routes = collected.n;
+
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i < FIB_BENCH_ADDRS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        random_addrs[i] = (uint32_t)seed;
+    }
+    size_t trace_len = 0;
+    if (trace_path) {
+        trace_len = fib_bench_read_trace(trace_path, trace, FIB_BENCH_ADDRS);
+    } else if (num_routes > 0) {
+        /* Cubing a uniform draw favours low ranks, like real traffic favouring a
+         * few popular destinations; the stride scatters ranks across the table */
+        for (size_t i = 0; i < FIB_BENCH_ADDRS; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            double u = (seed >> 11) * (1.0 / 9007199254740992.0);
+            size_t rank = (size_t)(u * u * u * num_routes);
+            const struct bgp_dest *d = routes[(rank * 2654435761ULL) % num_routes];
+            trace[i] = d->prefix | ((uint32_t)(seed >> 32) & ~ptrie_mask(d->plen));
+        }
+        trace_len = FIB_BENCH_ADDRS;
+    }
+
+    bgp_fib_stats(spk);
+    fib_bench_run(spk, "random", random_addrs, FIB_BENCH_ADDRS, threads, NULL, 0);
+    if (trace_len > 0) {
+        fib_bench_run(spk, "trace", trace, trace_len, threads, NULL, 0);
+    }
+    if (num_routes > 0) {
+        fib_bench_run(spk, "churn", random_addrs, FIB_BENCH_ADDRS, threads, routes, num_routes);
+    }
+    free(random_addrs);
+    free(trace);
+    free(routes);
+}
+
+/* Validation timing state for the benchmark */
+struct rpki_bench {
+    const struct bgp_rpki *rpki;            /* VRPs to validate against */
+    unsigned long counts[BGP_RPKI_STATES];  /* Routes found in each state */
+};
+
+/* Walk callback: validate a destination's Loc-RIB route once more */
+static int bgp_rpki_bench_visit(uint32_t prefix, uint8_t plen, void *data, void *arg) {
+    const struct bgp_dest *dest = data;
+    struct rpki_bench *b = arg;
+    if (dest->best) {
+        b->counts[bgp_rpki_validate(b->rpki, prefix, plen,
+                                    bgp_attrs_origin_as(dest->best->attrs))]++;
+    }
+    return 0;
+}
+
+/* Function to time origin validation of every Loc-RIB route */
+static void bgp_rpki_bench(struct bgp_speaker *spk) {
+    struct rpki_bench b = { &spk->rpki, { 0 } };
+    uint64_t start = bgp_now_ns();
+    ptrie_walk(&spk->rib.trie, bgp_rpki_bench_visit, &b);
+    uint64_t ns = bgp_now_ns() - start;
+    unsigned long n = b.counts[0] + b.counts[1] + b.counts[2];
+    printf("RPKI: validated %lu routes in %.1f ms (%.0f ns/route, walk included): "
+           "%lu valid, %lu invalid, %lu not found\n", n, ns / 1e6, n ? (double)ns / n : 0.0,
+           b.counts[BGP_RPKI_VALID], b.counts[BGP_RPKI_INVALID], b.counts[BGP_RPKI_NOT_FOUND]);
+}
+
+/* Function to run the event loop until SIGINT/SIGTERM */
+static void bgp_run(struct bgp_speaker *spk) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!stop_requested) {
+        uint64_t now = tw_now_ms();
+        int timeout = tw_timeout_ms(&spk->timers, now);
+        if (spk->rib_due_ms) {
+            int due = spk->rib_due_ms > now ? (int)(spk->rib_due_ms - now) : 0;
+            if (timeout < 0 || due < timeout) {
+                timeout = due;
+            }
+        }
+        int n = epoll_wait(spk->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct bgp_peer *peer = events[i].data.ptr;
+            if (!peer) {
+                bgp_accept(spk);
+                continue;
+            }
+            if (peer->dead || peer->fd < 0) {
+                continue; /* Session torn down earlier in this pass */
+            }
+            if (peer->state == BGP_CONNECT) {
+                bgp_peer_connected(peer);
+            } else {
+                if (events[i].events & EPOLLOUT) {
+                    bgp_peer_flush(peer);
+                }
+                if (peer->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                    bgp_peer_readable(peer);
+                }
+            }
+        }
+
+        tw_advance(&spk->timers, tw_now_ms());
+        bgp_reap_peers(spk);
+        bgp_rib_batch(spk);
+        bgp_flush_peers(spk);
+
+        if (stats_requested) {
+            stats_requested = 0;
+            bgp_print_stats(spk);
+        }
+        if (snapshot_requested) {
+            snapshot_requested = 0;
+            bgp_write_snapshot(spk);
+        }
+        if (vrp_reload_requested) {
+            vrp_reload_requested = 0;
+            bgp_load_vrps(spk);
+        }
+    }
+
+    /* Graceful shutdown: send Cease on every open session */
+    for (int i = 0; i < spk->num_peers; i++) {
+        bgp_fsm(spk->peers[i], BGP_EV_STOP);
+        bgp_rxring_free(&spk->peers[i]->rx);
+        free(spk->peers[i]);
+    }
+    spk->num_peers = 0;
+}
+
+/* Signal handler: request a graceful stop */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* Signal handler: request a statistics dump */
+static void handle_stats(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+/* Signal handler: request a VRP reload */
+static void handle_reload(int sig) {
+    (void)sig;
+    vrp_reload_requested = 1;
+}
+
+/* Signal handler: request an MRT snapshot */
+static void handle_snapshot(int sig) {
+    (void)sig;
+    snapshot_requested = 1;
+}
+
+/* Main function: Entry point of the BGP speaker */
+int main(int argc, char *argv[]) {
+    struct bgp_speaker spk;
+    memset(&spk, 0, sizeof(spk));
+    spk.router_id = 0xC0A80001; /* 192.168.0.1 unless overridden */
+    spk.hold_time = BGP_HOLD_TIME;
+    spk.listen_fd = -1;
+    int listen_port = 0;
+    char *mrt_files[MAX_MRT_FILES];
+    int num_mrt = 0;
+    int mrt_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int bench = 0;
+    const char *trace_path = NULL;
+    int reject_invalid = 0;
+
+    /* Parse options */
+    int opt;
+    while ((opt = getopt(argc, argv, "i:t:l:avm:j:w:bT:r:R")) != -1) {
+        struct in_addr id;
+        switch (opt) {
+        case 'i':
+            if (inet_pton(AF_INET, optarg, &id) <= 0) {
+                fprintf(stderr, "Invalid router ID: %s\n", optarg);
+                exit(1);
+            }
+            spk.router_id = ntohl(id.s_addr);
+            break;
+        case 't':
+            spk.hold_time = atoi(optarg);
+            break;
+        case 'l':
+            listen_port = atoi(optarg);
+            break;
+        case 'a':
+            spk.accept_any = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'm':
+            if (num_mrt == MAX_MRT_FILES) {
+                fprintf(stderr, "Too many MRT files (max %d)\n", MAX_MRT_FILES);
+                exit(1);
+            }
+            mrt_files[num_mrt++] = optarg;
+            break;
+        case 'j':
+            mrt_threads = atoi(optarg);
+            break;
+        case 'w':
+            spk.snapshot_path = optarg;
+            break;
+        case 'b':
+            bench = 1;
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'r':
+            spk.vrp_path = optarg;
+            break;
+        case 'R':
+            reject_invalid = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    /* Remaining arguments: <local_as> followed by zero or more peer triples */
+    int npos = argc - optind;
+    if (npos < 1 || (npos - 1) % 3 != 0 || (npos == 1 && listen_port == 0 && !bench) ||
+        (spk.hold_time != 0 && spk.hold_time < 3) || (bench && num_mrt == 0)) {
+usage:
+        fprintf(stderr, "Usage: %s [-i router_id] [-t hold_time] [-l listen_port [-a]] [-v]\n"
+                        "          [-m dump.mrt]... [-j threads] [-w snapshot.mrt] [-b [-T trace]]\n"
+                        "          [-r vrps.json|vrps.csv [-R]]\n"
+                        "          <local_as> [<peer_ip> <peer_as> <peer_port>]...\n", argv[0]);
+        fprintf(stderr, "  -m  preload an uncompressed MRT dump (TABLE_DUMP_V2 or BGP4MP)\n"
+                        "  -j  MRT parser and FIB lookup threads (default: online CPUs)\n"
+                        "  -w  MRT snapshot file, written on SIGUSR2\n"
+                        "  -b  benchmark: load the -m dumps, write -w if given, time FIB lookups,\n"
+                        "      print stats, exit\n"
+                        "  -T  FIB benchmark trace, one destination address per line\n"
+                        "      (default: addresses drawn from the loaded prefixes)\n"
+                        "  -r  RPKI VRPs (JSON or CSV export), reloaded on SIGHUP\n"
+                        "  -R  make RPKI Invalid routes ineligible for best path\n");
+        fprintf(stderr, "Example: %s 65001 127.0.0.1 65002 179\n", argv[0]);
+        fprintf(stderr, "         %s -i 10.0.0.1 -l 1179 -a 65001\n", argv[0]);
+        fprintf(stderr, "         %s -b -m rib.20240101.0000 65001\n", argv[0]);
         exit(1);
     }
+    spk.local_as = strtoul(argv[optind], NULL, 10);
 
-    /* Connect to peer */
-    if (connect(sockfd, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) < 0) {
-        perror("Connection to peer failed");
-        close(sockfd);
+    /* Create the epoll instance and timer wheel */
+    spk.epfd = epoll_create1(0);
+    if (spk.epfd < 0) {
+        perror("epoll_create1 failed");
         exit(1);
     }
-    printf("Connected to peer %s:%d\n", peer_ip, peer_port);
-
-    /* Prepare BGP OPEN message */
-    struct bgp_open open_msg;
-    memset(&open_msg, 0, sizeof(open_msg));
-    init_bgp_header(&open_msg.header, sizeof(struct bgp_open), BGP_OPEN);
-    open_msg.version = 4;                    /* BGP-4 */
-    open_msg.my_as = htons(local_as);        /* Local AS */
-    open_msg.hold_time = htons(180);         /* 3 minutes */
-    open_msg.bgp_id = htonl(0xC0A80001);     /* 192.168.0.1 (hardcoded for simplicity) */
-    open_msg.opt_param_len = 0;              /* No optional parameters */
-
-    /* Send OPEN message */
-    if (send_bgp_message(sockfd, &open_msg, sizeof(open_msg)) < 0) {
-        close(sockfd);
+    tw_init(&spk.timers, TIMER_TICK_MS);
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    signal(SIGUSR1, handle_stats);
+    signal(SIGUSR2, handle_snapshot);
+    signal(SIGHUP, handle_reload);
+    bgp_rib_init(&spk.rib);
+    spk.rib.notify = bgp_rib_changed;
+    spk.rib.notify_arg = &spk;
+    spk.rib.reject_invalid = reject_invalid;
+    bgp_rpki_init(&spk.rpki);
+    if (spk.vrp_path) {
+        spk.rib.rpki = &spk.rpki;
+        if (bgp_load_vrps(&spk) < 0) {
+            exit(1);
+        }
+    }
+    if (fib_init(&spk.fib, FIB_TBL8_GROUPS, FIB_MAX_NEXTHOPS) < 0) {
+        fprintf(stderr, "Failed to allocate forwarding table\n");
         exit(1);
     }
+    bgp_mrt_source_init(&spk.mrt);
 
-    /* Receive peer’s OPEN message */
-    unsigned char buffer[BUFFER_SIZE];
-    int len = receive_bgp_message(sockfd, buffer, sizeof(buffer));
-    if (len < 0 || ((struct bgp_header*)buffer)->type != BGP_OPEN) {
-        fprintf(stderr, "Failed to receive valid OPEN message\n");
-        close(sockfd);
+    if (num_mrt > 0 && bgp_load_mrt(&spk, mrt_files, num_mrt, mrt_threads) < 0) {
         exit(1);
     }
-    struct bgp_open *peer_open = (struct bgp_open*)buffer;
-    printf("Received OPEN: AS %u, Hold Time %u, BGP ID %x\n",
-           ntohs(peer_open->my_as), ntohs(peer_open->hold_time), ntohl(peer_open->bgp_id));
+    if (bench) {
+        if (spk.snapshot_path) {
+            bgp_write_snapshot(&spk);
+        }
+        bgp_fib_bench(&spk, mrt_threads > 0 ? mrt_threads : 1, trace_path);
+        if (spk.vrp_path) {
+            bgp_rpki_bench(&spk);
+        }
+        bgp_rib_stats(&spk.rib, stdout);
+        bgp_mrt_source_free(&spk.rib, &spk.mrt);
+        bgp_rib_destroy(&spk.rib);
+        fib_destroy(&spk.fib);
+        bgp_rpki_free(&spk.rpki);
+        return 0;
+    }
+    signal(SIGPIPE, SIG_IGN); /* Writes to a dead peer fail with EPIPE instead */
 
-    /* Send KEEPALIVE message */
-    struct bgp_header keepalive;
-    init_bgp_header(&keepalive, sizeof(struct bgp_header), BGP_KEEPALIVE);
-    if (send_bgp_message(sockfd, &keepalive, sizeof(keepalive)) < 0) {
-        close(sockfd);
+    if (listen_port && bgp_listen(&spk, listen_port) < 0) {
         exit(1);
     }
 
-    /* Close socket */
-    close(sockfd);
-    printf("BGP session simulation completed\n");
+    /* Configure peers and kick their FSMs with ManualStart */
+    for (int i = optind + 1; i + 2 < argc; i += 3) {
+        struct sockaddr_in peer_addr;
+        memset(&peer_addr, 0, sizeof(peer_addr));
+        peer_addr.sin_family = AF_INET;
+        peer_addr.sin_port = htons(atoi(argv[i + 2]));
+        if (inet_pton(AF_INET, argv[i], &peer_addr.sin_addr) <= 0) {
+            fprintf(stderr, "Invalid peer IP address: %s\n", argv[i]);
+            exit(1);
+        }
+        struct bgp_peer *peer = bgp_add_peer(&spk, &peer_addr, strtoul(argv[i + 1], NULL, 10));
+        if (!peer) {
+            exit(1);
+        }
+        bgp_fsm(peer, BGP_EV_START);
+    }
+
+    bgp_run(&spk);
+    bgp_mrt_source_free(&spk.rib, &spk.mrt);
+    bgp_rib_destroy(&spk.rib);
+    fib_destroy(&spk.fib);
+    bgp_rpki_free(&spk.rpki);
+
+    if (spk.listen_fd >= 0) {
+        close(spk.listen_fd);
+    }
+    close(spk.epfd);
+    printf("BGP speaker stopped\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,74 @@
+/* bgp_update.c: UPDATE message decoding for the BGP speaker (see include/bgp_update.h). */
+
+/* Include BGP definitions */
+#include <stddef.h>     /* For NULL */
+#include "bgp.h"        /* For BGP_HEADER_LEN, bgp_get16 */
+#include "bgp_attr.h"   /* For BGP_ERR_UPD_* subcodes */
+#include "bgp_update.h" /* For struct bgp_update */
+
+/* Function to split an UPDATE into its three sections */
+int bgp_update_decode(const uint8_t *msg, uint16_t len, struct bgp_update *upd,
+                      uint8_t *err_subcode) {
+    const uint8_t *p = msg + BGP_HEADER_LEN;
+    size_t body = len - BGP_HEADER_LEN;
+
+    /* Withdrawn Routes Length (2) + Total Path Attribute Length (2) at minimum */
+    if (len < BGP_HEADER_LEN + 4) {
+        *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+        return -1;
+    }
+    upd->withdrawn_len = bgp_get16(p);
+    if ((size_t)upd->withdrawn_len + 4 > body) {
+        *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+        return -1;
+    }
+    upd->withdrawn = p + 2;
+    upd->attrs_len = bgp_get16(p + 2 + upd->withdrawn_len);
+    if ((size_t)upd->withdrawn_len + upd->attrs_len + 4 > body) {
+        *err_subcode = BGP_ERR_UPD_MALFORMED_ATTRS;
+        return -1;
+    }
+    upd->attrs = p + 4 + upd->withdrawn_len;
+    upd->nlri = upd->attrs + upd->attrs_len;
+    upd->nlri_len = body - 4 - upd->withdrawn_len - upd->attrs_len;
+
+    if (bgp_prefixes_check(upd->withdrawn, upd->withdrawn_len) < 0 ||
+        bgp_prefixes_check(upd->nlri, upd->nlri_len) < 0) {
+        *err_subcode = BGP_ERR_UPD_NETWORK;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to validate an encoded prefix list */
+int bgp_prefixes_check(const uint8_t *p, uint16_t len) {
+    int count = 0;
+    size_t off = 0;
+    while (off < len) {
+        uint8_t plen = p[off];
+        if (plen > 32 || off + 1 + (plen + 7) / 8 > len) {
+            return -1;
+        }
+        off += 1 + (plen + 7) / 8;
+        count++;
+    }
+    return count;
+}
+
+/* Function to decode one prefix: length octet, then the significant octets */
+int bgp_prefix_next(const uint8_t **pos, const uint8_t *end, uint32_t *prefix, uint8_t *plen) {
+    const uint8_t *p = *pos;
+    if (p >= end) {
+        return 0;
+    }
+    uint8_t bits = p[0];
+    int bytes = (bits + 7) / 8;
+    uint32_t addr = 0;
+    for (int i = 0; i < bytes; i++) {
+        addr |= (uint32_t)p[1 + i] << (24 - 8 * i);
+    }
+    *prefix = bits ? addr & (~0u << (32 - bits)) : 0; /* Ignore trailing host bits */
+    *plen = bits;
+    *pos = p + 1 + bytes;
+    return 1;
+}
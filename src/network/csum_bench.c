@@ -0,0 +1,230 @@
+/* csum_bench.c: Checks and measures the shared Internet checksum (inet_csum). It
+ * first compares every bulk sum implementation the CPU can run, and the RFC 1624
+ * incremental updates, against a plain 16-bit reference loop on random buffers of
+ * random lengths and alignments, then times each implementation over a range of
+ * packet sizes and prints the throughput in GB/s. Exits with status 1 if any
+ * result differs. Like a librarian checking a new adding machine against a column
+ * of sums done by hand before timing how fast it gets through the ledger. */
+
+/* Include standard libraries for I/O, memory and timing */
+#include <stdio.h>       /* For printf, fprintf */
+#include <stdlib.h>      /* For exit, malloc, free, atoi */
+#include <string.h>      /* For memcpy, memset */
+#include <unistd.h>      /* For getopt */
+#include <time.h>        /* For clock_gettime */
+#include "inet_csum.h"   /* For csum_partial, csum_update*, csum_set_impl */
+
+/* Packet sizes timed, in bytes */
+static const size_t bench_sizes[] = { 20, 40, 64, 128, 256, 576, 1500, 4096, 9000, 65536 };
+#define NUM_SIZES (int)(sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+/* Default time spent on each size (milliseconds) */
+#define DEFAULT_BENCH_MS 100
+/* Random buffers checked per implementation */
+#define CHECK_ROUNDS 20000
+/* Largest buffer checked */
+#define CHECK_MAX_LEN 2048
+
+/* Keeps the timed sums from being optimized away */
+static volatile uint32_t sink;
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to draw a pseudo-random number (xorshift64) */
+static uint64_t next_random(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+/* Function to compute the checksum the way the pingers used to: 16 bits at a time */
+static uint16_t reference_csum(const void *b, size_t len) {
+    const unsigned char *p = b;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2, p += 2) {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
+    }
+    if (len == 1) {
+        unsigned char last[2] = { *p, 0 };
+        uint16_t w;
+        memcpy(&w, last, 2);
+        sum += w;
+    }
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/* Function to compare one implementation against the reference. Returns the
+ * number of mismatches. */
+static unsigned long check_impl(unsigned char *buf, uint64_t *seed) {
+    unsigned long bad = 0;
+    for (int i = 0; i < CHECK_ROUNDS; i++) {
+        size_t off = next_random(seed) % 64;
+        size_t len = next_random(seed) % CHECK_MAX_LEN;
+        unsigned char *p = buf + off;
+        for (size_t k = 0; k < len; k++) {
+            p[k] = (unsigned char)next_random(seed);
+        }
+        if (i % 8 == 0) {
+            memset(p, 0xFF, len); /* Worst case for carries */
+        }
+        uint16_t want = reference_csum(p, len);
+        if (inet_csum(p, len) != want) {
+            bad++;
+        }
+        /* Summing in two even-length pieces must give the same answer */
+        size_t split = (next_random(seed) % (len + 1)) & ~(size_t)1;
+        if (csum_fold(csum_partial(p + split, len - split, csum_partial(p, split, 0))) != want) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/* Function to check the incremental updates against a full recomputation. Returns
+ * the number of mismatches. */
+static unsigned long check_updates(uint64_t *seed) {
+    unsigned long bad = 0;
+    for (int i = 0; i < CHECK_ROUNDS; i++) {
+        unsigned char pkt[60];
+        for (size_t k = 0; k < sizeof(pkt); k++) {
+            pkt[k] = (unsigned char)next_random(seed);
+        }
+        pkt[10] = pkt[11] = 0;
+        uint16_t check = inet_csum(pkt, sizeof(pkt));
+        memcpy(pkt + 10, &check, 2);
+
+        /* TTL (byte 8), IPv4 address (bytes 12..15), IPv6 address (bytes 20..35) */
+        uint8_t old_ttl = pkt[8];
+        pkt[8] = (uint8_t)next_random(seed);
+        check = csum_update_ttl(check, old_ttl, pkt[8]);
+        uint32_t old_addr, new_addr = (uint32_t)next_random(seed);
+        memcpy(&old_addr, pkt + 12, 4);
+        memcpy(pkt + 12, &new_addr, 4);
+        check = csum_update32(check, old_addr, new_addr);
+        unsigned char old6[16];
+        memcpy(old6, pkt + 20, 16);
+        for (int k = 20; k < 36; k++) {
+            pkt[k] = (unsigned char)next_random(seed);
+        }
+        check = csum_update128(check, old6, pkt + 20);
+
+        /* A packet with a correct checksum sums to zero */
+        memcpy(pkt + 10, &check, 2);
+        if (inet_csum(pkt, sizeof(pkt)) != 0) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/* Function to time one implementation on one size. Returns GB/s. */
+static double time_size(const unsigned char *buf, size_t len, unsigned ms, int reference) {
+    uint64_t deadline = now_ns() + ms * 1000000ULL;
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    uint64_t end;
+    uint32_t acc = 0;
+    do {
+        for (int i = 0; i < 256; i++) {
+            acc += reference ? reference_csum(buf, len) : inet_csum(buf, len);
+        }
+        bytes += 256 * (uint64_t)len;
+        end = now_ns();
+    } while (end < deadline);
+    sink = acc;
+    return (double)bytes / (end - start);
+}
+
+/* Function to print one row of the throughput table */
+static void bench_row(const char *name, const unsigned char *buf, unsigned ms, int reference) {
+    printf("%-10s", name);
+    for (int i = 0; i < NUM_SIZES; i++) {
+        printf(" %7.2f", time_size(buf, bench_sizes[i], ms, reference));
+    }
+    printf("\n");
+}
+
+/* Main function: Entry point of the checksum benchmark */
+int main(int argc, char *argv[]) {
+    unsigned ms = DEFAULT_BENCH_MS;
+    size_t align = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:o:")) != -1) {
+        switch (opt) {
+        case 'm':
+            ms = (unsigned)atoi(optarg);
+            break;
+        case 'o':
+            align = (size_t)atoi(optarg) % 64;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m ms_per_size] [-o buffer_offset]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (ms == 0) {
+        fprintf(stderr, "Time per size must be positive\n");
+        exit(1);
+    }
+
+    size_t max_size = bench_sizes[NUM_SIZES - 1];
+    unsigned char *mem = malloc(max_size + CHECK_MAX_LEN + 128);
+    if (!mem) {
+        perror("Failed to allocate buffers");
+        exit(1);
+    }
+    /* Start the timed buffer on a cache line, plus the requested offset */
+    unsigned char *buf = mem + (64 - (uintptr_t)mem % 64) % 64 + align;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    /* Correctness first: every implementation must agree with the reference */
+    unsigned long bad = 0;
+    for (int impl = CSUM_IMPL_PORTABLE; impl <= CSUM_IMPL_AVX2; impl++) {
+        if (csum_set_impl(impl) < 0) {
+            printf("%-10s not supported by this CPU\n", csum_impl_name(impl));
+            continue;
+        }
+        unsigned long n = check_impl(mem, &seed);
+        printf("%-10s %s (%d random buffers)\n", csum_impl_name(impl), n ? "MISMATCH" : "ok",
+               CHECK_ROUNDS);
+        bad += n;
+    }
+    csum_set_impl(CSUM_IMPL_AUTO);
+    unsigned long n = check_updates(&seed);
+    printf("%-10s %s (TTL, IPv4 and IPv6 address rewrites)\n", "rfc1624", n ? "MISMATCH" : "ok");
+    bad += n;
+
+    /* Then throughput, in GB/s, for each implementation and size */
+    for (size_t k = 0; k < max_size; k++) {
+        buf[k] = (unsigned char)next_random(&seed);
+    }
+    printf("\nGB/s, buffer offset %zu, %u ms per size, auto = %s\n", align, ms,
+           csum_impl_name(csum_get_impl()));
+    printf("%-10s", "bytes");
+    for (int i = 0; i < NUM_SIZES; i++) {
+        printf(" %7zu", bench_sizes[i]);
+    }
+    printf("\n");
+    bench_row("reference", buf, ms, 1);
+    for (int impl = CSUM_IMPL_PORTABLE; impl <= CSUM_IMPL_AVX2; impl++) {
+        if (csum_set_impl(impl) == 0) {
+            bench_row(csum_impl_name(impl), buf, ms, 0);
+        }
+    }
+
+    free(mem);
+    if (bad) {
+        fprintf(stderr, "%lu checksum mismatches\n", bad);
+        exit(1);
+    }
+    return 0;
+}
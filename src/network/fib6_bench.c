@@ -0,0 +1,579 @@
+/* fib6_bench.c: Checks and measures the IPv6 forwarding table (fib6). It builds
+ * a table shaped like the IPv6 default-free zone (about 200k prefixes, mostly
+ * /48, /32, /40, /44 and /29, clustered inside provider allocations the way real
+ * more-specifics are), or loads one from a file of "prefix/len" lines, and first
+ * compares every lookup against a longest-prefix match done in the writer's trie,
+ * including after a round of deletes and re-inserts. It then times lookups per
+ * second per thread with random traffic (every prefix equally likely) and skewed
+ * traffic (Zipf over prefixes, as real flows are), one at a time and in batches,
+ * as the table grows and for several direct array sizes, next to the average and
+ * worst number of nodes a lookup visits. Exits with status 1 if any result
+ * differs. Like a librarian timing how fast the catalogue answers queries as the
+ * collection grows, after checking every answer against the shelves. */
+
+/* Include standard libraries for I/O, memory, threads and timing */
+#include <stdio.h>        /* For printf, fprintf, fopen, fgets */
+#include <stdlib.h>       /* For exit, malloc, calloc, free, atoi, strtoul */
+#include <string.h>       /* For memset, strchr, strtok */
+#include <unistd.h>       /* For getopt */
+#include <time.h>         /* For clock_gettime */
+#include <math.h>         /* For pow */
+#include <pthread.h>      /* For pthread_create, pthread_join */
+#include <arpa/inet.h>    /* For inet_pton */
+#include "fib6.h"         /* For struct fib6, fib6_* */
+
+/* Default table size (the IPv6 DFZ is around this) */
+#define DEFAULT_PREFIXES 200000
+/* Default time per measurement (milliseconds) */
+#define DEFAULT_BENCH_MS 300
+/* Destination addresses generated per traffic pattern */
+#define NUM_ADDRS (1 << 20)
+/* Distinct next hops (peers) routes point at */
+#define NUM_NEXTHOPS 64
+/* Zipf exponent of the skewed traffic */
+#define ZIPF_S 1.0
+/* Lookups per timing step */
+#define BENCH_CHUNK 256
+/* Direct array sizes compared at the full table size */
+static const unsigned bench_direct_bits[] = { 12, 16, 18, 20 };
+#define NUM_DIRECT (int)(sizeof(bench_direct_bits) / sizeof(bench_direct_bits[0]))
+
+/* Share of the table each prefix length takes, per mille (after DFZ reports) */
+static const struct {
+    uint8_t plen;
+    unsigned weight;
+} table_lengths[] = {
+    { 20, 1 }, { 24, 3 }, { 28, 12 }, { 29, 55 }, { 30, 6 }, { 31, 5 }, { 32, 150 },
+    { 33, 15 }, { 34, 18 }, { 35, 8 }, { 36, 45 }, { 37, 8 }, { 38, 14 }, { 39, 8 },
+    { 40, 80 }, { 41, 5 }, { 42, 15 }, { 43, 6 }, { 44, 65 }, { 45, 10 }, { 46, 30 },
+    { 47, 20 }, { 48, 400 }, { 56, 8 }, { 64, 3 },
+};
+#define NUM_LENGTHS (int)(sizeof(table_lengths) / sizeof(table_lengths[0]))
+
+/* Regional registry blocks allocations are drawn from (first 16 bits) */
+static const uint16_t rir_blocks[] = { 0x2001, 0x2400, 0x2600, 0x2800, 0x2a00, 0x2c00 };
+#define NUM_RIR (int)(sizeof(rir_blocks) / sizeof(rir_blocks[0]))
+
+/* One route of the test table */
+struct bench_route {
+    struct in6_addr prefix;
+    uint8_t plen;
+    uint16_t next_hop;
+};
+
+/* One timing thread */
+struct bench_thread {
+    pthread_t tid;
+    const struct fib6 *f;
+    const struct in6_addr *addrs;   /* NUM_ADDRS destinations */
+    size_t start;                   /* Where in addrs this thread begins */
+    int batch;                      /* Use fib6_lookup_batch */
+    uint64_t deadline;              /* Stop time (now_ns) */
+    unsigned long lookups;          /* Result */
+    uint64_t elapsed;               /* Result (ns) */
+    unsigned sum;                   /* Keeps the results live */
+};
+
+/* Keeps the timed lookups from being optimized away */
+static volatile unsigned sink;
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to draw a pseudo-random number (xorshift64) */
+static uint64_t next_random(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+/* Function to set the bits of a from bit plen on to random values */
+static void randomize_below(struct in6_addr *a, uint8_t plen, uint64_t *seed) {
+    for (int i = plen; i < 128; i++) {
+        int byte = i / 8, bit = 7 - i % 8;
+        a->s6_addr[byte] &= (uint8_t)~(1u << bit);
+        a->s6_addr[byte] |= (uint8_t)((next_random(seed) & 1) << bit);
+    }
+}
+
+/* Function to clear the bits of a from bit plen on */
+static void mask_below(struct in6_addr *a, uint8_t plen) {
+    for (int i = plen; i < 128; i++) {
+        a->s6_addr[i / 8] &= (uint8_t)~(1u << (7 - i % 8));
+    }
+}
+
+/* Function to draw a prefix length from the DFZ distribution */
+static uint8_t random_length(uint64_t *seed) {
+    unsigned total = 0;
+    for (int i = 0; i < NUM_LENGTHS; i++) {
+        total += table_lengths[i].weight;
+    }
+    unsigned r = (unsigned)(next_random(seed) % total);
+    for (int i = 0; i < NUM_LENGTHS; i++) {
+        if (r < table_lengths[i].weight) {
+            return table_lengths[i].plen;
+        }
+        r -= table_lengths[i].weight;
+    }
+    return 48;
+}
+
+/* Function to generate n distinct routes. Allocations (/32 and shorter) land at
+ * random in a registry block; four in five longer prefixes are carved out of an
+ * existing allocation, and half of those keep its next hop. Returns the count. */
+static size_t generate_table(struct bench_route *routes, size_t n, uint64_t *seed) {
+    struct fib6 seen;
+    if (fib6_init(&seen, FIB6_MIN_DIRECT_BITS) < 0) {
+        return 0;
+    }
+    size_t *allocs = malloc(n * sizeof(*allocs));
+    size_t num_allocs = 0, count = 0;
+    while (allocs && count < n) {
+        struct bench_route r;
+        memset(&r, 0, sizeof(r));
+        r.plen = random_length(seed);
+        r.next_hop = (uint16_t)(1 + next_random(seed) % NUM_NEXTHOPS);
+        if (r.plen > 32 && num_allocs > 0 && next_random(seed) % 5 != 0) {
+            const struct bench_route *parent = &routes[allocs[next_random(seed) % num_allocs]];
+            r.prefix = parent->prefix;
+            randomize_below(&r.prefix, parent->plen, seed);
+            if (next_random(seed) & 1) {
+                r.next_hop = parent->next_hop;
+            }
+        } else {
+            uint16_t block = rir_blocks[next_random(seed) % NUM_RIR];
+            r.prefix.s6_addr[0] = (uint8_t)(block >> 8);
+            r.prefix.s6_addr[1] = (uint8_t)block;
+            randomize_below(&r.prefix, 12, seed);
+        }
+        mask_below(&r.prefix, r.plen);
+        if (fib6_get(&seen, &r.prefix, r.plen) != 0) {
+            continue; /* Already drawn */
+        }
+        if (fib6_insert(&seen, &r.prefix, r.plen, 1) < 0) {
+            break;
+        }
+        if (r.plen <= 32) {
+            allocs[num_allocs++] = count;
+        }
+        routes[count++] = r;
+    }
+    free(allocs);
+    fib6_destroy(&seen);
+    return count;
+}
+
+/* Function to load routes from a file of "prefix/len" lines (the first such
+ * token of each line counts). Returns the count, or -1 if it cannot be read. */
+static long load_table(const char *path, struct bench_route *routes, size_t max,
+                       uint64_t *seed) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Failed to open table");
+        return -1;
+    }
+    char line[512];
+    size_t count = 0;
+    while (count < max && fgets(line, sizeof(line), fp)) {
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+            char *slash = strchr(tok, '/');
+            if (!slash) {
+                continue;
+            }
+            *slash = '\0';
+            struct bench_route *r = &routes[count];
+            unsigned long plen = strtoul(slash + 1, NULL, 10);
+            if (plen <= 128 && inet_pton(AF_INET6, tok, &r->prefix) == 1) {
+                r->plen = (uint8_t)plen;
+                mask_below(&r->prefix, r->plen);
+                r->next_hop = (uint16_t)(1 + next_random(seed) % NUM_NEXTHOPS);
+                count++;
+            }
+            break;
+        }
+    }
+    fclose(fp);
+    return (long)count;
+}
+
+/* Function to build a FIB from the first n routes. Returns the build time in
+ * milliseconds, or -1 on failure. */
+static double build_fib(struct fib6 *f, unsigned direct_bits, const struct bench_route *routes,
+                        size_t n) {
+    if (fib6_init(f, direct_bits) < 0) {
+        return -1;
+    }
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        if (fib6_insert(f, &routes[i].prefix, routes[i].plen, routes[i].next_hop) < 0) {
+            fib6_destroy(f);
+            return -1;
+        }
+    }
+    if (fib6_commit(f) < 0) {
+        fib6_destroy(f);
+        return -1;
+    }
+    return (now_ns() - start) / 1e6;
+}
+
+/* Function to fill addrs with destinations inside the first n routes: uniformly
+ * over routes, or Zipf-distributed over a random ranking of them */
+static void make_traffic(struct in6_addr *addrs, const struct bench_route *routes, size_t n,
+                         int skewed, uint64_t *seed) {
+    double *cdf = NULL;
+    size_t *rank = NULL;
+    if (skewed) {
+        cdf = malloc(n * sizeof(*cdf));
+        rank = malloc(n * sizeof(*rank));
+        if (!cdf || !rank) {
+            free(cdf);
+            free(rank);
+            skewed = 0;
+        } else {
+            double total = 0;
+            for (size_t i = 0; i < n; i++) {
+                total += 1.0 / pow((double)(i + 1), ZIPF_S);
+                cdf[i] = total;
+                rank[i] = i;
+            }
+            for (size_t i = n - 1; i > 0; i--) {
+                size_t j = next_random(seed) % (i + 1);
+                size_t tmp = rank[i];
+                rank[i] = rank[j];
+                rank[j] = tmp;
+            }
+            for (size_t i = 0; i < n; i++) {
+                cdf[i] /= total;
+            }
+        }
+    }
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        size_t r;
+        if (skewed) {
+            double u = (next_random(seed) >> 11) * (1.0 / 9007199254740992.0);
+            size_t lo = 0, hi = n - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            r = rank[lo];
+        } else {
+            r = next_random(seed) % n;
+        }
+        addrs[i] = routes[r].prefix;
+        randomize_below(&addrs[i], routes[r].plen, seed);
+    }
+    free(cdf);
+    free(rank);
+}
+
+/* Function to compare the fast lookups against the trie. Returns mismatches. */
+static unsigned long check_fib(const struct fib6 *f, const struct in6_addr *addrs, size_t n) {
+    unsigned long bad = 0;
+    uint16_t nh[BENCH_CHUNK];
+    for (size_t i = 0; i < n; i += BENCH_CHUNK) {
+        size_t k = n - i < BENCH_CHUNK ? n - i : BENCH_CHUNK;
+        fib6_lookup_batch(f, &addrs[i], nh, k);
+        for (size_t j = 0; j < k; j++) {
+            uint16_t want = fib6_lookup_slow(f, &addrs[i + j]);
+            if (fib6_lookup(f, &addrs[i + j]) != want || nh[j] != want) {
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+/* Function to check the table, then churn a tenth of it and check again. Returns
+ * mismatches. */
+static unsigned long check_table(struct fib6 *f, const struct bench_route *routes, size_t n,
+                                 const struct in6_addr *addrs, uint64_t *seed) {
+    struct in6_addr *random_addrs = malloc(NUM_ADDRS / 4 * sizeof(*random_addrs));
+    if (!random_addrs) {
+        return 1;
+    }
+    for (size_t i = 0; i < NUM_ADDRS / 4; i++) {
+        for (int b = 0; b < 16; b += 8) {
+            uint64_t r = next_random(seed);
+            memcpy(&random_addrs[i].s6_addr[b], &r, 8);
+        }
+        random_addrs[i].s6_addr[0] = 0x20 | (random_addrs[i].s6_addr[0] & 0x0F);
+    }
+    unsigned long bad = check_fib(f, addrs, NUM_ADDRS) +
+                        check_fib(f, random_addrs, NUM_ADDRS / 4);
+
+    /* Delete a tenth, repoint another tenth, and add a default route */
+    for (size_t i = 0; i < n; i += 10) {
+        fib6_delete(f, &routes[i].prefix, routes[i].plen);
+        if (i + 1 < n) {
+            fib6_insert(f, &routes[i + 1].prefix, routes[i + 1].plen,
+                        (uint16_t)(1 + (routes[i + 1].next_hop % NUM_NEXTHOPS)));
+        }
+    }
+    struct in6_addr any;
+    memset(&any, 0, sizeof(any));
+    fib6_insert(f, &any, 0, NUM_NEXTHOPS + 1);
+    if (fib6_commit(f) < 0) {
+        bad++;
+    }
+    bad += check_fib(f, addrs, NUM_ADDRS) + check_fib(f, random_addrs, NUM_ADDRS / 4);
+
+    /* And put it all back */
+    fib6_delete(f, &any, 0);
+    for (size_t i = 0; i < n; i += 10) {
+        fib6_insert(f, &routes[i].prefix, routes[i].plen, routes[i].next_hop);
+        if (i + 1 < n) {
+            fib6_insert(f, &routes[i + 1].prefix, routes[i + 1].plen, routes[i + 1].next_hop);
+        }
+    }
+    if (fib6_commit(f) < 0) {
+        bad++;
+    }
+    bad += check_fib(f, addrs, NUM_ADDRS) + check_fib(f, random_addrs, NUM_ADDRS / 4);
+    if (f->count != n) {
+        bad++;
+    }
+    free(random_addrs);
+    return bad;
+}
+
+/* Function to measure the nodes lookups visit: the average into *avg, the worst
+ * returned */
+static int lookup_depth(const struct fib6 *f, const struct in6_addr *addrs, double *avg) {
+    unsigned long total = 0;
+    int worst = 0;
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        int d = fib6_lookup_depth(f, &addrs[i]);
+        total += d;
+        if (d > worst) {
+            worst = d;
+        }
+    }
+    *avg = (double)total / NUM_ADDRS;
+    return worst;
+}
+
+/* Function run by each timing thread */
+static void *bench_worker(void *arg) {
+    struct bench_thread *t = arg;
+    uint16_t nh[BENCH_CHUNK];
+    size_t pos = t->start;
+    unsigned sum = 0;
+    uint64_t start = now_ns(), end;
+    do {
+        for (int round = 0; round < 16; round++) {
+            if (t->batch) {
+                fib6_lookup_batch(t->f, &t->addrs[pos], nh, BENCH_CHUNK);
+                sum += nh[0] + nh[BENCH_CHUNK - 1];
+            } else {
+                for (size_t i = 0; i < BENCH_CHUNK; i++) {
+                    sum += fib6_lookup(t->f, &t->addrs[pos + i]);
+                }
+            }
+            pos = (pos + BENCH_CHUNK) % NUM_ADDRS;
+        }
+        t->lookups += 16 * BENCH_CHUNK;
+        end = now_ns();
+    } while (end < t->deadline);
+    t->elapsed = end - start;
+    t->sum = sum;
+    return NULL;
+}
+
+/* Function to time lookups over addrs on several threads. Returns millions of
+ * lookups per second per thread. */
+static double bench_lookups(const struct fib6 *f, const struct in6_addr *addrs, int threads,
+                            int batch, unsigned ms) {
+    struct bench_thread *t = calloc(threads, sizeof(*t));
+    if (!t) {
+        return 0;
+    }
+    uint64_t deadline = now_ns() + ms * 1000000ULL;
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        t[i].f = f;
+        t[i].addrs = addrs;
+        t[i].start = (size_t)i * (NUM_ADDRS / threads) / BENCH_CHUNK * BENCH_CHUNK;
+        t[i].batch = batch;
+        t[i].deadline = deadline;
+        if (pthread_create(&t[i].tid, NULL, bench_worker, &t[i]) != 0) {
+            perror("Failed to start thread");
+            break;
+        }
+        started++;
+    }
+    double rate = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(t[i].tid, NULL);
+        rate += t[i].lookups * 1e3 / t[i].elapsed;
+        sink += t[i].sum;
+    }
+    free(t);
+    return started ? rate / started : 0;
+}
+
+/* Function to print one row of the results table */
+static void bench_row(const char *label, const struct fib6 *f, double build_ms,
+                      const struct in6_addr *uniform, const struct in6_addr *skewed,
+                      int threads, unsigned ms) {
+    double avg;
+    int worst = lookup_depth(f, uniform, &avg);
+    /* Memory lookups touch: the direct array and the subtrees, not the writer's trie */
+    double mib = (((size_t)1 << f->direct_bits) * sizeof(*f->direct) + f->stats.subtree_bytes) /
+                 1048576.0;
+    printf("%-9s %8lu %8.1f %8.1f %6.2f %4d %8.1f %8.1f %8.1f %8.1f\n", label, f->count, mib,
+           build_ms, avg, worst,
+           bench_lookups(f, uniform, threads, 0, ms), bench_lookups(f, uniform, threads, 1, ms),
+           bench_lookups(f, skewed, threads, 0, ms), bench_lookups(f, skewed, threads, 1, ms));
+}
+
+/* Function to print the results table header */
+static void bench_header(const char *first, int threads) {
+    printf("%-9s %8s %8s %8s %6s %4s %17s %17s\n", "", "", "MiB", "", "nodes", "",
+           "random Mlps/thr", "skewed Mlps/thr");
+    printf("%-9s %8s %8s %8s %6s %4s %8s %8s %8s %8s   (%d thread%s)\n", first, "routes", "lookup",
+           "build ms", "avg", "max", "single", "batch", "single", "batch", threads,
+           threads == 1 ? "" : "s");
+}
+
+/* Main function: Entry point of the IPv6 FIB benchmark */
+int main(int argc, char *argv[]) {
+    size_t num_routes = DEFAULT_PREFIXES;
+    unsigned ms = DEFAULT_BENCH_MS;
+    unsigned direct_bits = FIB6_DIRECT_BITS;
+    int threads = 1;
+    const char *path = NULL;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:d:t:f:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_routes = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            ms = (unsigned)atoi(optarg);
+            break;
+        case 'd':
+            direct_bits = (unsigned)atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n prefixes] [-f table_file] [-d direct_bits] "
+                    "[-t threads] [-m ms_per_run] [-s seed]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_routes == 0 || ms == 0 || threads < 1 || direct_bits < FIB6_MIN_DIRECT_BITS ||
+        direct_bits > FIB6_MAX_DIRECT_BITS) {
+        fprintf(stderr, "Prefixes, time and threads must be positive and direct bits %d-%d\n",
+                FIB6_MIN_DIRECT_BITS, FIB6_MAX_DIRECT_BITS);
+        exit(1);
+    }
+
+    struct bench_route *routes = malloc(num_routes * sizeof(*routes));
+    struct in6_addr *uniform = malloc(NUM_ADDRS * sizeof(*uniform));
+    struct in6_addr *skewed = malloc(NUM_ADDRS * sizeof(*skewed));
+    if (!routes || !uniform || !skewed) {
+        perror("Failed to allocate buffers");
+        exit(1);
+    }
+    if (path) {
+        long got = load_table(path, routes, num_routes, &seed);
+        if (got <= 0) {
+            fprintf(stderr, "No routes in %s\n", path);
+            exit(1);
+        }
+        num_routes = (size_t)got;
+    } else {
+        num_routes = generate_table(routes, num_routes, &seed);
+    }
+    /* Shuffle, so every prefix of the table is a fair sample of it */
+    for (size_t i = num_routes - 1; i > 0; i--) {
+        size_t j = next_random(&seed) % (i + 1);
+        struct bench_route tmp = routes[i];
+        routes[i] = routes[j];
+        routes[j] = tmp;
+    }
+
+    /* Correctness first: every lookup must agree with the trie */
+    struct fib6 f;
+    double build_ms = build_fib(&f, direct_bits, routes, num_routes);
+    if (build_ms < 0) {
+        fprintf(stderr, "Failed to build the table\n");
+        exit(1);
+    }
+    make_traffic(uniform, routes, f.count, 0, &seed);
+    make_traffic(skewed, routes, f.count, 1, &seed);
+    unsigned long bad = check_table(&f, routes, num_routes, uniform, &seed);
+    printf("%s: %lu routes, %lu subtrees, %lu nodes, %lu leaves\n", path ? path : "generated",
+           f.count, f.stats.subtrees, f.stats.nodes, f.stats.leaves);
+    printf("lookups %s (checked against the trie before and after churn)\n",
+           bad ? "MISMATCH" : "ok");
+    fib6_destroy(&f);
+
+    /* Lookup cost as the table grows, with traffic spread over the whole table */
+    printf("\nDirect array of 2^%u entries, %u ms per run\n", direct_bits, ms);
+    bench_header("table", threads);
+    for (size_t n = num_routes / 8; n > 0; n *= 2) {
+        if (n > num_routes) {
+            n = num_routes;
+        }
+        make_traffic(uniform, routes, n, 0, &seed);
+        make_traffic(skewed, routes, n, 1, &seed);
+        build_ms = build_fib(&f, direct_bits, routes, n);
+        if (build_ms < 0) {
+            fprintf(stderr, "Failed to build the table\n");
+            exit(1);
+        }
+        char label[24];
+        snprintf(label, sizeof(label), "%zuk", (n + 500) / 1000);
+        bench_row(label, &f, build_ms, uniform, skewed, threads, ms);
+        fib6_destroy(&f);
+        if (n == num_routes) {
+            break;
+        }
+    }
+
+    /* Stride tuning: how many bits the direct array should resolve */
+    printf("\nFull table by direct array size\n");
+    bench_header("direct", threads);
+    for (int i = 0; i < NUM_DIRECT; i++) {
+        build_ms = build_fib(&f, bench_direct_bits[i], routes, num_routes);
+        if (build_ms < 0) {
+            fprintf(stderr, "Failed to build the table\n");
+            exit(1);
+        }
+        char label[24];
+        snprintf(label, sizeof(label), "2^%u", bench_direct_bits[i]);
+        bench_row(label, &f, build_ms, uniform, skewed, threads, ms);
+        fib6_destroy(&f);
+    }
+
+    free(routes);
+    free(uniform);
+    free(skewed);
+    if (bad) {
+        fprintf(stderr, "%lu lookup mismatches\n", bad);
+        exit(1);
+    }
+    return 0;
+}
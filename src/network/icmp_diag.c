@@ -1,171 +1,1713 @@
-/* icmp_diag.c: A simple ICMP diagnostic tool that sends Echo Requests (like ping) to a
- * target IP and receives Echo Replies, calculating round-trip time (RTT). It uses raw
- * sockets to craft ICMP packets. Like a librarian sending test letters and timing replies.
- * Requires root privileges (sudo). */
+/* icmp_diag.c: An ICMP diagnostic tool that sends Echo Requests (like ping) and
+ * receives Echo Replies, calculating round-trip time (RTT). It uses raw sockets to
+ * craft ICMP packets. Given one target it prints every reply like ping; given a
+ * list (arguments or -f file) it works like fping: one non-blocking raw socket sends
+ * probes to every target at a paced rate, and replies are matched to their probes
+ * through a hash keyed on (id, seq, target) as they arrive, in any order. Each probe
+ * carries a timeout on a timer wheel, so a lost reply only costs one timer firing
+ * and the send loop never stops to wait. With -T it traces routes instead, Paris
+ * traceroute style: every TTL of every target is probed at once, each probe's ICMP
+ * checksum (what load balancers hash) is pinned to a flow identifier so ECMP keeps
+ * the path stable, and Time Exceeded errors are matched through the Echo Request
+ * they quote. -M adds multipath detection (MDA), probing each hop with more flows
+ * until every interface there has been seen with 95% confidence. With -P it
+ * discovers path MTUs instead: every target's largest deliverable packet is
+ * binary-searched at once with DF-set probes, Frag Needed errors jump the search to
+ * the MTU they report, sizes that vanish without one are reported as black holes,
+ * and the results are cached for the transport tools. Like a librarian
+ * mailing test letters to thousands of branches at a steady pace and ticking each
+ * one off as the answers come back. Requires root privileges (sudo). */
+
+#define _GNU_SOURCE /* For ppoll */
 
 /* Include standard libraries for sockets, networking, time, and I/O */
 #include <stdio.h>      /* For printf, perror, fprintf (printing) */
+#include <stdarg.h>     /* For va_list (metrics text) */
 #include <stdlib.h>     /* For exit, malloc, free (memory and control) */
 #include <string.h>     /* For memcpy, memset (memory operations) */
-#include <unistd.h>     /* For close, usleep (socket and timing) */
-#include <sys/socket.h> /* For socket, sendto, recvfrom */
-#include <sys/time.h>   /* For gettimeofday (RTT calculation) */
+#include <unistd.h>     /* For close, getpid, getopt */
+#include <errno.h>      /* For errno, EAGAIN, ENOBUFS */
+#include <signal.h>     /* For signal, SIGINT (stop sending, print statistics) */
+#include <poll.h>       /* For ppoll, POLLIN (waiting for replies or the next send) */
+#include <time.h>       /* For clock_gettime (send times and pacing) */
+#include <sys/socket.h> /* For socket, sendmsg, recvmsg */
 #include <netinet/in.h> /* For sockaddr_in, in_addr (IP addresses) */
 #include <arpa/inet.h>  /* For inet_pton, htons (network conversions) */
 #include <netinet/ip.h> /* For iphdr (IP header) */
 #include <netinet/ip_icmp.h> /* For icmphdr (ICMP header) */
+#include <linux/net_tstamp.h> /* For SOF_TIMESTAMPING_* (kernel send/receive timestamps) */
+#include <linux/errqueue.h>   /* For struct scm_timestamping */
+#include "timer_wheel.h" /* For struct timer_wheel (probe timeouts) */
+#include "pool.h"        /* For struct pool (outstanding probes) */
+#include "hdr_hist.h"    /* For struct hdr_hist (per-target RTT distribution) */
+#include "inet_csum.h"   /* For inet_csum (Echo Request checksum) */
+#include "pmtu.h"        /* For struct pmtu_search, struct pmtu_cache (-P) */
+
+/* Raw socket option that drops ICMP types in the kernel (linux/icmp.h, which
+ * clashes with netinet/ip_icmp.h): bit n set = drop type n */
+#ifndef ICMP_FILTER
+#define ICMP_FILTER 1
+struct icmp_filter {
+    uint32_t data;
+};
+#endif
 
 /* Buffer size for ICMP packets */
 #define BUFFER_SIZE 1024
-/* Default number of pings */
+/* Default number of pings (one target) */
 #define DEFAULT_COUNT 4
 /* ICMP payload size (includes timestamp) */
 #define PAYLOAD_SIZE 56
+/* Echo Request as sent: header plus payload */
+#define ICMP_LEN (sizeof(struct icmphdr) + PAYLOAD_SIZE)
+/* Payload bytes that keep a traceroute probe's checksum fixed (after the timestamp) */
+#define PARIS_OFFSET (sizeof(struct icmphdr) + sizeof(uint64_t))
+
+/* Multi-target mode defaults */
+#define DEFAULT_RATE 1000        /* Probes per second across all targets */
+#define DEFAULT_PERIOD_MS 1000   /* Interval between probes to the same target */
+#define DEFAULT_TIMEOUT_MS 1000  /* Wait for a reply before counting the probe lost */
+#define TICK_MS 10               /* Timer wheel resolution for probe timeouts */
+#define SEND_BURST 256           /* Most probes sent per loop pass when behind */
+#define SOCKET_BUFFER (4 << 20)  /* Receive/send buffer so reply bursts are not dropped */
+#define MAX_TARGETS (1 << 20)    /* Targets accepted from the command line and -f */
+
+/* Daemon mode (-m): a Prometheus text endpoint served from the probe loop */
+#define DEFAULT_WINDOW_S 60      /* Exported percentiles cover this many seconds */
+#define MAX_SCRAPERS 8           /* Concurrent metrics connections */
+#define SCRAPE_CHUNK 512         /* Targets rendered per loop pass, so probing never stalls */
+#define SCRAPE_IDLE_MS 10000     /* Close metrics connections idle this long */
+
+/* Traceroute mode (-T, -M) */
+#define DEFAULT_MAX_HOPS 30
+#define TRACE_QUERIES 3          /* Probes per hop for one target (1 for a list) */
+#define HOP_IFACES 16            /* Interfaces remembered per hop */
+/* MDA stopping points: flows to probe at a hop where k interfaces have been seen
+ * before concluding, with 95% confidence, that there is no k+1th */
+static const uint8_t mda_stop[HOP_IFACES + 1] = {
+    0, 6, 11, 16, 21, 27, 33, 38, 44, 51, 57, 63, 70, 76, 83, 90, 96
+};
+
+/* Kernel timestamps: software on every packet, hardware where the NIC has been
+ * configured to stamp (e.g. by hwstamp_ctl or a PTP daemon) */
+#define TIMESTAMPING_FLAGS (SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | \
+                            SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE | \
+                            SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE)
+
+/* Where a reply's RTT came from, most accurate first */
+#define RTT_HARDWARE 0   /* NIC send and receive stamps */
+#define RTT_KERNEL 1     /* Kernel send and receive stamps */
+#define RTT_KERNEL_RX 2  /* Probe's recorded send time against the kernel receive stamp */
+#define RTT_USER 3       /* Probe's recorded send time against the time the reply was read */
+#define RTT_SOURCES 4
+
+/* RTT histograms: microseconds up to the probe timeout, 1/2^5 (about 3%)
+ * resolution, which keeps each target's counters around 2 KB */
+#define HIST_SUB_BITS 5
+/* Percentiles reported per target */
+#define NUM_QUANTILES 4
+static const double quantiles[NUM_QUANTILES] = { 50, 90, 99, 99.9 };
+
+/* Probe outcomes, fed to the loss-burst counters in sequence order */
+#define OUTCOME_REPLY 0
+#define OUTCOME_LOST 1
+#define OUTCOME_SKIPPED 2  /* Never sent (send error) */
+
+/* One interface that answered at a hop */
+struct hop_iface {
+    uint32_t addr;      /* Interface address (network byte order) */
+    float min_rtt;      /* Fastest answer (ms) */
+    uint16_t replies;   /* Answers from it */
+};
+
+/* One TTL of a traced path */
+struct trace_hop {
+    struct hop_iface ifaces[HOP_IFACES]; /* Interfaces seen, in order of discovery */
+    uint8_t num_ifaces;   /* Entries in ifaces[] */
+    uint8_t unreach;      /* Destination Unreachable code + 1 (0 = none) */
+    uint16_t flows_sent;  /* Flows probed at this hop (MDA) */
+    uint16_t replies;     /* Probes answered */
+};
+
+/* One traceroute or PMTUD probe waiting to be sent */
+struct probe_job {
+    uint32_t target;  /* Index into targets[] */
+    uint8_t ttl;      /* Hop to reach (0 = the default TTL) */
+    uint16_t flow;    /* Paris flow identifier */
+    uint16_t size;    /* PMTUD: IP packet size (0 = the usual Echo Request) */
+};
+
+/* One host being probed */
+struct target {
+    struct sockaddr_in addr;        /* Destination */
+    char name[INET_ADDRSTRLEN];     /* Printable address */
+    uint16_t next_seq;              /* Sequence number of the next probe */
+    unsigned sent;                  /* Probes sent */
+    unsigned received;              /* Replies matched */
+    unsigned lost;                  /* Probes that timed out */
+    unsigned errors;                /* Probes the kernel refused to send */
+    double min_rtt, max_rtt, sum_rtt; /* RTT statistics (ms) */
+    double last_rtt;                /* Previous RTT (ms), for jitter */
+    double jitter;                  /* Smoothed RTT variation, RFC 3550 style (ms) */
+    struct hdr_hist rtt_hist;       /* RTT distribution (us) */
+    float window_q[NUM_QUANTILES];  /* Percentiles of the last complete window (us) */
+    uint16_t acct_seq;              /* Oldest probe not yet fed to the loss counters */
+    uint64_t known, lost_bits, reply_bits; /* Outcomes of acct_seq + 0..63 */
+    unsigned loss_run;              /* Probes lost in a row so far */
+    unsigned loss_bursts;           /* Runs of one or more consecutive losses */
+    unsigned max_loss_burst;        /* Longest such run */
+    struct trace_hop *hops;         /* Traceroute: one entry per TTL */
+    uint8_t end_ttl;                /* Traceroute: first TTL that reached the end (0 = none) */
+    struct pmtu_search pmtu;        /* PMTUD: search state */
+    uint32_t pmtu_from;             /* PMTUD: router that sent the lowest Frag Needed */
+};
+
+struct pinger;
+
+/* One metrics connection, rendered and written a chunk at a time */
+struct scraper {
+    int fd;                   /* Connection (-1 = slot free) */
+    char req[1024];           /* Request read so far */
+    size_t req_len;           /* Bytes in req */
+    int family;               /* Metric family being rendered (-1 = nothing sent yet) */
+    uint32_t next_target;     /* Next target within that family */
+    int done;                 /* Everything rendered; close once out is sent */
+    char *out;                /* Rendered text not yet written */
+    size_t out_len, out_sent, out_cap;
+    uint64_t last_active_ns;  /* Last read or write */
+};
+
+/* One probe awaiting its reply */
+struct probe {
+    struct probe *hash_next;  /* Next probe in the same hash bucket */
+    struct tw_timer timer;    /* Fires when the probe times out */
+    struct pinger *pg;        /* Owning pinger */
+    uint32_t target;          /* Index into targets[] */
+    uint16_t seq;             /* ICMP sequence number */
+    uint8_t ttl;              /* Traceroute TTL (0 = a ping) */
+    uint16_t size;            /* PMTUD probe's IP packet size (0 = not one) */
+    uint64_t sent_ns;         /* Monotonic send time, what RTTs are measured from */
+    uint64_t tx_sw_ns;        /* Kernel send stamp, CLOCK_REALTIME (0 = not reported) */
+    uint64_t tx_hw_ns;        /* NIC send stamp (0 = not reported) */
+};
+
+/* Probe schedule, outstanding probes and totals */
+struct pinger {
+    int sockfd;                     /* Raw ICMP socket */
+    uint16_t id;                    /* ICMP identifier (our PID) */
+    struct target *targets;         /* Hosts to probe */
+    uint32_t num_targets;           /* Entries in targets[] */
+    unsigned count;                 /* Probes per target (0 = until interrupted) */
+    unsigned rate;                  /* Probes per second across all targets */
+    unsigned period_ms;             /* Interval between probes to one target */
+    unsigned timeout_ms;            /* Probe lifetime */
+    int per_reply;                  /* 1 = print every reply and timeout (ping style) */
+    int timestamping;               /* 1 = SO_TIMESTAMPING is enabled on the socket */
+    unsigned round;                 /* Current pass over the targets */
+    uint32_t cursor;                /* Next target in this round */
+    uint64_t round_start_ns;        /* When the current round began */
+    uint64_t next_send_ns;          /* When the next probe is due */
+    struct probe **buckets;         /* (id, seq, target) -> outstanding probe */
+    uint32_t bucket_mask;           /* Buckets - 1 */
+    struct pool probes;             /* Allocator for outstanding probes */
+    struct timer_wheel timers;      /* Probe timeouts */
+    unsigned long sent;             /* Probes sent */
+    unsigned long received;         /* Replies matched to a probe */
+    unsigned long lost;             /* Probes that timed out */
+    unsigned long unmatched;        /* Our replies with no outstanding probe (late, duplicate) */
+    unsigned long send_stalls;      /* Sends retried because the socket buffer was full */
+    unsigned long rtt_sources[RTT_SOURCES]; /* Replies timed by each source */
+    uint64_t first_send_ns;         /* Time of the first probe */
+    uint64_t last_send_ns;          /* Time of the latest probe */
+    int metrics_fd;                 /* Metrics listener (-1 = not a daemon) */
+    unsigned window_s;              /* Percentile window (daemon mode) */
+    uint64_t window_end_ns;         /* When the current window closes */
+    unsigned long windows;          /* Windows completed */
+    struct scraper scrapers[MAX_SCRAPERS]; /* Metrics connections */
+    int trace;                      /* 1 = traceroute mode */
+    int mda;                        /* 1 = multipath detection */
+    uint8_t max_hops;               /* Highest TTL traced */
+    uint16_t flow_base;             /* First Paris flow identifier */
+    struct probe_job *jobs;         /* Probes waiting to be sent (ring) */
+    size_t jobs_cap;                /* Ring size (power of two) */
+    size_t jobs_head, jobs_tail;    /* Next job to send, next free slot */
+    uint64_t last_answer_ns;        /* When the latest traceroute or PMTUD answer arrived */
+    int pmtud;                      /* 1 = path MTU discovery mode */
+    uint16_t max_size;              /* PMTUD: largest packet size tried */
+};
+
+/* Set by SIGINT: stop sending, wait for outstanding probes, print statistics */
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Signal handler: request a stop */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to read the wall clock in nanoseconds (the clock of kernel stamps) */
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-/* Compute checksum for ICMP packet */
-unsigned short checksum(void *b, int len) {
-    unsigned short *buf = b;
-    unsigned int sum = 0;
-    unsigned short result;
+/* Function to hash a probe key to its bucket */
+static inline uint32_t probe_bucket(const struct pinger *pg, uint32_t addr, uint16_t seq) {
+    uint32_t h = (addr ^ ((uint32_t)pg->id << 16 | seq)) * 0x9E3779B1u;
+    return (h ^ h >> 15) & pg->bucket_mask;
+}
 
-    for (sum = 0; len > 1; len -= 2) {
-        sum += *buf++;
+/* Function to find the outstanding probe for (seq, target), or NULL */
+static struct probe *probe_find(const struct pinger *pg, uint32_t addr, uint16_t seq) {
+    struct probe *p = pg->buckets[probe_bucket(pg, addr, seq)];
+    while (p && (p->seq != seq || pg->targets[p->target].addr.sin_addr.s_addr != addr)) {
+        p = p->hash_next;
     }
-    if (len == 1) {
-        sum += *(unsigned char*)buf;
+    return p;
+}
+
+/* Function to unlink a probe from the hash and free it */
+static void probe_release(struct pinger *pg, struct probe *p) {
+    struct probe **link = &pg->buckets[probe_bucket(pg, pg->targets[p->target].addr.sin_addr.s_addr,
+                                                    p->seq)];
+    while (*link != p) {
+        link = &(*link)->hash_next;
     }
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
-    result = ~sum;
-    return result;
+    *link = p->hash_next;
+    pool_free(&pg->probes, p);
 }
 
-/* Main function: Entry point of the ICMP diagnostic tool */
-int main(int argc, char *argv[]) {
-    /* Check command-line arguments */
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s <target_ip> [count]\n", argv[0]);
-        fprintf(stderr, "Example: %s 8.8.8.8 4\n", argv[0]);
-        exit(1);
+/* Function to count one outcome towards the loss-burst statistics */
+static void loss_step(struct target *t, int outcome) {
+    if (outcome == OUTCOME_LOST) {
+        if (t->loss_run++ == 0) {
+            t->loss_bursts++;
+        }
+        if (t->loss_run > t->max_loss_burst) {
+            t->max_loss_burst = t->loss_run;
+        }
+    } else if (outcome == OUTCOME_REPLY) {
+        t->loss_run = 0;
     }
+}
 
-    /* Pointers to arguments */
-    char *target_ip = argv[1]; /* Target IP (e.g., 8.8.8.8) */
-    int count = (argc == 3) ? atoi(argv[2]) : DEFAULT_COUNT; /* Number of pings */
+/* Function to record a probe's outcome. A reply can overtake the timeout of an
+ * earlier probe, so outcomes wait in a 64-probe window and are counted in
+ * sequence order; one too far ahead of the window is counted straight away. */
+static void account_outcome(struct target *t, uint16_t seq, int outcome) {
+    uint16_t off = seq - t->acct_seq;
+    if (off >= 64) {
+        loss_step(t, outcome);
+        return;
+    }
+    t->known |= 1ULL << off;
+    t->lost_bits |= (uint64_t)(outcome == OUTCOME_LOST) << off;
+    t->reply_bits |= (uint64_t)(outcome == OUTCOME_REPLY) << off;
+    while (t->known & 1) {
+        loss_step(t, t->lost_bits & 1 ? OUTCOME_LOST :
+                     t->reply_bits & 1 ? OUTCOME_REPLY : OUTCOME_SKIPPED);
+        t->known >>= 1;
+        t->lost_bits >>= 1;
+        t->reply_bits >>= 1;
+        t->acct_seq++;
+    }
+}
 
-    /* Create raw socket for ICMP */
-    int sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        exit(1);
+/* Function to record a reply's RTT in the target's statistics */
+static void record_rtt(struct target *t, double rtt) {
+    t->min_rtt = (t->received == 0 || rtt < t->min_rtt) ? rtt : t->min_rtt;
+    t->max_rtt = (rtt > t->max_rtt) ? rtt : t->max_rtt;
+    t->sum_rtt += rtt;
+    if (t->received > 0) {
+        double d = rtt > t->last_rtt ? rtt - t->last_rtt : t->last_rtt - rtt;
+        t->jitter += (d - t->jitter) / 16;
     }
+    t->last_rtt = rtt;
+    hdr_hist_record(&t->rtt_hist, (uint64_t)(rtt * 1000 + 0.5));
+    t->received++;
+}
 
-    /* Set up target address */
-    struct sockaddr_in target_addr;
-    memset(&target_addr, 0, sizeof(target_addr));
-    target_addr.sin_family = AF_INET;
-    if (inet_pton(AF_INET, target_ip, &target_addr.sin_addr) <= 0) {
-        perror("Invalid target IP");
-        close(sockfd);
-        exit(1);
+/* Function to queue a traceroute or PMTUD probe. Returns 0, or -1 if out of memory. */
+static int job_push(struct pinger *pg, uint32_t target, uint8_t ttl, uint16_t flow,
+                    uint16_t size) {
+    if (pg->jobs_tail - pg->jobs_head == pg->jobs_cap) {
+        size_t cap = pg->jobs_cap ? pg->jobs_cap * 2 : 1024;
+        struct probe_job *jobs = malloc(cap * sizeof(*jobs));
+        if (!jobs) {
+            return -1;
+        }
+        for (size_t i = pg->jobs_head; i != pg->jobs_tail; i++) {
+            jobs[i - pg->jobs_head] = pg->jobs[i & (pg->jobs_cap - 1)];
+        }
+        free(pg->jobs);
+        pg->jobs = jobs;
+        pg->jobs_tail -= pg->jobs_head;
+        pg->jobs_head = 0;
+        pg->jobs_cap = cap;
+    }
+    struct probe_job *job = &pg->jobs[pg->jobs_tail++ & (pg->jobs_cap - 1)];
+    job->target = target;
+    job->ttl = ttl;
+    job->flow = flow;
+    job->size = size;
+    return 0;
+}
+
+/* Function to feed a PMTUD probe's outcome to its target's search and queue the
+ * next probe, if the search is not over */
+static void pmtu_outcome(struct pinger *pg, uint32_t ti, uint16_t size, int outcome,
+                         uint16_t reported) {
+    struct target *t = &pg->targets[ti];
+    pmtu_search_result(&t->pmtu, size, outcome, reported);
+    uint16_t next = pmtu_search_next(&t->pmtu);
+    if (next && job_push(pg, ti, 0, 0, next) < 0) {
+        fprintf(stderr, "Out of memory: path MTU search of %s stopped\n", t->name);
+    }
+}
+
+/* Timer callback: the probe's reply did not come in time */
+static void probe_expired(struct tw_timer *timer, void *arg) {
+    (void)timer;
+    struct probe *p = arg;
+    struct pinger *pg = p->pg;
+    struct target *t = &pg->targets[p->target];
+    if (pg->per_reply) {
+        printf("Request timeout for icmp_seq %u\n", p->seq);
+    }
+    t->lost++;
+    if (!p->ttl && !p->size) {
+        account_outcome(t, p->seq, OUTCOME_LOST);
+    }
+    pg->lost++;
+    uint32_t ti = p->target;
+    uint16_t size = p->size;
+    probe_release(pg, p);
+    if (size) {
+        pmtu_outcome(pg, ti, size, PMTU_LOST, 0);
+    }
+}
+
+/* Function to tell whether probes remain to be sent */
+static int more_to_send(const struct pinger *pg) {
+    if (stop_requested) {
+        return 0;
+    }
+    if (pg->trace || pg->pmtud) {
+        return pg->jobs_head != pg->jobs_tail;
     }
+    return pg->count == 0 || pg->round < pg->count;
+}
 
-    /* Packet buffer */
-    unsigned char packet[BUFFER_SIZE];
+/* Function to pin an Echo Request's checksum to a flow's value (Paris traceroute).
+ * Load balancers hash the first transport bytes, which for ICMP include the
+ * checksum, so two payload bytes absorb whatever the changing sequence number
+ * and timestamp add to the sum. */
+static void paris_checksum(unsigned char *packet, uint16_t flow) {
     struct icmphdr *icmp_hdr = (struct icmphdr *)packet;
-    unsigned char *payload = packet + sizeof(struct icmphdr);
+    uint16_t want = htons(0x8000 | flow);
+    uint16_t fill = 0;
+    memcpy(packet + PARIS_OFFSET, &fill, sizeof(fill));
+    icmp_hdr->checksum = 0;
+    /* inet_csum() is the complement of the sum so far; adding ~want to it in ones'
+     * complement gives the word that brings the sum to ~want */
+    uint32_t sum = (uint32_t)inet_csum(packet, ICMP_LEN) + (uint16_t)~want;
+    fill = (sum & 0xFFFF) + (sum >> 16);
+    memcpy(packet + PARIS_OFFSET, &fill, sizeof(fill));
+    icmp_hdr->checksum = want;
+}
 
-    /* Statistics */
-    int sent = 0, received = 0;
-    double min_rtt = 1e6, max_rtt = 0, sum_rtt = 0;
+/* Function to send a probe to target ti (ttl 0 = the default TTL, a ping; size 0 =
+ * the usual Echo Request, else a PMTUD probe of that IP packet size). Returns 1 if
+ * sent (or skipped after a hard error), 0 if the socket buffer is full and the
+ * send should be retried. */
+static int send_probe(struct pinger *pg, unsigned char *packet, uint32_t ti, uint8_t ttl,
+                      uint16_t flow, uint16_t size) {
+    struct target *t = &pg->targets[ti];
+    struct icmphdr *icmp_hdr = (struct icmphdr *)packet;
+    uint16_t seq = t->next_seq;
+    size_t icmp_len = size ? size - sizeof(struct iphdr) : ICMP_LEN;
 
-    printf("PING %s (%s): %d data bytes\n", target_ip, target_ip, PAYLOAD_SIZE);
+    /* Set ICMP header */
+    icmp_hdr->type = ICMP_ECHO;     /* Echo Request */
+    icmp_hdr->code = 0;
+    icmp_hdr->un.echo.id = htons(pg->id);
+    icmp_hdr->un.echo.sequence = htons(seq);
+    icmp_hdr->checksum = 0; /* Set after payload */
 
-    /* Send <count> ICMP Echo Requests */
-    for (int seq = 1; seq <= count; seq++) {
-        /* Clear packet */
-        memset(packet, 0, sizeof(packet));
+    struct probe *p = pool_alloc(&pg->probes);
+    if (!p) {
+        return 0; /* Out of memory: try again once replies free some probes */
+    }
 
-        /* Set ICMP header */
-        icmp_hdr->type = ICMP_ECHO;     /* Echo Request */
-        icmp_hdr->code = 0;
-        icmp_hdr->un.echo.id = htons(getpid()); /* Unique ID */
-        icmp_hdr->un.echo.sequence = htons(seq);
-        icmp_hdr->checksum = 0; /* Set after payload */
+    /* Set payload timestamp (the filler is already in place) */
+    uint64_t now = now_ns();
+    memcpy(packet + sizeof(struct icmphdr), &now, sizeof(now));
+    if (ttl) {
+        paris_checksum(packet, flow);
+    } else {
+        icmp_hdr->checksum = inet_csum(packet, icmp_len);
+    }
 
-        /* Set payload (timestamp + filler) */
-        struct timeval *tv = (struct timeval *)payload;
-        gettimeofday(tv, NULL);
-        for (int i = sizeof(struct timeval); i < PAYLOAD_SIZE; i++) {
-            payload[i] = 'A'; /* Fill with 'A' */
+    /* A traceroute probe carries its TTL as ancillary data */
+    struct iovec iov = { packet, icmp_len };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { .msg_name = &t->addr, .msg_namelen = sizeof(t->addr),
+                          .msg_iov = &iov, .msg_iovlen = 1 };
+    if (ttl) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = IPPROTO_IP;
+        c->cmsg_type = IP_TTL;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        int hops = ttl;
+        memcpy(CMSG_DATA(c), &hops, sizeof(hops));
+    }
+    if (sendmsg(pg->sockfd, &msg, 0) < 0) {
+        pool_free(&pg->probes, p);
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR) {
+            pg->send_stalls++;
+            return 0;
+        }
+        if (size && errno == EMSGSIZE) {
+            /* Larger than our own interface's MTU: the kernel said so at once */
+            t->next_seq++;
+            pmtu_outcome(pg, ti, size, PMTU_LOCAL, 0);
+            return 1;
+        }
+        if (t->errors++ == 0 || pg->per_reply) {
+            fprintf(stderr, "Send to %s failed: %s\n", t->name, strerror(errno));
         }
+        account_outcome(t, seq, OUTCOME_SKIPPED);
+        t->next_seq++;
+        return 1;
+    }
 
-        /* Compute checksum */
-        icmp_hdr->checksum = checksum(packet, sizeof(struct icmphdr) + PAYLOAD_SIZE);
+    /* Track the probe until its reply or its timeout */
+    p->pg = pg;
+    p->target = ti;
+    p->seq = seq;
+    p->ttl = ttl;
+    p->size = size;
+    p->sent_ns = now;
+    p->tx_sw_ns = 0;
+    p->tx_hw_ns = 0;
+    uint32_t b = probe_bucket(pg, t->addr.sin_addr.s_addr, seq);
+    p->hash_next = pg->buckets[b];
+    pg->buckets[b] = p;
+    tw_timer_init(&p->timer, probe_expired, p);
+    tw_add(&pg->timers, &p->timer, pg->timeout_ms);
 
-        /* Send packet */
-        if (sendto(sockfd, packet, sizeof(struct icmphdr) + PAYLOAD_SIZE, 0,
-                   (struct sockaddr*)&target_addr, sizeof(target_addr)) < 0) {
-            perror("Send failed");
+    t->next_seq++;
+    t->sent++;
+    pg->sent++;
+    if (pg->first_send_ns == 0) {
+        pg->first_send_ns = now;
+    }
+    pg->last_send_ns = now;
+    return 1;
+}
+
+/* Function to send every probe that is due, keeping to the rate overall and to
+ * the period per target (pings) or draining the job queue (traceroute, PMTUD) */
+static void send_due(struct pinger *pg, unsigned char *packet) {
+    uint64_t gap = 1000000000ULL / pg->rate;
+    uint64_t now = now_ns();
+    for (int burst = 0; burst < SEND_BURST && now >= pg->next_send_ns; burst++) {
+        if (!more_to_send(pg)) {
+            return;
+        }
+        if (pg->trace || pg->pmtud) {
+            const struct probe_job *job = &pg->jobs[pg->jobs_head & (pg->jobs_cap - 1)];
+            if (!send_probe(pg, packet, job->target, job->ttl, job->flow, job->size)) {
+                return;
+            }
+            pg->jobs_head++;
+            pg->next_send_ns += gap;
             continue;
         }
-        sent++;
-
-        /* Receive reply */
-        unsigned char reply[BUFFER_SIZE];
-        struct sockaddr_in from_addr;
-        socklen_t from_len = sizeof(from_addr);
-        struct timeval start, end;
-        gettimeofday(&start, NULL);
+        if (!send_probe(pg, packet, pg->cursor, 0, 0, 0)) {
+            return;
+        }
+        pg->next_send_ns += gap;
+        if (++pg->cursor == pg->num_targets) {
+            /* Next round: no target is probed again before its period is up */
+            pg->cursor = 0;
+            pg->round++;
+            uint64_t earliest = pg->round_start_ns + pg->period_ms * 1000000ULL;
+            if (pg->next_send_ns < earliest) {
+                pg->next_send_ns = earliest;
+            }
+            pg->round_start_ns = pg->next_send_ns;
+        }
+    }
+}
 
-        ssize_t len = recvfrom(sockfd, reply, sizeof(reply), 0,
-                               (struct sockaddr*)&from_addr, &from_len);
-        gettimeofday(&end, NULL);
+/* Function to pull the software and hardware timestamps out of a message */
+static void read_timestamps(struct msghdr *msg, uint64_t *sw_ns, uint64_t *hw_ns) {
+    *sw_ns = *hw_ns = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            *sw_ns = ts.ts[0].tv_sec * 1000000000ULL + ts.ts[0].tv_nsec;
+            *hw_ns = ts.ts[2].tv_sec * 1000000000ULL + ts.ts[2].tv_nsec;
+        }
+    }
+}
 
+/* Function to attach the kernel's send timestamps to their probes. Each one comes
+ * back on the error queue with a copy of the packet as it left (link-layer
+ * header included), so the Echo Request is the last ICMP_LEN bytes. */
+static void receive_tx_timestamps(struct pinger *pg) {
+    unsigned char data[BUFFER_SIZE];
+    char control[512];
+    for (;;) {
+        struct iovec iov = { data, sizeof(data) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control, .msg_controllen = sizeof(control) };
+        ssize_t len = recvmsg(pg->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
         if (len < 0) {
-            perror("Receive failed");
+            return;
+        }
+        if (len < (ssize_t)(sizeof(struct iphdr) + ICMP_LEN)) {
+            continue;
+        }
+        const struct icmphdr *icmp_hdr = (const struct icmphdr *)(data + len - ICMP_LEN);
+        const struct iphdr *ip = (const struct iphdr *)((const unsigned char *)icmp_hdr -
+                                                        sizeof(struct iphdr));
+        if (ip->version != 4 || ip->protocol != IPPROTO_ICMP || icmp_hdr->type != ICMP_ECHO ||
+            ntohs(icmp_hdr->un.echo.id) != pg->id) {
             continue;
         }
+        struct probe *p = probe_find(pg, ip->daddr, ntohs(icmp_hdr->un.echo.sequence));
+        if (p) {
+            read_timestamps(&msg, &p->tx_sw_ns, &p->tx_hw_ns);
+        }
+    }
+}
+
+/* Function to work out a reply's RTT in nanoseconds from the best pair of
+ * timestamps available, recording which pair was used */
+static uint64_t reply_rtt(struct pinger *pg, struct probe *p, uint64_t rx_sw_ns,
+                          uint64_t rx_hw_ns, uint64_t now, int64_t realtime_offset) {
+    if (pg->timestamping && (p->tx_sw_ns == 0 || (rx_hw_ns && p->tx_hw_ns == 0))) {
+        receive_tx_timestamps(pg); /* The send stamp may still be queued */
+    }
+    if (rx_hw_ns && p->tx_hw_ns && rx_hw_ns > p->tx_hw_ns) {
+        pg->rtt_sources[RTT_HARDWARE]++;
+        return rx_hw_ns - p->tx_hw_ns;
+    }
+    if (rx_sw_ns && p->tx_sw_ns && rx_sw_ns > p->tx_sw_ns) {
+        pg->rtt_sources[RTT_KERNEL]++;
+        return rx_sw_ns - p->tx_sw_ns;
+    }
+    /* Kernel receive stamp on the monotonic clock of the recorded send time */
+    uint64_t rx_ns = rx_sw_ns ? rx_sw_ns - realtime_offset : 0;
+    if (rx_ns > p->sent_ns && rx_ns <= now) {
+        pg->rtt_sources[RTT_KERNEL_RX]++;
+        return rx_ns - p->sent_ns;
+    }
+    pg->rtt_sources[RTT_USER]++;
+    return now - p->sent_ns;
+}
+
+/* Function to queue more flows at a hop until MDA is 95% sure it has seen every
+ * interface there. Each TTL is treated on its own, so all hops fill in at once. */
+static void trace_more(struct pinger *pg, uint32_t ti, uint8_t ttl) {
+    struct target *t = &pg->targets[ti];
+    struct trace_hop *h = &t->hops[ttl - 1];
+    if (!pg->mda || h->num_ifaces == 0 || (t->end_ttl && ttl >= t->end_ttl)) {
+        return;
+    }
+    while (h->flows_sent < mda_stop[h->num_ifaces]) {
+        if (job_push(pg, ti, ttl, pg->flow_base + h->flows_sent, 0) < 0) {
+            return;
+        }
+        h->flows_sent++;
+    }
+}
+
+/* Function to record who answered a traceroute probe */
+static void trace_record(struct pinger *pg, struct probe *p, uint32_t from,
+                         const struct icmphdr *answer, double rtt) {
+    struct target *t = &pg->targets[p->target];
+    struct trace_hop *h = &t->hops[p->ttl - 1];
+    if (answer->type != ICMP_TIME_EXCEEDED) {
+        /* The destination answered, or a router gave up on it: the path ends here */
+        if (answer->type == ICMP_DEST_UNREACH) {
+            h->unreach = answer->code + 1;
+        }
+        if (t->end_ttl == 0 || p->ttl < t->end_ttl) {
+            t->end_ttl = p->ttl;
+        }
+    }
+    h->replies++;
+    t->received++;
+    pg->last_answer_ns = now_ns();
+    int i = 0;
+    while (i < h->num_ifaces && h->ifaces[i].addr != from) {
+        i++;
+    }
+    if (i == h->num_ifaces) {
+        if (i == HOP_IFACES) {
+            return; /* Wider than we track */
+        }
+        h->num_ifaces++;
+        h->ifaces[i].addr = from;
+        h->ifaces[i].min_rtt = rtt;
+        h->ifaces[i].replies = 0;
+    }
+    struct hop_iface *iface = &h->ifaces[i];
+    iface->min_rtt = rtt < iface->min_rtt ? rtt : iface->min_rtt;
+    iface->replies++;
+    trace_more(pg, p->target, p->ttl);
+}
 
-        /* Skip IP header (assume 20 bytes, no options) */
-        struct icmphdr *reply_icmp = (struct icmphdr *)(reply + 20);
-        if (len < 20 + sizeof(struct icmphdr) || reply_icmp->type != ICMP_ECHOREPLY ||
-            ntohs(reply_icmp->un.echo.id) != getpid() ||
-            ntohs(reply_icmp->un.echo.sequence) != seq) {
+/* Function to read every queued reply and match it to its probe */
+static void receive_replies(struct pinger *pg) {
+    unsigned char reply[BUFFER_SIZE];
+    char control[512];
+    struct sockaddr_in from_addr;
+    int64_t realtime_offset = realtime_ns() - now_ns();
+    for (;;) {
+        struct iovec iov = { reply, sizeof(reply) };
+        struct msghdr msg = { .msg_name = &from_addr, .msg_namelen = sizeof(from_addr),
+                              .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control, .msg_controllen = sizeof(control) };
+        ssize_t len = recvmsg(pg->sockfd, &msg, MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Receive failed");
+            }
+            return;
+        }
+        uint64_t now = now_ns();
+
+        /* Skip the IP header (its length is in the header) */
+        const struct iphdr *ip = (const struct iphdr *)reply;
+        size_t ihl = len >= (ssize_t)sizeof(*ip) ? ip->ihl * 4u : 0;
+        if (ihl < sizeof(*ip) || len < (ssize_t)(ihl + sizeof(struct icmphdr))) {
+            continue;
+        }
+        const struct icmphdr *reply_icmp = (const struct icmphdr *)(reply + ihl);
+        const struct icmphdr *probe_icmp = reply_icmp;
+        uint32_t dst = from_addr.sin_addr.s_addr;
+        if (reply_icmp->type != ICMP_ECHOREPLY) {
+            /* An error quotes the IP header and first 8 bytes of the probe that
+             * caused it: enough for the probe's destination, id and seq */
+            int wanted = pg->trace ? reply_icmp->type == ICMP_TIME_EXCEEDED ||
+                                     reply_icmp->type == ICMP_DEST_UNREACH :
+                         pg->pmtud && reply_icmp->type == ICMP_DEST_UNREACH;
+            if (!wanted) {
+                continue;
+            }
+            const struct iphdr *quoted = (const struct iphdr *)(reply_icmp + 1);
+            size_t qihl = len >= (ssize_t)(ihl + sizeof(struct icmphdr) + sizeof(*quoted)) ?
+                          quoted->ihl * 4u : 0;
+            if (qihl < sizeof(*quoted) || quoted->protocol != IPPROTO_ICMP ||
+                len < (ssize_t)(ihl + sizeof(struct icmphdr) + qihl + sizeof(struct icmphdr))) {
+                continue;
+            }
+            probe_icmp = (const struct icmphdr *)((const unsigned char *)quoted + qihl);
+            if (probe_icmp->type != ICMP_ECHO) {
+                continue;
+            }
+            dst = quoted->daddr;
+        }
+        if (ntohs(probe_icmp->un.echo.id) != pg->id) {
             continue; /* Not our reply */
         }
 
-        /* Calculate RTT */
-        double rtt = (end.tv_sec - start.tv_sec) * 1000.0 +
-                     (end.tv_usec - start.tv_usec) / 1000.0;
-        min_rtt = (rtt < min_rtt) ? rtt : min_rtt;
-        max_rtt = (rtt > max_rtt) ? rtt : max_rtt;
-        sum_rtt += rtt;
-        char from_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &from_addr.sin_addr, from_ip, sizeof(from_ip));
-        printf("%ld bytes from %s: icmp_seq=%d ttl=64 time=%.2f ms\n",
-               len - 20, from_ip, seq, rtt);
-        received++;
+        /* Find the probe by (id, seq, target) */
+        uint16_t seq = ntohs(probe_icmp->un.echo.sequence);
+        struct probe *p = probe_find(pg, dst, seq);
+        if (!p) {
+            pg->unmatched++; /* Arrived after its timeout, or a duplicate */
+            continue;
+        }
+
+        /* Calculate RTT from the probe's recorded send time: errors do not echo
+         * the payload, and an echoed copy could come back truncated or mangled */
+        uint64_t rx_sw_ns, rx_hw_ns;
+        read_timestamps(&msg, &rx_sw_ns, &rx_hw_ns);
+        struct target *t = &pg->targets[p->target];
+        double rtt = reply_rtt(pg, p, rx_sw_ns, rx_hw_ns, now, realtime_offset) / 1e6;
+        pg->received++;
+        if (p->ttl) {
+            trace_record(pg, p, from_addr.sin_addr.s_addr, reply_icmp, rtt);
+            tw_cancel(&pg->timers, &p->timer);
+            probe_release(pg, p);
+            continue;
+        }
+        if (p->size) {
+            /* PMTUD: the Echo Reply means the size fits; Frag Needed carries the
+             * next-hop MTU of the router that could not forward it */
+            int outcome = PMTU_FITS;
+            uint16_t reported = 0;
+            if (reply_icmp->type == ICMP_DEST_UNREACH) {
+                outcome = reply_icmp->code == ICMP_FRAG_NEEDED ? PMTU_TOO_BIG : PMTU_UNREACH;
+                reported = ntohs(reply_icmp->un.frag.mtu);
+                if (outcome == PMTU_TOO_BIG &&
+                    (!t->pmtu.reported || (reported && reported < t->pmtu.reported))) {
+                    t->pmtu_from = from_addr.sin_addr.s_addr;
+                }
+            } else {
+                t->received++;
+            }
+            uint16_t size = p->size;
+            uint32_t ti = p->target;
+            pg->last_answer_ns = now;
+            tw_cancel(&pg->timers, &p->timer);
+            probe_release(pg, p);
+            pmtu_outcome(pg, ti, size, outcome, reported);
+            continue;
+        }
+        record_rtt(t, rtt);
+        account_outcome(t, seq, OUTCOME_REPLY);
+        if (pg->per_reply) {
+            printf("%ld bytes from %s: icmp_seq=%u ttl=%u time=%.3f ms\n",
+                   (long)(len - ihl), t->name, seq, ip->ttl, rtt);
+        }
+        tw_cancel(&pg->timers, &p->timer);
+        probe_release(pg, p);
+    }
+}
+
+/* Function to add a target given as a dotted-quad address. Returns 0, or -1 if
+ * the address is invalid or the list is full. */
+static int add_target(struct pinger *pg, uint32_t *cap, const char *ip) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) <= 0) {
+        fprintf(stderr, "Invalid target IP: %s\n", ip);
+        return -1;
+    }
+    if (pg->num_targets == *cap) {
+        uint32_t new_cap = *cap ? *cap * 2 : 1024;
+        struct target *targets = new_cap <= MAX_TARGETS ?
+                                 realloc(pg->targets, new_cap * sizeof(*targets)) : NULL;
+        if (!targets) {
+            fprintf(stderr, "Too many targets (max %d)\n", MAX_TARGETS);
+            return -1;
+        }
+        pg->targets = targets;
+        *cap = new_cap;
+    }
+    struct target *t = &pg->targets[pg->num_targets++];
+    memset(t, 0, sizeof(*t));
+    t->addr.sin_family = AF_INET;
+    t->addr.sin_addr = addr;
+    t->next_seq = 1;
+    t->acct_seq = 1;
+    inet_ntop(AF_INET, &addr, t->name, sizeof(t->name));
+    return 0;
+}
 
-        /* Wait 1 second between pings */
-        usleep(1000000);
+/* Function to read targets from a file (one address per line, # comments),
+ * or from stdin when path is "-". Returns the number of bad lines, or -1. */
+static int load_targets(struct pinger *pg, uint32_t *cap, const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        perror("Failed to open target list");
+        return -1;
+    }
+    char line[256];
+    int bad = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line + strspn(line, " \t");
+        p[strcspn(p, " \t\r\n#")] = '\0';
+        if (*p && add_target(pg, cap, p) < 0) {
+            bad++;
+            if (pg->num_targets == MAX_TARGETS) {
+                break;
+            }
+        }
     }
+    if (f != stdin) {
+        fclose(f);
+    }
+    return bad;
+}
+
+/* Function to size the probe hash for the probes that can be outstanding at once */
+static int init_probes(struct pinger *pg) {
+    uint64_t outstanding = (uint64_t)pg->rate * pg->timeout_ms / 1000 + SEND_BURST;
+    uint32_t buckets = 1024;
+    while (buckets < 2 * outstanding && buckets < (1u << 24)) {
+        buckets <<= 1;
+    }
+    pg->buckets = calloc(buckets, sizeof(*pg->buckets));
+    if (!pg->buckets) {
+        return -1;
+    }
+    pg->bucket_mask = buckets - 1;
+    pool_init(&pg->probes, sizeof(struct probe), 4096, 0);
+    tw_init(&pg->timers, TICK_MS);
+    return 0;
+}
 
-    /* Close socket */
-    close(sockfd);
+/* Function to give every target an RTT histogram covering up to the timeout */
+static int init_histograms(struct pinger *pg) {
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        if (hdr_hist_init(&pg->targets[i].rtt_hist, pg->timeout_ms * 1000ULL,
+                          HIST_SUB_BITS) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    /* Print statistics */
-    if (sent > 0) {
-        double avg_rtt = sum_rtt / received;
-        double loss = 100.0 * (sent - received) / sent;
-        printf("\n--- %s ping statistics ---\n", target_ip);
-        printf("%d packets sent, %d packets received, %.1f%% packet loss\n",
-               sent, received, loss);
-        if (received > 0) {
-            printf("round-trip min/avg/max = %.2f/%.2f/%.2f ms\n",
-                   min_rtt, avg_rtt, max_rtt);
+/* Function to give every target a hop table and queue a probe for every TTL of
+ * every target, count times over (MDA then decides how many more each hop needs) */
+static int init_trace(struct pinger *pg) {
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        pg->targets[i].hops = calloc(pg->max_hops, sizeof(struct trace_hop));
+        if (!pg->targets[i].hops) {
+            return -1;
+        }
+    }
+    for (unsigned q = 0; q < pg->count; q++) {
+        for (uint32_t i = 0; i < pg->num_targets; i++) {
+            for (unsigned ttl = 1; ttl <= pg->max_hops; ttl++) {
+                if (job_push(pg, i, ttl, pg->flow_base, 0) < 0) {
+                    return -1;
+                }
+                pg->targets[i].hops[ttl - 1].flows_sent = 1;
+            }
         }
     }
+    return 0;
+}
 
+/* Function to start every target's path MTU search: the first probe of each is
+ * the largest size, which on most paths settles it in one round trip */
+static int init_pmtud(struct pinger *pg) {
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        struct target *t = &pg->targets[i];
+        pmtu_search_init(&t->pmtu, PMTU_FLOOR_V4, pg->max_size);
+        if (job_push(pg, i, 0, 0, pmtu_search_next(&t->pmtu)) < 0) {
+            return -1;
+        }
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+/* Function to print a histogram's percentiles in milliseconds */
+static void print_percentiles(const struct hdr_hist *h) {
+    printf("p50/p90/p99/p99.9 = ");
+    for (int q = 0; q < NUM_QUANTILES; q++) {
+        printf(q ? "/%.3f" : "%.3f", hdr_hist_percentile(h, quantiles[q]) / 1e3);
+    }
+}
+
+/* Function to print each target's path, one line per hop, and the totals */
+static void print_trace(const struct pinger *pg, int quiet, uint64_t elapsed_ns) {
+    static const char *unreach_marks[] = { "!N", "!H", "!P", "!P", "!F", "!S" };
+    uint32_t reached = 0;
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        const struct target *t = &pg->targets[i];
+        reached += t->end_ttl > 0 && t->hops[t->end_ttl - 1].unreach == 0;
+        if (quiet) {
+            continue;
+        }
+        /* Up to where the path ended, or the last hop that answered */
+        unsigned last = t->end_ttl;
+        for (unsigned ttl = pg->max_hops; last == 0 && ttl > 0; ttl--) {
+            last = t->hops[ttl - 1].num_ifaces ? ttl : 0;
+        }
+        printf("traceroute to %s, %u hops max%s\n", t->name, pg->max_hops,
+               pg->mda ? ", multipath" : "");
+        for (unsigned ttl = 1; ttl <= last; ttl++) {
+            const struct trace_hop *h = &t->hops[ttl - 1];
+            printf("%2u ", ttl);
+            if (h->num_ifaces == 0) {
+                printf(" *");
+            }
+            for (int k = 0; k < h->num_ifaces; k++) {
+                char addr[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &h->ifaces[k].addr, addr, sizeof(addr));
+                printf("  %s  %.3f ms", addr, h->ifaces[k].min_rtt);
+            }
+            if (h->unreach) {
+                printf(" %s", h->unreach <= 6 ? unreach_marks[h->unreach - 1] : "!X");
+            }
+            if (pg->mda && h->flows_sent > 1) {
+                printf("  [%u flows]", h->flows_sent);
+            } else if (h->num_ifaces && h->replies < pg->count) {
+                printf("  (%u/%u)", h->replies, pg->count);
+            }
+            printf("\n");
+        }
+        if (t->end_ttl == 0) {
+            printf("    no answer beyond hop %u\n", last);
+        }
+    }
+    printf("\n%u target%s traced in %.1f ms, %u reached; %lu probes, %lu answered\n",
+           pg->num_targets, pg->num_targets == 1 ? "" : "s", elapsed_ns / 1e6, reached,
+           pg->sent, pg->received);
+    if (pg->unmatched || pg->send_stalls) {
+        printf("%lu late or duplicate answers, %lu sends retried on a full socket buffer\n",
+               pg->unmatched, pg->send_stalls);
+    }
+}
+
+/* Function to print each target's path MTU and how it was found, and the totals */
+static void print_pmtud(const struct pinger *pg, int quiet, uint64_t elapsed_ns) {
+    uint32_t measured = 0, black_holes = 0, unreachable = 0;
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        const struct target *t = &pg->targets[i];
+        uint16_t mtu = pmtu_search_mtu(&t->pmtu);
+        measured += mtu > 0;
+        black_holes += mtu > 0 && (t->pmtu.flags & PMTU_F_BLACKHOLE);
+        unreachable += mtu == 0;
+        if (quiet) {
+            continue;
+        }
+        printf("%-15s : ", t->name);
+        if (t->pmtu.flags & PMTU_F_UNREACHABLE) {
+            printf("unreachable");
+        } else if (mtu == 0) {
+            printf("path MTU below %u", t->pmtu.floor);
+        } else {
+            printf("path MTU %u", mtu);
+            if (mtu == pg->max_size) {
+                printf(" (largest size tried)");
+            }
+            if (t->pmtu.flags & PMTU_F_PTB) {
+                char from[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &t->pmtu_from, from, sizeof(from));
+                printf(", Frag Needed from %s", from);
+            }
+            if (t->pmtu.flags & PMTU_F_BLACKHOLE) {
+                printf(", BLACK HOLE: larger packets vanish without Frag Needed");
+            }
+            if ((t->pmtu.flags & PMTU_F_LOCAL) && !(t->pmtu.flags & (PMTU_F_PTB | PMTU_F_BLACKHOLE))) {
+                printf(", local interface limit");
+            }
+        }
+        printf(" (%u probe%s)\n", t->pmtu.probes, t->pmtu.probes == 1 ? "" : "s");
+    }
+    printf("\n%u target%s in %.1f ms: %u measured, %u black hole%s, %u unreachable; "
+           "%lu probes, %lu answered\n", pg->num_targets, pg->num_targets == 1 ? "" : "s",
+           elapsed_ns / 1e6, measured, black_holes, black_holes == 1 ? "" : "s", unreachable,
+           pg->sent, pg->received);
+}
+
+/* Function to add every path MTU found to the cache file the transport tools read */
+static void save_pmtu_cache(const struct pinger *pg, const char *path) {
+    struct pmtu_cache cache;
+    pmtu_cache_init(&cache);
+    time_t now = time(NULL);
+    int ok = pmtu_cache_load(&cache, path) >= 0;
+    unsigned n = 0;
+    for (uint32_t i = 0; ok && i < pg->num_targets; i++) {
+        const struct target *t = &pg->targets[i];
+        uint16_t mtu = pmtu_search_mtu(&t->pmtu);
+        if (mtu) {
+            ok = pmtu_cache_set(&cache, AF_INET, &t->addr.sin_addr, mtu, t->pmtu.flags, now) == 0;
+            n++;
+        }
+    }
+    if (!ok || pmtu_cache_save(&cache, path, now) < 0) {
+        fprintf(stderr, "Failed to write path MTU cache %s: %s\n", path,
+                ok ? strerror(errno) : "out of memory");
+    } else if (n > 0) {
+        printf("%u path MTU%s cached in %s\n", n, n == 1 ? "" : "s", path);
+    }
+    pmtu_cache_free(&cache);
+}
+
+/* Function to print which clocks the RTTs were measured with */
+static void print_rtt_sources(const struct pinger *pg) {
+    const unsigned long *n = pg->rtt_sources;
+    if (pg->received > 0) {
+        printf("RTT timestamps: %lu hardware, %lu kernel, %lu kernel receive only, "
+               "%lu user space\n", n[RTT_HARDWARE], n[RTT_KERNEL], n[RTT_KERNEL_RX], n[RTT_USER]);
+    }
+}
+
+/* Function to print the ping-style statistics of the only target */
+static void print_single(const struct pinger *pg) {
+    const struct target *t = &pg->targets[0];
+    if (t->sent == 0) {
+        return;
+    }
+    printf("\n--- %s ping statistics ---\n", t->name);
+    printf("%u packets sent, %u packets received, %.1f%% packet loss\n",
+           t->sent, t->received, 100.0 * (t->sent - t->received) / t->sent);
+    if (t->received > 0) {
+        printf("round-trip min/avg/max = %.3f/%.3f/%.3f ms\n",
+               t->min_rtt, t->sum_rtt / t->received, t->max_rtt);
+        printf("round-trip ");
+        print_percentiles(&t->rtt_hist);
+        printf(" ms, jitter %.3f ms\n", t->jitter);
+    }
+    if (t->loss_bursts > 0) {
+        printf("%u loss bursts, longest %u probes\n", t->loss_bursts, t->max_loss_burst);
+    }
+    print_rtt_sources(pg);
+}
+
+/* Function to print one line per target and the totals (fping style) */
+static void print_summary(const struct pinger *pg, int quiet) {
+    for (uint32_t i = 0; i < pg->num_targets && !quiet; i++) {
+        const struct target *t = &pg->targets[i];
+        printf("%-15s : xmt/rcv/%%loss = %u/%u/%.0f%%", t->name, t->sent, t->received,
+               t->sent ? 100.0 * (t->sent - t->received) / t->sent : 0);
+        if (t->received > 0) {
+            printf(", min/avg/max = %.3f/%.3f/%.3f, ", t->min_rtt, t->sum_rtt / t->received,
+                   t->max_rtt);
+            print_percentiles(&t->rtt_hist);
+            printf(", jitter = %.3f", t->jitter);
+        }
+        if (t->loss_bursts > 0) {
+            printf(", loss bursts = %u (longest %u)", t->loss_bursts, t->max_loss_burst);
+        }
+        printf(t->errors ? " (%u send errors)\n" : "\n", t->errors);
+    }
+
+    /* Totals, with the RTT distribution over every target */
+    struct hdr_hist all;
+    uint32_t alive = 0;
+    unsigned long bursts = 0;
+    unsigned longest = 0;
+    int have_all = hdr_hist_init(&all, pg->timeout_ms * 1000ULL, HIST_SUB_BITS) == 0;
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        const struct target *t = &pg->targets[i];
+        alive += t->received > 0;
+        bursts += t->loss_bursts;
+        longest = t->max_loss_burst > longest ? t->max_loss_burst : longest;
+        if (have_all) {
+            hdr_hist_merge(&all, &t->rtt_hist);
+        }
+    }
+    double secs = (pg->last_send_ns - pg->first_send_ns) / 1e9;
+    printf("\n%u targets, %u alive, %u unreachable\n", pg->num_targets, alive,
+           pg->num_targets - alive);
+    printf("%lu probes sent (%.0f/s), %lu replies, %lu timed out, %.1f%% loss\n", pg->sent,
+           secs > 0 ? (pg->sent - 1) / secs : 0, pg->received, pg->lost,
+           pg->sent ? 100.0 * (pg->sent - pg->received) / pg->sent : 0);
+    if (pg->unmatched || pg->send_stalls) {
+        printf("%lu late or duplicate replies, %lu sends retried on a full socket buffer\n",
+               pg->unmatched, pg->send_stalls);
+    }
+    if (have_all && all.total > 0) {
+        printf("RTT ");
+        print_percentiles(&all);
+        printf(" ms over all targets\n");
+    }
+    if (bursts > 0) {
+        printf("%lu loss bursts, longest %u probes\n", bursts, longest);
+    }
+    print_rtt_sources(pg);
+    if (have_all) {
+        hdr_hist_free(&all);
+    }
+}
+
+/* Per-target metric families, exported in this order */
+static const struct metric_family {
+    const char *name;
+    const char *type;
+    const char *help;
+} families[] = {
+    { "icmp_diag_probes_sent_total", "counter", "Echo Requests sent" },
+    { "icmp_diag_replies_total", "counter", "Echo Replies matched to a probe" },
+    { "icmp_diag_probes_lost_total", "counter", "Probes with no reply within the timeout" },
+    { "icmp_diag_send_errors_total", "counter", "Probes the kernel refused to send" },
+    { "icmp_diag_rtt_seconds", "summary", "Round-trip time; quantiles cover the last window" },
+    { "icmp_diag_jitter_seconds", "gauge", "Smoothed RTT variation (RFC 3550)" },
+    { "icmp_diag_loss_bursts_total", "counter", "Runs of consecutive lost probes" },
+    { "icmp_diag_loss_burst_max", "gauge", "Longest run of consecutive lost probes" },
+    { "icmp_diag_consecutive_losses", "gauge", "Probes lost in a row right now" },
+};
+#define NUM_FAMILIES (int)(sizeof(families) / sizeof(families[0]))
+
+/* Function to close a percentile window: keep its percentiles for export and
+ * start every histogram afresh, so memory per target never grows */
+static void rotate_window(struct pinger *pg) {
+    for (uint32_t i = 0; i < pg->num_targets; i++) {
+        struct target *t = &pg->targets[i];
+        for (int q = 0; q < NUM_QUANTILES; q++) {
+            t->window_q[q] = t->rtt_hist.total ? hdr_hist_percentile(&t->rtt_hist, quantiles[q])
+                                               : -1;
+        }
+        hdr_hist_reset(&t->rtt_hist);
+    }
+    pg->windows++;
+    pg->window_end_ns += pg->window_s * 1000000000ULL;
+}
+
+/* Function to append formatted text to a connection's output */
+static int out_printf(struct scraper *s, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(s->out + s->out_len, s->out_cap - s->out_len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t)n < s->out_cap - s->out_len) {
+            s->out_len += n;
+            return 0;
+        }
+        size_t cap = s->out_cap ? s->out_cap * 2 : 65536;
+        while (cap - s->out_len <= (size_t)n) {
+            cap *= 2;
+        }
+        char *out = realloc(s->out, cap);
+        if (!out) {
+            return -1;
+        }
+        s->out = out;
+        s->out_cap = cap;
+    }
+}
+
+/* Function to render one target's samples of one metric family */
+static void render_target(struct scraper *s, const struct pinger *pg, int family,
+                          const struct target *t) {
+    const char *name = families[family].name;
+    switch (family) {
+    case 0:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->sent);
+        break;
+    case 1:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->received);
+        break;
+    case 2:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->lost);
+        break;
+    case 3:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->errors);
+        break;
+    case 4:
+        for (int q = 0; q < NUM_QUANTILES; q++) {
+            double us = pg->windows ? t->window_q[q] :
+                        t->rtt_hist.total ? (double)hdr_hist_percentile(&t->rtt_hist, quantiles[q])
+                                          : -1;
+            if (us < 0) {
+                out_printf(s, "%s{target=\"%s\",quantile=\"%g\"} NaN\n", name, t->name,
+                           quantiles[q] / 100);
+            } else {
+                out_printf(s, "%s{target=\"%s\",quantile=\"%g\"} %.6f\n", name, t->name,
+                           quantiles[q] / 100, us / 1e6);
+            }
+        }
+        out_printf(s, "%s_sum{target=\"%s\"} %.6f\n", name, t->name, t->sum_rtt / 1e3);
+        out_printf(s, "%s_count{target=\"%s\"} %u\n", name, t->name, t->received);
+        break;
+    case 5:
+        out_printf(s, "%s{target=\"%s\"} %.6f\n", name, t->name, t->jitter / 1e3);
+        break;
+    case 6:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->loss_bursts);
+        break;
+    case 7:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->max_loss_burst);
+        break;
+    case 8:
+        out_printf(s, "%s{target=\"%s\"} %u\n", name, t->name, t->loss_run);
+        break;
+    }
+}
+
+/* Function to render the next chunk of the exposition: up to SCRAPE_CHUNK
+ * targets, then the tool-wide metrics at the end */
+static void scrape_render(const struct pinger *pg, struct scraper *s) {
+    static const char *source_names[RTT_SOURCES] = { "hardware", "kernel", "kernel_rx", "user" };
+    if (s->family < 0) {
+        out_printf(s, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Connection: close\r\n\r\n");
+        s->family = 0;
+    }
+    uint32_t rendered = 0;
+    while (rendered < SCRAPE_CHUNK && s->family < NUM_FAMILIES) {
+        const struct metric_family *f = &families[s->family];
+        if (s->next_target == 0) {
+            out_printf(s, "# HELP %s %s\n# TYPE %s %s\n", f->name, f->help, f->name, f->type);
+        }
+        while (s->next_target < pg->num_targets && rendered < SCRAPE_CHUNK) {
+            render_target(s, pg, s->family, &pg->targets[s->next_target++]);
+            rendered++;
+        }
+        if (s->next_target == pg->num_targets) {
+            s->family++;
+            s->next_target = 0;
+        }
+    }
+    if (s->family < NUM_FAMILIES) {
+        return;
+    }
+    out_printf(s, "# HELP icmp_diag_targets Targets being probed\n"
+                  "# TYPE icmp_diag_targets gauge\nicmp_diag_targets %u\n", pg->num_targets);
+    out_printf(s, "# HELP icmp_diag_unmatched_replies_total Replies after their timeout, or "
+                  "duplicates\n# TYPE icmp_diag_unmatched_replies_total counter\n"
+                  "icmp_diag_unmatched_replies_total %lu\n", pg->unmatched);
+    out_printf(s, "# HELP icmp_diag_send_stalls_total Sends retried on a full socket buffer\n"
+                  "# TYPE icmp_diag_send_stalls_total counter\n"
+                  "icmp_diag_send_stalls_total %lu\n", pg->send_stalls);
+    out_printf(s, "# HELP icmp_diag_rtt_source_total Replies timed by each timestamp source\n"
+                  "# TYPE icmp_diag_rtt_source_total counter\n");
+    for (int i = 0; i < RTT_SOURCES; i++) {
+        out_printf(s, "icmp_diag_rtt_source_total{source=\"%s\"} %lu\n", source_names[i],
+                   pg->rtt_sources[i]);
+    }
+    s->done = 1;
+}
+
+/* Function to close a metrics connection and free its slot */
+static void scraper_close(struct scraper *s) {
+    close(s->fd);
+    free(s->out);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+/* Function to open the metrics listener on [addr:]port. Returns the socket, or -1. */
+static int open_metrics(const char *spec) {
+    char host[64] = "127.0.0.1";
+    const char *colon = strrchr(spec, ':');
+    if (colon && (size_t)(colon - spec) < sizeof(host)) {
+        memcpy(host, spec, colon - spec);
+        host[colon - spec] = '\0';
+        spec = colon + 1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(spec));
+    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0 || addr.sin_port == 0) {
+        fprintf(stderr, "Invalid metrics address: %s\n", host);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("Metrics socket failed");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, MAX_SCRAPERS) < 0) {
+        perror("Metrics bind failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Function to accept a metrics connection, if a slot is free */
+static void scraper_accept(struct pinger *pg) {
+    int fd = accept4(pg->metrics_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+        return;
+    }
+    for (int i = 0; i < MAX_SCRAPERS; i++) {
+        struct scraper *s = &pg->scrapers[i];
+        if (s->fd < 0) {
+            s->fd = fd;
+            s->family = -1;
+            s->last_active_ns = now_ns();
+            return;
+        }
+    }
+    close(fd); /* Busy: the scraper will retry */
+}
+
+/* Function to move a metrics connection along: read the request, then render
+ * and write the response a chunk at a time */
+static void scraper_io(struct pinger *pg, struct scraper *s, short revents) {
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        scraper_close(s);
+        return;
+    }
+    if (s->family < 0 && !s->done) {
+        ssize_t n = recv(s->fd, s->req + s->req_len, sizeof(s->req) - 1 - s->req_len, 0);
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                scraper_close(s);
+            }
+            return;
+        }
+        s->last_active_ns = now_ns();
+        s->req_len += n;
+        s->req[s->req_len] = '\0';
+        if (!strstr(s->req, "\r\n\r\n") && s->req_len < sizeof(s->req) - 1) {
+            return; /* Headers not complete yet */
+        }
+        if (strncmp(s->req, "GET /metrics", 12) != 0) {
+            out_printf(s, "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n"
+                          "Metrics are at /metrics\n");
+            s->done = 1;
+        }
+    }
+    if (s->out_sent == s->out_len && !s->done) {
+        s->out_len = s->out_sent = 0;
+        scrape_render(pg, s);
+    }
+    while (s->out_sent < s->out_len) {
+        ssize_t n = send(s->fd, s->out + s->out_sent, s->out_len - s->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                scraper_close(s);
+            }
+            return;
+        }
+        s->out_sent += n;
+        s->last_active_ns = now_ns();
+    }
+    if (s->done) {
+        scraper_close(s);
+    }
+}
+
+/* Main function: Entry point of the ICMP diagnostic tool */
+int main(int argc, char *argv[]) {
+    struct pinger pg;
+    memset(&pg, 0, sizeof(pg));
+    pg.rate = DEFAULT_RATE;
+    pg.period_ms = DEFAULT_PERIOD_MS;
+    pg.timeout_ms = DEFAULT_TIMEOUT_MS;
+    pg.window_s = DEFAULT_WINDOW_S;
+    pg.metrics_fd = -1;
+    pg.max_hops = DEFAULT_MAX_HOPS;
+    pg.flow_base = 1;
+    pg.max_size = PMTU_DEFAULT_MAX;
+    pg.id = getpid() & 0xFFFF;
+    uint32_t cap = 0;
+    int count = -1;
+    int quiet = 0;
+    const char *list_path = NULL;
+    const char *metrics_addr = NULL;
+    const char *cache_path = PMTU_CACHE_PATH;
+
+    /* Parse options */
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:r:p:t:qm:w:TMH:F:PS:o:")) != -1) {
+        switch (opt) {
+        case 'f':
+            list_path = optarg;
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        case 'r':
+            pg.rate = atoi(optarg);
+            break;
+        case 'p':
+            pg.period_ms = atoi(optarg);
+            break;
+        case 't':
+            pg.timeout_ms = atoi(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'm':
+            metrics_addr = optarg;
+            break;
+        case 'w':
+            pg.window_s = atoi(optarg);
+            break;
+        case 'M':
+            pg.mda = 1;
+            /* Fall through: multipath detection is a traceroute */
+        case 'T':
+            pg.trace = 1;
+            break;
+        case 'H':
+            pg.max_hops = atoi(optarg) > 255 ? 0 : atoi(optarg);
+            break;
+        case 'F':
+            pg.flow_base = atoi(optarg) & 0x7FFF;
+            break;
+        case 'P':
+            pg.pmtud = 1;
+            break;
+        case 'S':
+            pg.max_size = atoi(optarg) < 68 || atoi(optarg) > 65535 ? 0 : atoi(optarg);
+            break;
+        case 'o':
+            cache_path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    /* Targets: -f list and arguments; "<target_ip> <count>" keeps working */
+    int npos = argc - optind;
+    if (npos == 2 && !list_path && count < 0 && strchr(argv[optind + 1], '.') == NULL) {
+        count = atoi(argv[optind + 1]);
+        npos = 1;
+    }
+    if (list_path && load_targets(&pg, &cap, list_path) < 0) {
+        exit(1);
+    }
+    for (int i = 0; i < npos; i++) {
+        if (add_target(&pg, &cap, argv[optind + i]) < 0) {
+            exit(1);
+        }
+    }
+    if (pg.num_targets == 0 || count < -1 || pg.rate == 0 || pg.timeout_ms == 0 ||
+        pg.window_s == 0 || pg.max_hops == 0 || (pg.trace && (metrics_addr || count == 0)) ||
+        pg.max_size == 0 || (pg.pmtud && (pg.trace || metrics_addr))) {
+usage:
+        fprintf(stderr, "Usage: %s [-c count] [-r rate] [-p period_ms] [-t timeout_ms] [-q]\n"
+                        "          [-m [addr:]port [-w window_s]] [-T|-M [-H max_hops] [-F flow]]\n"
+                        "          [-P [-S max_size] [-o cache_file]]\n"
+                        "          [-f targets.txt|-] [target_ip]...\n", argv[0]);
+        fprintf(stderr, "  -c  probes per target (default %d for one target, 1 for a list;\n"
+                        "      0 = until interrupted)\n"
+                        "  -r  probes per second across all targets (default %d)\n"
+                        "  -p  interval between probes to one target (default %d ms)\n"
+                        "  -t  wait for a reply before counting a probe lost (default %d ms)\n"
+                        "  -q  totals only (no per-target lines)\n"
+                        "  -f  read targets from a file, one address per line\n"
+                        "  -m  daemon mode: probe until stopped and serve per-target metrics\n"
+                        "      at http://addr:port/metrics (addr defaults to 127.0.0.1)\n"
+                        "  -w  daemon mode: percentiles cover the last window (default %d s)\n"
+                        "  -T  traceroute: probe every TTL at once with a fixed Paris flow;\n"
+                        "      -c is probes per hop (default %d for one target, 1 for a list)\n"
+                        "  -M  traceroute with multipath detection (MDA)\n"
+                        "  -H  highest TTL to trace (default %d)\n"
+                        "  -F  Paris flow identifier of the first flow (default 1)\n"
+                        "  -P  path MTU discovery: binary-search each target's path MTU with\n"
+                        "      DF-set probes and add the results to the cache file\n"
+                        "  -S  largest packet size tried (default %d)\n"
+                        "  -o  path MTU cache file (default %s)\n"
+                        "Routers rate-limit ICMP errors; lower -r if hops go missing.\n",
+                DEFAULT_COUNT, DEFAULT_RATE, DEFAULT_PERIOD_MS, DEFAULT_TIMEOUT_MS,
+                DEFAULT_WINDOW_S, TRACE_QUERIES, DEFAULT_MAX_HOPS, PMTU_DEFAULT_MAX,
+                PMTU_CACHE_PATH);
+        fprintf(stderr, "Example: %s 8.8.8.8 4\n", argv[0]);
+        fprintf(stderr, "         %s -r 10000 -f hosts.txt\n", argv[0]);
+        fprintf(stderr, "         %s -m 9101 -p 10000 -f hosts.txt\n", argv[0]);
+        fprintf(stderr, "         %s -M 192.0.2.1\n", argv[0]);
+        fprintf(stderr, "         %s -P -f hosts.txt\n", argv[0]);
+        exit(1);
+    }
+    pg.per_reply = pg.num_targets == 1 && !quiet && !metrics_addr && !pg.trace && !pg.pmtud;
+    pg.count = count >= 0 ? count : metrics_addr ? 0 : pg.num_targets > 1 ? 1 :
+               pg.trace ? TRACE_QUERIES : DEFAULT_COUNT;
+    if (pg.mda) {
+        pg.count = 1; /* MDA decides how many flows each hop gets */
+    }
+    for (int i = 0; i < MAX_SCRAPERS; i++) {
+        pg.scrapers[i].fd = -1;
+    }
+    if (metrics_addr && (pg.metrics_fd = open_metrics(metrics_addr)) < 0) {
+        exit(1);
+    }
+
+    /* Create raw socket for ICMP */
+    pg.sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if (pg.sockfd < 0) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+
+    /* Let only Echo Replies (and, tracing, the errors probes cause) through,
+     * with room for bursts of them */
+    struct icmp_filter filter;
+    filter.data = ~(1u << ICMP_ECHOREPLY);
+    if (pg.trace) {
+        filter.data &= ~(1u << ICMP_TIME_EXCEEDED | 1u << ICMP_DEST_UNREACH);
+    }
+    if (pg.pmtud) {
+        filter.data &= ~(1u << ICMP_DEST_UNREACH);
+    }
+    if (setsockopt(pg.sockfd, SOL_RAW, ICMP_FILTER, &filter, sizeof(filter)) < 0) {
+        perror("ICMP_FILTER failed (all ICMP will be read)");
+    }
+    int bufsize = SOCKET_BUFFER;
+    setsockopt(pg.sockfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(pg.sockfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+    /* PMTUD probes go out with DF set and whatever size we ask for, even above
+     * an MTU the kernel has already learned for the route */
+    int pmtudisc = IP_PMTUDISC_PROBE;
+    if (pg.pmtud &&
+        setsockopt(pg.sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) < 0) {
+        perror("IP_MTU_DISCOVER failed");
+        close(pg.sockfd);
+        exit(1);
+    }
+
+    /* Ask the kernel to stamp each probe as it leaves and each reply as it
+     * arrives, so RTTs exclude our own scheduling delays (not for PMTUD, whose
+     * large probes would each be looped back whole with their stamp) */
+    int ts_flags = TIMESTAMPING_FLAGS;
+    if (!pg.pmtud) {
+        if (setsockopt(pg.sockfd, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)) < 0) {
+            perror("SO_TIMESTAMPING failed (RTT measured in user space)");
+        } else {
+            pg.timestamping = 1;
+        }
+    }
+
+    if (init_probes(&pg) < 0 ||
+        (pg.trace ? init_trace(&pg) : pg.pmtud ? init_pmtud(&pg) : init_histograms(&pg)) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        close(pg.sockfd);
+        exit(1);
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+
+    /* Packet template: the filler is the same for every probe (PMTUD probes
+     * take as much of it as their size needs) */
+    size_t packet_size = pg.pmtud && pg.max_size > BUFFER_SIZE ? pg.max_size : BUFFER_SIZE;
+    unsigned char *packet = malloc(packet_size);
+    if (!packet) {
+        fprintf(stderr, "Out of memory\n");
+        close(pg.sockfd);
+        exit(1);
+    }
+    memset(packet, 0, packet_size);
+    for (size_t i = sizeof(struct icmphdr) + sizeof(uint64_t); i < packet_size; i++) {
+        packet[i] = 'A'; /* Fill with 'A' */
+    }
+
+    if (pg.trace) {
+        printf("Tracing %u target%s, %u hops max, %u probes/s%s\n", pg.num_targets,
+               pg.num_targets == 1 ? "" : "s", pg.max_hops, pg.rate,
+               pg.mda ? ", multipath detection" : "");
+    } else if (pg.pmtud) {
+        printf("Path MTU discovery for %u target%s, %u to %u bytes, %u probes/s\n",
+               pg.num_targets, pg.num_targets == 1 ? "" : "s", pg.targets[0].pmtu.floor,
+               pg.max_size, pg.rate);
+    } else if (pg.num_targets == 1) {
+        printf("PING %s (%s): %d data bytes\n", pg.targets[0].name, pg.targets[0].name,
+               PAYLOAD_SIZE);
+    } else {
+        if (pg.count) {
+            printf("Probing %u targets, %u probes each, %u probes/s\n", pg.num_targets,
+                   pg.count, pg.rate);
+        } else {
+            printf("Probing %u targets until stopped, %u probes/s\n", pg.num_targets, pg.rate);
+        }
+    }
+    if (pg.metrics_fd >= 0) {
+        printf("Serving metrics at http://%s%s/metrics (%u s windows, %zu histogram bytes "
+               "per target)\n", strchr(metrics_addr, ':') ? "" : "127.0.0.1:", metrics_addr,
+               pg.window_s, hdr_hist_bytes(&pg.targets[0].rtt_hist));
+    }
+
+    /* Send on schedule and match replies until every probe is answered or lost */
+    pg.round_start_ns = pg.next_send_ns = now_ns();
+    pg.window_end_ns = pg.round_start_ns + pg.window_s * 1000000000ULL;
+    struct pollfd pfds[2 + MAX_SCRAPERS];
+    struct scraper *polled[2 + MAX_SCRAPERS];
+    for (;;) {
+        int sending = more_to_send(&pg);
+        if (!sending && pg.timers.pending == 0) {
+            break;
+        }
+        if (sending) {
+            send_due(&pg, packet);
+        }
+
+        /* Sleep until a reply, the next send or the next timeout tick */
+        uint64_t now = now_ns();
+        int64_t wait_ns = -1;
+        int tick_ms = tw_timeout_ms(&pg.timers, now / 1000000);
+        if (tick_ms >= 0) {
+            wait_ns = tick_ms * 1000000LL;
+        }
+        if (sending) {
+            int64_t until_send = pg.next_send_ns > now ? (int64_t)(pg.next_send_ns - now) : 0;
+            if (wait_ns < 0 || until_send < wait_ns) {
+                wait_ns = until_send;
+            }
+        }
+
+        /* Poll the raw socket, plus the metrics listener and connections */
+        int nfds = 0;
+        pfds[nfds++] = (struct pollfd){ pg.sockfd, POLLIN, 0 };
+        if (pg.metrics_fd >= 0) {
+            pfds[nfds++] = (struct pollfd){ pg.metrics_fd, POLLIN, 0 };
+            for (int i = 0; i < MAX_SCRAPERS; i++) {
+                struct scraper *sc = &pg.scrapers[i];
+                if (sc->fd < 0) {
+                    continue;
+                }
+                if (now - sc->last_active_ns > SCRAPE_IDLE_MS * 1000000ULL) {
+                    scraper_close(sc);
+                    continue;
+                }
+                polled[nfds] = sc;
+                pfds[nfds++] = (struct pollfd){ sc->fd,
+                                                sc->family < 0 && !sc->done ? POLLIN : POLLOUT, 0 };
+            }
+        }
+        struct timespec ts = { wait_ns / 1000000000, wait_ns % 1000000000 };
+        int ready = ppoll(pfds, nfds, wait_ns >= 0 ? &ts : NULL, NULL);
+        if (ready > 0 && pfds[0].revents) {
+            if (pg.timestamping) {
+                receive_tx_timestamps(&pg);
+            }
+            receive_replies(&pg);
+        }
+        tw_advance(&pg.timers, tw_now_ms());
+        if (ready > 0 && pg.metrics_fd >= 0) {
+            for (int i = 2; i < nfds; i++) {
+                if (pfds[i].revents) {
+                    scraper_io(&pg, polled[i], pfds[i].revents);
+                }
+            }
+            if (pfds[1].revents & POLLIN) {
+                scraper_accept(&pg);
+            }
+        }
+        if (pg.metrics_fd >= 0 && now_ns() >= pg.window_end_ns) {
+            rotate_window(&pg);
+        }
+    }
+
+    /* Close sockets */
+    close(pg.sockfd);
+    if (pg.metrics_fd >= 0) {
+        for (int i = 0; i < MAX_SCRAPERS; i++) {
+            if (pg.scrapers[i].fd >= 0) {
+                scraper_close(&pg.scrapers[i]);
+            }
+        }
+        close(pg.metrics_fd);
+    }
+
+    /* Print statistics */
+    if (pg.trace) {
+        print_trace(&pg, quiet, pg.last_answer_ns ? pg.last_answer_ns - pg.first_send_ns : 0);
+    } else if (pg.pmtud) {
+        print_pmtud(&pg, quiet, pg.last_answer_ns ? pg.last_answer_ns - pg.first_send_ns : 0);
+        save_pmtu_cache(&pg, cache_path);
+    } else if (pg.num_targets == 1 && !quiet) {
+        print_single(&pg);
+    } else {
+        print_summary(&pg, quiet);
+    }
+    int failed = pg.received == 0;
+    pool_destroy(&pg.probes);
+    free(pg.buckets);
+    for (uint32_t i = 0; i < pg.num_targets; i++) {
+        hdr_hist_free(&pg.targets[i].rtt_hist);
+        free(pg.targets[i].hops);
+    }
+    free(pg.targets);
+    free(pg.jobs);
+    free(packet);
+    return failed;
+}
@@ -0,0 +1,1046 @@
+/* ipv6_dp.c: Userspace IPv6 datapath on multi-queue TUN devices (see
+ * include/ipv6_dp.h). A TUN queue hands over one packet per read(), so a worker
+ * drains up to DP_BATCH packets from a queue per poll() wakeup and then processes
+ * them back to back, paying for the wakeup once per batch. Replies are built in
+ * the buffer the request arrived in; checksums are patched (RFC 1624) where only
+ * a few fields change and summed afresh only for new messages. */
+
+/* Include standard libraries for devices, threads and packet headers */
+#include <stdio.h>        /* For fprintf, perror */
+#include <stddef.h>       /* For offsetof */
+#include <stdlib.h>       /* For calloc, malloc, free */
+#include <string.h>       /* For memcpy, memcmp, memmove, memset, strncpy */
+#include <unistd.h>       /* For read, write, close */
+#include <errno.h>        /* For errno */
+#include <fcntl.h>        /* For open, O_RDWR, O_NONBLOCK */
+#include <poll.h>         /* For poll */
+#include <time.h>         /* For clock_gettime */
+#include <sys/ioctl.h>    /* For ioctl, SIOCGIFMTU, SIOCSIFFLAGS */
+#include <sys/socket.h>   /* For socket */
+#include <arpa/inet.h>    /* For htons, ntohs, htonl */
+#include <netinet/ip6.h>  /* For struct ip6_hdr */
+#include <netinet/icmp6.h> /* For struct icmp6_hdr, ND_* */
+#include <linux/if_tun.h> /* For TUNSETIFF, IFF_TUN, IFF_MULTI_QUEUE */
+#include "inet_csum.h"    /* For csum_partial, csum_pseudo_v6, csum_update* */
+#include "timer_wheel.h"  /* For tw_now_ms (reassembly deadlines) */
+#include "ipv6_frag.h"    /* For ipv6_frag_input, ipv6_fragment */
+#include "ndp.h"          /* For ndp_resolve, ndp_enqueue, ndp_age */
+#include "ipv6_dp.h"      /* For struct ipv6_dp, struct dp_worker */
+
+/* Distance between packet buffers: DP_PKT_MAX rounded up to a cache line, so
+ * every packet starts aligned */
+#define DP_BUF_STRIDE ((DP_PKT_MAX + 63) & ~63)
+/* Extension headers walked before a chain counts as an attack */
+#define DP_MAX_EXT 16
+/* Hop limit of the packets we originate */
+#define DP_HOP_LIMIT 64
+/* ICMPv6 errors per second and burst, per worker */
+#define DP_ICMP_RATE 1000
+#define DP_ICMP_BURST 100
+/* ICMPv6 errors never exceed the minimum IPv6 MTU (RFC 4443 2.4 c) */
+#define DP_ERR_MAX 1280
+/* Longest wait in poll, so a stop request is seen */
+#define DP_POLL_MS 100
+/* Router Advertisement timing and contents (RFC 4861 sections 6.2.1 and 10) */
+#define DP_RA_MAX_INTERVAL_MS 600000     /* MaxRtrAdvInterval */
+#define DP_RA_MIN_INTERVAL_MS 200000     /* MinRtrAdvInterval */
+#define DP_RA_INITIAL_INTERVAL_MS 16000  /* MAX_INITIAL_RTR_ADVERT_INTERVAL */
+#define DP_RA_INITIAL_COUNT 3            /* MAX_INITIAL_RTR_ADVERTISEMENTS */
+#define DP_RA_MIN_DELAY_MS 3000          /* MIN_DELAY_BETWEEN_RAS */
+#define DP_RA_LIFETIME 1800              /* AdvDefaultLifetime (seconds) */
+#define DP_PREFIX_VALID 2592000          /* AdvValidLifetime (seconds) */
+#define DP_PREFIX_PREFERRED 604800       /* AdvPreferredLifetime (seconds) */
+/* Resolve new neighbors through their solicited-node group rather than directly */
+#define DP_SOLICIT_MULTICAST 0
+
+/* Extension headers with the generic (length + 1) * 8 layout */
+#define DP_PROTO_MOBILITY 135
+#define DP_PROTO_HIP 139
+#define DP_PROTO_SHIM6 140
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t dp_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const struct ndp_ops dp_ndp_ops;
+
+/* Function to prepare a datapath with no devices */
+int ipv6_dp_init(struct ipv6_dp *dp, int num_workers, size_t frag_mem) {
+    memset(dp, 0, sizeof(*dp));
+    dp->ctl_fd = -1;
+    if (num_workers < 1 || num_workers > DP_MAX_WORKERS) {
+        return -1;
+    }
+    dp->workers = calloc(num_workers, sizeof(*dp->workers));
+    if (fib6_init(&dp->routes.fib, 0) < 0 || !dp->workers ||
+        ndp_init(&dp->ndp, DP_MAX_NEIGHBORS, &dp_ndp_ops) < 0) {
+        ipv6_dp_destroy(dp);
+        return -1;
+    }
+    dp->routes.num_nexthops = 1; /* Index 0 means "no route" */
+    dp->num_workers = num_workers;
+    inet_pton(AF_INET6, "fe80::1", &dp->link_local);
+    for (int i = 0; i < num_workers; i++) {
+        struct dp_worker *w = &dp->workers[i];
+        w->dp = dp;
+        w->index = i;
+        w->bufs = malloc((size_t)DP_BATCH * DP_BUF_STRIDE);
+        w->scratch = malloc(DP_ERR_MAX);
+        w->reasm = malloc(DP_PKT_MAX);
+        w->frag_out = malloc(DP_PKT_MAX);
+        if (!w->bufs || !w->scratch || !w->reasm || !w->frag_out ||
+            ipv6_frag_init(&w->frag, frag_mem, 0) < 0) {
+            ipv6_dp_destroy(dp);
+            return -1;
+        }
+        w->frag_id = (uint32_t)w->frag.seed; /* Unpredictable (RFC 7739) */
+        w->rng = (uint32_t)(w->frag.seed >> 32) | 1;
+        w->ndp_slot = -1;
+    }
+    dp->ctl_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    /* The checksum implementation is chosen on first use; choose it before the
+     * workers race to */
+    csum_get_impl();
+    return 0;
+}
+
+/* Function to open one queue of a multi-queue TUN device */
+static int dp_open_queue(const char *name) {
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Failed to open /dev/net/tun");
+        return -1;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        fprintf(stderr, "TUNSETIFF %s failed: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Function to open a device's queues and bring it up */
+int ipv6_dp_add_dev(struct ipv6_dp *dp, const char *name) {
+    if (dp->num_devs == DP_MAX_DEVS || strlen(name) >= IFNAMSIZ) {
+        fprintf(stderr, "Cannot add device %s\n", name);
+        return -1;
+    }
+    struct dp_dev *d = &dp->devs[dp->num_devs];
+    memset(d, 0, sizeof(*d));
+    strcpy(d->name, name);
+    for (int i = 0; i < dp->num_workers; i++) {
+        d->fds[i] = dp_open_queue(name);
+        if (d->fds[i] < 0) {
+            while (i-- > 0) {
+                close(d->fds[i]);
+            }
+            return -1;
+        }
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (dp->ctl_fd >= 0 && ioctl(dp->ctl_fd, SIOCGIFFLAGS, &ifr) == 0 &&
+        !(ifr.ifr_flags & IFF_UP)) {
+        ifr.ifr_flags |= IFF_UP;
+        if (ioctl(dp->ctl_fd, SIOCSIFFLAGS, &ifr) < 0) {
+            perror("Failed to bring the device up");
+        }
+    }
+    atomic_store(&d->mtu, 1500);
+    dp->num_devs++;
+    ipv6_dp_refresh(dp);
+    return dp->num_devs - 1;
+}
+
+/* Function to answer for one more address */
+int ipv6_dp_add_local(struct ipv6_dp *dp, const struct in6_addr *addr) {
+    if (dp->num_local == DP_MAX_LOCAL) {
+        return -1;
+    }
+    dp->local[dp->num_local++] = *addr;
+    return 0;
+}
+
+/* Function to find or add the index of a next hop. Returns 0 if the table is
+ * full or out of memory. */
+static uint16_t dp_nexthop_index(struct dp_routes *r, int dev, const struct in6_addr *gateway) {
+    struct dp_route nh;
+    memset(&nh, 0, sizeof(nh));
+    nh.dev = dev;
+    nh.has_gateway = gateway != NULL;
+    if (gateway) {
+        nh.gateway = *gateway;
+    }
+    for (uint32_t i = 1; i < r->num_nexthops; i++) {
+        if (memcmp(&r->nexthops[i], &nh, sizeof(nh)) == 0) {
+            return (uint16_t)i;
+        }
+    }
+    if (r->num_nexthops > FIB6_MAX_NEXTHOP) {
+        return 0;
+    }
+    if (r->num_nexthops >= r->cap_nexthops) {
+        uint32_t cap = r->cap_nexthops ? r->cap_nexthops * 2 : 16;
+        struct dp_route *nexthops = realloc(r->nexthops, cap * sizeof(*nexthops));
+        if (!nexthops) {
+            return 0;
+        }
+        r->nexthops = nexthops;
+        r->cap_nexthops = cap;
+    }
+    r->nexthops[r->num_nexthops] = nh;
+    return (uint16_t)r->num_nexthops++;
+}
+
+/* Function to add or replace a route */
+int ipv6_dp_add_route(struct ipv6_dp *dp, const struct in6_addr *prefix, uint8_t plen, int dev,
+                      const struct in6_addr *gateway) {
+    if (plen > 128 || dev < 0 || dev >= dp->num_devs) {
+        return -1;
+    }
+    uint16_t nh = dp_nexthop_index(&dp->routes, dev, gateway);
+    if (nh == 0) {
+        return -1;
+    }
+    return fib6_insert(&dp->routes.fib, prefix, plen, nh);
+}
+
+/* Function to find the route with the longest prefix covering addr */
+const struct dp_route *ipv6_dp_route(const struct dp_routes *r, const struct in6_addr *addr) {
+    uint16_t nh = fib6_lookup(&r->fib, addr);
+    return nh ? &r->nexthops[nh] : NULL;
+}
+
+/* Function to find the device a packet leaves through */
+int ipv6_dp_lookup(const struct dp_routes *r, const struct in6_addr *addr) {
+    const struct dp_route *rt = ipv6_dp_route(r, addr);
+    return rt ? rt->dev : -1;
+}
+
+/* Function to walk the extension header chain (RFC 8200 section 4) */
+int ipv6_dp_parse(const unsigned char *pkt, size_t len, struct dp_parsed *out) {
+    memset(out, 0, sizeof(*out));
+    if (len < sizeof(struct ip6_hdr) || (pkt[0] >> 4) != 6) {
+        return -1;
+    }
+    uint8_t nh = ((const struct ip6_hdr *)pkt)->ip6_nxt;
+    size_t off = sizeof(struct ip6_hdr);
+    for (;;) {
+        size_t hlen;
+        switch (nh) {
+        case IPPROTO_HOPOPTS:
+            if (off != sizeof(struct ip6_hdr)) {
+                return -1; /* Hop-by-Hop Options must come first */
+            }
+            /* Fall through */
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+        case DP_PROTO_MOBILITY:
+        case DP_PROTO_HIP:
+        case DP_PROTO_SHIM6:
+            if (off + 2 > len) {
+                return -1;
+            }
+            hlen = (pkt[off + 1] + 1) * 8;
+            break;
+        case IPPROTO_AH:
+            if (off + 2 > len) {
+                return -1;
+            }
+            hlen = (pkt[off + 1] + 2) * 4;
+            break;
+        case IPPROTO_FRAGMENT:
+            hlen = 8;
+            if (off + hlen > len) {
+                return -1;
+            }
+            out->frag_off = off;
+            if ((((pkt[off + 2] << 8) | pkt[off + 3]) & 0xFFF8) != 0) {
+                /* Only the first fragment holds the upper-layer header */
+                out->proto = pkt[off];
+                out->l4_off = off + hlen;
+                out->ext_count++;
+                return 0;
+            }
+            break;
+        default:
+            out->proto = nh;
+            out->l4_off = off;
+            return 0;
+        }
+        if (off + hlen > len || ++out->ext_count > DP_MAX_EXT) {
+            return -1;
+        }
+        nh = pkt[off];
+        off += hlen;
+    }
+}
+
+/* Function to write a packet to one of this worker's queues */
+static void dp_send(struct dp_worker *w, int dev, const unsigned char *pkt, size_t len) {
+    if (write(w->dp->devs[dev].fds[w->index], pkt, len) < 0) {
+        w->stats.tx_errors++;
+    }
+}
+
+/* Where ipv6_fragment's fragments go */
+struct dp_frag_dest {
+    struct dp_worker *w;
+    int dev;
+};
+
+/* Function to send one fragment of a reply */
+static void dp_send_fragment(const unsigned char *frag, size_t len, void *arg) {
+    struct dp_frag_dest *dest = arg;
+    dp_send(dest->w, dest->dev, frag, len);
+    dest->w->stats.frag_tx++;
+}
+
+/* Function to send a packet we originate (IPv6 header, then the upper layer),
+ * fragmenting it if it is larger than the device MTU */
+static void dp_send_local(struct dp_worker *w, int dev, const unsigned char *pkt, size_t len) {
+    uint32_t mtu = atomic_load_explicit(&w->dp->devs[dev].mtu, memory_order_relaxed);
+    if (len <= mtu) {
+        dp_send(w, dev, pkt, len);
+        return;
+    }
+    struct dp_frag_dest dest = { w, dev };
+    if (ipv6_fragment(pkt, len, sizeof(struct ip6_hdr), mtu, w->frag_id++, w->frag_out,
+                      dp_send_fragment, &dest) < 0) {
+        w->stats.tx_errors++;
+    }
+}
+
+/* Function to tell whether addr is one of ours */
+static int dp_is_local(const struct ipv6_dp *dp, const struct in6_addr *addr) {
+    if (memcmp(&dp->link_local, addr, sizeof(*addr)) == 0) {
+        return 1;
+    }
+    for (int i = 0; i < dp->num_local; i++) {
+        if (memcmp(&dp->local[i], addr, sizeof(*addr)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Function to tell whether a multicast address is one we listen to: all-nodes,
+ * all-routers, or the solicited-node group of one of our addresses */
+static int dp_is_our_group(const struct ipv6_dp *dp, const struct in6_addr *addr) {
+    static const unsigned char solicited[13] = { 0xFF, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0xFF };
+    static const unsigned char all_nodes[15] = { 0xFF, 0x02 };
+    if (memcmp(addr->s6_addr, all_nodes, sizeof(all_nodes)) == 0 &&
+        (addr->s6_addr[15] == 1 || addr->s6_addr[15] == 2)) {
+        return 1; /* ff02::1, ff02::2 */
+    }
+    if (memcmp(addr->s6_addr, solicited, sizeof(solicited)) != 0) {
+        return 0;
+    }
+    if (memcmp(dp->link_local.s6_addr + 13, addr->s6_addr + 13, 3) == 0) {
+        return 1;
+    }
+    for (int i = 0; i < dp->num_local; i++) {
+        if (memcmp(dp->local[i].s6_addr + 13, addr->s6_addr + 13, 3) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Function to spend one token of the ICMPv6 error budget */
+static int dp_icmp_allowed(struct dp_worker *w) {
+    uint64_t now = dp_now_ns();
+    w->tokens += (now - w->tokens_ns) * (DP_ICMP_RATE / 1e9);
+    w->tokens_ns = now;
+    if (w->tokens > DP_ICMP_BURST) {
+        w->tokens = DP_ICMP_BURST;
+    }
+    if (w->tokens < 1) {
+        return 0;
+    }
+    w->tokens -= 1;
+    return 1;
+}
+
+/* Function to send an ICMPv6 error about a packet back to its source, quoting as
+ * much of it as fits (RFC 4443 section 2.4) */
+static void dp_icmp_error(struct dp_worker *w, int in_dev, const unsigned char *pkt, size_t len,
+                          const struct dp_parsed *p, uint8_t type, uint8_t code, uint32_t param) {
+    struct ipv6_dp *dp = w->dp;
+    const struct ip6_hdr *orig = (const struct ip6_hdr *)pkt;
+    if (dp->num_local == 0 || IN6_IS_ADDR_UNSPECIFIED(&orig->ip6_src) ||
+        IN6_IS_ADDR_MULTICAST(&orig->ip6_dst) || dp_is_local(dp, &orig->ip6_src)) {
+        return; /* Nothing to tell, or only ourselves (our own looped solicitation) */
+    }
+    if (p->proto == IPPROTO_ICMPV6 && !p->frag_off && p->l4_off < len &&
+        pkt[p->l4_off] < ICMP6_ECHO_REQUEST) {
+        return; /* Never an error about an error */
+    }
+    if (!dp_icmp_allowed(w)) {
+        return;
+    }
+    size_t hdrs = sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr);
+    size_t quote = len < DP_ERR_MAX - hdrs ? len : DP_ERR_MAX - hdrs;
+    unsigned char *e = w->scratch;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)e;
+    struct icmp6_hdr *icmp = (struct icmp6_hdr *)(e + sizeof(*ip6));
+    memset(ip6, 0, sizeof(*ip6));
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(sizeof(*icmp) + quote);
+    ip6->ip6_nxt = IPPROTO_ICMPV6;
+    ip6->ip6_hlim = DP_HOP_LIMIT;
+    ip6->ip6_src = dp->local[0];
+    ip6->ip6_dst = orig->ip6_src;
+    icmp->icmp6_type = type;
+    icmp->icmp6_code = code;
+    icmp->icmp6_cksum = 0;
+    icmp->icmp6_data32[0] = htonl(param);
+    memcpy(e + hdrs, pkt, quote);
+    uint32_t sum = csum_pseudo_v6(&ip6->ip6_src, &ip6->ip6_dst, IPPROTO_ICMPV6,
+                                  sizeof(*icmp) + quote);
+    icmp->icmp6_cksum = csum_fold(csum_partial(icmp, sizeof(*icmp) + quote, sum));
+
+    /* Back the way the source is routed, or where the packet came from */
+    int out = ipv6_dp_lookup(&dp->routes, &ip6->ip6_dst);
+    dp_send(w, out >= 0 ? out : in_dev, e, hdrs + quote);
+    w->stats.icmp_errors++;
+}
+
+/* Function to turn an Echo Request into its Echo Reply in place. The reply drops
+ * the request's extension headers; swapping the addresses leaves the pseudo-header
+ * sum alone, so only the type (and a multicast destination we answer from our own
+ * address) needs patching into the checksum. */
+static void dp_echo_reply(struct dp_worker *w, int in_dev, unsigned char *pkt, size_t icmp_off,
+                          size_t icmp_len) {
+    struct ipv6_dp *dp = w->dp;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    if (IN6_IS_ADDR_UNSPECIFIED(&ip6->ip6_src)) {
+        w->stats.other++;
+        return;
+    }
+    unsigned char *icmp = pkt + sizeof(*ip6);
+    if (icmp_off != sizeof(*ip6)) {
+        memmove(icmp, pkt + icmp_off, icmp_len);
+    }
+    struct in6_addr src = IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst) ? dp->local[0] : ip6->ip6_dst;
+    uint16_t check, old_word, new_word;
+    memcpy(&check, icmp + 2, 2);
+    memcpy(&old_word, icmp, 2);
+    icmp[0] = ICMP6_ECHO_REPLY;
+    memcpy(&new_word, icmp, 2);
+    check = csum_update16(check, old_word, new_word);
+    check = csum_update128(check, &ip6->ip6_dst, &src);
+    memcpy(icmp + 2, &check, 2);
+
+    ip6->ip6_dst = ip6->ip6_src;
+    ip6->ip6_src = src;
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(icmp_len);
+    ip6->ip6_nxt = IPPROTO_ICMPV6;
+    ip6->ip6_hlim = DP_HOP_LIMIT;
+    int out = ipv6_dp_lookup(&dp->routes, &ip6->ip6_dst);
+    dp_send_local(w, out >= 0 ? out : in_dev, pkt, sizeof(*ip6) + icmp_len);
+    w->stats.echo_replies++;
+}
+
+/* Function to answer a Neighbor Solicitation for one of our addresses with a
+ * Neighbor Advertisement (RFC 4861 section 7.2.4). TUN links have no link-layer
+ * addresses, so the advertisement carries no Target Link-Layer Address option. */
+static void dp_neighbor_advert(struct dp_worker *w, int in_dev, unsigned char *pkt,
+                               size_t icmp_off, size_t icmp_len) {
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    const struct nd_neighbor_solicit *ns = (const struct nd_neighbor_solicit *)(pkt + icmp_off);
+    if (ip6->ip6_hlim != 255 || ns->nd_ns_code != 0 || icmp_len < sizeof(*ns) ||
+        IN6_IS_ADDR_MULTICAST(&ns->nd_ns_target)) {
+        w->stats.malformed++;
+        return;
+    }
+    if (!dp_is_local(w->dp, &ns->nd_ns_target)) {
+        w->stats.other++;
+        return;
+    }
+    struct in6_addr target = ns->nd_ns_target;
+    int solicited = !IN6_IS_ADDR_UNSPECIFIED(&ip6->ip6_src);
+    if (solicited) {
+        ndp_input_solicitation(&w->dp->ndp, in_dev, &ip6->ip6_src, w->now_ms, w);
+    }
+
+    struct nd_neighbor_advert *na = (struct nd_neighbor_advert *)(pkt + sizeof(*ip6));
+    memset(na, 0, sizeof(*na));
+    na->nd_na_type = ND_NEIGHBOR_ADVERT;
+    na->nd_na_flags_reserved = ND_NA_FLAG_ROUTER | ND_NA_FLAG_OVERRIDE |
+                               (solicited ? ND_NA_FLAG_SOLICITED : 0);
+    na->nd_na_target = target;
+    if (solicited) {
+        ip6->ip6_dst = ip6->ip6_src;
+    } else {
+        inet_pton(AF_INET6, "ff02::1", &ip6->ip6_dst);
+    }
+    ip6->ip6_src = target;
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(sizeof(*na));
+    ip6->ip6_nxt = IPPROTO_ICMPV6;
+    ip6->ip6_hlim = 255;
+    uint32_t sum = csum_pseudo_v6(&ip6->ip6_src, &ip6->ip6_dst, IPPROTO_ICMPV6, sizeof(*na));
+    na->nd_na_cksum = csum_fold(csum_partial(na, sizeof(*na), sum));
+    dp_send(w, in_dev, pkt, sizeof(*ip6) + sizeof(*na));
+    w->stats.neighbor_adverts++;
+}
+
+/* Function to pick the source of a packet we originate on dev: the first of our
+ * addresses routed out of dev, else our first address, else our link-local one */
+static const struct in6_addr *dp_source_for(const struct ipv6_dp *dp, int dev) {
+    for (int i = 0; i < dp->num_local; i++) {
+        if (ipv6_dp_lookup(&dp->routes, &dp->local[i]) == dev) {
+            return &dp->local[i];
+        }
+    }
+    return dp->num_local > 0 ? &dp->local[0] : &dp->link_local;
+}
+
+/* Function to send a Neighbor Solicitation for target out of dev (called by the
+ * neighbor cache). TUN links have no Source Link-Layer Address option to add, and
+ * no link-layer multicast either: Linux joins no solicited-node groups on such
+ * (NOARP) devices, so set DP_SOLICIT_MULTICAST only for peers that do. */
+static void dp_ndp_solicit(void *ctx, int dev, const struct in6_addr *target, int unicast) {
+    struct dp_worker *w = ctx;
+    unsigned char *pkt = w->scratch;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *)(pkt + sizeof(*ip6));
+    memset(pkt, 0, sizeof(*ip6) + sizeof(*ns));
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(sizeof(*ns));
+    ip6->ip6_nxt = IPPROTO_ICMPV6;
+    ip6->ip6_hlim = 255;
+    ip6->ip6_src = *dp_source_for(w->dp, dev);
+    if (unicast || !DP_SOLICIT_MULTICAST) {
+        ip6->ip6_dst = *target;
+    } else {
+        /* Solicited-node group: ff02::1:ff00:0/104 plus the target's low 24 bits */
+        ip6->ip6_dst.s6_addr[0] = 0xFF;
+        ip6->ip6_dst.s6_addr[1] = 0x02;
+        ip6->ip6_dst.s6_addr[11] = 0x01;
+        ip6->ip6_dst.s6_addr[12] = 0xFF;
+        memcpy(ip6->ip6_dst.s6_addr + 13, target->s6_addr + 13, 3);
+    }
+    ns->nd_ns_type = ND_NEIGHBOR_SOLICIT;
+    ns->nd_ns_target = *target;
+    uint32_t sum = csum_pseudo_v6(&ip6->ip6_src, &ip6->ip6_dst, IPPROTO_ICMPV6, sizeof(*ns));
+    ns->nd_ns_cksum = csum_fold(csum_partial(ns, sizeof(*ns), sum));
+    dp_send(w, dev, pkt, sizeof(*ip6) + sizeof(*ns));
+}
+
+/* Function to send a packet that waited for its next hop (called by the cache) */
+static void dp_ndp_transmit(void *ctx, int dev, const unsigned char *pkt, size_t len) {
+    struct dp_worker *w = ctx;
+    dp_send(w, dev, pkt, len);
+    w->stats.forwarded++;
+}
+
+/* Function to report a packet whose next hop never answered (called by the cache) */
+static void dp_ndp_unreachable(void *ctx, int in_dev, const unsigned char *pkt, size_t len) {
+    struct dp_parsed p;
+    if (ipv6_dp_parse(pkt, len, &p) == 0) {
+        dp_icmp_error(ctx, in_dev, pkt, len, &p, ICMP6_DST_UNREACH, ICMP6_DST_UNREACH_ADDR, 0);
+    }
+}
+
+static const struct ndp_ops dp_ndp_ops = {
+    dp_ndp_solicit, dp_ndp_transmit, dp_ndp_unreachable
+};
+
+/* Function to take in a Neighbor Advertisement (RFC 4861 section 7.1.2 checks) */
+static void dp_neighbor_input(struct dp_worker *w, int in_dev, const unsigned char *pkt,
+                              size_t icmp_off, size_t icmp_len) {
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr *)pkt;
+    const struct nd_neighbor_advert *na = (const struct nd_neighbor_advert *)(pkt + icmp_off);
+    if (ip6->ip6_hlim != 255 || icmp_len < sizeof(*na) || na->nd_na_code != 0 ||
+        IN6_IS_ADDR_MULTICAST(&na->nd_na_target) ||
+        (IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst) &&
+         (na->nd_na_flags_reserved & ND_NA_FLAG_SOLICITED))) {
+        w->stats.malformed++;
+        return;
+    }
+    uint32_t flags = na->nd_na_flags_reserved;
+    ndp_input_na(&w->dp->ndp, in_dev, &na->nd_na_target, !!(flags & ND_NA_FLAG_SOLICITED),
+                 !!(flags & ND_NA_FLAG_OVERRIDE), !!(flags & ND_NA_FLAG_ROUTER), w->now_ms, w);
+}
+
+/* Advertisement being filled in by dp_advert_prefix */
+struct dp_advert_ctx {
+    const struct ipv6_dp *dp;
+    int dev;
+    unsigned char *ra;             /* ICMPv6 message */
+    size_t len;                    /* Bytes of it so far */
+};
+
+/* Function to add a Prefix Information option for a route if it is an on-link
+ * /64 out of the advertising device */
+static int dp_advert_prefix(const struct in6_addr *prefix, uint8_t plen, uint16_t next_hop,
+                            void *arg) {
+    struct dp_advert_ctx *ctx = arg;
+    const struct dp_route *rt = &ctx->dp->routes.nexthops[next_hop];
+    if (rt->dev != ctx->dev || rt->has_gateway || plen != 64 || IN6_IS_ADDR_LINKLOCAL(prefix) ||
+        IN6_IS_ADDR_MULTICAST(prefix)) {
+        return 0;
+    }
+    if (sizeof(struct ip6_hdr) + ctx->len + sizeof(struct nd_opt_prefix_info) > DP_ERR_MAX) {
+        return 1; /* Full */
+    }
+    struct nd_opt_prefix_info *pi = (struct nd_opt_prefix_info *)(ctx->ra + ctx->len);
+    memset(pi, 0, sizeof(*pi));
+    pi->nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION;
+    pi->nd_opt_pi_len = 4;
+    pi->nd_opt_pi_prefix_len = 64;
+    pi->nd_opt_pi_flags_reserved = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO;
+    pi->nd_opt_pi_valid_time = htonl(DP_PREFIX_VALID);
+    pi->nd_opt_pi_preferred_time = htonl(DP_PREFIX_PREFERRED);
+    pi->nd_opt_pi_prefix = *prefix;
+    ctx->len += sizeof(*pi);
+    return 0;
+}
+
+/* Function to send a Router Advertisement out of dev to dst: our hop limit, a
+ * router lifetime, the link MTU, and a Prefix Information option (on-link,
+ * autonomous) for every on-link /64 routed out of dev (RFC 4861 section 4.2) */
+static void dp_router_advert(struct dp_worker *w, int dev, const struct in6_addr *dst) {
+    struct ipv6_dp *dp = w->dp;
+    unsigned char *pkt = w->scratch;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    struct nd_router_advert *ra = (struct nd_router_advert *)(pkt + sizeof(*ip6));
+    memset(pkt, 0, sizeof(*ip6) + sizeof(*ra));
+    ra->nd_ra_type = ND_ROUTER_ADVERT;
+    ra->nd_ra_curhoplimit = DP_HOP_LIMIT;
+    ra->nd_ra_router_lifetime = htons(DP_RA_LIFETIME);
+    size_t len = sizeof(*ra);
+
+    struct nd_opt_mtu *mtu = (struct nd_opt_mtu *)(pkt + sizeof(*ip6) + len);
+    memset(mtu, 0, sizeof(*mtu));
+    mtu->nd_opt_mtu_type = ND_OPT_MTU;
+    mtu->nd_opt_mtu_len = 1;
+    mtu->nd_opt_mtu_mtu = htonl(atomic_load_explicit(&dp->devs[dev].mtu, memory_order_relaxed));
+    len += sizeof(*mtu);
+
+    struct dp_advert_ctx ctx = { dp, dev, pkt + sizeof(*ip6), len };
+    fib6_walk(&dp->routes.fib, dp_advert_prefix, &ctx);
+    len = ctx.len;
+
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(len);
+    ip6->ip6_nxt = IPPROTO_ICMPV6;
+    ip6->ip6_hlim = 255;
+    ip6->ip6_src = dp->link_local; /* Hosts only accept link-local sources */
+    ip6->ip6_dst = *dst;
+    uint32_t sum = csum_pseudo_v6(&ip6->ip6_src, &ip6->ip6_dst, IPPROTO_ICMPV6, len);
+    ra->nd_ra_cksum = csum_fold(csum_partial(ra, len, sum));
+    dp_send(w, dev, pkt, sizeof(*ip6) + len);
+    w->stats.router_adverts++;
+}
+
+/* Function to answer a Router Solicitation: unicast to a host that has an
+ * address (within the ICMPv6 budget), otherwise to all nodes at most once per
+ * MIN_DELAY_BETWEEN_RAS */
+static void dp_router_solicit_input(struct dp_worker *w, int in_dev, const unsigned char *pkt,
+                                    size_t icmp_off, size_t icmp_len) {
+    struct ipv6_dp *dp = w->dp;
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr *)pkt;
+    if (ip6->ip6_hlim != 255 || icmp_len < sizeof(struct nd_router_solicit) ||
+        pkt[icmp_off + 1] != 0) {
+        w->stats.malformed++;
+        return;
+    }
+    if (!dp->advertise) {
+        w->stats.other++;
+        return;
+    }
+    struct in6_addr src = ip6->ip6_src;
+    if (!IN6_IS_ADDR_UNSPECIFIED(&src)) {
+        ndp_input_solicitation(&dp->ndp, in_dev, &src, w->now_ms, w);
+        if (dp_icmp_allowed(w)) {
+            dp_router_advert(w, in_dev, &src);
+        }
+        return;
+    }
+    uint64_t last = atomic_load(&dp->devs[in_dev].last_ra_ms);
+    if (last && w->now_ms < last + DP_RA_MIN_DELAY_MS) {
+        return;
+    }
+    if (atomic_compare_exchange_strong(&dp->devs[in_dev].last_ra_ms, &last, w->now_ms)) {
+        struct in6_addr all_nodes;
+        inet_pton(AF_INET6, "ff02::1", &all_nodes);
+        dp_router_advert(w, in_dev, &all_nodes);
+    }
+}
+
+/* Function to take in another router's Router Advertisement (RFC 4861 6.1.2
+ * checks): its sender becomes a default router for as long as it says */
+static void dp_router_advert_input(struct dp_worker *w, int in_dev, const unsigned char *pkt,
+                                   size_t icmp_off, size_t icmp_len) {
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr *)pkt;
+    const struct nd_router_advert *ra = (const struct nd_router_advert *)(pkt + icmp_off);
+    if (ip6->ip6_hlim != 255 || icmp_len < sizeof(*ra) || ra->nd_ra_code != 0 ||
+        !IN6_IS_ADDR_LINKLOCAL(&ip6->ip6_src)) {
+        w->stats.malformed++;
+        return;
+    }
+    ndp_input_ra(&w->dp->ndp, in_dev, &ip6->ip6_src, ntohs(ra->nd_ra_router_lifetime),
+                 w->now_ms, w);
+}
+
+/* Function to send the unsolicited Router Advertisements that are due (worker 0):
+ * the first few quickly, then at random intervals (RFC 4861 section 6.2.4) */
+static void dp_router_advert_timer(struct dp_worker *w) {
+    struct ipv6_dp *dp = w->dp;
+    for (int d = 0; d < dp->num_devs; d++) {
+        struct dp_dev *dev = &dp->devs[d];
+        if (w->now_ms < dev->next_ra_ms) {
+            continue;
+        }
+        struct in6_addr all_nodes;
+        inet_pton(AF_INET6, "ff02::1", &all_nodes);
+        dp_router_advert(w, d, &all_nodes);
+        atomic_store(&dev->last_ra_ms, w->now_ms);
+
+        w->rng ^= w->rng << 13; /* xorshift32 */
+        w->rng ^= w->rng >> 17;
+        w->rng ^= w->rng << 5;
+        uint64_t interval = DP_RA_MIN_INTERVAL_MS +
+                            w->rng % (DP_RA_MAX_INTERVAL_MS - DP_RA_MIN_INTERVAL_MS);
+        if (dev->initial_ras < DP_RA_INITIAL_COUNT) {
+            dev->initial_ras++;
+            if (interval > DP_RA_INITIAL_INTERVAL_MS) {
+                interval = DP_RA_INITIAL_INTERVAL_MS;
+            }
+        }
+        dev->next_ra_ms = w->now_ms + interval;
+    }
+}
+
+/* Function to handle a packet addressed to us; a fragment is held until its
+ * datagram is complete, which is then handled from the reassembly buffer */
+static void dp_local(struct dp_worker *w, int in_dev, unsigned char *pkt, size_t len,
+                     const struct dp_parsed *p) {
+    struct dp_parsed whole;
+    w->stats.local++;
+    if (p->frag_off) {
+        w->stats.fragments++;
+        len = ipv6_frag_input(&w->frag, pkt, len, p->frag_off, w->reasm, DP_PKT_MAX);
+        if (len == 0) {
+            return;
+        }
+        pkt = w->reasm;
+        if (ipv6_dp_parse(pkt, len, &whole) < 0 || whole.frag_off) {
+            w->stats.malformed++; /* Fragments inside fragments are never reassembled */
+            return;
+        }
+        p = &whole;
+        w->stats.reassembled++;
+    }
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    size_t icmp_len = len - p->l4_off;
+    if (p->proto != IPPROTO_ICMPV6 || icmp_len < sizeof(struct icmp6_hdr)) {
+        w->stats.other++;
+        return;
+    }
+    uint32_t sum = csum_pseudo_v6(&ip6->ip6_src, &ip6->ip6_dst, IPPROTO_ICMPV6, icmp_len);
+    if (csum_fold(csum_partial(pkt + p->l4_off, icmp_len, sum)) != 0) {
+        w->stats.malformed++;
+        return;
+    }
+    switch (pkt[p->l4_off]) {
+    case ICMP6_ECHO_REQUEST:
+        dp_echo_reply(w, in_dev, pkt, p->l4_off, icmp_len);
+        break;
+    case ND_NEIGHBOR_SOLICIT:
+        dp_neighbor_advert(w, in_dev, pkt, p->l4_off, icmp_len);
+        break;
+    case ND_NEIGHBOR_ADVERT:
+        dp_neighbor_input(w, in_dev, pkt, p->l4_off, icmp_len);
+        break;
+    case ND_ROUTER_SOLICIT:
+        dp_router_solicit_input(w, in_dev, pkt, p->l4_off, icmp_len);
+        break;
+    case ND_ROUTER_ADVERT:
+        dp_router_advert_input(w, in_dev, pkt, p->l4_off, icmp_len);
+        break;
+    default:
+        w->stats.other++;
+        break;
+    }
+}
+
+/* Function to route a packet out of the device its destination's route names (or
+ * to a learned default router), once its next hop is known to be there */
+static void dp_forward(struct dp_worker *w, int in_dev, unsigned char *pkt, size_t len,
+                       const struct dp_parsed *p) {
+    struct ipv6_dp *dp = w->dp;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    if (ip6->ip6_hlim <= 1) {
+        w->stats.hop_limit++;
+        dp_icmp_error(w, in_dev, pkt, len, p, ICMP6_TIME_EXCEEDED, ICMP6_TIME_EXCEED_TRANSIT, 0);
+        return;
+    }
+    const struct dp_route *rt = ipv6_dp_route(&dp->routes, &ip6->ip6_dst);
+    struct in6_addr next_hop;
+    int out;
+    if (rt) {
+        out = rt->dev;
+        next_hop = rt->has_gateway ? rt->gateway : ip6->ip6_dst;
+    } else if (ndp_default_router(&dp->ndp, w->ndp_slot, w->now_ms, &next_hop, &out) < 0) {
+        w->stats.no_route++;
+        dp_icmp_error(w, in_dev, pkt, len, p, ICMP6_DST_UNREACH, ICMP6_DST_UNREACH_NOROUTE, 0);
+        return;
+    }
+    uint32_t mtu = atomic_load_explicit(&dp->devs[out].mtu, memory_order_relaxed);
+    if (len > mtu) {
+        w->stats.too_big++;
+        dp_icmp_error(w, in_dev, pkt, len, p, ICMP6_PACKET_TOO_BIG, 0, mtu);
+        return;
+    }
+    ip6->ip6_hlim--; /* IPv6 has no header checksum to patch */
+    if (!ndp_resolve(&dp->ndp, w->ndp_slot, out, &next_hop, w->now_ms)) {
+        w->stats.neighbor_wait++;
+        if (!ndp_enqueue(&dp->ndp, out, &next_hop, in_dev, pkt, len, w->now_ms, w)) {
+            return; /* Sent once the neighbor answers */
+        }
+    }
+    dp_send(w, out, pkt, len);
+    w->stats.forwarded++;
+}
+
+/* Function to validate one packet and deliver or forward it */
+static void dp_process(struct dp_worker *w, int in_dev, unsigned char *pkt, size_t len) {
+    struct ipv6_dp *dp = w->dp;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)pkt;
+    w->stats.rx++;
+    w->stats.rx_bytes += len;
+    struct dp_parsed p;
+    if (len < sizeof(*ip6) || ntohs(ip6->ip6_plen) == 0 ||
+        sizeof(*ip6) + ntohs(ip6->ip6_plen) > len) {
+        w->stats.malformed++;
+        return;
+    }
+    len = sizeof(*ip6) + ntohs(ip6->ip6_plen); /* Ignore any trailing bytes */
+    if (ipv6_dp_parse(pkt, len, &p) < 0 || IN6_IS_ADDR_MULTICAST(&ip6->ip6_src)) {
+        w->stats.malformed++;
+        return;
+    }
+
+    if (dp_is_local(dp, &ip6->ip6_dst)) {
+        dp_local(w, in_dev, pkt, len, &p);
+    } else if (IN6_IS_ADDR_MULTICAST(&ip6->ip6_dst)) {
+        if (dp_is_our_group(dp, &ip6->ip6_dst)) {
+            dp_local(w, in_dev, pkt, len, &p);
+        } else {
+            w->stats.other++; /* Multicast is not routed */
+        }
+    } else if (IN6_IS_ADDR_LINKLOCAL(&ip6->ip6_dst) || IN6_IS_ADDR_LINKLOCAL(&ip6->ip6_src) ||
+               IN6_IS_ADDR_LOOPBACK(&ip6->ip6_dst) || IN6_IS_ADDR_UNSPECIFIED(&ip6->ip6_dst)) {
+        w->stats.other++; /* Never leaves its link (RFC 4291 2.5.6) */
+    } else {
+        dp_forward(w, in_dev, pkt, len, &p);
+    }
+}
+
+/* Function run by each worker: wait on its queue of every device, drain a batch
+ * from each ready queue and process it */
+static void *dp_worker_run(void *arg) {
+    struct dp_worker *w = arg;
+    struct ipv6_dp *dp = w->dp;
+    struct pollfd pfd[DP_MAX_DEVS];
+    size_t lens[DP_BATCH];
+    for (int d = 0; d < dp->num_devs; d++) {
+        pfd[d].fd = dp->devs[d].fds[w->index];
+        pfd[d].events = POLLIN;
+    }
+    w->tokens = DP_ICMP_BURST;
+    w->tokens_ns = dp_now_ns();
+    while (!dp->stop) {
+        int ready = poll(pfd, dp->num_devs, DP_POLL_MS);
+        w->now_ms = tw_now_ms();
+        if (w->frag.num_queues > 0) {
+            ipv6_frag_expire(&w->frag, w->now_ms);
+        }
+        if (w->index == 0) {
+            ndp_age(&dp->ndp, w->now_ms, w);
+            if (dp->advertise) {
+                dp_router_advert_timer(w);
+            }
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        for (int d = 0; d < dp->num_devs; d++) {
+            if (!(pfd[d].revents & POLLIN)) {
+                continue;
+            }
+            int got = 0;
+            while (got < DP_BATCH) {
+                ssize_t n = read(pfd[d].fd, w->bufs + (size_t)got * DP_BUF_STRIDE, DP_PKT_MAX);
+                if (n <= 0) {
+                    break;
+                }
+                lens[got++] = n;
+            }
+            for (int i = 0; i < got; i++) {
+                dp_process(w, d, w->bufs + (size_t)i * DP_BUF_STRIDE, lens[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Function to start the workers (all or none) */
+int ipv6_dp_start(struct ipv6_dp *dp) {
+    dp->stop = 0;
+    if (fib6_commit(&dp->routes.fib) < 0) {
+        fprintf(stderr, "Out of memory building the route table\n");
+        return -1;
+    }
+    for (int i = 0; i < dp->num_workers; i++) {
+        struct dp_worker *w = &dp->workers[i];
+        if (w->ndp_slot < 0 && (w->ndp_slot = ndp_register(&dp->ndp)) < 0) {
+            fprintf(stderr, "No neighbor cache reader slot for worker %d\n", i);
+            return -1;
+        }
+        w->now_ms = tw_now_ms();
+    }
+    for (int i = 0; i < dp->num_workers; i++) {
+        if (pthread_create(&dp->workers[i].tid, NULL, dp_worker_run, &dp->workers[i]) != 0) {
+            perror("pthread_create failed");
+            ipv6_dp_stop(dp); /* A queue without a worker would strand its flows */
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Function to re-read each device's MTU */
+void ipv6_dp_refresh(struct ipv6_dp *dp) {
+    for (int d = 0; d < dp->num_devs; d++) {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, dp->devs[d].name, IFNAMSIZ - 1);
+        if (dp->ctl_fd >= 0 && ioctl(dp->ctl_fd, SIOCGIFMTU, &ifr) == 0) {
+            atomic_store(&dp->devs[d].mtu, (uint32_t)ifr.ifr_mtu);
+        }
+    }
+}
+
+/* Function to stop and join the workers */
+void ipv6_dp_stop(struct ipv6_dp *dp) {
+    dp->stop = 1;
+    for (int i = 0; i < dp->num_workers; i++) {
+        if (dp->workers[i].tid) {
+            pthread_join(dp->workers[i].tid, NULL);
+            dp->workers[i].tid = 0;
+        }
+    }
+}
+
+/* Function to add up every worker's counters */
+void ipv6_dp_totals(const struct ipv6_dp *dp, struct dp_stats *sum) {
+    memset(sum, 0, sizeof(*sum));
+    unsigned long *s = (unsigned long *)sum;
+    size_t fields = offsetof(struct dp_stats, tx_errors) / sizeof(unsigned long) + 1;
+    for (int i = 0; i < dp->num_workers; i++) {
+        const unsigned long *v = (const unsigned long *)&dp->workers[i].stats;
+        for (size_t k = 0; k < fields; k++) {
+            s[k] += v[k];
+        }
+    }
+}
+
+/* Function to total the drops of one set of counters */
+static unsigned long dp_drops(const struct dp_stats *s) {
+    return s->malformed + s->no_route + s->hop_limit + s->too_big + s->other + s->tx_errors;
+}
+
+/* Function to add up every worker's reassembly counters */
+void ipv6_dp_frag_totals(const struct ipv6_dp *dp, struct frag_stats *sum) {
+    memset(sum, 0, sizeof(*sum));
+    unsigned long *s = (unsigned long *)sum;
+    size_t fields = offsetof(struct frag_stats, no_memory) / sizeof(unsigned long) + 1;
+    for (int i = 0; i < dp->num_workers; i++) {
+        const struct frag_stats *f = &dp->workers[i].frag.stats;
+        const unsigned long *v = (const unsigned long *)f;
+        for (size_t k = 0; k < fields; k++) {
+            s[k] += v[k];
+        }
+        sum->peak_bytes += f->peak_bytes;
+    }
+}
+
+/* Function to print one row of the statistics table */
+static void dp_print_row(FILE *out, const char *label, const struct dp_stats *s, double secs) {
+    fprintf(out, "%-8s %12lu %12lu %9lu %8lu %8lu %8lu %10lu %10.0f\n", label, s->rx,
+            s->forwarded, s->local, s->echo_replies, s->neighbor_adverts, s->icmp_errors,
+            dp_drops(s), secs > 0 ? s->rx / secs : 0);
+}
+
+/* Function to print the counters of every worker and the totals */
+void ipv6_dp_print_stats(const struct ipv6_dp *dp, FILE *out, double secs) {
+    fprintf(out, "%-8s %12s %12s %9s %8s %8s %8s %10s %10s\n", "worker", "rx", "forwarded",
+            "local", "echo", "na", "icmp_err", "dropped", "rx_pps");
+    for (int i = 0; i < dp->num_workers; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "%d", i);
+        dp_print_row(out, label, &dp->workers[i].stats, secs);
+    }
+    struct dp_stats sum;
+    ipv6_dp_totals(dp, &sum);
+    dp_print_row(out, "total", &sum, secs);
+    fprintf(out, "drops: %lu malformed, %lu no route, %lu hop limit, %lu too big, "
+            "%lu other, %lu write errors\n", sum.malformed, sum.no_route, sum.hop_limit,
+            sum.too_big, sum.other, sum.tx_errors);
+    struct frag_stats fs;
+    ipv6_dp_frag_totals(dp, &fs);
+    fprintf(out, "neighbors: %lu cached, %lu created, %lu resolved, %lu failed, %lu unreachable, "
+            "%lu collected, %lu solicitations, %lu packets queued, %lu queue drops, "
+            "%lu table full, %lu NA and %lu RA received, %lu RA sent\n", dp->ndp.count,
+            dp->ndp.stats.created, dp->ndp.stats.resolved, dp->ndp.stats.failed,
+            dp->ndp.stats.unreachable, dp->ndp.stats.collected, dp->ndp.stats.solicits,
+            dp->ndp.stats.queued, dp->ndp.stats.queue_drops, dp->ndp.stats.table_full,
+            dp->ndp.stats.advertisements, dp->ndp.stats.router_adverts, sum.router_adverts);
+    fprintf(out, "reassembly: %lu fragments, %lu datagrams, %lu atomic, %lu timed out, "
+            "%lu overlapping, %lu malformed, %lu too many holes, %lu over source share, "
+            "%lu evicted, %lu no memory, peak %zu bytes; %lu fragments sent\n", fs.fragments,
+            fs.reassembled, fs.atomic, fs.timeouts, fs.overlaps, fs.malformed,
+            fs.too_many_holes, fs.source_limited, fs.evicted, fs.no_memory, fs.peak_bytes,
+            sum.frag_tx);
+}
+
+/* Function to close the devices and free everything */
+void ipv6_dp_destroy(struct ipv6_dp *dp) {
+    for (int d = 0; d < dp->num_devs; d++) {
+        for (int i = 0; i < dp->num_workers; i++) {
+            close(dp->devs[d].fds[i]);
+        }
+    }
+    fib6_destroy(&dp->routes.fib);
+    free(dp->routes.nexthops);
+    if (dp->workers) {
+        for (int i = 0; i < dp->num_workers; i++) {
+            free(dp->workers[i].bufs);
+            free(dp->workers[i].scratch);
+            free(dp->workers[i].reasm);
+            free(dp->workers[i].frag_out);
+            ipv6_frag_destroy(&dp->workers[i].frag);
+        }
+        free(dp->workers);
+    }
+    ndp_destroy(&dp->ndp);
+    if (dp->ctl_fd >= 0) {
+        close(dp->ctl_fd);
+    }
+    memset(dp, 0, sizeof(*dp));
+    dp->ctl_fd = -1;
+}
@@ -0,0 +1,479 @@
+/* ipv6_frag.c: Bounded IPv6 fragment reassembly and fragmentation (see
+ * include/ipv6_frag.h). Every byte a datagram in progress holds (its queue and
+ * its chunks) is charged to the engine and to the source /64 that sent it before
+ * it is taken from the pools, so the budget check is the only limit that ever
+ * bites; the pools are sized so they cannot run dry first. */
+
+/* Include standard libraries for memory, randomness and header layouts */
+#include <stdlib.h>        /* For calloc, free */
+#include <string.h>        /* For memcpy, memset */
+#include <stddef.h>        /* For offsetof */
+#include <time.h>          /* For time (fallback hash key) */
+#include <sys/random.h>    /* For getrandom */
+#include <arpa/inet.h>     /* For ntohs, ntohl, htons, htonl */
+#include <netinet/ip6.h>   /* For struct ip6_hdr */
+#include "ipv6_frag.h"     /* For struct ipv6_frag, struct frag_queue */
+
+/* Timer wheel resolution for reassembly deadlines (milliseconds) */
+#define FRAG_TICK_MS 100
+/* Upper bound of the open-ended hole before the last fragment arrives */
+#define FRAG_END UINT32_MAX
+
+/* Function to mix 64 bits (murmur3 finalizer) */
+static uint64_t frag_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Function to hash a datagram key with the engine's secret */
+static uint32_t frag_key_hash(const struct ipv6_frag *f, const struct in6_addr *src,
+                              const struct in6_addr *dst, uint32_t id) {
+    uint64_t w[4];
+    memcpy(w, src, 16);
+    memcpy(w + 2, dst, 16);
+    uint64_t h = f->seed ^ id;
+    for (int i = 0; i < 4; i++) {
+        h = frag_mix(h ^ w[i]);
+    }
+    return (uint32_t)h & f->queue_mask;
+}
+
+/* Function to find the byte naming the header that starts at end: the IPv6
+ * header's Next Header, or that of the last Hop-by-Hop, Routing or Destination
+ * Options header before end. Returns its offset, or 0 if the headers do not end
+ * exactly at end. */
+static size_t frag_nh_offset(const unsigned char *pkt, size_t end) {
+    size_t nh_at = 6;
+    size_t off = sizeof(struct ip6_hdr);
+    while (off < end) {
+        uint8_t type = pkt[nh_at];
+        if ((type != IPPROTO_HOPOPTS && type != IPPROTO_ROUTING && type != IPPROTO_DSTOPTS) ||
+            off + 2 > end) {
+            return 0;
+        }
+        nh_at = off;
+        off += (pkt[off + 1] + 1) * 8;
+    }
+    return off == end ? nh_at : 0;
+}
+
+/* Function to take one object from a pool filled at start */
+static int frag_prefill(struct pool *p) {
+    void *obj = pool_alloc(p);
+    if (!obj) {
+        return -1;
+    }
+    pool_free(p, obj);
+    return 0;
+}
+
+/* Function to find the smallest power of two at least n */
+static uint32_t frag_pow2(size_t n) {
+    uint32_t size = 16;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/* Function to prepare an engine and allocate all its memory */
+int ipv6_frag_init(struct ipv6_frag *f, size_t mem_limit, uint64_t timeout_ms) {
+    memset(f, 0, sizeof(*f));
+    f->mem_limit = mem_limit ? mem_limit : FRAG_DEFAULT_MEM;
+    f->source_limit = f->mem_limit / FRAG_SRC_SHARE;
+    f->timeout_ms = timeout_ms ? timeout_ms : FRAG_TIMEOUT_MS;
+
+    /* Every queue holds at least one chunk once charged, which bounds the queues */
+    size_t max_chunks = f->mem_limit / FRAG_CHUNK;
+    size_t max_queues = f->mem_limit / (sizeof(struct frag_queue) + FRAG_CHUNK);
+    if (max_queues == 0) {
+        return -1;
+    }
+    pool_init(&f->chunk_pool, FRAG_CHUNK, max_chunks, max_chunks);
+    pool_init(&f->queue_pool, sizeof(struct frag_queue), max_queues, max_queues);
+    pool_init(&f->source_pool, sizeof(struct frag_source), max_queues, max_queues);
+    f->queue_mask = frag_pow2(max_queues) - 1;
+    f->source_mask = frag_pow2(max_queues) - 1;
+    f->queues = calloc(f->queue_mask + 1, sizeof(*f->queues));
+    f->sources = calloc(f->source_mask + 1, sizeof(*f->sources));
+    if (!f->queues || !f->sources || frag_prefill(&f->chunk_pool) < 0 ||
+        frag_prefill(&f->queue_pool) < 0 || frag_prefill(&f->source_pool) < 0) {
+        ipv6_frag_destroy(f);
+        return -1;
+    }
+    if (getrandom(&f->seed, sizeof(f->seed), 0) != sizeof(f->seed)) {
+        f->seed = frag_mix((uint64_t)time(NULL) ^ (uintptr_t)f);
+    }
+    tw_init(&f->wheel, FRAG_TICK_MS);
+    return 0;
+}
+
+/* Function to free everything */
+void ipv6_frag_destroy(struct ipv6_frag *f) {
+    pool_destroy(&f->chunk_pool);
+    pool_destroy(&f->queue_pool);
+    pool_destroy(&f->source_pool);
+    free(f->queues);
+    free(f->sources);
+    f->queues = NULL;
+    f->sources = NULL;
+}
+
+/* Function to find (or, if create is set, add) the budget of a source /64 */
+static struct frag_source *frag_source_get(struct ipv6_frag *f, const struct in6_addr *src,
+                                           int create) {
+    uint64_t prefix;
+    memcpy(&prefix, src, sizeof(prefix));
+    struct frag_source **bucket = &f->sources[frag_mix(prefix ^ f->seed) & f->source_mask];
+    for (struct frag_source *s = *bucket; s; s = s->hash_next) {
+        if (s->prefix == prefix) {
+            return s;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    struct frag_source *s = pool_alloc(&f->source_pool);
+    if (!s) {
+        return NULL;
+    }
+    s->prefix = prefix;
+    s->bytes = 0;
+    s->queues = 0;
+    s->hash_next = *bucket;
+    *bucket = s;
+    return s;
+}
+
+/* Function to drop a source's entry once it holds nothing */
+static void frag_source_put(struct ipv6_frag *f, struct frag_source *s) {
+    if (s->queues > 0) {
+        return;
+    }
+    struct frag_source **link = &f->sources[frag_mix(s->prefix ^ f->seed) & f->source_mask];
+    while (*link != s) {
+        link = &(*link)->hash_next;
+    }
+    *link = s->hash_next;
+    pool_free(&f->source_pool, s);
+}
+
+/* Function to release a datagram in progress and everything it holds */
+static void frag_queue_free(struct ipv6_frag *f, struct frag_queue *q) {
+    struct frag_queue **link = &f->queues[frag_key_hash(f, &q->src, &q->dst, q->id)];
+    while (*link != q) {
+        link = &(*link)->hash_next;
+    }
+    *link = q->hash_next;
+    if (q->older) {
+        q->older->newer = q->newer;
+    } else {
+        f->oldest = q->newer;
+    }
+    if (q->newer) {
+        q->newer->older = q->older;
+    } else {
+        f->newest = q->older;
+    }
+    tw_cancel(&f->wheel, &q->timer);
+    for (int i = 0; i < FRAG_MAX_CHUNKS; i++) {
+        if (q->chunks[i]) {
+            pool_free(&f->chunk_pool, q->chunks[i]);
+        }
+    }
+    if (q->unfrag) {
+        pool_free(&f->chunk_pool, q->unfrag);
+    }
+    f->bytes -= q->charged;
+    q->source->bytes -= q->charged;
+    q->source->queues--;
+    frag_source_put(f, q->source);
+    f->num_queues--;
+    pool_free(&f->queue_pool, q);
+}
+
+/* Function to charge bytes to a source and the engine, evicting the oldest
+ * datagrams (never keep) while the engine is over budget. Returns 0, or -1 with
+ * the refusal counted. */
+static int frag_charge(struct ipv6_frag *f, struct frag_source *s, struct frag_queue *keep,
+                       size_t bytes) {
+    if (s->bytes + bytes > f->source_limit) {
+        f->stats.source_limited++;
+        return -1;
+    }
+    while (f->bytes + bytes > f->mem_limit) {
+        struct frag_queue *victim = f->oldest;
+        if (victim && victim == keep) {
+            victim = keep->newer;
+        }
+        if (!victim) {
+            f->stats.no_memory++;
+            return -1;
+        }
+        frag_queue_free(f, victim);
+        f->stats.evicted++;
+    }
+    f->bytes += bytes;
+    s->bytes += bytes;
+    if (keep) {
+        keep->charged += bytes;
+    }
+    if (f->bytes > f->stats.peak_bytes) {
+        f->stats.peak_bytes = f->bytes;
+    }
+    return 0;
+}
+
+/* Function called by the wheel when a datagram runs out of time */
+static void frag_expired(struct tw_timer *timer, void *arg) {
+    struct ipv6_frag *f = arg;
+    struct frag_queue *q = (struct frag_queue *)((char *)timer - offsetof(struct frag_queue, timer));
+    f->stats.timeouts++;
+    frag_queue_free(f, q);
+}
+
+/* Function to start a datagram in progress, charged to its source */
+static struct frag_queue *frag_queue_new(struct ipv6_frag *f, const struct ip6_hdr *ip6,
+                                         uint32_t id, struct frag_queue **bucket) {
+    struct frag_source *s = frag_source_get(f, &ip6->ip6_src, 1);
+    if (!s) {
+        f->stats.no_memory++;
+        return NULL;
+    }
+    /* Count the queue first so evicting the source's last datagram keeps s */
+    s->queues++;
+    struct frag_queue *q = NULL;
+    if (frag_charge(f, s, NULL, sizeof(struct frag_queue)) == 0) {
+        q = pool_alloc(&f->queue_pool);
+        if (!q) {
+            f->bytes -= sizeof(struct frag_queue);
+            s->bytes -= sizeof(struct frag_queue);
+            f->stats.no_memory++;
+        }
+    }
+    if (!q) {
+        s->queues--;
+        frag_source_put(f, s);
+        return NULL;
+    }
+    memset(q, 0, sizeof(*q));
+    q->source = s;
+    q->charged = sizeof(struct frag_queue);
+    q->src = ip6->ip6_src;
+    q->dst = ip6->ip6_dst;
+    q->id = id;
+    q->num_holes = 1;
+    q->holes[0].first = 0;
+    q->holes[0].last = FRAG_END;
+    q->hash_next = *bucket;
+    *bucket = q;
+    q->older = f->newest;
+    if (f->newest) {
+        f->newest->newer = q;
+    } else {
+        f->oldest = q;
+    }
+    f->newest = q;
+    f->num_queues++;
+    tw_timer_init(&q->timer, frag_expired, f);
+    tw_add(&f->wheel, &q->timer, f->timeout_ms);
+    return q;
+}
+
+/* Function to copy the Fragment header-less datagram to out. Returns its length,
+ * or 0 if it does not fit. */
+static size_t frag_emit_whole(const unsigned char *unfrag, size_t unfrag_len, uint8_t next_header,
+                              unsigned char *out, size_t out_size, size_t frag_len) {
+    size_t nh_at = frag_nh_offset(unfrag, unfrag_len);
+    size_t total = unfrag_len + frag_len;
+    if (!nh_at || total > out_size || total - sizeof(struct ip6_hdr) > 65535) {
+        return 0;
+    }
+    memcpy(out, unfrag, unfrag_len);
+    out[nh_at] = next_header;
+    ((struct ip6_hdr *)out)->ip6_plen = htons(total - sizeof(struct ip6_hdr));
+    return total;
+}
+
+/* Function to fit bytes first..last into a hole, splitting it. Returns 0, or -1
+ * if they overlap data already received, or -2 if the holes would overflow. */
+static int frag_fill(struct frag_queue *q, uint32_t first, uint32_t last, int more) {
+    int h = 0;
+    while (h < q->num_holes && !(q->holes[h].first <= first && last <= q->holes[h].last)) {
+        h++;
+    }
+    if (h == q->num_holes) {
+        return -1;
+    }
+    struct frag_hole hole = q->holes[h];
+    if (!more && hole.last != FRAG_END) {
+        return -1; /* Data beyond the end already came, or a second last fragment */
+    }
+    int pieces = (hole.first < first) + (more && last < hole.last);
+    if (q->num_holes - 1 + pieces > FRAG_MAX_HOLES) {
+        return -2;
+    }
+    q->holes[h] = q->holes[--q->num_holes];
+    if (hole.first < first) {
+        q->holes[q->num_holes].first = hole.first;
+        q->holes[q->num_holes++].last = first - 1;
+    }
+    if (more && last < hole.last) {
+        q->holes[q->num_holes].first = last + 1;
+        q->holes[q->num_holes++].last = hole.last;
+    }
+    return 0;
+}
+
+/* Function to feed one fragment */
+size_t ipv6_frag_input(struct ipv6_frag *f, const unsigned char *pkt, size_t len, size_t frag_off,
+                       unsigned char *out, size_t out_size) {
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr *)pkt;
+    f->stats.fragments++;
+    if (frag_off < sizeof(*ip6) || frag_off > FRAG_CHUNK || frag_off + 8 > len) {
+        f->stats.malformed++;
+        return 0;
+    }
+    uint8_t next_header = pkt[frag_off];
+    uint16_t offlg = (pkt[frag_off + 2] << 8) | pkt[frag_off + 3];
+    uint32_t offset = offlg & 0xFFF8;
+    int more = offlg & 1;
+    uint32_t id;
+    memcpy(&id, pkt + frag_off + 4, sizeof(id));
+    id = ntohl(id);
+    const unsigned char *data = pkt + frag_off + 8;
+    uint32_t data_len = len - frag_off - 8;
+
+    /* A whole datagram in a Fragment header is processed on its own (RFC 6946) */
+    if (offset == 0 && !more) {
+        f->stats.atomic++;
+        size_t n = frag_emit_whole(pkt, frag_off, next_header, out, out_size, data_len);
+        if (n == 0) {
+            f->stats.malformed++;
+            return 0;
+        }
+        memcpy(out + frag_off, data, data_len);
+        return n;
+    }
+
+    /* All but the last fragment carry a multiple of 8 bytes; none reaches past 64 KiB */
+    if (data_len == 0 || (more && data_len % 8 != 0) ||
+        frag_off - sizeof(*ip6) + offset + data_len > 65535) {
+        f->stats.malformed++;
+        return 0;
+    }
+
+    struct frag_queue **bucket = &f->queues[frag_key_hash(f, &ip6->ip6_src, &ip6->ip6_dst, id)];
+    struct frag_queue *q = *bucket;
+    while (q && !(q->id == id && memcmp(&q->src, &ip6->ip6_src, sizeof(q->src)) == 0 &&
+                  memcmp(&q->dst, &ip6->ip6_dst, sizeof(q->dst)) == 0)) {
+        q = q->hash_next;
+    }
+    if (!q && !(q = frag_queue_new(f, ip6, id, bucket))) {
+        return 0;
+    }
+
+    /* Place the bytes: they must fill part of exactly one hole */
+    uint32_t first = offset;
+    uint32_t last = offset + data_len - 1;
+    int fit = frag_fill(q, first, last, more);
+    if (fit < 0) {
+        if (fit == -1) {
+            f->stats.overlaps++;
+        } else {
+            f->stats.too_many_holes++;
+        }
+        frag_queue_free(f, q);
+        return 0;
+    }
+
+    /* Charge and fetch the chunks the data lands in */
+    size_t needed = (offset == 0 && !q->unfrag);
+    for (uint32_t k = first / FRAG_CHUNK; k <= last / FRAG_CHUNK; k++) {
+        needed += !q->chunks[k];
+    }
+    if (needed && frag_charge(f, q->source, q, needed * FRAG_CHUNK) < 0) {
+        frag_queue_free(f, q);
+        return 0;
+    }
+    for (uint32_t k = first / FRAG_CHUNK; k <= last / FRAG_CHUNK; k++) {
+        if (!q->chunks[k]) {
+            q->chunks[k] = pool_alloc(&f->chunk_pool);
+        }
+        uint32_t lo = k * FRAG_CHUNK > first ? k * FRAG_CHUNK : first;
+        uint32_t hi = (k + 1) * FRAG_CHUNK - 1 < last ? (k + 1) * FRAG_CHUNK - 1 : last;
+        memcpy(q->chunks[k] + (lo - k * FRAG_CHUNK), data + (lo - first), hi - lo + 1);
+    }
+    if (offset == 0) {
+        if (!q->unfrag) {
+            q->unfrag = pool_alloc(&f->chunk_pool);
+        }
+        memcpy(q->unfrag, pkt, frag_off);
+        q->unfrag_len = frag_off;
+        q->next_header = next_header;
+    }
+    if (!more) {
+        q->total = last + 1;
+    }
+    if (q->num_holes > 0) {
+        return 0;
+    }
+
+    /* Complete: the first fragment's headers, then the data in order */
+    size_t n = frag_emit_whole(q->unfrag, q->unfrag_len, q->next_header, out, out_size, q->total);
+    if (n == 0) {
+        f->stats.malformed++;
+    } else {
+        unsigned char *p = out + q->unfrag_len;
+        for (uint32_t k = 0; k * FRAG_CHUNK < q->total; k++) {
+            uint32_t bytes = q->total - k * FRAG_CHUNK;
+            memcpy(p + k * FRAG_CHUNK, q->chunks[k], bytes < FRAG_CHUNK ? bytes : FRAG_CHUNK);
+        }
+        f->stats.reassembled++;
+    }
+    frag_queue_free(f, q);
+    return n;
+}
+
+/* Function to expire datagrams whose time ran out */
+void ipv6_frag_expire(struct ipv6_frag *f, uint64_t now_ms) {
+    tw_advance(&f->wheel, now_ms);
+}
+
+/* Function to split a packet into fragments of at most mtu bytes */
+int ipv6_fragment(const unsigned char *pkt, size_t len, size_t unfrag_len, size_t mtu,
+                  uint32_t id, unsigned char *scratch, ipv6_frag_emit emit, void *arg) {
+    size_t nh_at = frag_nh_offset(pkt, unfrag_len);
+    if (!nh_at || len <= unfrag_len || mtu < unfrag_len + 8 + 8) {
+        return -1;
+    }
+    size_t per = (mtu - unfrag_len - 8) & ~(size_t)7;
+    uint8_t next_header = pkt[nh_at];
+    uint32_t nid = htonl(id);
+    int n = 0;
+    for (size_t off = 0; unfrag_len + off < len; off += per) {
+        size_t bytes = len - unfrag_len - off;
+        int more = bytes > per;
+        if (more) {
+            bytes = per;
+        }
+        memcpy(scratch, pkt, unfrag_len);
+        scratch[nh_at] = IPPROTO_FRAGMENT;
+        unsigned char *fh = scratch + unfrag_len;
+        uint16_t offlg = htons((uint16_t)(off | more));
+        fh[0] = next_header;
+        fh[1] = 0;
+        memcpy(fh + 2, &offlg, sizeof(offlg));
+        memcpy(fh + 4, &nid, sizeof(nid));
+        memcpy(fh + 8, pkt + unfrag_len + off, bytes);
+        size_t frag_len = unfrag_len + 8 + bytes;
+        ((struct ip6_hdr *)scratch)->ip6_plen = htons(frag_len - sizeof(struct ip6_hdr));
+        emit(scratch, frag_len, arg);
+        n++;
+    }
+    return n;
+}
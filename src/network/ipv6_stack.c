@@ -1,8 +1,17 @@
 /* ipv6_stack.c: A simple IPv6 stack implementation that sends ICMPv6 Echo Requests
  * (like ping6) to a target IPv6 address and receives Echo Replies, calculating
- * round-trip time (RTT). It uses raw sockets for ICMPv6 packets. Like a librarian
- * sending test letters with a new address format (IPv6). Requires root privileges
- * (sudo) and an IPv6-enabled interface. */
+ * round-trip time (RTT). It uses raw sockets for ICMPv6 packets. With -P it
+ * discovers the path MTU to each of several targets at once instead: every round
+ * sends one probe per unfinished target, sized by a binary search, and Packet Too
+ * Big errors jump the search to the MTU they report; results are cached for the
+ * transport tools. With -R it becomes a router instead: a userspace IPv6 datapath
+ * on multi-queue TUN devices (ipv6_dp.c) that answers pings and neighbor
+ * solicitations for its addresses (reassembling fragmented requests within a
+ * fixed memory budget) and forwards everything else by longest prefix match, one
+ * worker thread per queue, resolving next hops with its own Neighbor Discovery
+ * and optionally advertising itself as a router (-A). Like a librarian sending test letters with a
+ * new address format (IPv6). Requires root privileges (sudo) and an IPv6-enabled
+ * interface. */
 
 /* Include standard libraries for sockets, networking, time, and I/O */
 #include <stdio.h>      /* For printf, perror, fprintf (printing) */
@@ -15,6 +24,14 @@
 #include <arpa/inet.h>  /* For inet_pton, htons (network conversions) */
 #include <netinet/icmp6.h> /* For icmp6_hdr (ICMPv6 header) */
 #include <net/if.h>     /* For ifreq, if_nametoindex (interface index) */
+#include <errno.h>      /* For errno, EAGAIN (reply timeout) */
+#include <poll.h>       /* For poll (PMTUD rounds) */
+#include <time.h>       /* For clock_gettime, time (PMTUD rounds, cache) */
+#include <signal.h>     /* For signal, SIGINT, SIGTERM (stop the datapath) */
+#include "hdr_hist.h"   /* For struct hdr_hist (RTT percentiles) */
+#include "inet_csum.h"  /* For csum_pseudo_v6, csum_partial */
+#include "pmtu.h"       /* For struct pmtu_search, struct pmtu_cache (-P) */
+#include "ipv6_dp.h"    /* For struct ipv6_dp (-R) */
 
 /* Buffer size for IPv6 packets */
 #define BUFFER_SIZE 1024
@@ -22,55 +39,463 @@
 #define DEFAULT_COUNT 4
 /* ICMPv6 payload size (includes timestamp) */
 #define PAYLOAD_SIZE 56
+/* Wait for a reply before counting the ping lost (seconds) */
+#define REPLY_TIMEOUT 1
+/* Bytes of an IPv6 header, which PMTUD probe sizes include */
+#define IPV6_HDR_LEN 40
 
-/* Compute checksum for ICMPv6 packet (includes pseudo-header) */
-unsigned short checksum(void *b, int len, struct in6_addr *src, struct in6_addr *dst) {
-    unsigned short *buf = b;
-    unsigned int sum = 0;
-    unsigned short result;
+/* One destination of a path MTU search (-P) */
+struct pmtu_target {
+    struct sockaddr_in6 addr;        /* Destination */
+    char name[INET6_ADDRSTRLEN];     /* Printable address */
+    struct pmtu_search search;       /* Search state */
+    struct in6_addr from;            /* Router that sent the lowest Packet Too Big */
+    uint16_t size;                   /* Size of the probe in flight (0 = none) */
+    uint16_t seq;                    /* Its sequence number */
+};
 
-    /* Pseudo-header for ICMPv6 checksum */
-    unsigned char pseudo[40];
-    memset(pseudo, 0, sizeof(pseudo));
-    memcpy(pseudo, src, 16);           /* Source IPv6 address */
-    memcpy(pseudo + 16, dst, 16);      /* Destination IPv6 address */
-    pseudo[32] = 0; pseudo[33] = 0; pseudo[34] = 0; pseudo[35] = len >> 8;
-    pseudo[36] = len & 0xFF;           /* Length */
-    pseudo[39] = IPPROTO_ICMPV6;       /* Next header (ICMPv6) */
+/* Function to read the monotonic clock in milliseconds */
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
-    /* Sum pseudo-header */
-    for (int i = 0; i < 40; i += 2) {
-        sum += (pseudo[i] << 8) + pseudo[i + 1];
+/* Function to send target ti its next PMTUD probe: an Echo Request whose payload
+ * starts with ti, so a reply or a quoted probe leads straight back to it. Returns
+ * 1 if a probe is in flight, 0 once the target's search is over. */
+static int pmtu_send(int sockfd, struct pmtu_target *targets, uint32_t ti, unsigned char *packet,
+                     const struct in6_addr *src, uint16_t id, uint16_t *seq) {
+    struct pmtu_target *t = &targets[ti];
+    for (;;) {
+        uint16_t size = pmtu_search_next(&t->search);
+        if (size == 0) {
+            return 0;
+        }
+        size_t icmp_len = size - IPV6_HDR_LEN;
+        struct icmp6_hdr *icmp_hdr = (struct icmp6_hdr *)packet;
+        icmp_hdr->icmp6_type = ICMP6_ECHO_REQUEST;
+        icmp_hdr->icmp6_code = 0;
+        icmp_hdr->icmp6_id = htons(id);
+        icmp_hdr->icmp6_seq = htons(++*seq);
+        icmp_hdr->icmp6_cksum = 0;
+        memcpy(packet + sizeof(*icmp_hdr), &ti, sizeof(ti));
+        uint32_t sum = csum_pseudo_v6(src, &t->addr.sin6_addr, IPPROTO_ICMPV6, icmp_len);
+        icmp_hdr->icmp6_cksum = csum_fold(csum_partial(packet, icmp_len, sum));
+        if (sendto(sockfd, packet, icmp_len, 0, (struct sockaddr *)&t->addr,
+                   sizeof(t->addr)) < 0) {
+            if (errno == EMSGSIZE) {
+                /* Larger than our own interface's MTU */
+                pmtu_search_result(&t->search, size, PMTU_LOCAL, 0);
+                continue;
+            }
+            fprintf(stderr, "Send to %s failed: %s\n", t->name, strerror(errno));
+            pmtu_search_result(&t->search, size, PMTU_UNREACH, 0);
+            return 0;
+        }
+        t->size = size;
+        t->seq = *seq;
+        return 1;
     }
+}
 
-    /* Sum packet */
-    for (; len > 1; len -= 2) {
-        sum += *buf++;
+/* Function to match one ICMPv6 message to the probe in flight it answers, and
+ * feed the outcome to that target's search. Returns 1 if it matched. */
+static int pmtu_receive(struct pmtu_target *targets, uint32_t num_targets, uint16_t id,
+                        const unsigned char *msg, ssize_t len, const struct sockaddr_in6 *from) {
+    const struct icmp6_hdr *icmp_hdr = (const struct icmp6_hdr *)msg;
+    const struct icmp6_hdr *probe = icmp_hdr;
+    const struct in6_addr *dst = &from->sin6_addr;
+    int outcome = PMTU_FITS;
+    uint16_t reported = 0;
+    if (len < (ssize_t)(sizeof(*icmp_hdr) + sizeof(uint32_t))) {
+        return 0;
+    }
+    if (icmp_hdr->icmp6_type != ICMP6_ECHO_REPLY) {
+        /* An error quotes as much of the probe as fits: its IPv6 header (for the
+         * destination) and the Echo Request with the start of its payload */
+        if (icmp_hdr->icmp6_type != ICMP6_PACKET_TOO_BIG &&
+            icmp_hdr->icmp6_type != ICMP6_DST_UNREACH) {
+            return 0;
+        }
+        size_t quoted = sizeof(*icmp_hdr) + IPV6_HDR_LEN + sizeof(*icmp_hdr) + sizeof(uint32_t);
+        if (len < (ssize_t)quoted || msg[sizeof(*icmp_hdr) + 6] != IPPROTO_ICMPV6) {
+            return 0;
+        }
+        dst = (const struct in6_addr *)(msg + sizeof(*icmp_hdr) + 24);
+        probe = (const struct icmp6_hdr *)(msg + sizeof(*icmp_hdr) + IPV6_HDR_LEN);
+        if (probe->icmp6_type != ICMP6_ECHO_REQUEST) {
+            return 0;
+        }
+        if (icmp_hdr->icmp6_type == ICMP6_PACKET_TOO_BIG) {
+            uint32_t mtu = ntohl(icmp_hdr->icmp6_mtu);
+            outcome = PMTU_TOO_BIG;
+            reported = mtu > 65535 ? 65535 : mtu;
+        } else {
+            outcome = PMTU_UNREACH;
+        }
+    }
+    uint32_t ti;
+    memcpy(&ti, probe + 1, sizeof(ti));
+    if (ntohs(probe->icmp6_id) != id || ti >= num_targets) {
+        return 0;
+    }
+    struct pmtu_target *t = &targets[ti];
+    if (!t->size || ntohs(probe->icmp6_seq) != t->seq ||
+        memcmp(dst, &t->addr.sin6_addr, sizeof(*dst)) != 0) {
+        return 0; /* Late, or not ours */
     }
-    if (len == 1) {
-        sum += *(unsigned char*)buf;
+    if (outcome == PMTU_TOO_BIG && (!t->search.reported || reported < t->search.reported)) {
+        t->from = from->sin6_addr;
     }
+    pmtu_search_result(&t->search, t->size, outcome, reported);
+    t->size = 0;
+    return 1;
+}
 
-    /* Fold 32-bit sum to 16 bits */
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
-    result = ~sum;
-    return result;
+/* Function to discover the path MTU to every target in lockstep rounds: send each
+ * unfinished target its next probe, then wait up to REPLY_TIMEOUT for the answers.
+ * Returns the number of targets whose path MTU was found. */
+static uint32_t run_pmtud(int sockfd, struct pmtu_target *targets, uint32_t num_targets,
+                          uint16_t max_size, const struct in6_addr *src, const char *cache_path) {
+    unsigned char *packet = calloc(1, max_size);
+    if (!packet) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+    for (size_t i = sizeof(struct icmp6_hdr) + sizeof(uint32_t); i < max_size; i++) {
+        packet[i] = 'A'; /* Fill with 'A' */
+    }
+    uint16_t id = getpid() & 0xFFFF;
+    uint16_t seq = 0;
+    unsigned rounds = 0;
+    int64_t start = now_ms();
+    printf("Path MTU discovery for %u target%s, %u to %u bytes\n", num_targets,
+           num_targets == 1 ? "" : "s", PMTU_FLOOR_V6, max_size);
+    for (;;) {
+        uint32_t in_flight = 0;
+        for (uint32_t i = 0; i < num_targets; i++) {
+            in_flight += pmtu_send(sockfd, targets, i, packet, src, id, &seq);
+        }
+        if (in_flight == 0) {
+            break;
+        }
+        rounds++;
+        int64_t deadline = now_ms() + REPLY_TIMEOUT * 1000;
+        while (in_flight > 0) {
+            int64_t wait = deadline - now_ms();
+            struct pollfd pfd = { sockfd, POLLIN, 0 };
+            if (wait <= 0 || poll(&pfd, 1, (int)wait) <= 0) {
+                break;
+            }
+            unsigned char msg[BUFFER_SIZE];
+            struct sockaddr_in6 from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len;
+            while ((len = recvfrom(sockfd, msg, sizeof(msg), MSG_DONTWAIT,
+                                   (struct sockaddr *)&from, &from_len)) >= 0) {
+                in_flight -= pmtu_receive(targets, num_targets, id, msg, len, &from);
+                from_len = sizeof(from);
+            }
+        }
+        for (uint32_t i = 0; i < num_targets; i++) {
+            if (targets[i].size) {
+                pmtu_search_result(&targets[i].search, targets[i].size, PMTU_LOST, 0);
+                targets[i].size = 0;
+            }
+        }
+    }
+    free(packet);
+
+    /* Results, and the cache the transport tools read */
+    struct pmtu_cache cache;
+    pmtu_cache_init(&cache);
+    int cache_ok = pmtu_cache_load(&cache, cache_path) >= 0;
+    time_t now = time(NULL);
+    uint32_t measured = 0, black_holes = 0;
+    for (uint32_t i = 0; i < num_targets; i++) {
+        const struct pmtu_target *t = &targets[i];
+        uint16_t mtu = pmtu_search_mtu(&t->search);
+        printf("%s : ", t->name);
+        if (mtu == 0) {
+            printf("unreachable");
+        } else {
+            printf("path MTU %u", mtu);
+            if (mtu == max_size) {
+                printf(" (largest size tried)");
+            }
+            if (t->search.flags & PMTU_F_PTB) {
+                char from[INET6_ADDRSTRLEN];
+                inet_ntop(AF_INET6, &t->from, from, sizeof(from));
+                printf(", Packet Too Big from %s", from);
+            }
+            if (t->search.flags & PMTU_F_BLACKHOLE) {
+                printf(", BLACK HOLE: larger packets vanish without Packet Too Big");
+                black_holes++;
+            }
+            measured++;
+            cache_ok = cache_ok &&
+                       pmtu_cache_set(&cache, AF_INET6, &t->addr.sin6_addr, mtu, t->search.flags,
+                                      now) == 0;
+        }
+        printf(" (%u probe%s)\n", t->search.probes, t->search.probes == 1 ? "" : "s");
+    }
+    printf("\n%u target%s in %lld ms (%u rounds): %u measured, %u black hole%s, %u unreachable\n",
+           num_targets, num_targets == 1 ? "" : "s", (long long)(now_ms() - start), rounds,
+           measured, black_holes, black_holes == 1 ? "" : "s", num_targets - measured);
+    if (measured > 0) {
+        if (!cache_ok || pmtu_cache_save(&cache, cache_path, now) < 0) {
+            fprintf(stderr, "Failed to write path MTU cache %s\n", cache_path);
+        } else {
+            printf("%u path MTU%s cached in %s\n", measured, measured == 1 ? "" : "s", cache_path);
+        }
+    }
+    pmtu_cache_free(&cache);
+    return measured;
 }
 
 /* Main function: Entry point of the IPv6 stack */
+/* Set by SIGINT / SIGTERM to stop the datapath (-R) */
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Function to handle SIGINT / SIGTERM */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* Function to find the source address the kernel would use to reach target out
+ * of interface if_name, by connecting a UDP socket (nothing is sent). Returns 0,
+ * or -1 if there is no route or no usable address. */
+static int select_source(const char *if_name, const struct sockaddr_in6 *target,
+                         struct in6_addr *src) {
+    int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    struct sockaddr_in6 dst = *target;
+    dst.sin6_port = htons(9); /* Any port; connect only selects a route */
+    struct sockaddr_in6 local;
+    socklen_t local_len = sizeof(local);
+    if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, if_name, strlen(if_name) + 1) < 0 ||
+        connect(fd, (struct sockaddr *)&dst, sizeof(dst)) < 0 ||
+        getsockname(fd, (struct sockaddr *)&local, &local_len) < 0) {
+        perror("No source address for the target");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    *src = local.sin6_addr;
+    return 0;
+}
+
+/* Function to parse a route "prefix/len=device[,gateway]" and add it to the
+ * datapath. Returns 0, or -1 if it is malformed or names an unknown device. */
+static int add_route_arg(struct ipv6_dp *dp, const char *arg) {
+    char buf[2 * INET6_ADDRSTRLEN + IFNAMSIZ + 8];
+    if (strlen(arg) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, arg);
+    char *eq = strchr(buf, '=');
+    char *slash = strchr(buf, '/');
+    if (!eq || !slash || slash > eq) {
+        return -1;
+    }
+    *eq = '\0';
+    *slash = '\0';
+    struct in6_addr gateway;
+    char *comma = strchr(eq + 1, ',');
+    if (comma) {
+        *comma = '\0';
+        if (inet_pton(AF_INET6, comma + 1, &gateway) <= 0) {
+            return -1;
+        }
+    }
+    char *end;
+    long plen = strtol(slash + 1, &end, 10);
+    struct in6_addr prefix;
+    if (*end != '\0' || end == slash + 1 || plen < 0 || plen > 128 ||
+        inet_pton(AF_INET6, buf, &prefix) <= 0) {
+        return -1;
+    }
+    for (int d = 0; d < dp->num_devs; d++) {
+        if (strcmp(dp->devs[d].name, eq + 1) == 0) {
+            return ipv6_dp_add_route(dp, &prefix, (uint8_t)plen, d, comma ? &gateway : NULL);
+        }
+    }
+    return -1;
+}
+
+/* Function to run the TUN datapath (-R) until interrupted, or for duration seconds
+ * if non-zero, printing the packet rates every second; each worker may hold
+ * frag_mem bytes of fragments, and advertise turns on Router Advertisements.
+ * Returns 0, or -1 on a setup error. */
+static int run_router(char **devs, int num_devs, char **locals, int num_locals, char **routes,
+                      int num_routes, int workers, int duration, size_t frag_mem,
+                      int advertise) {
+    struct ipv6_dp dp;
+    if (ipv6_dp_init(&dp, workers, frag_mem) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    dp.advertise = advertise;
+    for (int i = 0; i < num_devs; i++) {
+        if (ipv6_dp_add_dev(&dp, devs[i]) < 0) {
+            ipv6_dp_destroy(&dp);
+            return -1;
+        }
+    }
+    for (int i = 0; i < num_locals; i++) {
+        struct in6_addr addr;
+        if (inet_pton(AF_INET6, locals[i], &addr) <= 0 || ipv6_dp_add_local(&dp, &addr) < 0) {
+            fprintf(stderr, "Invalid or one too many local addresses: %s\n", locals[i]);
+            ipv6_dp_destroy(&dp);
+            return -1;
+        }
+    }
+    for (int i = 0; i < num_routes; i++) {
+        if (add_route_arg(&dp, routes[i]) < 0) {
+            fprintf(stderr, "Invalid route (want prefix/len=device): %s\n", routes[i]);
+            ipv6_dp_destroy(&dp);
+            return -1;
+        }
+    }
+
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    if (ipv6_dp_start(&dp) < 0) {
+        ipv6_dp_destroy(&dp);
+        return -1;
+    }
+    printf("IPv6 datapath: %d devices, %d workers, %lu routes, %d local addresses\n",
+           dp.num_devs, dp.num_workers, dp.routes.fib.count, dp.num_local);
+    fflush(stdout);
+
+    int64_t start = now_ms();
+    int64_t last = start;
+    struct dp_stats prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    while (!stop_requested && (duration == 0 || now_ms() - start < duration * 1000LL)) {
+        usleep(100000);
+        int64_t now = now_ms();
+        if (now - last < 1000) {
+            continue;
+        }
+        ipv6_dp_refresh(&dp); /* Pick up MTU changes */
+        ipv6_dp_totals(&dp, &cur);
+        double secs = (now - last) / 1000.0;
+        printf("%7.1f s: %10.0f pps in, %10.0f pps forwarded, %8.0f pps local\n",
+               (now - start) / 1000.0, (cur.rx - prev.rx) / secs,
+               (cur.forwarded - prev.forwarded) / secs, (cur.local - prev.local) / secs);
+        fflush(stdout);
+        prev = cur;
+        last = now;
+    }
+    ipv6_dp_stop(&dp);
+
+    printf("\n");
+    ipv6_dp_print_stats(&dp, stdout, (now_ms() - start) / 1000.0);
+    ipv6_dp_destroy(&dp);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     /* Check command-line arguments */
-    if (argc < 3 || argc > 4) {
+    int pmtud = 0;
+    int max_size = PMTU_DEFAULT_MAX;
+    const char *cache_path = PMTU_CACHE_PATH;
+    int router = 0;
+    int workers = 1;
+    int duration = 0;
+    int advertise = 0;
+    long frag_kb = FRAG_DEFAULT_MEM / 1024;
+    char **locals = calloc(argc, sizeof(*locals));
+    char **routes = calloc(argc, sizeof(*routes));
+    int num_locals = 0, num_routes = 0;
+    if (!locals || !routes) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int opt;
+    while ((opt = getopt(argc, argv, "PS:o:Rw:d:a:r:f:A")) != -1) {
+        switch (opt) {
+        case 'P':
+            pmtud = 1;
+            break;
+        case 'S':
+            max_size = atoi(optarg);
+            break;
+        case 'o':
+            cache_path = optarg;
+            break;
+        case 'R':
+            router = 1;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'a':
+            locals[num_locals++] = optarg;
+            break;
+        case 'r':
+            routes[num_routes++] = optarg;
+            break;
+        case 'f':
+            frag_kb = atol(optarg);
+            break;
+        case 'A':
+            advertise = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    int npos = argc - optind;
+    if (npos < (router ? 1 : 2) || (!pmtud && !router && npos > 3) || (pmtud && router) ||
+        max_size < PMTU_FLOOR_V6 || max_size > 65535 || workers < 1 ||
+        workers > DP_MAX_WORKERS || duration < 0 || frag_kb < 64 || frag_kb > (1L << 20)) {
+usage:
         fprintf(stderr, "Usage: %s <interface> <target_ipv6> [count]\n", argv[0]);
+        fprintf(stderr, "       %s -P [-S max_size] [-o cache_file] <interface> <target_ipv6>...\n",
+                argv[0]);
+        fprintf(stderr, "       %s -R [-A] [-w workers] [-d seconds] [-f kb] [-a address]... "
+                "[-r prefix/len=tun[,gateway]]... <tun>...\n", argv[0]);
+        fprintf(stderr, "  -P  path MTU discovery to every target at once; results are added\n"
+                        "      to the cache file (default %s)\n"
+                        "  -S  largest packet size tried (default %d)\n"
+                        "  -R  route between TUN devices (created if missing), one queue per\n"
+                        "      worker (default 1, at most %d); -a adds an address to answer\n"
+                        "      for, -r a route (on-link unless a gateway is given), -d stops\n"
+                        "      after that many seconds; -A sends Router Advertisements\n"
+                        "  -f  fragment reassembly memory per worker in KiB (default %u)\n",
+                PMTU_CACHE_PATH, PMTU_DEFAULT_MAX, DP_MAX_WORKERS, FRAG_DEFAULT_MEM / 1024);
         fprintf(stderr, "Example: %s eth0 2001:4860:4860::8888 4\n", argv[0]);
+        fprintf(stderr, "         %s -P eth0 2001:db8::1 2001:db8::2\n", argv[0]);
+        fprintf(stderr, "         %s -R -A -w 4 -a 2001:db8:1::1 -r 2001:db8:1::/64=tun0 "
+                "-r ::/0=tun1,2001:db8:2::1 tun0 tun1\n", argv[0]);
         exit(1);
     }
 
+    /* The datapath takes over from here */
+    if (router) {
+        int rc = run_router(argv + optind, npos, locals, num_locals, routes, num_routes, workers,
+                            duration, (size_t)frag_kb * 1024, advertise);
+        free(locals);
+        free(routes);
+        return rc < 0 ? 1 : 0;
+    }
+    free(locals);
+    free(routes);
+
     /* Pointers to arguments */
-    char *if_name = argv[1];     /* Interface (e.g., eth0) */
-    char *target_ip = argv[2];   /* Target IPv6 (e.g., 2001:4860:4860::8888) */
-    int count = (argc == 4) ? atoi(argv[3]) : DEFAULT_COUNT; /* Number of pings */
+    char *if_name = argv[optind];        /* Interface (e.g., eth0) */
+    char *target_ip = argv[optind + 1];  /* Target IPv6 (e.g., 2001:4860:4860::8888) */
+    int count = (!pmtud && npos == 3) ? atoi(argv[optind + 2]) : DEFAULT_COUNT; /* Pings */
 
     /* Get interface index */
     int if_index = if_nametoindex(if_name);
@@ -93,6 +518,10 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    /* Give up on a reply after REPLY_TIMEOUT so losses are counted, not waited on */
+    struct timeval timeout = { REPLY_TIMEOUT, 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
     /* Set up target address */
     struct sockaddr_in6 target_addr;
     memset(&target_addr, 0, sizeof(target_addr));
@@ -104,9 +533,55 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /* Get source IPv6 address (hardcoded for simplicity; ideally use getifaddrs) */
+    /* Source address: the one the kernel would pick for the target (RFC 6724) */
     struct in6_addr src_addr;
-    inet_pton(AF_INET6, "::1", &src_addr); /* Use loopback or configure dynamically */
+    if (select_source(if_name, &target_addr, &src_addr) < 0) {
+        close(sockfd);
+        exit(1);
+    }
+
+    /* Path MTU discovery replaces the pings */
+    if (pmtud) {
+        uint32_t num_targets = npos - 1;
+        struct pmtu_target *targets = calloc(num_targets, sizeof(*targets));
+        if (!targets) {
+            fprintf(stderr, "Out of memory\n");
+            close(sockfd);
+            exit(1);
+        }
+        for (uint32_t i = 0; i < num_targets; i++) {
+            struct pmtu_target *t = &targets[i];
+            t->addr = target_addr;
+            if (inet_pton(AF_INET6, argv[optind + 1 + i], &t->addr.sin6_addr) <= 0) {
+                fprintf(stderr, "Invalid target IPv6: %s\n", argv[optind + 1 + i]);
+                close(sockfd);
+                exit(1);
+            }
+            inet_ntop(AF_INET6, &t->addr.sin6_addr, t->name, sizeof(t->name));
+            pmtu_search_init(&t->search, PMTU_FLOOR_V6, max_size);
+        }
+
+        /* Probes of exactly the size asked for (never fragmented by us), and only
+         * Echo Replies and the errors probes cause */
+        int pmtudisc = IPV6_PMTUDISC_PROBE;
+        if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) < 0) {
+            perror("IPV6_MTU_DISCOVER failed");
+            close(sockfd);
+            exit(1);
+        }
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+        ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+        setsockopt(sockfd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+
+        uint32_t measured = run_pmtud(sockfd, targets, num_targets, max_size, &src_addr,
+                                      cache_path);
+        free(targets);
+        close(sockfd);
+        return measured > 0 ? 0 : 1;
+    }
 
     /* Packet buffer */
     unsigned char packet[BUFFER_SIZE];
@@ -116,6 +591,14 @@ int main(int argc, char *argv[]) {
     /* Statistics */
     int sent = 0, received = 0;
     double min_rtt = 1e6, max_rtt = 0, sum_rtt = 0;
+    double last_rtt = 0, jitter = 0;            /* RFC 3550 style RTT variation (ms) */
+    int loss_run = 0, loss_bursts = 0, max_loss_burst = 0;
+    struct hdr_hist rtt_hist;                   /* RTTs in microseconds */
+    if (hdr_hist_init(&rtt_hist, REPLY_TIMEOUT * 1000000ULL, 5) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        close(sockfd);
+        exit(1);
+    }
 
     printf("PING6 %s (%s): %d data bytes\n", target_ip, target_ip, PAYLOAD_SIZE);
 
@@ -139,8 +622,9 @@ int main(int argc, char *argv[]) {
         }
 
         /* Compute checksum */
-        icmp_hdr->icmp6_cksum = checksum(packet, sizeof(struct icmp6_hdr) + PAYLOAD_SIZE,
-                                         &src_addr, &target_addr.sin6_addr);
+        size_t icmp_len = sizeof(struct icmp6_hdr) + PAYLOAD_SIZE;
+        uint32_t sum = csum_pseudo_v6(&src_addr, &target_addr.sin6_addr, IPPROTO_ICMPV6, icmp_len);
+        icmp_hdr->icmp6_cksum = csum_fold(csum_partial(packet, icmp_len, sum));
 
         /* Send packet */
         if (sendto(sockfd, packet, sizeof(struct icmp6_hdr) + PAYLOAD_SIZE, 0,
@@ -157,29 +641,49 @@ int main(int argc, char *argv[]) {
         struct timeval start, end;
         gettimeofday(&start, NULL);
 
-        ssize_t len = recvfrom(sockfd, reply, sizeof(reply), 0,
-                               (struct sockaddr*)&from_addr, &from_len);
+        /* Read until our reply, skipping other ICMPv6 traffic (on loopback our own
+         * Echo Request arrives first) */
+        struct icmp6_hdr *reply_icmp = (struct icmp6_hdr *)reply;
+        ssize_t len;
+        for (;;) {
+            len = recvfrom(sockfd, reply, sizeof(reply), 0,
+                           (struct sockaddr*)&from_addr, &from_len);
+            if (len < 0 || (len >= (ssize_t)sizeof(struct icmp6_hdr) &&
+                            reply_icmp->icmp6_type == ICMP6_ECHO_REPLY &&
+                            ntohs(reply_icmp->icmp6_id) == (getpid() & 0xFFFF) &&
+                            ntohs(reply_icmp->icmp6_seq) == seq)) {
+                break;
+            }
+            from_len = sizeof(from_addr);
+        }
         gettimeofday(&end, NULL);
 
         if (len < 0) {
-            perror("Receive failed");
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                printf("Request timeout for icmp_seq %d\n", seq);
+            } else {
+                perror("Receive failed");
+            }
+            if (loss_run++ == 0) {
+                loss_bursts++;
+            }
+            max_loss_burst = (loss_run > max_loss_burst) ? loss_run : max_loss_burst;
             continue;
         }
 
-        /* Validate ICMPv6 reply */
-        struct icmp6_hdr *reply_icmp = (struct icmp6_hdr *)reply;
-        if (len < sizeof(struct icmp6_hdr) || reply_icmp->icmp6_type != ICMP6_ECHO_REPLY ||
-            ntohs(reply_icmp->icmp6_id) != getpid() ||
-            ntohs(reply_icmp->icmp6_seq) != seq) {
-            continue; /* Not our reply */
-        }
-
         /* Calculate RTT */
         double rtt = (end.tv_sec - start.tv_sec) * 1000.0 +
                      (end.tv_usec - start.tv_usec) / 1000.0;
         min_rtt = (rtt < min_rtt) ? rtt : min_rtt;
         max_rtt = (rtt > max_rtt) ? rtt : max_rtt;
         sum_rtt += rtt;
+        if (received > 0) {
+            double d = rtt > last_rtt ? rtt - last_rtt : last_rtt - rtt;
+            jitter += (d - jitter) / 16;
+        }
+        last_rtt = rtt;
+        loss_run = 0;
+        hdr_hist_record(&rtt_hist, (uint64_t)(rtt * 1000 + 0.5));
         char from_ip[INET6_ADDRSTRLEN];
         inet_ntop(AF_INET6, &from_addr.sin6_addr, from_ip, sizeof(from_ip));
         printf("%ld bytes from %s: icmp_seq=%d time=%.2f ms\n",
@@ -203,8 +707,17 @@ int main(int argc, char *argv[]) {
         if (received > 0) {
             printf("round-trip min/avg/max = %.2f/%.2f/%.2f ms\n",
                    min_rtt, avg_rtt, max_rtt);
+            printf("round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms, jitter %.3f ms\n",
+                   hdr_hist_percentile(&rtt_hist, 50) / 1e3,
+                   hdr_hist_percentile(&rtt_hist, 90) / 1e3,
+                   hdr_hist_percentile(&rtt_hist, 99) / 1e3,
+                   hdr_hist_percentile(&rtt_hist, 99.9) / 1e3, jitter);
+        }
+        if (loss_bursts > 0) {
+            printf("%d loss bursts, longest %d pings\n", loss_bursts, max_loss_burst);
         }
     }
+    hdr_hist_free(&rtt_hist);
 
     return 0;
 }
\ No newline at end of file
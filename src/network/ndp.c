@@ -0,0 +1,477 @@
+/* ndp.c: Neighbor cache and default router list (see include/ndp.h). Readers
+ * (ndp_resolve, ndp_default_router) walk the hash chains inside an epoch critical
+ * section and never block; every other function holds the cache lock, so there is
+ * only ever one writer for the epoch domain. An entry's address and device never
+ * change once it is published, which is what lets readers use it without a lock;
+ * its state and timestamps are atomics. Links without link-layer addresses (TUN)
+ * have nothing to record in an entry but reachability, so the "link-layer address
+ * changed" cases of RFC 4861 never arise. */
+
+/* Include standard libraries for memory, randomness and atomics */
+#include <stdlib.h>        /* For calloc, malloc, free */
+#include <string.h>        /* For memcpy, memcmp, memset */
+#include <time.h>          /* For time (fallback hash key) */
+#include <sys/random.h>    /* For getrandom */
+#include "ndp.h"           /* For struct ndp_cache, struct ndp_entry */
+
+/* Function to hash a neighbor's device and address with the cache's secret */
+static uint32_t ndp_hash(const struct ndp_cache *c, int dev, const struct in6_addr *addr) {
+    uint64_t w[2];
+    memcpy(w, addr, sizeof(w));
+    uint64_t h = (w[0] ^ c->seed) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ w[1] ^ (uint64_t)dev) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+    return (uint32_t)h & (NDP_BUCKETS - 1);
+}
+
+/* Function to find a neighbor (under the lock, or inside an epoch section) */
+static struct ndp_entry *ndp_find(struct ndp_cache *c, int dev, const struct in6_addr *addr) {
+    struct ndp_entry *e = atomic_load_explicit(&c->buckets[ndp_hash(c, dev, addr)],
+                                               memory_order_acquire);
+    while (e && (e->dev != dev || memcmp(&e->addr, addr, sizeof(*addr)) != 0)) {
+        e = atomic_load_explicit(&e->next, memory_order_acquire);
+    }
+    return e;
+}
+
+/* Function to prepare an empty cache */
+int ndp_init(struct ndp_cache *c, unsigned long max_entries, const struct ndp_ops *ops) {
+    memset(c, 0, sizeof(*c));
+    c->buckets = calloc(NDP_BUCKETS, sizeof(*c->buckets));
+    if (!c->buckets) {
+        return -1;
+    }
+    epoch_init(&c->epoch);
+    pthread_mutex_init(&c->lock, NULL);
+    c->ops = ops;
+    c->max_entries = max_entries;
+    if (getrandom(&c->seed, sizeof(c->seed), 0) != sizeof(c->seed)) {
+        c->seed = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL ^ (uintptr_t)c;
+    }
+
+    /* ReachableTime is BaseReachableTime scaled by a random 0.5-1.5 (RFC 4861 6.3.2)
+     * so neighbors that start together do not all probe together */
+    c->reachable_ms = NDP_REACHABLE_MS / 2 + c->seed % NDP_REACHABLE_MS;
+    return 0;
+}
+
+/* Function to free a packet queue without sending it */
+static void ndp_queue_free(struct ndp_cache *c, struct ndp_entry *e) {
+    while (e->queue) {
+        struct ndp_pending *p = e->queue;
+        e->queue = p->next;
+        free(p);
+        c->queued--;
+    }
+    e->queue_tail = NULL;
+    e->queue_len = 0;
+}
+
+/* Function called once no reader can still hold a removed entry */
+static void ndp_entry_release(void *ptr, void *arg) {
+    (void)arg;
+    free(ptr);
+}
+
+/* Function to free everything */
+void ndp_destroy(struct ndp_cache *c) {
+    if (!c->buckets) {
+        return;
+    }
+    for (uint32_t b = 0; b < NDP_BUCKETS; b++) {
+        struct ndp_entry *e = atomic_load(&c->buckets[b]);
+        while (e) {
+            struct ndp_entry *next = atomic_load(&e->next);
+            ndp_queue_free(c, e);
+            free(e);
+            e = next;
+        }
+    }
+    epoch_destroy(&c->epoch);
+    pthread_mutex_destroy(&c->lock);
+    free(c->buckets);
+    c->buckets = NULL;
+}
+
+/* Function to claim a reader slot */
+int ndp_register(struct ndp_cache *c) {
+    return epoch_register(&c->epoch);
+}
+
+/* Function to tell, without a lock, whether a neighbor can take packets now */
+int ndp_resolve(struct ndp_cache *c, int slot, int dev, const struct in6_addr *addr,
+                uint64_t now_ms) {
+    int usable = 0;
+    epoch_enter(&c->epoch, slot);
+    struct ndp_entry *e = ndp_find(c, dev, addr);
+    if (e) {
+        uint8_t state = atomic_load_explicit(&e->state, memory_order_relaxed);
+        if (state != NDP_INCOMPLETE) {
+            usable = 1;
+            /* Refresh the use stamp about once a second, not on every packet */
+            if (atomic_load_explicit(&e->used_ms, memory_order_relaxed) + 1000 <= now_ms) {
+                atomic_store_explicit(&e->used_ms, now_ms, memory_order_relaxed);
+            }
+            if (state == NDP_STALE) {
+                /* The DELAY timer has its own field: writing deadline_ms here could
+                 * overwrite the deadline of a REACHABLE set under the lock meanwhile.
+                 * It is armed before the swap, so DELAY is never seen without it. */
+                uint8_t expected = NDP_STALE;
+                atomic_store_explicit(&e->delay_ms, now_ms + NDP_DELAY_MS, memory_order_relaxed);
+                atomic_compare_exchange_strong(&e->state, &expected, NDP_DELAY);
+            }
+        }
+    }
+    epoch_exit(&c->epoch, slot);
+    return usable;
+}
+
+/* Function to add a neighbor in the given state (locked). Returns it, or NULL if
+ * the cache is full. */
+static struct ndp_entry *ndp_add(struct ndp_cache *c, int dev, const struct in6_addr *addr,
+                                 uint8_t state, uint64_t now_ms) {
+    if (c->count >= c->max_entries) {
+        return NULL;
+    }
+    struct ndp_entry *e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+    e->addr = *addr;
+    e->dev = dev;
+    atomic_init(&e->state, state);
+    atomic_init(&e->used_ms, now_ms);
+
+    /* Fully built before it becomes reachable through the bucket */
+    struct ndp_entry *_Atomic *bucket = &c->buckets[ndp_hash(c, dev, addr)];
+    atomic_store_explicit(&e->next, atomic_load_explicit(bucket, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(bucket, e, memory_order_release);
+    c->count++;
+    c->stats.created++;
+    return e;
+}
+
+/* Function to unlink a neighbor (locked) and free it after the grace period */
+static void ndp_remove(struct ndp_cache *c, struct ndp_entry *_Atomic *link,
+                       struct ndp_entry *e) {
+    atomic_store_explicit(link, atomic_load_explicit(&e->next, memory_order_relaxed),
+                          memory_order_release);
+    ndp_queue_free(c, e);
+    c->count--;
+    if (epoch_retire(&c->epoch, e, ndp_entry_release, NULL) < 0) {
+        epoch_synchronize(&c->epoch);
+        free(e);
+    }
+}
+
+/* Function to send every packet waiting on a neighbor that answered (locked) */
+static void ndp_flush(struct ndp_cache *c, struct ndp_entry *e, void *ctx) {
+    while (e->queue) {
+        struct ndp_pending *p = e->queue;
+        e->queue = p->next;
+        c->ops->transmit(ctx, e->dev, p->data, p->len);
+        free(p);
+        c->queued--;
+    }
+    e->queue_tail = NULL;
+    e->queue_len = 0;
+}
+
+/* Function to hold a packet for a neighbor being resolved */
+int ndp_enqueue(struct ndp_cache *c, int dev, const struct in6_addr *addr, int in_dev,
+                const unsigned char *pkt, size_t len, uint64_t now_ms, void *ctx) {
+    pthread_mutex_lock(&c->lock);
+    struct ndp_entry *e = ndp_find(c, dev, addr);
+    if (e && atomic_load(&e->state) != NDP_INCOMPLETE) {
+        pthread_mutex_unlock(&c->lock);
+        return 1; /* Answered between the lookup and the lock */
+    }
+    if (!e) {
+        e = ndp_add(c, dev, addr, NDP_INCOMPLETE, now_ms);
+        if (!e) {
+            c->stats.table_full++;
+            pthread_mutex_unlock(&c->lock);
+            return 0;
+        }
+        e->probes = 1;
+        atomic_store(&e->deadline_ms, now_ms + NDP_RETRANS_MS);
+        c->ops->solicit(ctx, dev, addr, 0);
+        c->stats.solicits++;
+    }
+
+    /* A full queue gives up its oldest packet (RFC 4861 7.2.2) */
+    if ((e->queue_len >= NDP_QUEUE_LEN || c->queued >= NDP_MAX_QUEUED) && e->queue) {
+        struct ndp_pending *old = e->queue;
+        e->queue = old->next;
+        if (!e->queue) {
+            e->queue_tail = NULL;
+        }
+        e->queue_len--;
+        c->queued--;
+        free(old);
+        c->stats.queue_drops++;
+    }
+    struct ndp_pending *p = NULL;
+    if (c->queued < NDP_MAX_QUEUED) {
+        p = malloc(sizeof(*p) + len);
+    }
+    if (!p) {
+        c->stats.queue_drops++;
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    p->next = NULL;
+    p->in_dev = in_dev;
+    p->len = len;
+    memcpy(p->data, pkt, len);
+    if (e->queue_tail) {
+        e->queue_tail->next = p;
+    } else {
+        e->queue = p;
+    }
+    e->queue_tail = p;
+    e->queue_len++;
+    c->queued++;
+    c->stats.queued++;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+/* Function to drop a router from the default router list (locked) */
+static void ndp_router_forget(struct ndp_cache *c, int dev, const struct in6_addr *addr) {
+    for (int i = 0; i < NDP_MAX_ROUTERS; i++) {
+        struct ndp_router *r = &c->routers[i];
+        if (atomic_load(&r->expires_ms) && r->dev == dev &&
+            memcmp(&r->addr, addr, sizeof(*addr)) == 0) {
+            atomic_store(&r->expires_ms, 0);
+        }
+    }
+}
+
+/* Function to take in a Neighbor Advertisement */
+void ndp_input_na(struct ndp_cache *c, int dev, const struct in6_addr *target, int solicited,
+                  int override, int is_router, uint64_t now_ms, void *ctx) {
+    pthread_mutex_lock(&c->lock);
+    c->stats.advertisements++;
+    struct ndp_entry *e = ndp_find(c, dev, target);
+    if (!e) {
+        pthread_mutex_unlock(&c->lock); /* Unsolicited and unknown: nothing to update */
+        return;
+    }
+    uint8_t state = atomic_load(&e->state);
+    if (state == NDP_INCOMPLETE) {
+        atomic_store(&e->deadline_ms, solicited ? now_ms + c->reachable_ms : 0);
+        atomic_store(&e->state, solicited ? NDP_REACHABLE : NDP_STALE);
+        e->probes = 0;
+        c->stats.resolved++;
+        ndp_flush(c, e, ctx);
+    } else if (solicited) {
+        /* The same (absent) link-layer address, so Override changes nothing else */
+        atomic_store(&e->deadline_ms, now_ms + c->reachable_ms);
+        atomic_store(&e->state, NDP_REACHABLE);
+        e->probes = 0;
+    }
+    (void)override;
+    if (atomic_load(&e->is_router) && !is_router) {
+        ndp_router_forget(c, dev, target); /* No longer a router (RFC 4861 7.2.5) */
+    }
+    atomic_store(&e->is_router, is_router ? 1 : 0);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Function to take in the source of a solicitation */
+void ndp_input_solicitation(struct ndp_cache *c, int dev, const struct in6_addr *src,
+                            uint64_t now_ms, void *ctx) {
+    pthread_mutex_lock(&c->lock);
+    struct ndp_entry *e = ndp_find(c, dev, src);
+    if (!e) {
+        ndp_add(c, dev, src, NDP_STALE, now_ms);
+    } else if (atomic_load(&e->state) == NDP_INCOMPLETE) {
+        atomic_store(&e->deadline_ms, 0);
+        atomic_store(&e->state, NDP_STALE);
+        e->probes = 0;
+        c->stats.resolved++;
+        ndp_flush(c, e, ctx);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Function to take in a Router Advertisement */
+void ndp_input_ra(struct ndp_cache *c, int dev, const struct in6_addr *src,
+                  uint32_t lifetime_s, uint64_t now_ms, void *ctx) {
+    ndp_input_solicitation(c, dev, src, now_ms, ctx); /* It exists, like a solicitor */
+    pthread_mutex_lock(&c->lock);
+    c->stats.router_adverts++;
+    struct ndp_entry *e = ndp_find(c, dev, src);
+    if (e) {
+        atomic_store(&e->is_router, 1);
+    }
+    struct ndp_router *slot = NULL;
+    for (int i = 0; i < NDP_MAX_ROUTERS; i++) {
+        struct ndp_router *r = &c->routers[i];
+        uint64_t expires = atomic_load(&r->expires_ms);
+        if (expires && r->dev == dev && memcmp(&r->addr, src, sizeof(*src)) == 0) {
+            slot = r;
+            break;
+        }
+        if (!slot && expires <= now_ms) {
+            slot = r; /* Free (or expired): use it unless the router is listed */
+        }
+    }
+    if (lifetime_s == 0) {
+        ndp_router_forget(c, dev, src);
+    } else if (slot) {
+        if (atomic_load(&slot->expires_ms) == 0 || slot->dev != dev ||
+            memcmp(&slot->addr, src, sizeof(*src)) != 0) {
+            atomic_store(&slot->expires_ms, 0); /* Readers skip it while it changes */
+            slot->addr = *src;
+            slot->dev = dev;
+        }
+        atomic_store_explicit(&slot->expires_ms, now_ms + lifetime_s * 1000ULL,
+                              memory_order_release);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Function to pick a default router (RFC 4861 6.3.6): the first live one whose
+ * neighbor entry is usable, else the first live one */
+int ndp_default_router(struct ndp_cache *c, int slot, uint64_t now_ms, struct in6_addr *addr,
+                       int *dev) {
+    int found = 0;
+    epoch_enter(&c->epoch, slot);
+    for (int i = 0; i < NDP_MAX_ROUTERS; i++) {
+        struct ndp_router *r = &c->routers[i];
+        uint64_t expires = atomic_load_explicit(&r->expires_ms, memory_order_acquire);
+        if (expires <= now_ms) {
+            continue;
+        }
+        struct in6_addr a = r->addr;
+        int d = r->dev;
+        if (atomic_load_explicit(&r->expires_ms, memory_order_acquire) != expires) {
+            continue; /* Rewritten while we read it */
+        }
+        struct ndp_entry *e = ndp_find(c, d, &a);
+        int usable = e && atomic_load_explicit(&e->state, memory_order_relaxed) != NDP_INCOMPLETE;
+        if (!found || usable) {
+            *addr = a;
+            *dev = d;
+            found = 1;
+        }
+        if (usable) {
+            break;
+        }
+    }
+    epoch_exit(&c->epoch, slot);
+    return found ? 0 : -1;
+}
+
+/* Function to run the timer of one entry (locked). Returns 1 if it should go. */
+static int ndp_age_entry(struct ndp_cache *c, struct ndp_entry *e, uint64_t now_ms, void *ctx) {
+    uint8_t state = atomic_load(&e->state);
+    uint64_t deadline = atomic_load(&e->deadline_ms);
+    switch (state) {
+    case NDP_INCOMPLETE:
+        if (now_ms < deadline) {
+            return 0;
+        }
+        if (e->probes >= NDP_MAX_MULTICAST_SOLICIT) {
+            /* Tell the senders of the waiting packets (RFC 4861 7.2.2) */
+            while (e->queue) {
+                struct ndp_pending *p = e->queue;
+                e->queue = p->next;
+                c->ops->unreachable(ctx, p->in_dev, p->data, p->len);
+                free(p);
+                c->queued--;
+            }
+            e->queue_tail = NULL;
+            e->queue_len = 0;
+            c->stats.failed++;
+            return 1;
+        }
+        e->probes++;
+        atomic_store(&e->deadline_ms, now_ms + NDP_RETRANS_MS);
+        c->ops->solicit(ctx, e->dev, &e->addr, 0);
+        c->stats.solicits++;
+        return 0;
+    case NDP_REACHABLE:
+        if (now_ms >= deadline) {
+            uint8_t expected = NDP_REACHABLE;
+            atomic_compare_exchange_strong(&e->state, &expected, NDP_STALE);
+        }
+        return 0;
+    case NDP_STALE:
+        if (now_ms >= atomic_load(&e->used_ms) + NDP_GC_MS) {
+            c->stats.collected++;
+            return 1;
+        }
+        return 0;
+    case NDP_DELAY:
+        if (now_ms < atomic_load(&e->delay_ms)) {
+            return 0;
+        }
+        e->probes = 1;
+        atomic_store(&e->deadline_ms, now_ms + NDP_RETRANS_MS);
+        atomic_store(&e->state, NDP_PROBE);
+        c->ops->solicit(ctx, e->dev, &e->addr, 1);
+        c->stats.solicits++;
+        return 0;
+    case NDP_PROBE:
+        if (now_ms < deadline) {
+            return 0;
+        }
+        if (e->probes >= NDP_MAX_UNICAST_SOLICIT) {
+            c->stats.unreachable++;
+            return 1;
+        }
+        e->probes++;
+        atomic_store(&e->deadline_ms, now_ms + NDP_RETRANS_MS);
+        c->ops->solicit(ctx, e->dev, &e->addr, 1);
+        c->stats.solicits++;
+        return 0;
+    }
+    return 0;
+}
+
+/* Function to age the slice of the table due since the last call */
+void ndp_age(struct ndp_cache *c, uint64_t now_ms, void *ctx) {
+    if (c->aged_ms == 0 || now_ms < c->aged_ms) {
+        c->aged_ms = now_ms;
+        return;
+    }
+    uint64_t buckets = (now_ms - c->aged_ms) * NDP_BUCKETS / NDP_SWEEP_MS;
+    if (buckets == 0) {
+        return;
+    }
+    if (buckets >= NDP_BUCKETS) {
+        buckets = NDP_BUCKETS;
+        c->aged_ms = now_ms;
+    } else {
+        c->aged_ms += buckets * NDP_SWEEP_MS / NDP_BUCKETS;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    for (uint64_t i = 0; i < buckets; i++) {
+        struct ndp_entry *_Atomic *link = &c->buckets[c->cursor];
+        c->cursor = (c->cursor + 1) & (NDP_BUCKETS - 1);
+        struct ndp_entry *e;
+        while ((e = atomic_load_explicit(link, memory_order_relaxed)) != NULL) {
+            if (ndp_age_entry(c, e, now_ms, ctx)) {
+                if (atomic_load(&e->is_router)) {
+                    ndp_router_forget(c, e->dev, &e->addr);
+                }
+                ndp_remove(c, link, e);
+            } else {
+                link = &e->next;
+            }
+        }
+    }
+    for (int i = 0; i < NDP_MAX_ROUTERS; i++) {
+        uint64_t expires = atomic_load(&c->routers[i].expires_ms);
+        if (expires && expires <= now_ms) {
+            atomic_store(&c->routers[i].expires_ms, 0);
+        }
+    }
+    epoch_reclaim(&c->epoch);
+    pthread_mutex_unlock(&c->lock);
+}
@@ -1,6 +1,8 @@
 /* tcp_engine.c: A modular TCP engine for handling client and server connections
  * with customizable callbacks. Supports server (echoes data) and client (sends/
- * receives data) modes. Like a librarian managing a central desk for letters.
+ * receives data) modes. The client caps its segment size at the path MTU that
+ * icmp_diag -P cached for the server, if any, so the first full-sized segment
+ * already fits. Like a librarian managing a central desk for letters.
  * Integrates with netkernel tools for TCP-based protocols. */
 
 /* Include standard libraries for sockets, I/O, and networking */
@@ -10,14 +12,17 @@
 #include <unistd.h>     /* For close, read, write */
 #include <sys/socket.h> /* For socket, bind, listen, accept, connect */
 #include <netinet/in.h> /* For sockaddr_in */
+#include <netinet/tcp.h> /* For TCP_MAXSEG */
 #include <arpa/inet.h>  /* For inet_pton, inet_ntop */
+#include "pmtu.h"       /* For pmtu_cache_get */
 
 /* Buffer size for messages */
 #define BUFFER_SIZE 1024
 /* Default port */
 #define DEFAULT_PORT 6000
 
-/* TCP engine structure with callback functions */
+/* TCP engine structure with callback functions. The data callbacks may store a
+ * terminator at data[len], so callers pass writable memory with a byte to spare. */
 struct tcp_engine {
     void (*on_accept)(int client_sock, struct sockaddr_in *client_addr); /* Called on new connection */
     void (*on_receive)(int client_sock, char *data, ssize_t len);        /* Called on data received */
@@ -141,6 +146,17 @@ void run_client(const char *server_ip, int port, struct tcp_engine *engine) {
         exit(1);
     }
 
+    /* Size segments for the cached path MTU (less the IPv4 and TCP headers) */
+    uint16_t mtu = pmtu_cache_get(PMTU_CACHE_PATH, AF_INET, &server_addr.sin_addr);
+    if (mtu > 40) {
+        int mss = mtu - 40;
+        if (setsockopt(sockfd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss)) < 0) {
+            perror("TCP_MAXSEG failed");
+        } else {
+            printf("Path MTU %u cached for %s: MSS %d\n", mtu, server_ip, mss);
+        }
+    }
+
     /* Connect to server */
     if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Connect failed");
@@ -151,7 +167,7 @@ void run_client(const char *server_ip, int port, struct tcp_engine *engine) {
     printf("Connected to server %s:%d\n", server_ip, port);
 
     /* Send message */
-    char *message = "Hello, TCP engine!\n";
+    char message[] = "Hello, TCP engine!\n"; /* An array, not a literal: on_send writes */
     engine->on_send(sockfd, message, strlen(message));
     if (write(sockfd, message, strlen(message)) < 0) {
         perror("Send failed");
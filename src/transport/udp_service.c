@@ -1,34 +1,461 @@
 /* udp_service.c: A simple UDP service for handling client and server datagrams.
- * Server mode echoes received datagrams; client mode sends/receives datagrams.
- * Like a librarian at a dropbox for quick notes. Complements netkernel tools for
- * UDP-based protocols like DNS. */
+ * Server mode echoes received datagrams in batches: one recvmmsg fills a
+ * preallocated array of buffers with every datagram already queued (up to -b of
+ * them), and one sendmmsg sends all their replies straight out of the same
+ * buffers, so the per-datagram cost is the kernel's rather than two system calls
+ * and two printfs; -v prints every datagram as it used to. With -G the server
+ * turns on UDP_GRO, so the kernel hands it runs of same-sized datagrams from one
+ * sender as a single super-datagram of up to 64 KB, which it echoes with one
+ * UDP_SEGMENT (GSO) send that the kernel splits again. With -w N the server
+ * runs N workers, each pinned to a CPU with its own SO_REUSEPORT socket on the
+ * port, and a classic BPF program attached to the group picks the worker for
+ * each datagram: by a hash of its source address and port, so a client always
+ * reaches the same worker, or by the CPU that received it, so the worker pinned
+ * to that CPU serves it where it already sits in cache. Client mode sends/
+ * receives datagrams, reporting the largest datagram that crosses the path
+ * unfragmented when icmp_diag -P has cached its MTU. Bulk mode streams
+ * datagrams at a server for a while, with -g as 64 KB GSO sends, and bench mode
+ * measures bulk Gbit/s over loopback with and without each offload. Load mode
+ * is an open-loop load generator: it sends sequence-numbered, timestamped
+ * datagrams over -f flows at a fixed rate (-r) whether or not replies come back,
+ * stamping each with the time it was due so a sender that falls behind shows up
+ * as latency, and a receiving thread matches the echoes to report RTT
+ * percentiles, loss and reordering. Rserver and rsend run the reliable
+ * transport (rudp.h): rsend streams checkable messages over -f streams and
+ * rserver verifies their order and content and reports their latency. Relay
+ * mode sits between the two and drops (-L), delays (-D, -J) and queues (-B, -Q)
+ * datagrams each way, so loss recovery and congestion control can be watched
+ * on one host. Like a
+ * librarian at a
+ * dropbox for quick notes who empties the whole slot at once instead of reaching
+ * in for one note at a time. Complements netkernel tools for UDP-based protocols
+ * like DNS. */
+
+#define _GNU_SOURCE /* For recvmmsg, sendmmsg */
 
 /* Include standard libraries for sockets, I/O, and networking */
 #include <stdio.h>      /* For printf, perror, fprintf */
 #include <stdlib.h>     /* For exit, malloc, free */
 #include <string.h>     /* For memcpy, memset */
-#include <unistd.h>     /* For close */
-#include <sys/socket.h> /* For socket, bind, sendto, recvfrom */
+#include <unistd.h>     /* For close, getopt */
+#include <errno.h>      /* For errno, EINTR, EAGAIN */
+#include <signal.h>     /* For signal, SIGINT, SIGTERM (stop the server) */
+#include <time.h>       /* For clock_gettime */
+#include <sys/time.h>   /* For struct timeval (receive timeout) */
+#include <sched.h>      /* For cpu_set_t, CPU_SET (worker pinning) */
+#include <pthread.h>    /* For pthread_create, pthread_join, pthread_setaffinity_np */
+#include <stdatomic.h>  /* For atomic_ulong (load generator's sent count) */
+#include <sys/epoll.h>  /* For epoll_create1, epoll_wait (load generator's replies) */
+#include <sys/socket.h> /* For socket, bind, sendto, recvfrom, recvmmsg, sendmmsg */
 #include <netinet/in.h> /* For sockaddr_in */
+#include <netinet/udp.h> /* For UDP_SEGMENT, UDP_GRO */
 #include <arpa/inet.h>  /* For inet_pton, inet_ntop */
+#include <linux/filter.h> /* For struct sock_fprog, BPF_STMT, SKF_AD_CPU, SKF_NET_OFF */
+#include "pmtu.h"       /* For pmtu_cache_get */
+#include <poll.h>       /* For ppoll (relay) */
+#include "hdr_hist.h"   /* For struct hdr_hist (load generator's RTTs) */
+#include "rudp.h"       /* For rudp_open, rudp_send, rudp_poll (reliable modes) */
 
 /* Buffer size for datagrams */
 #define BUFFER_SIZE 1024
 /* Default port */
 #define DEFAULT_PORT 7000
+/* Bytes per server buffer: larger datagrams are echoed cut short */
+#define SLOT_SIZE 2048
+/* Bytes per server buffer with GRO on: a whole coalesced super-datagram */
+#define SUPER_SLOT_SIZE 65536
+/* Datagrams one GSO send may carry (the kernel's UDP_MAX_SEGMENTS) */
+#define GSO_MAX_SEGMENTS 64
+/* Largest UDP payload over IPv4 */
+#define MAX_UDP_PAYLOAD 65507
+/* Default bulk datagram size: fits a 1500-byte MTU with room for tunnels */
+#define DEFAULT_SEGMENT 1400
+/* Default bulk and bench run time (seconds) */
+#define DEFAULT_BULK_SECONDS 5
+/* Datagrams per recvmmsg / sendmmsg, by default and at most */
+#define DEFAULT_BATCH 64
+#define MAX_BATCH 1024
+/* Socket buffer the server asks for (the kernel caps it at net.core.rmem_max) */
+#define SOCKET_BUFFER (4 << 20)
+/* Load generator defaults: datagram size, datagrams per second, flows */
+#define DEFAULT_LOAD_SIZE 64
+#define DEFAULT_LOAD_RATE 10000
+#define DEFAULT_LOAD_FLOWS 1
+#define MAX_LOAD_FLOWS 1024
+/* Identifies the load generator's datagrams */
+#define LOAD_MAGIC 0x4C4F4144u
+/* How long the load generator waits for late replies after sending (milliseconds) */
+#define LOAD_DRAIN_MS 500
+/* Largest RTT the load generator tells apart (nanoseconds) */
+#define LOAD_MAX_RTT_NS 10000000000ULL
+/* Reliable mode defaults: message size */
+#define DEFAULT_MESSAGE_SIZE 1000
+/* Identifies rsend's messages */
+#define RMSG_MAGIC 0x524D5347u
+/* How long rsend waits for its last messages to be acknowledged (seconds) */
+#define RSEND_DRAIN_SECONDS 30
+/* Relay defaults: listen port offset from the server's, bottleneck queue (KB) */
+#define RELAY_PORT_OFFSET 1
+#define DEFAULT_RELAY_QUEUE_KB 256
+/* Clients the relay keeps a server-side socket for */
+#define RELAY_MAX_PEERS 64
+/* Most server worker threads */
+#define MAX_WORKERS 256
+/* How often a worker publishes its counters for the report (milliseconds) */
+#define PUBLISH_MS 100
 
-/* Server function */
-void run_server(int port) {
-    /* Create UDP socket */
+/* How datagrams are spread over the workers' SO_REUSEPORT sockets */
+enum steer_mode {
+    STEER_FLOW,         /* BPF: hash of source address and port */
+    STEER_CPU,          /* BPF: the CPU the datagram was received on */
+    STEER_KERNEL        /* No program: the kernel's own 4-tuple hash */
+};
+
+/* Server settings from the command line */
+struct server_config {
+    int port;           /* UDP port */
+    int batch;          /* Datagrams per system call */
+    int verbose;        /* Print every datagram */
+    int duration;       /* Seconds to run (0 = until interrupted) */
+    int gro;            /* Receive coalesced super-datagrams (UDP_GRO) */
+    int sink;           /* Count datagrams without echoing them */
+    int workers;        /* Threads, each with its own socket (SO_REUSEPORT if > 1) */
+    enum steer_mode steer; /* How datagrams pick a worker */
+};
+
+/* Bulk sender settings */
+struct bulk_config {
+    int segment;        /* Bytes per datagram */
+    int gso;            /* Hand the kernel 64 KB at a time to split (UDP_SEGMENT) */
+    int batch;          /* Datagrams per sendmmsg without GSO */
+    int duration;       /* Seconds to send */
+};
+
+/* Load generator settings */
+struct load_config {
+    int size;           /* Bytes per datagram (at least a load_header) */
+    double rate;        /* Datagrams per second over all flows (0 = as fast as possible) */
+    int flows;          /* Sockets, each its own source port */
+    int batch;          /* Most datagrams per sendmmsg */
+    int duration;       /* Seconds to send */
+};
+
+/* Start of every load datagram. It only travels to the echo server and back to
+ * the host that wrote it, so it stays in host byte order. */
+struct load_header {
+    uint32_t magic;     /* LOAD_MAGIC */
+    uint32_t flow;      /* Flow it was sent on */
+    uint64_t seq;       /* Per-flow sequence number, from 0 */
+    uint64_t sent_ns;   /* Monotonic time it was due to be sent */
+};
+
+/* One load flow: a connected socket. The sender owns tx_seq, the receiver rx_seq. */
+struct load_flow {
+    int fd;
+    uint64_t tx_seq;    /* Next sequence number to send */
+    uint64_t rx_seq;    /* One past the highest sequence number received */
+};
+
+/* Reliable transport settings (rserver, rsend) */
+struct reliable_config {
+    enum rudp_cc cc;    /* Congestion controller */
+    int size;           /* Bytes per message (at least an rmsg_header) */
+    double rate;        /* Messages per second (0 = as fast as the window allows) */
+    int streams;        /* Streams the messages are spread over, round robin */
+    int unordered;      /* Send them RUDP_UNORDERED */
+    int duration;       /* Seconds to send (rsend) or serve (rserver, 0 = until stopped) */
+};
+
+/* Start of every rsend message; the rest is bytes (seq + i) & 0xff, so the
+ * server can check it */
+struct rmsg_header {
+    uint32_t magic;     /* RMSG_MAGIC */
+    uint32_t seq;       /* Per-stream message number, from 0 */
+    uint64_t sent_ns;   /* When it was queued (monotonic; latency is only
+                         * meaningful with both ends on one host) */
+};
+
+/* Relay settings */
+struct relay_config {
+    int listen_port;    /* Port clients send to */
+    double loss;        /* Fraction of datagrams dropped, each way */
+    int delay_ms;       /* One-way delay added */
+    int jitter_ms;      /* Up to this much more, uniformly at random (reorders) */
+    double rate_mbit;   /* Bottleneck rate each way (0 = none) */
+    int queue_kb;       /* Bottleneck queue; arrivals beyond it are dropped */
+    int duration;       /* Seconds to run (0 = until interrupted) */
+};
+
+/* What a bulk send achieved */
+struct bulk_result {
+    unsigned long bytes;        /* Payload bytes handed to the kernel */
+    unsigned long datagrams;    /* Datagrams they make up */
+    unsigned long calls;        /* System calls it took */
+    unsigned long errors;       /* Sends the kernel refused */
+    double seconds;             /* Time spent */
+};
+
+/* Server counters */
+struct server_stats {
+    unsigned long rx;           /* Datagrams received (GRO segments counted singly) */
+    unsigned long tx;           /* Replies sent (likewise) */
+    unsigned long rx_bytes;     /* Bytes received */
+    unsigned long rx_calls;     /* recvmmsg calls that returned datagrams */
+    unsigned long tx_calls;     /* sendmmsg calls */
+    unsigned long coalesced;    /* Receives GRO merged from several datagrams */
+    unsigned long truncated;    /* Datagrams larger than a buffer */
+    unsigned long send_errors;  /* Replies the kernel refused */
+};
+
+/* The server's preallocated buffers: slot i receives datagram i of a batch and
+ * then holds its reply, addressed back to the sender recvmmsg filled in */
+struct dgram_batch {
+    struct mmsghdr *msgs;       /* One message header per slot */
+    struct iovec *iovs;         /* Its buffer */
+    struct sockaddr_in *addrs;  /* Its peer */
+    char *bufs;                 /* size * slot_size bytes */
+    char *ctrl;                 /* size * CTRL_SIZE bytes of ancillary data */
+    size_t slot_size;           /* Bytes per buffer */
+    int size;                   /* Slots */
+};
+
+/* One server thread: its socket, buffers and counters. The worker owns st; the
+ * reporting thread reads the copy it publishes under lock. */
+struct server_worker {
+    pthread_t tid;
+    int index;                          /* Position in the reuseport group */
+    int cpu;                            /* CPU it is pinned to (-1 = not pinned) */
+    int fd;
+    const struct server_config *cfg;
+    struct dgram_batch b;
+    struct server_stats st;
+    pthread_mutex_t lock;               /* Guards published */
+    struct server_stats published;
+};
+
+/* Ancillary data room per slot: the GRO segment size in, the GSO one out */
+#define CTRL_SIZE CMSG_SPACE(sizeof(int))
+
+/* Set by SIGINT / SIGTERM to stop the server */
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Function to handle SIGINT / SIGTERM */
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* Function to read the monotonic clock in milliseconds */
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Function to read the monotonic clock in nanoseconds */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function to free the slots */
+static void batch_free(struct dgram_batch *b) {
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->bufs);
+    free(b->ctrl);
+}
+
+/* Function to allocate size slots of slot_size bytes. Returns 0, or -1 if out of
+ * memory. */
+static int batch_init(struct dgram_batch *b, int size, size_t slot_size) {
+    memset(b, 0, sizeof(*b));
+    b->msgs = calloc(size, sizeof(*b->msgs));
+    b->iovs = calloc(size, sizeof(*b->iovs));
+    b->addrs = calloc(size, sizeof(*b->addrs));
+    b->bufs = malloc((size_t)size * slot_size);
+    b->ctrl = calloc(size, CTRL_SIZE);
+    if (!b->msgs || !b->iovs || !b->addrs || !b->bufs || !b->ctrl) {
+        batch_free(b);
+        return -1;
+    }
+    b->size = size;
+    b->slot_size = slot_size;
+    for (int i = 0; i < size; i++) {
+        b->iovs[i].iov_base = b->bufs + (size_t)i * slot_size;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+    }
+    return 0;
+}
+
+/* Function to ready every slot to receive */
+static void batch_reset(struct dgram_batch *b) {
+    for (int i = 0; i < b->size; i++) {
+        b->iovs[i].iov_len = b->slot_size;
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+        b->msgs[i].msg_hdr.msg_control = b->ctrl + (size_t)i * CTRL_SIZE;
+        b->msgs[i].msg_hdr.msg_controllen = CTRL_SIZE;
+        b->msgs[i].msg_hdr.msg_flags = 0;
+    }
+}
+
+/* Function to print one datagram (-v) */
+static void print_datagram(const char *what, const struct sockaddr_in *peer, const char *data,
+                           size_t len) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &peer->sin_addr, ip, sizeof(ip));
+    printf("%s %s:%d: %.*s\n", what, ip, ntohs(peer->sin_port), (int)len, data);
+}
+
+/* Function to read the segment size GRO reports for a received message (0 if
+ * it holds a single datagram) */
+static int gro_segment(struct msghdr *h) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+            return seg;
+        }
+    }
+    return 0;
+}
+
+/* Function to make a reply go out as segments of seg bytes (UDP_SEGMENT), or
+ * whole if seg is 0 */
+static void gso_segment(struct msghdr *h, int seg) {
+    if (seg == 0) {
+        h->msg_control = NULL;
+        h->msg_controllen = 0;
+        return;
+    }
+    h->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    struct cmsghdr *c = CMSG_FIRSTHDR(h);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t size = (uint16_t)seg;
+    memcpy(CMSG_DATA(c), &size, sizeof(size));
+}
+
+/* Function to count the datagrams a reply set up by gso_segment goes out as */
+static unsigned long gso_datagrams(struct msghdr *h, size_t len) {
+    struct cmsghdr *c = h->msg_controllen ? CMSG_FIRSTHDR(h) : NULL;
+    if (!c || c->cmsg_level != SOL_UDP || c->cmsg_type != UDP_SEGMENT) {
+        return 1;
+    }
+    uint16_t seg;
+    memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+    return (len + seg - 1) / seg;
+}
+
+/* Function to receive one batch on fd and echo it back (unless sinking it).
+ * Returns the number of messages handled, 0 if the receive timed out or was
+ * interrupted, or -1 on a socket error. */
+static int serve_batch(int fd, struct dgram_batch *b, const struct server_config *cfg,
+                       struct server_stats *st) {
+    batch_reset(b);
+    int n = recvmmsg(fd, b->msgs, b->size, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        perror("Receive failed");
+        return -1;
+    }
+    st->rx_calls++;
+    unsigned long segments = 0;
+    for (int i = 0; i < n; i++) {
+        struct msghdr *h = &b->msgs[i].msg_hdr;
+        unsigned len = b->msgs[i].msg_len;
+        if (h->msg_flags & MSG_TRUNC) {
+            st->truncated++;
+        }
+        /* A coalesced message is seg-sized datagrams with a shorter one last */
+        int seg = gro_segment(h);
+        if (seg > 0 && len > (unsigned)seg) {
+            segments += (len + seg - 1) / seg;
+            st->coalesced++;
+        } else {
+            seg = 0;
+            segments++;
+        }
+        st->rx_bytes += len;
+        b->iovs[i].iov_len = len; /* Echo exactly what arrived */
+        gso_segment(h, seg);
+        if (cfg->verbose) {
+            print_datagram("Received from", &b->addrs[i], b->iovs[i].iov_base, len);
+        }
+    }
+    st->rx += segments;
+    if (cfg->sink) {
+        return n;
+    }
+
+    /* Echo back: sendmmsg stops at the first reply it cannot send, so skip that
+     * one and carry on with the rest */
+    int sent = 0;
+    while (sent < n) {
+        int k = sendmmsg(fd, b->msgs + sent, n - sent, 0);
+        st->tx_calls++;
+        if (k < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (cfg->verbose) {
+                perror("Send failed");
+            }
+            st->send_errors++;
+            k = 1;
+        } else if (segments == (unsigned long)n) {
+            st->tx += k;
+        } else {
+            for (int i = sent; i < sent + k; i++) {
+                st->tx += gso_datagrams(&b->msgs[i].msg_hdr, b->iovs[i].iov_len);
+            }
+        }
+        if (cfg->verbose) {
+            for (int i = sent; i < sent + k && i < n; i++) {
+                print_datagram("Sent to", &b->addrs[i], b->iovs[i].iov_base, b->iovs[i].iov_len);
+            }
+        }
+        sent += k;
+    }
+    return n;
+}
+
+/* Function to open the server socket: bound to port, with a large receive buffer,
+ * a one-second receive timeout so the loop can report and stop, GRO if asked
+ * for, and SO_REUSEPORT if it is to share the port with other workers. Returns
+ * the descriptor, or -1 on error. */
+static int open_server_socket(int port, int gro, int reuseport) {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
         perror("Socket creation failed");
-        exit(1);
+        return -1;
     }
 
     /* Set socket options */
     int opt = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    int bufsize = SOCKET_BUFFER;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    struct timeval tv = { 1, 0 };
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (gro && setsockopt(sockfd, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) < 0) {
+        perror("UDP_GRO not supported");
+        close(sockfd);
+        return -1;
+    }
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("SO_REUSEPORT not supported");
+        close(sockfd);
+        return -1;
+    }
 
     /* Set up server address */
     struct sockaddr_in server_addr;
@@ -41,39 +468,253 @@ void run_server(int port) {
     if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
         close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* Function to attach the steering program to a bound reuseport socket. The
+ * kernel runs it for every datagram to the port and delivers the datagram to the
+ * socket whose index (order of binding) it returns. Returns 0, or -1 on error. */
+static int attach_steering(int fd, enum steer_mode steer, const struct server_worker *w,
+                           int workers) {
+    /* Flow: X = IPv4 header length, A = (source address ^ source port) * golden
+     * ratio, keeping the well-mixed high half. The program runs with the data
+     * pulled past the UDP header, so the headers are read at SKF_NET_OFF. */
+    struct sock_filter flow[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT(BPF_ST, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF),
+        BPF_STMT(BPF_LDX | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1u),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    /* CPU: the first worker pinned to the receiving CPU, looked up by a chain of
+     * compares built from the actual pinning; a CPU without a worker falls back
+     * to cpu % workers */
+    struct sock_filter cpu[2 * MAX_WORKERS + 3];
+    int n = 0;
+    cpu[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (int i = 0; i < workers; i++) {
+        int first = w[i].cpu >= 0;
+        for (int j = 0; j < i && first; j++) {
+            first = w[j].cpu != w[i].cpu;
+        }
+        if (first) {
+            cpu[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, w[i].cpu, 0, 1);
+            cpu[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+        }
+    }
+    cpu[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers);
+    cpu[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog prog;
+    if (steer == STEER_CPU) {
+        prog.len = n;
+        prog.filter = cpu;
+    } else {
+        prog.len = sizeof(flow) / sizeof(flow[0]);
+        prog.filter = flow;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("SO_ATTACH_REUSEPORT_CBPF failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to add one set of counters to another */
+static void stats_add(struct server_stats *sum, const struct server_stats *s) {
+    sum->rx += s->rx;
+    sum->tx += s->tx;
+    sum->rx_bytes += s->rx_bytes;
+    sum->rx_calls += s->rx_calls;
+    sum->tx_calls += s->tx_calls;
+    sum->coalesced += s->coalesced;
+    sum->truncated += s->truncated;
+    sum->send_errors += s->send_errors;
+}
+
+/* Function to make a worker's counters visible to the reporting thread */
+static void worker_publish(struct server_worker *w) {
+    pthread_mutex_lock(&w->lock);
+    w->published = w->st;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Function run by each server worker thread: serve its socket until stopped */
+static void *server_worker_main(void *arg) {
+    struct server_worker *w = arg;
+    int64_t last = now_ms();
+    while (!stop_requested) {
+        if (serve_batch(w->fd, &w->b, w->cfg, &w->st) < 0) {
+            stop_requested = 1;
+            break;
+        }
+        int64_t now = now_ms();
+        if (now - last >= PUBLISH_MS) {
+            worker_publish(w);
+            last = now;
+        }
+    }
+    worker_publish(w);
+    return NULL;
+}
+
+/* Function to free the workers' sockets and buffers */
+static void free_workers(struct server_worker *w, int n) {
+    for (int i = 0; i < n; i++) {
+        if (w[i].fd >= 0) {
+            close(w[i].fd);
+        }
+        batch_free(&w[i].b);
+        pthread_mutex_destroy(&w[i].lock);
+    }
+    free(w);
+}
+
+/* Function to open every worker's socket, in group order, and attach the
+ * steering program once the group exists. Returns the workers, or NULL on error. */
+static struct server_worker *open_workers(const struct server_config *cfg) {
+    struct server_worker *w = calloc(cfg->workers, sizeof(*w));
+    if (!w) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    /* Pin workers round-robin to the CPUs this process may run on */
+    int cpus[CPU_SETSIZE];
+    int ncpu = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) {
+                cpus[ncpu++] = c;
+            }
+        }
+    }
+    int reuseport = cfg->workers > 1;
+    if (reuseport && cfg->steer == STEER_CPU && ncpu != cfg->workers) {
+        fprintf(stderr, "Warning: %d workers on %d CPUs: %s\n", cfg->workers, ncpu,
+                ncpu > cfg->workers ? "datagrams received on CPUs without a worker are "
+                                      "served on another CPU" :
+                                      "workers sharing a CPU with another get no datagrams");
+    }
+    int opened = 0;
+    for (int i = 0; i < cfg->workers; i++) {
+        w[i].index = i;
+        w[i].cpu = reuseport && ncpu > 0 ? cpus[i % ncpu] : -1;
+        w[i].cfg = cfg;
+        pthread_mutex_init(&w[i].lock, NULL);
+        opened++;
+        w[i].fd = open_server_socket(cfg->port, cfg->gro, reuseport);
+        if (w[i].fd < 0) {
+            goto fail;
+        }
+        if (batch_init(&w[i].b, cfg->batch, cfg->gro ? SUPER_SLOT_SIZE : SLOT_SIZE) < 0) {
+            fprintf(stderr, "Out of memory\n");
+            goto fail;
+        }
+    }
+    if (reuseport && cfg->steer != STEER_KERNEL &&
+        attach_steering(w[0].fd, cfg->steer, w, cfg->workers) < 0) {
+        goto fail;
+    }
+    return w;
+
+fail:
+    free_workers(w, opened);
+    return NULL;
+}
+
+/* Function to sum the counters the workers have published */
+static void collect_stats(struct server_worker *w, int n, struct server_stats *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < n; i++) {
+        pthread_mutex_lock(&w[i].lock);
+        stats_add(sum, &w[i].published);
+        pthread_mutex_unlock(&w[i].lock);
+    }
+}
+
+/* Server function: the workers serve, this thread reports */
+void run_server(const struct server_config *cfg) {
+    struct server_worker *w = open_workers(cfg);
+    if (!w) {
         exit(1);
     }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    static const char *steer_names[] = { "flow hash", "CPU", "kernel hash" };
+    printf("UDP server listening on port %d, %d datagrams per batch%s%s", cfg->port,
+           cfg->batch, cfg->gro ? ", GRO" : "", cfg->sink ? ", not echoing" : "");
+    if (cfg->workers > 1) {
+        printf(", %d workers steered by %s", cfg->workers, steer_names[cfg->steer]);
+    }
+    printf("\n");
+    fflush(stdout);
 
-    printf("UDP server listening on port %d\n", port);
+    int started = 0;
+    for (; started < cfg->workers; started++) {
+        struct server_worker *sw = &w[started];
+        if (pthread_create(&sw->tid, NULL, server_worker_main, sw) != 0) {
+            fprintf(stderr, "Cannot start worker %d\n", started);
+            stop_requested = 1;
+            break;
+        }
+        if (sw->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(sw->cpu, &set);
+            pthread_setaffinity_np(sw->tid, sizeof(set), &set);
+        }
+    }
 
-    /* Handle datagrams */
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    while (1) {
-        /* Receive datagram */
-        ssize_t bytes = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0,
-                                 (struct sockaddr*)&client_addr, &client_len);
-        if (bytes < 0) {
-            perror("Receive failed");
+    /* Report the rates once a second while traffic flows */
+    struct server_stats st, prev;
+    memset(&prev, 0, sizeof(prev));
+    int64_t start = now_ms(), last = start;
+    while (!stop_requested && (cfg->duration == 0 || now_ms() - start < cfg->duration * 1000LL)) {
+        usleep(PUBLISH_MS * 1000);
+        int64_t now = now_ms();
+        if (now - last < 1000) {
             continue;
         }
-
-        buffer[bytes] = '\0';
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-        printf("Received from %s:%d: %s\n", client_ip, ntohs(client_addr.sin_port), buffer);
-
-        /* Echo back */
-        if (sendto(sockfd, buffer, bytes, 0,
-                   (struct sockaddr*)&client_addr, client_len) < 0) {
-            perror("Send failed");
-        } else {
-            printf("Sent to %s:%d: %s\n", client_ip, ntohs(client_addr.sin_port), buffer);
+        collect_stats(w, started, &st);
+        if (!cfg->verbose && st.rx != prev.rx) {
+            double secs = (now - last) / 1000.0;
+            unsigned long calls = st.rx_calls - prev.rx_calls;
+            printf("%7.1f s: %10.0f datagrams/s in, %10.0f out, %6.1f per recvmmsg, "
+                   "%6.2f Gbit/s in\n", (now - start) / 1000.0, (st.rx - prev.rx) / secs,
+                   (st.tx - prev.tx) / secs, calls ? (double)(st.rx - prev.rx) / calls : 0.0,
+                   (st.rx_bytes - prev.rx_bytes) * 8 / secs / 1e9);
+            fflush(stdout);
         }
+        prev = st;
+        last = now;
     }
 
-    close(sockfd);
+    /* Workers notice within their one-second receive timeout */
+    stop_requested = 1;
+    for (int i = 0; i < started; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+    collect_stats(w, started, &st);
+    printf("%lu datagrams (%lu bytes, %lu coalesced receives) in %lu recvmmsg calls, %lu "
+           "replies in %lu sendmmsg calls, %lu truncated, %lu send errors\n", st.rx, st.rx_bytes,
+           st.coalesced, st.rx_calls, st.tx, st.tx_calls, st.truncated, st.send_errors);
+    if (cfg->workers > 1) {
+        for (int i = 0; i < started; i++) {
+            printf("  worker %d (CPU %d): %lu datagrams, %.1f%%\n", i, w[i].cpu, w[i].st.rx,
+                   st.rx ? 100.0 * w[i].st.rx / st.rx : 0.0);
+        }
+    }
+    free_workers(w, cfg->workers);
 }
 
 /* Client function */
@@ -96,6 +737,13 @@ void run_client(const char *server_ip, int port) {
         exit(1);
     }
 
+    /* Largest payload that avoids fragmentation (path MTU less IPv4 and UDP headers) */
+    uint16_t mtu = pmtu_cache_get(PMTU_CACHE_PATH, AF_INET, &server_addr.sin_addr);
+    if (mtu > 28) {
+        printf("Path MTU %u cached for %s: datagrams up to %d bytes go unfragmented\n",
+               mtu, server_ip, mtu - 28);
+    }
+
     /* Send datagram */
     char *message = "Hello, UDP world!\n";
     if (sendto(sockfd, message, strlen(message), 0,
@@ -125,36 +773,1199 @@ void run_client(const char *server_ip, int port) {
     close(sockfd);
 }
 
+/* Function to open a UDP socket connected to ip:port with a large send buffer.
+ * Returns the descriptor, or -1 on error. */
+static int open_client_socket(const char *ip, int port) {
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid server IP: %s\n", ip);
+        return -1;
+    }
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    int bufsize = SOCKET_BUFFER;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Connect failed");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* Function to stream datagrams of bc->segment bytes on the connected socket fd
+ * until deadline_ms: with GSO as single sends of up to GSO_MAX_SEGMENTS datagrams
+ * that the kernel splits, otherwise as sendmmsg batches. Returns 0, or -1 if GSO
+ * is not available. */
+static int bulk_send(int fd, const struct bulk_config *bc, int64_t deadline_ms,
+                     struct bulk_result *r) {
+    memset(r, 0, sizeof(*r));
+    int per_send = 1;
+    if (bc->gso) {
+        per_send = MAX_UDP_PAYLOAD / bc->segment;
+        if (per_send > GSO_MAX_SEGMENTS) {
+            per_send = GSO_MAX_SEGMENTS;
+        }
+        if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &bc->segment, sizeof(bc->segment)) < 0) {
+            perror("UDP_SEGMENT not supported");
+            return -1;
+        }
+    }
+    size_t chunk = (size_t)per_send * bc->segment;
+    char *buf = malloc(chunk);
+    struct mmsghdr *msgs = calloc(bc->batch, sizeof(*msgs));
+    if (!buf || !msgs) {
+        free(buf);
+        free(msgs);
+        return -1;
+    }
+    memset(buf, 'x', chunk);
+    struct iovec iov = { buf, (size_t)bc->segment };
+    for (int i = 0; i < bc->batch; i++) {
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int64_t start = now_ms(), now = start;
+    while (now < deadline_ms && !stop_requested) {
+        if (bc->gso) {
+            ssize_t k = send(fd, buf, chunk, 0);
+            if (k < 0) {
+                r->errors++; /* ECONNREFUSED from an earlier datagram, ENOBUFS, ... */
+            } else {
+                r->bytes += k;
+                r->datagrams += per_send;
+            }
+        } else {
+            int k = sendmmsg(fd, msgs, bc->batch, 0);
+            if (k < 0) {
+                r->errors++;
+            } else {
+                r->bytes += (unsigned long)k * bc->segment;
+                r->datagrams += k;
+            }
+        }
+        r->calls++;
+        now = now_ms();
+    }
+    r->seconds = (now - start) / 1000.0;
+    free(buf);
+    free(msgs);
+    return 0;
+}
+
+/* Bulk client function */
+void run_bulk(const char *server_ip, int port, const struct bulk_config *bc) {
+    int sockfd = open_client_socket(server_ip, port);
+    if (sockfd < 0) {
+        exit(1);
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    struct bulk_result r;
+    if (bulk_send(sockfd, bc, now_ms() + bc->duration * 1000LL, &r) < 0) {
+        close(sockfd);
+        exit(1);
+    }
+    printf("Sent %lu datagrams of %d bytes to %s:%d in %lu %s calls over %.1f s: "
+           "%.2f Gbit/s, %lu errors\n", r.datagrams, bc->segment, server_ip, port, r.calls,
+           bc->gso ? "GSO send" : "sendmmsg", r.seconds,
+           r.seconds > 0 ? r.bytes * 8 / r.seconds / 1e9 : 0.0, r.errors);
+    close(sockfd);
+}
+
+/* One receiver of the offload benchmark */
+struct bench_receiver {
+    pthread_t tid;
+    int fd;
+    struct server_config cfg;
+    struct dgram_batch b;
+    struct server_stats st;
+    volatile int stop;
+};
+
+/* Function run by the benchmark's receiving thread */
+static void *bench_receive(void *arg) {
+    struct bench_receiver *r = arg;
+    while (!r->stop && serve_batch(r->fd, &r->b, &r->cfg, &r->st) >= 0) {
+    }
+    return NULL;
+}
+
+/* Function to run one bulk transfer over loopback. Returns 0, or -1 if an
+ * offload is not available. */
+static int bench_one(int port, const struct bulk_config *bc, int gro, struct bulk_result *res,
+                     struct server_stats *st) {
+    struct bench_receiver r;
+    memset(&r, 0, sizeof(r));
+    r.cfg.port = port;
+    r.cfg.batch = DEFAULT_BATCH;
+    r.cfg.gro = gro;
+    r.cfg.sink = 1;
+    r.fd = open_server_socket(port, gro, 0);
+    if (r.fd < 0) {
+        return -1;
+    }
+    size_t slot = gro || bc->segment > SLOT_SIZE ? SUPER_SLOT_SIZE : SLOT_SIZE;
+    if (batch_init(&r.b, r.cfg.batch, slot) < 0) {
+        close(r.fd);
+        return -1;
+    }
+    int fd = open_client_socket("127.0.0.1", port);
+    int rc = -1;
+    if (fd >= 0 && pthread_create(&r.tid, NULL, bench_receive, &r) == 0) {
+        rc = bulk_send(fd, bc, now_ms() + bc->duration * 1000LL, res);
+        usleep(100000); /* Let the receiver drain its socket */
+        r.stop = 1;
+        send(fd, "", 0, 0); /* Wake it */
+        pthread_join(r.tid, NULL);
+        *st = r.st;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    batch_free(&r.b);
+    close(r.fd);
+    return rc;
+}
+
+/* Benchmark function: bulk transfer over loopback with each combination of GSO
+ * on the sender and GRO on the receiver */
+void run_bench(int port, const struct bulk_config *base) {
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    printf("Bulk transfer over loopback, %d-byte datagrams, %d s per run\n", base->segment,
+           base->duration);
+    printf("%-5s %-5s %10s %10s %7s %11s %11s %12s\n", "GSO", "GRO", "Gbit/s out",
+           "Gbit/s in", "loss", "sends/s", "receives/s", "datagrams/s");
+    for (int mode = 0; mode < 4 && !stop_requested; mode++) {
+        struct bulk_config bc = *base;
+        bc.gso = mode & 1;
+        int gro = mode >> 1;
+        struct bulk_result res;
+        struct server_stats st;
+        memset(&st, 0, sizeof(st));
+        if (bench_one(port, &bc, gro, &res, &st) < 0 || res.seconds <= 0) {
+            printf("%-5s %-5s not supported here\n", bc.gso ? "on" : "off", gro ? "on" : "off");
+            continue;
+        }
+        double secs = res.seconds;
+        double loss = res.datagrams > st.rx ? 100.0 * (res.datagrams - st.rx) / res.datagrams : 0;
+        printf("%-5s %-5s %10.2f %10.2f %6.1f%% %11.0f %11.0f %12.0f\n", bc.gso ? "on" : "off",
+               gro ? "on" : "off", res.bytes * 8 / secs / 1e9, st.rx_bytes * 8 / secs / 1e9,
+               loss,
+               res.calls / secs, st.rx_calls / secs, st.rx / secs);
+        fflush(stdout);
+    }
+}
+
+/* The load generator's receiving thread and its results */
+struct load_receiver {
+    pthread_t tid;
+    struct load_flow *flows;
+    const struct load_config *lc;
+    int epfd;                   /* Every flow's socket */
+    atomic_ulong *sent;         /* Datagrams the sender has sent so far */
+    struct hdr_hist rtt;        /* All RTTs (nanoseconds) */
+    struct hdr_hist interval;   /* RTTs since the last report */
+    unsigned long received;     /* Replies matched to a flow */
+    unsigned long reordered;    /* Replies older than one already received on the flow */
+    unsigned long foreign;      /* Datagrams that were not load replies */
+    volatile int stop;
+};
+
+/* Function to account for one reply */
+static void load_reply(struct load_receiver *r, const char *data, size_t len, uint64_t now) {
+    struct load_header h;
+    if (len < sizeof(h)) {
+        r->foreign++;
+        return;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (h.magic != LOAD_MAGIC || h.flow >= (uint32_t)r->lc->flows || h.sent_ns > now) {
+        r->foreign++;
+        return;
+    }
+    struct load_flow *f = &r->flows[h.flow];
+    if (h.seq >= f->rx_seq) {
+        f->rx_seq = h.seq + 1;
+    } else {
+        r->reordered++;
+    }
+    r->received++;
+    hdr_hist_record(&r->interval, now - h.sent_ns);
+}
+
+/* Function to print the load generator's once-a-second line, then fold the
+ * interval's RTTs into the total */
+static void load_report(struct load_receiver *r, double t, double secs, unsigned long sent,
+                        unsigned long received) {
+    const struct hdr_hist *h = &r->interval;
+    printf("%7.1f s: %10.0f sent/s, %10.0f received/s, RTT p50 %8.1f p99 %8.1f max %8.1f us\n",
+           t, sent / secs, received / secs, hdr_hist_percentile(h, 50) / 1e3,
+           hdr_hist_percentile(h, 99) / 1e3, h->total ? h->max / 1e3 : 0.0);
+    fflush(stdout);
+    hdr_hist_merge(&r->rtt, &r->interval);
+    hdr_hist_reset(&r->interval);
+}
+
+/* Function run by the load generator's receiving thread: drain every flow's
+ * socket as replies arrive, reporting once a second */
+static void *load_receive(void *arg) {
+    struct load_receiver *r = arg;
+    const struct load_config *lc = r->lc;
+    int size = lc->size > SLOT_SIZE ? lc->size : SLOT_SIZE;
+    struct dgram_batch b;
+    if (batch_init(&b, lc->batch, size) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+    struct epoll_event events[64];
+    uint64_t start = now_ns(), last = start;
+    unsigned long last_sent = 0, last_received = 0;
+    while (!r->stop) {
+        int n = epoll_wait(r->epfd, events, 64, 100);
+        for (int e = 0; e < n; e++) {
+            int fd = r->flows[events[e].data.u32].fd;
+            int k;
+            do {
+                batch_reset(&b);
+                k = recvmmsg(fd, b.msgs, b.size, MSG_DONTWAIT, NULL);
+                uint64_t now = now_ns();
+                for (int i = 0; i < k; i++) {
+                    load_reply(r, b.iovs[i].iov_base, b.msgs[i].msg_len, now);
+                }
+            } while (k == b.size);
+        }
+        uint64_t now = now_ns();
+        if (now - last >= 1000000000ULL) {
+            unsigned long sent = atomic_load_explicit(r->sent, memory_order_relaxed);
+            load_report(r, (now - start) / 1e9, (now - last) / 1e9, sent - last_sent,
+                        r->received - last_received);
+            last_sent = sent;
+            last_received = r->received;
+            last = now;
+        }
+    }
+    hdr_hist_merge(&r->rtt, &r->interval);
+    batch_free(&b);
+    return NULL;
+}
+
+/* Function to open the load flows, each a socket connected to the server and
+ * registered with epfd. Returns 0, or -1 on error. */
+static int open_load_flows(const char *ip, int port, struct load_flow *flows, int n, int epfd) {
+    for (int i = 0; i < n; i++) {
+        flows[i].fd = open_client_socket(ip, port);
+        if (flows[i].fd < 0) {
+            return -1;
+        }
+        int bufsize = SOCKET_BUFFER;
+        setsockopt(flows[i].fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, flows[i].fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Function to send on schedule until the run ends: datagram j (over all flows)
+ * is due at start + j / rate, and every datagram that is due goes out now, up to
+ * a batch at a time on the next flow in turn, whether or not replies have come
+ * back. Returns the datagrams the kernel refused. */
+static unsigned long load_send(const struct load_config *lc, struct load_flow *flows,
+                               atomic_ulong *sent) {
+    struct dgram_batch b;
+    if (batch_init(&b, lc->batch, lc->size) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+    for (int i = 0; i < b.size; i++) {
+        memset(b.iovs[i].iov_base, 'x', lc->size);
+        b.iovs[i].iov_len = lc->size;
+        b.msgs[i].msg_hdr.msg_name = NULL;
+        b.msgs[i].msg_hdr.msg_namelen = 0;
+    }
+    unsigned long errors = 0;
+    uint64_t total = 0; /* Datagrams scheduled so far */
+    int next = 0;
+    uint64_t start = now_ns(), end = start + lc->duration * 1000000000ULL;
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= end || stop_requested) {
+            break;
+        }
+        uint64_t due = lc->rate > 0 ? (uint64_t)((now - start) * lc->rate / 1e9) + 1
+                                    : total + lc->batch;
+        if (due <= total) {
+            /* Ahead of schedule: sleep until the next datagram is due */
+            uint64_t at = start + (uint64_t)(total * 1e9 / lc->rate);
+            if (at > now + 20000) {
+                struct timespec ts = { 0, (long)(at - now - 10000) };
+                nanosleep(&ts, NULL);
+            }
+            continue;
+        }
+        int k = due - total < (uint64_t)lc->batch ? (int)(due - total) : lc->batch;
+        struct load_flow *f = &flows[next];
+        next = (next + 1) % lc->flows;
+        for (int i = 0; i < k; i++) {
+            struct load_header h = { LOAD_MAGIC, (uint32_t)(f - flows), f->tx_seq++, now };
+            if (lc->rate > 0) {
+                h.sent_ns = start + (uint64_t)((total + i) * 1e9 / lc->rate);
+            }
+            memcpy(b.iovs[i].iov_base, &h, sizeof(h));
+        }
+        total += k;
+        int n = sendmmsg(f->fd, b.msgs, k, 0);
+        if (n < 0) {
+            n = 0; /* ECONNREFUSED from an earlier datagram, ENOBUFS, ... */
+        }
+        errors += k - n;
+        atomic_fetch_add_explicit(sent, n, memory_order_relaxed);
+    }
+    batch_free(&b);
+    return errors;
+}
+
+/* Load generator function */
+void run_load(const char *server_ip, int port, const struct load_config *lc) {
+    struct load_flow *flows = calloc(lc->flows, sizeof(*flows));
+    struct load_receiver r;
+    memset(&r, 0, sizeof(r));
+    atomic_ulong sent = 0;
+    r.flows = flows;
+    r.lc = lc;
+    r.sent = &sent;
+    r.epfd = epoll_create1(0);
+    if (!flows || r.epfd < 0 || hdr_hist_init(&r.rtt, LOAD_MAX_RTT_NS, 7) < 0 ||
+        hdr_hist_init(&r.interval, LOAD_MAX_RTT_NS, 7) < 0) {
+        fprintf(stderr, "Cannot set up the load generator\n");
+        exit(1);
+    }
+    for (int i = 0; i < lc->flows; i++) {
+        flows[i].fd = -1;
+    }
+    if (open_load_flows(server_ip, port, flows, lc->flows, r.epfd) < 0 ||
+        pthread_create(&r.tid, NULL, load_receive, &r) != 0) {
+        exit(1);
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    if (lc->rate > 0) {
+        printf("Sending %d-byte datagrams to %s:%d at %.0f/s over %d flows for %d s\n", lc->size,
+               server_ip, port, lc->rate, lc->flows, lc->duration);
+    } else {
+        printf("Sending %d-byte datagrams to %s:%d as fast as possible over %d flows for %d s\n",
+               lc->size, server_ip, port, lc->flows, lc->duration);
+    }
+    fflush(stdout);
+
+    uint64_t start = now_ns();
+    unsigned long errors = load_send(lc, flows, &sent);
+    double secs = (now_ns() - start) / 1e9;
+    usleep(LOAD_DRAIN_MS * 1000);
+    r.stop = 1;
+    pthread_join(r.tid, NULL);
+
+    unsigned long total = atomic_load(&sent);
+    unsigned long lost = total > r.received ? total - r.received : 0;
+    const struct hdr_hist *h = &r.rtt;
+    printf("Sent %lu datagrams in %.1f s (%.0f/s), %lu refused by the kernel\n", total, secs,
+           secs > 0 ? total / secs : 0.0, errors);
+    printf("Received %lu replies: %lu lost (%.3f%%), %lu reordered, %lu foreign\n", r.received,
+           lost, total ? 100.0 * lost / total : 0.0, r.reordered, r.foreign);
+    if (h->total) {
+        printf("RTT us: min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", h->min / 1e3,
+               hdr_hist_percentile(h, 50) / 1e3, hdr_hist_percentile(h, 90) / 1e3,
+               hdr_hist_percentile(h, 99) / 1e3, hdr_hist_percentile(h, 99.9) / 1e3,
+               h->max / 1e3);
+    }
+    for (int i = 0; i < lc->flows; i++) {
+        close(flows[i].fd);
+    }
+    close(r.epfd);
+    hdr_hist_free(&r.rtt);
+    hdr_hist_free(&r.interval);
+    free(flows);
+}
+
+/* One rserver connection's checks */
+struct rsink_conn {
+    uint32_t next_seq[RUDP_MAX_STREAMS];    /* Next in-order message per stream */
+    unsigned long msgs, bytes;
+    unsigned long out_of_order;             /* Unordered messages that overtook */
+    unsigned long corrupt;                  /* Bad header, content or order */
+};
+
+/* rserver state shared with the transport's callbacks */
+struct rsink {
+    struct hdr_hist latency;                /* Queue-to-delivery times (ns) */
+    struct hdr_hist interval;               /* ...since the last report */
+    unsigned long msgs, bytes, corrupt, out_of_order;
+    int verbose;
+};
+
+/* Function to check one message rsend sent. Returns 1 if it is intact. */
+static int rmsg_check(const struct rmsg_header *h, const char *data, size_t len) {
+    if (len < sizeof(*h) || h->magic != RMSG_MAGIC) {
+        return 0;
+    }
+    for (size_t i = sizeof(*h); i < len; i++) {
+        if ((unsigned char)data[i] != (unsigned char)(h->seq + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* rserver callback: check and time each delivered message */
+static void rsink_message(struct rudp_conn *c, uint16_t stream, const void *data, size_t len,
+                          void *arg) {
+    struct rsink *sk = arg;
+    struct rsink_conn *rc = rudp_context(c);
+    struct rmsg_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(&h, data, len < sizeof(h) ? len : sizeof(h));
+    if (!rc) {
+        return;
+    }
+    rc->msgs++;
+    rc->bytes += len;
+    if (!rmsg_check(&h, data, len)) {
+        rc->corrupt++;
+        return;
+    }
+    /* Ordered messages must arrive exactly in sequence; unordered ones only
+     * never twice */
+    if (h.seq == rc->next_seq[stream]) {
+        rc->next_seq[stream]++;
+    } else if (h.seq > rc->next_seq[stream]) {
+        rc->out_of_order++;
+        rc->next_seq[stream] = h.seq + 1;
+    } else {
+        rc->out_of_order++;
+    }
+    uint64_t now = now_ns();
+    hdr_hist_record(&sk->interval, now > h.sent_ns ? now - h.sent_ns : 0);
+}
+
+/* rserver callback: set up and report connections */
+static void rsink_event(struct rudp_conn *c, enum rudp_event ev, void *arg) {
+    struct rsink *sk = arg;
+    const struct sockaddr_in *peer = rudp_peer(c);
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &peer->sin_addr, ip, sizeof(ip));
+    if (ev == RUDP_EV_ACCEPTED) {
+        rudp_set_context(c, calloc(1, sizeof(struct rsink_conn)));
+        printf("Connection from %s:%d\n", ip, ntohs(peer->sin_port));
+        fflush(stdout);
+        return;
+    }
+    struct rsink_conn *rc = rudp_context(c);
+    if (ev != RUDP_EV_CLOSED || !rc) {
+        return;
+    }
+    struct rudp_stats st;
+    rudp_conn_stats(c, &st);
+    printf("Connection from %s:%d closed: %lu messages (%lu bytes), %lu overtaking, "
+           "%lu corrupt, %lu duplicate fragments, %lu acks sent\n", ip, ntohs(peer->sin_port),
+           rc->msgs, rc->bytes, rc->out_of_order, rc->corrupt, st.duplicates, st.acks_sent);
+    fflush(stdout);
+    sk->msgs += rc->msgs;
+    sk->bytes += rc->bytes;
+    sk->corrupt += rc->corrupt;
+    sk->out_of_order += rc->out_of_order;
+    free(rc);
+}
+
+/* Function to print the p50 / p99 / max of a latency histogram in ms */
+static void print_latency(const char *what, const struct hdr_hist *h) {
+    printf("%s p50 %.2f p99 %.2f p99.9 %.2f max %.2f ms", what, hdr_hist_percentile(h, 50) / 1e6,
+           hdr_hist_percentile(h, 99) / 1e6, hdr_hist_percentile(h, 99.9) / 1e6,
+           h->total ? h->max / 1e6 : 0.0);
+}
+
+/* Reliable server function: accept connections and check their messages */
+void run_rserver(int port, const struct reliable_config *rcfg) {
+    struct rsink sk;
+    memset(&sk, 0, sizeof(sk));
+    if (hdr_hist_init(&sk.latency, LOAD_MAX_RTT_NS, 7) < 0 ||
+        hdr_hist_init(&sk.interval, LOAD_MAX_RTT_NS, 7) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    struct rudp_config cfg;
+    rudp_config_init(&cfg);
+    cfg.cc = rcfg->cc;
+    cfg.accept = 1;
+    cfg.on_message = rsink_message;
+    cfg.on_event = rsink_event;
+    cfg.arg = &sk;
+    struct rudp_endpoint *ep = rudp_open(port, &cfg);
+    if (!ep) {
+        exit(1);
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    printf("Reliable UDP server listening on port %d\n", port);
+    fflush(stdout);
+
+    int64_t start = now_ms(), last = start;
+    while (!stop_requested && (rcfg->duration == 0 || now_ms() - start < rcfg->duration * 1000LL)) {
+        if (rudp_poll(ep, 100) < 0) {
+            break;
+        }
+        int64_t now = now_ms();
+        if (now - last < 1000) {
+            continue;
+        }
+        const struct hdr_hist *h = &sk.interval;
+        if (h->total) {
+            printf("%7.1f s: %10.0f messages/s, latency", (now - start) / 1000.0,
+                   h->total * 1000.0 / (now - last));
+            print_latency("", h);
+            printf("\n");
+            fflush(stdout);
+        }
+        hdr_hist_merge(&sk.latency, h);
+        hdr_hist_reset(&sk.interval);
+        last = now;
+    }
+    hdr_hist_merge(&sk.latency, &sk.interval);
+    rudp_endpoint_close(ep); /* Open connections are dropped without their summary */
+    printf("%lu messages checked, %lu corrupt, %lu overtaking; latency", sk.latency.total,
+           sk.corrupt, sk.out_of_order);
+    print_latency("", &sk.latency);
+    printf("\n");
+    hdr_hist_free(&sk.latency);
+    hdr_hist_free(&sk.interval);
+}
+
+/* rsend state shared with the transport's callbacks */
+struct rsource {
+    int established;
+    int closed;
+    struct rudp_stats final;    /* Counters when the connection closed */
+};
+
+/* rsend callback: follow the connection's state */
+static void rsource_event(struct rudp_conn *c, enum rudp_event ev, void *arg) {
+    struct rsource *src = arg;
+    if (ev == RUDP_EV_ESTABLISHED) {
+        src->established = 1;
+    } else if (ev == RUDP_EV_CLOSED) {
+        rudp_conn_stats(c, &src->final);
+        src->closed = 1;
+    }
+}
+
+/* Function to print rsend's view of the connection */
+static void print_rsend_stats(const struct rudp_stats *st) {
+    printf("cwnd %6.1f KB, srtt %7.2f ms, %s, %lu retransmitted, %lu lost (%lu spurious), "
+           "%lu PTOs", st->cwnd / 1024.0, st->srtt_ns / 1e6, st->cc_state, st->retransmits,
+           st->lost, st->spurious, st->ptos);
+}
+
+/* Reliable client function: stream checkable messages to an rserver */
+void run_rsend(const char *server_ip, int port, const struct reliable_config *rcfg) {
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid server IP: %s\n", server_ip);
+        exit(1);
+    }
+    struct rsource src;
+    memset(&src, 0, sizeof(src));
+    struct rudp_config cfg;
+    rudp_config_init(&cfg);
+    cfg.cc = rcfg->cc;
+    cfg.on_event = rsource_event;
+    cfg.arg = &src;
+    struct rudp_endpoint *ep = rudp_open(0, &cfg);
+    char *msg = malloc(rcfg->size);
+    uint32_t *seqs = calloc(rcfg->streams, sizeof(*seqs));
+    struct rudp_conn *c = ep ? rudp_connect(ep, &server_addr) : NULL;
+    if (!c || !msg || !seqs) {
+        fprintf(stderr, "Cannot start the reliable client\n");
+        exit(1);
+    }
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    printf("Sending %d-byte %smessages to %s:%d over %d streams with %s, ", rcfg->size,
+           rcfg->unordered ? "unordered " : "", server_ip, port, rcfg->streams,
+           rudp_cc_name(rcfg->cc));
+    if (rcfg->rate > 0) {
+        printf("%.0f/s for %d s\n", rcfg->rate, rcfg->duration);
+    } else {
+        printf("as fast as the window allows for %d s\n", rcfg->duration);
+    }
+    fflush(stdout);
+
+    /* Queue messages on schedule (or whenever the transport takes them) */
+    uint64_t start = now_ns(), end = start + rcfg->duration * 1000000000ULL;
+    uint64_t last = start, total = 0, blocked = 0;
+    struct rudp_stats st, prev;
+    memset(&prev, 0, sizeof(prev));
+    while (!src.closed && !stop_requested && now_ns() < end) {
+        uint64_t now = now_ns();
+        uint64_t due = rcfg->rate > 0 ? (uint64_t)((now - start) * rcfg->rate / 1e9) + 1
+                                      : total + RUDP_STREAM_WINDOW;
+        int full = 0;
+        while (total < due) {
+            int stream = total % rcfg->streams;
+            struct rmsg_header h = { RMSG_MAGIC, seqs[stream], now };
+            memcpy(msg, &h, sizeof(h));
+            for (int i = sizeof(h); i < rcfg->size; i++) {
+                msg[i] = (char)(h.seq + i);
+            }
+            if (rudp_send(c, stream, msg, rcfg->size, rcfg->unordered ? RUDP_UNORDERED : 0) < 0) {
+                blocked++; /* Window or send buffer full: the schedule slips */
+                full = 1;
+                break;
+            }
+            seqs[stream]++;
+            total++;
+        }
+        if (rudp_poll(ep, full || rcfg->rate > 0 ? 1 : 0) < 0) {
+            break;
+        }
+        now = now_ns();
+        if (now - last >= 1000000000ULL && !src.closed) {
+            rudp_conn_stats(c, &st);
+            double secs = (now - last) / 1e9;
+            printf("%7.1f s: %8.0f messages/s acked, %8.2f Mbit/s, ", (now - start) / 1e9,
+                   (st.msgs_acked - prev.msgs_acked) / secs,
+                   (st.msgs_acked - prev.msgs_acked) * rcfg->size * 8 / secs / 1e6);
+            print_rsend_stats(&st);
+            printf("\n");
+            fflush(stdout);
+            prev = st;
+            last = now;
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    /* Let the last messages be acknowledged, then close */
+    uint64_t drain_end = now_ns() + RSEND_DRAIN_SECONDS * 1000000000ULL;
+    while (!src.closed && !rudp_idle(c) && now_ns() < drain_end) {
+        if (rudp_poll(ep, 10) < 0) {
+            break;
+        }
+    }
+    if (!src.closed) {
+        rudp_conn_stats(c, &src.final);
+        rudp_close(c);
+    }
+    uint64_t close_end = now_ns() + 2000000000ULL;
+    while (!src.closed && now_ns() < close_end) {
+        rudp_poll(ep, 10);
+    }
+    st = src.final;
+    printf("Sent %lu messages in %.1f s, %lu acknowledged: %.2f Mbit/s of messages, "
+           "%lu times the window was full\n", (unsigned long)total, secs, st.msgs_acked,
+           secs > 0 ? st.msgs_acked * rcfg->size * 8 / secs / 1e6 : 0.0, (unsigned long)blocked);
+    printf("%lu data packets, %lu bytes sent, min RTT %.2f ms, ", st.packets_sent, st.bytes_sent,
+           st.min_rtt_ns / 1e6);
+    print_rsend_stats(&st);
+    printf("\n");
+    rudp_endpoint_close(ep);
+    free(msg);
+    free(seqs);
+}
+
+/* A datagram the relay is holding back */
+struct relay_packet {
+    uint64_t release_ns;        /* When to send it on */
+    int fd;                     /* Socket to send it on */
+    struct sockaddr_in to;      /* Client it goes to (server side: connected) */
+    int to_client;
+    size_t len;
+    char data[];
+};
+
+/* One direction through the relay */
+struct relay_link {
+    const char *name;
+    uint64_t free_ns;           /* When the bottleneck has sent all it holds */
+    unsigned long forwarded, dropped, overflowed;
+};
+
+/* The relay's state */
+struct relay {
+    const struct relay_config *cfg;
+    struct relay_packet **heap; /* Min-heap by release time */
+    size_t heap_len, heap_cap;
+    struct relay_link up, down; /* Client to server, server to client */
+};
+
+/* Function to add a packet to the release heap. Returns 0, or -1 if out of memory. */
+static int relay_push(struct relay *r, struct relay_packet *p) {
+    if (r->heap_len == r->heap_cap) {
+        size_t cap = r->heap_cap ? r->heap_cap * 2 : 1024;
+        struct relay_packet **h = realloc(r->heap, cap * sizeof(*h));
+        if (!h) {
+            return -1;
+        }
+        r->heap = h;
+        r->heap_cap = cap;
+    }
+    size_t i = r->heap_len++;
+    while (i > 0 && r->heap[(i - 1) / 2]->release_ns > p->release_ns) {
+        r->heap[i] = r->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    r->heap[i] = p;
+    return 0;
+}
+
+/* Function to take the earliest packet off the release heap */
+static struct relay_packet *relay_pop(struct relay *r) {
+    struct relay_packet *top = r->heap[0], *last = r->heap[--r->heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= r->heap_len) {
+            break;
+        }
+        if (child + 1 < r->heap_len &&
+            r->heap[child + 1]->release_ns < r->heap[child]->release_ns) {
+            child++;
+        }
+        if (r->heap[child]->release_ns >= last->release_ns) {
+            break;
+        }
+        r->heap[i] = r->heap[child];
+        i = child;
+    }
+    if (r->heap_len > 0) {
+        r->heap[i] = last;
+    }
+    return top;
+}
+
+/* Function to pass one datagram through a link: drop it at random, queue it
+ * behind the bottleneck (or drop it if the queue is full), then delay it */
+static void relay_forward(struct relay *r, struct relay_link *l, int fd,
+                          const struct sockaddr_in *to, const char *data, size_t len,
+                          uint64_t now) {
+    const struct relay_config *cfg = r->cfg;
+    if (cfg->loss > 0 && drand48() < cfg->loss) {
+        l->dropped++;
+        return;
+    }
+    uint64_t depart = now;
+    if (cfg->rate_mbit > 0) {
+        uint64_t begin = l->free_ns > now ? l->free_ns : now;
+        double backlog = (begin - now) * cfg->rate_mbit / 8e3; /* Bytes */
+        if (backlog + len > cfg->queue_kb * 1024.0) {
+            l->overflowed++;
+            return;
+        }
+        depart = begin + (uint64_t)(len * 8e3 / cfg->rate_mbit);
+        l->free_ns = depart;
+    }
+    struct relay_packet *p = malloc(sizeof(*p) + len);
+    if (!p) {
+        l->dropped++;
+        return;
+    }
+    p->release_ns = depart + cfg->delay_ms * 1000000ULL +
+                    (cfg->jitter_ms > 0 ? (uint64_t)(drand48() * cfg->jitter_ms * 1e6) : 0);
+    p->fd = fd;
+    p->to_client = to != NULL;
+    if (to) {
+        p->to = *to;
+    }
+    p->len = len;
+    memcpy(p->data, data, len);
+    if (relay_push(r, p) < 0) {
+        free(p);
+        l->dropped++;
+        return;
+    }
+    l->forwarded++;
+}
+
+/* Function to print a link's counters */
+static void print_link(const struct relay_link *l) {
+    printf("%s %lu forwarded, %lu dropped, %lu overflowed", l->name, l->forwarded, l->dropped,
+           l->overflowed);
+}
+
+/* Relay function: carry datagrams between clients on cfg->listen_port and the
+ * server, impaired as configured */
+void run_relay(const char *server_ip, int port, const struct relay_config *cfg) {
+    int lfd = open_server_socket(cfg->listen_port, 0, 0);
+    if (lfd < 0) {
+        exit(1);
+    }
+    struct relay r;
+    memset(&r, 0, sizeof(r));
+    r.cfg = cfg;
+    r.up.name = "client->server";
+    r.down.name = "server->client";
+    struct sockaddr_in clients[RELAY_MAX_PEERS];
+    struct pollfd pfds[RELAY_MAX_PEERS + 1];
+    int npeers = 0;
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+    srand48(now_ns());
+    printf("Relaying port %d to %s:%d: %.1f%% loss, %d ms delay + up to %d ms jitter, ",
+           cfg->listen_port, server_ip, port, cfg->loss * 100, cfg->delay_ms, cfg->jitter_ms);
+    if (cfg->rate_mbit > 0) {
+        printf("%.1f Mbit/s bottleneck with a %d KB queue\n", cfg->rate_mbit, cfg->queue_kb);
+    } else {
+        printf("no bottleneck\n");
+    }
+    fflush(stdout);
+
+    char buf[SUPER_SLOT_SIZE];
+    int64_t start = now_ms(), last = start;
+    while (!stop_requested && (cfg->duration == 0 || now_ms() - start < cfg->duration * 1000LL)) {
+        /* Sleep until a datagram arrives or the next one is due out */
+        uint64_t now = now_ns();
+        uint64_t wait = 100000000ULL;
+        if (r.heap_len > 0) {
+            uint64_t due = r.heap[0]->release_ns;
+            wait = due > now ? (due - now < wait ? due - now : wait) : 0;
+        }
+        struct timespec ts = { 0, (long)wait };
+        if (ppoll(pfds, npeers + 1, &ts, NULL) < 0 && errno != EINTR) {
+            perror("ppoll failed");
+            break;
+        }
+
+        /* From clients: find (or open) the client's socket to the server */
+        now = now_ns();
+        for (int k = 0; k < DEFAULT_BATCH && (pfds[0].revents & POLLIN); k++) {
+            struct sockaddr_in from;
+            socklen_t fromlen = sizeof(from);
+            ssize_t n = recvfrom(lfd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from,
+                                 &fromlen);
+            if (n < 0) {
+                break;
+            }
+            int i = 0;
+            while (i < npeers && (clients[i].sin_addr.s_addr != from.sin_addr.s_addr ||
+                                  clients[i].sin_port != from.sin_port)) {
+                i++;
+            }
+            if (i == npeers) {
+                int fd = npeers < RELAY_MAX_PEERS ? open_client_socket(server_ip, port) : -1;
+                if (fd < 0) {
+                    r.up.dropped++;
+                    continue;
+                }
+                int bufsize = SOCKET_BUFFER;
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+                clients[i] = from;
+                pfds[i + 1].fd = fd;
+                pfds[i + 1].events = POLLIN;
+                pfds[i + 1].revents = 0;
+                npeers++;
+            }
+            relay_forward(&r, &r.up, pfds[i + 1].fd, NULL, buf, n, now);
+        }
+
+        /* From the server, back to whichever client the socket belongs to */
+        for (int i = 0; i < npeers; i++) {
+            for (int k = 0; k < DEFAULT_BATCH && (pfds[i + 1].revents & POLLIN); k++) {
+                ssize_t n = recv(pfds[i + 1].fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if (n < 0) {
+                    break;
+                }
+                relay_forward(&r, &r.down, lfd, &clients[i], buf, n, now);
+            }
+        }
+
+        /* Send on what is due */
+        now = now_ns();
+        while (r.heap_len > 0 && r.heap[0]->release_ns <= now) {
+            struct relay_packet *p = relay_pop(&r);
+            if (p->to_client) {
+                sendto(p->fd, p->data, p->len, 0, (struct sockaddr*)&p->to, sizeof(p->to));
+            } else {
+                send(p->fd, p->data, p->len, 0);
+            }
+            free(p);
+        }
+
+        int64_t ms = now_ms();
+        if (ms - last >= 1000 && r.up.forwarded + r.down.forwarded > 0) {
+            printf("%7.1f s: ", (ms - start) / 1000.0);
+            print_link(&r.up);
+            printf("; ");
+            print_link(&r.down);
+            printf("\n");
+            fflush(stdout);
+            last = ms;
+        }
+    }
+
+    print_link(&r.up);
+    printf("\n");
+    print_link(&r.down);
+    printf("\n");
+    while (r.heap_len > 0) {
+        free(relay_pop(&r));
+    }
+    free(r.heap);
+    for (int i = 0; i < npeers; i++) {
+        close(pfds[i + 1].fd);
+    }
+    close(lfd);
+}
+
+/* Function to print usage */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b batch] [-v] [-G] [-n] [-w workers] [-S flow|cpu|kernel]\n"
+            "       %*s [-d seconds] server [port]\n", prog, (int)strlen(prog), "");
+    fprintf(stderr, "       %s client <server_ip> [port]\n", prog);
+    fprintf(stderr, "       %s [-g] [-s size] [-b batch] [-d seconds] bulk <server_ip> [port]\n",
+            prog);
+    fprintf(stderr, "       %s [-s size] [-d seconds] bench [port]\n", prog);
+    fprintf(stderr, "       %s [-r rate] [-f flows] [-s size] [-b batch] [-d seconds] "
+            "load <server_ip> [port]\n", prog);
+    fprintf(stderr, "       %s [-C cubic|bbr] [-d seconds] rserver [port]\n", prog);
+    fprintf(stderr, "       %s [-C cubic|bbr] [-r rate] [-f streams] [-s size] [-U] [-d seconds] "
+            "rsend <server_ip> [port]\n", prog);
+    fprintf(stderr, "       %s [-l listen_port] [-L loss%%] [-D ms] [-J ms] [-B Mbit/s] [-Q KB] "
+            "relay <server_ip> [port]\n", prog);
+    fprintf(stderr, "  -b  datagrams per recvmmsg/sendmmsg (1-%d, default %d)\n", MAX_BATCH,
+            DEFAULT_BATCH);
+    fprintf(stderr, "  -v  print every datagram\n");
+    fprintf(stderr, "  -G  receive with UDP_GRO (coalesced super-datagrams)\n");
+    fprintf(stderr, "  -n  count datagrams without echoing them\n");
+    fprintf(stderr, "  -w  worker threads, each pinned with its own SO_REUSEPORT socket "
+            "(1-%d, default 1)\n", MAX_WORKERS);
+    fprintf(stderr, "  -S  how datagrams pick a worker: flow (source hash, default), cpu\n"
+            "      (receiving CPU) or kernel (no BPF program)\n");
+    fprintf(stderr, "  -g  send bulk data with UDP_SEGMENT (GSO), 64 KB per send\n");
+    fprintf(stderr, "  -s  bulk datagram size (default %d) or load datagram size (default %d)\n",
+            DEFAULT_SEGMENT, DEFAULT_LOAD_SIZE);
+    fprintf(stderr, "      or rsend message size (default %d)\n", DEFAULT_MESSAGE_SIZE);
+    fprintf(stderr, "  -r  load datagrams or rsend messages per second (0 = as fast as possible, "
+            "default %d)\n", DEFAULT_LOAD_RATE);
+    fprintf(stderr, "  -f  load flows, each from its own port, or rsend streams "
+            "(1-%d, default %d)\n", MAX_LOAD_FLOWS, DEFAULT_LOAD_FLOWS);
+    fprintf(stderr, "  -C  congestion controller of the reliable modes (default cubic)\n");
+    fprintf(stderr, "  -U  rsend: deliver messages as they complete, not in stream order\n");
+    fprintf(stderr, "  -l  relay: port to listen on (default the server's port + %d)\n",
+            RELAY_PORT_OFFSET);
+    fprintf(stderr, "  -L  relay: percent of datagrams to drop each way\n");
+    fprintf(stderr, "  -D  relay: one-way delay to add (ms); -J up to this much more at random\n");
+    fprintf(stderr, "  -B  relay: bottleneck rate each way (Mbit/s); "
+            "-Q its queue (KB, default %d)\n", DEFAULT_RELAY_QUEUE_KB);
+    fprintf(stderr, "  -d  stop the server after this many seconds; bulk, bench and load run time\n"
+            "      (default %d)\n", DEFAULT_BULK_SECONDS);
+    fprintf(stderr, "Example: %s server 7000\n", prog);
+    fprintf(stderr, "         %s client 127.0.0.1 7000\n", prog);
+    fprintf(stderr, "         %s -w 4 -S cpu server 7000\n", prog);
+    fprintf(stderr, "         %s -r 200000 -f 8 load 127.0.0.1 7000\n", prog);
+    fprintf(stderr, "         %s rserver 7000 & %s -L 2 -D 10 -B 50 relay 127.0.0.1 7000 &\n",
+            prog, prog);
+    fprintf(stderr, "         %s -r 0 -f 8 rsend 127.0.0.1 7001\n", prog);
+    fprintf(stderr, "         %s -G -n server 7000 & %s -g bulk 127.0.0.1 7000\n", prog, prog);
+    exit(1);
+}
+
 /* Main function: Entry point of the UDP service */
 int main(int argc, char *argv[]) {
-    /* Check command-line arguments */
+    const char *prog = argv[0];
+    struct server_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.port = DEFAULT_PORT;
+    cfg.batch = DEFAULT_BATCH;
+    cfg.workers = 1;
+    cfg.steer = STEER_FLOW;
+    struct bulk_config bc;
+    memset(&bc, 0, sizeof(bc));
+    bc.segment = DEFAULT_SEGMENT;
+    struct load_config lc;
+    memset(&lc, 0, sizeof(lc));
+    lc.rate = DEFAULT_LOAD_RATE;
+    lc.flows = DEFAULT_LOAD_FLOWS;
+    int size = 0;
+    struct reliable_config rc;
+    memset(&rc, 0, sizeof(rc));
+    rc.cc = RUDP_CC_CUBIC;
+    struct relay_config relay;
+    memset(&relay, 0, sizeof(relay));
+    relay.queue_kb = DEFAULT_RELAY_QUEUE_KB;
+
+    /* Parse options */
+    int opt;
+    while ((opt = getopt(argc, argv, "b:vd:Gngs:w:S:r:f:C:Ul:L:D:J:B:Q:")) != -1) {
+        switch (opt) {
+        case 'b':
+            cfg.batch = atoi(optarg);
+            break;
+        case 'v':
+            cfg.verbose = 1;
+            break;
+        case 'd':
+            cfg.duration = atoi(optarg);
+            break;
+        case 'G':
+            cfg.gro = 1;
+            break;
+        case 'n':
+            cfg.sink = 1;
+            break;
+        case 'g':
+            bc.gso = 1;
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'r':
+            lc.rate = atof(optarg);
+            break;
+        case 'f':
+            lc.flows = atoi(optarg);
+            break;
+        case 'C':
+            if (strcmp(optarg, "cubic") == 0) {
+                rc.cc = RUDP_CC_CUBIC;
+            } else if (strcmp(optarg, "bbr") == 0) {
+                rc.cc = RUDP_CC_BBR;
+            } else {
+                usage(prog);
+            }
+            break;
+        case 'U':
+            rc.unordered = 1;
+            break;
+        case 'l':
+            relay.listen_port = atoi(optarg);
+            break;
+        case 'L':
+            relay.loss = atof(optarg) / 100;
+            break;
+        case 'D':
+            relay.delay_ms = atoi(optarg);
+            break;
+        case 'J':
+            relay.jitter_ms = atoi(optarg);
+            break;
+        case 'B':
+            relay.rate_mbit = atof(optarg);
+            break;
+        case 'Q':
+            relay.queue_kb = atoi(optarg);
+            break;
+        case 'w':
+            cfg.workers = atoi(optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "flow") == 0) {
+                cfg.steer = STEER_FLOW;
+            } else if (strcmp(optarg, "cpu") == 0) {
+                cfg.steer = STEER_CPU;
+            } else if (strcmp(optarg, "kernel") == 0) {
+                cfg.steer = STEER_KERNEL;
+            } else {
+                usage(prog);
+            }
+            break;
+        default:
+            usage(prog);
+        }
+    }
+    bc.segment = size ? size : DEFAULT_SEGMENT;
+    lc.size = size ? size : DEFAULT_LOAD_SIZE;
+    if (cfg.batch < 1 || cfg.batch > MAX_BATCH || cfg.duration < 0 || size < 0 ||
+        size > RUDP_MAX_MESSAGE || cfg.workers < 1 || cfg.workers > MAX_WORKERS ||
+        lc.rate < 0 || lc.flows < 1 || lc.flows > MAX_LOAD_FLOWS || relay.loss < 0 ||
+        relay.loss > 1 || relay.delay_ms < 0 || relay.jitter_ms < 0 || relay.rate_mbit < 0 ||
+        relay.queue_kb < 1) {
+        usage(prog);
+    }
+    rc.size = size ? size : DEFAULT_MESSAGE_SIZE;
+    rc.rate = lc.rate;
+    rc.streams = lc.flows > RUDP_MAX_STREAMS ? RUDP_MAX_STREAMS : lc.flows;
+    rc.duration = cfg.duration;
+    relay.duration = cfg.duration;
+    bc.batch = cfg.batch;
+    bc.duration = cfg.duration ? cfg.duration : DEFAULT_BULK_SECONDS;
+    lc.batch = cfg.batch;
+    lc.duration = bc.duration;
+
+    /* Check command-line arguments (the mode becomes argv[1]) */
+    argc -= optind - 1;
+    argv += optind - 1;
     if (argc < 2 || argc > 4) {
-        fprintf(stderr, "Usage: %s server [port]\n", argv[0]);
-        fprintf(stderr, "       %s client <server_ip> [port]\n", argv[0]);
-        fprintf(stderr, "Example: %s server 7000\n", argv[0]);
-        fprintf(stderr, "         %s client 127.0.0.1 7000\n", argv[0]);
-        exit(1);
+        usage(prog);
     }
 
-    /* Pointers to arguments */
+    /* Pointers to arguments: client, bulk and load take the server's address first */
     char *mode = argv[1];
-    int port = (argc == 3 && strcmp(mode, "server") == 0) ? atoi(argv[2]) :
-               (argc == 4 && strcmp(mode, "client") == 0) ? atoi(argv[3]) : DEFAULT_PORT;
-    char *server_ip = (strcmp(mode, "client") == 0) ? argv[2] : NULL;
+    int needs_ip = strcmp(mode, "client") == 0 || strcmp(mode, "bulk") == 0 ||
+                   strcmp(mode, "load") == 0 || strcmp(mode, "rsend") == 0 ||
+                   strcmp(mode, "relay") == 0;
+    char *server_ip = needs_ip ? argv[2] : NULL;
+    int port_arg = needs_ip ? 3 : 2;
+    int port = argc > port_arg ? atoi(argv[port_arg]) : DEFAULT_PORT;
+    if (needs_ip && !server_ip) {
+        fprintf(stderr, "%s mode requires server IP\n", mode);
+        exit(1);
+    }
 
-    /* Run in server or client mode */
+    /* Run in the chosen mode */
     if (strcmp(mode, "server") == 0) {
-        run_server(port);
+        cfg.port = port;
+        run_server(&cfg);
     } else if (strcmp(mode, "client") == 0) {
-        if (!server_ip) {
-            fprintf(stderr, "Client mode requires server IP\n");
+        run_client(server_ip, port);
+    } else if (strcmp(mode, "bulk") == 0 || strcmp(mode, "bench") == 0) {
+        if (bc.segment < 1 || bc.segment > MAX_UDP_PAYLOAD) {
+            fprintf(stderr, "Segments must be 1 to %d bytes\n", MAX_UDP_PAYLOAD);
             exit(1);
         }
-        run_client(server_ip, port);
+        if (strcmp(mode, "bulk") == 0) {
+            run_bulk(server_ip, port, &bc);
+        } else {
+            run_bench(port, &bc);
+        }
+    } else if (strcmp(mode, "load") == 0) {
+        if (lc.size < (int)sizeof(struct load_header) || lc.size > MAX_UDP_PAYLOAD) {
+            fprintf(stderr, "Load datagrams must be %zu to %d bytes\n",
+                    sizeof(struct load_header), MAX_UDP_PAYLOAD);
+            exit(1);
+        }
+        run_load(server_ip, port, &lc);
+    } else if (strcmp(mode, "rserver") == 0) {
+        run_rserver(port, &rc);
+    } else if (strcmp(mode, "rsend") == 0) {
+        if (rc.size < (int)sizeof(struct rmsg_header)) {
+            fprintf(stderr, "Messages need at least %zu bytes\n", sizeof(struct rmsg_header));
+            exit(1);
+        }
+        rc.duration = bc.duration;
+        run_rsend(server_ip, port, &rc);
+    } else if (strcmp(mode, "relay") == 0) {
+        if (relay.listen_port == 0) {
+            relay.listen_port = port + RELAY_PORT_OFFSET;
+        }
+        run_relay(server_ip, port, &relay);
     } else {
-        fprintf(stderr, "Invalid mode: use 'server' or 'client'\n");
+        fprintf(stderr, "Invalid mode: use 'server', 'client', 'bulk', 'bench', 'load', "
+                "'rserver', 'rsend' or 'relay'\n");
         exit(1);
     }
 
     return 0;
-}
\ No newline at end of file
+}
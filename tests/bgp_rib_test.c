@@ -0,0 +1,116 @@
+/* bgp_rib_test.c: Regression checks for Loc-RIB change notification. A destination
+ * whose best path is withdrawn must be reported even when none of the remaining
+ * paths may become best, so the FIB and Adj-RIB-Out drop the withdrawn route. */
+
+#include <stdio.h>        /* For printf, fprintf, FILE */
+#include <stdlib.h>       /* For mkstemp */
+#include <string.h>       /* For memset */
+#include <unistd.h>       /* For unlink */
+#include "bgp.h"          /* For bgp_put32 */
+#include "bgp_attr.h"     /* For struct bgp_attrs, bgp_attr_intern */
+#include "bgp_rib.h"      /* For struct bgp_rib, bgp_rib_* */
+#include "bgp_rpki.h"     /* For struct bgp_rpki, bgp_rpki_load */
+
+/* What the notify callback saw */
+struct notify_log {
+    int calls;                     /* Notifications received */
+    const struct bgp_path *best;   /* Best path at the last one */
+};
+
+/* Function to record a Loc-RIB change */
+static void record_notify(const struct bgp_dest *dest, void *arg) {
+    struct notify_log *log = arg;
+    log->calls++;
+    log->best = dest->best;
+}
+
+/* Function to intern an attribute set whose AS_PATH is one AS (the origin) */
+static const struct bgp_attrs *make_attrs(struct bgp_rib *rib, uint32_t next_hop,
+                                          uint32_t origin_as) {
+    union {
+        struct bgp_attrs a;
+        uint8_t buf[sizeof(struct bgp_attrs) + 6];
+    } u;
+    memset(&u, 0, sizeof(u));
+    u.a.next_hop = next_hop;
+    u.a.as_path_len = 6;
+    u.a.as_path_hops = 1;
+    u.a.data[0] = BGP_AS_SEQUENCE;
+    u.a.data[1] = 1;
+    bgp_put32(u.a.data + 2, origin_as);
+    return bgp_attr_intern(&rib->attrs, &u.a);
+}
+
+static int failures; /* Checks that did not hold */
+
+/* Record a failed check and keep going */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Withdrawing the Valid best path leaves only an Invalid one: with Invalid paths
+ * rejected the destination has no route, and that must be notified */
+static void test_withdraw_best_leaves_only_invalid(void) {
+    char vrp_path[] = "/tmp/bgp_rib_test.XXXXXX";
+    int fd = mkstemp(vrp_path);
+    if (fd < 0) {
+        perror("mkstemp");
+        failures++;
+        return;
+    }
+    FILE *f = fdopen(fd, "w");
+    fprintf(f, "ASN,IP Prefix,Max Length\nAS65001,10.0.0.0/8,8\n");
+    fclose(f);
+
+    struct bgp_rpki rpki;
+    bgp_rpki_init(&rpki);
+    long loaded = bgp_rpki_load(&rpki, NULL, vrp_path);
+    unlink(vrp_path);
+    CHECK(loaded >= 0);
+
+    struct bgp_rib rib;
+    struct notify_log log = {0, NULL};
+    bgp_rib_init(&rib);
+    rib.rpki = &rpki;
+    rib.reject_invalid = 1;
+    rib.notify = record_notify;
+    rib.notify_arg = &log;
+
+    struct bgp_adj_in valid_peer, invalid_peer;
+    bgp_adj_in_init(&valid_peer, 1, 0x0a000101, 65001, 1);
+    bgp_adj_in_init(&invalid_peer, 2, 0x0a000102, 65002, 1);
+    const struct bgp_attrs *valid = make_attrs(&rib, 0x0a000101, 65001);
+    const struct bgp_attrs *invalid = make_attrs(&rib, 0x0a000102, 65002);
+    CHECK(bgp_rib_update(&rib, &valid_peer, 0x0a000000, 8, valid) == 0);
+    CHECK(bgp_rib_update(&rib, &invalid_peer, 0x0a000000, 8, invalid) == 0);
+    bgp_attr_unref(&rib.attrs, valid);
+    bgp_attr_unref(&rib.attrs, invalid);
+    bgp_rib_process(&rib, 0);
+
+    struct bgp_dest *dest = bgp_rib_lookup(&rib, 0x0a000000, 8);
+    CHECK(dest && dest->best && dest->best->peer == &valid_peer);
+    CHECK(log.calls == 1 && log.best == (dest ? dest->best : NULL));
+
+    CHECK(bgp_rib_withdraw(&rib, &valid_peer, 0x0a000000, 8) == 1);
+    bgp_rib_process(&rib, 0);
+    CHECK(log.calls == 2);
+    CHECK(log.best == NULL);
+    CHECK(dest->paths && dest->best == NULL);
+
+    bgp_rib_destroy(&rib);
+    bgp_rpki_free(&rpki);
+}
+
+int main(void) {
+    test_withdraw_best_leaves_only_invalid();
+    if (failures) {
+        fprintf(stderr, "bgp_rib_test: %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("bgp_rib_test: all checks passed\n");
+    return 0;
+}